@@ -0,0 +1,186 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - Arena.cpp
+
+Abstract:
+
+    - Per-command bump allocator.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdlib.h>
+#include <new>
+#include <vector>
+using namespace std;
+
+#include "Arena.h"
+
+Arena g_CommandArena;
+ULONG ArenaScope::s_Depth = 0;
+
+Arena::Arena(
+) :
+    m_Current(NULL),
+    m_Used(0),
+    m_Capacity(0),
+    m_Bytes(0)
+{
+    InitializeCriticalSection(&m_Lock);
+    ResetStats();
+}
+
+Arena::~Arena(
+)
+{
+    Reset();
+    DeleteCriticalSection(&m_Lock);
+}
+
+PVOID
+Arena::Alloc(
+    SIZE_T Size
+)
+{
+    PVOID Buffer = NULL;
+    PUCHAR Chunk;
+
+    Size = (Size + (ARENA_ALIGNMENT - 1)) & ~((SIZE_T)ARENA_ALIGNMENT - 1);
+    if (!Size) Size = ARENA_ALIGNMENT;
+
+    EnterCriticalSection(&m_Lock);
+
+    if (Size > (ARENA_CHUNK_SIZE / 4))
+    {
+        //
+        // Large buffers (images) get a chunk of their own, the current chunk stays in use.
+        //
+        Chunk = (PUCHAR)malloc(Size);
+        if (Chunk == NULL) goto CleanUp;
+
+        m_Chunks.push_back(Chunk);
+        m_Stats.Chunks += 1;
+        Buffer = Chunk;
+    }
+    else
+    {
+        if ((m_Current == NULL) || ((m_Capacity - m_Used) < Size))
+        {
+            Chunk = (PUCHAR)malloc(ARENA_CHUNK_SIZE);
+            if (Chunk == NULL) goto CleanUp;
+
+            m_Chunks.push_back(Chunk);
+            m_Stats.Chunks += 1;
+            m_Current = Chunk;
+            m_Used = 0;
+            m_Capacity = ARENA_CHUNK_SIZE;
+        }
+
+        Buffer = m_Current + m_Used;
+        m_Used += Size;
+    }
+
+    m_Bytes += Size;
+
+    m_Stats.Allocations += 1;
+    m_Stats.Bytes += Size;
+    m_Stats.PeakBytes = max(m_Stats.PeakBytes, (ULONG64)m_Bytes);
+
+CleanUp:
+    LeaveCriticalSection(&m_Lock);
+
+    return Buffer;
+}
+
+VOID
+Arena::Reset(
+)
+{
+    EnterCriticalSection(&m_Lock);
+
+    for (ULONG i = 0; i < m_Chunks.size(); i += 1) free(m_Chunks[i]);
+
+    m_Chunks.clear();
+    m_Current = NULL;
+    m_Used = 0;
+    m_Capacity = 0;
+    m_Bytes = 0;
+
+    m_Stats.Resets += 1;
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+VOID
+Arena::ResetStats(
+)
+{
+    RtlZeroMemory(&m_Stats, sizeof(m_Stats));
+}
+
+SIZE_T
+Arena::GetBytes(
+)
+{
+    SIZE_T Bytes;
+
+    EnterCriticalSection(&m_Lock);
+    Bytes = m_Bytes;
+    LeaveCriticalSection(&m_Lock);
+
+    return Bytes;
+}
+
+ULONG
+Arena::GetNumberOfChunks(
+)
+{
+    ULONG NumberOfChunks;
+
+    EnterCriticalSection(&m_Lock);
+    NumberOfChunks = (ULONG)m_Chunks.size();
+    LeaveCriticalSection(&m_Lock);
+
+    return NumberOfChunks;
+}
+
+ArenaScope::ArenaScope(
+)
+{
+    s_Depth += 1;
+}
+
+ArenaScope::~ArenaScope(
+)
+{
+    s_Depth -= 1;
+
+    if (s_Depth == 0) g_CommandArena.Reset();
+}
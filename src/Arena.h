@@ -0,0 +1,171 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - Arena.h
+
+Abstract:
+
+    - Per-command bump allocator. Buffers that belong to the objects built by
+      a command (images, strings, export/handle/VAD tables) are allocated from
+      the arena and released all at once when the command returns.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#define ARENA_CHUNK_SIZE (1024 * 1024)
+#define ARENA_ALIGNMENT 16
+
+class Arena {
+public:
+    typedef struct _ARENA_STATS {
+        ULONG64 Allocations;
+        ULONG64 Bytes;
+        ULONG64 Chunks; // Actual heap allocations.
+        ULONG64 Resets;
+        ULONG64 PeakBytes;
+    } ARENA_STATS, *PARENA_STATS;
+
+    Arena(
+    );
+
+    ~Arena(
+    );
+
+    //
+    // Thread-safe. The returned buffer is not zeroed.
+    //
+    PVOID
+    Alloc(
+        SIZE_T Size
+    );
+
+    //
+    // Releases every buffer handed out since the last reset.
+    //
+    VOID
+    Reset(
+    );
+
+    VOID
+    ResetStats(
+    );
+
+    //
+    // Bytes handed out since the last reset, and the heap chunks that hold them.
+    //
+    SIZE_T
+    GetBytes(
+    );
+
+    ULONG
+    GetNumberOfChunks(
+    );
+
+    ARENA_STATS m_Stats;
+
+private:
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
+
+    CRITICAL_SECTION m_Lock;
+
+    vector<PUCHAR> m_Chunks;
+    PUCHAR m_Current;
+    SIZE_T m_Used;
+    SIZE_T m_Capacity;
+    SIZE_T m_Bytes;
+};
+
+extern Arena g_CommandArena;
+
+//
+// Declared at the top of commands that build process/driver objects. The arena is reset
+// when the outermost scope exits, so scopes must not be used below the command level.
+//
+class ArenaScope {
+public:
+    ArenaScope(
+    );
+
+    ~ArenaScope(
+    );
+
+private:
+    static ULONG s_Depth;
+};
+
+//
+// Allocator for containers whose storage lives in the command arena.
+//
+template <typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+    typedef T &reference;
+    typedef const T &const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <typename U>
+    struct rebind {
+        typedef ArenaAllocator<U> other;
+    };
+
+    ArenaAllocator() {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>&) {}
+
+    T *allocate(size_t Count)
+    {
+        PVOID Buffer = g_CommandArena.Alloc(Count * sizeof(T));
+        if (Buffer == NULL) throw bad_alloc();
+
+        return (T *)Buffer;
+    }
+
+    void deallocate(T *, size_t)
+    {
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>&) const { return true; }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>&) const { return false; }
+};
+
+template <typename T>
+using ArenaVector = vector<T, ArenaAllocator<T>>;
+
+#endif
@@ -0,0 +1,229 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - CodeCache.cpp
+
+Abstract:
+
+    - Each code page is read from the target once, the module list once per
+      address space. Depends on the debugger engine only through the reader
+      and loader callbacks given to the constructor.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+using namespace std;
+
+#include "Disasm.h"
+#include "CodeCache.h"
+
+CodeCache::CodeCache(
+    PCODE_PAGE_READER Reader,
+    PCODE_MODULE_LOADER Loader,
+    PVOID Context
+) :
+    m_Reader(Reader),
+    m_Loader(Loader),
+    m_Context(Context)
+{
+    ResetStats();
+}
+
+const UCHAR *
+CodeCache::GetPage(
+    ULONG64 Tag,
+    ULONG64 PageBase
+)
+{
+    pair<ULONG64, ULONG64> Key(Tag, PageBase);
+    map<pair<ULONG64, ULONG64>, vector<UCHAR>>::iterator It;
+
+    m_Stats.PageLookups += 1;
+
+    It = m_Pages.find(Key);
+
+    if (It == m_Pages.end())
+    {
+        vector<UCHAR> Page(CODE_CACHE_PAGE_SIZE);
+
+        if (m_Pages.size() >= CODE_CACHE_MAX_PAGES) m_Pages.clear();
+
+        if (!m_Reader(m_Context, PageBase, &Page[0]))
+        {
+            m_Stats.PageFailures += 1;
+            Page.clear();
+        }
+
+        It = m_Pages.insert(make_pair(Key, vector<UCHAR>())).first;
+        It->second.swap(Page);
+    }
+    else
+    {
+        m_Stats.PageHits += 1;
+    }
+
+    return It->second.empty() ? NULL : &It->second[0];
+}
+
+ULONG
+CodeCache::Read(
+    ULONG64 Tag,
+    ULONG64 Address,
+    PUCHAR Buffer,
+    ULONG Size
+)
+{
+    ULONG Copied = 0;
+
+    while (Copied < Size)
+    {
+        ULONG64 PageBase = (Address + Copied) & ~((ULONG64)CODE_CACHE_PAGE_SIZE - 1);
+        ULONG Offset = (ULONG)((Address + Copied) - PageBase);
+        ULONG Length = min(Size - Copied, (ULONG)CODE_CACHE_PAGE_SIZE - Offset);
+        const UCHAR *Page = GetPage(Tag, PageBase);
+
+        if (!Page) break;
+
+        memcpy(Buffer + Copied, Page + Offset, Length);
+        Copied += Length;
+    }
+
+    return Copied;
+}
+
+CodeCache::PCODE_MODULE
+CodeCache::FindModule(
+    ULONG64 Tag,
+    ULONG64 Address
+)
+{
+    map<ULONG64, vector<CODE_MODULE>>::iterator It = m_Modules.find(Tag);
+    vector<CODE_MODULE>::iterator Module;
+
+    if (It == m_Modules.end())
+    {
+        vector<CODE_MODULE> Modules;
+
+        m_Loader(m_Context, Modules);
+        m_Stats.ModuleLists += 1;
+
+        sort(Modules.begin(), Modules.end(), [](const CODE_MODULE& a, const CODE_MODULE& b) { return a.Base < b.Base; });
+
+        It = m_Modules.insert(make_pair(Tag, vector<CODE_MODULE>())).first;
+        It->second.swap(Modules);
+    }
+
+    //
+    // Last module starting at or below Address.
+    //
+    Module = upper_bound(It->second.begin(), It->second.end(), Address,
+                         [](ULONG64 Value, const CODE_MODULE& Entry) { return Value < Entry.Base; });
+
+    if (Module == It->second.begin()) return NULL;
+
+    --Module;
+    if (Address >= Module->End) return NULL;
+
+    if (!Module->Bitness)
+    {
+        IMAGE_DOS_HEADER Dos;
+        IMAGE_FILE_HEADER File;
+
+        Module->Bitness = MAXUCHAR;
+
+        if ((Read(Tag, Module->Base, (PUCHAR)&Dos, sizeof(Dos)) == sizeof(Dos)) &&
+            (Dos.e_magic == IMAGE_DOS_SIGNATURE) &&
+            (Read(Tag, Module->Base + Dos.e_lfanew + sizeof(ULONG), (PUCHAR)&File, sizeof(File)) == sizeof(File)))
+        {
+            if (File.Machine == IMAGE_FILE_MACHINE_AMD64) Module->Bitness = 64;
+            else if (File.Machine == IMAGE_FILE_MACHINE_I386) Module->Bitness = 32;
+        }
+    }
+
+    return &(*Module);
+}
+
+BOOLEAN
+CodeCache::FindHook(
+    ULONG64 Tag,
+    ULONG64 Address,
+    BOOLEAN Is64Bit,
+    PX86_HOOK Hook
+)
+{
+    UCHAR Code[HOOK_SCAN_SIZE];
+    PCODE_MODULE Module;
+    ULONG64 ModuleBase = 0, ModuleEnd = 0;
+    ULONG Size;
+    BOOLEAN Found;
+
+    RtlZeroMemory(Hook, sizeof(*Hook));
+
+    m_Stats.Scans += 1;
+
+    Module = FindModule(Tag, Address);
+
+    if (Module)
+    {
+        ModuleBase = Module->Base;
+        ModuleEnd = Module->End;
+        if (Module->Bitness != MAXUCHAR) Is64Bit = (Module->Bitness == 64);
+    }
+    else
+    {
+        m_Stats.NoModule += 1;
+    }
+
+    Size = (ULONG)min((ULONG64)sizeof(Code), Module ? (ModuleEnd - Address) : sizeof(Code));
+    Size = Read(Tag, Address, Code, Size);
+
+    Found = X86FindHook(Code, Size, Address, Is64Bit, ModuleBase, ModuleEnd, HOOK_SCAN_DEPTH, Hook);
+    if (Found) m_Stats.Hooks += 1;
+
+    return Found;
+}
+
+VOID
+CodeCache::Flush(
+)
+{
+    m_Pages.clear();
+    m_Modules.clear();
+}
+
+VOID
+CodeCache::ResetStats(
+)
+{
+    RtlZeroMemory(&m_Stats, sizeof(m_Stats));
+}
@@ -0,0 +1,134 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - CodeCache.h
+
+Abstract:
+
+    - Code pages and module ranges of the target, for the inline hook
+      checks run on many entry points by a single command.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __CODECACHE_H__
+#define __CODECACHE_H__
+
+#define CODE_CACHE_PAGE_SIZE 0x1000
+#define CODE_CACHE_MAX_PAGES 4096 // 16MB, flushed as a whole when full.
+
+//
+// Returns TRUE if the whole page at Address has been read into Buffer.
+//
+typedef BOOLEAN (*PCODE_PAGE_READER)(PVOID Context, ULONG64 Address, PUCHAR Buffer);
+
+class CodeCache {
+public:
+    typedef struct _CODE_MODULE {
+        ULONG64 Base;
+        ULONG64 End;
+        UCHAR Bitness; // 32 or 64 from the PE header, 0 until read, MAXUCHAR if unknown.
+    } CODE_MODULE, *PCODE_MODULE;
+
+    //
+    // Appends the modules loaded in the current address space, in any order.
+    //
+    typedef VOID (*PCODE_MODULE_LOADER)(PVOID Context, vector<CODE_MODULE>& Modules);
+
+    typedef struct _CODE_CACHE_STATS {
+        ULONG64 Scans;
+        ULONG64 Hooks;
+        ULONG64 PageLookups;
+        ULONG64 PageHits;
+        ULONG64 PageFailures; // Unreadable pages (also cached).
+        ULONG64 ModuleLists;
+        ULONG64 NoModule; // Scans of code outside of any module.
+    } CODE_CACHE_STATS, *PCODE_CACHE_STATS;
+
+    CodeCache(
+        PCODE_PAGE_READER Reader,
+        PCODE_MODULE_LOADER Loader,
+        PVOID Context
+    );
+
+    //
+    // Copies up to Size bytes at Address, stops at the first unreadable page.
+    // Returns the number of bytes copied.
+    //
+    ULONG
+    Read(
+        ULONG64 Tag,
+        ULONG64 Address,
+        PUCHAR Buffer,
+        ULONG Size
+    );
+
+    PCODE_MODULE
+    FindModule(
+        ULONG64 Tag,
+        ULONG64 Address
+    );
+
+    //
+    // X86FindHook() on the function at Address, bounded by the module holding it.
+    // Is64Bit is only used when the bitness of the module is not known.
+    //
+    BOOLEAN
+    FindHook(
+        ULONG64 Tag,
+        ULONG64 Address,
+        BOOLEAN Is64Bit,
+        PX86_HOOK Hook
+    );
+
+    VOID
+    Flush(
+    );
+
+    VOID
+    ResetStats(
+    );
+
+    CODE_CACHE_STATS m_Stats;
+
+private:
+    const UCHAR *
+    GetPage(
+        ULONG64 Tag,
+        ULONG64 PageBase
+    );
+
+    PCODE_PAGE_READER m_Reader;
+    PCODE_MODULE_LOADER m_Loader;
+    PVOID m_Context;
+
+    map<pair<ULONG64, ULONG64>, vector<UCHAR>> m_Pages; // (tag, page), empty if unreadable.
+    map<ULONG64, vector<CODE_MODULE>> m_Modules; // Sorted by base, per tag.
+};
+
+#endif
@@ -38,339 +38,92 @@
 #include "MoonSolsDbgExt.h"
 
 //
-// PE functions
+// PE functions reading from the target, the parsing of captured images is in PEFile.cpp.
 //
 
-PVOID
-PEFile::RtlGetRessourceData(
-    ULONG Name,
-    ULONG Type
+ULONG
+PEFile::RtlProbeRemoteExports(
 )
 {
-    PIMAGE_RESOURCE_DIRECTORY ImgResDir = NULL;
-    PIMAGE_RESOURCE_DIRECTORY_ENTRY ImgResDirEntry;
-    PIMAGE_RESOURCE_DATA_ENTRY ImgResDataEntry;
-
-    ULONG ResRva, ResSize;
-
-    ULONG Index;
-
-    PVOID RessourceData = NULL;
-    ExtRemoteTyped BaseImage;
+    ULONG Probed = 0;
 
     //
-    // Points to Data Directory Table.
+    // Must be called from the engine thread, in the context of the owner process.
+    // Code pages shared by the targets are only read once by g_CodeCache.
     //
-    ResRva = m_Image.DataDirectory[IMAGE_DIRECTORY_ENTRY_RESOURCE].VirtualAddress;
-    ResSize = m_Image.DataDirectory[IMAGE_DIRECTORY_ENTRY_RESOURCE].Size;
-
-    //
-    // Category.Type
-    //
-    ImgResDir = (PIMAGE_RESOURCE_DIRECTORY)((PUCHAR)m_Image.Image + ResRva);
-    ImgResDirEntry = (PIMAGE_RESOURCE_DIRECTORY_ENTRY)(ImgResDir + 1);
-
-    if (ImgResDir->NumberOfIdEntries > 26) ImgResDir->NumberOfIdEntries = 26;
-
-    for (Index = 0; Index < ImgResDir->NumberOfIdEntries; Index += 1)
+    for (ULONG Index = 0; Index < m_Exports.size(); Index += 1)
     {
-        if (ImgResDirEntry[Index].Name == Type) break;
-    }
+        PEXPORT_INFO ExportInfo = &m_Exports[Index];
+        X86_HOOK Hook;
 
-    if ((Index == ImgResDir->NumberOfIdEntries) || (!ImgResDirEntry[Index].DataIsDirectory)) goto CleanUp;
+        if (!ExportInfo->IsTablePatched) continue;
 
-    //
-    // Sub-category.Name
-    //
-    ImgResDir = (PIMAGE_RESOURCE_DIRECTORY)((PUCHAR)m_Image.Image + ResRva + ImgResDirEntry[Index].OffsetToDirectory);
-    ImgResDirEntry = (PIMAGE_RESOURCE_DIRECTORY_ENTRY)(ImgResDir + 1);
+        ExportInfo->IsHooked = IsPointerHooked(m_ImageBase + ExportInfo->Address, &Hook);
+        ExportInfo->HookType = Hook.Type;
+        ExportInfo->HookOffset = Hook.Offset;
+        ExportInfo->HookTarget = Hook.Target;
 
-    if (ImgResDir->NumberOfIdEntries > 26) ImgResDir->NumberOfIdEntries = 26;
-
-    for (Index = 0; Index < ImgResDir->NumberOfIdEntries; Index += 1)
-    {
-        if (ImgResDirEntry[Index].Name == Name) break;
+        Probed += 1;
     }
 
-    if ((Index == ImgResDir->NumberOfIdEntries) || (!ImgResDirEntry[Index].DataIsDirectory)) goto CleanUp;
-
-    //
-    // Read first entry by default.
-    //
-    ImgResDir = (PIMAGE_RESOURCE_DIRECTORY)((PUCHAR)m_Image.Image + ResRva + ImgResDirEntry[Index].OffsetToDirectory);
-    ImgResDirEntry = (PIMAGE_RESOURCE_DIRECTORY_ENTRY)(ImgResDir + 1);
-
-    if (ImgResDirEntry[0].DataIsDirectory) goto CleanUp;
-
-    ImgResDataEntry = (PIMAGE_RESOURCE_DATA_ENTRY)((PUCHAR)m_Image.Image + ResRva + ImgResDirEntry[0].OffsetToDirectory);
-    RessourceData = malloc(ImgResDataEntry->Size);
-    if (RessourceData == NULL) goto CleanUp;
-
-    memcpy_s(RessourceData, ImgResDataEntry->Size, (PUCHAR)m_Image.Image + ImgResDataEntry->OffsetToData, ImgResDataEntry->Size);
-
-CleanUp:
-    return RessourceData;
+    return Probed;
 }
 
-BOOLEAN
-PEFile::RtlGetPdbInfo(
+ULONG
+PEFile::RtlReadImportAddresses(
 )
 {
-    BOOLEAN Result = FALSE;
-    PIMAGE_DEBUG_DIRECTORY DbgDir = NULL;
-    ULONG Offset;
-
-    if (!m_Image.Initialized) goto CleanUp;
-
-    Offset = m_Image.DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG].VirtualAddress;
-    if (!Offset || (m_ImageSize && (Offset > m_ImageSize))) goto CleanUp;
-    DbgDir = (PIMAGE_DEBUG_DIRECTORY)(((PUCHAR)m_Image.Image) + Offset);
-
-    Offset = DbgDir->AddressOfRawData;
-    if (!Offset || (m_ImageSize && (Offset > m_ImageSize))) goto CleanUp;
-    PCV_INFO_PDB70 PdbInfo = (PCV_INFO_PDB70)(((PUCHAR)m_Image.Image) + Offset);;
-
-    if (PdbInfo->Signature == CV_SIGNATURE_RSDS)
-    {
-        m_PdbInfo.Guid = PdbInfo->Guid;
-        m_PdbInfo.Age = PdbInfo->Age;
-
-        strcpy_s(m_PdbInfo.PdbName, sizeof(m_PdbInfo.PdbName), PdbInfo->PdbFileName);
-        Result = TRUE;
-    }
-
-CleanUp:
-    return Result;
-}
+    ULONG NumberOfReads = 0;
+    vector<UCHAR> Buffer;
 
-BOOLEAN
-PEFile::RtlGetExports(
-)
-{
-    BOOLEAN Result = FALSE;
-    PIMAGE_EXPORT_DIRECTORY ExportDir = NULL;
-
-    ULONG DirRva, DirSize;
-
-    PULONG AddressOfNames;
-    PUSHORT AddressOfNameOrdinals;
-    PULONG AddressOfFunctions;
-
-    UINT i;
-
-    ASSERTDBG(m_Image.Initialized);
-    if (!m_Image.Initialized) goto CleanUp;
-
-    DirRva = m_Image.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].VirtualAddress;
-    DirSize = m_Image.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].Size;
-
-    if (!DirRva || (m_ImageSize && (DirRva > m_ImageSize))) goto CleanUp;
-
-    PUCHAR Image = ((PUCHAR)m_Image.Image);
-
-    if (!DirSize || !DirRva) goto CleanUp;
-
-    ExportDir = (PIMAGE_EXPORT_DIRECTORY)(Image + DirRva);
-
-    if ((ExportDir->AddressOfNames >= (DirRva + DirSize)) ||
-        (ExportDir->AddressOfNameOrdinals >= (DirRva + DirSize)) ||
-        (ExportDir->AddressOfFunctions >= (DirRva + DirSize)))
-    {
-        goto CleanUp;
-    }
-
-    AddressOfNames = (PULONG)(Image + (ULONG)ExportDir->AddressOfNames);
-    AddressOfNameOrdinals = (PUSHORT)(Image + (ULONG)ExportDir->AddressOfNameOrdinals);
-    AddressOfFunctions = (PULONG)(Image + (ULONG)ExportDir->AddressOfFunctions);
-
-#if VERBOSE_MODE
-    g_Ext->Dml("(%s) ExportDir->NumberOfName: %d, ExportDir->NumberOfFunctions: %d\n",
-               m_PdbInfo.PdbName, ExportDir->NumberOfNames, ExportDir->NumberOfFunctions);
-#endif
-
-    m_NumberOfExportedFunctions = ExportDir->NumberOfNames;
-    ULONG NumberOfHookedAPIs = 0;
-    for (i = 0; i < ExportDir->NumberOfNames && i < 5000; i += 1)
+    //
+    // Must be called from the engine thread, in the context of the owner process.
+    // Consecutive slots (one array per imported module) are read at once.
+    //
+    for (ULONG First = 0, Last = 0; First < m_Imports.size(); First = Last)
     {
-        EXPORT_INFO ExportInfo = { 0 };
-
-        if (AddressOfNameOrdinals[i] >= ExportDir->NumberOfNames) continue;
+        for (Last = First + 1;
+             (Last < m_Imports.size()) && (m_Imports[Last].IatRva == (m_Imports[Last - 1].IatRva + m_ImportThunkSize));
+             Last += 1);
 
-        ExportInfo.Address = AddressOfFunctions[AddressOfNameOrdinals[i]];
+        Buffer.resize((Last - First) * m_ImportThunkSize);
 
-        ExportInfo.Index = i;
-        ExportInfo.Ordinal = AddressOfNameOrdinals[i];
-        ExportInfo.IsTablePatched = (ExportInfo.Address >= m_ImageSize) ? TRUE : FALSE;
-        ExportInfo.IsHooked = IsPointerHooked(m_ImageBase + ExportInfo.Address);
-        if (ExportInfo.IsTablePatched || ExportInfo.IsHooked) NumberOfHookedAPIs++;
+        ExtRemoteTypedEx::ReadVirtual(m_ImageBase + m_Imports[First].IatRva, &Buffer[0], (ULONG)Buffer.size(), NULL);
+        NumberOfReads += 1;
 
-        ULONG Len = (ULONG)strnlen_s((LPSTR)(Image + AddressOfNames[i]), sizeof(ExportInfo.Name) - 1);
-        if ((AddressOfNames[i] <= (DirRva + DirSize)) && Len)
+        for (ULONG i = First; i < Last; i += 1)
         {
-            // strcpy_s(ExportInfo.Name, sizeof(ExportInfo.Name), (LPSTR)(Image + AddressOfNames[i]));
-            memcpy_s(ExportInfo.Name, sizeof(ExportInfo.Name), (LPSTR)(Image + AddressOfNames[i]), Len);
-        }
-        else
-        {
-            strcpy_s(ExportInfo.Name, sizeof(ExportInfo.Name), "*unreadable*");
-        }
+            ULONG64 Address = 0;
 
-        m_Exports.push_back(ExportInfo);
+            memcpy_s(&Address, sizeof(Address), &Buffer[(i - First) * m_ImportThunkSize], m_ImportThunkSize);
+            m_Imports[i].Address = Address;
+        }
     }
 
-    m_NumberOfHookedAPIs = NumberOfHookedAPIs;
-
-    Result = TRUE;
-
-CleanUp:
-    return Result;
+    return NumberOfReads;
 }
 
 BOOLEAN
-PEFile::RtlGetFileVersion(
+PEFile::RtlGetImageHashes(
+    ULONG SizeOfImage
 )
 {
-    PVOID RessourceData = NULL;
-
-    UINT TranslateSize;
-    WCHAR MagicLine[MAX_PATH + 1];
-    PVOID Description;
-    UINT DescriptionSize;
-
-    PLANGANDCODEPAGE Translation;
-
-    BOOLEAN Result = TRUE;
-
-    RessourceData = RtlGetRessourceData(VS_VERSION_INFO, (ULONG)RT_VERSION);
-    // ASSERTDBG(RessourceData);
-    if (RessourceData == NULL) goto CleanUp;
-
-    // Read the list of languages and code pages.
-
-    Result = VerQueryValueW(RessourceData,
-        L"\\VarFileInfo\\Translation",
-        (LPVOID*)&Translation,
-        &TranslateSize);
-
-    if (!Result || Translation == NULL) goto CleanUp;
-
-    //
-    // Product Version
-    //
-    swprintf_s(MagicLine, sizeof(MagicLine),
-        L"\\StringFileInfo\\%04x%04x\\ProductVersion",
-        Translation[0].wLanguage,
-        Translation[0].wCodePage);
-
-    VerQueryValueW(RessourceData, MagicLine, &Description, &DescriptionSize);
-    if (DescriptionSize)
-    {
-        swprintf_s(m_FileVersion.ProductVersion, sizeof(m_FileVersion.ProductVersion),
-            L"%s", Description);
-    }
-
-    //
-    // File Version
-    //
-    swprintf_s(MagicLine, sizeof(MagicLine),
-        L"\\StringFileInfo\\%04x%04x\\FileVersion",
-        Translation[0].wLanguage,
-        Translation[0].wCodePage);
-
-    VerQueryValueW(RessourceData, MagicLine, &Description, &DescriptionSize);
-    if (DescriptionSize)
-    {
-        swprintf_s(m_FileVersion.FileVersion, sizeof(m_FileVersion.FileVersion),
-            L"%s", Description);
-    }
+    HashStream Stream(ReadVirtualPages);
 
     //
-    // Company Name
+    // Read from the target (current context), the image does not need to be captured.
     //
-    swprintf_s(MagicLine, sizeof(MagicLine),
-        L"\\StringFileInfo\\%04x%04x\\CompanyName",
-        Translation[0].wLanguage,
-        Translation[0].wCodePage);
-
-    VerQueryValueW(RessourceData, MagicLine, &Description, &DescriptionSize);
-    if (DescriptionSize)
-    {
-        swprintf_s(m_FileVersion.CompanyName, sizeof(m_FileVersion.CompanyName),
-            L"%s", Description);
-    }
-
-    //
-    // File Description
-    //
-    swprintf_s(MagicLine, sizeof(MagicLine),
-        L"\\StringFileInfo\\%04x%04x\\FileDescription",
-        Translation[0].wLanguage,
-        Translation[0].wCodePage);
-
-    VerQueryValueW(RessourceData, MagicLine, &Description, &DescriptionSize);
-    if (DescriptionSize)
-    {
-        swprintf_s(m_FileVersion.FileDescription, sizeof(m_FileVersion.FileDescription),
-            L"%s", Description);
-    }
+    if (!SizeOfImage) SizeOfImage = m_ImageSize;
+    if (!m_ImageBase || !SizeOfImage) return FALSE;
 
-#if VERBOSE_MODE
-    // g_Ext->Dml("FileDesc: %S\n", ProcessObject.m_CcProcessObject.FileDescription);
-#endif
-
-    Result = TRUE;
+    m_HasImageHashes = Stream.HashVirtual(m_ImageBase, SizeOfImage, &m_ImageHashes);
 
-CleanUp:
-
-    if (RessourceData) free(RessourceData);
-    return Result;
-}
-
-BOOLEAN
-PEFile::RtlGetSections(
-)
-{
-    ULONG Index;
-
-    for (Index = 0; Index < m_Image.NumberOfSections; Index += 1)
-    {
-        CACHED_SECTION_INFO SectionInfo = { 0 };
-        MD5_CONTEXT Md5Context = { 0 };
-
-        memcpy_s(SectionInfo.Name, sizeof(SectionInfo.Name),
-            m_Image.Sections[Index].Name, sizeof(m_Image.Sections[Index].Name));
-        SectionInfo.VaBase = m_Image.Sections[Index].VirtualAddress;
-        SectionInfo.VaSize = m_Image.Sections[Index].SizeOfRawData;
-
-        if (SectionInfo.VaSize > m_ImageSize) continue;
-
-#if VERBOSE_MODE
-        g_Ext->Dml("[%d] Base = 0x%I64X Size = 0x%x\n", Index, SectionInfo.VaBase, SectionInfo.VaSize);
-#endif
-
-        MD5Init(&Md5Context);
-        MD5Update(&Md5Context, (PUCHAR)m_Image.Image + SectionInfo.VaBase, SectionInfo.VaSize);
-        MD5Final(&Md5Context);
-
-        memcpy_s(SectionInfo.VaMd5Hash, sizeof(SectionInfo.VaMd5Hash), Md5Context.Digest, sizeof(Md5Context.Digest));
-
-#if VERBOSE_MODE
-        g_Ext->Dml("Section: %s\n", SectionInfo.Name);
-        g_Ext->Dml("Md5: ");
-        for (UINT i = 0; i < 16; i++) g_Ext->Dml("%02x", Md5Context.Digest[i]);
-        g_Ext->Dml("\n");
-#endif
-
-        // VirusTotal::GetReport(Md5Context.Digest);
-
-        m_CcSections.push_back(SectionInfo);
-    }
-
-    return TRUE;
+    return m_HasImageHashes;
 }
 
 BOOLEAN
 PEFile::InitImage(
+    Arena *Allocator
 )
 {
     PIMAGE_DOS_HEADER Header = NULL;
@@ -432,7 +185,12 @@ PEFile::InitImage(
         }
     }
 
-    Image = malloc(m_ImageSize);
+    //
+    // Released with the arena (by default the command arena), see PEFile::Free().
+    //
+    if (Allocator == NULL) Allocator = &g_CommandArena;
+
+    Image = Allocator->Alloc(m_ImageSize);
     if (Image == NULL) goto CleanUp;
     RtlZeroMemory(Image, (ULONG)m_ImageSize);
 
@@ -444,32 +202,7 @@ PEFile::InitImage(
         goto CleanUp;
     }
 
-    m_Image.Image = (PIMAGE_DOS_HEADER)Image;
-    REF_POINTER(m_Image.Image);
-
-    m_Image.NtHeader32 = (PIMAGE_NT_HEADERS32)((PUCHAR)Image + m_Image.Image->e_lfanew);
-    NtHeader32 = m_Image.NtHeader32;
-
-    if (NtHeader32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC)
-    {
-        m_Image.NtHeader32 = NULL;
-        m_Image.NtHeader64 = (PIMAGE_NT_HEADERS64)((PUCHAR)Image + m_Image.Image->e_lfanew);
-        m_Image.DataDirectory = (PIMAGE_DATA_DIRECTORY)m_Image.NtHeader64->OptionalHeader.DataDirectory;
-        m_Image.Sections = (PIMAGE_SECTION_HEADER)(m_Image.NtHeader64 + 1);
-
-        m_Image.NumberOfSections = m_Image.NtHeader64->FileHeader.NumberOfSections;
-    }
-    else if (NtHeader32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC)
-    {
-        m_Image.NtHeader64 = NULL;
-        m_Image.DataDirectory = (PIMAGE_DATA_DIRECTORY)m_Image.NtHeader32->OptionalHeader.DataDirectory;
-        m_Image.Sections = (PIMAGE_SECTION_HEADER)(m_Image.NtHeader32 + 1);
-        m_Image.NumberOfSections = m_Image.NtHeader32->FileHeader.NumberOfSections;
-    }
-    else
-    {
-        goto CleanUp;
-    }
+    if (!SetImage(Image, (ULONG)m_ImageSize)) goto CleanUp;
 
 #if VERBOSE_MODE
     g_Ext->Dml("m_Image = %p\n"
@@ -499,13 +232,7 @@ PEFile::GetInfoFull(
     Result = InitImage();
     if (Result == FALSE) goto CleanUp;
 
-    RtlGetFileVersion();
-    // if (Result == FALSE) goto CleanUp;
-
-    RtlGetPdbInfo();
-
-    RtlGetSections();
-    //if (Result == FALSE) goto CleanUp;
+    ParseImage();
 
     //
     // Dlls
@@ -36,20 +36,10 @@ Revision History:
 
 --*/
 
-#include "MoonSolsDbgExt.h"
-
 #ifndef __DBGHELPEX_H__
 #define __DBGHELPEX_H__
 
-#define CV_SIGNATURE_RSDS 'SDSR'
-
-typedef struct _CV_INFO_PDB70
-{
-    DWORD Signature;
-    GUID Guid; // unique identifier 
-    DWORD Age; // an always-incrementing value 
-    CHAR PdbFileName[1]; // zero terminated string with the name of the PDB file 
-} CV_INFO_PDB70, *PCV_INFO_PDB70;
+#define RESOURCE_ANY_ID ((ULONG)-1) // RtlFindRessourceEntry(), first entry of the directory.
 
 class PEFile {
 public:
@@ -87,6 +77,12 @@ public:
 
         BOOLEAN IsExecutable;
         ULONG32 Characteristics;
+
+        UCHAR VaSha1Hash[SHA1_DIGEST_SIZE];
+        UCHAR VaSha256Hash[SHA256_DIGEST_SIZE];
+        FUZZY_DIGESTS VaFuzzy;
+        ENTROPY_SUMMARY VaEntropy;
+        BOOLEAN VaHashValid; // FALSE if the section could not be read, digests are zeroed.
     } CACHED_SECTION_INFO, *PCACHED_SECTION_INFO;
 
     typedef struct _PDB_INFO {
@@ -95,11 +91,6 @@ public:
         CHAR PdbName[MAX_PATH + 1];
     } PDB_INFO, *PPDB_INFO;
 
-    typedef struct _LANGANDCODEPAGE {
-        WORD wLanguage;
-        WORD wCodePage;
-    } LANGANDCODEPAGE, *PLANGANDCODEPAGE;
-
     typedef struct _FILE_VERSION {
         WCHAR ProductVersion[256];
         WCHAR FileVersion[256];
@@ -115,12 +106,70 @@ public:
 
         BOOL IsTablePatched;
         BOOL IsHooked;
+        ULONG HookType; // X86_HOOK_TYPE
+        ULONG HookOffset; // Of the instruction leaving the module, from the entry point.
+        ULONG64 HookTarget;
+
+        BOOL IsForwarder;
+        CHAR Forwarder[128]; // e.g. "NTDLL.RtlAllocateHeap"
     } EXPORT_INFO, *PEXPORT_INFO;
 
+    typedef struct _IMPORT_INFO {
+        CHAR ModuleName[64]; // As written in the import descriptor.
+        CHAR Name[128]; // Empty for imports by ordinal.
+        ULONG Ordinal;
+        ULONG IatRva;
+
+        //
+        // Filled from the target by RtlReadImportAddresses() and CheckImports().
+        //
+        ULONG64 Address;
+        ULONG64 Expected;
+        BOOLEAN IsResolved;
+        BOOLEAN IsHooked;
+    } IMPORT_INFO, *PIMPORT_INFO;
+
+    PEFile()
+    {
+        m_ImageBase = 0ULL;
+        m_ImageSize = 0;
+        m_ObjectPtr = 0ULL;
+        m_NumberOfHookedAPIs = 0;
+        m_NumberOfExportedFunctions = 0;
+        m_OrdinalBase = 0;
+        m_ImportThunkSize = 0;
+        m_NumberOfHookedImports = 0;
+        m_HasImageHashes = FALSE;
+        m_HasImpHash = FALSE;
+
+        RtlZeroMemory(m_ImpHash, sizeof(m_ImpHash));
+        RtlZeroMemory(&m_ImageHashes, sizeof(m_ImageHashes));
+        RtlZeroMemory(&m_FileVersion, sizeof(m_FileVersion));
+        RtlZeroMemory(&m_Image, sizeof(m_Image));
+        RtlZeroMemory(&m_PdbInfo, sizeof(m_PdbInfo));
+    }
+
+    //
+    // Buffers are owned by an arena, objects are moved around but never copied.
+    //
+    PEFile(PEFile&& other)
+    {
+        MoveFrom(other);
+    }
+
+    PEFile& operator=(PEFile&& other)
+    {
+        if (this != &other) MoveFrom(other);
+        return *this;
+    }
+
+    PEFile(const PEFile&) = delete;
+    PEFile& operator=(const PEFile&) = delete;
+
     ULONG64 m_ImageBase;
     ULONG m_ImageSize;
 
-    vector<CACHED_SECTION_INFO> m_CcSections;
+    ArenaVector<CACHED_SECTION_INFO> m_CcSections;
     FILE_VERSION m_FileVersion;
     IMAGE_DATA m_Image;
     PDB_INFO m_PdbInfo;
@@ -130,28 +179,109 @@ public:
     //
     // Exports
     //
-    vector<EXPORT_INFO> m_Exports;
+    ArenaVector<EXPORT_INFO> m_Exports;
     ULONG m_NumberOfHookedAPIs;
     ULONG m_NumberOfExportedFunctions;
+    ULONG m_OrdinalBase;
+
+    //
+    // Built by RtlBuildExportIndex().
+    //
+    ArenaVector<ULONG> m_ExportNameIndex; // Open addressing, m_Exports index + 1 (0 = empty slot).
+    ArenaVector<ULONG> m_ExportRvaIndex; // m_Exports indexes sorted by address.
+
+    //
+    // Imports
+    //
+    ArenaVector<IMPORT_INFO> m_Imports;
+    ULONG m_ImportThunkSize; // 4 or 8, also tells the bitness of the image.
+    ULONG m_NumberOfHookedImports;
 
+    //
+    // MD5 of the "module.function" list, same as pefile's get_imphash(). Set by ParseImage().
+    //
+    UCHAR m_ImpHash[MD5_DIGEST_SIZE];
+    BOOLEAN m_HasImpHash;
+
+    //
+    // Whole image, streamed from the target by RtlGetImageHashes().
+    //
+    STREAM_DIGESTS m_ImageHashes;
+    BOOLEAN m_HasImageHashes;
+
+    //
+    // Points into m_Image, bounds-checked against SizeOfImage.
+    //
     PVOID
     RtlGetRessourceData(
         IN ULONG Name,
-        IN ULONG Type
+        IN ULONG Type,
+        OUT PULONG Size
+    );
+
+    PIMAGE_RESOURCE_DIRECTORY_ENTRY
+    RtlFindRessourceEntry(
+        IN ULONG DirectoryOffset,
+        IN ULONG Id
     );
 
     BOOLEAN
     RtlGetExports(
     );
 
+    ULONG
+    RtlProbeRemoteExports(
+    );
+
+    VOID
+    RtlBuildExportIndex(
+    );
+
+    PEXPORT_INFO
+    RtlFindExportByName(
+        LPCSTR Name
+    );
+
+    PEXPORT_INFO
+    RtlFindExportByAddress(
+        ULONG64 Rva
+    );
+
+    BOOLEAN
+    RtlGetImports(
+    );
+
+    BOOLEAN
+    RtlGetImpHash(
+    );
+
+    ULONG
+    RtlReadImportAddresses(
+    );
+
     BOOLEAN
     InitImage(
+        Arena *Allocator = NULL
+    );
+
+    //
+    // Image already captured (mapped layout), InitImage() reads it from the target.
+    //
+    BOOLEAN
+    SetImage(
+        PVOID Image,
+        ULONG ImageSize
     );
 
     BOOLEAN
     RtlGetSections(
     );
 
+    BOOLEAN
+    RtlGetImageHashes(
+        ULONG SizeOfImage = 0
+    );
+
     BOOLEAN
     RtlGetFileVersion(
     );
@@ -160,6 +290,10 @@ public:
     RtlGetPdbInfo(
     );
 
+    BOOLEAN
+    ParseImage(
+    );
+
     BOOLEAN
     GetInfoFull(
     );
@@ -167,6 +301,32 @@ public:
     void Free(void);
 
 protected:
+    void MoveFrom(PEFile& other)
+    {
+        m_ImageBase = other.m_ImageBase;
+        m_ImageSize = other.m_ImageSize;
+        m_CcSections = move(other.m_CcSections);
+        m_FileVersion = other.m_FileVersion;
+        m_Image = other.m_Image;
+        m_PdbInfo = other.m_PdbInfo;
+        m_ObjectPtr = other.m_ObjectPtr;
+        m_Exports = move(other.m_Exports);
+        m_NumberOfHookedAPIs = other.m_NumberOfHookedAPIs;
+        m_NumberOfExportedFunctions = other.m_NumberOfExportedFunctions;
+        m_OrdinalBase = other.m_OrdinalBase;
+        m_ExportNameIndex = move(other.m_ExportNameIndex);
+        m_ExportRvaIndex = move(other.m_ExportRvaIndex);
+        m_Imports = move(other.m_Imports);
+        m_ImportThunkSize = other.m_ImportThunkSize;
+        m_NumberOfHookedImports = other.m_NumberOfHookedImports;
+        memcpy(m_ImpHash, other.m_ImpHash, sizeof(m_ImpHash));
+        m_HasImpHash = other.m_HasImpHash;
+        m_ImageHashes = other.m_ImageHashes;
+        m_HasImageHashes = other.m_HasImageHashes;
+
+        RtlZeroMemory(&other.m_Image, sizeof(other.m_Image));
+    }
+
     void Clear(void)
     {
         Free();
@@ -175,6 +335,15 @@ protected:
         m_ImageSize = 0;
         m_ImageBase = 0ULL;
     }
+
+    //
+    // Calls Callback(ModuleName, Name, Ordinal, IatRva) for every import having a lookup
+    // table, Name is empty for imports by ordinal. Returns FALSE without import directory.
+    //
+    BOOLEAN
+    RtlWalkImports(
+        function<VOID(LPCSTR, LPCSTR, ULONG, ULONG)> Callback
+    );
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,791 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - Disasm.cpp
+
+Abstract:
+
+    - Only the length and the few operands needed to follow control flow
+      are decoded: prefixes, opcode maps (legacy, VEX, EVEX, XOP), ModRM,
+      SIB, displacement and immediate. One table lookup per opcode byte.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include "Disasm.h"
+
+#define D_MODRM 0x01
+#define D_IMM8 0x02
+#define D_IMMZ 0x04 // 16 or 32 bits, depends on the operand size.
+#define D_IMM16 0x08
+#define D_REL8 0x10
+#define D_RELZ 0x20
+#define D_SPECIAL 0x40 // Decoded case by case in X86Decode().
+#define D_INVALID 0x80 // One byte map: invalid in 64-bit mode. 0F map: always invalid.
+
+#define M D_MODRM
+#define I8 D_IMM8
+#define IZ D_IMMZ
+#define I16 D_IMM16
+#define R8 D_REL8
+#define RZ D_RELZ
+#define S D_SPECIAL
+#define X D_INVALID
+#define N 0
+
+//
+// Prefixes (26, 2E, 36, 3E, 40-4F in 64-bit mode, 64-67, F0, F2, F3) are consumed
+// before the lookup, their entries are never used.
+//
+static const UCHAR X86OneByteMap[256] = {
+    /* 00 */ M, M, M, M, I8, IZ, X, X, M, M, M, M, I8, IZ, X, S,
+    /* 10 */ M, M, M, M, I8, IZ, X, X, M, M, M, M, I8, IZ, X, X,
+    /* 20 */ M, M, M, M, I8, IZ, N, X, M, M, M, M, I8, IZ, N, X,
+    /* 30 */ M, M, M, M, I8, IZ, N, X, M, M, M, M, I8, IZ, N, X,
+    /* 40 */ N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+    /* 50 */ N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+    /* 60 */ X, X, S, M, N, N, N, N, IZ, M | IZ, I8, M | I8, N, N, N, N,
+    /* 70 */ R8, R8, R8, R8, R8, R8, R8, R8, R8, R8, R8, R8, R8, R8, R8, R8,
+    /* 80 */ M | I8, M | IZ, M | I8 | X, M | I8, M, M, M, M, M, M, M, M, M, M, M, S,
+    /* 90 */ N, N, N, N, N, N, N, N, N, N, IZ | I16 | X, N, N, N, N, N,
+    /* A0 */ S, S, S, S, N, N, N, N, I8, IZ, N, N, N, N, N, N,
+    /* B0 */ I8, I8, I8, I8, I8, I8, I8, I8, S, S, S, S, S, S, S, S,
+    /* C0 */ M | I8, M | I8, I16, N, S, S, M | I8, M | IZ, I16 | I8, N, I16, N, N, I8, X, N,
+    /* D0 */ M, M, M, M, I8 | X, I8 | X, X, N, M, M, M, M, M, M, M, M,
+    /* E0 */ R8, R8, R8, R8, I8, I8, I8, I8, RZ, RZ, IZ | I16 | X, R8, N, N, N, N,
+    /* F0 */ N, N, N, N, N, N, S, S, N, N, N, N, N, N, M, M
+};
+
+//
+// 0F xx. 0F 38 (ModRM) and 0F 3A (ModRM, imm8) are handled apart.
+//
+static const UCHAR X86TwoByteMap[256] = {
+    /* 00 */ M, M, M, M, X, N, N, N, N, N, X, N, X, M, N, M | I8,
+    /* 10 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+    /* 20 */ M, M, M, M, X, X, X, X, M, M, M, M, M, M, M, M,
+    /* 30 */ N, N, N, N, N, N, X, N, S, X, S, X, X, X, X, X,
+    /* 40 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+    /* 50 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+    /* 60 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+    /* 70 */ M | I8, M | I8, M | I8, M | I8, M, M, M, N, M, M, X, X, M, M, M, M,
+    /* 80 */ RZ, RZ, RZ, RZ, RZ, RZ, RZ, RZ, RZ, RZ, RZ, RZ, RZ, RZ, RZ, RZ,
+    /* 90 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+    /* A0 */ N, N, N, M, M | I8, M, X, X, N, N, N, M, M | I8, M, M, M,
+    /* B0 */ M, M, M, M, M, M, M, M, M, M, M | I8, M, M, M, M, M,
+    /* C0 */ M, M, M | I8, M, M | I8, M | I8, M | I8, M, N, N, N, N, N, N, N, N,
+    /* D0 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+    /* E0 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+    /* F0 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M
+};
+
+#undef M
+#undef I8
+#undef IZ
+#undef I16
+#undef R8
+#undef RZ
+#undef S
+#undef X
+#undef N
+
+#define X86_PREFIX_LEGACY 1
+#define X86_PREFIX_OPERAND_SIZE 2
+#define X86_PREFIX_ADDRESS_SIZE 3
+#define X86_PREFIX_REX 4 // 64-bit mode only.
+
+#define L X86_PREFIX_LEGACY
+#define O X86_PREFIX_OPERAND_SIZE
+#define A X86_PREFIX_ADDRESS_SIZE
+#define R X86_PREFIX_REX
+
+static const UCHAR X86PrefixMap[256] = {
+    /* 00 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 10 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 20 */ 0, 0, 0, 0, 0, 0, L, 0, 0, 0, 0, 0, 0, 0, L, 0,
+    /* 30 */ 0, 0, 0, 0, 0, 0, L, 0, 0, 0, 0, 0, 0, 0, L, 0,
+    /* 40 */ R, R, R, R, R, R, R, R, R, R, R, R, R, R, R, R,
+    /* 50 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 60 */ 0, 0, 0, 0, L, L, O, A, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 70 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 80 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 90 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* A0 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* B0 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* C0 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* D0 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* E0 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* F0 */ L, 0, L, L, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+#undef L
+#undef O
+#undef A
+#undef R
+
+//
+// Control flow of the one byte opcodes, FF is decided by ModRM.reg.
+//
+#define J X86FlowJmp
+#define C X86FlowJcc
+#define K X86FlowCall
+#define T X86FlowRet
+#define B X86FlowInt3
+
+static const UCHAR X86FlowMap[256] = {
+    /* 00 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 10 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 20 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 30 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 40 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 50 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 60 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 70 */ C, C, C, C, C, C, C, C, C, C, C, C, C, C, C, C,
+    /* 80 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 90 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* A0 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* B0 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* C0 */ 0, 0, T, T, 0, 0, 0, 0, 0, 0, T, T, B, 0, 0, T,
+    /* D0 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* E0 */ C, C, C, C, 0, 0, 0, 0, K, J, 0, J, 0, 0, 0, 0,
+    /* F0 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+#undef J
+#undef C
+#undef K
+#undef T
+#undef B
+
+//
+// Every read below stays within X86_WINDOW_SIZE bytes of the instruction, so they
+// are not checked one by one: the length is compared to the limit once at the end.
+// Longest read starts past 14 prefix bytes, 3 opcode bytes, ModRM, SIB, disp32 and imm32.
+// Near the end of the buffer, the bytes are decoded from a zero padded copy.
+//
+#define X86_WINDOW_SIZE 48
+
+typedef struct _X86_DECODER {
+    const UCHAR *Bytes;
+    ULONG Limit;
+    ULONG Offset;
+    BOOLEAN Is64Bit;
+    BOOLEAN AddressOverride;
+} X86_DECODER, *PX86_DECODER;
+
+static const ULONG64 X86SizeMask[9] = {
+    0, 0xFF, 0xFFFF, 0xFFFFFF, 0xFFFFFFFF,
+    0xFFFFFFFFFFULL, 0xFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFULL, MAXULONG64
+};
+
+//
+// Displacement size by ModRM.mod, 32/64-bit addressing.
+//
+static const UCHAR X86DisplacementSize[4] = { 0, 1, 4, 0 };
+
+static
+ULONG64
+X86ReadValue(
+    PX86_DECODER Decoder,
+    ULONG Size
+)
+{
+    ULONG64 Value;
+
+    memcpy(&Value, Decoder->Bytes + Decoder->Offset, sizeof(Value));
+    Decoder->Offset += Size;
+
+    return Value & X86SizeMask[Size];
+}
+
+static
+LONG64
+X86SignExtend(
+    ULONG64 Value,
+    ULONG Size
+)
+{
+    ULONG Shift = (64 - (Size * 8)) & 63;
+
+    return (LONG64)(Value << Shift) >> Shift;
+}
+
+static
+VOID
+X86DecodeModRm(
+    PX86_DECODER Decoder,
+    PX86_INSTRUCTION Instruction
+)
+{
+    ULONG Mod, Rm, DisplacementSize;
+    ULONG HasSib;
+
+    Instruction->ModRm = Decoder->Bytes[Decoder->Offset++];
+    Instruction->HasModRm = TRUE;
+
+    Mod = Instruction->ModRm >> 6;
+    Rm = Instruction->ModRm & 7;
+
+    if (!Decoder->Is64Bit && Decoder->AddressOverride)
+    {
+        //
+        // 16-bit addressing, no SIB.
+        //
+        DisplacementSize = (Mod == 1) ? 1 : (((Mod == 2) || ((Mod == 0) && (Rm == 6))) ? 2 : 0);
+    }
+    else
+    {
+        //
+        // Computed rather than branched on, the mix of forms is not predictable.
+        //
+        HasSib = (Mod != 3) & (Rm == 4);
+        Decoder->Offset += HasSib;
+
+        DisplacementSize = X86DisplacementSize[Mod];
+        DisplacementSize += ((Mod == 0) & (Rm == 5)) * 4;
+        DisplacementSize += (HasSib & (Mod == 0) & ((Decoder->Bytes[Decoder->Offset - 1] & 7) == 5)) * 4;
+
+        Instruction->RipRelative = Decoder->Is64Bit & (Mod == 0) & (Rm == 5);
+    }
+
+    Instruction->Displacement = (LONG)X86SignExtend(X86ReadValue(Decoder, DisplacementSize), DisplacementSize);
+    Instruction->HasDisplacement = (DisplacementSize != 0);
+}
+
+//
+// VEX (C4, C5), EVEX (62) and XOP (8F), Bytes follows the escape byte.
+// Returns the flags of the opcode, D_INVALID for unknown maps.
+//
+static
+ULONG
+X86DecodeExtended(
+    const UCHAR *Bytes,
+    PX86_INSTRUCTION Instruction,
+    UCHAR Escape
+)
+{
+    ULONG PayloadSize = (Escape == 0xC5) ? 1 : ((Escape == 0x62) ? 3 : 2);
+    ULONG MapSelect;
+    ULONG Flags;
+
+    if (Escape == 0xC5)
+    {
+        MapSelect = 1;
+    }
+    else
+    {
+        MapSelect = Bytes[0] & ((Escape == 0x62) ? 0x07 : 0x1F);
+        if (Bytes[1] & 0x80) Instruction->Rex |= 0x08; // W
+    }
+
+    //
+    // R, X and B (bits 7 to 5) are stored inverted, the 2-byte VEX only has R.
+    //
+    Instruction->Rex |= 0x40 | (((UCHAR)~Bytes[0] >> 5) & ((Escape == 0xC5) ? 0x04 : 0x07));
+    Instruction->Opcode = Bytes[PayloadSize];
+
+    if (Escape == 0x8F)
+    {
+        //
+        // XOP maps 8 (imm8), 9 and 0A (imm32).
+        //
+        Instruction->Map = MapSelect;
+        if (MapSelect == 8) return D_MODRM | D_IMM8;
+        else if (MapSelect == 9) return D_MODRM;
+        else if (MapSelect == 10) return D_MODRM | D_IMMZ;
+
+        return D_INVALID;
+    }
+
+    switch (MapSelect)
+    {
+        case 1:
+            Instruction->Map = 2;
+            Flags = D_MODRM | (X86TwoByteMap[Instruction->Opcode] & D_IMM8);
+
+            //
+            // vzeroupper / vzeroall.
+            //
+            if ((Escape != 0x62) && (Instruction->Opcode == 0x77)) Flags = 0;
+        break;
+        case 2:
+            Instruction->Map = 3;
+            Flags = D_MODRM;
+        break;
+        case 3:
+            Instruction->Map = 3;
+            Flags = D_MODRM | D_IMM8;
+        break;
+        case 5:
+        case 6:
+            //
+            // EVEX only (FP16).
+            //
+            if (Escape != 0x62) return D_INVALID;
+            Instruction->Map = MapSelect;
+            Flags = D_MODRM;
+        break;
+        default:
+            return D_INVALID;
+    }
+
+    return Flags;
+}
+
+ULONG
+X86Decode(
+    const UCHAR *Code,
+    ULONG Size,
+    BOOLEAN Is64Bit,
+    PX86_INSTRUCTION Instruction
+)
+{
+    X86_DECODER Decoder;
+    UCHAR Window[X86_WINDOW_SIZE];
+    ULONG Flags;
+    ULONG ImmediateSize = 0;
+    ULONG RelativeSize;
+    UCHAR Op, Prefix;
+
+    if (!Size) return 0;
+
+    //
+    // Not copied in the common case, loads from a fresh copy of the bytes
+    // are stalled by store forwarding.
+    //
+    Decoder.Bytes = Code;
+
+    if (Size < sizeof(Window))
+    {
+        RtlZeroMemory(Window, sizeof(Window));
+        memcpy(Window, Code, Size);
+        Decoder.Bytes = Window;
+    }
+
+    Decoder.Limit = min(Size, (ULONG)X86_MAX_INSTRUCTION_SIZE);
+    Decoder.Offset = 0;
+    Decoder.Is64Bit = Is64Bit;
+    Decoder.AddressOverride = FALSE;
+
+    Instruction->Map = 1;
+    Instruction->Rex = 0;
+    Instruction->ModRm = 0;
+    Instruction->HasModRm = FALSE;
+    Instruction->OperandSize16 = FALSE;
+    Instruction->RipRelative = FALSE;
+    Instruction->HasDisplacement = FALSE;
+    Instruction->Flow = X86FlowNone;
+    Instruction->Displacement = 0;
+
+    //
+    // A REX prefix only counts right before the opcode.
+    //
+    for (;; Decoder.Offset += 1)
+    {
+        if (Decoder.Offset >= Decoder.Limit) return 0;
+
+        Op = Decoder.Bytes[Decoder.Offset];
+        Prefix = X86PrefixMap[Op];
+
+        if (!Prefix || ((Prefix == X86_PREFIX_REX) && !Is64Bit)) break;
+
+        if (Prefix == X86_PREFIX_REX)
+        {
+            Instruction->Rex = Op;
+            continue;
+        }
+
+        if (Prefix == X86_PREFIX_OPERAND_SIZE) Instruction->OperandSize16 = TRUE;
+        else if (Prefix == X86_PREFIX_ADDRESS_SIZE) Decoder.AddressOverride = TRUE;
+
+        Instruction->Rex = 0;
+    }
+
+    Decoder.Offset += 1;
+    Instruction->Opcode = Op;
+
+    if (Instruction->Rex & 0x08) Instruction->OperandSize16 = FALSE;
+
+    if (Op == 0x0F)
+    {
+        Op = Decoder.Bytes[Decoder.Offset++];
+        Instruction->Opcode = Op;
+        Instruction->Map = 2;
+
+        if ((Op == 0x38) || (Op == 0x3A))
+        {
+            Instruction->Opcode = Decoder.Bytes[Decoder.Offset++];
+            Instruction->Map = 3;
+            Flags = (Op == 0x3A) ? (D_MODRM | D_IMM8) : D_MODRM;
+        }
+        else
+        {
+            Flags = X86TwoByteMap[Op];
+            if (Flags & D_INVALID) return 0;
+        }
+    }
+    else
+    {
+        Flags = X86OneByteMap[Op];
+        if (Is64Bit && (Flags & D_INVALID)) return 0;
+
+        if (Flags & D_SPECIAL)
+        {
+            UCHAR Next = Decoder.Bytes[Decoder.Offset];
+
+            if ((Op == 0xC4) || (Op == 0xC5) || (Op == 0x62))
+            {
+                //
+                // LES, LDS and BOUND in 32-bit mode, unless ModRM.mod is 11.
+                //
+                if (Is64Bit || ((Next & 0xC0) == 0xC0))
+                {
+                    Flags = X86DecodeExtended(Decoder.Bytes + Decoder.Offset, Instruction, Op);
+                    if (Flags & D_INVALID) return 0;
+                    Decoder.Offset += (Op == 0xC5) ? 2 : ((Op == 0x62) ? 4 : 3);
+                }
+                else
+                {
+                    Flags = D_MODRM;
+                }
+            }
+            else if (Op == 0x8F)
+            {
+                if ((Next & 0x1F) >= 8)
+                {
+                    Flags = X86DecodeExtended(Decoder.Bytes + Decoder.Offset, Instruction, Op);
+                    if (Flags & D_INVALID) return 0;
+                    Decoder.Offset += (Op == 0xC5) ? 2 : ((Op == 0x62) ? 4 : 3);
+                }
+                else
+                {
+                    Flags = D_MODRM;
+                }
+            }
+            else if ((Op >= 0xA0) && (Op <= 0xA3))
+            {
+                //
+                // mov al/eax, moffs: the offset has the size of an address.
+                //
+                Flags = 0;
+                if (Is64Bit) ImmediateSize = Decoder.AddressOverride ? 4 : 8;
+                else ImmediateSize = Decoder.AddressOverride ? 2 : 4;
+            }
+            else if ((Op >= 0xB8) && (Op <= 0xBF))
+            {
+                Flags = 0;
+                ImmediateSize = (Instruction->Rex & 0x08) ? 8 : (Instruction->OperandSize16 ? 2 : 4);
+            }
+            else if ((Op == 0xF6) || (Op == 0xF7))
+            {
+                //
+                // Only test (/0, /1) has an immediate.
+                //
+                Flags = D_MODRM;
+                if (((Next >> 3) & 7) <= 1) Flags |= (Op == 0xF6) ? D_IMM8 : D_IMMZ;
+            }
+        }
+    }
+
+    if (Flags & D_MODRM) X86DecodeModRm(&Decoder, Instruction);
+
+    //
+    // Sizes are summed from the flags and the operands read unconditionally,
+    // a size of 0 reads nothing.
+    //
+    ImmediateSize += ((Flags & D_IMM16) >> 2) + ((Flags & D_IMM8) >> 1);
+    ImmediateSize += ((Flags & D_IMMZ) >> 2) * (Instruction->OperandSize16 ? 2 : 4);
+    Instruction->Immediate = X86ReadValue(&Decoder, ImmediateSize);
+
+    RelativeSize = ((Flags & D_REL8) >> 4) + ((Flags & D_RELZ) >> 5) * ((Instruction->OperandSize16 && !Is64Bit) ? 2 : 4);
+    Instruction->Relative = X86SignExtend(X86ReadValue(&Decoder, RelativeSize), RelativeSize);
+
+    if (Decoder.Offset > Decoder.Limit) return 0;
+
+    //
+    // Control flow.
+    //
+    if (Instruction->Map == 1)
+    {
+        Instruction->Flow = (X86_FLOW)X86FlowMap[Op];
+
+        if (Op == 0xFF)
+        {
+            ULONG Reg = (Instruction->ModRm >> 3) & 7;
+
+            if ((Reg == 2) || (Reg == 3)) Instruction->Flow = X86FlowCallIndirect;
+            else if ((Reg == 4) || (Reg == 5)) Instruction->Flow = X86FlowJmpIndirect;
+        }
+    }
+    else if ((Instruction->Map == 2) && (Op >= 0x80) && (Op <= 0x8F))
+    {
+        Instruction->Flow = X86FlowJcc;
+    }
+
+    Instruction->Length = Decoder.Offset;
+
+    return Instruction->Length;
+}
+
+//
+// Hooks
+//
+
+static
+BOOLEAN
+X86IsSharedUserData(
+    ULONG64 Address
+)
+{
+    ULONG64 Page = Address & ~0xFFFULL;
+
+    //
+    // SystemCall pointer used by the syscall stubs, user and kernel mappings.
+    //
+    return ((Page == 0x7FFE0000ULL) || (Page == 0xFFDF0000ULL) || (Page == 0xFFFFF78000000000ULL)) ? TRUE : FALSE;
+}
+
+LPCSTR
+X86HookTypeName(
+    X86_HOOK_TYPE Type
+)
+{
+    switch (Type)
+    {
+        case X86HookNone: return "none";
+        case X86HookBranch: return "branch";
+        case X86HookIndirect: return "indirect";
+        case X86HookRegister: return "register";
+        case X86HookPushRet: return "push/ret";
+    }
+
+    return "";
+}
+
+BOOLEAN
+X86FindHook(
+    const UCHAR *Code,
+    ULONG Size,
+    ULONG64 Address,
+    BOOLEAN Is64Bit,
+    ULONG64 ModuleBase,
+    ULONG64 ModuleEnd,
+    ULONG MaxInstructions,
+    PX86_HOOK Hook
+)
+{
+    X86_INSTRUCTION Instruction;
+    ULONG64 AddressMask = Is64Bit ? MAXULONG64 : MAXULONG;
+    ULONG PointerSize = Is64Bit ? sizeof(ULONG64) : sizeof(ULONG);
+    BOOLEAN HasModule = (ModuleEnd > ModuleBase) ? TRUE : FALSE;
+
+    //
+    // Values loaded by mov reg, imm and push, until overwritten.
+    //
+    ULONG64 Registers[16];
+    ULONG KnownRegisters = 0;
+    ULONG64 Pushed = 0;
+    ULONG PushIndex = MAXULONG;
+
+    ULONG Offset = 0;
+
+    RtlZeroMemory(Hook, sizeof(*Hook));
+
+    if (!HasModule) MaxInstructions = min(MaxInstructions, 3UL);
+
+    for (ULONG Index = 0; (Index < MaxInstructions) && (Offset < Size); Index += 1)
+    {
+        ULONG64 Next, Target = 0;
+        X86_HOOK_TYPE Type = X86HookNone;
+        BOOLEAN Stop = FALSE;
+
+        if (!X86Decode(Code + Offset, Size - Offset, Is64Bit, &Instruction)) break;
+
+        Next = (Address + Offset + Instruction.Length) & AddressMask;
+
+        ULONG Reg = ((Instruction.ModRm >> 3) & 7) | ((Instruction.Rex & 0x04) << 1);
+        ULONG Rm = (Instruction.ModRm & 7) | ((Instruction.Rex & 0x01) << 3);
+        ULONG OpReg = (Instruction.Opcode & 7) | ((Instruction.Rex & 0x01) << 3);
+
+        switch (Instruction.Flow)
+        {
+            case X86FlowJmp:
+            case X86FlowJcc:
+            case X86FlowCall:
+                Target = (Next + Instruction.Relative) & AddressMask;
+
+                if (!HasModule || (Target < ModuleBase) || (Target >= ModuleEnd))
+                {
+                    Type = X86HookBranch;
+                }
+                else if (Instruction.Flow == X86FlowJmp)
+                {
+                    //
+                    // Followed while it stays in the bytes we have.
+                    //
+                    if ((Target < Address) || ((Target - Address) >= Size)) Stop = TRUE;
+                    else Offset = (ULONG)(Target - Address) - Instruction.Length;
+                }
+            break;
+
+            case X86FlowJmpIndirect:
+            case X86FlowCallIndirect:
+                if ((Instruction.ModRm >> 6) == 3)
+                {
+                    if (KnownRegisters & (1 << Rm))
+                    {
+                        Target = Registers[Rm] & AddressMask;
+                        if (!HasModule || (Target < ModuleBase) || (Target >= ModuleEnd)) Type = X86HookRegister;
+                    }
+                }
+                else
+                {
+                    ULONG64 Slot = 0;
+                    BOOLEAN HasSlot = FALSE;
+                    ULONG Mod = Instruction.ModRm >> 6;
+
+                    if (Instruction.RipRelative)
+                    {
+                        Slot = (Next + Instruction.Displacement) & AddressMask;
+                        HasSlot = TRUE;
+                    }
+                    else if (!Is64Bit && (Mod == 0) && ((Instruction.ModRm & 7) == 5))
+                    {
+                        Slot = (ULONG)Instruction.Displacement;
+                        HasSlot = TRUE;
+                    }
+                    else if (((Instruction.ModRm & 7) != 4) && (KnownRegisters & (1 << Rm)))
+                    {
+                        //
+                        // mov edx, imm / call [edx], as in the syscall stubs.
+                        //
+                        Slot = (Registers[Rm] + Instruction.Displacement) & AddressMask;
+                        HasSlot = TRUE;
+                    }
+
+                    if (HasSlot && !X86IsSharedUserData(Slot))
+                    {
+                        if ((Size >= PointerSize) && (Slot >= Address) && ((Slot - Address) <= (Size - PointerSize)))
+                        {
+                            //
+                            // jmp [rip+0] followed by the address, the target is in the code itself.
+                            //
+                            memcpy(&Target, Code + (Slot - Address), PointerSize);
+                            if (!HasModule || (Target < ModuleBase) || (Target >= ModuleEnd)) Type = X86HookIndirect;
+                        }
+                        else if (!HasModule || (Slot < ModuleBase) || (Slot >= ModuleEnd))
+                        {
+                            Type = X86HookIndirect;
+                        }
+                    }
+                }
+
+                if (Instruction.Flow == X86FlowJmpIndirect) Stop = TRUE;
+            break;
+
+            case X86FlowRet:
+                if (Index && (PushIndex == (Index - 1)))
+                {
+                    Target = Pushed & AddressMask;
+                    if (!HasModule || (Target < ModuleBase) || (Target >= ModuleEnd)) Type = X86HookPushRet;
+                }
+
+                Stop = TRUE;
+            break;
+
+            case X86FlowInt3:
+                Stop = TRUE;
+            break;
+
+            default:
+                if ((Instruction.Map == 1) && (Instruction.Opcode >= 0xB8) && (Instruction.Opcode <= 0xBF))
+                {
+                    //
+                    // mov reg, imm (32-bit results are zero extended).
+                    //
+                    Registers[OpReg] = Instruction.Immediate;
+                    KnownRegisters |= (1 << OpReg);
+                }
+                else if ((Instruction.Map == 1) && (Instruction.Opcode == 0xC7) && ((Instruction.ModRm >> 6) == 3))
+                {
+                    Registers[Rm] = (Instruction.Rex & 0x08) ? (ULONG64)X86SignExtend(Instruction.Immediate, 4) : Instruction.Immediate;
+                    KnownRegisters |= (1 << Rm);
+                }
+                else if ((Instruction.Map == 1) && ((Instruction.Opcode == 0x68) || (Instruction.Opcode == 0x6A)))
+                {
+                    Pushed = (ULONG64)X86SignExtend(Instruction.Immediate, (Instruction.Opcode == 0x6A) ? 1 : 4);
+                    PushIndex = Index;
+                }
+                else if ((Instruction.Map == 1) && (Instruction.Opcode >= 0x50) && (Instruction.Opcode <= 0x57))
+                {
+                    if (KnownRegisters & (1 << OpReg))
+                    {
+                        Pushed = Registers[OpReg];
+                        PushIndex = Index;
+                    }
+                }
+                else
+                {
+                    //
+                    // Anything else may overwrite the registers it names.
+                    //
+                    if (Instruction.HasModRm)
+                    {
+                        KnownRegisters &= ~(1 << Reg);
+                        if ((Instruction.ModRm >> 6) == 3) KnownRegisters &= ~(1 << Rm);
+                    }
+
+                    if ((Instruction.Map == 1) &&
+                        (((Instruction.Opcode >= 0x40) && (Instruction.Opcode <= 0x4F)) ||
+                         ((Instruction.Opcode >= 0x58) && (Instruction.Opcode <= 0x5F)) ||
+                         ((Instruction.Opcode >= 0x90) && (Instruction.Opcode <= 0x97)) ||
+                         ((Instruction.Opcode >= 0xB0) && (Instruction.Opcode <= 0xB7))))
+                    {
+                        KnownRegisters &= ~(1 << OpReg);
+                    }
+                }
+            break;
+        }
+
+        if (Type != X86HookNone)
+        {
+            Hook->Type = Type;
+            Hook->Offset = Offset;
+            Hook->InstructionIndex = Index;
+            Hook->Target = Target;
+
+            return TRUE;
+        }
+
+        if (Stop) break;
+
+        Offset += Instruction.Length;
+    }
+
+    return FALSE;
+}
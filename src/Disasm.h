@@ -0,0 +1,127 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - Disasm.h
+
+Abstract:
+
+    - Table-driven x86/x64 instruction length decoder, and inline hook
+      detection following the first instructions of a function.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __DISASM_H__
+#define __DISASM_H__
+
+#define X86_MAX_INSTRUCTION_SIZE 15
+
+//
+// Instructions followed from the start of a function, and bytes needed to do so.
+//
+#define HOOK_SCAN_DEPTH 16
+#define HOOK_SCAN_SIZE 0x100
+
+typedef enum _X86_FLOW {
+    X86FlowNone = 0,
+    X86FlowJmp, // jmp rel
+    X86FlowJcc, // jcc/loop/jrcxz rel
+    X86FlowCall, // call rel
+    X86FlowJmpIndirect, // jmp r/m
+    X86FlowCallIndirect, // call r/m
+    X86FlowRet,
+    X86FlowInt3
+} X86_FLOW;
+
+typedef struct _X86_INSTRUCTION {
+    ULONG Length;
+    ULONG Map; // 1 (one byte opcode), 2 (0F), 3 (0F 38 / 0F 3A).
+    UCHAR Opcode;
+    UCHAR Rex;
+    UCHAR ModRm;
+    BOOLEAN HasModRm;
+    BOOLEAN OperandSize16;
+    BOOLEAN RipRelative;
+    BOOLEAN HasDisplacement;
+    X86_FLOW Flow;
+
+    LONG Displacement; // Memory operand.
+    ULONG64 Immediate; // Zero extended.
+    LONG64 Relative; // Branch displacement, from the end of the instruction.
+} X86_INSTRUCTION, *PX86_INSTRUCTION;
+
+typedef enum _X86_HOOK_TYPE {
+    X86HookNone = 0,
+    X86HookBranch, // jmp, jcc or call rel.
+    X86HookIndirect, // jmp/call [mem] through a pointer outside of the module.
+    X86HookRegister, // mov reg, imm then jmp/call/push reg.
+    X86HookPushRet // push imm then ret.
+} X86_HOOK_TYPE;
+
+typedef struct _X86_HOOK {
+    X86_HOOK_TYPE Type;
+    ULONG Offset; // Of the branch, from the start of the function.
+    ULONG InstructionIndex;
+    ULONG64 Target; // Where it leads, 0 if unknown (e.g. slot outside of the code).
+} X86_HOOK, *PX86_HOOK;
+
+//
+// Returns the length of the instruction, 0 if it is invalid or does not fit in Size.
+//
+ULONG
+X86Decode(
+    const UCHAR *Code,
+    ULONG Size,
+    BOOLEAN Is64Bit,
+    PX86_INSTRUCTION Instruction
+);
+
+//
+// Follows the first MaxInstructions of the function at Address (Code holds Size bytes
+// from there) and reports the first control transfer leaving [ModuleBase, ModuleEnd).
+// Jumps staying inside Code are followed. Without module (ModuleEnd == 0), only the
+// first three instructions are checked and any jmp/call/push-ret there is reported.
+//
+BOOLEAN
+X86FindHook(
+    const UCHAR *Code,
+    ULONG Size,
+    ULONG64 Address,
+    BOOLEAN Is64Bit,
+    ULONG64 ModuleBase,
+    ULONG64 ModuleEnd,
+    ULONG MaxInstructions,
+    PX86_HOOK Hook
+);
+
+LPCSTR
+X86HookTypeName(
+    X86_HOOK_TYPE Type
+);
+
+#endif
@@ -134,10 +134,101 @@ GetDrivers()
 
     for each (HANDLE_OBJECT DriverObject in DriverObjects)
     {
-        MsDriverObject Driver(DriverObject.ObjectPtr);
-
-        Drivers.push_back(Driver);
+        Drivers.push_back(MsDriverObject(DriverObject.ObjectPtr));
     }
 
     return Drivers;
+}
+
+vector<MsDllObject>
+GetKernelModules()
+{
+    ExtRemoteTypedList Modules = ExtNtOsInformation::GetKernelLoadedModuleList();
+    vector<MsDllObject> Result;
+
+    //
+    // nt!_KLDR_DATA_TABLE_ENTRY has the same DllBase/SizeOfImage/*DllName fields as nt!_LDR_DATA_TABLE_ENTRY.
+    //
+    for (Modules.StartHead(); Modules.HasNode(); Modules.Next())
+    {
+        Result.push_back(MsDllObject(Modules.GetTypedNode()));
+    }
+
+    return Result;
+}
+
+static
+BOOLEAN
+GetReferencePath(
+    LPCWSTR ReferenceDirectory,
+    MsDllObject& Module,
+    LPWSTR Path,
+    ULONG PathCount
+)
+{
+    LPCWSTR Names[2];
+    LPCWSTR FileName = wcsrchr(Module.mm_CcDllObject.FullDllName, L'\\');
+
+    Names[0] = Module.mm_CcDllObject.DllName;
+    Names[1] = FileName ? FileName + 1 : Module.mm_CcDllObject.FullDllName;
+
+    for (ULONG i = 0; i < _countof(Names); i += 1)
+    {
+        if (!Names[i][0]) continue;
+
+        swprintf_s(Path, PathCount, L"%s\\%s", ReferenceDirectory, Names[i]);
+        if (GetFileAttributesW(Path) != INVALID_FILE_ATTRIBUTES) return TRUE;
+    }
+
+    swprintf_s(Path, PathCount, L"%s\\%s", ReferenceDirectory, Names[0]);
+
+    return FALSE;
+}
+
+VOID
+CheckImagesIntegrity(
+    vector<MsDllObject>& Modules,
+    LPCWSTR ReferenceDirectory,
+    vector<ImageIntegrity>& Checks
+)
+{
+    //
+    // Captures are done from the engine thread in batches, the comparisons of a batch
+    // run on the worker pool. Results are stored by index.
+    //
+    for (ULONG First = 0, Last = 0; First < Modules.size(); First = Last)
+    {
+        vector<ULONG> Batch;
+        ULONG64 BatchSize = 0;
+
+        for (Last = First; (Last < Modules.size()) && (BatchSize < INTEGRITY_BATCH_MAX_SIZE); Last += 1)
+        {
+            WCHAR Path[MAX_PATH];
+
+            GetReferencePath(ReferenceDirectory, Modules[Last], Path, _countof(Path));
+
+            if (Checks[Last].Capture(Modules[Last].m_ImageBase, Path, ReadVirtualPages))
+            {
+                Batch.push_back(Last);
+                BatchSize += Checks[Last].GetCapturedSize();
+            }
+        }
+
+        vector<BOOLEAN> Failed;
+
+        g_Scheduler.Run((ULONG)Batch.size(), [&Batch, &Checks](ULONG Index)
+        {
+            Checks[Batch[Index]].Compare();
+            Checks[Batch[Index]].Close();
+        }, &Failed);
+
+        for (ULONG i = 0; i < Batch.size(); i += 1)
+        {
+            if (!Failed[i]) continue;
+
+            Checks[Batch[i]].m_Status = IntegrityFailed;
+            Checks[Batch[i]].m_Patches.clear();
+            Checks[Batch[i]].Close();
+        }
+    }
 }
\ No newline at end of file
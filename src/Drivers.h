@@ -119,6 +119,24 @@ public:
     }
     ~MsDriverObject();
 
+    MsDriverObject(MsDriverObject&& other) :
+        PEFile(move(other)),
+        mm_DriverInfo(other.mm_DriverInfo),
+        m_TypedObject(other.m_TypedObject)
+    {
+    }
+
+    MsDriverObject& operator=(MsDriverObject&& other)
+    {
+        if (this != &other)
+        {
+            MoveFrom(other);
+            mm_DriverInfo = other.mm_DriverInfo;
+            m_TypedObject = other.m_TypedObject;
+        }
+        return *this;
+    }
+
     VOID Set();
 
     BOOLEAN Init(VOID);
@@ -132,4 +150,11 @@ vector<MsDriverObject>
 GetDrivers(
 );
 
+//
+// PsLoadedModuleList, including drivers without a driver object.
+//
+vector<MsDllObject>
+GetKernelModules(
+);
+
 #endif
\ No newline at end of file
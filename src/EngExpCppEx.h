@@ -48,12 +48,40 @@ GetNameByOffset(
     ULONG NameSize
 );
 
+ULONG
+GetNamesByOffsets(
+    ULONG Count,
+    PULONG64 Offsets,
+    LPSTR Names,
+    ULONG NameSize
+);
+
+extern SymbolCache g_SymbolCache;
+extern CodeCache g_CodeCache;
+
+//
+// Follows the first instructions of the function at Ptr, through g_CodeCache.
+// Engine thread only.
+//
 BOOLEAN
 IsPointerHooked(
-ULONG64 Ptr
+ULONG64 Ptr,
+PX86_HOOK Hook = NULL
 );
 
 
+//
+// Reads a range of the current context. Pages that can't be read are zero-filled and
+// reported to Hole (offset and size in Buffer), returns the number of such pages.
+//
+ULONG
+ReadVirtualPages(
+ULONG64 Address,
+PUCHAR Buffer,
+ULONG Size,
+const function<VOID(ULONG Offset, ULONG Size)>& Hole
+);
+
 ULONG64
 GetFastRefPointer(
 ULONG64 Pointer
@@ -83,7 +111,8 @@ public:
 
     static LPWSTR
         ExtRemoteTypedEx::GetUnicodeString2(
-        ExtRemoteTyped TypedObject
+        ExtRemoteTyped TypedObject,
+        Arena *Allocator = NULL
     );
 
     static LPWSTR
@@ -39,7 +39,8 @@ Revision History:
 
 LPWSTR
 ExtRemoteTypedEx::GetUnicodeString2(
-ExtRemoteTyped TypedObject
+ExtRemoteTyped TypedObject,
+Arena *Allocator
 )
 {
     LPWSTR String = NULL;
@@ -55,7 +56,10 @@ ExtRemoteTyped TypedObject
     MaxLen = max(MaxLen, Len);
     MaxLen += sizeof(WCHAR);
 
-    String = (LPWSTR)malloc(MaxLen);
+    //
+    // Without an arena, the caller has to free() the string.
+    //
+    String = (LPWSTR)(Allocator ? Allocator->Alloc(MaxLen) : malloc(MaxLen));
     if (!String) return NULL;
 
     return GetUnicodeString(TypedObject, String, MaxLen);
@@ -227,6 +231,38 @@ ULONG64 Address
     // return SIGN_EXTEND(Pointer);
 }
 
+bool
+DbgEngResolveName(
+    void *Context,
+    uint64_t Offset,
+    char *Name,
+    uint32_t NameSize
+)
+{
+    UNREFERENCED_PARAMETER(Context);
+
+    return (g_Ext->m_Symbols->GetNameByOffset(Offset, (PSTR)Name, NameSize, NULL, NULL) == S_OK);
+}
+
+SymbolCache g_SymbolCache(DbgEngResolveName, NULL);
+
+ULONG64
+GetSymbolTag(
+    ULONG64 Offset
+)
+{
+    ULONG64 ProcessDataOffset = 0ULL;
+
+    //
+    // Kernel addresses are shared by every process, user-mode ones depend on the current process.
+    //
+    if (Offset & 0x8000000000000000ULL) return 0ULL;
+
+    if (g_Ext->m_System2->GetImplicitProcessDataOffset(&ProcessDataOffset) != S_OK) ProcessDataOffset = 0ULL;
+
+    return ProcessDataOffset;
+}
+
 LPSTR
 GetNameByOffset(
     ULONG64 Offset,
@@ -234,14 +270,12 @@ GetNameByOffset(
     ULONG NameSize
 )
 {
-    HRESULT hResult;
     RtlZeroMemory(Name, NameSize);
 
     if (Offset)
     {
         // TODO: GetOffsetSymbol()
-        hResult = g_Ext->m_Symbols->GetNameByOffset(Offset, (PSTR)Name, NameSize, NULL, NULL);
-        if (hResult != S_OK)
+        if (!g_SymbolCache.Lookup(Offset, GetSymbolTag(Offset), Name, NameSize))
         {
             strcpy_s((LPSTR)Name, NameSize, "*UNKNOWN*");
         }
@@ -250,61 +284,148 @@ GetNameByOffset(
     return Name;
 }
 
-BOOLEAN
-IsPointerHooked(
-ULONG64 Ptr
+ULONG
+GetNamesByOffsets(
+    ULONG Count,
+    PULONG64 Offsets,
+    LPSTR Names,
+    ULONG NameSize
 )
 {
-    UCHAR ByteCode[0x20] = { 0 };
-    BOOLEAN Hooked = FALSE;
+    ULONG Resolved;
+
+    if (!Count) return 0;
 
-    if (g_Ext->m_Data->ReadVirtual(Ptr, ByteCode, sizeof(ByteCode), NULL) != S_OK) goto CleanUp;
+    //
+    // Every entry of a batch is expected to live in the same address space as the first one.
+    //
+    Resolved = g_SymbolCache.LookupBatch(Count, Offsets, GetSymbolTag(Offsets[0]), Names, NameSize);
 
-    if (ByteCode[0] == 0xe9) // jmp
+    for (ULONG i = 0; i < Count; i += 1)
     {
-        Hooked = TRUE;
-        goto CleanUp;
+        LPSTR Name = Names + ((SIZE_T)i * NameSize);
+
+        if (Offsets[i] && (Name[0] == '\0')) strcpy_s(Name, NameSize, "*UNKNOWN*");
     }
-    else if (ByteCode[0] == 0xe8) // call
+
+    return Resolved;
+}
+
+BOOLEAN
+DbgEngReadCodePage(
+    PVOID Context,
+    ULONG64 Address,
+    PUCHAR Buffer
+)
+{
+    ULONG BytesRead = 0;
+
+    UNREFERENCED_PARAMETER(Context);
+
+    if (g_Ext->m_Data->ReadVirtual(Address, Buffer, CODE_CACHE_PAGE_SIZE, &BytesRead) != S_OK) return FALSE;
+
+    return (BytesRead == CODE_CACHE_PAGE_SIZE);
+}
+
+VOID
+DbgEngLoadModules(
+    PVOID Context,
+    vector<CodeCache::CODE_MODULE>& Modules
+)
+{
+    vector<DEBUG_MODULE_PARAMETERS> Parameters;
+    ULONG Loaded = 0, Unloaded = 0;
+
+    UNREFERENCED_PARAMETER(Context);
+
+    if (g_Ext->m_Symbols->GetNumberModules(&Loaded, &Unloaded) != S_OK) return;
+    if (!Loaded) return;
+
+    Parameters.resize(Loaded);
+    if (g_Ext->m_Symbols->GetModuleParameters(Loaded, NULL, 0, &Parameters[0]) != S_OK) return;
+
+    for (ULONG i = 0; i < Loaded; i += 1)
     {
-        Hooked = TRUE;
-        goto CleanUp;
+        CodeCache::CODE_MODULE Module = { 0 };
+
+        if ((Parameters[i].Base == DEBUG_INVALID_OFFSET) || !Parameters[i].Size) continue;
+
+        Module.Base = Parameters[i].Base;
+        Module.End = Parameters[i].Base + Parameters[i].Size;
+        Modules.push_back(Module);
     }
-    else if ((ByteCode[0] == 0xb8) && // mov eax, XXXXXXXX
-        (ByteCode[5] == 0xba) && // mov edx, XXXXXXXX
-        (ByteCode[0xa] == 0xff) && (ByteCode[0xb] == 0x12) && // call [edx]
-        (ByteCode[0xc] == 0xc2)) // retn
+}
+
+CodeCache g_CodeCache(DbgEngReadCodePage, DbgEngLoadModules, NULL);
+
+BOOLEAN
+IsPointerHooked(
+ULONG64 Ptr,
+PX86_HOOK Hook
+)
+{
+    X86_HOOK LocalHook;
+
+    if (!Hook) Hook = &LocalHook;
+
+    RtlZeroMemory(Hook, sizeof(*Hook));
+
+    if (!Ptr) return FALSE;
+
+    return g_CodeCache.FindHook(GetSymbolTag(Ptr),
+                                Ptr,
+                                (g_Ext->m_Control->IsPointer64Bit() == S_OK),
+                                Hook);
+}
+
+ULONG
+ReadVirtualPages(
+ULONG64 Address,
+PUCHAR Buffer,
+ULONG Size,
+const function<VOID(ULONG Offset, ULONG Size)>& Hole
+)
+{
+    ULONG Offset = 0;
+    ULONG NumberOfHoles = 0;
+
+    while (Offset < Size)
     {
-        // NT Syscall
-        ULONG Edx = ByteCode[6] | (ByteCode[7] << 8) | (ByteCode[8] << 16) | (ByteCode[9] << 24);
-        if (Edx != 0x7ffe0300)
+        ULONG BytesRead = 0;
+        ULONG PageEnd;
+
+        //
+        // Reads stop at the first page that can't be read, BytesRead tells where.
+        //
+        g_Ext->m_Data->ReadVirtual(Address + Offset, Buffer + Offset, Size - Offset, &BytesRead);
+        if (BytesRead > (Size - Offset)) BytesRead = 0;
+
+        Offset += BytesRead;
+        if (Offset >= Size) break;
+
+        PageEnd = (ULONG)((((Address + Offset) & ~((ULONG64)PAGE_SIZE - 1)) + PAGE_SIZE) - Address);
+        PageEnd = min(PageEnd, Size);
+
+        //
+        // Some targets fail a large read without reporting the readable part.
+        //
+        if ((g_Ext->m_Data->ReadVirtual(Address + Offset, Buffer + Offset, PageEnd - Offset, &BytesRead) == S_OK) &&
+            (BytesRead == (PageEnd - Offset)))
         {
-            Hooked = TRUE;
-            goto CleanUp;
+            Offset = PageEnd;
+            continue;
         }
-    }
-    else if ((ByteCode[0] == 0x68) && // push XXXXXXX
-        (ByteCode[5] == 0xc3)) // ret
-    {
-        Hooked = TRUE;
-        goto CleanUp;
-    }
-    else if ((ByteCode[0] == 0xff) && (ByteCode[1] == 0x25)) // jmp dword ptr [XXXXXXXX]
-    {
-        Hooked = TRUE;
-        goto CleanUp;
-    }
-    else if ((ByteCode[0] == 0xff) && (ByteCode[1] == 0x15)) // call dword ptr [XXXXXXXX]
-    {
-        Hooked = TRUE;
-        goto CleanUp;
+
+        RtlZeroMemory(Buffer + Offset, PageEnd - Offset);
+        Hole(Offset, PageEnd - Offset);
+        NumberOfHoles += 1;
+
+        Offset = PageEnd;
     }
 
-CleanUp:
-    return Hooked;
+    return NumberOfHoles;
 }
 
-
 ULONG64
 GetFastRefPointer(
 ULONG64 Pointer
@@ -0,0 +1,225 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - Entropy.cpp
+
+Abstract:
+
+    - Byte histograms are counted in four tables, consecutive bytes go to
+      different tables so that runs of the same byte do not wait on the
+      increment of the previous one. Blocks of a single byte value are
+      counted at once. The x * log2(x) terms of a page come from a table.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+using namespace std;
+
+#include "Entropy.h"
+
+//
+// Count * log2(Count) for the byte counts of a page.
+//
+static float g_EntropyTable[ENTROPY_PAGE_SIZE + 1];
+
+static
+BOOLEAN
+BuildEntropyTable(
+)
+{
+    g_EntropyTable[0] = 0.0f;
+
+    for (ULONG i = 1; i <= ENTROPY_PAGE_SIZE; i += 1) g_EntropyTable[i] = (float)(i * log((double)i) / log(2.0));
+
+    return TRUE;
+}
+
+static BOOLEAN g_EntropyTableReady = BuildEntropyTable();
+
+ULONG
+GetPageEntropy(
+    const UCHAR *Data,
+    ULONG Length,
+    PULONG64 Histogram
+)
+{
+    ULONG Counts[4][256];
+    float Sum = 0.0f;
+    ULONG i = 0;
+
+    if (Length > ENTROPY_PAGE_SIZE) Length = ENTROPY_PAGE_SIZE;
+    if (Length == 0) return 0;
+
+    RtlZeroMemory(Counts, sizeof(Counts));
+
+    for (; (i + 16) <= Length; i += 16)
+    {
+        ULONG64 Low, High;
+
+        memcpy(&Low, Data + i, sizeof(Low));
+        memcpy(&High, Data + i + 8, sizeof(High));
+
+        //
+        // Zero and padding pages, one increment instead of a chain of sixteen.
+        //
+        if ((Low == High) && (Low == ((Low & 0xFF) * 0x0101010101010101ULL)))
+        {
+            Counts[0][(UCHAR)Low] += 16;
+            continue;
+        }
+
+        //
+        // Tables 0 1 2 3 1 0 3 2 within a word, every other byte (UTF-16 text) and
+        // every fourth byte still go to four different tables.
+        //
+        Counts[0][(UCHAR)Low]++;
+        Counts[1][(UCHAR)(Low >> 8)]++;
+        Counts[2][(UCHAR)(Low >> 16)]++;
+        Counts[3][(UCHAR)(Low >> 24)]++;
+        Counts[1][(UCHAR)(Low >> 32)]++;
+        Counts[0][(UCHAR)(Low >> 40)]++;
+        Counts[3][(UCHAR)(Low >> 48)]++;
+        Counts[2][(UCHAR)(Low >> 56)]++;
+
+        Counts[0][(UCHAR)High]++;
+        Counts[1][(UCHAR)(High >> 8)]++;
+        Counts[2][(UCHAR)(High >> 16)]++;
+        Counts[3][(UCHAR)(High >> 24)]++;
+        Counts[1][(UCHAR)(High >> 32)]++;
+        Counts[0][(UCHAR)(High >> 40)]++;
+        Counts[3][(UCHAR)(High >> 48)]++;
+        Counts[2][(UCHAR)(High >> 56)]++;
+    }
+
+    for (; i < Length; i += 1) Counts[i & 3][Data[i]]++;
+
+    for (ULONG Byte = 0; Byte < 256; Byte += 1)
+    {
+        ULONG Count = Counts[0][Byte] + Counts[1][Byte] + Counts[2][Byte] + Counts[3][Byte];
+
+        Sum += g_EntropyTable[Count];
+        if (Histogram) Histogram[Byte] += Count;
+    }
+
+    //
+    // H = log2(N) - Sum(c * log2(c)) / N, and N * log2(N) is in the table as well.
+    //
+    return (ULONG)((((g_EntropyTable[Length] - Sum) / Length) * ENTROPY_SCALE) + 0.5f);
+}
+
+VOID
+EntropyInit(
+    PENTROPY_CONTEXT Context,
+    ULONG64 Length
+)
+{
+    ULONG Width;
+
+    RtlZeroMemory(Context, sizeof(ENTROPY_CONTEXT));
+
+    Context->Summary.NumberOfPages = (ULONG)((Length + ENTROPY_PAGE_SIZE - 1) / ENTROPY_PAGE_SIZE);
+
+    Width = min(Context->Summary.NumberOfPages, (ULONG)ENTROPY_MAP_WIDTH);
+    memset(Context->Summary.Map, '.', Width);
+}
+
+ULONG
+EntropyUpdate(
+    PENTROPY_CONTEXT Context,
+    const UCHAR *Page,
+    ULONG Length
+)
+{
+    PENTROPY_SUMMARY Summary = &Context->Summary;
+    ULONG Entropy = GetPageEntropy(Page, Length, Context->Histogram);
+
+    Context->Length += Length;
+
+    if (Context->Page < Summary->NumberOfPages)
+    {
+        ULONG Width = min(Summary->NumberOfPages, (ULONG)ENTROPY_MAP_WIDTH);
+        ULONG Column = (ULONG)(((ULONG64)Context->Page * Width) / Summary->NumberOfPages);
+        CHAR Bits = (CHAR)('0' + (Entropy / ENTROPY_SCALE));
+
+        if (Entropy && ((Summary->Map[Column] == '.') || (Summary->Map[Column] < Bits))) Summary->Map[Column] = Bits;
+    }
+
+    if (Entropy > Summary->MaxPageEntropy) Summary->MaxPageEntropy = Entropy;
+    if (Entropy >= ENTROPY_HIGH) Summary->NumberOfHighPages += 1;
+
+    Context->Page += 1;
+
+    return Entropy;
+}
+
+VOID
+EntropyFinal(
+    PENTROPY_CONTEXT Context,
+    PENTROPY_SUMMARY Summary
+)
+{
+    double Sum = 0.0;
+
+    for (ULONG Byte = 0; Byte < 256; Byte += 1)
+    {
+        if (Context->Histogram[Byte]) Sum += Context->Histogram[Byte] * log((double)Context->Histogram[Byte]);
+    }
+
+    if (Context->Length)
+    {
+        double Length = (double)Context->Length;
+
+        Context->Summary.Entropy = (ULONG)((((log(Length) - (Sum / Length)) / log(2.0)) * ENTROPY_SCALE) + 0.5);
+    }
+
+    *Summary = Context->Summary;
+}
+
+VOID
+GetEntropySummary(
+    const UCHAR *Data,
+    ULONG64 Length,
+    PENTROPY_SUMMARY Summary
+)
+{
+    ENTROPY_CONTEXT Context;
+
+    EntropyInit(&Context, Length);
+
+    for (ULONG64 Offset = 0; Offset < Length; Offset += ENTROPY_PAGE_SIZE)
+    {
+        EntropyUpdate(&Context, Data + Offset, (ULONG)min(Length - Offset, (ULONG64)ENTROPY_PAGE_SIZE));
+    }
+
+    EntropyFinal(&Context, Summary);
+}
@@ -0,0 +1,117 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - Entropy.h
+
+Abstract:
+
+    - Shannon entropy of memory ranges, page by page, and the entropy map
+      summarizing a VAD or a PE section.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __ENTROPY_H__
+#define __ENTROPY_H__
+
+#define ENTROPY_PAGE_SIZE 0x1000
+
+//
+// Entropies are in 1/ENTROPY_SCALE bit per byte, from 0 to 8 * ENTROPY_SCALE. Packed and
+// encrypted data is usually above ENTROPY_HIGH (7.25 bits), code and text well below.
+//
+#define ENTROPY_SCALE 32
+#define ENTROPY_HIGH ((7 * ENTROPY_SCALE) + (ENTROPY_SCALE / 4))
+
+#define ENTROPY_MAP_WIDTH 64
+
+typedef struct _ENTROPY_SUMMARY {
+    ULONG Entropy; // Of the whole range.
+    ULONG MaxPageEntropy;
+    ULONG NumberOfPages;
+    ULONG NumberOfHighPages; // At least ENTROPY_HIGH.
+
+    //
+    // One character per group of pages, whole bits of the highest entropy of the group
+    // ('0' to '8'), '.' for constant pages.
+    //
+    CHAR Map[ENTROPY_MAP_WIDTH + 1];
+} ENTROPY_SUMMARY, *PENTROPY_SUMMARY;
+
+typedef struct _ENTROPY_CONTEXT {
+    ULONG64 Histogram[256]; // Of the pages seen so far.
+    ULONG64 Length;
+    ULONG Page;
+    ENTROPY_SUMMARY Summary;
+} ENTROPY_CONTEXT, *PENTROPY_CONTEXT;
+
+//
+// Entropy of Length bytes, at most ENTROPY_PAGE_SIZE. Histogram (optional) gets the
+// byte counts added.
+//
+ULONG
+GetPageEntropy(
+    const UCHAR *Data,
+    ULONG Length,
+    PULONG64 Histogram
+);
+
+//
+// Length is the size of the whole range, pages are then added in order.
+//
+VOID
+EntropyInit(
+    PENTROPY_CONTEXT Context,
+    ULONG64 Length
+);
+
+//
+// Adds the next page (the last one can be shorter) and returns its entropy.
+//
+ULONG
+EntropyUpdate(
+    PENTROPY_CONTEXT Context,
+    const UCHAR *Page,
+    ULONG Length
+);
+
+VOID
+EntropyFinal(
+    PENTROPY_CONTEXT Context,
+    PENTROPY_SUMMARY Summary
+);
+
+VOID
+GetEntropySummary(
+    const UCHAR *Data,
+    ULONG64 Length,
+    PENTROPY_SUMMARY Summary
+);
+
+#endif
@@ -0,0 +1,300 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - ExportIndex.cpp
+
+Abstract:
+
+    - Session-wide index of exported functions, and the resolution of imports through it.
+    - Only depends on the PE parser, test/ExportIndexTest.cpp builds it alone.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <functional>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "FuzzyHash.h"
+#include "Entropy.h"
+#include "HashStream.h"
+#include "Arena.h"
+#include "ImageIdentity.h"
+#include "DbgHelpEx.h"
+#include "ExportIndex.h"
+
+ExportIndex g_ExportIndex;
+
+ExportIndex::ExportIndex(
+)
+{
+    ResetStats();
+}
+
+VOID
+ExportIndex::MakeKey(
+    string& Key,
+    LPCSTR ModuleName,
+    ULONG PtrSize,
+    ULONG ImageSize,
+    LPCSTR Name,
+    ULONG Ordinal
+)
+{
+    CHAR Prefix[32];
+
+    sprintf_s(Prefix, sizeof(Prefix), "%u:%08x:", PtrSize, ImageSize);
+
+    Key = Prefix;
+    Key += ModuleName;
+
+    if (Name && Name[0])
+    {
+        Key += '!';
+        Key += Name;
+    }
+    else
+    {
+        sprintf_s(Prefix, sizeof(Prefix), "#%u", Ordinal);
+        Key += Prefix;
+    }
+}
+
+VOID
+ExportIndex::AddModule(
+    LPCSTR ModuleName,
+    ULONG PtrSize,
+    PEFile *Image
+)
+{
+    string Key;
+
+    MakeKey(Key, ModuleName, PtrSize, Image->m_ImageSize, NULL, 0);
+
+    //
+    // Every process loads the same modules, they are indexed once per session.
+    //
+    if (m_Modules.find(Key) != m_Modules.end()) return;
+
+    m_Modules[Key] = (ULONG)Image->m_Exports.size();
+    m_Stats.Modules += 1;
+
+    for (PEFile::EXPORT_INFO& ExportInfo : Image->m_Exports)
+    {
+        EXPORT_TARGET Target;
+
+        Target.Rva = (ULONG)ExportInfo.Address;
+        if (ExportInfo.IsForwarder) Target.Forwarder = ExportInfo.Forwarder;
+
+        if (ExportInfo.Name[0])
+        {
+            MakeKey(Key, ModuleName, PtrSize, Image->m_ImageSize, ExportInfo.Name, 0);
+            m_Entries[Key] = Target;
+        }
+
+        MakeKey(Key, ModuleName, PtrSize, Image->m_ImageSize, NULL, ExportInfo.Ordinal + Image->m_OrdinalBase);
+        m_Entries[Key] = Target;
+    }
+
+    m_Stats.Entries = m_Entries.size();
+}
+
+const ExportIndex::EXPORT_TARGET *
+ExportIndex::Find(
+    LPCSTR ModuleName,
+    ULONG PtrSize,
+    ULONG ImageSize,
+    LPCSTR Name,
+    ULONG Ordinal
+)
+{
+    unordered_map<string, EXPORT_TARGET>::const_iterator It;
+    string Key;
+
+    m_Stats.Lookups += 1;
+
+    MakeKey(Key, ModuleName, PtrSize, ImageSize, Name, Ordinal);
+
+    It = m_Entries.find(Key);
+    if (It == m_Entries.end()) return NULL;
+
+    m_Stats.Hits += 1;
+    if (!It->second.Forwarder.empty()) m_Stats.Forwards += 1;
+
+    return &It->second;
+}
+
+VOID
+ExportIndex::NormalizeModuleName(
+    LPSTR Name,
+    ULONG NameSize
+)
+{
+    _strlwr_s(Name, NameSize);
+
+    //
+    // Forwarders omit the extension ("NTDLL.RtlAllocateHeap").
+    //
+    if (!strchr(Name, '.')) strcat_s(Name, NameSize, ".dll");
+}
+
+VOID
+ExportIndex::MakeModuleKey(
+    string& Key,
+    LPCSTR Name,
+    ULONG PtrSize
+)
+{
+    Key = Name;
+    Key += (PtrSize == sizeof(ULONG)) ? "|32" : "|64";
+}
+
+BOOLEAN
+ExportIndex::ResolveImport(
+    LOADED_MODULE_MAP& Modules,
+    ULONG PtrSize,
+    PEFile::PIMPORT_INFO Import,
+    PULONG64 Expected
+)
+{
+    CHAR Module[64];
+    CHAR Function[128];
+    ULONG Ordinal = Import->Ordinal;
+    string Key;
+
+    strcpy_s(Module, sizeof(Module), Import->ModuleName);
+    strcpy_s(Function, sizeof(Function), Import->Name);
+
+    for (ULONG Depth = 0; Depth < EXPORT_INDEX_MAX_FORWARDS; Depth += 1)
+    {
+        const EXPORT_TARGET *Target;
+        LOADED_MODULE_MAP::iterator Loaded;
+        LPCSTR Forwarder, Separator;
+
+        NormalizeModuleName(Module, sizeof(Module));
+        MakeModuleKey(Key, Module, PtrSize);
+
+        Loaded = Modules.find(Key);
+        if (Loaded == Modules.end()) return FALSE;
+
+        Target = Find(Module, PtrSize, Loaded->second.Size, Function, Ordinal);
+        if (Target == NULL) return FALSE;
+
+        if (Target->Forwarder.empty())
+        {
+            *Expected = Loaded->second.Base + Target->Rva;
+            return TRUE;
+        }
+
+        //
+        // "MODULE.Function" or "MODULE.#Ordinal"
+        //
+        Forwarder = Target->Forwarder.c_str();
+        Separator = strrchr(Forwarder, '.');
+        if (!Separator || ((ULONG)(Separator - Forwarder) >= sizeof(Module))) return FALSE;
+
+        memcpy_s(Module, sizeof(Module), Forwarder, Separator - Forwarder);
+        Module[Separator - Forwarder] = '\0';
+
+        if (Separator[1] == '#')
+        {
+            Ordinal = strtoul(Separator + 2, NULL, 10);
+            Function[0] = '\0';
+        }
+        else
+        {
+            strcpy_s(Function, sizeof(Function), Separator + 1);
+        }
+    }
+
+    return FALSE;
+}
+
+VOID
+ExportIndex::CheckImports(
+    LOADED_MODULE_MAP& Modules,
+    PEFile *Image
+)
+{
+    Image->m_NumberOfHookedImports = 0;
+
+    for (PEFile::IMPORT_INFO& Import : Image->m_Imports)
+    {
+        Import.IsResolved = ResolveImport(Modules, Image->m_ImportThunkSize, &Import, &Import.Expected);
+
+        if (Import.IsResolved)
+        {
+            Import.IsHooked = (Import.Address != Import.Expected);
+        }
+        else
+        {
+            //
+            // Api sets or modules that are not loaded: the entry has at least to point to
+            // a loaded image.
+            //
+            Import.IsHooked = (Import.Address != 0);
+
+            for (LOADED_MODULE_MAP::iterator It = Modules.begin(); Import.IsHooked && (It != Modules.end()); ++It)
+            {
+                if ((Import.Address >= It->second.Base) && (Import.Address < (It->second.Base + It->second.Size))) Import.IsHooked = FALSE;
+            }
+        }
+
+        if (Import.IsHooked) Image->m_NumberOfHookedImports += 1;
+    }
+}
+
+VOID
+ExportIndex::Flush(
+)
+{
+    m_Entries.clear();
+    m_Modules.clear();
+
+    m_Stats.Entries = 0;
+}
+
+VOID
+ExportIndex::ResetStats(
+)
+{
+    m_Stats.Modules = 0;
+    m_Stats.Entries = m_Entries.size();
+    m_Stats.Lookups = 0;
+    m_Stats.Hits = 0;
+    m_Stats.Forwards = 0;
+}
@@ -0,0 +1,157 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - ExportIndex.h
+
+Abstract:
+
+    - Session-wide index of exported functions, (module, name or ordinal) -> RVA.
+    - Used to tell the address an Import Address Table slot should contain, following
+      forwarders through the modules loaded in the process.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __EXPORTINDEX_H__
+#define __EXPORTINDEX_H__
+
+#define EXPORT_INDEX_MAX_FORWARDS 4 // e.g. kernel32 -> kernelbase -> ntdll
+
+class ExportIndex {
+public:
+    typedef struct _EXPORT_TARGET {
+        ULONG Rva;
+        string Forwarder; // "MODULE.Function" or "MODULE.#Ordinal", empty if the code is in the module.
+    } EXPORT_TARGET, *PEXPORT_TARGET;
+
+    typedef struct _EXPORT_INDEX_STATS {
+        ULONG64 Modules;
+        ULONG64 Entries;
+        ULONG64 Lookups;
+        ULONG64 Hits;
+        ULONG64 Forwards;
+    } EXPORT_INDEX_STATS, *PEXPORT_INDEX_STATS;
+
+    typedef struct _LOADED_MODULE {
+        CHAR Name[64]; // Lower case base name.
+        ULONG PtrSize;
+        ULONG64 Base;
+        ULONG Size;
+    } LOADED_MODULE, *PLOADED_MODULE;
+
+    typedef unordered_map<string, LOADED_MODULE> LOADED_MODULE_MAP; // MakeModuleKey()
+
+    //
+    // Modules are identified by their lower case base name, pointer size and SizeOfImage
+    // (side-by-side assemblies load different versions under the same name).
+    //
+    VOID
+    AddModule(
+        LPCSTR ModuleName,
+        ULONG PtrSize,
+        PEFile *Image
+    );
+
+    const EXPORT_TARGET *
+    Find(
+        LPCSTR ModuleName,
+        ULONG PtrSize,
+        ULONG ImageSize,
+        LPCSTR Name,
+        ULONG Ordinal
+    );
+
+    //
+    // Address the IAT slot of Import should contain, FALSE if a module on the way is not
+    // loaded or does not have the export.
+    //
+    BOOLEAN
+    ResolveImport(
+        LOADED_MODULE_MAP& Modules,
+        ULONG PtrSize,
+        PEFile::PIMPORT_INFO Import,
+        PULONG64 Expected
+    );
+
+    //
+    // Sets IsResolved, Expected and IsHooked of every import of Image, the IAT slots must have
+    // been read by RtlReadImportAddresses().
+    //
+    VOID
+    CheckImports(
+        LOADED_MODULE_MAP& Modules,
+        PEFile *Image
+    );
+
+    static
+    VOID
+    NormalizeModuleName(
+        LPSTR Name,
+        ULONG NameSize
+    );
+
+    static
+    VOID
+    MakeModuleKey(
+        string& Key,
+        LPCSTR Name,
+        ULONG PtrSize
+    );
+
+    VOID
+    Flush(
+    );
+
+    VOID
+    ResetStats(
+    );
+
+    ExportIndex(
+    );
+
+    EXPORT_INDEX_STATS m_Stats;
+
+private:
+    static
+    VOID
+    MakeKey(
+        string& Key,
+        LPCSTR ModuleName,
+        ULONG PtrSize,
+        ULONG ImageSize,
+        LPCSTR Name,
+        ULONG Ordinal
+    );
+
+    unordered_map<string, EXPORT_TARGET> m_Entries;
+    unordered_map<string, ULONG> m_Modules;
+};
+
+extern ExportIndex g_ExportIndex;
+
+#endif
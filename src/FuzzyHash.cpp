@@ -0,0 +1,969 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - FuzzyHash.cpp
+
+Abstract:
+
+    - CTPH follows the ssdeep streaming engine: every candidate blocksize is
+      tracked at once, so the total length does not have to be known upfront.
+    - The TLSH-style digest uses the same construction as TLSH (128 buckets of
+      Pearson-hashed byte triplets, quartile encoding, 1 byte checksum).
+      Digests are meant to be compared with each other, not with other tools.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+using namespace std;
+
+#include "FuzzyHash.h"
+
+#define CTPH_ROLLING_WINDOW 7
+#define CTPH_MIN_BLOCKSIZE 3
+#define CTPH_HASH_PRIME 0x01000193
+#define CTPH_HASH_INIT 0x28021967
+#define CTPH_BLOCKSIZE(Index) (((ULONG)CTPH_MIN_BLOCKSIZE) << (Index))
+
+static const CHAR CtphBase64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static const UCHAR TlshPearson[256] = {
+    1, 87, 49, 12, 176, 178, 102, 166, 121, 193, 6, 84, 249, 230, 44, 163,
+    14, 197, 213, 181, 161, 85, 218, 80, 64, 239, 24, 226, 236, 142, 38, 200,
+    110, 177, 104, 103, 141, 253, 255, 50, 77, 101, 81, 18, 45, 96, 31, 222,
+    25, 107, 190, 70, 86, 237, 240, 34, 72, 242, 20, 214, 244, 227, 149, 235,
+    97, 234, 57, 22, 60, 250, 82, 175, 208, 5, 127, 199, 111, 62, 135, 248,
+    174, 169, 211, 58, 66, 154, 106, 195, 245, 171, 17, 187, 182, 179, 0, 243,
+    132, 56, 148, 75, 128, 133, 158, 100, 130, 126, 91, 13, 153, 246, 216, 219,
+    119, 68, 223, 78, 83, 88, 201, 99, 122, 11, 92, 32, 136, 114, 52, 10,
+    138, 30, 48, 183, 156, 35, 61, 26, 143, 74, 251, 94, 129, 162, 63, 152,
+    170, 7, 115, 167, 241, 206, 3, 150, 55, 59, 151, 220, 90, 53, 23, 131,
+    125, 173, 15, 238, 79, 95, 89, 16, 105, 137, 225, 224, 217, 160, 37, 123,
+    118, 73, 2, 157, 46, 116, 9, 145, 134, 228, 207, 212, 202, 215, 69, 229,
+    27, 188, 67, 124, 168, 252, 42, 4, 29, 108, 21, 247, 19, 205, 39, 203,
+    233, 40, 186, 147, 198, 192, 155, 33, 164, 191, 98, 204, 165, 180, 117, 76,
+    140, 36, 210, 172, 41, 54, 159, 8, 185, 232, 113, 196, 231, 47, 146, 120,
+    51, 65, 28, 144, 254, 221, 93, 189, 194, 139, 112, 43, 71, 109, 184, 209
+};
+
+//
+// CTPH
+//
+
+VOID
+CtphInit(
+    PCTPH_CONTEXT Context
+)
+{
+    RtlZeroMemory(Context, sizeof(*Context));
+
+    Context->Start = 0;
+    Context->End = 1;
+    Context->Blocks[0].h = CTPH_HASH_INIT;
+    Context->Blocks[0].HalfH = CTPH_HASH_INIT;
+}
+
+static
+VOID
+CtphTryFork(
+    PCTPH_CONTEXT Context
+)
+{
+    PCTPH_BLOCKHASH Previous, Next;
+
+    if (Context->End >= CTPH_NUM_BLOCKHASHES) return;
+
+    Previous = &Context->Blocks[Context->End - 1];
+    Next = &Context->Blocks[Context->End];
+
+    Next->h = Previous->h;
+    Next->HalfH = Previous->HalfH;
+    Next->Digest[0] = '\0';
+    Next->HalfDigest = '\0';
+    Next->Length = 0;
+
+    Context->End += 1;
+}
+
+static
+VOID
+CtphTryReduce(
+    PCTPH_CONTEXT Context
+)
+{
+    //
+    // The smallest blocksize is dropped once the next one has enough pieces, it
+    // cannot be selected anymore.
+    //
+    if ((Context->End - Context->Start) < 2) return;
+    if (((ULONG64)CTPH_BLOCKSIZE(Context->Start) * CTPH_SPAMSUM_LENGTH) >= Context->TotalSize) return;
+    if (Context->Blocks[Context->Start + 1].Length < (CTPH_SPAMSUM_LENGTH / 2)) return;
+
+    Context->Start += 1;
+}
+
+VOID
+CtphUpdate(
+    PCTPH_CONTEXT Context,
+    const UCHAR *Data,
+    SIZE_T Length
+)
+{
+    Context->TotalSize += Length;
+
+    for (SIZE_T Offset = 0; Offset < Length; Offset += 1)
+    {
+        UCHAR c = Data[Offset];
+        ULONG h;
+
+        Context->h2 -= Context->h1;
+        Context->h2 += CTPH_ROLLING_WINDOW * (ULONG)c;
+        Context->h1 += (ULONG)c;
+        Context->h1 -= (ULONG)Context->Window[Context->n % CTPH_ROLLING_WINDOW];
+        Context->Window[Context->n % CTPH_ROLLING_WINDOW] = c;
+        Context->n += 1;
+        Context->h3 = (Context->h3 << 5) ^ c;
+
+        h = Context->h1 + Context->h2 + Context->h3;
+
+        for (ULONG i = Context->Start; i < Context->End; i += 1)
+        {
+            Context->Blocks[i].h = (Context->Blocks[i].h * CTPH_HASH_PRIME) ^ c;
+            Context->Blocks[i].HalfH = (Context->Blocks[i].HalfH * CTPH_HASH_PRIME) ^ c;
+        }
+
+        for (ULONG i = Context->Start; i < Context->End; i += 1)
+        {
+            PCTPH_BLOCKHASH Block = &Context->Blocks[i];
+
+            //
+            // A trigger point for a blocksize is also one for every smaller blocksize.
+            //
+            if ((h % CTPH_BLOCKSIZE(i)) != (CTPH_BLOCKSIZE(i) - 1)) break;
+
+            if (Block->Length == 0) CtphTryFork(Context);
+
+            Block->Digest[Block->Length] = CtphBase64[Block->h % 64];
+            Block->HalfDigest = CtphBase64[Block->HalfH % 64];
+
+            if (Block->Length < (CTPH_SPAMSUM_LENGTH - 1))
+            {
+                Block->Length += 1;
+                Block->Digest[Block->Length] = '\0';
+                Block->h = CTPH_HASH_INIT;
+
+                if (Block->Length < (CTPH_SPAMSUM_LENGTH / 2))
+                {
+                    Block->HalfH = CTPH_HASH_INIT;
+                    Block->HalfDigest = '\0';
+                }
+            }
+            else
+            {
+                //
+                // Full: the last pieces are merged into the last character.
+                //
+                CtphTryReduce(Context);
+            }
+        }
+    }
+}
+
+VOID
+CtphFinal(
+    PCTPH_CONTEXT Context,
+    LPSTR Digest,
+    ULONG DigestSize
+)
+{
+    ULONG Index = Context->Start;
+    ULONG h = Context->h1 + Context->h2 + Context->h3;
+    ULONG Length;
+    PCTPH_BLOCKHASH Block;
+
+    if (DigestSize < CTPH_MAX_RESULT) return;
+
+    Digest[0] = '\0';
+
+    while (((ULONG64)CTPH_BLOCKSIZE(Index) * CTPH_SPAMSUM_LENGTH) < Context->TotalSize)
+    {
+        Index += 1;
+        if (Index >= CTPH_NUM_BLOCKHASHES) return;
+    }
+
+    if (Index >= Context->End) Index = Context->End - 1;
+    while ((Index > Context->Start) && (Context->Blocks[Index].Length < (CTPH_SPAMSUM_LENGTH / 2))) Index -= 1;
+
+    Length = sprintf_s(Digest, DigestSize, "%u:", CTPH_BLOCKSIZE(Index));
+
+    Block = &Context->Blocks[Index];
+    memcpy(Digest + Length, Block->Digest, Block->Length);
+    Length += Block->Length;
+
+    //
+    // Bytes after the last trigger point.
+    //
+    if (h != 0) Digest[Length++] = CtphBase64[Block->h % 64];
+    else if (Block->Digest[Block->Length] != '\0') Digest[Length++] = Block->Digest[Block->Length];
+
+    Digest[Length++] = ':';
+
+    if (Index < (Context->End - 1))
+    {
+        ULONG HalfLength;
+
+        Block = &Context->Blocks[Index + 1];
+        HalfLength = min(Block->Length, (ULONG)(CTPH_SPAMSUM_LENGTH / 2) - 1);
+
+        memcpy(Digest + Length, Block->Digest, HalfLength);
+        Length += HalfLength;
+
+        if (h != 0) Digest[Length++] = CtphBase64[Block->HalfH % 64];
+        else if (Block->HalfDigest != '\0') Digest[Length++] = Block->HalfDigest;
+    }
+    else if (h != 0)
+    {
+        Digest[Length++] = CtphBase64[Block->h % 64];
+    }
+
+    Digest[Length] = '\0';
+}
+
+typedef struct _CTPH_PARSED {
+    ULONG BlockSize;
+    CHAR Part1[CTPH_SPAMSUM_LENGTH + 1];
+    ULONG Length1;
+    CHAR Part2[CTPH_SPAMSUM_LENGTH + 1];
+    ULONG Length2;
+} CTPH_PARSED, *PCTPH_PARSED;
+
+//
+// Runs longer than 3 identical characters carry no information, ssdeep removes them.
+//
+static
+ULONG
+CtphCopyPart(
+    LPCSTR Start,
+    LPCSTR End,
+    LPSTR Part
+)
+{
+    ULONG Length = 0;
+
+    for (LPCSTR p = Start; p < End; p += 1)
+    {
+        if ((Length >= 3) && (*p == Part[Length - 1]) && (*p == Part[Length - 2]) && (*p == Part[Length - 3])) continue;
+        if (Length >= CTPH_SPAMSUM_LENGTH) return MAXULONG;
+
+        Part[Length++] = *p;
+    }
+
+    Part[Length] = '\0';
+
+    return Length;
+}
+
+static
+BOOLEAN
+CtphParse(
+    LPCSTR Digest,
+    PCTPH_PARSED Parsed
+)
+{
+    LPCSTR Part1, Part2, End;
+    CHAR *Next;
+
+    Parsed->BlockSize = strtoul(Digest, &Next, 10);
+    if ((Next == Digest) || (*Next != ':') || (Parsed->BlockSize < CTPH_MIN_BLOCKSIZE)) return FALSE;
+
+    Part1 = Next + 1;
+    Part2 = strchr(Part1, ':');
+    if (Part2 == NULL) return FALSE;
+    Part2 += 1;
+
+    for (End = Part2; *End && (*End != ',') && (*End != ':') && (*End != '\r') && (*End != '\n'); End += 1);
+
+    Parsed->Length1 = CtphCopyPart(Part1, Part2 - 1, Parsed->Part1);
+    Parsed->Length2 = CtphCopyPart(Part2, End, Parsed->Part2);
+
+    return ((Parsed->Length1 != MAXULONG) && (Parsed->Length2 != MAXULONG)) ? TRUE : FALSE;
+}
+
+static
+BOOLEAN
+CtphHasCommonSubstring(
+    LPCSTR s1,
+    ULONG Length1,
+    LPCSTR s2,
+    ULONG Length2
+)
+{
+    if ((Length1 < CTPH_ROLLING_WINDOW) || (Length2 < CTPH_ROLLING_WINDOW)) return FALSE;
+
+    for (ULONG i = 0; i <= (Length1 - CTPH_ROLLING_WINDOW); i += 1)
+    {
+        for (ULONG j = 0; j <= (Length2 - CTPH_ROLLING_WINDOW); j += 1)
+        {
+            if ((s1[i] == s2[j]) && !memcmp(s1 + i, s2 + j, CTPH_ROLLING_WINDOW)) return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+//
+// Insertions and deletions cost 1, substitutions 2.
+//
+static
+ULONG
+CtphEditDistance(
+    LPCSTR s1,
+    ULONG Length1,
+    LPCSTR s2,
+    ULONG Length2
+)
+{
+    ULONG Row[2][CTPH_SPAMSUM_LENGTH + 1];
+    ULONG Current = 0;
+
+    for (ULONG j = 0; j <= Length2; j += 1) Row[0][j] = j;
+
+    for (ULONG i = 0; i < Length1; i += 1)
+    {
+        PULONG Previous = Row[Current];
+        PULONG Next = Row[Current ^ 1];
+
+        Next[0] = i + 1;
+
+        for (ULONG j = 0; j < Length2; j += 1)
+        {
+            ULONG Cost = min(Previous[j + 1] + 1, Next[j] + 1);
+
+            Next[j + 1] = min(Cost, Previous[j] + ((s1[i] == s2[j]) ? 0 : 2));
+        }
+
+        Current ^= 1;
+    }
+
+    return Row[Current][Length2];
+}
+
+static
+ULONG
+CtphScoreStrings(
+    LPCSTR s1,
+    ULONG Length1,
+    LPCSTR s2,
+    ULONG Length2,
+    ULONG BlockSize
+)
+{
+    ULONG Score;
+
+    if (!CtphHasCommonSubstring(s1, Length1, s2, Length2)) return 0;
+
+    Score = CtphEditDistance(s1, Length1, s2, Length2);
+    Score = (Score * CTPH_SPAMSUM_LENGTH) / (Length1 + Length2);
+    Score = (100 * Score) / CTPH_SPAMSUM_LENGTH;
+    if (Score >= 100) return 0;
+
+    Score = 100 - Score;
+
+    //
+    // Small blocksizes: short digests must not claim a high similarity.
+    //
+    if (BlockSize >= (((99 + CTPH_ROLLING_WINDOW) / CTPH_ROLLING_WINDOW) * CTPH_MIN_BLOCKSIZE)) return Score;
+
+    return min(Score, (BlockSize / CTPH_MIN_BLOCKSIZE) * min(Length1, Length2));
+}
+
+static
+ULONG
+CtphCompareParsed(
+    PCTPH_PARSED p1,
+    PCTPH_PARSED p2
+)
+{
+    if (p1->BlockSize == p2->BlockSize)
+    {
+        if ((p1->Length1 == p2->Length1) && (p1->Length2 == p2->Length2) &&
+            !memcmp(p1->Part1, p2->Part1, p1->Length1) && !memcmp(p1->Part2, p2->Part2, p1->Length2)) return 100;
+
+        return max(CtphScoreStrings(p1->Part1, p1->Length1, p2->Part1, p2->Length1, p1->BlockSize),
+                   CtphScoreStrings(p1->Part2, p1->Length2, p2->Part2, p2->Length2, p1->BlockSize * 2));
+    }
+
+    if (p1->BlockSize == (p2->BlockSize * 2))
+    {
+        return CtphScoreStrings(p1->Part1, p1->Length1, p2->Part2, p2->Length2, p1->BlockSize);
+    }
+
+    if ((p1->BlockSize * 2) == p2->BlockSize)
+    {
+        return CtphScoreStrings(p1->Part2, p1->Length2, p2->Part1, p2->Length1, p2->BlockSize);
+    }
+
+    return 0;
+}
+
+ULONG
+CtphCompare(
+    LPCSTR Digest1,
+    LPCSTR Digest2
+)
+{
+    CTPH_PARSED p1, p2;
+
+    if (!CtphParse(Digest1, &p1) || !CtphParse(Digest2, &p2)) return 0;
+
+    return CtphCompareParsed(&p1, &p2);
+}
+
+//
+// TLSH
+//
+
+#define TLSH_MAP(Salt, i, j, k) (TlshPearson[TlshPearson[TlshPearson[TlshPearson[Salt] ^ (i)] ^ (j)] ^ (k)])
+
+VOID
+TlshInit(
+    PTLSH_CONTEXT Context
+)
+{
+    RtlZeroMemory(Context, sizeof(*Context));
+}
+
+VOID
+TlshUpdate(
+    PTLSH_CONTEXT Context,
+    const UCHAR *Data,
+    SIZE_T Length
+)
+{
+    UCHAR B = Context->Window[0], C = Context->Window[1], D = Context->Window[2], E = Context->Window[3];
+    UCHAR Checksum = Context->Checksum;
+    SIZE_T Offset = 0;
+
+    //
+    // The first 4 bytes only fill the window.
+    //
+    for (; (Offset < Length) && (Context->Length < 4); Offset += 1, Context->Length += 1)
+    {
+        E = D; D = C; C = B; B = Data[Offset];
+    }
+
+    Context->Length += Length - Offset;
+
+    for (; Offset < Length; Offset += 1)
+    {
+        UCHAR A = Data[Offset];
+
+        Checksum = TLSH_MAP(0, A, B, Checksum);
+
+        Context->Buckets[TLSH_MAP(2, A, B, C)] += 1;
+        Context->Buckets[TLSH_MAP(3, A, B, D)] += 1;
+        Context->Buckets[TLSH_MAP(5, A, C, D)] += 1;
+        Context->Buckets[TLSH_MAP(7, A, C, E)] += 1;
+        Context->Buckets[TLSH_MAP(11, A, B, E)] += 1;
+        Context->Buckets[TLSH_MAP(13, A, D, E)] += 1;
+
+        E = D; D = C; C = B; B = A;
+    }
+
+    Context->Window[0] = B;
+    Context->Window[1] = C;
+    Context->Window[2] = D;
+    Context->Window[3] = E;
+    Context->Checksum = Checksum;
+}
+
+static
+UCHAR
+TlshCaptureLength(
+    ULONG64 Length
+)
+{
+    LONG i;
+
+    if (Length <= 656) i = (LONG)floor(log((double)Length) / 0.4054651);
+    else if (Length <= 3199) i = (LONG)floor((log((double)Length) / 0.26236426) - 8.72777);
+    else i = (LONG)floor((log((double)Length) / 0.095310180) - 62.5472);
+
+    return (UCHAR)(i & 0xFF);
+}
+
+VOID
+TlshFinal(
+    PTLSH_CONTEXT Context,
+    PTLSH_DIGEST Digest
+)
+{
+    ULONG Sorted[TLSH_BUCKETS];
+    ULONG q1, q2, q3;
+    ULONG NonZero = 0;
+
+    RtlZeroMemory(Digest, sizeof(*Digest));
+
+    if (Context->Length < TLSH_MIN_LENGTH) return;
+
+    for (ULONG i = 0; i < TLSH_BUCKETS; i += 1)
+    {
+        Sorted[i] = Context->Buckets[i];
+        if (Sorted[i]) NonZero += 1;
+    }
+
+    //
+    // Less than half of the buckets used: not enough variety for a meaningful digest.
+    //
+    if (NonZero <= (TLSH_BUCKETS / 2)) return;
+
+    sort(Sorted, Sorted + TLSH_BUCKETS);
+    q1 = Sorted[(TLSH_BUCKETS / 4) - 1];
+    q2 = Sorted[(TLSH_BUCKETS / 2) - 1];
+    q3 = Sorted[((3 * TLSH_BUCKETS) / 4) - 1];
+    if (q3 == 0) return;
+
+    for (ULONG i = 0; i < TLSH_CODE_SIZE; i += 1)
+    {
+        UCHAR h = 0;
+
+        for (ULONG j = 0; j < 4; j += 1)
+        {
+            ULONG k = Context->Buckets[(4 * i) + j];
+
+            if (q3 < k) h += (UCHAR)(3 << (j * 2));
+            else if (q2 < k) h += (UCHAR)(2 << (j * 2));
+            else if (q1 < k) h += (UCHAR)(1 << (j * 2));
+        }
+
+        Digest->Code[i] = h;
+    }
+
+    Digest->Checksum = Context->Checksum;
+    Digest->Lvalue = TlshCaptureLength(Context->Length);
+    Digest->Q1Ratio = (UCHAR)(((ULONG)((q1 * 100.0f) / q3)) % 16);
+    Digest->Q2Ratio = (UCHAR)(((ULONG)((q2 * 100.0f) / q3)) % 16);
+    Digest->Valid = TRUE;
+}
+
+static
+ULONG
+TlshModDiff(
+    ULONG x,
+    ULONG y,
+    ULONG Range
+)
+{
+    ULONG Left = (x > y) ? (x - y) : (y - x);
+
+    return min(Left, Range - Left);
+}
+
+static
+ULONG
+TlshDistanceBounded(
+    PTLSH_DIGEST Digest1,
+    PTLSH_DIGEST Digest2,
+    ULONG Bound
+)
+{
+    ULONG Distance = 0;
+    ULONG Diff;
+
+    if (Digest1->Checksum != Digest2->Checksum) Distance += 1;
+
+    Diff = TlshModDiff(Digest1->Lvalue, Digest2->Lvalue, 256);
+    Distance += (Diff <= 1) ? Diff : (Diff * 12);
+
+    Diff = TlshModDiff(Digest1->Q1Ratio, Digest2->Q1Ratio, 16);
+    Distance += (Diff <= 1) ? Diff : ((Diff - 1) * 12);
+
+    Diff = TlshModDiff(Digest1->Q2Ratio, Digest2->Q2Ratio, 16);
+    Distance += (Diff <= 1) ? Diff : ((Diff - 1) * 12);
+
+    for (ULONG i = 0; (i < TLSH_CODE_SIZE) && (Distance <= Bound); i += 1)
+    {
+        UCHAR x = Digest1->Code[i];
+        UCHAR y = Digest2->Code[i];
+
+        if (x == y) continue;
+
+        for (ULONG j = 0; j < 8; j += 2)
+        {
+            LONG d = (LONG)((x >> j) & 3) - (LONG)((y >> j) & 3);
+
+            if (d < 0) d = -d;
+            Distance += (d == 3) ? 6 : d;
+        }
+    }
+
+    return Distance;
+}
+
+ULONG
+TlshDistance(
+    PTLSH_DIGEST Digest1,
+    PTLSH_DIGEST Digest2
+)
+{
+    return TlshDistanceBounded(Digest1, Digest2, MAXULONG);
+}
+
+VOID
+TlshToString(
+    PTLSH_DIGEST Digest,
+    LPSTR String,
+    ULONG StringSize
+)
+{
+    ULONG Length = 0;
+
+    if (StringSize < TLSH_STRING_SIZE) return;
+
+    if (!Digest->Valid)
+    {
+        String[0] = '\0';
+        return;
+    }
+
+    Length += sprintf_s(String + Length, StringSize - Length, "%02X%02X%X%X",
+        Digest->Checksum, Digest->Lvalue, Digest->Q1Ratio, Digest->Q2Ratio);
+
+    for (ULONG i = 0; i < TLSH_CODE_SIZE; i += 1)
+    {
+        Length += sprintf_s(String + Length, StringSize - Length, "%02X", Digest->Code[i]);
+    }
+}
+
+BOOLEAN
+TlshFromString(
+    LPCSTR String,
+    PTLSH_DIGEST Digest
+)
+{
+    UCHAR Bytes[3 + TLSH_CODE_SIZE];
+
+    RtlZeroMemory(Digest, sizeof(*Digest));
+
+    for (ULONG i = 0; i < sizeof(Bytes); i += 1)
+    {
+        ULONG Value = 0;
+
+        for (ULONG j = 0; j < 2; j += 1)
+        {
+            CHAR c = String[(i * 2) + j];
+
+            if ((c >= '0') && (c <= '9')) Value = (Value << 4) | (c - '0');
+            else if (((c | 0x20) >= 'a') && ((c | 0x20) <= 'f')) Value = (Value << 4) | ((c | 0x20) - 'a' + 10);
+            else return FALSE;
+        }
+
+        Bytes[i] = (UCHAR)Value;
+    }
+
+    Digest->Checksum = Bytes[0];
+    Digest->Lvalue = Bytes[1];
+    Digest->Q1Ratio = Bytes[2] >> 4;
+    Digest->Q2Ratio = Bytes[2] & 0xF;
+    memcpy(Digest->Code, Bytes + 3, TLSH_CODE_SIZE);
+    Digest->Valid = TRUE;
+
+    return TRUE;
+}
+
+//
+// Both
+//
+
+VOID
+FuzzyInit(
+    PFUZZY_CONTEXT Context
+)
+{
+    CtphInit(&Context->Ctph);
+    TlshInit(&Context->Tlsh);
+}
+
+VOID
+FuzzyUpdate(
+    PFUZZY_CONTEXT Context,
+    const UCHAR *Data,
+    SIZE_T Length
+)
+{
+    CtphUpdate(&Context->Ctph, Data, Length);
+    TlshUpdate(&Context->Tlsh, Data, Length);
+}
+
+VOID
+FuzzyFinal(
+    PFUZZY_CONTEXT Context,
+    PFUZZY_DIGESTS Digests
+)
+{
+    CtphFinal(&Context->Ctph, Digests->Ctph, sizeof(Digests->Ctph));
+    TlshFinal(&Context->Tlsh, &Digests->Tlsh);
+}
+
+VOID
+FuzzyHash(
+    const UCHAR *Data,
+    SIZE_T Length,
+    PFUZZY_DIGESTS Digests
+)
+{
+    FUZZY_CONTEXT Context;
+
+    FuzzyInit(&Context);
+    FuzzyUpdate(&Context, Data, Length);
+    FuzzyFinal(&Context, Digests);
+}
+
+//
+// Index
+//
+
+static
+ULONG64
+FuzzyGramKey(
+    ULONG BlockSize,
+    LPCSTR Gram
+)
+{
+    ULONG64 Key = 0xcbf29ce484222325ULL ^ BlockSize;
+
+    for (ULONG i = 0; i < CTPH_ROLLING_WINDOW; i += 1)
+    {
+        Key = (Key ^ (UCHAR)Gram[i]) * 0x100000001b3ULL;
+    }
+
+    return Key;
+}
+
+//
+// Digests without any 7-gram only match an identical digest, they are filed under the
+// whole digest.
+//
+static
+ULONG64
+FuzzyShortKey(
+    PCTPH_PARSED Parsed
+)
+{
+    ULONG64 Key = 0x84222325cbf29ce4ULL ^ Parsed->BlockSize;
+
+    for (ULONG i = 0; i < Parsed->Length1; i += 1) Key = (Key ^ (UCHAR)Parsed->Part1[i]) * 0x100000001b3ULL;
+    Key = (Key ^ ':') * 0x100000001b3ULL;
+    for (ULONG i = 0; i < Parsed->Length2; i += 1) Key = (Key ^ (UCHAR)Parsed->Part2[i]) * 0x100000001b3ULL;
+
+    return Key;
+}
+
+VOID
+FuzzyIndex::Add(
+    LPCSTR Name,
+    PFUZZY_DIGESTS Digests
+)
+{
+    FUZZY_ENTRY Entry;
+    CTPH_PARSED Parsed;
+    ULONG Index = (ULONG)m_Entries.size();
+
+    Entry.Name = Name;
+    Entry.Digests = *Digests;
+    m_Entries.push_back(Entry);
+
+    if (!CtphParse(Digests->Ctph, &Parsed)) return;
+
+    //
+    // The second part is the digest at twice the blocksize.
+    //
+    for (ULONG Part = 0; Part < 2; Part += 1)
+    {
+        LPCSTR s = Part ? Parsed.Part2 : Parsed.Part1;
+        ULONG Length = Part ? Parsed.Length2 : Parsed.Length1;
+        ULONG BlockSize = Part ? (Parsed.BlockSize * 2) : Parsed.BlockSize;
+
+        for (ULONG i = 0; (i + CTPH_ROLLING_WINDOW) <= Length; i += 1)
+        {
+            vector<ULONG>& Entries = m_Grams[FuzzyGramKey(BlockSize, s + i)];
+
+            if (Entries.empty() || (Entries.back() != Index)) Entries.push_back(Index);
+        }
+    }
+
+    if ((Parsed.Length1 < CTPH_ROLLING_WINDOW) && (Parsed.Length2 < CTPH_ROLLING_WINDOW))
+    {
+        m_Grams[FuzzyShortKey(&Parsed)].push_back(Index);
+    }
+}
+
+ULONG
+FuzzyIndex::Load(
+    LPCSTR FileName
+)
+{
+    FILE *File = NULL;
+    CHAR Line[1024];
+    ULONG Count = 0;
+
+    if (fopen_s(&File, FileName, "r") || (File == NULL)) return 0;
+
+    while (fgets(Line, sizeof(Line), File))
+    {
+        FUZZY_DIGESTS Digests = { 0 };
+        LPSTR Ctph, Tlsh, End;
+
+        Line[strcspn(Line, "\r\n")] = '\0';
+        if ((Line[0] == '#') || (Line[0] == '\0')) continue;
+
+        //
+        // Names may contain commas, digests cannot.
+        //
+        Tlsh = strrchr(Line, ',');
+        if (Tlsh == NULL) continue;
+        *Tlsh++ = '\0';
+
+        Ctph = strrchr(Line, ',');
+        if (Ctph == NULL) continue;
+        *Ctph++ = '\0';
+
+        for (End = Ctph; *End == ' '; End += 1);
+        strncpy_s(Digests.Ctph, sizeof(Digests.Ctph), End, _TRUNCATE);
+
+        for (End = Tlsh; *End == ' '; End += 1);
+        if (strlen(End) >= (TLSH_STRING_SIZE - 1)) TlshFromString(End, &Digests.Tlsh);
+
+        if (!Digests.Ctph[0] && !Digests.Tlsh.Valid) continue;
+
+        Add(Line, &Digests);
+        Count += 1;
+    }
+
+    fclose(File);
+
+    return Count;
+}
+
+VOID
+FuzzyIndex::Find(
+    PFUZZY_DIGESTS Digests,
+    ULONG MaxTlshDistance,
+    ULONG MaxResults,
+    vector<FUZZY_MATCH>& Matches
+)
+{
+    unordered_map<ULONG, FUZZY_MATCH> Found;
+    CTPH_PARSED Query;
+
+    if (CtphParse(Digests->Ctph, &Query))
+    {
+        vector<ULONG> Candidates;
+
+        for (ULONG Part = 0; Part < 2; Part += 1)
+        {
+            LPCSTR s = Part ? Query.Part2 : Query.Part1;
+            ULONG Length = Part ? Query.Length2 : Query.Length1;
+            ULONG BlockSize = Part ? (Query.BlockSize * 2) : Query.BlockSize;
+
+            for (ULONG i = 0; (i + CTPH_ROLLING_WINDOW) <= Length; i += 1)
+            {
+                unordered_map<ULONG64, vector<ULONG>>::iterator It = m_Grams.find(FuzzyGramKey(BlockSize, s + i));
+
+                if (It != m_Grams.end()) Candidates.insert(Candidates.end(), It->second.begin(), It->second.end());
+            }
+        }
+
+        if ((Query.Length1 < CTPH_ROLLING_WINDOW) && (Query.Length2 < CTPH_ROLLING_WINDOW))
+        {
+            unordered_map<ULONG64, vector<ULONG>>::iterator It = m_Grams.find(FuzzyShortKey(&Query));
+
+            if (It != m_Grams.end()) Candidates.insert(Candidates.end(), It->second.begin(), It->second.end());
+        }
+
+        sort(Candidates.begin(), Candidates.end());
+        Candidates.erase(unique(Candidates.begin(), Candidates.end()), Candidates.end());
+
+        for (ULONG Index : Candidates)
+        {
+            CTPH_PARSED Parsed;
+            ULONG Score;
+
+            if (!CtphParse(m_Entries[Index].Digests.Ctph, &Parsed)) continue;
+
+            Score = CtphCompareParsed(&Query, &Parsed);
+            if (!Score) continue;
+
+            FUZZY_MATCH Match = { Index, Score, MAXULONG };
+            Found[Index] = Match;
+        }
+    }
+
+    if (Digests->Tlsh.Valid)
+    {
+        for (ULONG Index = 0; Index < m_Entries.size(); Index += 1)
+        {
+            ULONG Distance;
+
+            if (!m_Entries[Index].Digests.Tlsh.Valid) continue;
+
+            Distance = TlshDistanceBounded(&Digests->Tlsh, &m_Entries[Index].Digests.Tlsh, MaxTlshDistance);
+            if (Distance > MaxTlshDistance) continue;
+
+            if (Found.find(Index) == Found.end())
+            {
+                FUZZY_MATCH Match = { Index, 0, Distance };
+                Found[Index] = Match;
+            }
+            else
+            {
+                Found[Index].TlshDistance = Distance;
+            }
+        }
+    }
+
+    Matches.clear();
+    for (unordered_map<ULONG, FUZZY_MATCH>::iterator It = Found.begin(); It != Found.end(); ++It) Matches.push_back(It->second);
+
+    sort(Matches.begin(), Matches.end(), [](const FUZZY_MATCH& a, const FUZZY_MATCH& b)
+    {
+        if (a.CtphScore != b.CtphScore) return a.CtphScore > b.CtphScore;
+        if (a.TlshDistance != b.TlshDistance) return a.TlshDistance < b.TlshDistance;
+        return a.Index < b.Index;
+    });
+
+    if (Matches.size() > MaxResults) Matches.resize(MaxResults);
+}
@@ -0,0 +1,250 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - FuzzyHash.h
+
+Abstract:
+
+    - Similarity digests: context triggered piecewise hashing (ssdeep
+      format) and a TLSH-style locality sensitive hash, both streaming.
+    - FuzzyIndex, nearest neighbours of a digest in a corpus of known ones.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __FUZZYHASH_H__
+#define __FUZZYHASH_H__
+
+#define CTPH_SPAMSUM_LENGTH 64
+#define CTPH_NUM_BLOCKHASHES 31
+#define CTPH_MAX_RESULT (2 * CTPH_SPAMSUM_LENGTH + 20) // "blocksize:digest:digest"
+
+#define TLSH_BUCKETS 128
+#define TLSH_CODE_SIZE (TLSH_BUCKETS / 4)
+#define TLSH_MIN_LENGTH 50
+#define TLSH_STRING_SIZE (((3 + TLSH_CODE_SIZE) * 2) + 1)
+
+//
+// Defaults for !ms_hash /match, TLSH distances under 100 usually mean same family.
+//
+#define FUZZY_MATCH_MAX_TLSH_DISTANCE 100
+#define FUZZY_MATCH_MAX_RESULTS 10
+
+typedef struct _CTPH_BLOCKHASH {
+    ULONG h;
+    ULONG HalfH;
+    CHAR Digest[CTPH_SPAMSUM_LENGTH];
+    CHAR HalfDigest;
+    ULONG Length;
+} CTPH_BLOCKHASH, *PCTPH_BLOCKHASH;
+
+typedef struct _CTPH_CONTEXT {
+    ULONG64 TotalSize;
+    ULONG Start; // First and last blocksizes still tracked.
+    ULONG End;
+
+    //
+    // Rolling hash over the last CTPH_ROLLING_WINDOW bytes.
+    //
+    UCHAR Window[7];
+    ULONG h1, h2, h3;
+    ULONG n;
+
+    CTPH_BLOCKHASH Blocks[CTPH_NUM_BLOCKHASHES];
+} CTPH_CONTEXT, *PCTPH_CONTEXT;
+
+typedef struct _TLSH_DIGEST {
+    BOOLEAN Valid; // Too short or too uniform inputs have no digest.
+    UCHAR Checksum;
+    UCHAR Lvalue;
+    UCHAR Q1Ratio;
+    UCHAR Q2Ratio;
+    UCHAR Code[TLSH_CODE_SIZE];
+} TLSH_DIGEST, *PTLSH_DIGEST;
+
+typedef struct _TLSH_CONTEXT {
+    ULONG Buckets[256];
+    UCHAR Window[4]; // Previous bytes, most recent first.
+    UCHAR Checksum;
+    ULONG64 Length;
+} TLSH_CONTEXT, *PTLSH_CONTEXT;
+
+typedef struct _FUZZY_DIGESTS {
+    CHAR Ctph[CTPH_MAX_RESULT];
+    TLSH_DIGEST Tlsh;
+} FUZZY_DIGESTS, *PFUZZY_DIGESTS;
+
+typedef struct _FUZZY_CONTEXT {
+    CTPH_CONTEXT Ctph;
+    TLSH_CONTEXT Tlsh;
+} FUZZY_CONTEXT, *PFUZZY_CONTEXT;
+
+VOID
+CtphInit(
+    PCTPH_CONTEXT Context
+);
+
+VOID
+CtphUpdate(
+    PCTPH_CONTEXT Context,
+    const UCHAR *Data,
+    SIZE_T Length
+);
+
+//
+// Same output as ssdeep (fuzzy_digest() without flags).
+//
+VOID
+CtphFinal(
+    PCTPH_CONTEXT Context,
+    LPSTR Digest,
+    ULONG DigestSize
+);
+
+//
+// 0 (unrelated) to 100 (identical), same scoring as ssdeep.
+//
+ULONG
+CtphCompare(
+    LPCSTR Digest1,
+    LPCSTR Digest2
+);
+
+VOID
+TlshInit(
+    PTLSH_CONTEXT Context
+);
+
+VOID
+TlshUpdate(
+    PTLSH_CONTEXT Context,
+    const UCHAR *Data,
+    SIZE_T Length
+);
+
+VOID
+TlshFinal(
+    PTLSH_CONTEXT Context,
+    PTLSH_DIGEST Digest
+);
+
+//
+// 0 for identical inputs, grows with the differences (no upper bound).
+//
+ULONG
+TlshDistance(
+    PTLSH_DIGEST Digest1,
+    PTLSH_DIGEST Digest2
+);
+
+VOID
+TlshToString(
+    PTLSH_DIGEST Digest,
+    LPSTR String,
+    ULONG StringSize
+);
+
+BOOLEAN
+TlshFromString(
+    LPCSTR String,
+    PTLSH_DIGEST Digest
+);
+
+VOID
+FuzzyInit(
+    PFUZZY_CONTEXT Context
+);
+
+VOID
+FuzzyUpdate(
+    PFUZZY_CONTEXT Context,
+    const UCHAR *Data,
+    SIZE_T Length
+);
+
+VOID
+FuzzyFinal(
+    PFUZZY_CONTEXT Context,
+    PFUZZY_DIGESTS Digests
+);
+
+VOID
+FuzzyHash(
+    const UCHAR *Data,
+    SIZE_T Length,
+    PFUZZY_DIGESTS Digests
+);
+
+class FuzzyIndex {
+public:
+    typedef struct _FUZZY_MATCH {
+        ULONG Index; // In m_Entries.
+        ULONG CtphScore; // 0 when not compared.
+        ULONG TlshDistance; // MAXULONG when not compared.
+    } FUZZY_MATCH, *PFUZZY_MATCH;
+
+    typedef struct _FUZZY_ENTRY {
+        string Name;
+        FUZZY_DIGESTS Digests;
+    } FUZZY_ENTRY, *PFUZZY_ENTRY;
+
+    //
+    // One "name,ctph,tlsh" line per known sample, empty fields and '#' comments allowed.
+    // Returns the number of entries added.
+    //
+    ULONG
+    Load(
+        LPCSTR FileName
+    );
+
+    VOID
+    Add(
+        LPCSTR Name,
+        PFUZZY_DIGESTS Digests
+    );
+
+    //
+    // CTPH candidates come from the 7-gram index (ssdeep scores 0 without a common
+    // 7 character substring), TLSH candidates from a scan that gives up on an entry
+    // as soon as it is past MaxTlshDistance. Sorted by CTPH score, then TLSH distance.
+    //
+    VOID
+    Find(
+        PFUZZY_DIGESTS Digests,
+        ULONG MaxTlshDistance,
+        ULONG MaxResults,
+        vector<FUZZY_MATCH>& Matches
+    );
+
+    vector<FUZZY_ENTRY> m_Entries;
+
+private:
+    unordered_map<ULONG64, vector<ULONG>> m_Grams; // (blocksize, 7-gram) to entries, and whole digests without any 7-gram.
+};
+
+#endif
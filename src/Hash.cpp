@@ -0,0 +1,634 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - Hash.cpp
+
+Abstract:
+
+    - SHA-1 (FIPS 180-4) and SHA-256, with SHA-NI transforms.
+    - MD5 comes from Md5.cpp (single stream) and Md5Mb.cpp (batches).
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <string.h>
+#include <intrin.h>
+#include <vector>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "Md5Mb.h"
+
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define MULTI_HASH_SLICE_SIZE (16 * 1024)
+
+typedef VOID (*PHASH_TRANSFORM)(ULONG *State, const UCHAR *Data, SIZE_T Blocks);
+
+static const ULONG Sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static
+ULONG
+LoadBe32(
+    const UCHAR *p
+)
+{
+    return ((ULONG)p[0] << 24) | ((ULONG)p[1] << 16) | ((ULONG)p[2] << 8) | (ULONG)p[3];
+}
+
+static
+VOID
+StoreBe32(
+    UCHAR *p,
+    ULONG v
+)
+{
+    p[0] = (UCHAR)(v >> 24);
+    p[1] = (UCHAR)(v >> 16);
+    p[2] = (UCHAR)(v >> 8);
+    p[3] = (UCHAR)v;
+}
+
+static
+VOID
+Sha1Transform(
+    ULONG *State,
+    const UCHAR *Data,
+    SIZE_T Blocks
+)
+{
+    ULONG W[80];
+
+    for (; Blocks; Blocks -= 1, Data += 64)
+    {
+        ULONG a = State[0], b = State[1], c = State[2], d = State[3], e = State[4];
+        ULONG i;
+
+        for (i = 0; i < 16; i += 1) W[i] = LoadBe32(Data + (i * 4));
+        for (; i < 80; i += 1) W[i] = ROTL32(W[i - 3] ^ W[i - 8] ^ W[i - 14] ^ W[i - 16], 1);
+
+        for (i = 0; i < 80; i += 1)
+        {
+            ULONG f, k, t;
+
+            if (i < 20) { f = (b & c) | (~b & d); k = 0x5a827999; }
+            else if (i < 40) { f = b ^ c ^ d; k = 0x6ed9eba1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8f1bbcdc; }
+            else { f = b ^ c ^ d; k = 0xca62c1d6; }
+
+            t = ROTL32(a, 5) + f + e + k + W[i];
+            e = d;
+            d = c;
+            c = ROTL32(b, 30);
+            b = a;
+            a = t;
+        }
+
+        State[0] += a;
+        State[1] += b;
+        State[2] += c;
+        State[3] += d;
+        State[4] += e;
+    }
+}
+
+static
+VOID
+Sha256Transform(
+    ULONG *State,
+    const UCHAR *Data,
+    SIZE_T Blocks
+)
+{
+    ULONG W[64];
+
+    for (; Blocks; Blocks -= 1, Data += 64)
+    {
+        ULONG a = State[0], b = State[1], c = State[2], d = State[3];
+        ULONG e = State[4], f = State[5], g = State[6], h = State[7];
+        ULONG i;
+
+        for (i = 0; i < 16; i += 1) W[i] = LoadBe32(Data + (i * 4));
+        for (; i < 64; i += 1)
+        {
+            ULONG s0 = ROTR32(W[i - 15], 7) ^ ROTR32(W[i - 15], 18) ^ (W[i - 15] >> 3);
+            ULONG s1 = ROTR32(W[i - 2], 17) ^ ROTR32(W[i - 2], 19) ^ (W[i - 2] >> 10);
+            W[i] = W[i - 16] + s0 + W[i - 7] + s1;
+        }
+
+        for (i = 0; i < 64; i += 1)
+        {
+            ULONG S1 = ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25);
+            ULONG Ch = (e & f) ^ (~e & g);
+            ULONG t1 = h + S1 + Ch + Sha256K[i] + W[i];
+            ULONG S0 = ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22);
+            ULONG Maj = (a & b) ^ (a & c) ^ (b & c);
+            ULONG t2 = S0 + Maj;
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        State[0] += a;
+        State[1] += b;
+        State[2] += c;
+        State[3] += d;
+        State[4] += e;
+        State[5] += f;
+        State[6] += g;
+        State[7] += h;
+    }
+}
+
+#if HASH_SHANI_SUPPORT
+//
+// Group g of 4 rounds, the schedule of W[g + 1] is computed while it runs. Groups are
+// expanded with literal numbers so that the round function is an immediate and W stays
+// in registers.
+//
+#define SHA1_GROUP(g, Function, Ex, Ey)                                                     \
+    {                                                                                     \
+        __m128i Current = W[(g) & 3];                                                     \
+                                                                                          \
+        if ((g) == 0) Ex = _mm_add_epi32(Ex, Current);                                    \
+        else Ex = _mm_sha1nexte_epu32(Ex, Current);                                       \
+        Ey = Abcd;                                                                        \
+        if (((g) >= 3) && ((g) <= 18)) W[((g) + 1) & 3] = _mm_sha1msg2_epu32(W[((g) + 1) & 3], Current); \
+        Abcd = _mm_sha1rnds4_epu32(Abcd, Ex, Function);                                   \
+        if (((g) >= 1) && ((g) <= 16)) W[((g) - 1) & 3] = _mm_sha1msg1_epu32(W[((g) - 1) & 3], Current); \
+        if (((g) >= 2) && ((g) <= 17)) W[((g) - 2) & 3] = _mm_xor_si128(W[((g) - 2) & 3], Current); \
+    }
+
+static
+VOID
+Sha1TransformShaNi(
+    ULONG *State,
+    const UCHAR *Data,
+    SIZE_T Blocks
+)
+{
+    const __m128i Mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i Abcd, E0, E1, AbcdSave, E0Save;
+    __m128i W[4];
+
+    Abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)State), 0x1B);
+    E0 = _mm_set_epi32(State[4], 0, 0, 0);
+
+    for (; Blocks; Blocks -= 1, Data += 64)
+    {
+        AbcdSave = Abcd;
+        E0Save = E0;
+
+        for (ULONG i = 0; i < 4; i += 1) W[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(Data + (i * 16))), Mask);
+
+        //
+        // E0 and E1 alternate, the round function changes every 5 groups.
+        //
+        SHA1_GROUP(0, 0, E0, E1);
+        SHA1_GROUP(1, 0, E1, E0);
+        SHA1_GROUP(2, 0, E0, E1);
+        SHA1_GROUP(3, 0, E1, E0);
+        SHA1_GROUP(4, 0, E0, E1);
+        SHA1_GROUP(5, 1, E1, E0);
+        SHA1_GROUP(6, 1, E0, E1);
+        SHA1_GROUP(7, 1, E1, E0);
+        SHA1_GROUP(8, 1, E0, E1);
+        SHA1_GROUP(9, 1, E1, E0);
+        SHA1_GROUP(10, 2, E0, E1);
+        SHA1_GROUP(11, 2, E1, E0);
+        SHA1_GROUP(12, 2, E0, E1);
+        SHA1_GROUP(13, 2, E1, E0);
+        SHA1_GROUP(14, 2, E0, E1);
+        SHA1_GROUP(15, 3, E1, E0);
+        SHA1_GROUP(16, 3, E0, E1);
+        SHA1_GROUP(17, 3, E1, E0);
+        SHA1_GROUP(18, 3, E0, E1);
+        SHA1_GROUP(19, 3, E1, E0);
+
+        E0 = _mm_sha1nexte_epu32(E0, E0Save);
+        Abcd = _mm_add_epi32(Abcd, AbcdSave);
+    }
+
+    _mm_storeu_si128((__m128i *)State, _mm_shuffle_epi32(Abcd, 0x1B));
+    State[4] = (ULONG)_mm_extract_epi32(E0, 3);
+}
+
+//
+// Group g of 4 rounds, the schedule of W[g + 1] is computed while it runs.
+//
+#define SHA256_GROUP(g)                                                                   \
+    {                                                                                     \
+        __m128i Current = W[(g) & 3];                                                     \
+                                                                                          \
+        Msg = _mm_add_epi32(Current, _mm_loadu_si128((const __m128i *)&Sha256K[(g) * 4])); \
+        State1 = _mm_sha256rnds2_epu32(State1, State0, Msg);                              \
+                                                                                          \
+        if (((g) >= 3) && ((g) <= 14))                                                    \
+        {                                                                                 \
+            Tmp = _mm_alignr_epi8(Current, W[((g) - 1) & 3], 4);                          \
+            W[((g) + 1) & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(W[((g) + 1) & 3], Tmp), Current); \
+        }                                                                                 \
+                                                                                          \
+        Msg = _mm_shuffle_epi32(Msg, 0x0E);                                               \
+        State0 = _mm_sha256rnds2_epu32(State0, State1, Msg);                              \
+                                                                                          \
+        if (((g) >= 1) && ((g) <= 12)) W[((g) - 1) & 3] = _mm_sha256msg1_epu32(W[((g) - 1) & 3], Current); \
+    }
+
+static
+VOID
+Sha256TransformShaNi(
+    ULONG *State,
+    const UCHAR *Data,
+    SIZE_T Blocks
+)
+{
+    const __m128i Mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i State0, State1, Tmp, Msg, AbefSave, CdghSave;
+    __m128i W[4];
+
+    Tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&State[0]), 0xB1); // CDAB
+    State1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&State[4]), 0x1B); // EFGH
+    State0 = _mm_alignr_epi8(Tmp, State1, 8); // ABEF
+    State1 = _mm_blend_epi16(State1, Tmp, 0xF0); // CDGH
+
+    for (; Blocks; Blocks -= 1, Data += 64)
+    {
+        AbefSave = State0;
+        CdghSave = State1;
+
+        for (ULONG i = 0; i < 4; i += 1) W[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(Data + (i * 16))), Mask);
+
+        SHA256_GROUP(0);
+        SHA256_GROUP(1);
+        SHA256_GROUP(2);
+        SHA256_GROUP(3);
+        SHA256_GROUP(4);
+        SHA256_GROUP(5);
+        SHA256_GROUP(6);
+        SHA256_GROUP(7);
+        SHA256_GROUP(8);
+        SHA256_GROUP(9);
+        SHA256_GROUP(10);
+        SHA256_GROUP(11);
+        SHA256_GROUP(12);
+        SHA256_GROUP(13);
+        SHA256_GROUP(14);
+        SHA256_GROUP(15);
+
+        State0 = _mm_add_epi32(State0, AbefSave);
+        State1 = _mm_add_epi32(State1, CdghSave);
+    }
+
+    Tmp = _mm_shuffle_epi32(State0, 0x1B); // FEBA
+    State1 = _mm_shuffle_epi32(State1, 0xB1); // DCHG
+    State0 = _mm_blend_epi16(Tmp, State1, 0xF0); // DCBA
+    State1 = _mm_alignr_epi8(State1, Tmp, 8); // ABEF
+
+    _mm_storeu_si128((__m128i *)&State[0], State0);
+    _mm_storeu_si128((__m128i *)&State[4], State1);
+}
+#endif
+
+ULONG
+GetHashFeatures(
+    VOID
+)
+{
+    static LONG Features = -1;
+    int Info[4];
+    ULONG Result = 0;
+
+    if (Features != -1) return (ULONG)Features;
+
+    __cpuid(Info, 0);
+    if (Info[0] >= 1)
+    {
+        __cpuid(Info, 1);
+        if (Info[3] & (1 << 26)) Result |= HASH_FEATURE_SSE2;
+        if (Info[2] & (1 << 9)) Result |= HASH_FEATURE_SSSE3;
+        if (Info[2] & (1 << 19)) Result |= HASH_FEATURE_SSE41;
+
+        //
+        // AVX2 also needs the OS to save the YMM registers (OSXSAVE + XCR0).
+        //
+        BOOLEAN AvxOs = ((Info[2] & (1 << 27)) && ((_xgetbv(0) & 6) == 6)) ? TRUE : FALSE;
+
+        __cpuid(Info, 0);
+        if (Info[0] >= 7)
+        {
+            __cpuidex(Info, 7, 0);
+            if (AvxOs && (Info[1] & (1 << 5))) Result |= HASH_FEATURE_AVX2;
+            if (Info[1] & (1 << 29)) Result |= HASH_FEATURE_SHANI;
+        }
+    }
+
+    Features = (LONG)Result;
+
+    return Result;
+}
+
+static
+PHASH_TRANSFORM
+GetSha1Transform(
+    VOID
+)
+{
+#if HASH_SHANI_SUPPORT
+    const ULONG Required = HASH_FEATURE_SHANI | HASH_FEATURE_SSSE3 | HASH_FEATURE_SSE41;
+
+    if ((GetHashFeatures() & Required) == Required) return Sha1TransformShaNi;
+#endif
+    return Sha1Transform;
+}
+
+static
+PHASH_TRANSFORM
+GetSha256Transform(
+    VOID
+)
+{
+#if HASH_SHANI_SUPPORT
+    const ULONG Required = HASH_FEATURE_SHANI | HASH_FEATURE_SSSE3 | HASH_FEATURE_SSE41;
+
+    if ((GetHashFeatures() & Required) == Required) return Sha256TransformShaNi;
+#endif
+    return Sha256Transform;
+}
+
+static PHASH_TRANSFORM g_Sha1Transform = GetSha1Transform();
+static PHASH_TRANSFORM g_Sha256Transform = GetSha256Transform();
+
+//
+// Common Merkle-Damgard buffering, both algorithms use 64-byte blocks and a big-endian length.
+//
+static
+VOID
+BlockUpdate(
+    PHASH_TRANSFORM Transform,
+    ULONG *State,
+    UCHAR *Buffer,
+    ULONG64 *TotalLength,
+    const UCHAR *Data,
+    SIZE_T Length
+)
+{
+    ULONG Used = (ULONG)(*TotalLength & 63);
+
+    *TotalLength += Length;
+
+    if (Used)
+    {
+        ULONG Fill = 64 - Used;
+
+        if (Length < Fill)
+        {
+            memcpy(Buffer + Used, Data, Length);
+            return;
+        }
+
+        memcpy(Buffer + Used, Data, Fill);
+        Transform(State, Buffer, 1);
+        Data += Fill;
+        Length -= Fill;
+    }
+
+    if (Length >= 64)
+    {
+        Transform(State, Data, Length / 64);
+        Data += Length & ~(SIZE_T)63;
+        Length &= 63;
+    }
+
+    if (Length) memcpy(Buffer, Data, Length);
+}
+
+static
+VOID
+BlockFinal(
+    PHASH_TRANSFORM Transform,
+    ULONG *State,
+    UCHAR *Buffer,
+    ULONG64 TotalLength
+)
+{
+    ULONG Used = (ULONG)(TotalLength & 63);
+    ULONG64 Bits = TotalLength * 8;
+
+    Buffer[Used++] = 0x80;
+
+    if (Used > 56)
+    {
+        memset(Buffer + Used, 0, 64 - Used);
+        Transform(State, Buffer, 1);
+        Used = 0;
+    }
+
+    memset(Buffer + Used, 0, 56 - Used);
+    StoreBe32(Buffer + 56, (ULONG)(Bits >> 32));
+    StoreBe32(Buffer + 60, (ULONG)Bits);
+    Transform(State, Buffer, 1);
+}
+
+VOID
+SHA1Init(
+    PSHA1_CONTEXT Context
+)
+{
+    static const ULONG Iv[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+
+    memset(Context, 0, sizeof(*Context));
+    memcpy(Context->State, Iv, sizeof(Iv));
+}
+
+VOID
+SHA1Update(
+    PSHA1_CONTEXT Context,
+    const UCHAR *Data,
+    SIZE_T Length
+)
+{
+    BlockUpdate(g_Sha1Transform, Context->State, Context->Buffer, &Context->Length, Data, Length);
+}
+
+VOID
+SHA1Final(
+    PSHA1_CONTEXT Context
+)
+{
+    BlockFinal(g_Sha1Transform, Context->State, Context->Buffer, Context->Length);
+
+    for (ULONG i = 0; i < 5; i += 1) StoreBe32(Context->Digest + (i * 4), Context->State[i]);
+}
+
+VOID
+SHA256Init(
+    PSHA256_CONTEXT Context
+)
+{
+    static const ULONG Iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memset(Context, 0, sizeof(*Context));
+    memcpy(Context->State, Iv, sizeof(Iv));
+}
+
+VOID
+SHA256Update(
+    PSHA256_CONTEXT Context,
+    const UCHAR *Data,
+    SIZE_T Length
+)
+{
+    BlockUpdate(g_Sha256Transform, Context->State, Context->Buffer, &Context->Length, Data, Length);
+}
+
+VOID
+SHA256Final(
+    PSHA256_CONTEXT Context
+)
+{
+    BlockFinal(g_Sha256Transform, Context->State, Context->Buffer, Context->Length);
+
+    for (ULONG i = 0; i < 8; i += 1) StoreBe32(Context->Digest + (i * 4), Context->State[i]);
+}
+
+VOID
+MultiHashInit(
+    PMULTI_HASH_CONTEXT Context
+)
+{
+    memset(&Context->Md5, 0, sizeof(Context->Md5));
+    MD5Init(&Context->Md5);
+    SHA1Init(&Context->Sha1);
+    SHA256Init(&Context->Sha256);
+}
+
+VOID
+MultiHashUpdate(
+    PMULTI_HASH_CONTEXT Context,
+    const UCHAR *Data,
+    SIZE_T Length
+)
+{
+    while (Length)
+    {
+        ULONG Slice = (Length > MULTI_HASH_SLICE_SIZE) ? MULTI_HASH_SLICE_SIZE : (ULONG)Length;
+
+        MD5Update(&Context->Md5, (PUCHAR)Data, Slice);
+        SHA1Update(&Context->Sha1, Data, Slice);
+        SHA256Update(&Context->Sha256, Data, Slice);
+
+        Data += Slice;
+        Length -= Slice;
+    }
+}
+
+VOID
+MultiHashFinal(
+    PMULTI_HASH_CONTEXT Context,
+    PHASH_DIGESTS Digests
+)
+{
+    MD5Final(&Context->Md5);
+    SHA1Final(&Context->Sha1);
+    SHA256Final(&Context->Sha256);
+
+    memcpy(Digests->Md5, Context->Md5.Digest, sizeof(Digests->Md5));
+    memcpy(Digests->Sha1, Context->Sha1.Digest, sizeof(Digests->Sha1));
+    memcpy(Digests->Sha256, Context->Sha256.Digest, sizeof(Digests->Sha256));
+}
+
+VOID
+MultiHash(
+    const UCHAR *Data,
+    SIZE_T Length,
+    PHASH_DIGESTS Digests
+)
+{
+    MULTI_HASH_CONTEXT Context;
+
+    MultiHashInit(&Context);
+    MultiHashUpdate(&Context, Data, Length);
+    MultiHashFinal(&Context, Digests);
+}
+
+VOID
+MultiHashBatch(
+    PHASH_JOB Jobs,
+    ULONG Count
+)
+{
+    vector<MD5_JOB> Md5Jobs(Count);
+
+    for (ULONG i = 0; i < Count; i += 1)
+    {
+        SHA1_CONTEXT Sha1;
+        SHA256_CONTEXT Sha256;
+
+        Md5Jobs[i].Data = Jobs[i].Data;
+        Md5Jobs[i].Length = Jobs[i].Length;
+
+        SHA1Init(&Sha1);
+        SHA1Update(&Sha1, Jobs[i].Data, Jobs[i].Length);
+        SHA1Final(&Sha1);
+
+        SHA256Init(&Sha256);
+        SHA256Update(&Sha256, Jobs[i].Data, Jobs[i].Length);
+        SHA256Final(&Sha256);
+
+        memcpy(Jobs[i].Digests.Sha1, Sha1.Digest, sizeof(Jobs[i].Digests.Sha1));
+        memcpy(Jobs[i].Digests.Sha256, Sha256.Digest, sizeof(Jobs[i].Digests.Sha256));
+    }
+
+    MD5MultiBuffer(Md5Jobs.data(), Count);
+
+    for (ULONG i = 0; i < Count; i += 1)
+    {
+        memcpy(Jobs[i].Digests.Md5, Md5Jobs[i].Digest, sizeof(Jobs[i].Digests.Md5));
+    }
+}
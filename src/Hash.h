@@ -0,0 +1,169 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - Hash.h
+
+Abstract:
+
+    - SHA-1 and SHA-256, and a context computing MD5, SHA-1 and SHA-256 in one pass.
+    - SHA-NI code paths are used when the processor supports them.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#define MD5_DIGEST_SIZE 16
+#define SHA1_DIGEST_SIZE 20
+#define SHA256_DIGEST_SIZE 32
+
+//
+// SHA intrinsics are available from Visual Studio 2015.
+//
+#if !defined(HASH_SHANI_SUPPORT) && defined(_MSC_VER) && (_MSC_VER >= 1900)
+#define HASH_SHANI_SUPPORT 1
+#endif
+
+#define HASH_FEATURE_SSE2 (1 << 0)
+#define HASH_FEATURE_SSSE3 (1 << 1)
+#define HASH_FEATURE_SSE41 (1 << 2)
+#define HASH_FEATURE_AVX2 (1 << 3)
+#define HASH_FEATURE_SHANI (1 << 4)
+
+typedef struct _SHA1_CONTEXT {
+    ULONG State[5];
+    ULONG64 Length; // In bytes.
+    UCHAR Buffer[64];
+    UCHAR Digest[SHA1_DIGEST_SIZE];
+} SHA1_CONTEXT, *PSHA1_CONTEXT;
+
+typedef struct _SHA256_CONTEXT {
+    ULONG State[8];
+    ULONG64 Length; // In bytes.
+    UCHAR Buffer[64];
+    UCHAR Digest[SHA256_DIGEST_SIZE];
+} SHA256_CONTEXT, *PSHA256_CONTEXT;
+
+typedef struct _HASH_DIGESTS {
+    UCHAR Md5[MD5_DIGEST_SIZE];
+    UCHAR Sha1[SHA1_DIGEST_SIZE];
+    UCHAR Sha256[SHA256_DIGEST_SIZE];
+} HASH_DIGESTS, *PHASH_DIGESTS;
+
+typedef struct _HASH_JOB {
+    const UCHAR *Data;
+    SIZE_T Length;
+    HASH_DIGESTS Digests;
+} HASH_JOB, *PHASH_JOB;
+
+typedef struct _MULTI_HASH_CONTEXT {
+    MD5_CONTEXT Md5;
+    SHA1_CONTEXT Sha1;
+    SHA256_CONTEXT Sha256;
+} MULTI_HASH_CONTEXT, *PMULTI_HASH_CONTEXT;
+
+ULONG
+GetHashFeatures(
+    VOID
+);
+
+VOID
+SHA1Init(
+    PSHA1_CONTEXT Context
+);
+
+VOID
+SHA1Update(
+    PSHA1_CONTEXT Context,
+    const UCHAR *Data,
+    SIZE_T Length
+);
+
+VOID
+SHA1Final(
+    PSHA1_CONTEXT Context
+);
+
+VOID
+SHA256Init(
+    PSHA256_CONTEXT Context
+);
+
+VOID
+SHA256Update(
+    PSHA256_CONTEXT Context,
+    const UCHAR *Data,
+    SIZE_T Length
+);
+
+VOID
+SHA256Final(
+    PSHA256_CONTEXT Context
+);
+
+VOID
+MultiHashInit(
+    PMULTI_HASH_CONTEXT Context
+);
+
+//
+// Data is consumed in slices small enough to stay in the L1 cache while the
+// three algorithms go over it.
+//
+VOID
+MultiHashUpdate(
+    PMULTI_HASH_CONTEXT Context,
+    const UCHAR *Data,
+    SIZE_T Length
+);
+
+VOID
+MultiHashFinal(
+    PMULTI_HASH_CONTEXT Context,
+    PHASH_DIGESTS Digests
+);
+
+VOID
+MultiHash(
+    const UCHAR *Data,
+    SIZE_T Length,
+    PHASH_DIGESTS Digests
+);
+
+//
+// Many small buffers (e.g. sections): the MD5 of all jobs goes through the
+// multi-buffer engine, SHA-1 and SHA-256 are computed job by job.
+//
+VOID
+MultiHashBatch(
+    PHASH_JOB Jobs,
+    ULONG Count
+);
+
+#endif
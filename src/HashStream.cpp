@@ -0,0 +1,297 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - HashStream.cpp
+
+Abstract:
+
+    - Two chunk buffers are used in turn: the engine thread reads one while
+      the other one is hashed by the hasher thread of the stream. Memory use
+      does not depend on the range size, and neither does the number of
+      threads.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+#include <functional>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "FuzzyHash.h"
+#include "HashStream.h"
+
+HashStream::HashStream(
+    const READ_ROUTINE& Reader
+) :
+    m_Reader(Reader),
+    m_PageBase(0ULL),
+    m_NumberOfUnreadablePages(0),
+    m_Forked(FALSE),
+    m_Pending(NULL),
+    m_Stop(FALSE)
+{
+    InitializeCriticalSection(&m_Lock);
+    InitializeConditionVariable(&m_Posted);
+    InitializeConditionVariable(&m_Hashed);
+}
+
+HashStream::~HashStream(
+)
+{
+    if (m_Hasher.joinable())
+    {
+        EnterCriticalSection(&m_Lock);
+        m_Stop = TRUE;
+        WakeConditionVariable(&m_Posted);
+        LeaveCriticalSection(&m_Lock);
+
+        m_Hasher.join();
+    }
+
+    DeleteCriticalSection(&m_Lock);
+}
+
+BOOLEAN
+HashStream::IsPageReadable(
+    ULONG Page
+)
+{
+    if ((Page / 8) >= m_UnreadableBitmap.size()) return FALSE;
+
+    return (m_UnreadableBitmap[Page / 8] & (1 << (Page % 8))) ? FALSE : TRUE;
+}
+
+VOID
+HashStream::ReadChunk(
+    ULONG64 Address,
+    PSTREAM_CHUNK Chunk
+)
+{
+    Chunk->Holes.clear();
+
+    m_Reader(Address, Chunk->Buffer, Chunk->Size, [this, Address, Chunk](ULONG Offset, ULONG Size)
+    {
+        ULONG Page = (ULONG)(((Address + Offset) - m_PageBase) / HASH_STREAM_PAGE_SIZE);
+
+        if (Chunk->Holes.size() && ((Chunk->Holes.back().Offset + Chunk->Holes.back().Size) == Offset))
+        {
+            Chunk->Holes.back().Size += Size;
+        }
+        else
+        {
+            STREAM_HOLE Hole = { Offset, Size };
+            Chunk->Holes.push_back(Hole);
+        }
+
+        m_UnreadableBitmap[Page / 8] |= (UCHAR)(1 << (Page % 8));
+        m_NumberOfUnreadablePages += 1;
+    });
+}
+
+VOID
+HashStream::HashChunk(
+    PSTREAM_CHUNK Chunk
+)
+{
+    ULONG Offset = 0;
+
+    for (STREAM_HOLE& Hole : Chunk->Holes)
+    {
+        if (Hole.Offset > Offset)
+        {
+            MultiHashUpdate(&m_AsRead, Chunk->Buffer + Offset, Hole.Offset - Offset);
+            if (m_Forked) MultiHashUpdate(&m_Readable, Chunk->Buffer + Offset, Hole.Offset - Offset);
+        }
+
+        //
+        // Both hashes are identical until the first hole.
+        //
+        if (!m_Forked)
+        {
+            m_Readable = m_AsRead;
+            m_Forked = TRUE;
+        }
+
+        MultiHashUpdate(&m_AsRead, Chunk->Buffer + Hole.Offset, Hole.Size);
+
+        Offset = Hole.Offset + Hole.Size;
+    }
+
+    if (Chunk->Size > Offset)
+    {
+        MultiHashUpdate(&m_AsRead, Chunk->Buffer + Offset, Chunk->Size - Offset);
+        if (m_Forked) MultiHashUpdate(&m_Readable, Chunk->Buffer + Offset, Chunk->Size - Offset);
+    }
+
+    //
+    // Holes are zero-filled in the buffer, the chunk is hashed as read.
+    //
+    FuzzyUpdate(&m_Fuzzy, Chunk->Buffer, Chunk->Size);
+}
+
+VOID
+HashStream::Hasher(
+)
+{
+    EnterCriticalSection(&m_Lock);
+
+    for (;;)
+    {
+        PSTREAM_CHUNK Chunk;
+
+        while ((m_Pending == NULL) && !m_Stop) SleepConditionVariableCS(&m_Posted, &m_Lock, INFINITE);
+        if (m_Pending == NULL) break;
+
+        Chunk = m_Pending;
+
+        LeaveCriticalSection(&m_Lock);
+        HashChunk(Chunk);
+        EnterCriticalSection(&m_Lock);
+
+        m_Pending = NULL;
+        WakeConditionVariable(&m_Hashed);
+    }
+
+    LeaveCriticalSection(&m_Lock);
+}
+
+VOID
+HashStream::PostChunk(
+    PSTREAM_CHUNK Chunk
+)
+{
+    if (!m_Hasher.joinable())
+    {
+        try
+        {
+            m_Hasher = thread([this]() { Hasher(); });
+        }
+        catch (...)
+        {
+            HashChunk(Chunk);
+            return;
+        }
+    }
+
+    EnterCriticalSection(&m_Lock);
+    m_Pending = Chunk;
+    WakeConditionVariable(&m_Posted);
+    LeaveCriticalSection(&m_Lock);
+}
+
+VOID
+HashStream::WaitForHasher(
+)
+{
+    EnterCriticalSection(&m_Lock);
+    while (m_Pending != NULL) SleepConditionVariableCS(&m_Hashed, &m_Lock, INFINITE);
+    LeaveCriticalSection(&m_Lock);
+}
+
+BOOLEAN
+HashStream::HashVirtual(
+    ULONG64 Address,
+    ULONG64 Size,
+    PSTREAM_DIGESTS Digests
+)
+{
+    STREAM_CHUNK Chunks[2];
+    ULONG Current = 0;
+    ULONG64 Offset;
+    ULONG NumberOfPages;
+    BOOLEAN Result = FALSE;
+
+    RtlZeroMemory(Digests, sizeof(*Digests));
+
+    m_PageBase = Address & ~((ULONG64)HASH_STREAM_PAGE_SIZE - 1);
+    NumberOfPages = (ULONG)((((Address + Size + HASH_STREAM_PAGE_SIZE - 1) & ~((ULONG64)HASH_STREAM_PAGE_SIZE - 1)) - m_PageBase) / HASH_STREAM_PAGE_SIZE);
+
+    m_UnreadableBitmap.assign((NumberOfPages + 7) / 8, 0);
+    m_NumberOfUnreadablePages = 0;
+    m_Forked = FALSE;
+
+    MultiHashInit(&m_AsRead);
+    FuzzyInit(&m_Fuzzy);
+
+    Chunks[0].Buffer = (PUCHAR)malloc(HASH_STREAM_CHUNK_SIZE);
+    Chunks[1].Buffer = (PUCHAR)malloc(HASH_STREAM_CHUNK_SIZE);
+    if ((Chunks[0].Buffer == NULL) || (Chunks[1].Buffer == NULL)) goto CleanUp;
+
+    for (Offset = 0; Offset < Size; Offset += Chunks[Current].Size, Current ^= 1)
+    {
+        PSTREAM_CHUNK Chunk = &Chunks[Current];
+
+        //
+        // Chunks end on a page boundary so that a page never spans two chunks.
+        //
+        Chunk->Size = (ULONG)min(Size - Offset,
+            (((Address + Offset) & ~((ULONG64)HASH_STREAM_PAGE_SIZE - 1)) + HASH_STREAM_CHUNK_SIZE) - (Address + Offset));
+
+        ReadChunk(Address + Offset, Chunk);
+
+        WaitForHasher();
+
+        if (Offset + Chunk->Size >= Size)
+        {
+            //
+            // Last chunk, nothing left to overlap with.
+            //
+            HashChunk(Chunk);
+            continue;
+        }
+
+        PostChunk(Chunk);
+    }
+
+    WaitForHasher();
+
+    MultiHashFinal(&m_AsRead, &Digests->AsRead);
+
+    if (m_Forked) MultiHashFinal(&m_Readable, &Digests->Readable);
+    else Digests->Readable = Digests->AsRead;
+
+    FuzzyFinal(&m_Fuzzy, &Digests->Fuzzy);
+
+    Digests->Size = Size;
+    Digests->NumberOfPages = NumberOfPages;
+    Digests->NumberOfUnreadablePages = m_NumberOfUnreadablePages;
+
+    Result = TRUE;
+
+CleanUp:
+    if (Chunks[0].Buffer) free(Chunks[0].Buffer);
+    if (Chunks[1].Buffer) free(Chunks[1].Buffer);
+
+    return Result;
+}
@@ -0,0 +1,154 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - HashStream.h
+
+Abstract:
+
+    - Hashes a virtual range while it is being read from the target, without
+      capturing it first.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __HASHSTREAM_H__
+#define __HASHSTREAM_H__
+
+#define HASH_STREAM_CHUNK_SIZE (1024 * 1024)
+#define HASH_STREAM_PAGE_SIZE 0x1000
+
+typedef struct _STREAM_DIGESTS {
+    HASH_DIGESTS AsRead; // Unreadable pages hashed as zeroes.
+    HASH_DIGESTS Readable; // Unreadable pages left out.
+    FUZZY_DIGESTS Fuzzy; // As read.
+
+    ULONG64 Size;
+    ULONG NumberOfPages;
+    ULONG NumberOfUnreadablePages;
+} STREAM_DIGESTS, *PSTREAM_DIGESTS;
+
+class HashStream {
+public:
+    //
+    // Same contract as ReadVirtualPages(): unreadable pages are zero-filled and reported
+    // to Hole, the number of such pages is returned.
+    //
+    typedef function<VOID(ULONG Offset, ULONG Size)> HOLE_ROUTINE;
+    typedef function<ULONG(ULONG64 Address, PUCHAR Buffer, ULONG Size, const HOLE_ROUTINE& Hole)> READ_ROUTINE;
+
+    HashStream(
+        const READ_ROUTINE& Reader
+    );
+
+    ~HashStream(
+    );
+
+    //
+    // Reads the range chunk by chunk from the calling thread. A chunk is hashed by the
+    // hasher thread of the stream while the next one is read, the thread is started
+    // with the first range of more than one chunk and kept for the next ones.
+    //
+    BOOLEAN
+    HashVirtual(
+        ULONG64 Address,
+        ULONG64 Size,
+        PSTREAM_DIGESTS Digests
+    );
+
+    //
+    // Page index relative to the page containing the start address of the last range.
+    //
+    BOOLEAN
+    IsPageReadable(
+        ULONG Page
+    );
+
+    vector<UCHAR> m_UnreadableBitmap; // One bit per page.
+
+private:
+    typedef struct _STREAM_HOLE {
+        ULONG Offset;
+        ULONG Size;
+    } STREAM_HOLE, *PSTREAM_HOLE;
+
+    typedef struct _STREAM_CHUNK {
+        PUCHAR Buffer;
+        ULONG Size;
+        vector<STREAM_HOLE> Holes; // Zero-filled ranges, by increasing offset.
+    } STREAM_CHUNK, *PSTREAM_CHUNK;
+
+    HashStream(const HashStream&);
+    HashStream& operator=(const HashStream&);
+
+    VOID
+    ReadChunk(
+        ULONG64 Address,
+        PSTREAM_CHUNK Chunk
+    );
+
+    VOID
+    HashChunk(
+        PSTREAM_CHUNK Chunk
+    );
+
+    //
+    // Hands Chunk to the hasher thread, or hashes it here if the thread cannot be started.
+    //
+    VOID
+    PostChunk(
+        PSTREAM_CHUNK Chunk
+    );
+
+    VOID
+    WaitForHasher(
+    );
+
+    VOID
+    Hasher(
+    );
+
+    READ_ROUTINE m_Reader;
+
+    ULONG64 m_PageBase;
+    ULONG m_NumberOfUnreadablePages;
+
+    MULTI_HASH_CONTEXT m_AsRead;
+    MULTI_HASH_CONTEXT m_Readable; // Copy of m_AsRead taken at the first hole.
+    BOOLEAN m_Forked;
+
+    FUZZY_CONTEXT m_Fuzzy;
+
+    thread m_Hasher;
+    CRITICAL_SECTION m_Lock;
+    CONDITION_VARIABLE m_Posted; // A chunk was posted, or the stream is destroyed.
+    CONDITION_VARIABLE m_Hashed;
+    PSTREAM_CHUNK m_Pending; // Until hashed.
+    BOOLEAN m_Stop;
+};
+
+#endif
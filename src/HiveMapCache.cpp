@@ -0,0 +1,216 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - HiveMapCache.cpp
+
+Abstract:
+
+    - Cell index to address translation of the registry hives of the
+      target, the map tables of a hive are read once per session.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <string.h>
+#include <map>
+#include <vector>
+using namespace std;
+
+#include "HiveMapCache.h"
+
+HiveMapCache::HiveMapCache(
+    PHIVE_LAYOUT_LOADER Loader,
+    PHIVE_MAP_READER Reader,
+    PVOID Context
+) :
+    m_Loader(Loader),
+    m_Reader(Reader),
+    m_Context(Context),
+    m_LastHive(0),
+    m_LastMap(NULL)
+{
+    ResetStats();
+}
+
+//
+// Count pointers found every Stride bytes, Offset bytes into each entry, in one read.
+//
+BOOLEAN
+HiveMapCache::ReadPointers(
+    ULONG64 Address,
+    ULONG PointerSize,
+    ULONG Stride,
+    ULONG Offset,
+    ULONG Count,
+    vector<ULONG64>& Pointers
+)
+{
+    vector<UCHAR> Buffer((SIZE_T)Stride * Count);
+
+    Pointers.assign(Count, 0ULL);
+
+    if ((PointerSize != sizeof(ULONG)) && (PointerSize != sizeof(ULONG64))) return FALSE;
+    if ((Offset + PointerSize) > Stride) return FALSE;
+
+    m_Stats.Reads += 1;
+    if (!m_Reader(m_Context, Address, &Buffer[0], (ULONG)Buffer.size())) return FALSE;
+
+    for (ULONG i = 0; i < Count; i += 1)
+    {
+        const UCHAR *Entry = &Buffer[((SIZE_T)i * Stride) + Offset];
+
+        if (PointerSize == sizeof(ULONG64)) memcpy(&Pointers[i], Entry, sizeof(ULONG64));
+        else Pointers[i] = *(const ULONG *)Entry;
+    }
+
+    return TRUE;
+}
+
+//
+// Reads the directory entry of Table, then the block addresses of its _HMAP_TABLE. Only
+// the entry is read from the directory: a small hive has no directory past SmallDir.
+//
+BOOLEAN
+HiveMapCache::LoadTable(
+    PHIVE_MAP Map,
+    ULONG Type,
+    ULONG Table
+)
+{
+    PHIVE_MAP_LAYOUT Layout = &Map->Layout;
+    vector<ULONG64> Entry;
+
+    if (!ReadPointers(Layout->Directory[Type] + ((ULONG64)Table * Layout->PointerSize), Layout->PointerSize,
+                      Layout->PointerSize, 0, 1, Entry) || !Entry[0])
+    {
+        return FALSE;
+    }
+
+    if (!ReadPointers(Entry[0], Layout->PointerSize, Layout->EntrySize, Layout->BlockAddressOffset,
+                      HIVE_MAP_TABLE_SIZE, Map->Blocks[Type][Table]))
+    {
+        Map->Blocks[Type][Table].clear();
+        return FALSE;
+    }
+
+    m_Stats.Tables += 1;
+
+    return TRUE;
+}
+
+ULONG64
+HiveMapCache::GetCellAddress(
+    ULONG64 Hive,
+    ULONG CellIndex
+)
+{
+    ULONG Type = (CellIndex & HCELL_TYPE_MASK) >> HCELL_TYPE_SHIFT;
+    ULONG Table = (CellIndex & HCELL_TABLE_MASK) >> HCELL_TABLE_SHIFT;
+    ULONG Block = (CellIndex & HCELL_BLOCK_MASK) >> HCELL_BLOCK_SHIFT;
+    ULONG Offset = CellIndex & HCELL_OFFSET_MASK;
+    PHIVE_MAP Map = m_LastMap;
+    vector<ULONG64> *Blocks;
+    BOOLEAN Hit = TRUE;
+
+    m_Stats.Lookups += 1;
+
+    if ((Map == NULL) || (m_LastHive != Hive))
+    {
+        map<ULONG64, HIVE_MAP>::iterator It = m_Hives.find(Hive);
+
+        if (It == m_Hives.end())
+        {
+            It = m_Hives.insert(make_pair(Hive, HIVE_MAP())).first;
+            Map = &It->second;
+
+            Map->Valid = m_Loader(m_Context, Hive, &Map->Layout);
+            for (ULONG i = 0; i < HIVE_MAP_STORAGE_TYPES; i += 1)
+            {
+                Map->Layout.DirectorySize[i] = min(Map->Layout.DirectorySize[i], (ULONG)HIVE_MAP_DIRECTORY_SIZE);
+            }
+            m_Stats.Hives += 1;
+            Hit = FALSE;
+        }
+
+        Map = &It->second;
+        m_LastHive = Hive;
+        m_LastMap = Map;
+    }
+
+    if (!Map->Valid || !Map->Layout.Directory[Type]) goto Failed;
+    if (Table >= Map->Layout.DirectorySize[Type]) goto Failed;
+
+    if (Map->Blocks[Type].empty())
+    {
+        Map->Blocks[Type].resize(Map->Layout.DirectorySize[Type]);
+        Map->Failed[Type].assign(Map->Layout.DirectorySize[Type], FALSE);
+    }
+
+    if (Map->Failed[Type][Table]) goto Failed;
+
+    Blocks = &Map->Blocks[Type][Table];
+
+    if (Blocks->empty())
+    {
+        Hit = FALSE;
+
+        if (!LoadTable(Map, Type, Table))
+        {
+            Map->Failed[Type][Table] = TRUE;
+            goto Failed;
+        }
+    }
+
+    if (!(*Blocks)[Block]) goto Failed;
+
+    if (Hit) m_Stats.Hits += 1;
+
+    return (*Blocks)[Block] + Offset + Map->Layout.CellHeaderSize;
+
+Failed:
+    m_Stats.Failures += 1;
+
+    return 0ULL;
+}
+
+VOID
+HiveMapCache::Flush(
+)
+{
+    m_Hives.clear();
+    m_LastHive = 0;
+    m_LastMap = NULL;
+}
+
+VOID
+HiveMapCache::ResetStats(
+)
+{
+    RtlZeroMemory(&m_Stats, sizeof(m_Stats));
+}
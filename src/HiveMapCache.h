@@ -0,0 +1,164 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - HiveMapCache.h
+
+Abstract:
+
+    - Cell index to address translation of the registry hives of the
+      target, the map tables of a hive are read once per session.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __HIVEMAPCACHE_H__
+#define __HIVEMAPCACHE_H__
+
+//
+// Cell index: storage type (stable or volatile), map directory entry, map table entry,
+// offset in the block.
+//
+#define HCELL_TYPE_MASK 0x80000000
+#define HCELL_TYPE_SHIFT 31
+
+#define HCELL_TABLE_MASK 0x7fe00000
+#define HCELL_TABLE_SHIFT 21
+
+#define HCELL_BLOCK_MASK 0x001ff000
+#define HCELL_BLOCK_SHIFT 12
+
+#define HCELL_OFFSET_MASK 0x00000fff
+
+#define HIVE_MAP_STORAGE_TYPES 2
+#define HIVE_MAP_DIRECTORY_SIZE ((HCELL_TABLE_MASK >> HCELL_TABLE_SHIFT) + 1) // _HMAP_DIRECTORY entries.
+#define HIVE_MAP_TABLE_SIZE ((HCELL_BLOCK_MASK >> HCELL_BLOCK_SHIFT) + 1) // _HMAP_TABLE entries.
+
+class HiveMapCache {
+public:
+    typedef struct _HIVE_MAP_LAYOUT {
+        ULONG64 Directory[HIVE_MAP_STORAGE_TYPES]; // _HMAP_DIRECTORY of each storage, 0 if none.
+
+        //
+        // Entries of each directory: 1 when Map points at the SmallDir of the _DUAL (small
+        // hives), which only holds the address of table 0.
+        //
+        ULONG DirectorySize[HIVE_MAP_STORAGE_TYPES];
+        ULONG PointerSize;
+        ULONG EntrySize; // _HMAP_ENTRY
+        ULONG BlockAddressOffset;
+        ULONG CellHeaderSize; // Between the block address of a cell and its data.
+    } HIVE_MAP_LAYOUT, *PHIVE_MAP_LAYOUT;
+
+    //
+    // Fills the layout of the hive at Hive, FALSE if it cannot be read.
+    //
+    typedef BOOLEAN (*PHIVE_LAYOUT_LOADER)(PVOID Context, ULONG64 Hive, PHIVE_MAP_LAYOUT Layout);
+
+    //
+    // Returns TRUE if Size bytes at Address have been read into Buffer.
+    //
+    typedef BOOLEAN (*PHIVE_MAP_READER)(PVOID Context, ULONG64 Address, PVOID Buffer, ULONG Size);
+
+    typedef struct _HIVE_MAP_CACHE_STATS {
+        ULONG64 Lookups;
+        ULONG64 Hits; // Translated without reading anything.
+        ULONG64 Failures; // Unreadable hive, directory entry or table, cached.
+        ULONG64 Hives;
+        ULONG64 Tables; // Map tables read.
+        ULONG64 Reads;
+    } HIVE_MAP_CACHE_STATS, *PHIVE_MAP_CACHE_STATS;
+
+    HiveMapCache(
+        PHIVE_LAYOUT_LOADER Loader,
+        PHIVE_MAP_READER Reader,
+        PVOID Context
+    );
+
+    //
+    // Address of the data of the cell, 0 if it cannot be translated.
+    //
+    ULONG64
+    GetCellAddress(
+        ULONG64 Hive,
+        ULONG CellIndex
+    );
+
+    VOID
+    Flush(
+    );
+
+    VOID
+    ResetStats(
+    );
+
+    HIVE_MAP_CACHE_STATS m_Stats;
+
+private:
+    typedef struct _HIVE_MAP {
+        BOOLEAN Valid;
+        HIVE_MAP_LAYOUT Layout;
+
+        //
+        // Per storage and directory entry, the block addresses of the table once it was
+        // touched. Entries that could not be read are Failed until the next Flush().
+        //
+        vector<vector<ULONG64>> Blocks[HIVE_MAP_STORAGE_TYPES];
+        vector<BOOLEAN> Failed[HIVE_MAP_STORAGE_TYPES];
+    } HIVE_MAP, *PHIVE_MAP;
+
+    BOOLEAN
+    LoadTable(
+        PHIVE_MAP Map,
+        ULONG Type,
+        ULONG Table
+    );
+
+    BOOLEAN
+    ReadPointers(
+        ULONG64 Address,
+        ULONG PointerSize,
+        ULONG Stride,
+        ULONG Offset,
+        ULONG Count,
+        vector<ULONG64>& Pointers
+    );
+
+    PHIVE_LAYOUT_LOADER m_Loader;
+    PHIVE_MAP_READER m_Reader;
+    PVOID m_Context;
+
+    map<ULONG64, HIVE_MAP> m_Hives;
+
+    //
+    // Cells of a walk come from the same hive, its map is found without a lookup.
+    //
+    ULONG64 m_LastHive;
+    PHIVE_MAP m_LastMap;
+};
+
+#endif
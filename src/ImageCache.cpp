@@ -0,0 +1,310 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - ImageCache.cpp
+
+Abstract:
+
+    - Session-wide cache of parsed PE metadata.
+    - An image is identified by its TimeDateStamp, SizeOfImage, PDB GUID/Age and a
+      hash of its headers. A cached entry is only reused if every page of the headers
+      and of the read-only sections maps to the same physical page, i.e. the image
+      is the shared (unpatched) copy. Writable sections are hashed again.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include "MoonSolsDbgExt.h"
+
+ImageCache g_ImageCache;
+
+ImageCache::ImageCache(
+) :
+    m_NumberOfEntries(0)
+{
+    ResetStats();
+}
+
+static
+BOOLEAN
+ReadImage(
+    PVOID Context,
+    ULONG64 Address,
+    PVOID Buffer,
+    ULONG Size
+)
+{
+    UNREFERENCED_PARAMETER(Context);
+
+    return (g_Ext->m_Data->ReadVirtual(Address, Buffer, Size, NULL) == S_OK) ? TRUE : FALSE;
+}
+
+static
+BOOLEAN
+TranslateImage(
+    PVOID Context,
+    ULONG64 Address,
+    PULONG64 PhysicalAddress
+)
+{
+    UNREFERENCED_PARAMETER(Context);
+
+    return (g_Ext->m_Data2->VirtualToPhysical(Address, PhysicalAddress) == S_OK) ? TRUE : FALSE;
+}
+
+BOOLEAN
+ImageCache::GetIdentity(
+    PEFile *Image,
+    PIMAGE_IDENTITY Identity
+)
+{
+    return GetImageIdentity(Image->m_ImageBase, ReadImage, TranslateImage, NULL, Identity);
+}
+
+BOOLEAN
+ImageCache::RehashSection(
+    PEFile *Image,
+    PEFile::PCACHED_SECTION_INFO Section
+)
+{
+    HASH_DIGESTS Digests;
+    PUCHAR Buffer;
+
+    Buffer = (PUCHAR)malloc(Section->VaSize);
+    if (Buffer == NULL) goto Invalid;
+
+    //
+    // The digests of the cached copy do not apply to this process, and garbage is not hashed.
+    //
+    if (ExtRemoteTypedEx::ReadVirtual(Image->m_ImageBase + Section->VaBase, Buffer, Section->VaSize, NULL) != S_OK)
+    {
+        free(Buffer);
+        goto Invalid;
+    }
+
+    MultiHash(Buffer, Section->VaSize, &Digests);
+
+    memcpy_s(Section->VaMd5Hash, sizeof(Section->VaMd5Hash), Digests.Md5, sizeof(Digests.Md5));
+    memcpy_s(Section->VaSha1Hash, sizeof(Section->VaSha1Hash), Digests.Sha1, sizeof(Digests.Sha1));
+    memcpy_s(Section->VaSha256Hash, sizeof(Section->VaSha256Hash), Digests.Sha256, sizeof(Digests.Sha256));
+
+    FuzzyHash(Buffer, Section->VaSize, &Section->VaFuzzy);
+    GetEntropySummary(Buffer, Section->VaSize, &Section->VaEntropy);
+
+    free(Buffer);
+
+    Section->VaHashValid = TRUE;
+
+    return TRUE;
+
+Invalid:
+    RtlZeroMemory(Section->VaMd5Hash, sizeof(Section->VaMd5Hash));
+    RtlZeroMemory(Section->VaSha1Hash, sizeof(Section->VaSha1Hash));
+    RtlZeroMemory(Section->VaSha256Hash, sizeof(Section->VaSha256Hash));
+    RtlZeroMemory(&Section->VaFuzzy, sizeof(Section->VaFuzzy));
+    RtlZeroMemory(&Section->VaEntropy, sizeof(Section->VaEntropy));
+
+    Section->VaHashValid = FALSE;
+
+    return FALSE;
+}
+
+BOOLEAN
+ImageCache::Load(
+    PEFile *Image,
+    PIMAGE_IDENTITY Identity,
+    BOOLEAN NeedExports,
+    BOOLEAN NeedImports
+)
+{
+    map<IMAGE_CACHE_KEY, vector<IMAGE_CACHE_ENTRY>>::iterator It;
+
+    m_Stats.Lookups += 1;
+
+    It = m_Entries.find(Identity->Key);
+    if (It == m_Entries.end())
+    {
+        m_Stats.Misses += 1;
+        return FALSE;
+    }
+
+    for (ULONG i = 0; i < It->second.size(); i += 1)
+    {
+        IMAGE_CACHE_ENTRY& Entry = It->second[i];
+
+        if (NeedExports && !Entry.HasExports) continue;
+        if (NeedImports && !Entry.HasImports) continue;
+
+        if (Entry.Pages != Identity->Pages)
+        {
+            m_Stats.PageMismatches += 1;
+            continue;
+        }
+
+        Image->m_FileVersion = Entry.FileVersion;
+        Image->m_PdbInfo = Entry.PdbInfo;
+        memcpy(Image->m_ImpHash, Entry.ImpHash, sizeof(Image->m_ImpHash));
+        Image->m_HasImpHash = Entry.HasImpHash;
+
+        Image->m_CcSections.assign(Entry.Sections.begin(), Entry.Sections.end());
+
+        for (ULONG j = 0; j < Image->m_CcSections.size(); j += 1)
+        {
+            PEFile::PCACHED_SECTION_INFO Section = &Image->m_CcSections[j];
+
+            //
+            // Writable sections, and read-only ones sharing a page with the import address table,
+            // hold what this process wrote.
+            //
+            if ((Section->Characteristics & IMAGE_SCN_MEM_WRITE) || HasPrivatePages(Identity, Section->VaBase, Section->VaSize))
+            {
+                if (!RehashSection(Image, Section)) m_Stats.SectionsUnreadable += 1;
+                m_Stats.SectionsRehashed += 1;
+            }
+            else
+            {
+                m_Stats.SectionsReused += 1;
+            }
+        }
+
+        if (NeedExports)
+        {
+            Image->m_Exports.assign(Entry.Exports.begin(), Entry.Exports.end());
+            Image->m_NumberOfExportedFunctions = Entry.NumberOfExportedFunctions;
+            Image->m_NumberOfHookedAPIs = Entry.NumberOfHookedAPIs;
+            Image->m_OrdinalBase = Entry.OrdinalBase;
+            Image->RtlBuildExportIndex();
+        }
+
+        if (NeedImports)
+        {
+            Image->m_Imports.assign(Entry.Imports.begin(), Entry.Imports.end());
+            Image->m_ImportThunkSize = Entry.ImportThunkSize;
+        }
+
+        if (!Image->m_ImageSize) Image->m_ImageSize = Identity->Key.SizeOfImage;
+
+        m_Stats.Hits += 1;
+
+        return TRUE;
+    }
+
+    m_Stats.Misses += 1;
+
+    return FALSE;
+}
+
+VOID
+ImageCache::Insert(
+    PEFile *Image,
+    PIMAGE_IDENTITY Identity,
+    BOOLEAN HasExports,
+    BOOLEAN HasImports
+)
+{
+    IMAGE_CACHE_ENTRY Entry;
+    ULONG i;
+
+    if (m_NumberOfEntries >= IMAGE_CACHE_MAX_ENTRIES) Flush();
+
+    Entry.Pages = Identity->Pages;
+    Entry.FileVersion = Image->m_FileVersion;
+    Entry.PdbInfo = Image->m_PdbInfo;
+    memcpy(Entry.ImpHash, Image->m_ImpHash, sizeof(Entry.ImpHash));
+    Entry.HasImpHash = Image->m_HasImpHash;
+    Entry.Sections.assign(Image->m_CcSections.begin(), Image->m_CcSections.end());
+
+    Entry.HasExports = HasExports;
+    if (HasExports) Entry.Exports.assign(Image->m_Exports.begin(), Image->m_Exports.end());
+    Entry.NumberOfExportedFunctions = Image->m_NumberOfExportedFunctions;
+    Entry.NumberOfHookedAPIs = Image->m_NumberOfHookedAPIs;
+    Entry.OrdinalBase = Image->m_OrdinalBase;
+
+    Entry.HasImports = HasImports;
+    if (HasImports) Entry.Imports.assign(Image->m_Imports.begin(), Image->m_Imports.end());
+    Entry.ImportThunkSize = Image->m_ImportThunkSize;
+
+    vector<IMAGE_CACHE_ENTRY>& Variants = m_Entries[Identity->Key];
+
+    //
+    // Same pages: the entry is refreshed, keeping what the previous command parsed.
+    //
+    for (i = 0; i < Variants.size(); i += 1)
+    {
+        if (Variants[i].Pages == Entry.Pages) break;
+    }
+
+    if (i < Variants.size())
+    {
+        if (Variants[i].HasExports && !HasExports)
+        {
+            Entry.HasExports = TRUE;
+            Entry.Exports = move(Variants[i].Exports);
+            Entry.NumberOfExportedFunctions = Variants[i].NumberOfExportedFunctions;
+            Entry.NumberOfHookedAPIs = Variants[i].NumberOfHookedAPIs;
+            Entry.OrdinalBase = Variants[i].OrdinalBase;
+        }
+
+        if (Variants[i].HasImports && !HasImports)
+        {
+            Entry.HasImports = TRUE;
+            Entry.Imports = move(Variants[i].Imports);
+            Entry.ImportThunkSize = Variants[i].ImportThunkSize;
+        }
+
+        Variants[i] = move(Entry);
+    }
+    else
+    {
+        if (Variants.size() >= IMAGE_CACHE_MAX_VARIANTS)
+        {
+            Variants.erase(Variants.begin());
+            m_NumberOfEntries -= 1;
+        }
+
+        Variants.push_back(move(Entry));
+        m_NumberOfEntries += 1;
+    }
+
+    m_Stats.Insertions += 1;
+}
+
+VOID
+ImageCache::Flush(
+)
+{
+    m_Entries.clear();
+    m_NumberOfEntries = 0;
+}
+
+VOID
+ImageCache::ResetStats(
+)
+{
+    RtlZeroMemory(&m_Stats, sizeof(m_Stats));
+}
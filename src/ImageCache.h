@@ -0,0 +1,137 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - ImageCache.h
+
+Abstract:
+
+    - Session-wide cache of parsed PE metadata (version, PDB, section hashes,
+      exports). Shared images (ntdll, kernel32...) are parsed once and reused
+      for every process mapping the same physical pages.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __IMAGECACHE_H__
+#define __IMAGECACHE_H__
+
+#define IMAGE_CACHE_MAX_ENTRIES 2048
+#define IMAGE_CACHE_MAX_VARIANTS 4 // Same identity, different pages (e.g. patched copy).
+
+class ImageCache {
+public:
+    typedef struct _IMAGE_CACHE_ENTRY {
+        vector<ULONG64> Pages;
+
+        PEFile::FILE_VERSION FileVersion;
+        PEFile::PDB_INFO PdbInfo;
+        UCHAR ImpHash[MD5_DIGEST_SIZE];
+        BOOLEAN HasImpHash;
+        vector<PEFile::CACHED_SECTION_INFO> Sections;
+
+        BOOLEAN HasExports;
+        vector<PEFile::EXPORT_INFO> Exports;
+        ULONG NumberOfExportedFunctions;
+        ULONG NumberOfHookedAPIs;
+        ULONG OrdinalBase;
+
+        BOOLEAN HasImports;
+        vector<PEFile::IMPORT_INFO> Imports;
+        ULONG ImportThunkSize;
+    } IMAGE_CACHE_ENTRY, *PIMAGE_CACHE_ENTRY;
+
+    typedef struct _IMAGE_CACHE_STATS {
+        ULONG64 Lookups;
+        ULONG64 Hits;
+        ULONG64 Misses;
+        ULONG64 PageMismatches;
+        ULONG64 Insertions;
+        ULONG64 SectionsReused;
+        ULONG64 SectionsRehashed;
+        ULONG64 SectionsUnreadable;
+    } IMAGE_CACHE_STATS, *PIMAGE_CACHE_STATS;
+
+    //
+    // Reads the headers, debug directory and page mappings of the image (see GetImageIdentity()).
+    // Engine thread only, in the context of the process owning the image.
+    //
+    BOOLEAN
+    GetIdentity(
+        PEFile *Image,
+        PIMAGE_IDENTITY Identity
+    );
+
+    //
+    // Fills Image from the cache. Returns FALSE if the image has to be parsed.
+    //
+    BOOLEAN
+    Load(
+        PEFile *Image,
+        PIMAGE_IDENTITY Identity,
+        BOOLEAN NeedExports,
+        BOOLEAN NeedImports
+    );
+
+    //
+    // Stores the metadata of a freshly parsed image.
+    //
+    VOID
+    Insert(
+        PEFile *Image,
+        PIMAGE_IDENTITY Identity,
+        BOOLEAN HasExports,
+        BOOLEAN HasImports
+    );
+
+    VOID
+    Flush(
+    );
+
+    VOID
+    ResetStats(
+    );
+
+    ImageCache(
+    );
+
+    IMAGE_CACHE_STATS m_Stats;
+
+private:
+    BOOLEAN
+    RehashSection(
+        PEFile *Image,
+        PEFile::PCACHED_SECTION_INFO Section
+    );
+
+    map<IMAGE_CACHE_KEY, vector<IMAGE_CACHE_ENTRY>> m_Entries;
+    ULONG m_NumberOfEntries;
+};
+
+extern ImageCache g_ImageCache;
+
+#endif
@@ -0,0 +1,256 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - ImageIdentity.cpp
+
+Abstract:
+
+    - Identity of a mapped PE image: header signature and physical page of
+      every page shared between the processes mapping it.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <string.h>
+#include <vector>
+using namespace std;
+
+#include "Md5.h"
+#include "ImageIdentity.h"
+
+static
+VOID
+SetPages(
+    ULONG64 Base,
+    PIMAGE_IDENTITY_TRANSLATOR Translator,
+    PVOID Context,
+    PIMAGE_IDENTITY Identity,
+    ULONG64 Rva,
+    ULONG64 Size
+)
+{
+    ULONG64 Pa;
+
+    if (!Size) return;
+
+    for (ULONG64 Page = Rva / IMAGE_IDENTITY_PAGE_SIZE;
+         (Page < Identity->Pages.size()) && (Page <= ((Rva + Size - 1) / IMAGE_IDENTITY_PAGE_SIZE));
+         Page += 1)
+    {
+        if (!Translator(Context, Base + (Page * IMAGE_IDENTITY_PAGE_SIZE), &Pa)) Pa = IMAGE_CACHE_PAGE_INVALID;
+        Identity->Pages[(ULONG)Page] = Pa;
+    }
+}
+
+static
+VOID
+ClearPages(
+    PIMAGE_IDENTITY Identity,
+    ULONG64 Rva,
+    ULONG64 Size
+)
+{
+    if (!Size) return;
+
+    for (ULONG64 Page = Rva / IMAGE_IDENTITY_PAGE_SIZE;
+         (Page < Identity->Pages.size()) && (Page <= ((Rva + Size - 1) / IMAGE_IDENTITY_PAGE_SIZE));
+         Page += 1)
+    {
+        Identity->Pages[(ULONG)Page] = IMAGE_CACHE_PAGE_PRIVATE;
+    }
+}
+
+BOOLEAN
+GetImageIdentity(
+    ULONG64 Base,
+    PIMAGE_IDENTITY_READER Reader,
+    PIMAGE_IDENTITY_TRANSLATOR Translator,
+    PVOID Context,
+    PIMAGE_IDENTITY Identity
+)
+{
+    UCHAR Header[IMAGE_IDENTITY_PAGE_SIZE];
+    PIMAGE_DOS_HEADER DosHeader = (PIMAGE_DOS_HEADER)Header;
+    PIMAGE_NT_HEADERS32 NtHeader32;
+    PIMAGE_DATA_DIRECTORY DataDirectory;
+    PIMAGE_SECTION_HEADER Sections;
+    IMAGE_DEBUG_DIRECTORY DebugEntry;
+    CV_INFO_PDB70 CvInfo;
+    MD5_CONTEXT Md5Context = { 0 };
+
+    ULONG SizeOfHeaders;
+    ULONG NumberOfDirectories;
+    ULONG NumberOfSections;
+    ULONG NumberOfPages;
+    BOOLEAN Is64;
+
+    BOOLEAN Result = FALSE;
+
+    RtlZeroMemory(&Identity->Key, sizeof(Identity->Key));
+    Identity->Pages.clear();
+
+    if (!Base) goto CleanUp;
+
+    if (!Reader(Context, Base, Header, sizeof(Header))) goto CleanUp;
+
+    if (DosHeader->e_magic != IMAGE_DOS_SIGNATURE) goto CleanUp;
+    if ((DosHeader->e_lfanew <= 0) || ((ULONG)DosHeader->e_lfanew > (sizeof(Header) - sizeof(IMAGE_NT_HEADERS64)))) goto CleanUp;
+
+    NtHeader32 = (PIMAGE_NT_HEADERS32)(Header + DosHeader->e_lfanew);
+    if (NtHeader32->Signature != IMAGE_NT_SIGNATURE) goto CleanUp;
+
+    if (NtHeader32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC)
+    {
+        Is64 = FALSE;
+        Identity->Key.SizeOfImage = NtHeader32->OptionalHeader.SizeOfImage;
+        SizeOfHeaders = NtHeader32->OptionalHeader.SizeOfHeaders;
+        NumberOfDirectories = NtHeader32->OptionalHeader.NumberOfRvaAndSizes;
+        DataDirectory = NtHeader32->OptionalHeader.DataDirectory;
+    }
+    else if (NtHeader32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC)
+    {
+        PIMAGE_NT_HEADERS64 NtHeader64 = (PIMAGE_NT_HEADERS64)NtHeader32;
+
+        Is64 = TRUE;
+        Identity->Key.SizeOfImage = NtHeader64->OptionalHeader.SizeOfImage;
+        SizeOfHeaders = NtHeader64->OptionalHeader.SizeOfHeaders;
+        NumberOfDirectories = NtHeader64->OptionalHeader.NumberOfRvaAndSizes;
+        DataDirectory = NtHeader64->OptionalHeader.DataDirectory;
+    }
+    else
+    {
+        goto CleanUp;
+    }
+
+    NumberOfDirectories = min(NumberOfDirectories, (ULONG)IMAGE_NUMBEROF_DIRECTORY_ENTRIES);
+
+    if (!Identity->Key.SizeOfImage || (Identity->Key.SizeOfImage > IMAGE_CACHE_MAX_IMAGE_SIZE)) goto CleanUp;
+
+    Identity->Key.TimeDateStamp = NtHeader32->FileHeader.TimeDateStamp;
+
+    NumberOfSections = NtHeader32->FileHeader.NumberOfSections;
+    Sections = IMAGE_FIRST_SECTION(NtHeader32);
+    if ((PUCHAR)(Sections + NumberOfSections) > (Header + sizeof(Header))) goto CleanUp;
+
+    MD5Init(&Md5Context);
+    MD5Update(&Md5Context, Header, min(SizeOfHeaders, (ULONG)sizeof(Header)));
+    MD5Final(&Md5Context);
+    memcpy_s(Identity->Key.HeaderHash, sizeof(Identity->Key.HeaderHash), Md5Context.Digest, sizeof(Md5Context.Digest));
+
+    //
+    // PDB signature, same entry as PEFile::RtlGetPdbInfo().
+    //
+    if ((NumberOfDirectories > IMAGE_DIRECTORY_ENTRY_DEBUG) &&
+        DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG].VirtualAddress &&
+        (DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG].VirtualAddress < Identity->Key.SizeOfImage) &&
+        Reader(Context, Base + DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG].VirtualAddress, &DebugEntry, sizeof(DebugEntry)) &&
+        DebugEntry.AddressOfRawData && (DebugEntry.AddressOfRawData < Identity->Key.SizeOfImage) &&
+        Reader(Context, Base + DebugEntry.AddressOfRawData, &CvInfo, sizeof(CvInfo)) &&
+        (CvInfo.Signature == CV_SIGNATURE_RSDS))
+    {
+        Identity->Key.PdbGuid = CvInfo.Guid;
+        Identity->Key.PdbAge = CvInfo.Age;
+    }
+
+    //
+    // Physical pages of the headers and of the read-only sections. A private copy (copy-on-write
+    // after a patch) maps to different pages and will not match the cached shared copy.
+    //
+    NumberOfPages = (Identity->Key.SizeOfImage + IMAGE_IDENTITY_PAGE_SIZE - 1) / IMAGE_IDENTITY_PAGE_SIZE;
+    Identity->Pages.resize(NumberOfPages, IMAGE_CACHE_PAGE_PRIVATE);
+
+    SetPages(Base, Translator, Context, Identity, 0, SizeOfHeaders);
+
+    for (ULONG Index = 0; Index < NumberOfSections; Index += 1)
+    {
+        if (Sections[Index].Characteristics & IMAGE_SCN_MEM_WRITE) continue;
+
+        SetPages(Base, Translator, Context, Identity, Sections[Index].VirtualAddress,
+            max(Sections[Index].Misc.VirtualSize, Sections[Index].SizeOfRawData));
+    }
+
+    //
+    // The loader writes the import address table and the guard pointers of read-only sections
+    // in each process, the pages sharing them are private copies. Same ranges as the integrity
+    // check of ImageIntegrity::Compare().
+    //
+    if (NumberOfDirectories > IMAGE_DIRECTORY_ENTRY_IAT)
+    {
+        ClearPages(Identity, DataDirectory[IMAGE_DIRECTORY_ENTRY_IAT].VirtualAddress, DataDirectory[IMAGE_DIRECTORY_ENTRY_IAT].Size);
+    }
+
+    if ((NumberOfDirectories > IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG) && DataDirectory[IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG].VirtualAddress)
+    {
+        ULONG64 ConfigVa = Base + DataDirectory[IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG].VirtualAddress;
+        ULONG PtrSize = Is64 ? sizeof(ULONG64) : sizeof(ULONG);
+        ULONG Offsets[2];
+        ULONG ConfigSize;
+
+        Offsets[0] = Is64 ? LOAD_CONFIG64_GUARD_CHECK_OFFSET : LOAD_CONFIG32_GUARD_CHECK_OFFSET;
+        Offsets[1] = Is64 ? LOAD_CONFIG64_GUARD_DISPATCH_OFFSET : LOAD_CONFIG32_GUARD_DISPATCH_OFFSET;
+
+        if (Reader(Context, ConfigVa, &ConfigSize, sizeof(ConfigSize)))
+        {
+            for (ULONG i = 0; i < _countof(Offsets); i += 1)
+            {
+                ULONG64 Va = 0;
+
+                if ((Offsets[i] + PtrSize) > ConfigSize) continue;
+                if (!Reader(Context, ConfigVa + Offsets[i], &Va, PtrSize)) continue;
+
+                if ((Va > Base) && ((Va - Base) < Identity->Key.SizeOfImage)) ClearPages(Identity, Va - Base, PtrSize);
+            }
+        }
+    }
+
+    Result = TRUE;
+
+CleanUp:
+    return Result;
+}
+
+BOOLEAN
+HasPrivatePages(
+    PIMAGE_IDENTITY Identity,
+    ULONG Rva,
+    ULONG Size
+)
+{
+    if (!Size) return FALSE;
+
+    for (ULONG64 Page = Rva / IMAGE_IDENTITY_PAGE_SIZE;
+         (Page < Identity->Pages.size()) && (Page <= ((Rva + (ULONG64)Size - 1) / IMAGE_IDENTITY_PAGE_SIZE));
+         Page += 1)
+    {
+        if (Identity->Pages[(ULONG)Page] == IMAGE_CACHE_PAGE_PRIVATE) return TRUE;
+    }
+
+    return FALSE;
+}
@@ -0,0 +1,122 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - ImageIdentity.h
+
+Abstract:
+
+    - Identity of a mapped PE image: header signature and physical page of
+      every page shared between the processes mapping it.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __IMAGEIDENTITY_H__
+#define __IMAGEIDENTITY_H__
+
+#define CV_SIGNATURE_RSDS 'SDSR'
+
+typedef struct _CV_INFO_PDB70
+{
+    DWORD Signature;
+    GUID Guid; // unique identifier 
+    DWORD Age; // an always-incrementing value 
+    CHAR PdbFileName[1]; // zero terminated string with the name of the PDB file 
+} CV_INFO_PDB70, *PCV_INFO_PDB70;
+
+#define IMAGE_CACHE_MAX_IMAGE_SIZE (256 * 1024 * 1024)
+
+#define IMAGE_IDENTITY_PAGE_SIZE 0x1000
+
+#define IMAGE_CACHE_PAGE_INVALID (~0ULL)
+#define IMAGE_CACHE_PAGE_PRIVATE 0ULL // Not compared.
+
+//
+// IMAGE_LOAD_CONFIG_DIRECTORY32/64, GuardCFCheckFunctionPointer and GuardCFDispatchFunctionPointer.
+//
+#define LOAD_CONFIG32_GUARD_CHECK_OFFSET 0x48
+#define LOAD_CONFIG32_GUARD_DISPATCH_OFFSET 0x4C
+#define LOAD_CONFIG64_GUARD_CHECK_OFFSET 0x70
+#define LOAD_CONFIG64_GUARD_DISPATCH_OFFSET 0x78
+
+typedef struct _IMAGE_CACHE_KEY {
+    ULONG TimeDateStamp;
+    ULONG SizeOfImage;
+    GUID PdbGuid;
+    ULONG PdbAge;
+    UCHAR HeaderHash[16]; // MD5 of the headers.
+
+    bool operator<(const _IMAGE_CACHE_KEY& other) const
+    {
+        return memcmp(this, &other, sizeof(*this)) < 0;
+    }
+} IMAGE_CACHE_KEY, *PIMAGE_CACHE_KEY;
+
+typedef struct _IMAGE_IDENTITY {
+    IMAGE_CACHE_KEY Key;
+
+    //
+    // Physical address of each page of the image, IMAGE_CACHE_PAGE_INVALID for pages that
+    // are not resident. Pages every process writes to its own copy are not compared and left
+    // to IMAGE_CACHE_PAGE_PRIVATE: writable sections, and the read-only pages the loader
+    // patches (import address table, control flow guard pointers).
+    //
+    vector<ULONG64> Pages;
+} IMAGE_IDENTITY, *PIMAGE_IDENTITY;
+
+//
+// Returns TRUE if Size bytes at Address have been read into Buffer.
+//
+typedef BOOLEAN (*PIMAGE_IDENTITY_READER)(PVOID Context, ULONG64 Address, PVOID Buffer, ULONG Size);
+
+//
+// Returns TRUE and the physical address of the page at Address if it is resident.
+//
+typedef BOOLEAN (*PIMAGE_IDENTITY_TRANSLATOR)(PVOID Context, ULONG64 Address, PULONG64 PhysicalAddress);
+
+BOOLEAN
+GetImageIdentity(
+    ULONG64 Base,
+    PIMAGE_IDENTITY_READER Reader,
+    PIMAGE_IDENTITY_TRANSLATOR Translator,
+    PVOID Context,
+    PIMAGE_IDENTITY Identity
+);
+
+//
+// TRUE if one of the pages of the Size bytes at Rva is not compared by the identity.
+//
+BOOLEAN
+HasPrivatePages(
+    PIMAGE_IDENTITY Identity,
+    ULONG Rva,
+    ULONG Size
+);
+
+#endif
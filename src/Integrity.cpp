@@ -0,0 +1,503 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - Integrity.cpp
+
+Abstract:
+
+    - The reference file is mapped and laid out like the loader does (headers,
+      then each section at its virtual address), relocated to the base of the
+      loaded image, and compared page by page with what is in memory.
+    - Writable and discardable sections, and the slots the loader writes into
+      read-only sections (IAT, CFG check/dispatch pointers), are not compared.
+    - The target is only read through the routine given to Capture(), the
+      modules are captured and compared by CheckImagesIntegrity() (Drivers.cpp).
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <intrin.h>
+#include <string.h>
+#include <functional>
+#include <vector>
+using namespace std;
+
+#include "ImageIdentity.h"
+#include "Integrity.h"
+
+ImageIntegrity::ImageIntegrity(
+) :
+    m_Status(IntegrityNotChecked),
+    m_ImageBase(0ULL),
+    m_NumberOfPages(0),
+    m_NumberOfIdenticalPages(0),
+    m_NumberOfNonResidentPages(0),
+    m_Truncated(FALSE),
+    m_File(INVALID_HANDLE_VALUE),
+    m_Mapping(NULL),
+    m_View(NULL),
+    m_FileSize(0ULL),
+    m_DataDirectory(NULL),
+    m_NumberOfDirectories(0),
+    m_Sections(NULL),
+    m_NumberOfSections(0),
+    m_SizeOfImage(0),
+    m_SizeOfHeaders(0),
+    m_TimeDateStamp(0),
+    m_PreferredBase(0ULL),
+    m_Is64(FALSE)
+{
+    m_ReferencePath[0] = L'\0';
+}
+
+ImageIntegrity::~ImageIntegrity(
+)
+{
+    Close();
+}
+
+VOID
+ImageIntegrity::Close(
+)
+{
+    if (m_View) UnmapViewOfFile(m_View);
+    if (m_Mapping) CloseHandle(m_Mapping);
+    if (m_File != INVALID_HANDLE_VALUE) CloseHandle(m_File);
+
+    m_View = NULL;
+    m_Mapping = NULL;
+    m_File = INVALID_HANDLE_VALUE;
+
+    m_DataDirectory = NULL;
+    m_Sections = NULL;
+
+    //
+    // Results are kept, the captured pages are not needed anymore.
+    //
+    vector<UCHAR>().swap(m_Memory);
+    vector<BOOLEAN>().swap(m_Resident);
+    vector<pair<ULONG, ULONG>>().swap(m_Excluded);
+}
+
+BOOLEAN
+ImageIntegrity::ParseReference(
+)
+{
+    PIMAGE_DOS_HEADER DosHeader = (PIMAGE_DOS_HEADER)m_View;
+    PIMAGE_NT_HEADERS32 NtHeader32;
+    PIMAGE_NT_HEADERS64 NtHeader64;
+    ULONG64 SectionsEnd;
+
+    if (m_FileSize < sizeof(IMAGE_DOS_HEADER)) return FALSE;
+    if (DosHeader->e_magic != IMAGE_DOS_SIGNATURE) return FALSE;
+    if ((DosHeader->e_lfanew <= 0) || (((ULONG64)DosHeader->e_lfanew + sizeof(IMAGE_NT_HEADERS64)) > m_FileSize)) return FALSE;
+
+    NtHeader32 = (PIMAGE_NT_HEADERS32)(m_View + DosHeader->e_lfanew);
+    NtHeader64 = (PIMAGE_NT_HEADERS64)NtHeader32;
+    if (NtHeader32->Signature != IMAGE_NT_SIGNATURE) return FALSE;
+
+    if (NtHeader32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC)
+    {
+        m_Is64 = FALSE;
+        m_PreferredBase = NtHeader32->OptionalHeader.ImageBase;
+        m_SizeOfImage = NtHeader32->OptionalHeader.SizeOfImage;
+        m_SizeOfHeaders = NtHeader32->OptionalHeader.SizeOfHeaders;
+        m_DataDirectory = NtHeader32->OptionalHeader.DataDirectory;
+        m_NumberOfDirectories = min(NtHeader32->OptionalHeader.NumberOfRvaAndSizes, (ULONG)IMAGE_NUMBEROF_DIRECTORY_ENTRIES);
+    }
+    else if (NtHeader32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC)
+    {
+        m_Is64 = TRUE;
+        m_PreferredBase = NtHeader64->OptionalHeader.ImageBase;
+        m_SizeOfImage = NtHeader64->OptionalHeader.SizeOfImage;
+        m_SizeOfHeaders = NtHeader64->OptionalHeader.SizeOfHeaders;
+        m_DataDirectory = NtHeader64->OptionalHeader.DataDirectory;
+        m_NumberOfDirectories = min(NtHeader64->OptionalHeader.NumberOfRvaAndSizes, (ULONG)IMAGE_NUMBEROF_DIRECTORY_ENTRIES);
+    }
+    else
+    {
+        return FALSE;
+    }
+
+    m_TimeDateStamp = NtHeader32->FileHeader.TimeDateStamp;
+    m_NumberOfSections = NtHeader32->FileHeader.NumberOfSections;
+    m_Sections = (PIMAGE_SECTION_HEADER)((PUCHAR)&NtHeader32->OptionalHeader + NtHeader32->FileHeader.SizeOfOptionalHeader);
+
+    SectionsEnd = ((PUCHAR)m_Sections - m_View) + ((ULONG64)m_NumberOfSections * sizeof(IMAGE_SECTION_HEADER));
+    if (SectionsEnd > m_FileSize) return FALSE;
+
+    if (!m_SizeOfImage || (m_SizeOfImage > IMAGE_CACHE_MAX_IMAGE_SIZE)) return FALSE;
+
+    return TRUE;
+}
+
+BOOLEAN
+ImageIntegrity::IsCompared(
+    PIMAGE_SECTION_HEADER Section
+)
+{
+    //
+    // Writable sections change at run time, discardable ones (INIT) are freed after load.
+    //
+    if (Section->Characteristics & (IMAGE_SCN_MEM_WRITE | IMAGE_SCN_MEM_DISCARDABLE)) return FALSE;
+    if (!Section->SizeOfRawData || !Section->VirtualAddress) return FALSE;
+
+    return ((ULONG64)Section->VirtualAddress + Section->SizeOfRawData <= m_SizeOfImage) ? TRUE : FALSE;
+}
+
+VOID
+ImageIntegrity::ExcludeRange(
+    ULONG64 Rva,
+    ULONG Size
+)
+{
+    if (!Size || ((Rva + Size) > m_SizeOfImage)) return;
+
+    m_Excluded.push_back(make_pair((ULONG)Rva, Size));
+}
+
+BOOLEAN
+ImageIntegrity::Capture(
+    ULONG64 ImageBase,
+    LPCWSTR ReferencePath,
+    const READ_ROUTINE& Reader
+)
+{
+    LARGE_INTEGER FileSize;
+    IMAGE_DOS_HEADER DosHeader;
+    IMAGE_NT_HEADERS32 NtHeader;
+    HOLE_ROUTINE NoHole = [](ULONG, ULONG) {};
+
+    m_ImageBase = ImageBase;
+    wcscpy_s(m_ReferencePath, _countof(m_ReferencePath), ReferencePath);
+
+    m_File = CreateFileW(ReferencePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_File == INVALID_HANDLE_VALUE)
+    {
+        m_Status = IntegrityNoReference;
+        goto CleanUp;
+    }
+
+    m_Status = IntegrityInvalidReference;
+
+    if (!GetFileSizeEx(m_File, &FileSize) || !FileSize.QuadPart) goto CleanUp;
+    m_FileSize = FileSize.QuadPart;
+
+    m_Mapping = CreateFileMappingW(m_File, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m_Mapping == NULL) goto CleanUp;
+
+    m_View = (PUCHAR)MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0);
+    if (m_View == NULL) goto CleanUp;
+
+    if (!ParseReference()) goto CleanUp;
+
+    //
+    // Headers of the loaded image are only used to catch a different build, they
+    // are sometimes wiped from memory.
+    //
+    if ((Reader(ImageBase, (PUCHAR)&DosHeader, sizeof(DosHeader), NoHole) == 0) &&
+        (DosHeader.e_magic == IMAGE_DOS_SIGNATURE) &&
+        (Reader(ImageBase + DosHeader.e_lfanew, (PUCHAR)&NtHeader, sizeof(NtHeader), NoHole) == 0) &&
+        (NtHeader.Signature == IMAGE_NT_SIGNATURE))
+    {
+        //
+        // SizeOfImage is at the same offset in both optional headers.
+        //
+        if ((NtHeader.FileHeader.TimeDateStamp != m_TimeDateStamp) || (NtHeader.OptionalHeader.SizeOfImage != m_SizeOfImage))
+        {
+            m_Status = IntegrityVersionMismatch;
+            goto CleanUp;
+        }
+    }
+
+    m_Memory.assign(m_SizeOfImage, 0);
+    m_Resident.assign((m_SizeOfImage + INTEGRITY_PAGE_SIZE - 1) / INTEGRITY_PAGE_SIZE, FALSE);
+
+    for (ULONG i = 0; i < m_NumberOfSections; i += 1)
+    {
+        PIMAGE_SECTION_HEADER Section = &m_Sections[i];
+        ULONG First, Last;
+
+        if (!IsCompared(Section)) continue;
+
+        First = Section->VirtualAddress / INTEGRITY_PAGE_SIZE;
+        Last = (Section->VirtualAddress + Section->SizeOfRawData - 1) / INTEGRITY_PAGE_SIZE;
+
+        for (ULONG Page = First; Page <= Last; Page += 1) m_Resident[Page] = TRUE;
+
+        Reader(ImageBase + Section->VirtualAddress,
+               &m_Memory[Section->VirtualAddress],
+               Section->SizeOfRawData,
+               [this, Section](ULONG Offset, ULONG Size)
+        {
+            UNREFERENCED_PARAMETER(Size);
+
+            m_Resident[(Section->VirtualAddress + Offset) / INTEGRITY_PAGE_SIZE] = FALSE;
+        });
+    }
+
+    m_Status = IntegrityNotChecked;
+
+    return TRUE;
+
+CleanUp:
+    Close();
+
+    return FALSE;
+}
+
+VOID
+ImageIntegrity::Relocate(
+    PUCHAR Image
+)
+{
+    ULONG64 Delta = m_ImageBase - m_PreferredBase;
+    ULONG Rva, End;
+
+    if (!Delta || (m_NumberOfDirectories <= IMAGE_DIRECTORY_ENTRY_BASERELOC)) return;
+
+    Rva = m_DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC].VirtualAddress;
+    End = Rva + m_DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC].Size;
+    if (!Rva || (End < Rva) || (End > m_SizeOfImage)) return;
+
+    while ((Rva + sizeof(IMAGE_BASE_RELOCATION)) <= End)
+    {
+        PIMAGE_BASE_RELOCATION Block = (PIMAGE_BASE_RELOCATION)(Image + Rva);
+        PUSHORT Entries = (PUSHORT)(Block + 1);
+        ULONG Count;
+
+        if ((Block->SizeOfBlock < sizeof(IMAGE_BASE_RELOCATION)) || (Block->SizeOfBlock > (End - Rva))) break;
+
+        Count = (Block->SizeOfBlock - sizeof(IMAGE_BASE_RELOCATION)) / sizeof(USHORT);
+
+        for (ULONG i = 0; i < Count; i += 1)
+        {
+            ULONG64 Target = (ULONG64)Block->VirtualAddress + (Entries[i] & 0xFFF);
+
+            switch (Entries[i] >> 12)
+            {
+                case IMAGE_REL_BASED_HIGHLOW:
+                    if ((Target + sizeof(ULONG)) <= m_SizeOfImage) *(PULONG)(Image + Target) += (ULONG)Delta;
+                break;
+                case IMAGE_REL_BASED_DIR64:
+                    if ((Target + sizeof(ULONG64)) <= m_SizeOfImage) *(PULONG64)(Image + Target) += Delta;
+                break;
+                case IMAGE_REL_BASED_HIGH:
+                    if ((Target + sizeof(USHORT)) <= m_SizeOfImage) *(PUSHORT)(Image + Target) += (USHORT)(Delta >> 16);
+                break;
+                case IMAGE_REL_BASED_LOW:
+                    if ((Target + sizeof(USHORT)) <= m_SizeOfImage) *(PUSHORT)(Image + Target) += (USHORT)Delta;
+                break;
+                default:
+                    // IMAGE_REL_BASED_ABSOLUTE is padding.
+                break;
+            }
+        }
+
+        Rva += Block->SizeOfBlock;
+    }
+}
+
+VOID
+ImageIntegrity::AddDifference(
+    ULONG Rva,
+    PIMAGE_SECTION_HEADER Section,
+    PUCHAR Image
+)
+{
+    PINTEGRITY_PATCH Last = m_Patches.size() ? &m_Patches.back() : NULL;
+
+    if (Last && ((Last->Rva + Last->Size + INTEGRITY_PATCH_GAP) >= Rva))
+    {
+        Last->Size = (Rva + 1) - Last->Rva;
+        return;
+    }
+
+    if (m_Patches.size() >= INTEGRITY_MAX_PATCHES)
+    {
+        m_Truncated = TRUE;
+        return;
+    }
+
+    INTEGRITY_PATCH Patch = { 0 };
+    ULONG Available = min((ULONG)INTEGRITY_PATCH_BYTES, m_SizeOfImage - Rva);
+
+    Patch.Rva = Rva;
+    Patch.Size = 1;
+    memcpy(Patch.Section, Section->Name, IMAGE_SIZEOF_SHORT_NAME);
+    memcpy(Patch.Memory, &m_Memory[Rva], Available);
+    memcpy(Patch.Reference, Image + Rva, Available);
+
+    m_Patches.push_back(Patch);
+}
+
+VOID
+ImageIntegrity::Compare(
+)
+{
+    vector<UCHAR> Image;
+    ULONG HeadersSize;
+
+    if (!m_View || m_Memory.empty()) return;
+
+    //
+    // Results and excluded ranges are the ones of this comparison only.
+    //
+    m_Excluded.clear();
+    m_Patches.clear();
+    m_Truncated = FALSE;
+    m_NumberOfPages = 0;
+    m_NumberOfIdenticalPages = 0;
+    m_NumberOfNonResidentPages = 0;
+
+    //
+    // Same layout as the loader: headers, then the raw data of each section.
+    //
+    Image.assign(m_SizeOfImage, 0);
+
+    HeadersSize = (ULONG)min((ULONG64)min(m_SizeOfHeaders, m_SizeOfImage), m_FileSize);
+    memcpy(&Image[0], m_View, HeadersSize);
+
+    for (ULONG i = 0; i < m_NumberOfSections; i += 1)
+    {
+        PIMAGE_SECTION_HEADER Section = &m_Sections[i];
+        ULONG64 RawEnd = (ULONG64)Section->PointerToRawData + Section->SizeOfRawData;
+        ULONG Size = Section->SizeOfRawData;
+
+        if (!Section->VirtualAddress || (Section->VirtualAddress >= m_SizeOfImage)) continue;
+        if (RawEnd > m_FileSize) Size = (Section->PointerToRawData < m_FileSize) ? (ULONG)(m_FileSize - Section->PointerToRawData) : 0;
+        Size = min(Size, m_SizeOfImage - Section->VirtualAddress);
+
+        if (Size) memcpy(&Image[Section->VirtualAddress], m_View + Section->PointerToRawData, Size);
+    }
+
+    Relocate(Image.data());
+
+    //
+    // Slots written by the loader in read-only sections are taken from memory.
+    //
+    if (m_NumberOfDirectories > IMAGE_DIRECTORY_ENTRY_IAT)
+    {
+        ExcludeRange(m_DataDirectory[IMAGE_DIRECTORY_ENTRY_IAT].VirtualAddress, m_DataDirectory[IMAGE_DIRECTORY_ENTRY_IAT].Size);
+    }
+
+    if (m_NumberOfDirectories > IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG)
+    {
+        ULONG ConfigRva = m_DataDirectory[IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG].VirtualAddress;
+        ULONG PtrSize = m_Is64 ? sizeof(ULONG64) : sizeof(ULONG);
+        ULONG Offsets[2];
+
+        Offsets[0] = m_Is64 ? LOAD_CONFIG64_GUARD_CHECK_OFFSET : LOAD_CONFIG32_GUARD_CHECK_OFFSET;
+        Offsets[1] = m_Is64 ? LOAD_CONFIG64_GUARD_DISPATCH_OFFSET : LOAD_CONFIG32_GUARD_DISPATCH_OFFSET;
+
+        if (ConfigRva && (((ULONG64)ConfigRva + sizeof(ULONG)) <= m_SizeOfImage))
+        {
+            ULONG ConfigSize = *(PULONG)&Image[ConfigRva];
+
+            for (ULONG i = 0; i < _countof(Offsets); i += 1)
+            {
+                ULONG64 Va = 0;
+
+                if ((Offsets[i] + PtrSize > ConfigSize) || (((ULONG64)ConfigRva + Offsets[i] + PtrSize) > m_SizeOfImage)) continue;
+
+                memcpy(&Va, &Image[ConfigRva + Offsets[i]], PtrSize);
+                if (Va > m_ImageBase) ExcludeRange(Va - m_ImageBase, PtrSize);
+            }
+        }
+    }
+
+    for (pair<ULONG, ULONG>& Range : m_Excluded)
+    {
+        memcpy(&Image[Range.first], &m_Memory[Range.first], Range.second);
+    }
+
+    for (ULONG i = 0; i < m_NumberOfSections; i += 1)
+    {
+        PIMAGE_SECTION_HEADER Section = &m_Sections[i];
+        ULONG End;
+
+        if (!IsCompared(Section)) continue;
+
+        End = Section->VirtualAddress + Section->SizeOfRawData;
+
+        for (ULONG Start = Section->VirtualAddress; Start < End; )
+        {
+            ULONG PageEnd = min((Start & ~(INTEGRITY_PAGE_SIZE - 1)) + INTEGRITY_PAGE_SIZE, End);
+            PUCHAR Memory = &m_Memory[Start];
+            PUCHAR Reference = &Image[Start];
+            ULONG Size = PageEnd - Start;
+
+            if (!m_Resident[Start / INTEGRITY_PAGE_SIZE])
+            {
+                m_NumberOfNonResidentPages += 1;
+                Start = PageEnd;
+                continue;
+            }
+
+            m_NumberOfPages += 1;
+
+            if (memcmp(Memory, Reference, Size) == 0)
+            {
+                m_NumberOfIdenticalPages += 1;
+                Start = PageEnd;
+                continue;
+            }
+
+            //
+            // 16 bytes at a time, each bit of the mask is a differing byte.
+            //
+            ULONG Offset = 0;
+
+            for (; (Offset + 16) <= Size; Offset += 16)
+            {
+                __m128i m = _mm_loadu_si128((const __m128i *)(Memory + Offset));
+                __m128i r = _mm_loadu_si128((const __m128i *)(Reference + Offset));
+                ULONG Mask = (~_mm_movemask_epi8(_mm_cmpeq_epi8(m, r))) & 0xFFFF;
+
+                while (Mask)
+                {
+                    ULONG Bit;
+
+                    _BitScanForward(&Bit, Mask);
+                    AddDifference(Start + Offset + Bit, Section, Image.data());
+                    Mask &= Mask - 1;
+                }
+            }
+
+            for (; Offset < Size; Offset += 1)
+            {
+                if (Memory[Offset] != Reference[Offset]) AddDifference(Start + Offset, Section, Image.data());
+            }
+
+            Start = PageEnd;
+        }
+    }
+
+    m_Status = m_Patches.size() ? IntegrityPatched : IntegrityClean;
+}
@@ -0,0 +1,192 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - Integrity.h
+
+Abstract:
+
+    - Compares the read-only sections of a loaded image with a clean copy
+      of its file, after applying the base relocations to the file.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __INTEGRITY_H__
+#define __INTEGRITY_H__
+
+//
+// Upper bound of captured module bytes kept in memory by CheckImagesIntegrity() at once.
+//
+#define INTEGRITY_BATCH_MAX_SIZE (256 * 1024 * 1024)
+
+#define INTEGRITY_MAX_PATCHES 256 // Per image, a wrong reference file would report everything.
+#define INTEGRITY_PATCH_GAP 4 // Differences closer than this are reported as one range.
+#define INTEGRITY_PATCH_BYTES 16 // Bytes kept from both sides for display.
+#define INTEGRITY_PAGE_SIZE 0x1000
+
+typedef enum _INTEGRITY_STATUS {
+    IntegrityNotChecked = 0,
+    IntegrityClean = 1,
+    IntegrityPatched = 2,
+    IntegrityNoReference = 3, // No such file in the reference directory.
+    IntegrityInvalidReference = 4, // Not a PE file, or truncated.
+    IntegrityVersionMismatch = 5, // TimeDateStamp or SizeOfImage differ.
+    IntegrityFailed = 6 // Compare() threw (out of memory).
+} INTEGRITY_STATUS;
+
+typedef struct _INTEGRITY_PATCH {
+    ULONG Rva;
+    ULONG Size;
+    CHAR Section[IMAGE_SIZEOF_SHORT_NAME + 1];
+
+    UCHAR Memory[INTEGRITY_PATCH_BYTES];
+    UCHAR Reference[INTEGRITY_PATCH_BYTES];
+} INTEGRITY_PATCH, *PINTEGRITY_PATCH;
+
+class ImageIntegrity {
+public:
+    //
+    // Same contract as ReadVirtualPages(): unreadable pages are zero-filled and reported
+    // to Hole, the number of such pages is returned.
+    //
+    typedef function<VOID(ULONG Offset, ULONG Size)> HOLE_ROUTINE;
+    typedef function<ULONG(ULONG64 Address, PUCHAR Buffer, ULONG Size, const HOLE_ROUTINE& Hole)> READ_ROUTINE;
+
+    ImageIntegrity(
+    );
+
+    ~ImageIntegrity(
+    );
+
+    ImageIntegrity(const ImageIntegrity&) = delete;
+    ImageIntegrity& operator=(const ImageIntegrity&) = delete;
+
+    //
+    // Engine thread: maps the reference file and reads the pages of the compared sections.
+    //
+    BOOLEAN
+    Capture(
+        ULONG64 ImageBase,
+        LPCWSTR ReferencePath,
+        const READ_ROUTINE& Reader
+    );
+
+    //
+    // Any thread: rebuilds the relocated image from the file and compares it.
+    //
+    VOID
+    Compare(
+    );
+
+    VOID
+    Close(
+    );
+
+    ULONG
+    GetCapturedSize(
+    )
+    {
+        return (ULONG)m_Memory.size();
+    }
+
+    INTEGRITY_STATUS m_Status;
+    WCHAR m_ReferencePath[MAX_PATH];
+    ULONG64 m_ImageBase;
+
+    ULONG m_NumberOfPages; // Compared.
+    ULONG m_NumberOfIdenticalPages;
+    ULONG m_NumberOfNonResidentPages;
+    BOOLEAN m_Truncated; // More than INTEGRITY_MAX_PATCHES.
+
+    vector<INTEGRITY_PATCH> m_Patches;
+
+private:
+    BOOLEAN
+    ParseReference(
+    );
+
+    BOOLEAN
+    IsCompared(
+        PIMAGE_SECTION_HEADER Section
+    );
+
+    VOID
+    ExcludeRange(
+        ULONG64 Rva,
+        ULONG Size
+    );
+
+    VOID
+    Relocate(
+        PUCHAR Image
+    );
+
+    VOID
+    AddDifference(
+        ULONG Rva,
+        PIMAGE_SECTION_HEADER Section,
+        PUCHAR Image
+    );
+
+    HANDLE m_File;
+    HANDLE m_Mapping;
+    PUCHAR m_View;
+    ULONG64 m_FileSize;
+
+    //
+    // Reference headers, inside m_View.
+    //
+    PIMAGE_DATA_DIRECTORY m_DataDirectory;
+    ULONG m_NumberOfDirectories;
+    PIMAGE_SECTION_HEADER m_Sections;
+    ULONG m_NumberOfSections;
+    ULONG m_SizeOfImage;
+    ULONG m_SizeOfHeaders;
+    ULONG m_TimeDateStamp;
+    ULONG64 m_PreferredBase;
+    BOOLEAN m_Is64;
+
+    vector<UCHAR> m_Memory; // Loaded image, only compared sections are read.
+    vector<BOOLEAN> m_Resident; // Per page.
+    vector<pair<ULONG, ULONG>> m_Excluded; // (Rva, Size) written by the loader, set by Compare().
+};
+
+class MsDllObject;
+
+//
+// Checks[i] receives the result for Modules[i], reference files are looked up by base name.
+// In Drivers.cpp, next to GetKernelModules().
+//
+VOID
+CheckImagesIntegrity(
+    vector<MsDllObject>& Modules,
+    LPCWSTR ReferenceDirectory,
+    vector<ImageIntegrity>& Checks
+);
+
+#endif
@@ -0,0 +1,449 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - MalRules.cpp
+
+Abstract:
+
+    - Rule file parser, and the binary form of the rules stored next to the
+      compiled automaton in the rule cache.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <vector>
+#include <string>
+using namespace std;
+
+#include "MalRules.h"
+
+#define RULE_FILE_SIGNATURE 0x4C524D4D // "MMRL"
+#define RULE_FILE_VERSION 1
+
+static
+LPSTR
+SkipSpaces(
+    LPSTR String
+)
+{
+    while (isspace((UCHAR)*String)) String += 1;
+
+    return String;
+}
+
+static
+BOOLEAN
+IsEndOfLine(
+    LPSTR String
+)
+{
+    String = SkipSpaces(String);
+
+    return (*String == '\0') || (*String == '#');
+}
+
+static
+LONG
+HexDigit(
+    CHAR c
+)
+{
+    if ((c >= '0') && (c <= '9')) return c - '0';
+    if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+    if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+
+    return -1;
+}
+
+//
+// "6a 30 ?? 648b", spaces between bytes are optional.
+//
+static
+LPCSTR
+ParseHexString(
+    LPSTR String,
+    vector<UCHAR>& Bytes,
+    vector<UCHAR>& Mask
+)
+{
+    BOOLEAN Significant = FALSE;
+
+    for (String = SkipSpaces(String); !IsEndOfLine(String); String = SkipSpaces(String))
+    {
+        if ((String[0] == '?') && (String[1] == '?'))
+        {
+            Bytes.push_back(0);
+            Mask.push_back(0);
+        }
+        else if ((HexDigit(String[0]) >= 0) && (HexDigit(String[1]) >= 0))
+        {
+            Bytes.push_back((UCHAR)((HexDigit(String[0]) << 4) | HexDigit(String[1])));
+            Mask.push_back(0xFF);
+            Significant = TRUE;
+        }
+        else
+        {
+            return "invalid hex byte";
+        }
+
+        String += 2;
+    }
+
+    if (!Significant) return "hex string without significant byte";
+
+    return NULL;
+}
+
+//
+// Quoted string with escapes, Wide widens every byte to UTF-16LE.
+//
+static
+LPCSTR
+ParseQuotedString(
+    LPSTR String,
+    BOOLEAN Wide,
+    vector<UCHAR>& Bytes,
+    vector<UCHAR>& Mask
+)
+{
+    String = SkipSpaces(String);
+    if (*String++ != '"') return "string must be quoted";
+
+    while (*String != '"')
+    {
+        UCHAR c = *String++;
+
+        if (c == '\0') return "unterminated string";
+
+        if (c == '\\')
+        {
+            c = *String++;
+
+            switch (c)
+            {
+                case '\\': case '"': break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case 'n': c = '\n'; break;
+                case 'x':
+                    if ((HexDigit(String[0]) < 0) || (HexDigit(String[1]) < 0)) return "invalid \\x escape";
+
+                    c = (UCHAR)((HexDigit(String[0]) << 4) | HexDigit(String[1]));
+                    String += 2;
+                    break;
+                default:
+                    return "invalid escape";
+            }
+        }
+
+        Bytes.push_back(c);
+        Mask.push_back(0xFF);
+
+        if (Wide)
+        {
+            Bytes.push_back(0);
+            Mask.push_back(0xFF);
+        }
+    }
+
+    if (!IsEndOfLine(String + 1)) return "unexpected text after the string";
+    if (Bytes.empty()) return "empty string";
+
+    return NULL;
+}
+
+//
+// Condition is 0 for "all" until the strings of the rule are known.
+//
+static
+LPCSTR
+EndRule(
+    MalScoreRules::PRULE Rule
+)
+{
+    if (!Rule->NumberOfStrings) return "rule without string";
+
+    if (Rule->Condition == 0) Rule->Condition = Rule->NumberOfStrings;
+    if (Rule->Condition > Rule->NumberOfStrings) return "condition needs more strings than the rule has";
+
+    return NULL;
+}
+
+BOOLEAN
+MalScoreRules::Parse(
+    LPCSTR FileName,
+    LPSTR Error,
+    ULONG ErrorSize
+)
+{
+    FILE *File = NULL;
+    CHAR Line[4096];
+    ULONG LineNumber = 0;
+    LPCSTR Reason = NULL;
+    PRULE Rule = NULL;
+
+    Clear();
+    if (ErrorSize) Error[0] = '\0';
+
+    if (fopen_s(&File, FileName, "r") || (File == NULL))
+    {
+        sprintf_s(Error, ErrorSize, "cannot open %s", FileName);
+        return FALSE;
+    }
+
+    while (fgets(Line, sizeof(Line), File))
+    {
+        LPSTR Keyword, Arguments;
+
+        LineNumber += 1;
+
+        Line[strcspn(Line, "\r\n")] = '\0';
+
+        Keyword = SkipSpaces(Line);
+        if (IsEndOfLine(Keyword)) continue;
+
+        for (Arguments = Keyword; *Arguments && !isspace((UCHAR)*Arguments); Arguments += 1);
+        if (*Arguments) *Arguments++ = '\0';
+
+        if (strcmp(Keyword, "rule") == 0)
+        {
+            RULE NewRule;
+            LPSTR Name = SkipSpaces(Arguments);
+            LPSTR End = Name;
+
+            if (Rule && ((Reason = EndRule(Rule)) != NULL)) goto CleanUp;
+
+            while (*End && !isspace((UCHAR)*End) && (*End != '#')) End += 1;
+
+            if ((End == Name) || !IsEndOfLine(End)) { Reason = "rule name expected"; goto CleanUp; }
+            if ((End - Name) > RULE_MAX_NAME_LENGTH) { Reason = "rule name too long"; goto CleanUp; }
+
+            NewRule.Name.assign(Name, End - Name);
+            NewRule.Weight = RULE_DEFAULT_WEIGHT;
+            NewRule.Condition = 1;
+            NewRule.FirstString = (ULONG)m_Strings.size();
+            NewRule.NumberOfStrings = 0;
+
+            m_Rules.push_back(NewRule);
+            Rule = &m_Rules.back();
+            continue;
+        }
+
+        if (Rule == NULL) { Reason = "directive outside of a rule"; goto CleanUp; }
+
+        if (strcmp(Keyword, "weight") == 0)
+        {
+            LPSTR Value = SkipSpaces(Arguments);
+            LPSTR End = Value;
+
+            if (isdigit((UCHAR)*Value)) Rule->Weight = strtoul(Value, &End, 0);
+
+            if ((End == Value) || !IsEndOfLine(End)) { Reason = "invalid weight"; goto CleanUp; }
+            continue;
+        }
+
+        if (strcmp(Keyword, "condition") == 0)
+        {
+            LPSTR Value = SkipSpaces(Arguments);
+            LPSTR End = Value;
+
+            if (strncmp(Value, "any", 3) == 0)
+            {
+                Rule->Condition = 1;
+                End = Value + 3;
+            }
+            else if (strncmp(Value, "all", 3) == 0)
+            {
+                Rule->Condition = 0;
+                End = Value + 3;
+            }
+            else if (isdigit((UCHAR)*Value))
+            {
+                Rule->Condition = strtoul(Value, &End, 0);
+                if (Rule->Condition == 0) End = Value;
+            }
+
+            if ((End == Value) || !IsEndOfLine(End)) { Reason = "invalid condition"; goto CleanUp; }
+            continue;
+        }
+
+        if ((strcmp(Keyword, "hex") == 0) || (strcmp(Keyword, "ascii") == 0) || (strcmp(Keyword, "wide") == 0))
+        {
+            RULE_STRING String;
+
+            if (Rule->NumberOfStrings == RULE_MAX_STRINGS) { Reason = "too many strings in the rule"; goto CleanUp; }
+
+            if (Keyword[0] == 'h') Reason = ParseHexString(Arguments, String.Bytes, String.Mask);
+            else Reason = ParseQuotedString(Arguments, Keyword[0] == 'w', String.Bytes, String.Mask);
+
+            if (Reason) goto CleanUp;
+            if (String.Bytes.size() > RULE_MAX_STRING_LENGTH) { Reason = "string too long"; goto CleanUp; }
+
+            String.Rule = (ULONG)(m_Rules.size() - 1);
+            m_Strings.push_back(String);
+            Rule->NumberOfStrings += 1;
+            continue;
+        }
+
+        Reason = "unknown directive";
+        goto CleanUp;
+    }
+
+    if (Rule) Reason = EndRule(Rule);
+
+CleanUp:
+    fclose(File);
+
+    if (Reason)
+    {
+        sprintf_s(Error, ErrorSize, "%s(%d): %s", FileName, LineNumber, Reason);
+        Clear();
+
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+MalScoreRules::Save(
+    FILE *File
+) const
+{
+    ULONG Header[4] = { RULE_FILE_SIGNATURE, RULE_FILE_VERSION, (ULONG)m_Rules.size(), (ULONG)m_Strings.size() };
+
+    if (fwrite(Header, sizeof(Header), 1, File) != 1) return FALSE;
+
+    for (const RULE& Rule : m_Rules)
+    {
+        ULONG Fields[5] = { (ULONG)Rule.Name.size(), Rule.Weight, Rule.Condition, Rule.FirstString, Rule.NumberOfStrings };
+
+        if (fwrite(Fields, sizeof(Fields), 1, File) != 1) return FALSE;
+        if (fwrite(Rule.Name.data(), 1, Rule.Name.size(), File) != Rule.Name.size()) return FALSE;
+    }
+
+    for (const RULE_STRING& String : m_Strings)
+    {
+        ULONG Fields[2] = { String.Rule, (ULONG)String.Bytes.size() };
+
+        if (fwrite(Fields, sizeof(Fields), 1, File) != 1) return FALSE;
+        if (fwrite(&String.Bytes[0], 1, String.Bytes.size(), File) != String.Bytes.size()) return FALSE;
+        if (fwrite(&String.Mask[0], 1, String.Mask.size(), File) != String.Mask.size()) return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+MalScoreRules::Load(
+    FILE *File
+)
+{
+    ULONG Header[4];
+    BOOLEAN Result = FALSE;
+
+    Clear();
+
+    if (fread(Header, sizeof(Header), 1, File) != 1) goto CleanUp;
+    if ((Header[0] != RULE_FILE_SIGNATURE) || (Header[1] != RULE_FILE_VERSION)) goto CleanUp;
+    if ((Header[2] > Header[3]) || (Header[3] > RULE_MAX_TOTAL_STRINGS)) goto CleanUp;
+    if (Header[3] > ((ULONG64)Header[2] * RULE_MAX_STRINGS)) goto CleanUp;
+
+    m_Rules.resize(Header[2]);
+    m_Strings.resize(Header[3]);
+
+    for (ULONG i = 0; i < m_Rules.size(); i += 1)
+    {
+        PRULE Rule = &m_Rules[i];
+        CHAR Name[RULE_MAX_NAME_LENGTH];
+        ULONG Fields[5];
+
+        if (fread(Fields, sizeof(Fields), 1, File) != 1) goto CleanUp;
+        if ((Fields[0] == 0) || (Fields[0] > RULE_MAX_NAME_LENGTH)) goto CleanUp;
+        if (fread(Name, 1, Fields[0], File) != Fields[0]) goto CleanUp;
+
+        Rule->Name.assign(Name, Fields[0]);
+        Rule->Weight = Fields[1];
+        Rule->Condition = Fields[2];
+        Rule->FirstString = Fields[3];
+        Rule->NumberOfStrings = Fields[4];
+
+        //
+        // Strings of a rule are contiguous, in rule order.
+        //
+        if ((Rule->NumberOfStrings == 0) || (Rule->NumberOfStrings > RULE_MAX_STRINGS)) goto CleanUp;
+        if ((Rule->Condition == 0) || (Rule->Condition > Rule->NumberOfStrings)) goto CleanUp;
+        if (Rule->FirstString != (i ? (m_Rules[i - 1].FirstString + m_Rules[i - 1].NumberOfStrings) : 0)) goto CleanUp;
+        if ((Rule->FirstString + Rule->NumberOfStrings) > m_Strings.size()) goto CleanUp;
+    }
+
+    if (m_Rules.size() && ((m_Rules.back().FirstString + m_Rules.back().NumberOfStrings) != m_Strings.size())) goto CleanUp;
+
+    for (ULONG i = 0; i < m_Strings.size(); i += 1)
+    {
+        PRULE_STRING String = &m_Strings[i];
+        ULONG Fields[2];
+
+        if (fread(Fields, sizeof(Fields), 1, File) != 1) goto CleanUp;
+        if ((Fields[0] >= m_Rules.size()) || (Fields[1] == 0) || (Fields[1] > RULE_MAX_STRING_LENGTH)) goto CleanUp;
+
+        String->Rule = Fields[0];
+        String->Bytes.resize(Fields[1]);
+        String->Mask.resize(Fields[1]);
+
+        if ((i < m_Rules[String->Rule].FirstString) ||
+            (i >= (m_Rules[String->Rule].FirstString + m_Rules[String->Rule].NumberOfStrings)))
+        {
+            goto CleanUp;
+        }
+
+        if (fread(&String->Bytes[0], 1, Fields[1], File) != Fields[1]) goto CleanUp;
+        if (fread(&String->Mask[0], 1, Fields[1], File) != Fields[1]) goto CleanUp;
+    }
+
+    Result = TRUE;
+
+CleanUp:
+    if (!Result) Clear();
+
+    return Result;
+}
+
+VOID
+MalScoreRules::Clear(
+)
+{
+    m_Rules.clear();
+    m_Strings.clear();
+}
@@ -0,0 +1,106 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - MalRules.h
+
+Abstract:
+
+    - User supplied MalScore rules: hex strings with wildcards, ASCII and
+      UTF-16 strings, a weight and a condition per rule.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __MALRULES_H__
+#define __MALRULES_H__
+
+//
+// A rule needs at most RULE_MAX_STRINGS strings, hits are kept as one bit per string.
+//
+#define RULE_MAX_STRINGS 64
+#define RULE_MAX_STRING_LENGTH 256
+#define RULE_MAX_NAME_LENGTH 128
+#define RULE_DEFAULT_WEIGHT 10
+
+#define RULE_MAX_TOTAL_STRINGS (16 * 1024 * 1024) // Sanity check of the cached rules.
+
+class MalScoreRules {
+public:
+    typedef struct _RULE {
+        string Name;
+        ULONG Weight; // Added to the MalScore of a region when the rule hits.
+        ULONG Condition; // Number of distinct strings needed.
+        ULONG FirstString; // In m_Strings.
+        ULONG NumberOfStrings;
+    } RULE, *PRULE;
+
+    typedef struct _RULE_STRING {
+        ULONG Rule;
+        vector<UCHAR> Bytes;
+        vector<UCHAR> Mask; // Zero for "??" bytes.
+    } RULE_STRING, *PRULE_STRING;
+
+    //
+    // One directive per line, '#' starts a comment:
+    //
+    //     rule <name>
+    //     weight <n>                     (default RULE_DEFAULT_WEIGHT)
+    //     condition any | all | <n>      (default any)
+    //     hex 6a 30 ?? 64 8b
+    //     ascii "text"
+    //     wide "text"                    (UTF-16LE)
+    //
+    // Strings accept \\, \", \t, \r, \n and \xNN. On failure, Error holds the line and the
+    // reason and the rules are left empty.
+    //
+    BOOLEAN
+    Parse(
+        LPCSTR FileName,
+        LPSTR Error,
+        ULONG ErrorSize
+    );
+
+    BOOLEAN
+    Save(
+        FILE *File
+    ) const;
+
+    BOOLEAN
+    Load(
+        FILE *File
+    );
+
+    VOID
+    Clear(
+    );
+
+    vector<RULE> m_Rules;
+    vector<RULE_STRING> m_Strings;
+};
+
+#endif
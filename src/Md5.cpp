@@ -35,7 +35,9 @@ Revision History:
 
 --*/
 
-#include "MoonSolsDbgExt.h"
+#include <windows.h>
+
+#include "Md5.h"
 
 
 /* F, G and H are basic MD5 functions: selection, majority, parity */
@@ -209,6 +211,30 @@ Transform(
     Buffer[3] += d;
 }
 
+/* Transform whole 64-byte blocks, bypassing the context buffer.
+   Used by the multi-buffer engine to finish a single remaining stream.
+*/
+VOID
+MD5Blocks(
+    PULONG State,
+    const UCHAR *Data,
+    SIZE_T Blocks
+)
+{
+    ULONG In[16];
+    ULONG i, ii;
+
+    for (; Blocks; Blocks--, Data += 64)
+    {
+        for (i = 0, ii = 0; i < 16; i++, ii += 4)
+            In[i] = (((ULONG)Data[ii+3]) << 24) |
+                    (((ULONG)Data[ii+2]) << 16) |
+                    (((ULONG)Data[ii+1]) << 8) |
+                    ((ULONG)Data[ii]);
+        Transform (State, In);
+    }
+}
+
 VOID
 MD5Init(
     PMD5_CONTEXT Md5Context
@@ -57,8 +57,8 @@ MD5Init(
 void
 MD5Update(
     MD5_CONTEXT *Md5Context,
-    unsigned char *InBuf,
-    unsigned long InLen
+    PUCHAR InBuf,
+    ULONG InLen
 );
 
 void
@@ -66,4 +66,11 @@ MD5Final(
     MD5_CONTEXT *Md5Context
 );
 
+void
+MD5Blocks(
+    PULONG State,
+    const UCHAR *Data,
+    SIZE_T Blocks
+);
+
 #endif
\ No newline at end of file
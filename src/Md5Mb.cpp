@@ -0,0 +1,509 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - Md5Mb.cpp
+
+Abstract:
+
+    - Multi-buffer MD5. Each lane of a vector register carries the state of
+      a different message, one 64-byte block of every lane is transformed
+      per step. Lanes are refilled from the job list as messages complete.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <string.h>
+#include <intrin.h>
+#include <algorithm>
+#include <vector>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "Md5Mb.h"
+
+typedef struct _MD5_LANE {
+    PMD5_JOB Job;
+    SIZE_T Block; // Next block to transform.
+    SIZE_T FullBlocks; // Blocks read straight from Job->Data.
+    SIZE_T TotalBlocks; // FullBlocks + 1 or 2 padding blocks from Tail.
+    UCHAR Tail[128];
+} MD5_LANE, *PMD5_LANE;
+
+static const UCHAR Md5ZeroBlock[64] = { 0 };
+
+struct Md5Sse2Lanes {
+    typedef __m128i V;
+    static const ULONG Count = 4;
+
+    static V Load(const ULONG *p) { return _mm_loadu_si128((const __m128i *)p); }
+    static VOID Store(ULONG *p, V x) { _mm_storeu_si128((__m128i *)p, x); }
+    static V Set1(ULONG x) { return _mm_set1_epi32((int)x); }
+    static V Add(V x, V y) { return _mm_add_epi32(x, y); }
+    static V And(V x, V y) { return _mm_and_si128(x, y); }
+    static V Or(V x, V y) { return _mm_or_si128(x, y); }
+    static V Xor(V x, V y) { return _mm_xor_si128(x, y); }
+    static V Not(V x) { return _mm_xor_si128(x, _mm_set1_epi32(-1)); }
+    static V Rotl(V x, int n) { return _mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - n)); }
+    static VOID Leave() { }
+
+    //
+    // X[i] receives word i of every lane's block (4x4 transposes).
+    //
+    static
+    VOID
+    LoadWords(
+        const UCHAR * const *Blocks,
+        V *X
+    )
+    {
+        for (ULONG g = 0; g < 4; g += 1)
+        {
+            V r0 = _mm_loadu_si128((const __m128i *)(Blocks[0] + (g * 16)));
+            V r1 = _mm_loadu_si128((const __m128i *)(Blocks[1] + (g * 16)));
+            V r2 = _mm_loadu_si128((const __m128i *)(Blocks[2] + (g * 16)));
+            V r3 = _mm_loadu_si128((const __m128i *)(Blocks[3] + (g * 16)));
+
+            V t0 = _mm_unpacklo_epi32(r0, r1);
+            V t1 = _mm_unpacklo_epi32(r2, r3);
+            V t2 = _mm_unpackhi_epi32(r0, r1);
+            V t3 = _mm_unpackhi_epi32(r2, r3);
+
+            X[(g * 4) + 0] = _mm_unpacklo_epi64(t0, t1);
+            X[(g * 4) + 1] = _mm_unpackhi_epi64(t0, t1);
+            X[(g * 4) + 2] = _mm_unpacklo_epi64(t2, t3);
+            X[(g * 4) + 3] = _mm_unpackhi_epi64(t2, t3);
+        }
+    }
+};
+
+struct Md5Avx2Lanes {
+    typedef __m256i V;
+    static const ULONG Count = 8;
+
+    static V Load(const ULONG *p) { return _mm256_loadu_si256((const __m256i *)p); }
+    static VOID Store(ULONG *p, V x) { _mm256_storeu_si256((__m256i *)p, x); }
+    static V Set1(ULONG x) { return _mm256_set1_epi32((int)x); }
+    static V Add(V x, V y) { return _mm256_add_epi32(x, y); }
+    static V And(V x, V y) { return _mm256_and_si256(x, y); }
+    static V Or(V x, V y) { return _mm256_or_si256(x, y); }
+    static V Xor(V x, V y) { return _mm256_xor_si256(x, y); }
+    static V Not(V x) { return _mm256_xor_si256(x, _mm256_set1_epi32(-1)); }
+    static V Rotl(V x, int n) { return _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - n)); }
+    static VOID Leave() { _mm256_zeroupper(); }
+
+    //
+    // Lanes 0-3 go to the low 128 bits and lanes 4-7 to the high 128 bits,
+    // unpack instructions then transpose both halves at once.
+    //
+    static
+    VOID
+    LoadWords(
+        const UCHAR * const *Blocks,
+        V *X
+    )
+    {
+        for (ULONG g = 0; g < 4; g += 1)
+        {
+            V r[4];
+
+            for (ULONG i = 0; i < 4; i += 1)
+            {
+                __m128i Lo = _mm_loadu_si128((const __m128i *)(Blocks[i] + (g * 16)));
+                __m128i Hi = _mm_loadu_si128((const __m128i *)(Blocks[i + 4] + (g * 16)));
+
+                r[i] = _mm256_inserti128_si256(_mm256_castsi128_si256(Lo), Hi, 1);
+            }
+
+            V t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+            V t1 = _mm256_unpacklo_epi32(r[2], r[3]);
+            V t2 = _mm256_unpackhi_epi32(r[0], r[1]);
+            V t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+
+            X[(g * 4) + 0] = _mm256_unpacklo_epi64(t0, t1);
+            X[(g * 4) + 1] = _mm256_unpackhi_epi64(t0, t1);
+            X[(g * 4) + 2] = _mm256_unpacklo_epi64(t2, t3);
+            X[(g * 4) + 3] = _mm256_unpackhi_epi64(t2, t3);
+        }
+    }
+};
+
+//
+// Same round functions as Md5.cpp, written with one operation less.
+//
+#define MB_F(x, y, z) L::Xor((z), L::And((x), L::Xor((y), (z))))
+#define MB_G(x, y, z) L::Xor((y), L::And((z), L::Xor((x), (y))))
+#define MB_H(x, y, z) L::Xor(L::Xor((x), (y)), (z))
+#define MB_I(x, y, z) L::Xor((y), L::Or((x), L::Not(z)))
+
+#define MB_STEP(f, a, b, c, d, k, s, t) \
+    (a) = L::Add((b), L::Rotl(L::Add(L::Add((a), f((b), (c), (d))), L::Add(X[k], L::Set1(t))), (s)))
+
+template <class L>
+static
+VOID
+Md5MbTransform(
+    ULONG (*State)[MD5_MB_MAX_LANES],
+    const UCHAR * const *Blocks
+)
+{
+    typedef typename L::V V;
+    V X[16];
+
+    V a = L::Load(State[0]);
+    V b = L::Load(State[1]);
+    V c = L::Load(State[2]);
+    V d = L::Load(State[3]);
+
+    L::LoadWords(Blocks, X);
+
+    MB_STEP(MB_F, a, b, c, d, 0, 7, 0xd76aa478);
+    MB_STEP(MB_F, d, a, b, c, 1, 12, 0xe8c7b756);
+    MB_STEP(MB_F, c, d, a, b, 2, 17, 0x242070db);
+    MB_STEP(MB_F, b, c, d, a, 3, 22, 0xc1bdceee);
+    MB_STEP(MB_F, a, b, c, d, 4, 7, 0xf57c0faf);
+    MB_STEP(MB_F, d, a, b, c, 5, 12, 0x4787c62a);
+    MB_STEP(MB_F, c, d, a, b, 6, 17, 0xa8304613);
+    MB_STEP(MB_F, b, c, d, a, 7, 22, 0xfd469501);
+    MB_STEP(MB_F, a, b, c, d, 8, 7, 0x698098d8);
+    MB_STEP(MB_F, d, a, b, c, 9, 12, 0x8b44f7af);
+    MB_STEP(MB_F, c, d, a, b, 10, 17, 0xffff5bb1);
+    MB_STEP(MB_F, b, c, d, a, 11, 22, 0x895cd7be);
+    MB_STEP(MB_F, a, b, c, d, 12, 7, 0x6b901122);
+    MB_STEP(MB_F, d, a, b, c, 13, 12, 0xfd987193);
+    MB_STEP(MB_F, c, d, a, b, 14, 17, 0xa679438e);
+    MB_STEP(MB_F, b, c, d, a, 15, 22, 0x49b40821);
+
+    MB_STEP(MB_G, a, b, c, d, 1, 5, 0xf61e2562);
+    MB_STEP(MB_G, d, a, b, c, 6, 9, 0xc040b340);
+    MB_STEP(MB_G, c, d, a, b, 11, 14, 0x265e5a51);
+    MB_STEP(MB_G, b, c, d, a, 0, 20, 0xe9b6c7aa);
+    MB_STEP(MB_G, a, b, c, d, 5, 5, 0xd62f105d);
+    MB_STEP(MB_G, d, a, b, c, 10, 9, 0x02441453);
+    MB_STEP(MB_G, c, d, a, b, 15, 14, 0xd8a1e681);
+    MB_STEP(MB_G, b, c, d, a, 4, 20, 0xe7d3fbc8);
+    MB_STEP(MB_G, a, b, c, d, 9, 5, 0x21e1cde6);
+    MB_STEP(MB_G, d, a, b, c, 14, 9, 0xc33707d6);
+    MB_STEP(MB_G, c, d, a, b, 3, 14, 0xf4d50d87);
+    MB_STEP(MB_G, b, c, d, a, 8, 20, 0x455a14ed);
+    MB_STEP(MB_G, a, b, c, d, 13, 5, 0xa9e3e905);
+    MB_STEP(MB_G, d, a, b, c, 2, 9, 0xfcefa3f8);
+    MB_STEP(MB_G, c, d, a, b, 7, 14, 0x676f02d9);
+    MB_STEP(MB_G, b, c, d, a, 12, 20, 0x8d2a4c8a);
+
+    MB_STEP(MB_H, a, b, c, d, 5, 4, 0xfffa3942);
+    MB_STEP(MB_H, d, a, b, c, 8, 11, 0x8771f681);
+    MB_STEP(MB_H, c, d, a, b, 11, 16, 0x6d9d6122);
+    MB_STEP(MB_H, b, c, d, a, 14, 23, 0xfde5380c);
+    MB_STEP(MB_H, a, b, c, d, 1, 4, 0xa4beea44);
+    MB_STEP(MB_H, d, a, b, c, 4, 11, 0x4bdecfa9);
+    MB_STEP(MB_H, c, d, a, b, 7, 16, 0xf6bb4b60);
+    MB_STEP(MB_H, b, c, d, a, 10, 23, 0xbebfbc70);
+    MB_STEP(MB_H, a, b, c, d, 13, 4, 0x289b7ec6);
+    MB_STEP(MB_H, d, a, b, c, 0, 11, 0xeaa127fa);
+    MB_STEP(MB_H, c, d, a, b, 3, 16, 0xd4ef3085);
+    MB_STEP(MB_H, b, c, d, a, 6, 23, 0x04881d05);
+    MB_STEP(MB_H, a, b, c, d, 9, 4, 0xd9d4d039);
+    MB_STEP(MB_H, d, a, b, c, 12, 11, 0xe6db99e5);
+    MB_STEP(MB_H, c, d, a, b, 15, 16, 0x1fa27cf8);
+    MB_STEP(MB_H, b, c, d, a, 2, 23, 0xc4ac5665);
+
+    MB_STEP(MB_I, a, b, c, d, 0, 6, 0xf4292244);
+    MB_STEP(MB_I, d, a, b, c, 7, 10, 0x432aff97);
+    MB_STEP(MB_I, c, d, a, b, 14, 15, 0xab9423a7);
+    MB_STEP(MB_I, b, c, d, a, 5, 21, 0xfc93a039);
+    MB_STEP(MB_I, a, b, c, d, 12, 6, 0x655b59c3);
+    MB_STEP(MB_I, d, a, b, c, 3, 10, 0x8f0ccc92);
+    MB_STEP(MB_I, c, d, a, b, 10, 15, 0xffeff47d);
+    MB_STEP(MB_I, b, c, d, a, 1, 21, 0x85845dd1);
+    MB_STEP(MB_I, a, b, c, d, 8, 6, 0x6fa87e4f);
+    MB_STEP(MB_I, d, a, b, c, 15, 10, 0xfe2ce6e0);
+    MB_STEP(MB_I, c, d, a, b, 6, 15, 0xa3014314);
+    MB_STEP(MB_I, b, c, d, a, 13, 21, 0x4e0811a1);
+    MB_STEP(MB_I, a, b, c, d, 4, 6, 0xf7537e82);
+    MB_STEP(MB_I, d, a, b, c, 11, 10, 0xbd3af235);
+    MB_STEP(MB_I, c, d, a, b, 2, 15, 0x2ad7d2bb);
+    MB_STEP(MB_I, b, c, d, a, 9, 21, 0xeb86d391);
+
+    L::Store(State[0], L::Add(L::Load(State[0]), a));
+    L::Store(State[1], L::Add(L::Load(State[1]), b));
+    L::Store(State[2], L::Add(L::Load(State[2]), c));
+    L::Store(State[3], L::Add(L::Load(State[3]), d));
+}
+
+#undef MB_STEP
+#undef MB_I
+#undef MB_H
+#undef MB_G
+#undef MB_F
+
+//
+// Builds the padding blocks of the job (MD5Final layout) and resets the lane state.
+//
+static
+VOID
+LaneStart(
+    PMD5_LANE Lane,
+    PMD5_JOB Job,
+    ULONG (*State)[MD5_MB_MAX_LANES],
+    ULONG Index
+)
+{
+    SIZE_T Remainder = Job->Length % 64;
+    ULONG64 Bits = (ULONG64)Job->Length << 3;
+    ULONG TailSize = (Remainder < 56) ? 64 : 128;
+
+    Lane->Job = Job;
+    Lane->Block = 0;
+    Lane->FullBlocks = Job->Length / 64;
+    Lane->TotalBlocks = Lane->FullBlocks + (TailSize / 64);
+
+    memset(Lane->Tail, 0, sizeof(Lane->Tail));
+    if (Remainder) memcpy(Lane->Tail, Job->Data + (Lane->FullBlocks * 64), Remainder);
+    Lane->Tail[Remainder] = 0x80;
+    for (ULONG i = 0; i < 8; i += 1) Lane->Tail[TailSize - 8 + i] = (UCHAR)(Bits >> (i * 8));
+
+    State[0][Index] = 0x67452301;
+    State[1][Index] = 0xefcdab89;
+    State[2][Index] = 0x98badcfe;
+    State[3][Index] = 0x10325476;
+}
+
+static
+const UCHAR *
+LaneBlock(
+    PMD5_LANE Lane
+)
+{
+    if (Lane->Block < Lane->FullBlocks) return Lane->Job->Data + (Lane->Block * 64);
+
+    return Lane->Tail + ((Lane->Block - Lane->FullBlocks) * 64);
+}
+
+static
+VOID
+LaneFinish(
+    PMD5_LANE Lane,
+    ULONG (*State)[MD5_MB_MAX_LANES],
+    ULONG Index
+)
+{
+    for (ULONG i = 0; i < 4; i += 1)
+    {
+        ULONG Word = State[i][Index];
+
+        Lane->Job->Digest[(i * 4) + 0] = (UCHAR)Word;
+        Lane->Job->Digest[(i * 4) + 1] = (UCHAR)(Word >> 8);
+        Lane->Job->Digest[(i * 4) + 2] = (UCHAR)(Word >> 16);
+        Lane->Job->Digest[(i * 4) + 3] = (UCHAR)(Word >> 24);
+    }
+
+    Lane->Job = NULL;
+}
+
+//
+// Remaining blocks of a lane with the scalar transform.
+//
+static
+VOID
+LaneDrain(
+    PMD5_LANE Lane,
+    ULONG (*State)[MD5_MB_MAX_LANES],
+    ULONG Index
+)
+{
+    ULONG Words[4];
+
+    for (ULONG i = 0; i < 4; i += 1) Words[i] = State[i][Index];
+
+    if (Lane->Block < Lane->FullBlocks)
+    {
+        MD5Blocks(Words, Lane->Job->Data + (Lane->Block * 64), Lane->FullBlocks - Lane->Block);
+        Lane->Block = Lane->FullBlocks;
+    }
+
+    MD5Blocks(Words, Lane->Tail + ((Lane->Block - Lane->FullBlocks) * 64), Lane->TotalBlocks - Lane->Block);
+    Lane->Block = Lane->TotalBlocks;
+
+    for (ULONG i = 0; i < 4; i += 1) State[i][Index] = Words[i];
+
+    LaneFinish(Lane, State, Index);
+}
+
+template <class L>
+static
+VOID
+Md5MbRun(
+    PMD5_JOB *Jobs,
+    ULONG Count
+)
+{
+    ULONG State[4][MD5_MB_MAX_LANES] = { 0 };
+    const UCHAR *Blocks[MD5_MB_MAX_LANES];
+    MD5_LANE Lanes[MD5_MB_MAX_LANES];
+    ULONG Next = 0;
+    ULONG Active = 0;
+
+    for (ULONG i = 0; i < L::Count; i += 1)
+    {
+        Lanes[i].Job = NULL;
+        if (Next < Count)
+        {
+            LaneStart(&Lanes[i], Jobs[Next++], State, i);
+            Active += 1;
+        }
+    }
+
+    while (Active)
+    {
+        //
+        // A single stream left does not benefit from the vector unit.
+        //
+        if ((Active == 1) && (Next == Count))
+        {
+            for (ULONG i = 0; i < L::Count; i += 1)
+            {
+                if (Lanes[i].Job) LaneDrain(&Lanes[i], State, i);
+            }
+            break;
+        }
+
+        for (ULONG i = 0; i < L::Count; i += 1)
+        {
+            Blocks[i] = Lanes[i].Job ? LaneBlock(&Lanes[i]) : Md5ZeroBlock;
+        }
+
+        Md5MbTransform<L>(State, Blocks);
+
+        for (ULONG i = 0; i < L::Count; i += 1)
+        {
+            if (!Lanes[i].Job) continue;
+
+            Lanes[i].Block += 1;
+            if (Lanes[i].Block < Lanes[i].TotalBlocks) continue;
+
+            LaneFinish(&Lanes[i], State, i);
+            Active -= 1;
+
+            if (Next < Count)
+            {
+                LaneStart(&Lanes[i], Jobs[Next++], State, i);
+                Active += 1;
+            }
+        }
+    }
+
+    L::Leave();
+}
+
+static
+VOID
+Md5ScalarRun(
+    PMD5_JOB *Jobs,
+    ULONG Count
+)
+{
+    ULONG State[4][MD5_MB_MAX_LANES];
+    MD5_LANE Lane;
+
+    for (ULONG i = 0; i < Count; i += 1)
+    {
+        LaneStart(&Lane, Jobs[i], State, 0);
+        LaneDrain(&Lane, State, 0);
+    }
+}
+
+ULONG
+MD5MultiBufferLanes(
+    VOID
+)
+{
+    ULONG Features = GetHashFeatures();
+
+    if (Features & HASH_FEATURE_AVX2) return Md5Avx2Lanes::Count;
+    if (Features & HASH_FEATURE_SSE2) return Md5Sse2Lanes::Count;
+
+    return 1;
+}
+
+VOID
+MD5MultiBuffer(
+    PMD5_JOB Jobs,
+    ULONG Count
+)
+{
+    vector<PMD5_JOB> Order(Count);
+    ULONG Lanes = MD5MultiBufferLanes();
+
+    for (ULONG i = 0; i < Count; i += 1) Order[i] = &Jobs[i];
+
+    if ((Count < 2) || (Lanes == 1))
+    {
+        Md5ScalarRun(Order.data(), Count);
+        return;
+    }
+
+    sort(Order.begin(), Order.end(), [](PMD5_JOB a, PMD5_JOB b) { return a->Length > b->Length; });
+
+    if (Lanes == Md5Avx2Lanes::Count) Md5MbRun<Md5Avx2Lanes>(Order.data(), Count);
+    else Md5MbRun<Md5Sse2Lanes>(Order.data(), Count);
+}
+
+VOID
+Md5Queue::Submit(
+    const UCHAR *Data,
+    SIZE_T Length,
+    PUCHAR Digest
+)
+{
+    MD5_JOB Job;
+
+    Job.Data = Data;
+    Job.Length = Length;
+
+    m_Jobs.push_back(Job);
+    m_Digests.push_back(Digest);
+}
+
+VOID
+Md5Queue::Flush(
+)
+{
+    if (m_Jobs.empty()) return;
+
+    MD5MultiBuffer(m_Jobs.data(), (ULONG)m_Jobs.size());
+
+    for (ULONG i = 0; i < m_Jobs.size(); i += 1)
+    {
+        memcpy(m_Digests[i], m_Jobs[i].Digest, sizeof(m_Jobs[i].Digest));
+    }
+
+    m_Jobs.clear();
+    m_Digests.clear();
+}
@@ -0,0 +1,96 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - Md5Mb.h
+
+Abstract:
+
+    - Multi-buffer MD5: independent messages are hashed side by side in the
+      lanes of SSE2 (4) or AVX2 (8) registers.
+    - Digests are identical to MD5Init/MD5Update/MD5Final.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __MD5MB_H__
+#define __MD5MB_H__
+
+#define MD5_MB_MAX_LANES 8
+
+typedef struct _MD5_JOB {
+    const UCHAR *Data;
+    SIZE_T Length;
+    UCHAR Digest[MD5_DIGEST_SIZE];
+} MD5_JOB, *PMD5_JOB;
+
+//
+// Number of messages hashed in parallel on this CPU (1 when no SIMD path is usable).
+//
+ULONG
+MD5MultiBufferLanes(
+    VOID
+);
+
+//
+// Hashes every job, longest messages first so that lanes stay busy until the end.
+//
+VOID
+MD5MultiBuffer(
+    PMD5_JOB Jobs,
+    ULONG Count
+);
+
+class Md5Queue {
+public:
+    //
+    // Data must stay valid and Digest is only written by Flush().
+    //
+    VOID
+    Submit(
+        const UCHAR *Data,
+        SIZE_T Length,
+        PUCHAR Digest
+    );
+
+    VOID
+    Flush(
+    );
+
+    ULONG
+    GetCount(
+    )
+    {
+        return (ULONG)m_Jobs.size();
+    }
+
+private:
+    vector<MD5_JOB> m_Jobs;
+    vector<PUCHAR> m_Digests;
+};
+
+#endif
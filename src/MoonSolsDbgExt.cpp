@@ -47,6 +47,7 @@ public:
     EXT_COMMAND_METHOD(ms_readkcb);
     EXT_COMMAND_METHOD(ms_readknode);
     EXT_COMMAND_METHOD(ms_readkvalue);
+    EXT_COMMAND_METHOD(ms_regfile);
 
     EXT_COMMAND_METHOD(ms_netstat);
 
@@ -87,20 +88,75 @@ public:
     EXT_COMMAND_METHOD(ms_sockets);
 
     EXT_COMMAND_METHOD(ms_malscore);
+    EXT_COMMAND_METHOD(ms_rules);
+    EXT_COMMAND_METHOD(ms_hash);
+    EXT_COMMAND_METHOD(ms_integrity);
 
     EXT_COMMAND_METHOD(ms_exqueue);
 
     EXT_COMMAND_METHOD(ms_store);
-    // EXT_COMMAND_METHOD(ms_strings);
+    EXT_COMMAND_METHOD(ms_strings);
 
     // EXT_COMMAND_METHOD(ms_virustotal);
 
     // EXT_COMMAND_METHOD(ms_analyze); // !ms_analyze -v
 
+    EXT_COMMAND_METHOD(ms_stats);
+
+    virtual HRESULT __thiscall Initialize(void);
+    virtual void __thiscall OnSessionInactive(_In_ ULONG64 Argument);
+    virtual void __thiscall OnSessionAccessible(_In_ ULONG64 Argument);
 };
 
 EXT_DECLARE_GLOBALS();
 
+HRESULT
+EXT_CLASS::Initialize(
+)
+{
+    g_MalScoreOutput = OutMalScore;
+
+    return ExtExtension::Initialize();
+}
+
+void
+EXT_CLASS::OnSessionInactive(
+    _In_ ULONG64 Argument
+)
+{
+    UNREFERENCED_PARAMETER(Argument);
+
+    g_SymbolCache.Flush();
+    g_CodeCache.Flush();
+    g_ImageCache.Flush();
+    g_ExportIndex.Flush();
+    g_HiveMapCache.Flush();
+
+    //
+    // Next target may use a different kernel.
+    //
+    InvalidateProcessLayout();
+
+    g_CommandArena.Reset();
+}
+
+void
+EXT_CLASS::OnSessionAccessible(
+    _In_ ULONG64 Argument
+)
+{
+    UNREFERENCED_PARAMETER(Argument);
+
+    //
+    // The target ran (or modules got loaded), cached names and images may be stale.
+    //
+    g_SymbolCache.Flush();
+    g_CodeCache.Flush();
+    g_ImageCache.Flush();
+    g_ExportIndex.Flush();
+    g_HiveMapCache.Flush();
+}
+
 EXT_COMMAND(ms_process,
     "Display list of processes",
     "{;e,o;;}"
@@ -112,14 +168,20 @@ EXT_COMMAND(ms_process,
     "{vads;b,o;vads;Display VADs belonging to process}"
     "{vars;b,o;vars;Display environment variables}"
     "{exports;b,o;exports;Display exports belonging to process}"
+    "{iat;b,o;iat;Check Import Address Tables of the process and its dlls}"
+    "{hashes;b,o;hashes;Display MD5/SHA1/SHA256 of images, sections and VADs}"
     "{all;b,o;all;Display or scan all}"
-    "{scan;b,o;scan;Display only malicious artifacts}")
+    "{scan;b,o;scan;Display only malicious artifacts}"
+    "{workers;ed,o;count;Number of threads used to parse images (default: one per processor)}")
 {
+    ArenaScope Scope;
     ULONG Flags = 0;
     ULONG64 Pid;
-    BOOLEAN bScan;
+    BOOLEAN bScan = FALSE;
 
     Pid = GetArgU64("pid", FALSE);
+    if (HasArg("workers")) g_Scheduler.SetWorkerCount((ULONG)GetArgU64("workers", FALSE));
+
     LPCSTR HandlesArg = GetArgStr("handles", FALSE);
     if (HandlesArg) Flags |= PROCESS_HANDLES_FLAG;
 
@@ -134,9 +196,13 @@ EXT_COMMAND(ms_process,
         if (Flags & PROCESS_DLLS_FLAG) Flags |= PROCESS_DLL_EXPORTS_FLAG;
     }
 
+    if (HasArg("iat")) Flags |= PROCESS_IAT_FLAG | PROCESS_DLLS_FLAG;
+    if (HasArg("hashes")) Flags |= PROCESS_HASHES_FLAG;
+
     if (HasArg("all"))
     {
         Flags |= PROCESS_EXPORTS_FLAG | PROCESS_DLLS_FLAG | PROCESS_DLL_EXPORTS_FLAG | PROCESS_VADS_FLAG;
+        Flags |= PROCESS_IAT_FLAG;
         Flags |= PROCESS_ENVVAR_FLAG;
         Flags |= PROCESS_THREADS_FLAG;
         Flags |= PROCESS_HANDLES_FLAG;
@@ -154,7 +220,27 @@ EXT_COMMAND(ms_process,
 
     ProcessArray CachedProcessList = GetProcesses(Pid, Flags);
 
-    for each (MsProcessObject ProcObj in CachedProcessList)
+    if (bScan && (Flags & PROCESS_VADS_FLAG))
+    {
+        //
+        // Every VAD of every process is scored before the output, reads and scoring overlap.
+        //
+        ScanProcessVads(CachedProcessList, [this](const SCAN_PROGRESS& Progress)
+        {
+            Dml("<col fg=\"changed\">[*] Scanned</col> %d/%d processes, %d/%d VADs, %I64d/%I64d MB (%I64d ms, %d workers)\n",
+                Progress.ProcessesDone, Progress.Processes,
+                Progress.RegionsDone, Progress.Regions,
+                Progress.BytesDone / (1024 * 1024), Progress.Bytes / (1024 * 1024),
+                Progress.ElapsedMs, Progress.Workers);
+        });
+    }
+
+    //
+    // One hasher thread for the VADs of every process.
+    //
+    HashStream VadStream(ReadVirtualPages);
+
+    for (MsProcessObject& ProcObj : CachedProcessList)
     {
         Dml("\n<col fg=\"changed\">Process:</col>       <link cmd=\"!process %p 1\">%-20s</link> (PID=0x%4x) | "
             "[<link cmd=\"!ms_process /pid 0x%I64X /dlls\">+Dlls</link>] "
@@ -174,21 +260,23 @@ EXT_COMMAND(ms_process,
             ProcObj.m_CcProcessObject.ProcessId,
             ProcObj.m_CcProcessObject.ProcessId,
             ProcObj.m_CcProcessObject.ProcessObjectPtr);
-        if (wcslen(ProcObj.m_CcProcessObject.FullPath)) Dml("    <col fg=\"emphfg\">Path:          </col> %S\n", ProcObj.m_CcProcessObject.FullPath);
+        if (wcslen(ProcObj.GetFullPath())) Dml("    <col fg=\"emphfg\">Path:          </col> %S\n", ProcObj.GetFullPath());
         if (strlen(ProcObj.m_PdbInfo.PdbName)) Dml("    <col fg=\"emphfg\">PDB:           </col> %s\n", ProcObj.m_PdbInfo.PdbName);
         if (wcslen(ProcObj.m_FileVersion.CompanyName)) Dml("    <col fg=\"emphfg\">Vendor:        </col> %S\n", ProcObj.m_FileVersion.CompanyName);
         if (wcslen(ProcObj.m_FileVersion.FileVersion)) Dml("    <col fg=\"emphfg\">Version:       </col> %S\n", ProcObj.m_FileVersion.FileVersion);
         if (wcslen(ProcObj.m_FileVersion.FileDescription)) Dml("    <col fg=\"emphfg\">Description:   </col> %S\n", ProcObj.m_FileVersion.FileDescription);
-        if (ProcObj.m_CcProcessObject.CommandLine) Dml("    <col fg=\"emphfg\">Commandline:   </col> %S (%p)\n",
-            ProcObj.m_CcProcessObject.CommandLine, ProcObj.m_CcProcessObject.CommandLine);
+        if (ProcObj.GetProcessCommandLine()) Dml("    <col fg=\"emphfg\">Commandline:   </col> %S (%p)\n",
+            ProcObj.GetProcessCommandLine(), ProcObj.GetProcessCommandLine());
 
         Dml("    <col fg=\"emphfg\">Sections:</col>      ");
-        for each (PEFile::CACHED_SECTION_INFO Section in ProcObj.m_CcSections)
+        for (PEFile::CACHED_SECTION_INFO& Section : ProcObj.m_CcSections)
         {
             Dml("%s, ", Section.Name);
         }
         Dml("\n");
 
+        if (Flags & PROCESS_HASHES_FLAG) OutImageHashes(&ProcObj);
+
         if (ProcObj.m_TypedObject.HasField("Flags2.ProtectedProcess"))
         {
             // Windows Vista+
@@ -200,7 +288,7 @@ EXT_COMMAND(ms_process,
 
         if (Flags & PROCESS_ENVVAR_FLAG)
         {
-            for each (MsProcessObject::ENV_VAR_OBJECT EnvVar in ProcObj.m_EnvVars)
+            for (MsProcessObject::ENV_VAR_OBJECT& EnvVar : ProcObj.GetEnvVars())
             {
                 Dml("    %S\n", EnvVar.Variable);
             }
@@ -215,7 +303,7 @@ EXT_COMMAND(ms_process,
                 "    |------|------|--------------------|----------------------------------------------------|---------|\n",
                 "Indx", "Ord", "Addr", "Name", "Patched", "Hooked");
 
-            for each (PEFile::EXPORT_INFO ExportInfo in ProcObj.m_Exports)
+            for (PEFile::EXPORT_INFO& ExportInfo : ProcObj.m_Exports)
             {
                 ULONG64 Ptr = ProcObj.m_ImageBase + ExportInfo.Address;
 
@@ -233,8 +321,15 @@ EXT_COMMAND(ms_process,
             g_Ext->Dml("\n");
         }
 
+        if ((Flags & PROCESS_IAT_FLAG) && ProcObj.m_Imports.size())
+        {
+            Dml("    <col fg=\"emphfg\">Imports:</col>       %d (%d hooked)\n",
+                (ULONG)ProcObj.m_Imports.size(), ProcObj.m_NumberOfHookedImports);
+            OutImports(&ProcObj, ProcObj.m_CcProcessObject.ProcessObjectPtr, bScan);
+        }
+
         UINT i = 0;
-        for each (MsDllObject DllObj in ProcObj.m_DllList)
+        for (MsDllObject& DllObj : ProcObj.m_DllList)
         {
             Dml("    -> [%3d]: (%s) %S\n",
                 i,
@@ -242,6 +337,8 @@ EXT_COMMAND(ms_process,
                 DllObj.mm_CcDllObject.FullDllName);
             i += 1;
 
+            if (Flags & PROCESS_HASHES_FLAG) OutImageHashes(&DllObj);
+
             if ((Flags & PROCESS_DLL_EXPORTS_FLAG) && (
                 ((Flags & PROCESS_SCAN_MALICIOUS_FLAG) && DllObj.m_NumberOfHookedAPIs) ||
                 (!(Flags & PROCESS_SCAN_MALICIOUS_FLAG) && DllObj.m_NumberOfExportedFunctions)))
@@ -251,7 +348,7 @@ EXT_COMMAND(ms_process,
                     "    |------|------|--------------------|----------------------------------------------------|---------|\n",
                     "Indx", "Ord", "Addr", "Name", "Patched", "Hooked");
 
-                for each (PEFile::EXPORT_INFO ExportInfo in DllObj.m_Exports)
+                for (PEFile::EXPORT_INFO& ExportInfo : DllObj.m_Exports)
                 {
                     ULONG64 Ptr = DllObj.m_ImageBase + ExportInfo.Address;
 
@@ -266,13 +363,27 @@ EXT_COMMAND(ms_process,
 
                         if ((Flags & PROCESS_SCAN_MALICIOUS_FLAG) && ExportInfo.IsHooked)
                         {
+                            CHAR Target[MAX_PATH];
+
                             ExecuteSilent(".process /p /r 0x%I64X", ProcObj.m_CcProcessObject.ProcessObjectPtr);
-                            Execute("u 0x%I64X L3", Ptr);
+
+                            Dml("           %s at +0x%x to 0x%016I64X (%s)\n",
+                                X86HookTypeName((X86_HOOK_TYPE)ExportInfo.HookType),
+                                ExportInfo.HookOffset,
+                                ExportInfo.HookTarget,
+                                ExportInfo.HookTarget ? GetNameByOffset(ExportInfo.HookTarget, Target, sizeof(Target)) : "unknown");
+
+                            Execute("u 0x%I64X L3", Ptr + ExportInfo.HookOffset);
                         }
                     }
                 }
                 Dml("\n");
             }
+
+            if ((Flags & PROCESS_IAT_FLAG) && DllObj.m_Imports.size())
+            {
+                OutImports(&DllObj, ProcObj.m_CcProcessObject.ProcessObjectPtr, bScan);
+            }
         }
 
         if (Flags & PROCESS_HANDLES_FLAG)
@@ -289,7 +400,7 @@ EXT_COMMAND(ms_process,
 
             swprintf_s(ArgType, sizeof(ArgType), L"%S", HandlesArg);
 
-            for each (HANDLE_OBJECT Handle in ProcObj.m_Handles)
+            for (HANDLE_OBJECT& Handle : ProcObj.m_Handles)
             {
                 if (wcslen(ArgType) && (_wcsicmp(ArgType, Handle.Type) != 0)) continue;
 
@@ -314,7 +425,7 @@ EXT_COMMAND(ms_process,
 
         if (Flags & PROCESS_VADS_FLAG)
         {
-            ProcObj.MmGetVads();
+            if (!bScan) ProcObj.MmGetVads(); // Otherwise listed and scored by ScanProcessVads().
 
             Dml("\n"
                 "    |----------------------|----------|--------------------|--------------------|---------------------------------------------------------------------------|\n"
@@ -322,7 +433,7 @@ EXT_COMMAND(ms_process,
                 "    |----------------------|----------|--------------------|--------------------|---------------------------------------------------------------------------|\n",
                 "Protection", "MalScore", "Start range", "End range", "FileObject");
 
-            for each (VAD_OBJECT Vad in ProcObj.m_Vads)
+            for (VAD_OBJECT& Vad : ProcObj.m_Vads)
             {
                 ULONG MalScore = 0;
                 HANDLE_OBJECT Handle = { 0 };
@@ -355,22 +466,39 @@ EXT_COMMAND(ms_process,
                         break;
                 }
 
-                ULONG VadSize = (ULONG)((Vad.EndingVpn - Vad.StartingVpn) * PAGE_SIZE);
+                ULONG64 VadSize = (Vad.EndingVpn - Vad.StartingVpn + 1) * PAGE_SIZE;
                 ULONG64 BaseAddress = Vad.StartingVpn * PAGE_SIZE;
 
-                if (bScan)
-                {
-                    MalScore = GetMalScoreEx(FALSE, &ProcObj, BaseAddress, VadSize);
-                }
+                if (bScan) MalScore = Vad.MalScore;
 
-                Dml("    | %-20s | <link cmd=\"!ms_malscore 0x%016I64X 0x%X\">%8d</link> | 0x%016I64X | 0x%016I64X | (0x%016I64X) %S |\n",
+                Dml("    | %-20s | <link cmd=\"!ms_malscore 0x%016I64X 0x%I64X\">%8d</link> | 0x%016I64X | 0x%016I64X | (0x%016I64X) %S |\n",
                     Protection,
                     BaseAddress, VadSize, MalScore,
                     Vad.StartingVpn * PAGE_SIZE,
-                    Vad.EndingVpn * PAGE_SIZE,
+                    (Vad.EndingVpn + 1) * PAGE_SIZE,
                     Vad.FileObject,
                     FoResult ? Handle.Name : L""
                     );
+
+                for (ULONG j = 0; bScan && (j < Vad.NumberOfRules); j += 1)
+                {
+                    MalScoreRules::PRULE Rule = &g_MalScoreRules.m_Rules[Vad.Rules[j]];
+
+                    Dml("    |   <col fg=\"changed\">Rule:</col> %-40s (weight %d)\n", Rule->Name.c_str(), Rule->Weight);
+                }
+
+                if (bScan && Vad.Entropy.NumberOfPages) OutEntropySummary("    |   ", &Vad.Entropy);
+
+                if (Flags & PROCESS_HASHES_FLAG)
+                {
+                    STREAM_DIGESTS Digests;
+
+                    ProcObj.SwitchContext();
+                    VadStream.HashVirtual(BaseAddress, VadSize, &Digests);
+                    ProcObj.RestoreContext();
+
+                    OutStreamDigests("      ", &Digests);
+                }
             }
         }
 
@@ -383,7 +511,7 @@ EXT_COMMAND(ms_process,
                 "    |--------|--------|--------------------|----------------------------------------------------|---------------------|---------------------|\n",
                 "Proc", "Thrd", "Addr", "Name");
 
-            for each (THREAD_OBJECT Thread in ProcObj.m_Threads)
+            for (THREAD_OBJECT& Thread : ProcObj.m_Threads)
             {
                 UCHAR Name[512] = { 0 };
                 UCHAR TimerType[32] = { 0 };
@@ -467,6 +595,7 @@ EXT_COMMAND(ms_drivers,
     "{object;ed,o;drvobj;Display driver information for a given driven object}"
     "{scan;b,o;scan;Display only malicious artifacts}")
 {
+    ArenaScope Scope;
     ULONG Flags = 0;
 
     ULONG64 DrvObj = GetArgU64("object", FALSE);
@@ -474,7 +603,7 @@ EXT_COMMAND(ms_drivers,
 
     vector<MsDriverObject> Drivers = GetDrivers();
 
-    for each (MsDriverObject Driver in Drivers)
+    for (MsDriverObject& Driver : Drivers)
     {
         if (DrvObj && (Driver.m_ObjectPtr != DrvObj)) continue;
 
@@ -486,6 +615,7 @@ EXT_COMMAND(ms_services,
     "Display list of services",
     "{;e,o;;}")
 {
+    ArenaScope Scope;
     vector<SERVICE_ENTRY> Services = GetServices();
     UINT i = 0;
 
@@ -1181,6 +1311,150 @@ EXT_COMMAND(ms_readkvalue,
     RegReadKeyValue(KeyHive, KeyValue);
 }
 
+EXT_COMMAND(ms_regfile,
+    "Display the keys and values of a registry hive file (regf), e.g. extracted from a disk",
+    "{key;s,o;path;Start from this key, relative to the root (e.g. ControlSet001\\Services)}"
+    "{depth;ed,o;depth;Levels of subkeys displayed (default: 1, 0 for all)}"
+    "{values;b,o;values;Display the values of the keys}"
+    "{stats;b,o;stats;Walk every key and value of the hive and measure it}"
+    "{;x;file;Hive file}")
+{
+    typedef struct _REGFILE_WALK {
+        RegFile *Hive;
+        BOOLEAN Values;
+        vector<UCHAR> Buffer; // Inline and big data values.
+        ULONG64 Keys;
+        ULONG64 NumberOfValues;
+        ULONG64 DataSize;
+        ULONG64 InvalidValues;
+    } REGFILE_WALK, *PREGFILE_WALK;
+
+    LPCSTR FileName = GetUnnamedArgStr(0);
+    ULONG MaxDepth = HasArg("depth") ? (ULONG)GetArgU64("depth", FALSE) : 1;
+    RegFile Hive;
+    RegFile::REGF_KEY Key;
+    REGFILE_WALK Walk;
+    ULONG64 Start, Elapsed;
+
+    if (!Hive.Open(FileName))
+    {
+        Err("Error: %s is not a valid registry hive file.\n", FileName);
+        return;
+    }
+
+    Dml("\n<col fg=\"changed\">[*] %s</col> (regf %d.%d, %I64d bytes)\n", FileName, Hive.m_Major, Hive.m_Minor, Hive.m_FileSize);
+    if (Hive.m_Dirty) Dml("    <col fg=\"changed\">Warning:</col> the hive was not flushed, recent changes may only be in its .LOG files.\n");
+    if (!Hive.m_ValidCheckSum) Dml("    <col fg=\"changed\">Warning:</col> invalid base block checksum.\n");
+
+    if (!Hive.GetRootKey(&Key))
+    {
+        Err("Error: invalid root key.\n");
+        return;
+    }
+
+    if (HasArg("key") && !Hive.OpenKey(&Key, GetArgStr("key", FALSE), &Key))
+    {
+        Err("Error: key %s not found.\n", GetArgStr("key", FALSE));
+        return;
+    }
+
+    Walk.Hive = &Hive;
+    Walk.Values = HasArg("values");
+    Walk.Keys = 0;
+    Walk.NumberOfValues = 0;
+    Walk.DataSize = 0;
+    Walk.InvalidValues = 0;
+
+    if (HasArg("stats"))
+    {
+        //
+        // Decodes everything the display would, without the output.
+        //
+        Start = GetTickCount64();
+
+        Hive.Walk(&Key, 0, [](PVOID Context, RegFile::PREGF_KEY Key) -> BOOLEAN
+        {
+            PREGFILE_WALK Walk = (PREGFILE_WALK)Context;
+            WCHAR Name[256];
+
+            Walk->Keys += 1;
+            RegFile::GetName(Key->Name, Key->NameLength, Key->CompressedName, Name, _countof(Name));
+
+            for (ULONG i = 0; i < Key->NumberOfValues; i += 1)
+            {
+                RegFile::REGF_VALUE Value;
+                const UCHAR *Data;
+                ULONG DataLength;
+
+                if (!Walk->Hive->GetValue(Key, i, &Value) || !Walk->Hive->GetValueData(&Value, Walk->Buffer, &Data, &DataLength))
+                {
+                    Walk->InvalidValues += 1;
+                    continue;
+                }
+
+                RegFile::GetName(Value.Name, Value.NameLength, Value.CompressedName, Name, _countof(Name));
+                Walk->NumberOfValues += 1;
+                Walk->DataSize += DataLength;
+            }
+
+            return TRUE;
+        }, &Walk);
+
+        Elapsed = GetTickCount64() - Start;
+
+        Dml("    Keys           %10I64d\n"
+            "    Values         %10I64d (%I64d KB of data)\n"
+            "    Invalid cells  %10I64d\n"
+            "    Invalid values %10I64d\n"
+            "    Walk           %10I64d ms (%I64d MB/s)\n",
+            Walk.Keys, Walk.NumberOfValues, Walk.DataSize / 1024, Hive.m_InvalidCells, Walk.InvalidValues,
+            Elapsed, Elapsed ? ((Hive.m_FileSize * 1000) / (Elapsed * 1024 * 1024)) : 0);
+        return;
+    }
+
+    Dml("\n");
+
+    Hive.Walk(&Key, MaxDepth, [](PVOID Context, RegFile::PREGF_KEY Key) -> BOOLEAN
+    {
+        PREGFILE_WALK Walk = (PREGFILE_WALK)Context;
+        WCHAR Name[256];
+        CHAR Indent[64];
+
+        RtlZeroMemory(Indent, sizeof(Indent));
+        memset(Indent, ' ', min(Key->Depth * 4, (ULONG)sizeof(Indent) - 1));
+
+        RegFile::GetName(Key->Name, Key->NameLength, Key->CompressedName, Name, _countof(Name));
+        g_Ext->Dml("%s<col fg=\"emphfg\">%S</col> (%d subkeys, %d values)\n", Indent, Name, Key->NumberOfSubKeys, Key->NumberOfValues);
+
+        for (ULONG i = 0; Walk->Values && (i < Key->NumberOfValues); i += 1)
+        {
+            RegFile::REGF_VALUE Value;
+            const UCHAR *Data;
+            ULONG DataLength;
+
+            if (!Walk->Hive->GetValue(Key, i, &Value))
+            {
+                g_Ext->Dml("%s   [%2d] <col fg=\"changed\">Invalid value</col>\n", Indent, i);
+                continue;
+            }
+
+            RegFile::GetName(Value.Name, Value.NameLength, Value.CompressedName, Name, _countof(Name));
+            g_Ext->Dml("%s   [%2d] <col fg=\"changed\">%-32S</col> | ", Indent, i, Value.NameLength ? Name : L"(Default)");
+
+            if (!Walk->Hive->GetValueData(&Value, Walk->Buffer, &Data, &DataLength))
+            {
+                g_Ext->Dml("<col fg=\"changed\">Invalid data</col> (cell 0x%X)\n", Value.Data);
+                continue;
+            }
+
+            RegOutValueData(Value.Type, Data, DataLength);
+        }
+
+        return TRUE;
+    }, &Walk);
+
+    if (Hive.m_InvalidCells) Dml("\n<col fg=\"changed\">[*] %I64d invalid cell(s) skipped.</col>\n", Hive.m_InvalidCells);
+}
 
 EXT_COMMAND(ms_readkcb,
     "Read key control block",
@@ -1300,6 +1574,7 @@ EXT_COMMAND(ms_consoles,
     "Display console command's history ",
     "{;e,o;;}")
 {
+    ArenaScope Scope;
     ProcessIterator Processes;
     MsProcessObject ProcObject;
 
@@ -1411,6 +1686,8 @@ EXT_COMMAND(ms_credentials,
     "Display user's credentials (based on gentilwiki's mimikatz) ",
     "{;e,o;;}")
 {
+    ArenaScope Scope;
+
     Mimikatz();
 }
 
@@ -1470,8 +1747,141 @@ EXT_COMMAND(ms_hivelist,
     "Display list of registry hives",
     "{;e,o;;}"
     "{hive;ed,o;hive;Display information for a given registry hive}"
-    "{scan;b,o;scan;Display additional information}")
+    "{scan;b,o;scan;Display additional information}"
+    "{bench;b,o;bench;Measure cell translation on a synthetic hive map}")
 {
+    if (HasArg("bench"))
+    {
+        //
+        // Synthetic hive at 0x10000: both map directories, then the map tables (x64
+        // _HMAP_ENTRY, 0x20 bytes with BlockAddress first). Blocks are not read.
+        //
+        typedef struct _BENCH_HIVE {
+            vector<UCHAR> Memory;
+            ULONG64 Reads;
+        } BENCH_HIVE, *PBENCH_HIVE;
+
+        const ULONG64 HiveBase = 0x10000;
+        const ULONG NumberOfCells = 1024 * 1024;
+        const ULONG NumberOfTables[HIVE_MAP_STORAGE_TYPES] = { 64, 4 }; // 128 MB stable, 8 MB volatile.
+        const ULONG EntrySize = 0x20;
+        BENCH_HIVE Bench;
+        vector<ULONG> Cells(NumberOfCells);
+        vector<ULONG64> Expected(NumberOfCells);
+        ULONG64 TableAddress = HiveBase + (HIVE_MAP_STORAGE_TYPES * HIVE_MAP_DIRECTORY_SIZE * sizeof(ULONG64));
+        ULONG64 Start, UncachedMs, CachedMs, WarmMs, UncachedReads, CachedReads, Mismatches = 0;
+        ULONG Seed = 0x12345678;
+
+        Bench.Reads = 0;
+        Bench.Memory.resize((SIZE_T)(TableAddress - HiveBase) +
+                            ((NumberOfTables[0] + NumberOfTables[1]) * HIVE_MAP_TABLE_SIZE * EntrySize));
+
+        for (ULONG Type = 0; Type < HIVE_MAP_STORAGE_TYPES; Type += 1)
+        {
+            for (ULONG Table = 0; Table < NumberOfTables[Type]; Table += 1)
+            {
+                ULONG64 Directory = HiveBase + (Type * HIVE_MAP_DIRECTORY_SIZE * sizeof(ULONG64));
+
+                *(PULONG64)&Bench.Memory[(SIZE_T)(Directory - HiveBase) + (Table * sizeof(ULONG64))] = TableAddress;
+
+                for (ULONG Block = 0; Block < HIVE_MAP_TABLE_SIZE; Block += 1)
+                {
+                    ULONG64 BlockAddress = 0xFFFFF8A000000000ULL | ((ULONG64)Type << 32) | (((Table * HIVE_MAP_TABLE_SIZE) + Block) * 0x1000ULL);
+
+                    *(PULONG64)&Bench.Memory[(SIZE_T)(TableAddress - HiveBase) + (Block * EntrySize)] = BlockAddress;
+                }
+
+                TableAddress += HIVE_MAP_TABLE_SIZE * EntrySize;
+            }
+        }
+
+        for (ULONG i = 0; i < NumberOfCells; i += 1)
+        {
+            ULONG Type, Table, Block, Offset;
+
+            Seed = (Seed * 1103515245) + 12345;
+            Type = ((Seed >> 16) % 16) ? 0 : 1;
+            Table = (Seed >> 8) % NumberOfTables[Type];
+            Seed = (Seed * 1103515245) + 12345;
+            Block = (Seed >> 16) % HIVE_MAP_TABLE_SIZE;
+            Offset = ((Seed >> 4) % HCELL_OFFSET_MASK) & ~7;
+
+            Cells[i] = (Type << HCELL_TYPE_SHIFT) | (Table << HCELL_TABLE_SHIFT) | (Block << HCELL_BLOCK_SHIFT) | Offset;
+        }
+
+        auto Reader = [](PVOID Context, ULONG64 Address, PVOID Buffer, ULONG Size) -> BOOLEAN
+        {
+            PBENCH_HIVE Bench = (PBENCH_HIVE)Context;
+
+            Bench->Reads += 1;
+            if ((Address < 0x10000) || ((Address - 0x10000 + Size) > Bench->Memory.size())) return FALSE;
+
+            memcpy(Buffer, &Bench->Memory[(SIZE_T)(Address - 0x10000)], Size);
+            return TRUE;
+        };
+
+        //
+        // Field by field, as the typed walk does: map, directory slot, block address, version.
+        //
+        Start = GetTickCount64();
+
+        for (ULONG i = 0; i < NumberOfCells; i += 1)
+        {
+            ULONG Type = (Cells[i] & HCELL_TYPE_MASK) >> HCELL_TYPE_SHIFT;
+            ULONG64 Directory = HiveBase + (Type * HIVE_MAP_DIRECTORY_SIZE * sizeof(ULONG64));
+            ULONG64 Map = 0, Table = 0, BlockAddress = 0;
+            ULONG Version = 0;
+
+            Reader(&Bench, HiveBase, &Map, sizeof(Map)); // Storage[Type].Map
+            Reader(&Bench, Directory + (((Cells[i] & HCELL_TABLE_MASK) >> HCELL_TABLE_SHIFT) * sizeof(ULONG64)), &Table, sizeof(Table));
+            Reader(&Bench, Table + (((Cells[i] & HCELL_BLOCK_MASK) >> HCELL_BLOCK_SHIFT) * EntrySize), &BlockAddress, sizeof(BlockAddress));
+            Reader(&Bench, HiveBase, &Version, sizeof(Version));
+
+            Expected[i] = BlockAddress + (Cells[i] & HCELL_OFFSET_MASK) + sizeof(LONG);
+        }
+
+        UncachedMs = GetTickCount64() - Start;
+        UncachedReads = Bench.Reads;
+
+        HiveMapCache Cache([](PVOID Context, ULONG64 Hive, HiveMapCache::PHIVE_MAP_LAYOUT Layout) -> BOOLEAN
+        {
+            UNREFERENCED_PARAMETER(Context);
+
+            Layout->Directory[0] = Hive;
+            Layout->Directory[1] = Hive + (HIVE_MAP_DIRECTORY_SIZE * sizeof(ULONG64));
+            Layout->DirectorySize[0] = HIVE_MAP_DIRECTORY_SIZE;
+            Layout->DirectorySize[1] = HIVE_MAP_DIRECTORY_SIZE;
+            Layout->PointerSize = sizeof(ULONG64);
+            Layout->EntrySize = 0x20;
+            Layout->BlockAddressOffset = 0;
+            Layout->CellHeaderSize = sizeof(LONG);
+            return TRUE;
+        }, Reader, &Bench);
+
+        Bench.Reads = 0;
+        Start = GetTickCount64();
+        for (ULONG i = 0; i < NumberOfCells; i += 1) Mismatches += (Cache.GetCellAddress(HiveBase, Cells[i]) != Expected[i]);
+        CachedMs = GetTickCount64() - Start;
+        CachedReads = Bench.Reads;
+
+        Start = GetTickCount64();
+        for (ULONG i = 0; i < NumberOfCells; i += 1) Mismatches += (Cache.GetCellAddress(HiveBase, Cells[i]) != Expected[i]);
+        WarmMs = GetTickCount64() - Start;
+
+        Dml("\n<col fg=\"changed\">[*] Cell translation (%d cells, %d map tables):</col>\n"
+            "     Field reads      %6I64d ms  %10I64d reads\n"
+            "     Map cache (cold) %6I64d ms  %10I64d reads  (%I64d tables)\n"
+            "     Map cache (warm) %6I64d ms  %10I64d reads\n"
+            "     Addresses        %s\n",
+            NumberOfCells, NumberOfTables[0] + NumberOfTables[1],
+            UncachedMs, UncachedReads,
+            CachedMs, CachedReads, Cache.m_Stats.Tables,
+            WarmMs, Bench.Reads - CachedReads,
+            Mismatches ? "<col fg=\"changed\">DIFFERENT</col>" : "identical");
+
+        return;
+    }
+
     vector<HIVE_OBJECT> Hives = GetHives();
 
     ULONG64 HiveAddr = GetArgU64("hive", FALSE);
@@ -1652,32 +2062,193 @@ EXT_COMMAND(ms_gdt,
 
 EXT_COMMAND(ms_malscore,
     "Analyze a memory space and returns a Malware Score Index (MSI) - (based on Frank Boldewin's work)",
-    "{;ed;base;Base address}{;ed;size;Memory space size}")
+    "{;ed,o;base;Base address}{;ed,o;size;Memory space size}"
+    "{bench;b,o;bench;Measure the scoring throughput and score checksum of a synthetic corpus}")
 {
-    ULONG64 BaseAddress = GetUnnamedArgU64(0);
-    ULONG Size = (ULONG)GetUnnamedArgU64(1);
+    ArenaScope Scope;
+    ULONG64 BaseAddress;
+    ULONG64 Size;
 
     LPBYTE Buffer = NULL;
 
+    if (HasArg("bench"))
+    {
+        const ULONG BenchSize = 16 * 1024 * 1024;
+        ULONG64 TotalBytes = 0, TotalMs = 0;
+        ULONG Checksum;
+        vector<MALSCORE_BENCH> Results;
+
+        //
+        // Shared with test/MalScoreBench, which runs it outside of the debugger.
+        //
+        if (!RunMalScoreBench(BenchSize, Results, &Checksum)) return;
+
+        Dml("\n<col fg=\"changed\">[*] MalScore throughput (%d MB per corpus, one idiom per 0x%X bytes):</col>\n",
+            BenchSize / (1024 * 1024), MALSCORE_CORPUS_STRIDE);
+
+        for (MALSCORE_BENCH& Bench : Results)
+        {
+            TotalBytes += BenchSize;
+            TotalMs += Bench.ElapsedMs;
+
+            Dml("     %-16s %6I64d ms  %6I64d MB/s  score %8d%s\n",
+                Bench.Name, Bench.ElapsedMs,
+                Bench.ElapsedMs ? ((ULONG64)BenchSize * 1000) / (Bench.ElapsedMs * 1024 * 1024) : 0ULL,
+                Bench.Score,
+                (Bench.ChunkedScore == Bench.Score) ? "" : "  <col fg=\"changed\">DIFFERENT in 64 KB chunks</col>");
+        }
+
+        Dml("     %-16s %6I64d ms  %6I64d MB/s  checksum <col fg=\"emphfg\">0x%08X</col>\n",
+            "Total", TotalMs,
+            TotalMs ? (TotalBytes * 1000) / (TotalMs * 1024 * 1024) : 0ULL,
+            Checksum);
+
+        //
+        // Scan scheduler scaling, on a synthetic image of 8 processes mapping parts of the
+        // random buffer. Scores must not depend on the number of workers.
+        //
+        vector<SCAN_REGION> Regions;
+        ULONG64 ReferenceSum = 0;
+        ULONG64 ReferenceMs = 0;
+        ULONG Seed = 0x12345678;
+
+        Buffer = (LPBYTE)malloc(BenchSize);
+        if (Buffer == NULL) return;
+
+        for (ULONG j = 0; j < BenchSize; j += 1)
+        {
+            Seed = (Seed * 1103515245) + 12345;
+            Buffer[j] = (UCHAR)(Seed >> 16);
+        }
+
+        for (ULONG Process = 0; Process < 8; Process += 1)
+        {
+            for (ULONG j = 0; j < 16; j += 1)
+            {
+                SCAN_REGION Region = { 0 };
+
+                Seed = (Seed * 1103515245) + 12345;
+
+                Region.Size = (64 * 1024) << ((Seed >> 16) % 6); // 64 KB to 2 MB.
+                Region.BaseAddress = ((ULONG64)(Process + 1) << 32) + (((Seed >> 8) % (BenchSize - Region.Size)) & ~(PAGE_SIZE - 1));
+                Region.Process = Process;
+                Region.Flags = MALSCORE_REGION_WRITABLE;
+                Regions.push_back(Region);
+            }
+        }
+
+        Dml("\n<col fg=\"changed\">[*] Scan scheduler scaling (%d processes, %d regions):</col>\n", 8, (ULONG)Regions.size());
+
+        for (ULONG Workers = 1; Workers <= max(g_Scheduler.GetWorkerCount(), 2UL); Workers *= 2)
+        {
+            ULONG64 Sum = 0;
+
+            ScanScheduler Scheduler([Buffer](ULONG64 ProcessObject, ULONG64 Address, LPBYTE Output, ULONG Length) -> BOOLEAN
+            {
+                UNREFERENCED_PARAMETER(ProcessObject);
+
+                memcpy(Output, Buffer + (ULONG)Address, Length);
+                return TRUE;
+            }, Workers, SCAN_MEMORY_BUDGET);
+
+            Scheduler.Run(Regions, [](const SCAN_PROGRESS& Progress) { UNREFERENCED_PARAMETER(Progress); });
+
+            for (SCAN_REGION& Region : Regions) Sum += Region.Score;
+
+            if (Workers == 1)
+            {
+                ReferenceSum = Sum;
+                ReferenceMs = Scheduler.m_Progress.ElapsedMs;
+            }
+
+            Dml("     %2d workers %6I64d ms  %6I64d MB/s  x%I64d.%02I64d  %I64d reads  (scores %s)\n",
+                Scheduler.m_Progress.Workers, Scheduler.m_Progress.ElapsedMs,
+                Scheduler.m_Progress.ElapsedMs ? (Scheduler.m_Progress.Bytes * 1000) / (Scheduler.m_Progress.ElapsedMs * 1024 * 1024) : 0ULL,
+                Scheduler.m_Progress.ElapsedMs ? ReferenceMs / Scheduler.m_Progress.ElapsedMs : 0ULL,
+                Scheduler.m_Progress.ElapsedMs ? ((ReferenceMs * 100) / Scheduler.m_Progress.ElapsedMs) % 100 : 0ULL,
+                Scheduler.m_Progress.Reads,
+                (Sum == ReferenceSum) ? "identical" : "<col fg=\"changed\">DIFFERENT</col>");
+        }
+
+        free(Buffer);
+        return;
+    }
+
+    if (!HasUnnamedArg(0) || !HasUnnamedArg(1))
+    {
+        Err("Error: base address and size required.\n");
+        return;
+    }
+
+    BaseAddress = GetUnnamedArgU64(0);
+    Size = GetUnnamedArgU64(1);
+
     Dml("   [ <col fg=\"changed\">Base:</col> <col fg=\"emphfg\">0x%016I64X</col>\n"
-        "   [ <col fg=\"changed\">Size:</col> <col fg=\"emphfg\">0x%X</col>\n",
+        "   [ <col fg=\"changed\">Size:</col> <col fg=\"emphfg\">0x%I64X</col>\n",
         BaseAddress, Size);
 
-    Buffer = (LPBYTE)malloc(Size);
+    //
+    // Read and scored a chunk at a time, large regions do not have to fit in memory.
+    //
+    ULONG MalwareScoreIndex = 0;
+    MALSCORE_DETAILS Details;
 
-    if (ExtRemoteTypedEx::ReadVirtual(BaseAddress, Buffer, Size, NULL) != S_OK)
+    if (!GetMalScoreStream(TRUE, BaseAddress, Size, ReadMalScoreRemote, &BaseAddress, 0, MALSCORE_REGION_WRITABLE, &MalwareScoreIndex, &Details))
     {
         Err("Error: Failed to read the memory buffer.\n");
-        goto CleanUp;
+        return;
     }
 
-    ULONG MalwareScoreIndex = GetMalScore(TRUE, BaseAddress, Buffer, Size);
+    if (Details.Entropy.NumberOfPages) OutEntropySummary("   ", &Details.Entropy);
 
     Dml("   -> <col fg=\"changed\">Malware Score Index (MSI)</col> = <col fg=\"emphfg\">%d</col>\n", MalwareScoreIndex);
+}
 
-CleanUp:
-    if (Buffer) free(Buffer);
+EXT_COMMAND(ms_rules,
+    "Load MalScore rules from a rule file, scored with the built-in patterns by !ms_malscore and !ms_process /scan",
+    "{;s,o;rulefile;Rule file (compiled rules are cached in <rulefile>.cache)}"
+    "{nocache;b,o;nocache;Compile the rules even if the cache is up to date, and do not write it}"
+    "{list;b,o;list;Display the loaded rules}"
+    "{unload;b,o;unload;Unload the rules}")
+{
+    if (HasArg("unload"))
+    {
+        UnloadMalScoreRules();
+        Dml("<col fg=\"changed\">[*] Rules unloaded.</col>\n");
+        return;
+    }
+
+    if (HasUnnamedArg(0))
+    {
+        LPCSTR FileName = GetUnnamedArgStr(0);
+        CHAR Error[MAX_PATH + 128];
+        BOOLEAN FromCache = FALSE;
+        ULONG64 Start = GetTickCount64();
+
+        if (!LoadMalScoreRules(FileName, !HasArg("nocache"), &FromCache, Error, sizeof(Error)))
+        {
+            Err("Error: %s\n", Error);
+            return;
+        }
 
+        Dml("<col fg=\"changed\">[*] %d rules (%d strings)</col> %s %s in %I64d ms\n",
+            (ULONG)g_MalScoreRules.m_Rules.size(), (ULONG)g_MalScoreRules.m_Strings.size(),
+            FromCache ? "loaded from the cache of" : "compiled from",
+            FileName, GetTickCount64() - Start);
+    }
+    else if (!HasArg("list"))
+    {
+        Dml("<col fg=\"changed\">[*] %d rules loaded.</col>\n", (ULONG)g_MalScoreRules.m_Rules.size());
+    }
+
+    if (HasArg("list"))
+    {
+        for (MalScoreRules::RULE& Rule : g_MalScoreRules.m_Rules)
+        {
+            Dml("    %-40s weight %4d  condition %d/%d\n",
+                Rule.Name.c_str(), Rule.Weight, Rule.Condition, Rule.NumberOfStrings);
+        }
+    }
 }
 
 EXT_COMMAND(ms_exqueue,
@@ -1709,4 +2280,562 @@ EXT_COMMAND(ms_store,
 
         StrMgr.SmiEnumCaches(CacheIndex);
     }
-}
\ No newline at end of file
+}
+
+EXT_COMMAND(ms_strings,
+    "Extract ASCII and UTF-16LE strings of a memory space, or index and search the ones of every process",
+    "{;e,o;base;Base address}{;e,o;size;Memory space size}"
+    "{min;ed,o;length;Minimum length in characters (default: 5)}"
+    "{index;s,o;file;Index the strings of every VAD of every process to this file}"
+    "{pid;ed,o;pid;Only index this process}"
+    "{max;ed,o;count;Maximum number of strings found (default: 100)}"
+    "{find;x,o;text;Search the index for strings containing text, case insensitive (last option)}")
+{
+    ArenaScope Scope;
+    ULONG MinLength = HasArg("min") ? (ULONG)GetArgU64("min", FALSE) : STRINGS_MIN_LENGTH;
+    LPCSTR IndexFile = HasArg("index") ? GetArgStr("index", FALSE) : NULL;
+    StringIndex Index;
+    vector<STRING_HIT> Hits;
+
+    if (IndexFile && HasArg("find"))
+    {
+        vector<StringIndex::INDEX_RESULT> Results;
+        ULONG MaxResults = HasArg("max") ? (ULONG)GetArgU64("max", FALSE) : STRINGS_MAX_RESULTS;
+
+        if (!Index.Open(IndexFile))
+        {
+            Err("Error: %s is not a valid string index.\n", IndexFile);
+            return;
+        }
+
+        if (!Index.Find(GetArgStr("find", FALSE), MaxResults, Results))
+        {
+            Err("Error: failed to read %s.\n", IndexFile);
+            return;
+        }
+
+        Dml("\n<col fg=\"changed\">[*] %d string(s) found</col> (%I64d indexed, %d processes)\n",
+            (ULONG)Results.size(), Index.m_NumberOfStrings, (ULONG)Index.m_Processes.size());
+
+        for (ULONG i = 0; i < Results.size(); i += 1)
+        {
+            StringIndex::PINDEX_PROCESS Process = &Index.m_Processes[Results[i].Process];
+
+            if ((i == 0) || (Results[i].Process != Results[i - 1].Process))
+            {
+                Dml("\n<col fg=\"changed\">Process:</col> <link cmd=\"!process %p 1\">%-20s</link> (PID=0x%4I64x)\n",
+                    Process->ProcessObject, Process->ImageFileName, Process->ProcessId);
+            }
+
+            OutString(Process->ProcessObject,
+                      Results[i].VadBase + Results[i].Offset,
+                      Results[i].Wide,
+                      Results[i].Length,
+                      Results[i].Text);
+        }
+
+        if (Results.size() == MaxResults) Dml("    ... more than %d string(s), see /max.\n", MaxResults);
+
+        return;
+    }
+
+    if (IndexFile)
+    {
+        ULONG64 Pid = GetArgU64("pid", FALSE);
+        ULONG64 Start = GetTickCount64();
+        ULONG64 Bytes = 0;
+
+        if (!Index.Create(IndexFile))
+        {
+            Err("Error: cannot create %s.\n", IndexFile);
+            return;
+        }
+
+        ProcessArray CachedProcessList = GetProcesses(Pid, 0);
+
+        //
+        // One pass over each VAD, strings are written out before the next one is read.
+        //
+        for (MsProcessObject& ProcObj : CachedProcessList)
+        {
+            ULONG Process = Index.AddProcess(ProcObj.m_CcProcessObject.ProcessId,
+                                             ProcObj.m_CcProcessObject.ProcessObjectPtr,
+                                             ProcObj.m_CcProcessObject.ImageFileName);
+            ULONG64 Strings = Index.m_NumberOfStrings;
+            BOOLEAN Failed = FALSE;
+
+            ProcObj.MmGetVads();
+            ProcObj.SwitchContext();
+
+            for (VAD_OBJECT& Vad : ProcObj.m_Vads)
+            {
+                ULONG64 BaseAddress = Vad.StartingVpn * PAGE_SIZE;
+                ULONG64 VadSize = (Vad.EndingVpn - Vad.StartingVpn + 1) * PAGE_SIZE;
+
+                Hits.clear();
+                GetStrings(VadSize, ReadMalScoreRemote, &BaseAddress, MinLength, Hits);
+                Bytes += VadSize;
+
+                if (!Index.Add(Process, BaseAddress, Hits))
+                {
+                    Failed = TRUE;
+                    break;
+                }
+            }
+
+            ProcObj.RestoreContext();
+
+            if (Failed)
+            {
+                Err("Error: failed to write %s.\n", IndexFile);
+                return;
+            }
+
+            Dml("<col fg=\"changed\">[*] Indexed</col> %-20s (PID=0x%4x) %6d VADs %10I64d strings\n",
+                ProcObj.m_CcProcessObject.ImageFileName, (ULONG)ProcObj.m_CcProcessObject.ProcessId,
+                (ULONG)ProcObj.m_Vads.size(), Index.m_NumberOfStrings - Strings);
+        }
+
+        if (!Index.Close())
+        {
+            Err("Error: failed to write %s.\n", IndexFile);
+            return;
+        }
+
+        Dml("\n<col fg=\"changed\">[*] %I64d strings</col> of %d processes (%I64d MB) indexed in %I64d ms to %s\n"
+            "    Search with !ms_strings /index %s /find text\n",
+            Index.m_NumberOfStrings, (ULONG)Index.m_Processes.size(), Bytes / (1024 * 1024),
+            GetTickCount64() - Start, IndexFile, IndexFile);
+
+        return;
+    }
+
+    if (!HasUnnamedArg(0) || !HasUnnamedArg(1))
+    {
+        Err("Error: base address and size, or /index required.\n");
+        return;
+    }
+
+    ULONG64 BaseAddress = GetUnnamedArgU64(0);
+    ULONG64 Size = GetUnnamedArgU64(1);
+
+    if (!GetStrings(Size, ReadMalScoreRemote, &BaseAddress, MinLength, Hits))
+    {
+        Err("Error: Failed to read the memory buffer.\n");
+        return;
+    }
+
+    //
+    // ASCII and UTF-16LE strings are found at the same time, they are listed by address.
+    //
+    sort(Hits.begin(), Hits.end(), [](const STRING_HIT& a, const STRING_HIT& b) { return a.Offset < b.Offset; });
+
+    for (STRING_HIT& Hit : Hits) OutString(0, BaseAddress + Hit.Offset, Hit.Wide, Hit.Length, Hit.Text);
+
+    Dml("\n    %d string(s).\n", (ULONG)Hits.size());
+}
+
+EXT_COMMAND(ms_hash,
+    "Compute MD5, SHA1, SHA256, ssdeep and TLSH of a memory space in one pass",
+    "{;e,o;base;Base address}"
+    "{;e,o;size;Memory space size (default: SizeOfImage of the image at base)}"
+    "{match;s,o;corpus;List the nearest known digests (\"name,ssdeep,tlsh\" lines)}"
+    "{bench;b,o;bench;Measure the hashing throughput on a synthetic buffer}")
+{
+    ArenaScope Scope;
+    HASH_DIGESTS Digests;
+    ULONG Features = GetHashFeatures();
+
+    if (HasArg("bench"))
+    {
+        const ULONG BenchSize = 64 * 1024 * 1024;
+        PUCHAR Buffer = (PUCHAR)malloc(BenchSize);
+        ULONG64 Start, Elapsed[6];
+
+        if (Buffer == NULL) return;
+
+        for (ULONG i = 0; i < BenchSize; i += 1) Buffer[i] = (UCHAR)((i * 2654435761UL) >> 24);
+
+        MD5_CONTEXT Md5Context = { 0 };
+        SHA1_CONTEXT Sha1Context;
+        SHA256_CONTEXT Sha256Context;
+
+        Start = GetTickCount64();
+        MD5Init(&Md5Context);
+        MD5Update(&Md5Context, Buffer, BenchSize);
+        MD5Final(&Md5Context);
+        Elapsed[0] = GetTickCount64() - Start;
+
+        Start = GetTickCount64();
+        SHA1Init(&Sha1Context);
+        SHA1Update(&Sha1Context, Buffer, BenchSize);
+        SHA1Final(&Sha1Context);
+        Elapsed[1] = GetTickCount64() - Start;
+
+        Start = GetTickCount64();
+        SHA256Init(&Sha256Context);
+        SHA256Update(&Sha256Context, Buffer, BenchSize);
+        SHA256Final(&Sha256Context);
+        Elapsed[2] = GetTickCount64() - Start;
+
+        Start = GetTickCount64();
+        MultiHash(Buffer, BenchSize, &Digests);
+        Elapsed[3] = GetTickCount64() - Start;
+
+        FUZZY_DIGESTS FuzzyDigests;
+
+        Start = GetTickCount64();
+        FuzzyHash(Buffer, BenchSize, &FuzzyDigests);
+        Elapsed[4] = GetTickCount64() - Start;
+
+        ENTROPY_SUMMARY EntropySummary;
+
+        Start = GetTickCount64();
+        GetEntropySummary(Buffer, BenchSize, &EntropySummary);
+        Elapsed[5] = GetTickCount64() - Start;
+
+        //
+        // Section-sized messages: reference MD5 one by one against the multi-buffer engine.
+        //
+        const ULONG SectionCount = 10000;
+        vector<MD5_JOB> Sections(SectionCount);
+        ULONG64 SectionBytes = 0, SectionElapsed[2];
+        ULONG Seed = 0x4d534d42, Mismatches = 0;
+
+        for (ULONG i = 0; i < SectionCount; i += 1)
+        {
+            Seed = (Seed * 1103515245) + 12345;
+            Sections[i].Length = 0x200 + ((Seed >> 8) % 0x8000);
+            Sections[i].Data = Buffer + ((Seed >> 4) % (BenchSize - Sections[i].Length));
+            SectionBytes += Sections[i].Length;
+        }
+
+        Start = GetTickCount64();
+        MD5MultiBuffer(Sections.data(), SectionCount);
+        SectionElapsed[1] = GetTickCount64() - Start;
+
+        Start = GetTickCount64();
+        for (ULONG i = 0; i < SectionCount; i += 1)
+        {
+            RtlZeroMemory(&Md5Context, sizeof(Md5Context));
+            MD5Init(&Md5Context);
+            MD5Update(&Md5Context, (PUCHAR)Sections[i].Data, (ULONG)Sections[i].Length);
+            MD5Final(&Md5Context);
+
+            if (memcmp(Md5Context.Digest, Sections[i].Digest, sizeof(Sections[i].Digest))) Mismatches += 1;
+        }
+        SectionElapsed[0] = GetTickCount64() - Start;
+
+        free(Buffer);
+
+        Dml("\n<col fg=\"changed\">[*] Hash throughput (%d MB, SHA-NI: %s, AVX2: %s):</col>\n",
+            BenchSize / (1024 * 1024),
+            (Features & HASH_FEATURE_SHANI) ? "Yes" : "No",
+            (Features & HASH_FEATURE_AVX2) ? "Yes" : "No");
+
+        LPCSTR Names[] = { "MD5", "SHA1", "SHA256", "MD5+SHA1+SHA256", "SSDEEP+TLSH", "Entropy map" };
+        for (ULONG i = 0; i < _countof(Names); i += 1)
+        {
+            Dml("     %-16s %6I64d ms  %6I64d MB/s\n",
+                Names[i], Elapsed[i],
+                Elapsed[i] ? ((ULONG64)BenchSize * 1000) / (Elapsed[i] * 1024 * 1024) : 0ULL);
+        }
+
+        Dml("\n<col fg=\"changed\">[*] MD5 of %d sections (%I64d MB, %d lanes):</col>\n",
+            SectionCount, SectionBytes / (1024 * 1024), MD5MultiBufferLanes());
+
+        LPCSTR SectionNames[] = { "Reference", "Multi-buffer" };
+        for (ULONG i = 0; i < _countof(SectionNames); i += 1)
+        {
+            Dml("     %-16s %6I64d ms  %6I64d MB/s\n",
+                SectionNames[i], SectionElapsed[i],
+                SectionElapsed[i] ? (SectionBytes * 1000) / (SectionElapsed[i] * 1024 * 1024) : 0ULL);
+        }
+
+        if (Mismatches) Err("Error: %d multi-buffer digests differ from MD5Final.\n", Mismatches);
+
+        return;
+    }
+
+    if (!HasUnnamedArg(0))
+    {
+        Err("Error: base address required.\n");
+        return;
+    }
+
+    ULONG64 BaseAddress = GetUnnamedArgU64(0);
+    ULONG64 Size = HasUnnamedArg(1) ? GetUnnamedArgU64(1) : 0ULL;
+
+    if (!Size)
+    {
+        PEFile Image;
+        IMAGE_IDENTITY Identity;
+
+        Image.m_ImageBase = BaseAddress;
+        if (!g_ImageCache.GetIdentity(&Image, &Identity))
+        {
+            Err("Error: no PE image at 0x%016I64X, a size is required.\n", BaseAddress);
+            return;
+        }
+
+        Size = Identity.Key.SizeOfImage;
+    }
+
+    HashStream Stream(ReadVirtualPages);
+    STREAM_DIGESTS StreamDigests;
+
+    if (!Stream.HashVirtual(BaseAddress, Size, &StreamDigests))
+    {
+        Err("Error: not enough memory.\n");
+        return;
+    }
+
+    Dml("   [ <col fg=\"changed\">Base:</col> <col fg=\"emphfg\">0x%016I64X</col>\n"
+        "   [ <col fg=\"changed\">Size:</col> <col fg=\"emphfg\">0x%I64X</col>\n",
+        BaseAddress, Size);
+    OutStreamDigests("     ", &StreamDigests);
+
+    if (HasArg("match"))
+    {
+        FuzzyIndex Corpus;
+        vector<FuzzyIndex::FUZZY_MATCH> Matches;
+        LPCSTR CorpusFile = GetArgStr("match", FALSE);
+        ULONG Count;
+
+        Count = Corpus.Load(CorpusFile);
+        if (!Count)
+        {
+            Err("Error: no digest loaded from %s.\n", CorpusFile);
+        }
+        else
+        {
+            Corpus.Find(&StreamDigests.Fuzzy, FUZZY_MATCH_MAX_TLSH_DISTANCE, FUZZY_MATCH_MAX_RESULTS, Matches);
+
+            Dml("     <col fg=\"changed\">%d nearest of %d known digests:</col>\n", (ULONG)Matches.size(), Count);
+
+            for (FuzzyIndex::FUZZY_MATCH& Match : Matches)
+            {
+                CHAR Score[16] = "-", Distance[16] = "-";
+
+                if (Match.CtphScore) sprintf_s(Score, sizeof(Score), "%d", Match.CtphScore);
+                if (Match.TlshDistance != MAXULONG) sprintf_s(Distance, sizeof(Distance), "%d", Match.TlshDistance);
+
+                Dml("     ssdeep %3s  tlsh %4s  %s\n", Score, Distance, Corpus.m_Entries[Match.Index].Name.c_str());
+            }
+        }
+    }
+
+    //
+    // Unreadable ranges, contiguous pages are merged.
+    //
+    ULONG64 PageBase = BaseAddress & ~((ULONG64)PAGE_SIZE - 1);
+
+    for (ULONG Page = 0; Page < StreamDigests.NumberOfPages; Page += 1)
+    {
+        ULONG First = Page;
+
+        if (Stream.IsPageReadable(Page)) continue;
+        while (((Page + 1) < StreamDigests.NumberOfPages) && !Stream.IsPageReadable(Page + 1)) Page += 1;
+
+        Dml("     Unreadable: 0x%016I64X - 0x%016I64X (%d pages)\n",
+            PageBase + ((ULONG64)First * PAGE_SIZE),
+            PageBase + ((ULONG64)(Page + 1) * PAGE_SIZE),
+            Page + 1 - First);
+    }
+}
+
+EXT_COMMAND(ms_integrity,
+    "Compare kernel modules in memory with reference binaries",
+    "{;e,o;;}"
+    "{ref;s;path;Directory containing the reference binaries}"
+    "{module;s,o;name;Only check this module (e.g. ntoskrnl.exe)}"
+    "{all;b,o;all;Also list clean and skipped modules}")
+{
+    ArenaScope Scope;
+    LPCSTR ReferenceArg = GetArgStr("ref", FALSE);
+    LPCSTR ModuleArg = HasArg("module") ? GetArgStr("module", FALSE) : NULL;
+    WCHAR ReferenceDirectory[MAX_PATH];
+    WCHAR ModuleName[MAX_PATH] = { 0 };
+
+    swprintf_s(ReferenceDirectory, _countof(ReferenceDirectory), L"%S", ReferenceArg);
+    if (ModuleArg) swprintf_s(ModuleName, _countof(ModuleName), L"%S", ModuleArg);
+
+    vector<MsDllObject> Modules;
+
+    for (MsDllObject& Module : GetKernelModules())
+    {
+        if (ModuleArg && _wcsicmp(Module.mm_CcDllObject.DllName, ModuleName)) continue;
+        Modules.push_back(move(Module));
+    }
+
+    if (Modules.empty())
+    {
+        Err("Error: no matching kernel module.\n");
+        return;
+    }
+
+    vector<ImageIntegrity> Checks(Modules.size());
+    LPCSTR StatusNames[] = { "Not checked", "Clean", "Patched", "No reference", "Invalid reference", "Version mismatch", "Failed" };
+    ULONG Counts[_countof(StatusNames)] = { 0 };
+
+    CheckImagesIntegrity(Modules, ReferenceDirectory, Checks);
+
+    Dml("\n<col fg=\"changed\">[*] Kernel modules integrity (%S):</col>\n"
+        "    %-18s %-24s %-18s %8s %8s %8s\n",
+        ReferenceDirectory, "Base", "Name", "Status", "Pages", "Same", "Paged");
+
+    for (ULONG i = 0; i < Modules.size(); i += 1)
+    {
+        ImageIntegrity& Check = Checks[i];
+
+        Counts[Check.m_Status] += 1;
+
+        if ((Check.m_Status != IntegrityPatched) && !HasArg("all") && !ModuleArg) continue;
+
+        Dml("    0x%016I64X %-24S <col fg=\"%s\">%-18s</col> %8d %8d %8d\n",
+            Modules[i].m_ImageBase,
+            Modules[i].mm_CcDllObject.DllName,
+            (Check.m_Status == IntegrityPatched) ? "changed" : "emphfg",
+            StatusNames[Check.m_Status],
+            Check.m_NumberOfPages,
+            Check.m_NumberOfIdenticalPages,
+            Check.m_NumberOfNonResidentPages);
+
+        for (INTEGRITY_PATCH& Patch : Check.m_Patches)
+        {
+            CHAR Symbol[MAX_PATH] = { 0 };
+            CHAR Memory[INTEGRITY_PATCH_BYTES * 3 + 1] = { 0 };
+            CHAR Reference[INTEGRITY_PATCH_BYTES * 3 + 1] = { 0 };
+            ULONG Shown = min(Patch.Size, (ULONG)INTEGRITY_PATCH_BYTES);
+
+            for (ULONG j = 0; j < Shown; j += 1)
+            {
+                sprintf_s(Memory + (j * 3), sizeof(Memory) - (j * 3), "%02X ", Patch.Memory[j]);
+                sprintf_s(Reference + (j * 3), sizeof(Reference) - (j * 3), "%02X ", Patch.Reference[j]);
+            }
+
+            Dml("        %-8s +0x%08X <link cmd=\"u 0x%016I64X\">0x%016I64X</link> %5d byte(s) %s\n"
+                "            Memory:    %s\n"
+                "            Reference: %s\n",
+                Patch.Section, Patch.Rva,
+                Check.m_ImageBase + Patch.Rva, Check.m_ImageBase + Patch.Rva,
+                Patch.Size,
+                GetNameByOffset(Check.m_ImageBase + Patch.Rva, (PSTR)Symbol, _countof(Symbol)),
+                Memory, Reference);
+        }
+
+        if (Check.m_Truncated) Dml("        ... more than %d ranges, is the reference file the right build?\n", INTEGRITY_MAX_PATCHES);
+    }
+
+    Dml("\n    %d module(s): %d clean, %d patched, %d without reference, %d invalid, %d version mismatch, %d failed.\n",
+        (ULONG)Modules.size(),
+        Counts[IntegrityClean], Counts[IntegrityPatched], Counts[IntegrityNoReference],
+        Counts[IntegrityInvalidReference], Counts[IntegrityVersionMismatch], Counts[IntegrityFailed]);
+}
+
+EXT_COMMAND(ms_stats,
+    "Display internal cache and worker pool statistics",
+    "{;e,o;;}"
+    "{reset;b,o;reset;Reset the counters}"
+    "{flush;b,o;flush;Flush the caches}")
+{
+    SymbolCache::PSYMBOL_CACHE_STATS SymStats = &g_SymbolCache.m_Stats;
+    ULONG64 SymHits = SymStats->Hits + SymStats->NegativeHits;
+
+    Dml("\n<col fg=\"changed\">[*] Symbol cache (GetNameByOffset):</col>\n"
+        "     Lookups:         %I64d\n"
+        "     Hits:            %I64d (%I64d negative)\n"
+        "     Misses:          %I64d\n"
+        "     Evictions:       %I64d\n"
+        "     Uncacheable:     %I64d\n"
+        "     Hit rate:        <col fg=\"emphfg\">%I64d%%</col>\n",
+        SymStats->Lookups,
+        SymHits, SymStats->NegativeHits,
+        SymStats->Misses,
+        SymStats->Evictions,
+        SymStats->Uncacheable,
+        SymStats->Lookups ? (SymHits * 100) / SymStats->Lookups : 0ULL);
+
+    CodeCache::PCODE_CACHE_STATS CodeStats = &g_CodeCache.m_Stats;
+
+    Dml("\n<col fg=\"changed\">[*] Code cache (inline hook checks):</col>\n"
+        "     Scans:           %I64d (%I64d hooked, %I64d outside of modules)\n"
+        "     Page lookups:    %I64d (%I64d hits, %I64d unreadable)\n"
+        "     Module lists:    %I64d\n",
+        CodeStats->Scans, CodeStats->Hooks, CodeStats->NoModule,
+        CodeStats->PageLookups, CodeStats->PageHits, CodeStats->PageFailures,
+        CodeStats->ModuleLists);
+
+    TaskScheduler::PSCHEDULER_STATS SchedStats = &g_Scheduler.m_Stats;
+    Arena::PARENA_STATS ArenaStats = &g_CommandArena.m_Stats;
+
+    Dml("\n<col fg=\"changed\">[*] Worker pool:</col>\n"
+        "     Workers:         %d\n"
+        "     Runs:            %I64d (%I64d tasks, %I64d ms)\n"
+        "     Failures:        %I64d task(s) threw, %I64d worker(s) not created\n"
+        "     Last run:        %d tasks on %d workers in %I64d ms, %d failed\n",
+        g_Scheduler.GetWorkerCount(),
+        SchedStats->Runs, SchedStats->Tasks, SchedStats->ElapsedMs,
+        SchedStats->Failures, SchedStats->ThreadFailures,
+        SchedStats->LastTasks, SchedStats->LastWorkers, SchedStats->LastElapsedMs, SchedStats->LastFailures);
+
+    Dml("\n<col fg=\"changed\">[*] Command arena:</col>\n"
+        "     Allocations:     %I64d (%I64d heap allocations)\n"
+        "     Bytes:           %I64d (peak %I64d)\n"
+        "     Resets:          %I64d\n",
+        ArenaStats->Allocations, ArenaStats->Chunks,
+        ArenaStats->Bytes, ArenaStats->PeakBytes,
+        ArenaStats->Resets);
+
+    ImageCache::PIMAGE_CACHE_STATS ImgStats = &g_ImageCache.m_Stats;
+
+    Dml("\n<col fg=\"changed\">[*] Image cache (PE metadata):</col>\n"
+        "     Lookups:         %I64d\n"
+        "     Hits:            %I64d\n"
+        "     Misses:          %I64d (%I64d page mismatches)\n"
+        "     Insertions:      %I64d\n"
+        "     Sections:        %I64d reused, %I64d rehashed (%I64d unreadable)\n"
+        "     Hit rate:        <col fg=\"emphfg\">%I64d%%</col>\n",
+        ImgStats->Lookups,
+        ImgStats->Hits,
+        ImgStats->Misses, ImgStats->PageMismatches,
+        ImgStats->Insertions,
+        ImgStats->SectionsReused, ImgStats->SectionsRehashed, ImgStats->SectionsUnreadable,
+        ImgStats->Lookups ? (ImgStats->Hits * 100) / ImgStats->Lookups : 0ULL);
+
+    ExportIndex::PEXPORT_INDEX_STATS ExpStats = &g_ExportIndex.m_Stats;
+
+    Dml("\n<col fg=\"changed\">[*] Export index (IAT checks):</col>\n"
+        "     Modules:         %I64d (%I64d entries)\n"
+        "     Lookups:         %I64d (%I64d found, %I64d forwarded)\n",
+        ExpStats->Modules, ExpStats->Entries,
+        ExpStats->Lookups, ExpStats->Hits, ExpStats->Forwards);
+
+    HiveMapCache::PHIVE_MAP_CACHE_STATS HiveStats = &g_HiveMapCache.m_Stats;
+
+    Dml("\n<col fg=\"changed\">[*] Hive map cache (registry cells):</col>\n"
+        "     Lookups:         %I64d (%I64d hits, %I64d failed)\n"
+        "     Map tables:      %I64d of %I64d hives (%I64d reads)\n",
+        HiveStats->Lookups, HiveStats->Hits, HiveStats->Failures,
+        HiveStats->Tables, HiveStats->Hives, HiveStats->Reads);
+
+    if (HasArg("flush"))
+    {
+        g_SymbolCache.Flush();
+        g_CodeCache.Flush();
+        g_ImageCache.Flush();
+        g_ExportIndex.Flush();
+        g_HiveMapCache.Flush();
+    }
+
+    if (HasArg("reset"))
+    {
+        g_SymbolCache.ResetStats();
+        g_CodeCache.ResetStats();
+        g_ImageCache.ResetStats();
+        g_ExportIndex.ResetStats();
+        g_HiveMapCache.ResetStats();
+        g_Scheduler.ResetStats();
+        g_CommandArena.ResetStats();
+    }
+}
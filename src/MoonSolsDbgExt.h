@@ -49,7 +49,13 @@ Revision History:
 
 #include <iostream>
 #include <vector>
+#include <deque>
 #include <map>
+#include <unordered_map>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <thread>
 using namespace std;
 
 #if JSON_SUPPORT
@@ -68,15 +74,38 @@ using namespace web::http::client;
 
 #pragma once
 #include "engextcpp.hpp"
+#include "SymbolCache.h"
+#include "Scheduler.h"
+#include "Entropy.h"
+#include "Spray.h"
+#include "ScanScheduler.h"
+#include "Arena.h"
+#include "Md5.h"
+#include "Hash.h"
+#include "Md5Mb.h"
+#include "VersionInfo.h"
+#include "FuzzyHash.h"
+#include "Strings.h"
+#include "Disasm.h"
+#include "CodeCache.h"
+#include "HiveMapCache.h"
+#include "RegFile.h"
+#include "ImageIdentity.h"
+#include "PatternMatcher.h"
+#include "MalRules.h"
 #include "EngExpCppEx.h"
+#include "HashStream.h"
 #include "UntypedData.h"
 
 #include "NtDef.h"
 #include "DbgHelpEx.h"
+#include "ImageCache.h"
+#include "ExportIndex.h"
 
 #include "Credentials.h"
 #include "Process.h"
 #include "Drivers.h"
+#include "Integrity.h"
 #include "Registry.h"
 #include "Network.h"
 #include "System.h"
@@ -87,11 +116,8 @@ using namespace web::http::client;
 
 #include "Objects.h"
 
-#include "Md5.h"
-
 #include "Output.h"
 
-#pragma comment(lib, "version.lib")
 #if JSON_SUPPORT
 #pragma comment(lib, "cpprest120_1_4.lib")
 #endif
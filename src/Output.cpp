@@ -93,6 +93,8 @@ OutDriver(
 {
     MsDriverObject::PFAST_IO_DISPATCH FastIo = NULL;
     UCHAR Name[512] = { 0 };
+    LPSTR MajorNames = NULL;
+    ULONG MajorCount = _countof(Driver->mm_DriverInfo.MajorFunction);
 
     g_Ext->Dml("    | <col fg=\"emphfg\">%-32S</col> | <link cmd=\"!ms_drivers /object 0x%016I64X\">0x%016I64x</link> | 0x%08X | %S\n",
         Driver->mm_DriverInfo.DriverName, Driver->m_ObjectPtr,
@@ -101,14 +103,23 @@ OutDriver(
 
     if (!ExpandFlag) return;
 
+    //
+    // Most of the IRP_MJ_* entries point to the same routine (e.g. IopInvalidDeviceRequest).
+    //
+    MajorNames = (LPSTR)malloc(MajorCount * sizeof(Name));
+    if (MajorNames) GetNamesByOffsets(MajorCount, Driver->mm_DriverInfo.MajorFunction, MajorNames, sizeof(Name));
+
     for (UINT i = 0; IrpMajor[i]; i += 1)
     {
         g_Ext->Dml("    \\---| %-32s | 0x%I64X | <col fg=\"changed\">%-6s</col> | %s\n",
             IrpMajor[i], Driver->mm_DriverInfo.MajorFunction[i],
             IsPointerHooked(Driver->mm_DriverInfo.MajorFunction[i]) ? "Hooked" : "",
-            GetNameByOffset(Driver->mm_DriverInfo.MajorFunction[i], (LPSTR)Name, _countof(Name)));
+            MajorNames ? MajorNames + (i * sizeof(Name)) :
+                         GetNameByOffset(Driver->mm_DriverInfo.MajorFunction[i], (LPSTR)Name, _countof(Name)));
     }
 
+    if (MajorNames) free(MajorNames);
+
     FastIo = &Driver->mm_DriverInfo.FastIoDispatch;
 
     if (FastIo->FastIoCheckIfPossible)
@@ -362,4 +373,184 @@ OutDriver(
             IsPointerHooked(FastIo->ReleaseForCcFlush) ? "Hooked" : "",
             GetNameByOffset(FastIo->ReleaseForCcFlush, (LPSTR)Name, _countof(Name)));
     }
-}
\ No newline at end of file
+}
+
+VOID
+OutDigests(
+    LPCSTR Indent,
+    PHASH_DIGESTS Digests
+)
+{
+    g_Ext->Dml("%sMD5:    ", Indent);
+    for (ULONG i = 0; i < sizeof(Digests->Md5); i += 1) g_Ext->Dml("%02x", Digests->Md5[i]);
+    g_Ext->Dml("\n%sSHA1:   ", Indent);
+    for (ULONG i = 0; i < sizeof(Digests->Sha1); i += 1) g_Ext->Dml("%02x", Digests->Sha1[i]);
+    g_Ext->Dml("\n%sSHA256: ", Indent);
+    for (ULONG i = 0; i < sizeof(Digests->Sha256); i += 1) g_Ext->Dml("%02x", Digests->Sha256[i]);
+    g_Ext->Dml("\n");
+}
+
+VOID
+OutFuzzyDigests(
+    LPCSTR Indent,
+    PFUZZY_DIGESTS Digests
+)
+{
+    CHAR Tlsh[TLSH_STRING_SIZE];
+
+    TlshToString(&Digests->Tlsh, Tlsh, sizeof(Tlsh));
+
+    g_Ext->Dml("%sSSDEEP: %s\n", Indent, Digests->Ctph);
+    g_Ext->Dml("%sTLSH:   %s\n", Indent, Digests->Tlsh.Valid ? Tlsh : "-");
+}
+
+VOID
+OutMalScore(
+    LPCSTR Format,
+    va_list Args
+)
+{
+    g_Ext->m_Control->ControlledOutputVaList(DEBUG_OUTCTL_AMBIENT_DML, g_Ext->m_OutMask, Format, Args);
+}
+
+VOID
+OutEntropySummary(
+    LPCSTR Indent,
+    PENTROPY_SUMMARY Summary
+)
+{
+    g_Ext->Dml("%sEntropy: %d.%02d (max %d.%02d, %d/%d high pages) [%s]\n",
+               Indent,
+               Summary->Entropy / ENTROPY_SCALE, ((Summary->Entropy % ENTROPY_SCALE) * 100) / ENTROPY_SCALE,
+               Summary->MaxPageEntropy / ENTROPY_SCALE, ((Summary->MaxPageEntropy % ENTROPY_SCALE) * 100) / ENTROPY_SCALE,
+               Summary->NumberOfHighPages, Summary->NumberOfPages,
+               Summary->Map);
+}
+
+VOID
+OutString(
+    ULONG64 ProcessObjectPtr,
+    ULONG64 Address,
+    BOOLEAN Wide,
+    ULONG Length,
+    const string& Text
+)
+{
+    CHAR Context[64] = { 0 };
+    string Escaped;
+
+    for (CHAR c : Text)
+    {
+        if (c == '<') Escaped += "&lt;";
+        else if (c == '>') Escaped += "&gt;";
+        else if (c == '&') Escaped += "&amp;";
+        else if (c == '\t') Escaped += ' ';
+        else Escaped += c;
+    }
+
+    if (Length > Text.size()) Escaped += "...";
+
+    if (ProcessObjectPtr) sprintf_s(Context, sizeof(Context), ".process /p /r 0x%016I64X; ", ProcessObjectPtr);
+
+    g_Ext->Dml("    <link cmd=\"%s%s 0x%016I64X\">0x%016I64X</link> %s %5d %s\n",
+               Context, Wide ? "du" : "da", Address, Address,
+               Wide ? "W" : "A", Length,
+               Escaped.c_str());
+}
+
+VOID
+OutStreamDigests(
+    LPCSTR Indent,
+    PSTREAM_DIGESTS Digests
+)
+{
+    OutDigests(Indent, &Digests->AsRead);
+    OutFuzzyDigests(Indent, &Digests->Fuzzy);
+
+    if (Digests->NumberOfUnreadablePages)
+    {
+        g_Ext->Dml("%s<col fg=\"changed\">%d of %d pages unreadable (hashed as zeroes above), readable pages only:</col>\n",
+            Indent, Digests->NumberOfUnreadablePages, Digests->NumberOfPages);
+        OutDigests(Indent, &Digests->Readable);
+    }
+}
+
+VOID
+OutImageHashes(
+    PEFile *Image
+)
+{
+    if (Image->m_HasImageHashes)
+    {
+        g_Ext->Dml("    <col fg=\"emphfg\">Image:</col> (0x%I64X, 0x%I64X bytes)\n", Image->m_ImageBase, Image->m_ImageHashes.Size);
+        OutStreamDigests("        ", &Image->m_ImageHashes);
+    }
+
+    if (Image->m_HasImpHash)
+    {
+        g_Ext->Dml("    <col fg=\"emphfg\">Imphash:</col> ");
+        for (ULONG i = 0; i < sizeof(Image->m_ImpHash); i += 1) g_Ext->Dml("%02x", Image->m_ImpHash[i]);
+        g_Ext->Dml("\n");
+    }
+
+    for (PEFile::CACHED_SECTION_INFO& Section : Image->m_CcSections)
+    {
+        HASH_DIGESTS Digests;
+
+        memcpy(Digests.Md5, Section.VaMd5Hash, sizeof(Digests.Md5));
+        memcpy(Digests.Sha1, Section.VaSha1Hash, sizeof(Digests.Sha1));
+        memcpy(Digests.Sha256, Section.VaSha256Hash, sizeof(Digests.Sha256));
+
+        g_Ext->Dml("    <col fg=\"emphfg\">Section %-8s</col> (+0x%X, 0x%X bytes)\n", Section.Name, Section.VaBase, Section.VaSize);
+
+        if (!Section.VaHashValid)
+        {
+            g_Ext->Dml("        <col fg=\"changed\">Section could not be read</col>\n");
+            continue;
+        }
+
+        OutDigests("        ", &Digests);
+        OutFuzzyDigests("        ", &Section.VaFuzzy);
+        OutEntropySummary("        ", &Section.VaEntropy);
+
+        if (Section.IsExecutable && (Section.VaEntropy.NumberOfHighPages >= MALSCORE_ENTROPY_RUN_PAGES))
+        {
+            g_Ext->Dml("        <col fg=\"changed\">Executable section with high entropy pages (packed?)</col>\n");
+        }
+    }
+}
+
+VOID
+OutImports(
+    PEFile *Image,
+    ULONG64 ProcessObjectPtr,
+    BOOLEAN HookedOnly
+)
+{
+    if (HookedOnly && !Image->m_NumberOfHookedImports) return;
+
+    g_Ext->Dml("    |--------------------------------------------------------------|--------------------|--------------------|--------|\n"
+               "    | <col fg=\"emphfg\">%-60s</col> | <col fg=\"emphfg\">%-18s</col> | <col fg=\"emphfg\">%-18s</col> | <col fg=\"emphfg\">%-6s</col> |\n"
+               "    |--------------------------------------------------------------|--------------------|--------------------|--------|\n",
+               "Import", "IAT entry", "Expected", "Hooked");
+
+    for (PEFile::IMPORT_INFO& Import : Image->m_Imports)
+    {
+        CHAR Function[256];
+
+        if (HookedOnly && !Import.IsHooked) continue;
+
+        if (Import.Name[0]) sprintf_s(Function, sizeof(Function), "%s!%s", Import.ModuleName, Import.Name);
+        else sprintf_s(Function, sizeof(Function), "%s!#%d", Import.ModuleName, Import.Ordinal);
+
+        g_Ext->Dml("    | %-60s | <link cmd=\".process /p /r 0x%016I64X; u 0x%016I64X L3\">0x%016I64X</link> | ",
+                   Function, ProcessObjectPtr, Import.Address, Import.Address);
+
+        if (Import.IsResolved) g_Ext->Dml("0x%016I64X | ", Import.Expected);
+        else g_Ext->Dml("%-18s | ", "Unknown");
+
+        g_Ext->Dml("<col fg=\"changed\">%-6s</col> |\n", Import.IsHooked ? "Yes" : "No");
+    }
+
+    g_Ext->Dml("\n");
+}
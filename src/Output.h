@@ -54,4 +54,65 @@ OutDriver(
     ULONG ExpandFlag
 );
 
+VOID
+OutDigests(
+    LPCSTR Indent,
+    PHASH_DIGESTS Digests
+);
+
+VOID
+OutFuzzyDigests(
+    LPCSTR Indent,
+    PFUZZY_DIGESTS Digests
+);
+
+VOID
+OutStreamDigests(
+    LPCSTR Indent,
+    PSTREAM_DIGESTS Digests
+);
+
+//
+// g_MalScoreOutput of the extension, DML to the debugger output.
+//
+VOID
+OutMalScore(
+    LPCSTR Format,
+    va_list Args
+);
+
+//
+// Entropy in bits per byte, high pages count and the map, one line.
+//
+VOID
+OutEntropySummary(
+    LPCSTR Indent,
+    PENTROPY_SUMMARY Summary
+);
+
+//
+// Address (a link to db/du in the process, in the current one if ProcessObjectPtr is 0),
+// A or W, length and the text with the DML markup escaped.
+//
+VOID
+OutString(
+    ULONG64 ProcessObjectPtr,
+    ULONG64 Address,
+    BOOLEAN Wide,
+    ULONG Length,
+    const string& Text
+);
+
+VOID
+OutImageHashes(
+    PEFile *Image
+);
+
+VOID
+OutImports(
+    PEFile *Image,
+    ULONG64 ProcessObjectPtr,
+    BOOLEAN HookedOnly
+);
+
 #endif
\ No newline at end of file
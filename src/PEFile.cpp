@@ -0,0 +1,810 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - PEFile.cpp
+
+Abstract:
+
+    - PEFile parsing of a captured image: exports, imports, resources, version,
+      PDB and section hashes. Uses m_Image only, never the target, so that it
+      runs on the worker pool (see GetProcesses()).
+    - Capture and the checks made in the target are in DbgHelpEx.cpp.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <functional>
+#include <vector>
+#include <string>
+#include <algorithm>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "FuzzyHash.h"
+#include "Entropy.h"
+#include "HashStream.h"
+#include "Arena.h"
+#include "Disasm.h"
+#include "VersionInfo.h"
+#include "ImageIdentity.h"
+#include "DbgHelpEx.h"
+
+PIMAGE_RESOURCE_DIRECTORY_ENTRY
+PEFile::RtlFindRessourceEntry(
+    ULONG DirectoryOffset,
+    ULONG Id
+)
+{
+    ULONG ResRva = m_Image.DataDirectory[IMAGE_DIRECTORY_ENTRY_RESOURCE].VirtualAddress;
+    ULONG ResSize = m_Image.DataDirectory[IMAGE_DIRECTORY_ENTRY_RESOURCE].Size;
+    PIMAGE_RESOURCE_DIRECTORY ImgResDir;
+    PIMAGE_RESOURCE_DIRECTORY_ENTRY ImgResDirEntry;
+    ULONG First, Count;
+
+    if ((DirectoryOffset > ResSize) || ((ResSize - DirectoryOffset) < sizeof(IMAGE_RESOURCE_DIRECTORY))) return NULL;
+
+    ImgResDir = (PIMAGE_RESOURCE_DIRECTORY)((PUCHAR)m_Image.Image + ResRva + DirectoryOffset);
+    ImgResDirEntry = (PIMAGE_RESOURCE_DIRECTORY_ENTRY)(ImgResDir + 1);
+
+    //
+    // Named entries come first, then the entries identified by an integer.
+    //
+    First = ImgResDir->NumberOfNamedEntries;
+    Count = First + ImgResDir->NumberOfIdEntries;
+
+    if ((((ULONG64)Count * sizeof(IMAGE_RESOURCE_DIRECTORY_ENTRY)) + sizeof(IMAGE_RESOURCE_DIRECTORY)) > (ResSize - DirectoryOffset))
+    {
+        return NULL;
+    }
+
+    if (Id == RESOURCE_ANY_ID) return Count ? &ImgResDirEntry[0] : NULL;
+
+    for (ULONG Index = First; Index < Count; Index += 1)
+    {
+        if (!ImgResDirEntry[Index].NameIsString && (ImgResDirEntry[Index].Id == Id)) return &ImgResDirEntry[Index];
+    }
+
+    return NULL;
+}
+
+PVOID
+PEFile::RtlGetRessourceData(
+    ULONG Name,
+    ULONG Type,
+    PULONG Size
+)
+{
+    PIMAGE_RESOURCE_DIRECTORY_ENTRY ImgResDirEntry;
+    PIMAGE_RESOURCE_DATA_ENTRY ImgResDataEntry;
+
+    ULONG ResSize;
+    ULONG Offset;
+
+    if (!m_Image.Initialized || !m_ImageSize) return NULL;
+
+    ResSize = m_Image.DataDirectory[IMAGE_DIRECTORY_ENTRY_RESOURCE].Size;
+    if (!m_Image.DataDirectory[IMAGE_DIRECTORY_ENTRY_RESOURCE].VirtualAddress ||
+        (((ULONG64)m_Image.DataDirectory[IMAGE_DIRECTORY_ENTRY_RESOURCE].VirtualAddress + ResSize) > m_ImageSize)) return NULL;
+
+    //
+    // Type, then name, then the first language.
+    //
+    ImgResDirEntry = RtlFindRessourceEntry(0, Type);
+    if ((ImgResDirEntry == NULL) || !ImgResDirEntry->DataIsDirectory) return NULL;
+
+    ImgResDirEntry = RtlFindRessourceEntry(ImgResDirEntry->OffsetToDirectory, Name);
+    if ((ImgResDirEntry == NULL) || !ImgResDirEntry->DataIsDirectory) return NULL;
+
+    ImgResDirEntry = RtlFindRessourceEntry(ImgResDirEntry->OffsetToDirectory, RESOURCE_ANY_ID);
+    if ((ImgResDirEntry == NULL) || ImgResDirEntry->DataIsDirectory) return NULL;
+
+    Offset = ImgResDirEntry->OffsetToData;
+    if ((Offset > ResSize) || ((ResSize - Offset) < sizeof(IMAGE_RESOURCE_DATA_ENTRY))) return NULL;
+
+    ImgResDataEntry = (PIMAGE_RESOURCE_DATA_ENTRY)((PUCHAR)m_Image.Image + m_Image.DataDirectory[IMAGE_DIRECTORY_ENTRY_RESOURCE].VirtualAddress + Offset);
+
+    //
+    // OffsetToData is an RVA, the data is used in place.
+    //
+    if (((ULONG64)ImgResDataEntry->OffsetToData + ImgResDataEntry->Size) > m_ImageSize) return NULL;
+
+    *Size = ImgResDataEntry->Size;
+
+    return (PUCHAR)m_Image.Image + ImgResDataEntry->OffsetToData;
+}
+
+BOOLEAN
+PEFile::RtlGetPdbInfo(
+)
+{
+    BOOLEAN Result = FALSE;
+    PIMAGE_DEBUG_DIRECTORY DbgDir = NULL;
+    PCV_INFO_PDB70 PdbInfo = NULL;
+    ULONG Offset;
+    ULONG Len;
+
+    if (!m_Image.Initialized) goto CleanUp;
+
+    //
+    // Both records must be inside of the image, the name may not be terminated.
+    //
+    Offset = m_Image.DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG].VirtualAddress;
+    if (!Offset || (((ULONG64)Offset + sizeof(IMAGE_DEBUG_DIRECTORY)) > m_ImageSize)) goto CleanUp;
+    DbgDir = (PIMAGE_DEBUG_DIRECTORY)(((PUCHAR)m_Image.Image) + Offset);
+
+    Offset = DbgDir->AddressOfRawData;
+    if (!Offset || (((ULONG64)Offset + FIELD_OFFSET(CV_INFO_PDB70, PdbFileName)) > m_ImageSize)) goto CleanUp;
+    PdbInfo = (PCV_INFO_PDB70)(((PUCHAR)m_Image.Image) + Offset);
+
+    if (PdbInfo->Signature == CV_SIGNATURE_RSDS)
+    {
+        m_PdbInfo.Guid = PdbInfo->Guid;
+        m_PdbInfo.Age = PdbInfo->Age;
+
+        Len = (ULONG)strnlen_s(PdbInfo->PdbFileName,
+                               min((ULONG)sizeof(m_PdbInfo.PdbName) - 1, m_ImageSize - Offset - FIELD_OFFSET(CV_INFO_PDB70, PdbFileName)));
+        memcpy_s(m_PdbInfo.PdbName, sizeof(m_PdbInfo.PdbName), PdbInfo->PdbFileName, Len);
+        m_PdbInfo.PdbName[Len] = '\0';
+        Result = TRUE;
+    }
+
+CleanUp:
+    return Result;
+}
+
+BOOLEAN
+PEFile::RtlGetExports(
+)
+{
+    BOOLEAN Result = FALSE;
+    PIMAGE_EXPORT_DIRECTORY ExportDir = NULL;
+
+    ULONG DirRva, DirSize;
+
+    PULONG AddressOfNames;
+    PUSHORT AddressOfNameOrdinals;
+    PULONG AddressOfFunctions;
+
+    vector<BOOLEAN> Named;
+    PUCHAR Image = ((PUCHAR)m_Image.Image);
+
+    ULONG NumberOfHookedAPIs = 0;
+    ULONG i;
+
+    if (!m_Image.Initialized) goto CleanUp;
+
+    DirRva = m_Image.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].VirtualAddress;
+    DirSize = m_Image.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].Size;
+
+    if (!DirSize || !DirRva || (DirRva >= m_ImageSize)) goto CleanUp;
+    if ((m_ImageSize - DirRva) < sizeof(IMAGE_EXPORT_DIRECTORY)) goto CleanUp;
+
+    ExportDir = (PIMAGE_EXPORT_DIRECTORY)(Image + DirRva);
+
+    //
+    // Tables are usually inside of the export directory, but only need to be inside of the image.
+    //
+    if ((((ULONG64)ExportDir->AddressOfFunctions + ((ULONG64)ExportDir->NumberOfFunctions * sizeof(ULONG))) > m_ImageSize) ||
+        (((ULONG64)ExportDir->AddressOfNames + ((ULONG64)ExportDir->NumberOfNames * sizeof(ULONG))) > m_ImageSize) ||
+        (((ULONG64)ExportDir->AddressOfNameOrdinals + ((ULONG64)ExportDir->NumberOfNames * sizeof(USHORT))) > m_ImageSize))
+    {
+        goto CleanUp;
+    }
+
+    AddressOfNames = (PULONG)(Image + (ULONG)ExportDir->AddressOfNames);
+    AddressOfNameOrdinals = (PUSHORT)(Image + (ULONG)ExportDir->AddressOfNameOrdinals);
+    AddressOfFunctions = (PULONG)(Image + (ULONG)ExportDir->AddressOfFunctions);
+
+
+    m_OrdinalBase = ExportDir->Base;
+
+    //
+    // Named exports first (in name order), then functions only exported by ordinal.
+    //
+    Named.assign(ExportDir->NumberOfFunctions, FALSE);
+
+    m_Exports.reserve(max(ExportDir->NumberOfNames, ExportDir->NumberOfFunctions));
+
+    for (i = 0; i < (ExportDir->NumberOfNames + ExportDir->NumberOfFunctions); i += 1)
+    {
+        EXPORT_INFO ExportInfo = { 0 };
+        ULONG Ordinal;
+        ULONG NameRva = 0;
+
+        if (i < ExportDir->NumberOfNames)
+        {
+            Ordinal = AddressOfNameOrdinals[i];
+            if (Ordinal >= ExportDir->NumberOfFunctions) continue;
+
+            Named[Ordinal] = TRUE;
+            NameRva = AddressOfNames[i];
+        }
+        else
+        {
+            Ordinal = i - ExportDir->NumberOfNames;
+            if (Named[Ordinal]) continue;
+        }
+
+        ExportInfo.Address = AddressOfFunctions[Ordinal];
+
+        //
+        // Unused slot of the function table.
+        //
+        if (!ExportInfo.Address && !NameRva) continue;
+
+        ExportInfo.Index = (ULONG)m_Exports.size();
+        ExportInfo.Ordinal = Ordinal;
+
+        if ((ExportInfo.Address >= DirRva) && (ExportInfo.Address < ((ULONG64)DirRva + DirSize)))
+        {
+            //
+            // Forwarded to another module, the entry points to "DLL.Function" or "DLL.#Ordinal".
+            //
+            ULONG Len = (ULONG)strnlen_s((LPSTR)(Image + ExportInfo.Address),
+                                         min((ULONG)sizeof(ExportInfo.Forwarder) - 1, m_ImageSize - (ULONG)ExportInfo.Address));
+
+            ExportInfo.IsForwarder = TRUE;
+            memcpy_s(ExportInfo.Forwarder, sizeof(ExportInfo.Forwarder), Image + ExportInfo.Address, Len);
+        }
+        else
+        {
+            ExportInfo.IsTablePatched = (ExportInfo.Address >= m_ImageSize) ? TRUE : FALSE;
+        }
+
+        //
+        // The image has already been captured, the first instructions are followed in the
+        // local copy. Targets outside of the image are probed later by RtlProbeRemoteExports().
+        //
+        if (!ExportInfo.IsTablePatched && !ExportInfo.IsForwarder)
+        {
+            X86_HOOK Hook;
+
+            ExportInfo.IsHooked = X86FindHook(Image + ExportInfo.Address,
+                                              min((ULONG)HOOK_SCAN_SIZE, m_ImageSize - (ULONG)ExportInfo.Address),
+                                              m_ImageBase + ExportInfo.Address,
+                                              (m_Image.NtHeader64 != NULL),
+                                              m_ImageBase,
+                                              m_ImageBase + m_ImageSize,
+                                              HOOK_SCAN_DEPTH,
+                                              &Hook);
+
+            ExportInfo.HookType = Hook.Type;
+            ExportInfo.HookOffset = Hook.Offset;
+            ExportInfo.HookTarget = Hook.Target;
+        }
+
+        if (ExportInfo.IsTablePatched || ExportInfo.IsHooked) NumberOfHookedAPIs++;
+
+        if (i < ExportDir->NumberOfNames)
+        {
+            ULONG Len = 0;
+
+            if (NameRva < m_ImageSize)
+            {
+                Len = (ULONG)strnlen_s((LPSTR)(Image + NameRva), min((ULONG)sizeof(ExportInfo.Name) - 1, m_ImageSize - NameRva));
+            }
+
+            if (Len)
+            {
+                memcpy_s(ExportInfo.Name, sizeof(ExportInfo.Name), (LPSTR)(Image + NameRva), Len);
+            }
+            else
+            {
+                strcpy_s(ExportInfo.Name, sizeof(ExportInfo.Name), "*unreadable*");
+            }
+        }
+
+        m_Exports.push_back(ExportInfo);
+    }
+
+    m_NumberOfExportedFunctions = (ULONG)m_Exports.size();
+    m_NumberOfHookedAPIs = NumberOfHookedAPIs;
+
+    RtlBuildExportIndex();
+
+    Result = TRUE;
+
+CleanUp:
+    return Result;
+}
+
+static
+ULONG
+HashExportName(
+    LPCSTR Name
+)
+{
+    ULONG Hash = 2166136261UL; // FNV-1a
+
+    while (*Name)
+    {
+        Hash ^= (UCHAR)*Name++;
+        Hash *= 16777619UL;
+    }
+
+    return Hash;
+}
+
+VOID
+PEFile::RtlBuildExportIndex(
+)
+{
+    ULONG Size = 16;
+
+    while (Size < (m_Exports.size() * 2)) Size <<= 1;
+
+    m_ExportNameIndex.assign(Size, 0);
+    m_ExportRvaIndex.resize(m_Exports.size());
+
+    for (ULONG Index = 0; Index < m_Exports.size(); Index += 1)
+    {
+        m_ExportRvaIndex[Index] = Index;
+
+        if (!m_Exports[Index].Name[0]) continue;
+
+        for (ULONG Slot = HashExportName(m_Exports[Index].Name) & (Size - 1);; Slot = (Slot + 1) & (Size - 1))
+        {
+            if (!m_ExportNameIndex[Slot])
+            {
+                m_ExportNameIndex[Slot] = Index + 1;
+                break;
+            }
+        }
+    }
+
+    ArenaVector<EXPORT_INFO>& Exports = m_Exports;
+    stable_sort(m_ExportRvaIndex.begin(), m_ExportRvaIndex.end(),
+                [&Exports](ULONG a, ULONG b) { return Exports[a].Address < Exports[b].Address; });
+}
+
+PEFile::PEXPORT_INFO
+PEFile::RtlFindExportByName(
+    LPCSTR Name
+)
+{
+    ULONG Size = (ULONG)m_ExportNameIndex.size();
+
+    if (!Size || !Name || !Name[0]) return NULL;
+
+    for (ULONG Slot = HashExportName(Name) & (Size - 1); m_ExportNameIndex[Slot]; Slot = (Slot + 1) & (Size - 1))
+    {
+        PEXPORT_INFO ExportInfo = &m_Exports[m_ExportNameIndex[Slot] - 1];
+
+        if (strcmp(ExportInfo->Name, Name) == 0) return ExportInfo;
+    }
+
+    return NULL;
+}
+
+PEFile::PEXPORT_INFO
+PEFile::RtlFindExportByAddress(
+    ULONG64 Rva
+)
+{
+    ArenaVector<ULONG>::iterator It;
+    ArenaVector<EXPORT_INFO>& Exports = m_Exports;
+
+    //
+    // Closest export at or below Rva, forwarders have no code in this image.
+    //
+    It = upper_bound(m_ExportRvaIndex.begin(), m_ExportRvaIndex.end(), Rva,
+                     [&Exports](ULONG64 Value, ULONG Index) { return Value < Exports[Index].Address; });
+
+    while (It != m_ExportRvaIndex.begin())
+    {
+        --It;
+        if (!Exports[*It].IsForwarder) return &Exports[*It];
+    }
+
+    return NULL;
+}
+
+BOOLEAN
+PEFile::RtlWalkImports(
+    function<VOID(LPCSTR, LPCSTR, ULONG, ULONG)> Callback
+)
+{
+    BOOLEAN Result = FALSE;
+    PIMAGE_IMPORT_DESCRIPTOR Descriptor;
+    PUCHAR Image = ((PUCHAR)m_Image.Image);
+
+    ULONG DirRva, DirSize;
+    ULONG ThunkSize;
+    ULONG64 OrdinalFlag;
+
+    if (!m_Image.Initialized) goto CleanUp;
+
+    DirRva = m_Image.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT].VirtualAddress;
+    DirSize = m_Image.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT].Size;
+
+    if (!DirSize || !DirRva || (DirRva >= m_ImageSize)) goto CleanUp;
+
+    ThunkSize = m_Image.NtHeader64 ? sizeof(ULONG64) : sizeof(ULONG);
+    OrdinalFlag = m_Image.NtHeader64 ? IMAGE_ORDINAL_FLAG64 : IMAGE_ORDINAL_FLAG32;
+
+    //
+    // The descriptor array is terminated by an empty entry, the directory size is not reliable.
+    //
+    for (Descriptor = (PIMAGE_IMPORT_DESCRIPTOR)(Image + DirRva);
+         ((PUCHAR)(Descriptor + 1) <= (Image + m_ImageSize)) && Descriptor->Name;
+         Descriptor += 1)
+    {
+        CHAR ModuleName[64] = { 0 };
+        ULONG Len;
+
+        //
+        // Without lookup table, names are lost once the loader filled the IAT.
+        //
+        if (!Descriptor->OriginalFirstThunk || !Descriptor->FirstThunk) continue;
+        if ((Descriptor->Name >= m_ImageSize) ||
+            (Descriptor->OriginalFirstThunk >= m_ImageSize) ||
+            (Descriptor->FirstThunk >= m_ImageSize)) continue;
+
+        Len = (ULONG)strnlen_s((LPSTR)(Image + Descriptor->Name), min((ULONG)sizeof(ModuleName) - 1, m_ImageSize - Descriptor->Name));
+        memcpy_s(ModuleName, sizeof(ModuleName), Image + Descriptor->Name, Len);
+
+        for (ULONG Index = 0;; Index += 1)
+        {
+            CHAR Name[128] = { 0 };
+            ULONG Ordinal = 0;
+            ULONG64 LookupRva = (ULONG64)Descriptor->OriginalFirstThunk + ((ULONG64)Index * ThunkSize);
+            ULONG64 Thunk = 0;
+
+            if ((LookupRva + ThunkSize) > m_ImageSize) break;
+            if (((ULONG64)Descriptor->FirstThunk + (((ULONG64)Index + 1) * ThunkSize)) > m_ImageSize) break;
+
+            memcpy_s(&Thunk, sizeof(Thunk), Image + LookupRva, ThunkSize);
+            if (!Thunk) break;
+
+            if (Thunk & OrdinalFlag)
+            {
+                Ordinal = (ULONG)IMAGE_ORDINAL64(Thunk);
+            }
+            else
+            {
+                ULONG NameRva = (ULONG)Thunk + FIELD_OFFSET(IMAGE_IMPORT_BY_NAME, Name);
+
+                if (NameRva >= m_ImageSize) continue;
+
+                Len = (ULONG)strnlen_s((LPSTR)(Image + NameRva), min((ULONG)sizeof(Name) - 1, m_ImageSize - NameRva));
+                memcpy_s(Name, sizeof(Name), Image + NameRva, Len);
+            }
+
+            Callback(ModuleName, Name, Ordinal, Descriptor->FirstThunk + (Index * ThunkSize));
+        }
+    }
+
+    Result = TRUE;
+
+CleanUp:
+    return Result;
+}
+
+BOOLEAN
+PEFile::RtlGetImports(
+)
+{
+    if (!m_Image.Initialized) return FALSE;
+
+    m_ImportThunkSize = m_Image.NtHeader64 ? sizeof(ULONG64) : sizeof(ULONG);
+
+    return RtlWalkImports([this](LPCSTR ModuleName, LPCSTR Name, ULONG Ordinal, ULONG IatRva)
+    {
+        IMPORT_INFO ImportInfo = { 0 };
+
+        strcpy_s(ImportInfo.ModuleName, sizeof(ImportInfo.ModuleName), ModuleName);
+        strcpy_s(ImportInfo.Name, sizeof(ImportInfo.Name), Name);
+        ImportInfo.Ordinal = Ordinal;
+        ImportInfo.IatRva = IatRva;
+
+        m_Imports.push_back(ImportInfo);
+    });
+}
+
+//
+// pefile resolves the Winsock 1.1 ordinals, wsock32.dll and ws2_32.dll share them.
+//
+static const struct {
+    USHORT Ordinal;
+    LPCSTR Name;
+} ImpHashWinsockOrdinals[] = {
+    { 1, "accept" }, { 2, "bind" }, { 3, "closesocket" }, { 4, "connect" },
+    { 5, "getpeername" }, { 6, "getsockname" }, { 7, "getsockopt" }, { 8, "htonl" },
+    { 9, "htons" }, { 10, "ioctlsocket" }, { 11, "inet_addr" }, { 12, "inet_ntoa" },
+    { 13, "listen" }, { 14, "ntohl" }, { 15, "ntohs" }, { 16, "recv" },
+    { 17, "recvfrom" }, { 18, "select" }, { 19, "send" }, { 20, "sendto" },
+    { 21, "setsockopt" }, { 22, "shutdown" }, { 23, "socket" },
+    { 51, "gethostbyaddr" }, { 52, "gethostbyname" }, { 53, "getprotobyname" },
+    { 54, "getprotobynumber" }, { 55, "getservbyname" }, { 56, "getservbyport" },
+    { 57, "gethostname" },
+    { 101, "wsaasyncselect" }, { 102, "wsaasyncgethostbyaddr" }, { 103, "wsaasyncgethostbyname" },
+    { 104, "wsaasyncgetprotobynumber" }, { 105, "wsaasyncgetprotobyname" },
+    { 106, "wsaasyncgetservbyport" }, { 107, "wsaasyncgetservbyname" },
+    { 108, "wsacancelasyncrequest" }, { 109, "wsasetblockinghook" },
+    { 110, "wsaunhookblockinghook" }, { 111, "wsagetlasterror" }, { 112, "wsasetlasterror" },
+    { 113, "wsacancelblockingcall" }, { 114, "wsaisblocking" }, { 115, "wsastartup" },
+    { 116, "wsacleanup" }, { 151, "__wsafdisset" }
+};
+
+BOOLEAN
+PEFile::RtlGetImpHash(
+)
+{
+    string List;
+    MD5_CONTEXT Md5Context = { 0 };
+
+    m_HasImpHash = FALSE;
+
+    RtlWalkImports([&List](LPCSTR ModuleName, LPCSTR Name, ULONG Ordinal, ULONG IatRva)
+    {
+        CHAR Module[64];
+        CHAR Function[128];
+        LPSTR Extension;
+
+        UNREFERENCED_PARAMETER(IatRva);
+
+        //
+        // Lower case, without .dll, .ocx or .sys extension.
+        //
+        strcpy_s(Module, sizeof(Module), ModuleName);
+        _strlwr_s(Module, sizeof(Module));
+
+        Extension = strrchr(Module, '.');
+        if (Extension && (!strcmp(Extension, ".dll") || !strcmp(Extension, ".ocx") || !strcmp(Extension, ".sys"))) *Extension = '\0';
+
+        if (Name[0])
+        {
+            strcpy_s(Function, sizeof(Function), Name);
+            _strlwr_s(Function, sizeof(Function));
+        }
+        else
+        {
+            sprintf_s(Function, sizeof(Function), "ord%d", Ordinal);
+
+            if (!strcmp(Module, "ws2_32") || !strcmp(Module, "wsock32"))
+            {
+                for (ULONG i = 0; i < _countof(ImpHashWinsockOrdinals); i += 1)
+                {
+                    if (ImpHashWinsockOrdinals[i].Ordinal != Ordinal) continue;
+
+                    strcpy_s(Function, sizeof(Function), ImpHashWinsockOrdinals[i].Name);
+                    break;
+                }
+            }
+        }
+
+        if (!List.empty()) List += ',';
+        List += Module;
+        List += '.';
+        List += Function;
+    });
+
+    if (List.empty()) return FALSE;
+
+    MD5Init(&Md5Context);
+    MD5Update(&Md5Context, (PUCHAR)List.data(), (ULONG)List.size());
+    MD5Final(&Md5Context);
+
+    memcpy_s(m_ImpHash, sizeof(m_ImpHash), Md5Context.Digest, sizeof(Md5Context.Digest));
+    m_HasImpHash = TRUE;
+
+    return TRUE;
+}
+
+BOOLEAN
+PEFile::RtlGetFileVersion(
+)
+{
+    PVOID RessourceData;
+    ULONG RessourceSize = 0;
+    VERSION_INFO VersionInfo;
+
+    RessourceData = RtlGetRessourceData(VS_VERSION_INFO, (ULONG)RT_VERSION, &RessourceSize);
+    if (RessourceData == NULL) return TRUE;
+
+    if (!VerParseVersionInfo((PUCHAR)RessourceData, RessourceSize, &VersionInfo)) return TRUE;
+
+    VerCopyString(&VersionInfo.Strings[VersionProductVersion],
+        (PUSHORT)m_FileVersion.ProductVersion, _countof(m_FileVersion.ProductVersion));
+    VerCopyString(&VersionInfo.Strings[VersionFileVersion],
+        (PUSHORT)m_FileVersion.FileVersion, _countof(m_FileVersion.FileVersion));
+    VerCopyString(&VersionInfo.Strings[VersionCompanyName],
+        (PUSHORT)m_FileVersion.CompanyName, _countof(m_FileVersion.CompanyName));
+    VerCopyString(&VersionInfo.Strings[VersionFileDescription],
+        (PUSHORT)m_FileVersion.FileDescription, _countof(m_FileVersion.FileDescription));
+
+    //
+    // No StringFileInfo, fall back on VS_FIXEDFILEINFO.
+    //
+    if (VersionInfo.HasFixedInfo && !m_FileVersion.FileVersion[0])
+    {
+        swprintf_s(m_FileVersion.FileVersion, _countof(m_FileVersion.FileVersion), L"%d.%d.%d.%d",
+            HIWORD(VersionInfo.FileVersionMS), LOWORD(VersionInfo.FileVersionMS),
+            HIWORD(VersionInfo.FileVersionLS), LOWORD(VersionInfo.FileVersionLS));
+    }
+
+    if (VersionInfo.HasFixedInfo && !m_FileVersion.ProductVersion[0])
+    {
+        swprintf_s(m_FileVersion.ProductVersion, _countof(m_FileVersion.ProductVersion), L"%d.%d.%d.%d",
+            HIWORD(VersionInfo.ProductVersionMS), LOWORD(VersionInfo.ProductVersionMS),
+            HIWORD(VersionInfo.ProductVersionLS), LOWORD(VersionInfo.ProductVersionLS));
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+PEFile::RtlGetSections(
+)
+{
+    vector<HASH_JOB> Jobs;
+    ULONG Index;
+
+    m_CcSections.reserve(m_Image.NumberOfSections);
+    Jobs.reserve(m_Image.NumberOfSections);
+
+    for (Index = 0; Index < m_Image.NumberOfSections; Index += 1)
+    {
+        CACHED_SECTION_INFO SectionInfo = { 0 };
+        HASH_JOB Job;
+
+        memcpy_s(SectionInfo.Name, sizeof(SectionInfo.Name),
+            m_Image.Sections[Index].Name, sizeof(m_Image.Sections[Index].Name));
+        SectionInfo.VaBase = m_Image.Sections[Index].VirtualAddress;
+        SectionInfo.VaSize = m_Image.Sections[Index].SizeOfRawData;
+        SectionInfo.Characteristics = m_Image.Sections[Index].Characteristics;
+        SectionInfo.IsExecutable = (SectionInfo.Characteristics & IMAGE_SCN_MEM_EXECUTE) ? TRUE : FALSE;
+
+        //
+        // Raw data past the end of the image is not mapped.
+        //
+        if (SectionInfo.VaBase >= m_ImageSize) continue;
+        SectionInfo.VaSize = min(SectionInfo.VaSize, m_ImageSize - SectionInfo.VaBase);
+
+        Job.Data = (PUCHAR)m_Image.Image + SectionInfo.VaBase;
+        Job.Length = SectionInfo.VaSize;
+        Jobs.push_back(Job);
+
+        m_CcSections.push_back(SectionInfo);
+    }
+
+    //
+    // Sections are small, their MD5 are computed side by side.
+    //
+    MultiHashBatch(Jobs.data(), (ULONG)Jobs.size());
+
+    for (Index = 0; Index < Jobs.size(); Index += 1)
+    {
+        PCACHED_SECTION_INFO SectionInfo = &m_CcSections[Index];
+        PHASH_DIGESTS Digests = &Jobs[Index].Digests;
+
+        memcpy_s(SectionInfo->VaMd5Hash, sizeof(SectionInfo->VaMd5Hash), Digests->Md5, sizeof(Digests->Md5));
+        memcpy_s(SectionInfo->VaSha1Hash, sizeof(SectionInfo->VaSha1Hash), Digests->Sha1, sizeof(Digests->Sha1));
+        memcpy_s(SectionInfo->VaSha256Hash, sizeof(SectionInfo->VaSha256Hash), Digests->Sha256, sizeof(Digests->Sha256));
+
+        //
+        // Right behind the exact hashes, the section is still in the cache.
+        //
+        FuzzyHash(Jobs[Index].Data, Jobs[Index].Length, &SectionInfo->VaFuzzy);
+        GetEntropySummary(Jobs[Index].Data, Jobs[Index].Length, &SectionInfo->VaEntropy);
+        SectionInfo->VaHashValid = TRUE;
+
+        // VirusTotal::GetReport(Digests->Md5);
+    }
+
+    return TRUE;
+}
+
+//
+// Version, PDB, imphash and section hashes. Uses m_Image only (see GetProcesses()).
+//
+BOOLEAN
+PEFile::ParseImage(
+)
+{
+    if (!m_Image.Initialized) return FALSE;
+
+    RtlGetFileVersion();
+
+    RtlGetPdbInfo();
+
+    RtlGetImpHash();
+
+    RtlGetSections();
+
+    return TRUE;
+}
+
+//
+// Image is captured (mapped layout), ImageSize bytes long. The headers must be inside of it,
+// section headers past its end are ignored.
+//
+BOOLEAN
+PEFile::SetImage(
+    PVOID Image,
+    ULONG ImageSize
+)
+{
+    PIMAGE_DOS_HEADER DosHeader = (PIMAGE_DOS_HEADER)Image;
+    PIMAGE_NT_HEADERS32 NtHeader32;
+    ULONG NtHeaderOffset;
+    ULONG SectionsOffset;
+
+    RtlZeroMemory(&m_Image, sizeof(m_Image));
+
+    if ((Image == NULL) || (ImageSize < sizeof(IMAGE_DOS_HEADER))) return FALSE;
+
+    NtHeaderOffset = (ULONG)DosHeader->e_lfanew;
+    if (((ULONG64)NtHeaderOffset + sizeof(IMAGE_NT_HEADERS32)) > ImageSize) return FALSE;
+
+    NtHeader32 = (PIMAGE_NT_HEADERS32)((PUCHAR)Image + NtHeaderOffset);
+
+    if (NtHeader32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC)
+    {
+        if (((ULONG64)NtHeaderOffset + sizeof(IMAGE_NT_HEADERS64)) > ImageSize) return FALSE;
+
+        m_Image.NtHeader64 = (PIMAGE_NT_HEADERS64)NtHeader32;
+        m_Image.DataDirectory = (PIMAGE_DATA_DIRECTORY)m_Image.NtHeader64->OptionalHeader.DataDirectory;
+        m_Image.Sections = (PIMAGE_SECTION_HEADER)(m_Image.NtHeader64 + 1);
+        m_Image.NumberOfSections = m_Image.NtHeader64->FileHeader.NumberOfSections;
+    }
+    else if (NtHeader32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC)
+    {
+        m_Image.NtHeader32 = NtHeader32;
+        m_Image.DataDirectory = (PIMAGE_DATA_DIRECTORY)m_Image.NtHeader32->OptionalHeader.DataDirectory;
+        m_Image.Sections = (PIMAGE_SECTION_HEADER)(m_Image.NtHeader32 + 1);
+        m_Image.NumberOfSections = m_Image.NtHeader32->FileHeader.NumberOfSections;
+    }
+    else
+    {
+        return FALSE;
+    }
+
+    SectionsOffset = (ULONG)((PUCHAR)m_Image.Sections - (PUCHAR)Image);
+    m_Image.NumberOfSections = min(m_Image.NumberOfSections, (ULONG)((ImageSize - SectionsOffset) / sizeof(IMAGE_SECTION_HEADER)));
+
+    m_Image.Image = DosHeader;
+    m_ImageSize = ImageSize;
+    m_Image.Initialized = TRUE;
+
+    return TRUE;
+}
+
+VOID
+PEFile::Free(void)
+{
+    //
+    // The image buffer belongs to the arena it has been allocated from.
+    //
+    RtlZeroMemory(&m_Image, sizeof(m_Image));
+}
@@ -0,0 +1,625 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - PatternMatcher.cpp
+
+Abstract:
+
+    - Each pattern is looked up through its longest run of significant bytes,
+      the rest of it is verified when that run is found. The automaton is a
+      full transition table over byte classes, one lookup per input byte. When
+      that table would be too large, only the shallowest states keep a full row
+      and the deeper ones sparse transitions with failure links.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+using namespace std;
+
+#include "PatternMatcher.h"
+
+PatternMatcher::PatternMatcher(
+) :
+    m_MaxLength(0),
+    m_NumberOfClasses(1),
+    m_NumberOfStates(0),
+    m_NumberOfDenseStates(0)
+{
+    RtlZeroMemory(m_Classes, sizeof(m_Classes));
+}
+
+BOOLEAN
+PatternMatcher::Add(
+    ULONG Id,
+    const UCHAR *Bytes,
+    const UCHAR *Mask,
+    ULONG Length
+)
+{
+    PATTERN Pattern;
+    ULONG Run = 0;
+
+    Pattern.Id = Id;
+    Pattern.Length = Length;
+    Pattern.AnchorOffset = 0;
+    Pattern.AnchorLength = 0;
+    Pattern.Bytes.assign(Bytes, Bytes + Length);
+    Pattern.Mask.assign(Length, 0xFF);
+    if (Mask) Pattern.Mask.assign(Mask, Mask + Length);
+
+    for (ULONG i = 0; i < Length; i += 1)
+    {
+        Run = Pattern.Mask[i] ? (Run + 1) : 0;
+
+        if (Run > Pattern.AnchorLength)
+        {
+            Pattern.AnchorLength = Run;
+            Pattern.AnchorOffset = i + 1 - Run;
+        }
+    }
+
+    if (!Pattern.AnchorLength) return FALSE;
+
+    Pattern.Verify = (Pattern.AnchorLength != Length);
+
+    m_MaxLength = max(m_MaxLength, Length);
+    m_Patterns.push_back(Pattern);
+
+    return TRUE;
+}
+
+BOOLEAN
+PatternMatcher::AddHex(
+    ULONG Id,
+    LPCSTR Hex
+)
+{
+    vector<UCHAR> Bytes, Mask;
+    ULONG Len = (ULONG)strlen(Hex);
+
+    if (!Len || (Len % 2)) return FALSE;
+
+    for (ULONG i = 0; i < Len; i += 2)
+    {
+        CHAR Digits[3] = { Hex[i], Hex[i + 1], '\0' };
+        LPSTR End;
+
+        if ((Digits[0] == '?') && (Digits[1] == '?'))
+        {
+            Bytes.push_back(0);
+            Mask.push_back(0);
+            continue;
+        }
+
+        Bytes.push_back((UCHAR)strtoul(Digits, &End, 16));
+        Mask.push_back(0xFF);
+
+        if (*End != '\0') return FALSE;
+    }
+
+    return Add(Id, &Bytes[0], &Mask[0], (ULONG)Bytes.size());
+}
+
+VOID
+PatternMatcher::Compile(
+)
+{
+    vector<map<UCHAR, ULONG>> Goto(1);
+    vector<vector<ULONG>> Outputs(1);
+    vector<ULONG> Fail, Queue, Order, Number;
+
+    //
+    // Byte classes: a distinct class for every byte found in an anchor.
+    //
+    RtlZeroMemory(m_Classes, sizeof(m_Classes));
+    m_NumberOfClasses = 1;
+
+    for (ULONG i = 0; i < m_Patterns.size(); i += 1)
+    {
+        PPATTERN Pattern = &m_Patterns[i];
+
+        for (ULONG j = 0; j < Pattern->AnchorLength; j += 1)
+        {
+            UCHAR Byte = Pattern->Bytes[Pattern->AnchorOffset + j];
+            if (!m_Classes[Byte]) m_Classes[Byte] = (UCHAR)m_NumberOfClasses++;
+        }
+    }
+
+    //
+    // 256 distinct bytes do not fit in a UCHAR with class 0 reserved, they all get their own.
+    //
+    if (m_NumberOfClasses > 256)
+    {
+        for (ULONG i = 0; i < 256; i += 1) m_Classes[i] = (UCHAR)i;
+        m_NumberOfClasses = 256;
+    }
+
+    //
+    // Trie of the anchors.
+    //
+    for (ULONG i = 0; i < m_Patterns.size(); i += 1)
+    {
+        PPATTERN Pattern = &m_Patterns[i];
+        ULONG State = 0;
+
+        for (ULONG j = 0; j < Pattern->AnchorLength; j += 1)
+        {
+            UCHAR Class = m_Classes[Pattern->Bytes[Pattern->AnchorOffset + j]];
+            map<UCHAR, ULONG>::iterator It = Goto[State].find(Class);
+
+            if (It == Goto[State].end())
+            {
+                Goto[State][Class] = (ULONG)Goto.size();
+                State = (ULONG)Goto.size();
+                Goto.push_back(map<UCHAR, ULONG>());
+                Outputs.push_back(vector<ULONG>());
+            }
+            else
+            {
+                State = It->second;
+            }
+        }
+
+        Outputs[State].push_back(i);
+    }
+
+    m_NumberOfStates = (ULONG)Goto.size();
+    Fail.assign(m_NumberOfStates, 0);
+
+    //
+    // Breadth first, the failure state of a state is always complete before the state itself.
+    // Following failure links is amortized linear in the total length of the anchors.
+    //
+    for (map<UCHAR, ULONG>::iterator It = Goto[0].begin(); It != Goto[0].end(); ++It) Queue.push_back(It->second);
+
+    for (ULONG Head = 0; Head < Queue.size(); Head += 1)
+    {
+        ULONG State = Queue[Head];
+
+        Outputs[State].insert(Outputs[State].end(), Outputs[Fail[State]].begin(), Outputs[Fail[State]].end());
+
+        for (map<UCHAR, ULONG>::iterator It = Goto[State].begin(); It != Goto[State].end(); ++It)
+        {
+            ULONG FailState = Fail[State];
+            map<UCHAR, ULONG>::iterator Next;
+
+            while (((Next = Goto[FailState].find(It->first)) == Goto[FailState].end()) && FailState) FailState = Fail[FailState];
+
+            Fail[It->second] = (Next != Goto[FailState].end()) ? Next->second : 0;
+            Queue.push_back(It->second);
+        }
+    }
+
+    //
+    // States are renumbered in that order, the dense ones are the shallowest.
+    //
+    Order.push_back(0);
+    Order.insert(Order.end(), Queue.begin(), Queue.end());
+    Number.assign(m_NumberOfStates, 0);
+
+    for (ULONG i = 0; i < m_NumberOfStates; i += 1) Number[Order[i]] = i;
+
+    m_NumberOfDenseStates = min(m_NumberOfStates, (ULONG)(PATTERN_MAX_DENSE_ENTRIES / m_NumberOfClasses));
+
+    m_OutputIndex.assign(m_NumberOfStates + 1, 0);
+    m_Outputs.clear();
+
+    for (ULONG State = 0; State < m_NumberOfStates; State += 1)
+    {
+        m_OutputIndex[State] = (ULONG)m_Outputs.size();
+        m_Outputs.insert(m_Outputs.end(), Outputs[Order[State]].begin(), Outputs[Order[State]].end());
+    }
+
+    m_OutputIndex[m_NumberOfStates] = (ULONG)m_Outputs.size();
+
+    //
+    // Dense rows start as a copy of the row of the failure state, complete by then.
+    //
+    m_Delta.assign((SIZE_T)m_NumberOfDenseStates * m_NumberOfClasses, 0);
+
+    for (ULONG State = 0; State < m_NumberOfDenseStates; State += 1)
+    {
+        ULONG *Row = &m_Delta[(SIZE_T)State * m_NumberOfClasses];
+
+        if (State)
+        {
+            const ULONG *FailRow = &m_Delta[(SIZE_T)Number[Fail[Order[State]]] * m_NumberOfClasses];
+
+            for (ULONG Class = 0; Class < m_NumberOfClasses; Class += 1) Row[Class] = FailRow[Class];
+        }
+
+        for (map<UCHAR, ULONG>::iterator It = Goto[Order[State]].begin(); It != Goto[Order[State]].end(); ++It)
+        {
+            Row[It->first] = Number[It->second];
+        }
+    }
+
+    m_TransitionIndex.clear();
+    m_Labels.clear();
+    m_Targets.clear();
+    m_Fail.clear();
+
+    if (m_NumberOfDenseStates == m_NumberOfStates)
+    {
+        //
+        // States become row offsets, flagged when they have outputs.
+        //
+        for (SIZE_T i = 0; i < m_Delta.size(); i += 1)
+        {
+            ULONG State = m_Delta[i];
+
+            m_Delta[i] = State * m_NumberOfClasses;
+            if (m_OutputIndex[State + 1] != m_OutputIndex[State]) m_Delta[i] |= PATTERN_STATE_OUTPUT;
+        }
+    }
+    else
+    {
+        m_TransitionIndex.assign(m_NumberOfStates + 1, 0);
+        m_Fail.assign(m_NumberOfStates, 0);
+
+        for (ULONG State = m_NumberOfDenseStates; State < m_NumberOfStates; State += 1)
+        {
+            m_TransitionIndex[State] = (ULONG)m_Labels.size();
+            m_Fail[State] = Number[Fail[Order[State]]];
+
+            for (map<UCHAR, ULONG>::iterator It = Goto[Order[State]].begin(); It != Goto[Order[State]].end(); ++It)
+            {
+                m_Labels.push_back(It->first);
+                m_Targets.push_back(Number[It->second]);
+            }
+        }
+
+        m_TransitionIndex[m_NumberOfStates] = (ULONG)m_Labels.size();
+    }
+}
+
+VOID
+PatternMatcher::Report(
+    ULONG State,
+    ULONG Position,
+    const UCHAR *Buffer,
+    ULONG Length,
+    vector<PATTERN_MATCH>& Matches,
+    SIZE_T First,
+    BOOLEAN *Sorted
+) const
+{
+    for (ULONG j = m_OutputIndex[State]; j < m_OutputIndex[State + 1]; j += 1)
+    {
+        const PATTERN *Pattern = &m_Patterns[m_Outputs[j]];
+        ULONG AnchorEnd = Position + 1;
+        ULONG Start;
+        PATTERN_MATCH Match;
+
+        if (AnchorEnd < (Pattern->AnchorOffset + Pattern->AnchorLength)) continue;
+
+        Start = AnchorEnd - Pattern->AnchorOffset - Pattern->AnchorLength;
+        if (Pattern->Length > (Length - Start)) continue;
+
+        if (Pattern->Verify)
+        {
+            ULONG k;
+
+            for (k = 0; k < Pattern->Length; k += 1)
+            {
+                if ((Buffer[Start + k] & Pattern->Mask[k]) != (Pattern->Bytes[k] & Pattern->Mask[k])) break;
+            }
+
+            if (k != Pattern->Length) continue;
+        }
+
+        Match.Offset = Start;
+        Match.Id = Pattern->Id;
+
+        if ((Matches.size() > First) &&
+            ((Matches.back().Offset > Start) || ((Matches.back().Offset == Start) && (Matches.back().Id > Match.Id))))
+        {
+            *Sorted = FALSE;
+        }
+
+        Matches.push_back(Match);
+    }
+}
+
+ULONG
+PatternMatcher::Scan(
+    const UCHAR *Buffer,
+    ULONG Length,
+    vector<PATTERN_MATCH>& Matches
+) const
+{
+    SIZE_T First = Matches.size();
+    BOOLEAN Sorted = TRUE;
+    ULONG Next = 0;
+
+    if (!m_NumberOfStates) return 0;
+
+    if (m_NumberOfDenseStates == m_NumberOfStates)
+    {
+        for (ULONG i = 0; i < Length; i += 1)
+        {
+            Next = m_Delta[(Next & ~PATTERN_STATE_OUTPUT) + m_Classes[Buffer[i]]];
+
+            if (!(Next & PATTERN_STATE_OUTPUT)) continue;
+
+            Report((Next & ~PATTERN_STATE_OUTPUT) / m_NumberOfClasses, i, Buffer, Length, Matches, First, &Sorted);
+        }
+    }
+    else
+    {
+        const UCHAR *Labels = m_Labels.data();
+
+        for (ULONG i = 0; i < Length; i += 1)
+        {
+            UCHAR Class = m_Classes[Buffer[i]];
+
+            //
+            // Failure links always lead to shallower states, down to a dense one at worst.
+            //
+            for (;;)
+            {
+                if (Next < m_NumberOfDenseStates)
+                {
+                    Next = m_Delta[(SIZE_T)Next * m_NumberOfClasses + Class];
+                    break;
+                }
+
+                const UCHAR *End = Labels + m_TransitionIndex[Next + 1];
+                const UCHAR *Label = lower_bound(Labels + m_TransitionIndex[Next], End, Class);
+
+                if ((Label != End) && (*Label == Class))
+                {
+                    Next = m_Targets[Label - Labels];
+                    break;
+                }
+
+                Next = m_Fail[Next];
+            }
+
+            if (m_OutputIndex[Next + 1] != m_OutputIndex[Next]) Report(Next, i, Buffer, Length, Matches, First, &Sorted);
+        }
+    }
+
+    //
+    // Anchors not at the start of their pattern report it late, and suffix outputs of a
+    // state are not ordered by id.
+    //
+    if (!Sorted)
+    {
+        sort(Matches.begin() + First, Matches.end(), [](const PATTERN_MATCH& a, const PATTERN_MATCH& b) {
+            return (a.Offset != b.Offset) ? (a.Offset < b.Offset) : (a.Id < b.Id);
+        });
+    }
+
+    return (ULONG)(Matches.size() - First);
+}
+
+#define PATTERN_FILE_SIGNATURE 0x4D54504D // "MPTM"
+#define PATTERN_FILE_VERSION 1
+
+template <typename T>
+static
+BOOLEAN
+WriteVector(
+    FILE *File,
+    const vector<T>& Vector
+)
+{
+    ULONG Count = (ULONG)Vector.size();
+
+    if (fwrite(&Count, sizeof(Count), 1, File) != 1) return FALSE;
+    if (Count && (fwrite(&Vector[0], sizeof(T), Count, File) != Count)) return FALSE;
+
+    return TRUE;
+}
+
+template <typename T>
+static
+BOOLEAN
+ReadVector(
+    FILE *File,
+    vector<T>& Vector,
+    ULONG MaxCount
+)
+{
+    ULONG Count;
+
+    if (fread(&Count, sizeof(Count), 1, File) != 1) return FALSE;
+    if (Count > MaxCount) return FALSE;
+
+    Vector.resize(Count);
+    if (Count && (fread(&Vector[0], sizeof(T), Count, File) != Count)) return FALSE;
+
+    return TRUE;
+}
+
+BOOLEAN
+PatternMatcher::Save(
+    FILE *File
+) const
+{
+    ULONG Header[6] = { PATTERN_FILE_SIGNATURE, PATTERN_FILE_VERSION, m_MaxLength, m_NumberOfClasses, m_NumberOfStates, m_NumberOfDenseStates };
+    ULONG NumberOfPatterns = (ULONG)m_Patterns.size();
+
+    if (fwrite(Header, sizeof(Header), 1, File) != 1) return FALSE;
+    if (fwrite(m_Classes, sizeof(m_Classes), 1, File) != 1) return FALSE;
+    if (fwrite(&NumberOfPatterns, sizeof(NumberOfPatterns), 1, File) != 1) return FALSE;
+
+    for (const PATTERN& Pattern : m_Patterns)
+    {
+        ULONG Fields[5] = { Pattern.Id, Pattern.Length, Pattern.AnchorOffset, Pattern.AnchorLength, Pattern.Verify };
+
+        if (fwrite(Fields, sizeof(Fields), 1, File) != 1) return FALSE;
+        if (!WriteVector(File, Pattern.Bytes) || !WriteVector(File, Pattern.Mask)) return FALSE;
+    }
+
+    return WriteVector(File, m_Delta) &&
+           WriteVector(File, m_OutputIndex) &&
+           WriteVector(File, m_Outputs) &&
+           WriteVector(File, m_TransitionIndex) &&
+           WriteVector(File, m_Labels) &&
+           WriteVector(File, m_Targets) &&
+           WriteVector(File, m_Fail);
+}
+
+BOOLEAN
+PatternMatcher::Load(
+    FILE *File
+)
+{
+    ULONG Header[6];
+    ULONG NumberOfPatterns;
+    BOOLEAN Result = FALSE;
+    const ULONG MaxCount = 0x10000000;
+
+    m_Patterns.clear();
+    m_NumberOfStates = 0;
+
+    if (fread(Header, sizeof(Header), 1, File) != 1) goto CleanUp;
+    if ((Header[0] != PATTERN_FILE_SIGNATURE) || (Header[1] != PATTERN_FILE_VERSION)) goto CleanUp;
+    if ((Header[3] == 0) || (Header[3] > 256) || (Header[4] == 0) || (Header[5] == 0) || (Header[5] > Header[4])) goto CleanUp;
+
+    m_MaxLength = Header[2];
+    m_NumberOfClasses = Header[3];
+    m_NumberOfStates = Header[4];
+    m_NumberOfDenseStates = Header[5];
+
+    if (fread(m_Classes, sizeof(m_Classes), 1, File) != 1) goto CleanUp;
+    if (fread(&NumberOfPatterns, sizeof(NumberOfPatterns), 1, File) != 1) goto CleanUp;
+    if (NumberOfPatterns > MaxCount) goto CleanUp;
+
+    m_Patterns.resize(NumberOfPatterns);
+
+    for (PATTERN& Pattern : m_Patterns)
+    {
+        ULONG Fields[5];
+
+        if (fread(Fields, sizeof(Fields), 1, File) != 1) goto CleanUp;
+
+        Pattern.Id = Fields[0];
+        Pattern.Length = Fields[1];
+        Pattern.AnchorOffset = Fields[2];
+        Pattern.AnchorLength = Fields[3];
+        Pattern.Verify = (BOOLEAN)Fields[4];
+
+        if (!ReadVector(File, Pattern.Bytes, MaxCount) || !ReadVector(File, Pattern.Mask, MaxCount)) goto CleanUp;
+        if ((Pattern.Bytes.size() != Pattern.Length) || (Pattern.Mask.size() != Pattern.Length)) goto CleanUp;
+        if (!Pattern.AnchorLength || (Pattern.Length > m_MaxLength)) goto CleanUp;
+        if ((Pattern.AnchorOffset + Pattern.AnchorLength) > Pattern.Length) goto CleanUp;
+    }
+
+    if (!ReadVector(File, m_Delta, MaxCount) ||
+        !ReadVector(File, m_OutputIndex, MaxCount) ||
+        !ReadVector(File, m_Outputs, MaxCount) ||
+        !ReadVector(File, m_TransitionIndex, MaxCount) ||
+        !ReadVector(File, m_Labels, MaxCount) ||
+        !ReadVector(File, m_Targets, MaxCount) ||
+        !ReadVector(File, m_Fail, MaxCount))
+    {
+        goto CleanUp;
+    }
+
+    //
+    // Every index used by Scan() must be in range.
+    //
+    if (m_OutputIndex.size() != (m_NumberOfStates + 1)) goto CleanUp;
+    if (m_OutputIndex[m_NumberOfStates] != m_Outputs.size()) goto CleanUp;
+
+    for (ULONG State = 0; State < m_NumberOfStates; State += 1)
+    {
+        if (m_OutputIndex[State] > m_OutputIndex[State + 1]) goto CleanUp;
+    }
+
+    for (ULONG Output : m_Outputs)
+    {
+        if (Output >= m_Patterns.size()) goto CleanUp;
+    }
+
+    for (ULONG i = 0; i < 256; i += 1)
+    {
+        if (m_Classes[i] >= m_NumberOfClasses) goto CleanUp;
+    }
+
+    if (m_Delta.size() != ((SIZE_T)m_NumberOfDenseStates * m_NumberOfClasses)) goto CleanUp;
+
+    if (m_NumberOfDenseStates == m_NumberOfStates)
+    {
+        for (ULONG Entry : m_Delta)
+        {
+            ULONG Offset = Entry & ~PATTERN_STATE_OUTPUT;
+            ULONG State = Offset / m_NumberOfClasses;
+
+            if ((Offset % m_NumberOfClasses) || (State >= m_NumberOfStates)) goto CleanUp;
+            if (((Entry & PATTERN_STATE_OUTPUT) != 0) != (m_OutputIndex[State + 1] != m_OutputIndex[State])) goto CleanUp;
+        }
+    }
+    else
+    {
+        if ((m_TransitionIndex.size() != (m_NumberOfStates + 1)) || (m_Fail.size() != m_NumberOfStates)) goto CleanUp;
+        if ((m_Labels.size() != m_Targets.size()) || (m_TransitionIndex[m_NumberOfStates] != m_Labels.size())) goto CleanUp;
+
+        for (ULONG Target : m_Delta)
+        {
+            if (Target >= m_NumberOfStates) goto CleanUp;
+        }
+
+        //
+        // Failure links have to lead to shallower states or Scan() would loop.
+        //
+        for (ULONG State = m_NumberOfDenseStates; State < m_NumberOfStates; State += 1)
+        {
+            if (m_TransitionIndex[State] > m_TransitionIndex[State + 1]) goto CleanUp;
+            if (m_Fail[State] >= State) goto CleanUp;
+        }
+
+        for (ULONG Target : m_Targets)
+        {
+            if (Target >= m_NumberOfStates) goto CleanUp;
+        }
+    }
+
+    Result = TRUE;
+
+CleanUp:
+    if (!Result)
+    {
+        m_Patterns.clear();
+        m_MaxLength = 0;
+        m_NumberOfStates = 0;
+        m_NumberOfDenseStates = 0;
+        m_Delta.clear();
+    }
+
+    return Result;
+}
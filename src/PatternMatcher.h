@@ -0,0 +1,187 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - PatternMatcher.h
+
+Abstract:
+
+    - Aho-Corasick automaton over byte patterns with wildcards, all the
+      matches of a buffer are found in a single pass.
+    - The compiled automaton can be saved to and loaded from a file.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __PATTERNMATCHER_H__
+#define __PATTERNMATCHER_H__
+
+//
+// Transitions hold the offset of the next row in the table, with PATTERN_STATE_OUTPUT
+// set when patterns end in that state.
+//
+#define PATTERN_STATE_OUTPUT 0x80000000
+
+//
+// Larger automata (thousands of rules) only get full rows for their shallowest states,
+// deeper ones keep sparse transitions and failure links. Matching stays linear.
+//
+#define PATTERN_MAX_DENSE_ENTRIES (4 * 1024 * 1024)
+
+class PatternMatcher {
+public:
+    typedef struct _PATTERN_MATCH {
+        ULONG Offset; // Of the first byte of the pattern.
+        ULONG Id;
+    } PATTERN_MATCH, *PPATTERN_MATCH;
+
+    PatternMatcher(
+    );
+
+    //
+    // Mask is NULL when every byte is significant, otherwise bytes with a zero mask
+    // match anything. Returns FALSE for patterns without significant byte.
+    //
+    BOOLEAN
+    Add(
+        ULONG Id,
+        const UCHAR *Bytes,
+        const UCHAR *Mask,
+        ULONG Length
+    );
+
+    //
+    // "6a30??648b" style, two hex digits or "??" per byte.
+    //
+    BOOLEAN
+    AddHex(
+        ULONG Id,
+        LPCSTR Hex
+    );
+
+    //
+    // Must be called after the last Add(), before Scan().
+    //
+    VOID
+    Compile(
+    );
+
+    //
+    // Appends the matches lying entirely inside of Buffer, sorted by offset then id.
+    // Returns the number of matches appended.
+    //
+    ULONG
+    Scan(
+        const UCHAR *Buffer,
+        ULONG Length,
+        vector<PATTERN_MATCH>& Matches
+    ) const;
+
+    //
+    // Compiled automaton, so that it does not have to be compiled again. Load() checks the
+    // consistency of what it reads and leaves the matcher empty on failure.
+    //
+    BOOLEAN
+    Save(
+        FILE *File
+    ) const;
+
+    BOOLEAN
+    Load(
+        FILE *File
+    );
+
+    ULONG
+    GetMaxLength(
+    ) const
+    {
+        return m_MaxLength;
+    }
+
+    ULONG
+    GetNumberOfStates(
+    ) const
+    {
+        return m_NumberOfStates;
+    }
+
+    BOOLEAN
+    IsDense(
+    ) const
+    {
+        return (m_NumberOfDenseStates == m_NumberOfStates);
+    }
+
+private:
+    typedef struct _PATTERN {
+        ULONG Id;
+        ULONG Length;
+        ULONG AnchorOffset; // Longest run of significant bytes, the part looked up by the automaton.
+        ULONG AnchorLength;
+        BOOLEAN Verify; // Bytes outside of the anchor have to be checked.
+        vector<UCHAR> Bytes;
+        vector<UCHAR> Mask;
+    } PATTERN, *PPATTERN;
+
+    VOID
+    Report(
+        ULONG State,
+        ULONG Position,
+        const UCHAR *Buffer,
+        ULONG Length,
+        vector<PATTERN_MATCH>& Matches,
+        SIZE_T First,
+        BOOLEAN *Sorted
+    ) const;
+
+    vector<PATTERN> m_Patterns;
+    ULONG m_MaxLength;
+
+    UCHAR m_Classes[256]; // Bytes not used by any anchor share class 0.
+    ULONG m_NumberOfClasses;
+    ULONG m_NumberOfStates; // Numbered breadth first, the root is 0.
+    ULONG m_NumberOfDenseStates;
+
+    //
+    // m_NumberOfDenseStates rows of m_NumberOfClasses transitions. They hold row offsets
+    // flagged with PATTERN_STATE_OUTPUT when every state is dense, state numbers otherwise.
+    //
+    vector<ULONG> m_Delta;
+
+    //
+    // States past m_NumberOfDenseStates: goto transitions sorted by class, failure links.
+    //
+    vector<ULONG> m_TransitionIndex; // Per state, first transition (one more entry at the end).
+    vector<UCHAR> m_Labels;
+    vector<ULONG> m_Targets;
+    vector<ULONG> m_Fail;
+
+    vector<ULONG> m_OutputIndex; // Per state, first entry in m_Outputs (one more entry at the end).
+    vector<ULONG> m_Outputs; // m_Patterns indexes, including the ones of the suffix states.
+};
+
+#endif
@@ -38,8 +38,6 @@ Revision History:
 #include "MoonSolsDbgExt.h"
 #include "Process.h"
 
-map<PVOID, ULONG> g_References;
-
 //
 // User-Mode Modules (DLLs)
 //
@@ -256,8 +254,7 @@ MsProcessObject::GetDlls()
 
         for (Dlls.First(); !Dlls.IsDone(); Dlls.Next())
         {
-            MsDllObject Object = Dlls.Current();
-            m_DllList.push_back(Object);
+            m_DllList.push_back(MsDllObject(Dlls.Current()));
         }
     }
 
@@ -299,7 +296,7 @@ MsProcessObject::GetDlls()
                                             LdrDataTableEntry.FullDllName.Length,
                                             NULL) != S_OK) break;
 
-            m_DllList.push_back(Object);
+            m_DllList.push_back(move(Object));
 
             if (g_Ext->m_Data->ReadVirtual(SIGN_EXTEND(LdrDataTableEntry.InLoadOrderLinks.Flink), &LdrDataTableEntry, sizeof(LdrDataTableEntry), NULL) != S_OK) goto CleanUp;
         }
@@ -452,17 +449,138 @@ CleanUp:
     return Result;
 }
 
+//
+// EPROCESS field offsets, resolved once per session so that Set() needs a single read.
+//
+typedef struct _EPROCESS_LAYOUT {
+    BOOLEAN Initialized;
+    BOOLEAN Valid;
+
+    ULONG Size;
+
+    ULONG UniqueProcessId;
+    ULONG InheritedFromUniqueProcessId;
+    ULONG SectionBaseAddress;
+    ULONG ImageFileName;
+    ULONG Peb;
+} EPROCESS_LAYOUT, *PEPROCESS_LAYOUT;
+
+static EPROCESS_LAYOUT g_ProcessLayout;
+
 VOID
-MsProcessObject::Set(
+InvalidateProcessLayout(
+    VOID
+)
+{
+    RtlZeroMemory(&g_ProcessLayout, sizeof(g_ProcessLayout));
+}
+
+static
+PEPROCESS_LAYOUT
+GetProcessLayout(
+    VOID
+)
+{
+    PEPROCESS_LAYOUT Layout = &g_ProcessLayout;
+    ULONG End;
+
+    if (Layout->Initialized) return Layout->Valid ? Layout : NULL;
+
+    Layout->Initialized = TRUE;
+
+    try
+    {
+        Layout->UniqueProcessId = ExtRemoteTyped::GetTypeFieldOffset("nt!_EPROCESS", "UniqueProcessId");
+        Layout->InheritedFromUniqueProcessId = ExtRemoteTyped::GetTypeFieldOffset("nt!_EPROCESS", "InheritedFromUniqueProcessId");
+        Layout->SectionBaseAddress = ExtRemoteTyped::GetTypeFieldOffset("nt!_EPROCESS", "SectionBaseAddress");
+        Layout->ImageFileName = ExtRemoteTyped::GetTypeFieldOffset("nt!_EPROCESS", "ImageFileName");
+        Layout->Peb = ExtRemoteTyped::GetTypeFieldOffset("nt!_EPROCESS", "Peb");
+    }
+    catch (...)
+    {
+        return NULL;
+    }
+
+    End = max(Layout->UniqueProcessId, Layout->InheritedFromUniqueProcessId);
+    End = max(End, Layout->SectionBaseAddress);
+    End = max(End, Layout->Peb);
+    End += sizeof(ULONG64);
+    End = max(End, Layout->ImageFileName + (ULONG)sizeof(((MsProcessObject::PCACHED_PROCESS_OBJECT)0)->ImageFileName));
+
+    if (End > EPROCESS_MAX_SIZE) return NULL;
+
+    Layout->Size = End;
+    Layout->Valid = TRUE;
+
+    return Layout;
+}
+
+static
+ULONG64
+GetLayoutPtr(
+    PUCHAR Body,
+    ULONG Offset
 )
 {
-    ULONG64 Peb;
+    if (GetPtrSize() == sizeof(ULONG64)) return *(PULONG64)(Body + Offset);
+
+    return SIGN_EXTEND(*(PULONG)(Body + Offset));
+}
 
+BOOLEAN
+MsProcessObject::SetFromLayout(
+    VOID
+)
+{
+    UCHAR Body[EPROCESS_MAX_SIZE];
+    PEPROCESS_LAYOUT Layout;
+    ULONG BytesRead = 0;
+
+    Layout = GetProcessLayout();
+    if (Layout == NULL) return FALSE;
+
+    if (g_Ext->m_Data->ReadVirtual(m_CcProcessObject.ProcessObjectPtr, Body, Layout->Size, &BytesRead) != S_OK) return FALSE;
+    if (BytesRead != Layout->Size) return FALSE;
+
+    m_CcProcessObject.ProcessId = GetLayoutPtr(Body, Layout->UniqueProcessId);
+    m_CcProcessObject.ParentProcessId = GetLayoutPtr(Body, Layout->InheritedFromUniqueProcessId);
+    m_ImageBase = GetLayoutPtr(Body, Layout->SectionBaseAddress);
+    m_CcProcessObject.Peb = GetLayoutPtr(Body, Layout->Peb);
+
+    memcpy_s(m_CcProcessObject.ImageFileName, sizeof(m_CcProcessObject.ImageFileName),
+        Body + Layout->ImageFileName, sizeof(m_CcProcessObject.ImageFileName) - 1);
+
+    return TRUE;
+}
+
+VOID
+MsProcessObject::Set(
+)
+{
     RtlZeroMemory(&m_CcProcessObject, sizeof(m_CcProcessObject));
 
-    m_CcProcessObject.ProcessId = m_TypedObject.Field("UniqueProcessId").GetPtr();
-    m_CcProcessObject.ParentProcessId = m_TypedObject.Field("InheritedFromUniqueProcessId").GetPtr();
-    m_ImageBase = m_TypedObject.Field("SectionBaseAddress").GetPtr();
+    m_EnvVarsBuffer = NULL;
+    m_ProcessDataOffset = 0;
+
+    //
+    // Only the fields needed to identify the process are read here, with one read of the
+    // EPROCESS body. Everything else is read by Materialize().
+    //
+    m_FieldsLoaded = 0;
+
+    m_CcProcessObject.ProcessObjectPtr = m_TypedObject.GetPtr();
+
+    if (!SetFromLayout())
+    {
+        m_CcProcessObject.ProcessId = m_TypedObject.Field("UniqueProcessId").GetPtr();
+        m_CcProcessObject.ParentProcessId = m_TypedObject.Field("InheritedFromUniqueProcessId").GetPtr();
+        m_ImageBase = m_TypedObject.Field("SectionBaseAddress").GetPtr();
+        m_CcProcessObject.Peb = m_TypedObject.Field("Peb").GetPtr();
+
+        m_TypedObject.Field("ImageFileName").GetString((PTSTR)&m_CcProcessObject.ImageFileName,
+            sizeof(m_CcProcessObject.ImageFileName));
+    }
+
     if ((m_ImageBase == 0ULL) && (m_CcProcessObject.ProcessId == 4))
     {
         //
@@ -470,134 +588,235 @@ MsProcessObject::Set(
         //
         m_ImageBase = ExtNtOsInformation::GetNtDebuggerData(DEBUG_DATA_KernBase, "nt", 0);
     }
+}
 
-    m_CcProcessObject.ProcessObjectPtr = m_TypedObject.GetPtr();
-
-    m_TypedObject.Field("ImageFileName").GetString((PTSTR)&m_CcProcessObject.ImageFileName,
-        sizeof(m_CcProcessObject.ImageFileName));
+VOID
+MsProcessObject::Materialize(
+    ULONG Fields
+)
+{
+    ULONG64 Peb = m_CcProcessObject.Peb;
+    ULONG64 ProcessParameters;
+    ULONG64 ImplicitProcess = 0;
 
-    ExtRemoteTypedEx::GetUnicodeString(m_TypedObject.Field("SeAuditProcessCreationInfo.ImageFileName").Field("Name"),
-        (PWSTR)&m_CcProcessObject.FullPath,
-        sizeof(m_CcProcessObject.FullPath));
+    Fields &= ~m_FieldsLoaded;
+    if (!Fields) return;
 
-    Peb = m_TypedObject.Field("Peb").GetPtr();
+    m_FieldsLoaded |= Fields;
 
-    if (Peb)
+    if (Fields & PROCESS_FIELD_FULLPATH)
     {
-        ULONG64 ProcessParameters;
-
-        SwitchContext();
+        ExtRemoteTypedEx::GetUnicodeString(m_TypedObject.Field("SeAuditProcessCreationInfo.ImageFileName").Field("Name"),
+            (PWSTR)&m_CcProcessObject.FullPath,
+            sizeof(m_CcProcessObject.FullPath));
+    }
 
-        if (IsValid(Peb))
-        {
-            ProcessParameters = m_TypedObject.Field("Peb").Field("ProcessParameters").GetPtr();
+    if (!(Fields & (PROCESS_FIELD_PARAMETERS | PROCESS_FIELD_ENVIRONMENT)) || !Peb) return;
 
-            if (ProcessParameters && IsValid(ProcessParameters))
-            {
-                ULONG EnvironmentSize;
+    //
+    // Not SwitchContext(): the accessors can be called while the caller has switched to this
+    // process, its RestoreContext() must still find the process it saved in m_ProcessDataOffset.
+    //
+    if (g_Ext->m_System2->GetImplicitProcessDataOffset(&ImplicitProcess) != S_OK) return;
+    if ((ImplicitProcess != m_CcProcessObject.ProcessObjectPtr) &&
+        (g_Ext->m_System2->SetImplicitProcessDataOffset(m_CcProcessObject.ProcessObjectPtr) != S_OK)) return;
 
-                m_CcProcessObject.DllPath = ExtRemoteTypedEx::GetUnicodeString2(m_TypedObject.Field("Peb").Field("ProcessParameters").Field("DllPath"));
-                REF_POINTER(m_CcProcessObject.DllPath);
+    if (!IsValid(Peb)) goto CleanUp;
 
-                m_CcProcessObject.ImagePathName = ExtRemoteTypedEx::GetUnicodeString2(m_TypedObject.Field("Peb").Field("ProcessParameters").Field("ImagePathName"));
-                REF_POINTER(m_CcProcessObject.ImagePathName);
+    ProcessParameters = m_TypedObject.Field("Peb").Field("ProcessParameters").GetPtr();
+    if (!ProcessParameters || !IsValid(ProcessParameters)) goto CleanUp;
 
-                m_CcProcessObject.CommandLine = ExtRemoteTypedEx::GetUnicodeString2(m_TypedObject.Field("Peb").Field("ProcessParameters").Field("CommandLine"));
-                REF_POINTER(m_CcProcessObject.CommandLine);
+    if (Fields & PROCESS_FIELD_PARAMETERS)
+    {
+        m_CcProcessObject.DllPath = ExtRemoteTypedEx::GetUnicodeString2(m_TypedObject.Field("Peb").Field("ProcessParameters").Field("DllPath"), &g_CommandArena);
+        m_CcProcessObject.ImagePathName = ExtRemoteTypedEx::GetUnicodeString2(m_TypedObject.Field("Peb").Field("ProcessParameters").Field("ImagePathName"), &g_CommandArena);
+        m_CcProcessObject.CommandLine = ExtRemoteTypedEx::GetUnicodeString2(m_TypedObject.Field("Peb").Field("ProcessParameters").Field("CommandLine"), &g_CommandArena);
+    }
 
-                ULONG64 Environment = m_TypedObject.Field("Peb").Field("ProcessParameters").Field("Environment").GetPtr();
-                if (m_TypedObject.Field("Peb").Field("ProcessParameters").HasField("EnvironmentSize"))
-                {
-                    EnvironmentSize = (ULONG)m_TypedObject.Field("Peb").Field("ProcessParameters").Field("EnvironmentSize").GetPtr();
-                }
-                else
-                {
-                    EnvironmentSize = 0x1000;
-                }
+    if (Fields & PROCESS_FIELD_ENVIRONMENT)
+    {
+        ULONG EnvironmentSize;
 
-                LPWSTR m_EnvVarsBuffer = (LPWSTR)malloc(EnvironmentSize);
-                if (g_Ext->m_Data->ReadVirtual(Environment, m_EnvVarsBuffer, EnvironmentSize, NULL) == S_OK)
-                {
+        ULONG64 Environment = m_TypedObject.Field("Peb").Field("ProcessParameters").Field("Environment").GetPtr();
+        if (m_TypedObject.Field("Peb").Field("ProcessParameters").HasField("EnvironmentSize"))
+        {
+            EnvironmentSize = (ULONG)m_TypedObject.Field("Peb").Field("ProcessParameters").Field("EnvironmentSize").GetPtr();
+        }
+        else
+        {
+            EnvironmentSize = 0x1000;
+        }
 
-                    for (UINT Index = 0; Index < (EnvironmentSize / sizeof(WCHAR)); Index += 1)
-                    {
-                        ENV_VAR_OBJECT EnvVar = { 0 };
+        m_EnvVarsBuffer = (LPWSTR)g_CommandArena.Alloc(EnvironmentSize);
+        if (m_EnvVarsBuffer == NULL) goto CleanUp;
 
-                        if (m_EnvVarsBuffer[Index] == L'\0') continue;
+        if (g_Ext->m_Data->ReadVirtual(Environment, m_EnvVarsBuffer, EnvironmentSize, NULL) == S_OK)
+        {
+            for (UINT Index = 0; Index < (EnvironmentSize / sizeof(WCHAR)); Index += 1)
+            {
+                ENV_VAR_OBJECT EnvVar = { 0 };
 
-                        ULONG Len = (ULONG)wcslen(&m_EnvVarsBuffer[Index]);
+                if (m_EnvVarsBuffer[Index] == L'\0') continue;
 
-                        EnvVar.Variable = &m_EnvVarsBuffer[Index];
-                        m_EnvVars.push_back(EnvVar);
-                        Index += Len;
-                    }
+                ULONG Len = (ULONG)wcsnlen(&m_EnvVarsBuffer[Index], (EnvironmentSize / sizeof(WCHAR)) - Index);
 
-                }
+                EnvVar.Variable = &m_EnvVarsBuffer[Index];
+                m_EnvVars.push_back(EnvVar);
+                Index += Len;
             }
         }
-
-        RestoreContext();
     }
+
+CleanUp:
+    if (ImplicitProcess != m_CcProcessObject.ProcessObjectPtr) g_Ext->m_System2->SetImplicitProcessDataOffset(ImplicitProcess);
 }
 
-MsDllObject::MsDllObject(const MsDllObject& other)
+LPCWSTR
+MsProcessObject::GetFullPath(
+    VOID
+)
 {
-    *this = other;
+    Materialize(PROCESS_FIELD_FULLPATH);
 
-    REF_POINTER(m_Image.Image);
+    return m_CcProcessObject.FullPath;
 }
 
-
-MsDllObject::~MsDllObject()
+LPCWSTR
+MsProcessObject::GetProcessCommandLine(
+    VOID
+)
 {
-    Clear();
+    Materialize(PROCESS_FIELD_PARAMETERS);
+
+    return m_CcProcessObject.CommandLine;
 }
 
-MsProcessObject::MsProcessObject(const MsProcessObject& other)
+ArenaVector<MsProcessObject::ENV_VAR_OBJECT>&
+MsProcessObject::GetEnvVars(
+    VOID
+)
 {
-    REF_POINTER(other.m_CcProcessObject.CommandLine);
-    REF_POINTER(other.m_CcProcessObject.DllPath);
-    REF_POINTER(other.m_CcProcessObject.ImagePathName);
-
-    REF_POINTER(other.m_Image.Image);
+    Materialize(PROCESS_FIELD_ENVIRONMENT);
 
-    REF_POINTER(other.m_EnvVarsBuffer);
+    return m_EnvVars;
+}
 
-    *this = other;
+MsDllObject::~MsDllObject()
+{
+    Clear();
 }
 
 VOID
-MsProcessObject::Release() throw(...)
+MsProcessObject::MoveFields(
+    MsProcessObject& other
+)
 {
-    DEREF_POINTER(m_CcProcessObject.CommandLine);
-    DEREF_POINTER(m_CcProcessObject.DllPath);
-    DEREF_POINTER(m_CcProcessObject.ImagePathName);
-    DEREF_POINTER(m_EnvVarsBuffer);
+    m_CcProcessObject = other.m_CcProcessObject;
+
+    m_EnvVars = move(other.m_EnvVars);
+    m_DllList = move(other.m_DllList);
+    m_Handles = move(other.m_Handles);
+    m_Vads = move(other.m_Vads);
+    m_Threads = move(other.m_Threads);
+
+    m_ProcessDataOffset = other.m_ProcessDataOffset;
+    m_TypedObject = other.m_TypedObject;
+    m_EnvVarsBuffer = other.m_EnvVarsBuffer;
+    m_FieldsLoaded = other.m_FieldsLoaded;
 }
 
 MsProcessObject::~MsProcessObject()
 {
-    try
-    {
-        Release();
-    }
-    catch (...)
-    {
+    Clear();
+}
 
-    }
+typedef struct _ENRICH_TASK {
+    PEFile *Image;
+    BOOLEAN Exports;
+    BOOLEAN Imports;
 
-    Clear();
+    BOOLEAN Cacheable;
+    IMAGE_IDENTITY Identity;
+} ENRICH_TASK, *PENRICH_TASK;
+
+//
+// Images already parsed in another process (same identity, same physical pages) are
+// filled from the cache. Others are captured and queued for the worker pool.
+// Returns the number of captured bytes.
+//
+static
+ULONG
+QueueImage(
+    PEFile *Image,
+    BOOLEAN Exports,
+    BOOLEAN Imports,
+    BOOLEAN Hashes,
+    Arena *ImageArena,
+    vector<ENRICH_TASK> &Tasks
+)
+{
+    ENRICH_TASK Task;
+
+    Task.Image = Image;
+    Task.Exports = Exports;
+    Task.Imports = Imports;
+    Task.Cacheable = g_ImageCache.GetIdentity(Image, &Task.Identity);
+
+    //
+    // The whole image hash covers writable pages, it is never cached. It is streamed
+    // from the target instead of being computed from the captured image.
+    //
+    if (Hashes) Image->RtlGetImageHashes(Task.Identity.Key.SizeOfImage);
+
+    if (Task.Cacheable && g_ImageCache.Load(Image, &Task.Identity, Exports, Imports)) return 0;
+
+    if (!Image->InitImage(ImageArena)) return 0;
+
+    Tasks.push_back(move(Task));
+
+    return Image->m_ImageSize;
 }
 
+//
+// Validates every IAT slot of the process and of its dlls against the exports of the loaded
+// modules. Must be called in the context of the process, after the images were parsed.
+//
+static
 VOID
-PEFile::Free(void)
+CheckImports(
+    MsProcessObject& ProcObj
+)
 {
-    if (m_Image.Initialized)
+    ExportIndex::LOADED_MODULE_MAP Modules;
+    vector<PEFile *> Images;
+    string Key;
+
+    if (ProcObj.m_Imports.size()) Images.push_back(&ProcObj);
+
+    for (MsDllObject& DllObj : ProcObj.m_DllList)
     {
-        DEREF_POINTER(m_Image.Image);
+        ExportIndex::LOADED_MODULE Module = { 0 };
+
+        sprintf_s(Module.Name, sizeof(Module.Name), "%S", DllObj.mm_CcDllObject.DllName);
+        ExportIndex::NormalizeModuleName(Module.Name, sizeof(Module.Name));
+
+        Module.PtrSize = DllObj.mm_CcDllObject.IsWow64 ? sizeof(ULONG) : g_Ext->m_PtrSize;
+        Module.Base = DllObj.m_ImageBase;
+        Module.Size = DllObj.m_ImageSize;
+
+        if (DllObj.m_Exports.size()) g_ExportIndex.AddModule(Module.Name, Module.PtrSize, &DllObj);
+
+        ExportIndex::MakeModuleKey(Key, Module.Name, Module.PtrSize);
+        Modules[Key] = Module;
+
+        if (DllObj.m_Imports.size()) Images.push_back(&DllObj);
     }
 
-    RtlZeroMemory(&m_Image, sizeof(m_Image));
+    for (PEFile *Image : Images)
+    {
+        Image->RtlReadImportAddresses();
+        g_ExportIndex.CheckImports(Modules, Image);
+    }
 }
 
 ProcessArray GetProcesses(
@@ -618,7 +837,7 @@ ProcessArray GetProcesses(
 
         if (!Pid || (Pid == ProcObject.m_CcProcessObject.ProcessId))
         {
-            ProcessList.push_back(ProcObject);
+            ProcessList.push_back(move(ProcObject));
         }
     }
 
@@ -628,20 +847,18 @@ ProcessArray GetProcesses(
 
         for (MmProcesses.First(); !MmProcesses.IsDone(); MmProcesses.Next())
         {
-            MsProcessObject ProcObject = MmProcesses.Current();
-
-            MmProcessList.push_back(MmProcesses.Current());
+            MmProcessList.push_back(MsProcessObject(MmProcesses.Current()));
         }
 
         //
         // Note: MmProcessList doesn't contain System process (PID = 4).
         // Retrieve hidden process.
         //
-        for each (MsProcessObject MmProcObject in MmProcessList)
+        for (MsProcessObject& MmProcObject : MmProcessList)
         {
             BOOLEAN Found = FALSE;
 
-            for each (MsProcessObject ProcObject in ProcessList)
+            for (MsProcessObject& ProcObject : ProcessList)
             {
                 if (MmProcObject.m_CcProcessObject.ProcessId == ProcObject.m_CcProcessObject.ProcessId) Found = TRUE;
             }
@@ -653,7 +870,7 @@ ProcessArray GetProcesses(
                 //
                 MmProcObject.m_CcProcessObject.HiddenProcess = TRUE;
 
-                ProcessList.push_back(MmProcObject);
+                ProcessList.push_back(move(MmProcObject));
             }
         }
     }
@@ -670,39 +887,107 @@ ProcessArray GetProcesses(
     //
     // Process + Dlls
     //
-    for (ULONG i = 0; i < ProcessList.size(); i++)
+    // Processes are handled in batches. Images are captured from the engine thread (the
+    // debugger engine is not reentrant), then parsed and hashed by the worker pool, then
+    // released. Results are stored in the objects themselves so the order never changes.
+    // Image bytes are only needed during the batch, they come from their own arena.
+    //
+    Arena ImageArena;
+
+    for (ULONG First = 0, Last = 0; First < ProcessList.size(); First = Last)
     {
-        BOOLEAN Initialized = FALSE;
-        MsProcessObject& ProcObj = ProcessList[i];
+        vector<ENRICH_TASK> Tasks;
+        ULONG64 BatchSize = 0;
+
+        for (Last = First; (Last < ProcessList.size()) && (BatchSize < PROCESS_BATCH_MAX_SIZE); Last += 1)
+        {
+            MsProcessObject& ProcObj = ProcessList[Last];
+
+            ProcObj.SwitchContext();
 
-        ProcObj.SwitchContext();
+            BatchSize += QueueImage(&ProcObj,
+                                    (Flags & PROCESS_EXPORTS_FLAG) ? TRUE : FALSE,
+                                    (Flags & PROCESS_IAT_FLAG) ? TRUE : FALSE,
+                                    (Flags & PROCESS_HASHES_FLAG) ? TRUE : FALSE,
+                                    &ImageArena, Tasks);
+
+            if (Flags & PROCESS_DLLS_FLAG)
+            {
+                ProcObj.GetDlls();
 
-        Initialized = ProcObj.GetInfoFull();
+                for (ULONG j = 0; (Flags & (PROCESS_DLL_EXPORTS_FLAG | PROCESS_IAT_FLAG | PROCESS_HASHES_FLAG)) && (j < ProcObj.m_DllList.size()); j++)
+                {
+                    MsDllObject& DllObj = ProcObj.m_DllList[j];
+
+                    //
+                    // Exports of every dll are needed to validate the IAT entries. The main image
+                    // is also in the list, its imports are checked once (from ProcObj).
+                    //
+                    BatchSize += QueueImage(&DllObj,
+                                            (Flags & (PROCESS_DLL_EXPORTS_FLAG | PROCESS_IAT_FLAG)) ? TRUE : FALSE,
+                                            ((Flags & PROCESS_IAT_FLAG) && (DllObj.m_ImageBase != ProcObj.m_ImageBase)) ? TRUE : FALSE,
+                                            (Flags & PROCESS_HASHES_FLAG) ? TRUE : FALSE,
+                                            &ImageArena, Tasks);
+                }
+            }
 
-        if (Flags & PROCESS_DLLS_FLAG) ProcObj.GetDlls();
+            ProcObj.RestoreContext();
+        }
 
-        if (Initialized && (Flags & PROCESS_EXPORTS_FLAG)) ProcObj.RtlGetExports();
+        vector<BOOLEAN> Failed;
 
-        if (Flags & PROCESS_DLLS_FLAG)
+        if (g_Scheduler.Run((ULONG)Tasks.size(), [&Tasks](ULONG Index)
         {
-            for (ULONG j = 0; j < ProcObj.m_DllList.size(); j++)
+            Tasks[Index].Image->ParseImage();
+            if (Tasks[Index].Exports) Tasks[Index].Image->RtlGetExports();
+            if (Tasks[Index].Imports) Tasks[Index].Image->RtlGetImports();
+        }, &Failed))
+        {
+            g_Ext->Warn("Warning: %d image(s) could not be parsed, their exports and imports may be incomplete.\n",
+                        (ULONG)count(Failed.begin(), Failed.end(), TRUE));
+        }
+
+        for (ULONG t = 0; t < Tasks.size(); t += 1)
+        {
+            //
+            // A partial parse is not shared with the other processes.
+            //
+            if (Tasks[t].Cacheable && !Failed[t]) g_ImageCache.Insert(Tasks[t].Image, &Tasks[t].Identity, Tasks[t].Exports, Tasks[t].Imports);
+        }
+
+        for (ULONG i = First; i < Last; i++)
+        {
+            MsProcessObject& ProcObj = ProcessList[i];
+            BOOLEAN Switched = FALSE;
+
+            //
+            // Export entries pointing outside of their image have to be probed in the target.
+            //
+            for (ULONG j = 0; j <= ProcObj.m_DllList.size(); j++)
             {
-                MsDllObject& DllObj = ProcObj.m_DllList[j];
+                PEFile *Image = (j == 0) ? (PEFile *)&ProcObj : (PEFile *)&ProcObj.m_DllList[j - 1];
 
-                if (Flags & PROCESS_DLL_EXPORTS_FLAG)
+                if (Image->m_Exports.size() && Image->m_NumberOfHookedAPIs)
                 {
-                    DllObj.GetInfoFull();
+                    if (!Switched) Switched = ProcObj.SwitchContext();
+                    Image->RtlProbeRemoteExports();
+                }
 
-                    DllObj.RtlGetExports();
+                if (j) Image->Free();
+            }
 
-                    DllObj.Free();
-                }
+            if (Flags & PROCESS_IAT_FLAG)
+            {
+                if (!Switched) Switched = ProcObj.SwitchContext();
+                CheckImports(ProcObj);
             }
-        }
 
-        ProcObj.Free();
+            if (Switched) ProcObj.RestoreContext();
 
-        ProcObj.RestoreContext();
+            ProcObj.Free();
+        }
+
+        ImageArena.Reset();
     }
 
     //
@@ -711,6 +996,59 @@ ProcessArray GetProcesses(
     return ProcessList;
 }
 
+VOID
+ScanProcessVads(
+    ProcessArray& Processes,
+    const ScanScheduler::PROGRESS_ROUTINE& Progress
+)
+{
+    vector<SCAN_REGION> Regions;
+    ULONG64 ProcessDataOffset = 0;
+    ULONG Index = 0;
+
+    for (ULONG i = 0; i < Processes.size(); i += 1)
+    {
+        MsProcessObject& ProcObj = Processes[i];
+
+        ProcObj.MmGetVads();
+
+        for (VAD_OBJECT& Vad : ProcObj.m_Vads)
+        {
+            SCAN_REGION Region = { 0 };
+
+            Region.ProcessObject = ProcObj.m_CcProcessObject.ProcessObjectPtr;
+            Region.BaseAddress = Vad.StartingVpn * PAGE_SIZE;
+            Region.Size = (Vad.EndingVpn - Vad.StartingVpn + 1) * PAGE_SIZE;
+            Region.Process = i;
+            Region.Flags = (Vad.Protection & MM_READWRITE) ? MALSCORE_REGION_WRITABLE : 0;
+
+            Regions.push_back(Region);
+        }
+    }
+
+    //
+    // The reader switches the implicit process from one region to the other.
+    //
+    g_Ext->m_System2->GetImplicitProcessDataOffset(&ProcessDataOffset);
+
+    ScanScheduler Scheduler(ReadScanRegionRemote, g_Scheduler.GetWorkerCount(), SCAN_MEMORY_BUDGET);
+    Scheduler.Run(Regions, Progress);
+
+    if (ProcessDataOffset) g_Ext->m_System2->SetImplicitProcessDataOffset(ProcessDataOffset);
+
+    for (MsProcessObject& ProcObj : Processes)
+    {
+        for (VAD_OBJECT& Vad : ProcObj.m_Vads)
+        {
+            Vad.MalScore = Regions[Index].Score;
+            Vad.Rules = Regions[Index].Rules;
+            Vad.NumberOfRules = Regions[Index].NumberOfRules;
+            Vad.Entropy = Regions[Index].Entropy;
+            Index += 1;
+        }
+    }
+}
+
 MsProcessObject
 FindProcessByName(
     LPSTR ProcessName
@@ -813,7 +1151,6 @@ MsProcessObject::MmGetFirstVad(
     MmVad = ExtRemoteTyped("(nt!_MMVAD *)@$extin", VadInfo->CurrentNode);
     VadInfo->StartingVpn = MmVad.Field("StartingVpn").GetPtr();
     VadInfo->EndingVpn = MmVad.Field("EndingVpn").GetPtr();
-    VadInfo->EndingVpn += 1;
 
     return TRUE;
 }
@@ -894,7 +1231,6 @@ PVAD_OBJECT VadInfo
     MmVad = ExtRemoteTyped("(nt!_MMVAD *)@$extin", VadInfo->CurrentNode);
     VadInfo->StartingVpn = MmVad.Field("StartingVpn").GetPtr();
     VadInfo->EndingVpn = MmVad.Field("EndingVpn").GetPtr();
-    VadInfo->EndingVpn += 1;
 
     if (MmVad.HasField("u.VadFlags.VadType"))
     {
@@ -987,4 +1323,74 @@ MsProcessObject::GetThreads()
     }
 
     return TRUE;
-}
\ No newline at end of file
+}
+
+BOOLEAN
+ReadMalScoreRemote(
+    PVOID Context,
+    ULONG64 Offset,
+    LPBYTE Buffer,
+    ULONG Length
+)
+{
+    ULONG64 Address = *(PULONG64)Context + Offset;
+    ULONG Done = 0;
+
+    //
+    // Page by page, unreadable pages are left as zeroes.
+    //
+    while (Done < Length)
+    {
+        ULONG Size = PAGE_SIZE - (ULONG)((Address + Done) & (PAGE_SIZE - 1));
+        if (Size > (Length - Done)) Size = Length - Done;
+
+        if (g_Ext->m_Data->ReadVirtual(Address + Done, Buffer + Done, Size, NULL) != S_OK)
+        {
+            RtlZeroMemory(Buffer + Done, Size);
+
+            //
+            // Same as ExtRemoteTypedEx::ReadVirtual(), an invalid base address is an error.
+            //
+            if (Done == 0) return FALSE;
+        }
+
+        Done += Size;
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+ReadScanRegionRemote(
+    ULONG64 ProcessObject,
+    ULONG64 Address,
+    LPBYTE Buffer,
+    ULONG Length
+)
+{
+    ULONG64 Current = 0;
+
+    if ((g_Ext->m_System2->GetImplicitProcessDataOffset(&Current) == S_OK) && (Current != ProcessObject))
+    {
+        g_Ext->m_System2->SetImplicitProcessDataOffset(ProcessObject);
+    }
+
+    return ReadMalScoreRemote(&Address, 0, Buffer, Length);
+}
+
+ULONG
+GetMalScoreEx(
+    BOOLEAN Verbose,
+    MsProcessObject *ProcObj,
+    ULONG64 BaseAddress,
+    ULONG64 Length
+)
+{
+    ULONG MalScore = 0;
+
+    ProcObj->SwitchContext();
+    GetMalScoreStream(Verbose, BaseAddress, Length, ReadMalScoreRemote, &BaseAddress, 0, MALSCORE_REGION_WRITABLE, &MalScore);
+    ProcObj->RestoreContext();
+
+    return MalScore;
+}
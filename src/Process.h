@@ -38,36 +38,6 @@ Revision History:
 #ifndef __PROCESS_H__
 #define __PROCESS_H__
 
-#define DEREF_POINTER(Ptr) { \
-if (Ptr && (g_References[Ptr] >= 1)) \
-    { \
-        g_References[Ptr] -= 1; \
-        /* g_Ext->Dml("(%s:%d::%s) [%d] ", __FILE__, __LINE__, __FUNCTION__, g_References[Ptr]); */ \
-        if (g_References[Ptr] == 0) \
-        {\
-            /* g_Ext->Dml("free(Ptr) = %p", Ptr); */ \
-            free(Ptr); \
-        } \
-        Ptr = NULL; \
-        /* g_Ext->Dml("\n"); */\
-    } \
-}
-
-#define REF_POINTER(Ptr) { \
-if (Ptr) \
-    { \
-        if (g_References.find(Ptr) == g_References.end()) \
-        { \
-            g_References.insert(pair<PVOID, ULONG>(Ptr, 1)); \
-        } \
-        else \
-        { \
-            g_References[Ptr] += 1; \
-        } \
-        /* g_Ext->Dml("(%s:%d::%s) [%d] Ref(%p) \n", __FILE__, __LINE__, __FUNCTION__, g_References[Ptr], Ptr); */ \
-    } \
-}
-
 #define MM_READONLY            1
 #define MM_EXECUTE             2
 #define MM_EXECUTE_READ        3
@@ -84,6 +54,24 @@ if (Ptr) \
 #define PROCESS_VADS_FLAG (1 << 5)
 #define PROCESS_THREADS_FLAG (1 << 6)
 #define PROCESS_ENVVAR_FLAG (1 << 7)
+#define PROCESS_IAT_FLAG (1 << 8)
+#define PROCESS_HASHES_FLAG (1 << 9)
+
+//
+// MsProcessObject fields that are only read from the target when needed, by the first
+// call of their accessor (see MsProcessObject::Materialize()).
+//
+#define PROCESS_FIELD_FULLPATH (1 << 0)
+#define PROCESS_FIELD_PARAMETERS (1 << 1) // CommandLine, DllPath, ImagePathName
+#define PROCESS_FIELD_ENVIRONMENT (1 << 2)
+#define PROCESS_FIELD_ALL (PROCESS_FIELD_FULLPATH | PROCESS_FIELD_PARAMETERS | PROCESS_FIELD_ENVIRONMENT)
+
+#define EPROCESS_MAX_SIZE 0x1000
+
+//
+// Upper bound of captured image bytes kept in memory by GetProcesses() at once.
+//
+#define PROCESS_BATCH_MAX_SIZE (256 * 1024 * 1024)
 
 #define OBP_CREATOR_INFO_BIT 0x1
 #define OBP_NAME_INFO_BIT 0x2
@@ -123,7 +111,7 @@ typedef struct _VAD_OBJECT {
     ULONG64 FirstNode;
     ULONG64 CurrentNode;
     ULONG64 StartingVpn;
-    ULONG64 EndingVpn;
+    ULONG64 EndingVpn; // Last page of the range, as in the _MMVAD.
 
     ULONG32 VadType;
     ULONG32 Protection;
@@ -131,6 +119,11 @@ typedef struct _VAD_OBJECT {
     ULONG32 MemCommit;
 
     ULONG64 FileObject;
+
+    ULONG MalScore; // Set by ScanProcessVads().
+    PULONG Rules; // Indexes in g_MalScoreRules.m_Rules of the rules that hit.
+    ULONG NumberOfRules;
+    ENTROPY_SUMMARY Entropy;
 } VAD_OBJECT, *PVAD_OBJECT;
 
 class ModuleIterator {
@@ -200,7 +193,23 @@ public:
     }
     ~MsDllObject();
 
-    MsDllObject::MsDllObject(const MsDllObject& other);
+    MsDllObject(MsDllObject&& other) :
+        PEFile(move(other)),
+        mm_CcDllObject(other.mm_CcDllObject),
+        m_TypedObject(other.m_TypedObject)
+    {
+    }
+
+    MsDllObject& operator=(MsDllObject&& other)
+    {
+        if (this != &other)
+        {
+            MoveFrom(other);
+            mm_CcDllObject = other.mm_CcDllObject;
+            m_TypedObject = other.m_TypedObject;
+        }
+        return *this;
+    }
 
     VOID Set();
 
@@ -245,23 +254,34 @@ public:
         WCHAR WindowTitle[256];
         LPWSTR DllPath;
         LPWSTR ImagePathName;
+
+        ULONG64 Peb;
     } CACHED_PROCESS_OBJECT, *PCACHED_PROCESS_OBJECT;
 
     MsProcessObject()
     {
         Clear();
+        RtlZeroMemory(&m_CcProcessObject, sizeof(m_CcProcessObject));
+        m_EnvVarsBuffer = NULL;
+        m_FieldsLoaded = PROCESS_FIELD_ALL;
+        m_ProcessDataOffset = 0;
     }
 
-    /*
-    MsProcessObject(MsProcessObject &other)
+    MsProcessObject(MsProcessObject&& other) :
+        PEFile(move(other))
     {
-        m_DllList = other.m_DllList;
-        m_CcProcessObject = other.m_CcProcessObject;
-        m_Image = other.m_Image;
-        m_ProcessDataOffset = other.m_ProcessDataOffset;
-        m_TypedObject = other.m_TypedObject;
-    }*/
-    MsProcessObject(const MsProcessObject& other); // copy constructor
+        MoveFields(other);
+    }
+
+    MsProcessObject& operator=(MsProcessObject&& other)
+    {
+        if (this != &other)
+        {
+            MoveFrom(other);
+            MoveFields(other);
+        }
+        return *this;
+    }
 
     MsProcessObject(ExtRemoteTyped Object)
     {
@@ -273,7 +293,12 @@ public:
     ~MsProcessObject();
 
     VOID Set();
-    VOID Release() throw(...);
+
+    VOID Materialize(ULONG Fields);
+
+    LPCWSTR GetFullPath(VOID);
+    LPCWSTR GetProcessCommandLine(VOID);
+    ArenaVector<ENV_VAR_OBJECT>& GetEnvVars(VOID);
 
     BOOLEAN GetDlls();
     BOOLEAN GetHandles();
@@ -292,26 +317,69 @@ public:
 
     CACHED_PROCESS_OBJECT m_CcProcessObject;
 
-    vector<ENV_VAR_OBJECT> m_EnvVars;
+    ArenaVector<ENV_VAR_OBJECT> m_EnvVars;
 
-    vector<MsDllObject> m_DllList;
-    vector<HANDLE_OBJECT> m_Handles;
-    vector<VAD_OBJECT> m_Vads;
-    vector<THREAD_OBJECT> m_Threads;
+    ArenaVector<MsDllObject> m_DllList;
+    ArenaVector<HANDLE_OBJECT> m_Handles;
+    ArenaVector<VAD_OBJECT> m_Vads;
+    ArenaVector<THREAD_OBJECT> m_Threads;
 
     ULONG64 m_ProcessDataOffset;
 
     ExtRemoteTyped m_TypedObject;
     LPWSTR m_EnvVarsBuffer;
+
+    ULONG m_FieldsLoaded; // PROCESS_FIELD_*
+
+private:
+    BOOLEAN SetFromLayout(VOID);
+
+    VOID MoveFields(MsProcessObject& other);
 };
 
 typedef vector<MsProcessObject> ProcessArray;
 
 ProcessArray GetProcesses(ULONG64 Pid, ULONG Flags);
 
+//
+// Lists the VADs of every process and scores them all at once with a ScanScheduler.
+//
+VOID ScanProcessVads(ProcessArray& Processes, const ScanScheduler::PROGRESS_ROUTINE& Progress);
+
+VOID InvalidateProcessLayout(VOID);
+
 MsProcessObject FindProcessByName(LPSTR ProcessName);
 MsProcessObject FindProcessByPid(ULONG64 ProcessId);
 
-extern map<PVOID, ULONG> g_References;
+//
+// MalScore reader of the current process context, Context points to the ULONG64 base address.
+//
+BOOLEAN
+ReadMalScoreRemote(
+    PVOID Context,
+    ULONG64 Offset,
+    LPBYTE Buffer,
+    ULONG Length
+);
+
+//
+// Reader from the target, switches the implicit process when it changes. The caller restores
+// the original one after ScanScheduler::Run().
+//
+BOOLEAN
+ReadScanRegionRemote(
+    ULONG64 ProcessObject,
+    ULONG64 Address,
+    LPBYTE Buffer,
+    ULONG Length
+);
+
+ULONG
+GetMalScoreEx(
+    BOOLEAN Verbose,
+    MsProcessObject *ProcObj,
+    ULONG64 BaseAddress,
+    ULONG64 Length
+);
 
 #endif
\ No newline at end of file
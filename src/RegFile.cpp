@@ -0,0 +1,562 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - RegFile.cpp
+
+Abstract:
+
+    - Cell indexes of a hive file are offsets from the end of the base block,
+      so a cell is the view + 0x1000 + index: no map translation as with the
+      _CMHIVE of a live hive, only bounds checks against the bins.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wctype.h>
+#include <vector>
+using namespace std;
+
+#include "RegFile.h"
+
+RegFile::RegFile(
+)
+{
+    m_File = INVALID_HANDLE_VALUE;
+    m_Mapping = NULL;
+    m_View = NULL;
+    m_End = 0;
+    m_RootCell = REGF_CELL_NIL;
+
+    m_FileSize = 0;
+    m_Major = 0;
+    m_Minor = 0;
+    m_Dirty = FALSE;
+    m_ValidCheckSum = FALSE;
+    m_InvalidCells = 0;
+
+    m_Stack.reserve(REGF_MAX_DEPTH);
+}
+
+RegFile::~RegFile(
+)
+{
+    Close();
+}
+
+BOOLEAN
+RegFile::Open(
+    LPCSTR FileName
+)
+{
+    PREGF_BASE_BLOCK BaseBlock;
+    LARGE_INTEGER FileSize;
+    REGF_KEY Root;
+    ULONG CheckSum = 0;
+
+    Close();
+
+    m_File = CreateFileA(FileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_File == INVALID_HANDLE_VALUE) goto Failed;
+
+    if (!GetFileSizeEx(m_File, &FileSize)) goto Failed;
+    if (FileSize.QuadPart < REGF_BASE_BLOCK_SIZE) goto Failed;
+    m_FileSize = FileSize.QuadPart;
+
+    m_Mapping = CreateFileMappingA(m_File, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m_Mapping == NULL) goto Failed;
+
+    m_View = (const UCHAR *)MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0);
+    if (m_View == NULL) goto Failed;
+
+    BaseBlock = (PREGF_BASE_BLOCK)m_View;
+    if (BaseBlock->Signature != REGF_SIGNATURE) goto Failed;
+    if (BaseBlock->Major != 1) goto Failed;
+
+    m_Major = BaseBlock->Major;
+    m_Minor = BaseBlock->Minor;
+    m_Dirty = (BaseBlock->Sequence1 != BaseBlock->Sequence2);
+
+    for (ULONG i = 0; i < FIELD_OFFSET(REGF_BASE_BLOCK, CheckSum) / sizeof(ULONG); i += 1) CheckSum ^= ((PULONG)m_View)[i];
+    if (CheckSum == 0) CheckSum = 1;
+    else if (CheckSum == 0xFFFFFFFF) CheckSum = 0xFFFFFFFE;
+    m_ValidCheckSum = (CheckSum == BaseBlock->CheckSum);
+
+    //
+    // Truncated files (e.g. carved) are parsed up to their end.
+    //
+    m_End = min(m_FileSize, (ULONG64)REGF_BASE_BLOCK_SIZE + BaseBlock->Length);
+    m_RootCell = BaseBlock->RootCell;
+
+    if (!ReadKey(m_RootCell, 0, &Root)) goto Failed;
+
+    return TRUE;
+
+Failed:
+    Close();
+    return FALSE;
+}
+
+VOID
+RegFile::Close(
+)
+{
+    if (m_View) UnmapViewOfFile(m_View);
+    if (m_Mapping) CloseHandle(m_Mapping);
+    if (m_File != INVALID_HANDLE_VALUE) CloseHandle(m_File);
+
+    m_File = INVALID_HANDLE_VALUE;
+    m_Mapping = NULL;
+    m_View = NULL;
+    m_End = 0;
+    m_RootCell = REGF_CELL_NIL;
+    m_InvalidCells = 0;
+}
+
+//
+// Returns the data of an allocated cell holding at least MinSize bytes, NULL otherwise.
+//
+const UCHAR *
+RegFile::GetCell(
+    ULONG Cell,
+    ULONG MinSize,
+    PULONG Size
+)
+{
+    ULONG64 Offset;
+    LONG CellSize;
+
+    if ((m_View == NULL) || (Cell == REGF_CELL_NIL) || (Cell & (sizeof(LONG) - 1))) return NULL;
+
+    Offset = (ULONG64)REGF_BASE_BLOCK_SIZE + Cell;
+    if ((Offset + sizeof(LONG)) > m_End) return NULL;
+
+    //
+    // Allocated cells have a negative size, header included.
+    //
+    CellSize = *(LONG *)(m_View + Offset);
+    if ((CellSize >= 0) || (CellSize == LONG_MIN)) return NULL;
+
+    CellSize = -CellSize;
+    if (((ULONG)CellSize < sizeof(LONG) + MinSize) || ((Offset + CellSize) > m_End)) return NULL;
+
+    if (Size) *Size = CellSize - sizeof(LONG);
+
+    return m_View + Offset + sizeof(LONG);
+}
+
+BOOLEAN
+RegFile::ReadKey(
+    ULONG Cell,
+    ULONG Depth,
+    PREGF_KEY Key
+)
+{
+    PREGF_KEY_NODE KeyNode;
+    ULONG Size;
+
+    KeyNode = (PREGF_KEY_NODE)GetCell(Cell, FIELD_OFFSET(REGF_KEY_NODE, Name), &Size);
+    if ((KeyNode == NULL) || (KeyNode->Signature != REGF_KEY_NODE_SIGNATURE)) return FALSE;
+    if (KeyNode->NameLength > (Size - FIELD_OFFSET(REGF_KEY_NODE, Name))) return FALSE;
+
+    Key->Cell = Cell;
+    Key->Parent = KeyNode->Parent;
+    Key->Depth = Depth;
+    Key->LastWriteTime = KeyNode->LastWriteTime;
+    Key->NumberOfSubKeys = KeyNode->SubKeyCounts[0];
+    Key->SubKeyList = KeyNode->SubKeyLists[0];
+    Key->NumberOfValues = KeyNode->ValueCount;
+    Key->ValueList = KeyNode->ValueList;
+    Key->Security = KeyNode->Security;
+    Key->CompressedName = (KeyNode->Flags & REGF_KEY_COMP_NAME) ? TRUE : FALSE;
+    Key->NameLength = KeyNode->NameLength;
+    Key->Name = KeyNode->Name;
+
+    return TRUE;
+}
+
+//
+// Cursors start at { List, 0, REGF_CELL_NIL, 0 }. ri lists only point to leaves (li, lf, lh).
+//
+BOOLEAN
+RegFile::NextSubKey(
+    PLIST_CURSOR Cursor,
+    PULONG Cell
+)
+{
+    PREGF_KEY_INDEX Index;
+    ULONG Size, Stride;
+
+    while (TRUE)
+    {
+        if (Cursor->Leaf != REGF_CELL_NIL)
+        {
+            Index = (PREGF_KEY_INDEX)GetCell(Cursor->Leaf, FIELD_OFFSET(REGF_KEY_INDEX, List), &Size);
+            if ((Index == NULL) ||
+                ((Index->Signature != REGF_INDEX_LEAF_SIGNATURE) &&
+                 (Index->Signature != REGF_FAST_LEAF_SIGNATURE) &&
+                 (Index->Signature != REGF_HASH_LEAF_SIGNATURE)))
+            {
+                m_InvalidCells += 1;
+                Cursor->Leaf = REGF_CELL_NIL;
+                continue;
+            }
+
+            Stride = (Index->Signature == REGF_INDEX_LEAF_SIGNATURE) ? 1 : 2;
+            if ((Cursor->LeafIndex < Index->Count) &&
+                (Cursor->LeafIndex < ((Size - FIELD_OFFSET(REGF_KEY_INDEX, List)) / (Stride * sizeof(ULONG)))))
+            {
+                *Cell = Index->List[Cursor->LeafIndex * Stride];
+                Cursor->LeafIndex += 1;
+                return TRUE;
+            }
+
+            Cursor->Leaf = REGF_CELL_NIL;
+        }
+
+        Index = (PREGF_KEY_INDEX)GetCell(Cursor->List, FIELD_OFFSET(REGF_KEY_INDEX, List), &Size);
+        if (Index == NULL)
+        {
+            m_InvalidCells += 1;
+            return FALSE;
+        }
+
+        switch (Index->Signature)
+        {
+            case REGF_INDEX_ROOT_SIGNATURE:
+            case REGF_INDEX_LEAF_SIGNATURE:
+                Stride = 1;
+            break;
+            case REGF_FAST_LEAF_SIGNATURE:
+            case REGF_HASH_LEAF_SIGNATURE:
+                Stride = 2;
+            break;
+            default:
+                m_InvalidCells += 1;
+                return FALSE;
+        }
+
+        if ((Cursor->Index >= Index->Count) ||
+            (Cursor->Index >= ((Size - FIELD_OFFSET(REGF_KEY_INDEX, List)) / (Stride * sizeof(ULONG))))) return FALSE;
+
+        *Cell = Index->List[Cursor->Index * Stride];
+        Cursor->Index += 1;
+
+        if (Index->Signature != REGF_INDEX_ROOT_SIGNATURE) return TRUE;
+
+        Cursor->Leaf = *Cell;
+        Cursor->LeafIndex = 0;
+    }
+}
+
+BOOLEAN
+RegFile::GetRootKey(
+    PREGF_KEY Key
+)
+{
+    return ReadKey(m_RootCell, 0, Key);
+}
+
+BOOLEAN
+RegFile::OpenKey(
+    PREGF_KEY Parent,
+    LPCSTR Path,
+    PREGF_KEY Key
+)
+{
+    REGF_KEY Current = *Parent;
+
+    while (*Path)
+    {
+        LPCSTR End = Path;
+        LIST_CURSOR Cursor;
+        ULONG Cell;
+        BOOLEAN Found = FALSE;
+
+        while (*End && (*End != '\\')) End += 1;
+
+        if (End != Path)
+        {
+            ULONG Length = (ULONG)(End - Path);
+
+            Cursor.List = Current.SubKeyList;
+            Cursor.Index = 0;
+            Cursor.Leaf = REGF_CELL_NIL;
+            Cursor.LeafIndex = 0;
+
+            while (Current.NumberOfSubKeys && !Found && NextSubKey(&Cursor, &Cell))
+            {
+                REGF_KEY SubKey;
+                WCHAR Name[256];
+
+                if (!ReadKey(Cell, Current.Depth + 1, &SubKey)) continue;
+                if (GetName(SubKey.Name, SubKey.NameLength, SubKey.CompressedName, Name, _countof(Name)) != Length) continue;
+
+                Found = TRUE;
+                for (ULONG i = 0; Found && (i < Length); i += 1)
+                {
+                    if (towupper(Name[i]) != towupper((UCHAR)Path[i])) Found = FALSE;
+                }
+
+                if (Found) Current = SubKey;
+            }
+
+            if (!Found) return FALSE;
+        }
+
+        Path = *End ? End + 1 : End;
+    }
+
+    *Key = Current;
+    return TRUE;
+}
+
+BOOLEAN
+RegFile::Walk(
+    PREGF_KEY Key,
+    ULONG MaxDepth,
+    PREGF_KEY_ROUTINE Routine,
+    PVOID Context
+)
+{
+    WALK_FRAME Frame;
+    REGF_KEY SubKey;
+    ULONG Cell;
+
+    if (MaxDepth == 0 || MaxDepth >= REGF_MAX_DEPTH) MaxDepth = REGF_MAX_DEPTH - 1;
+
+    SubKey = *Key;
+    SubKey.Depth = 0;
+    if (!Routine(Context, &SubKey)) return FALSE;
+
+    m_Stack.clear();
+
+    Frame.Cell = SubKey.Cell;
+    Frame.Cursor.List = SubKey.SubKeyList;
+    Frame.Cursor.Index = 0;
+    Frame.Cursor.Leaf = REGF_CELL_NIL;
+    Frame.Cursor.LeafIndex = 0;
+    if (SubKey.NumberOfSubKeys) m_Stack.push_back(Frame);
+
+    while (!m_Stack.empty())
+    {
+        BOOLEAN Loop = FALSE;
+        ULONG Depth = (ULONG)m_Stack.size();
+
+        if (!NextSubKey(&m_Stack.back().Cursor, &Cell))
+        {
+            m_Stack.pop_back();
+            continue;
+        }
+
+        if (!ReadKey(Cell, Depth, &SubKey))
+        {
+            m_InvalidCells += 1;
+            continue;
+        }
+
+        //
+        // Corrupted lists could point back to an ancestor.
+        //
+        for (ULONG i = 0; !Loop && (i < m_Stack.size()); i += 1) Loop = (m_Stack[i].Cell == Cell);
+        if (Loop)
+        {
+            m_InvalidCells += 1;
+            continue;
+        }
+
+        if (!Routine(Context, &SubKey)) return FALSE;
+
+        if (SubKey.NumberOfSubKeys && (Depth < MaxDepth))
+        {
+            Frame.Cell = Cell;
+            Frame.Cursor.List = SubKey.SubKeyList;
+            Frame.Cursor.Index = 0;
+            Frame.Cursor.Leaf = REGF_CELL_NIL;
+            Frame.Cursor.LeafIndex = 0;
+            m_Stack.push_back(Frame);
+        }
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+RegFile::GetValue(
+    PREGF_KEY Key,
+    ULONG Index,
+    PREGF_VALUE Value
+)
+{
+    const ULONG *ValueList;
+    PREGF_KEY_VALUE KeyValue;
+    ULONG Size;
+
+    if (Index >= Key->NumberOfValues) return FALSE;
+
+    ValueList = (const ULONG *)GetCell(Key->ValueList, 0, &Size);
+    if ((ValueList == NULL) || (Index >= (Size / sizeof(ULONG)))) return FALSE;
+
+    KeyValue = (PREGF_KEY_VALUE)GetCell(ValueList[Index], FIELD_OFFSET(REGF_KEY_VALUE, Name), &Size);
+    if ((KeyValue == NULL) || (KeyValue->Signature != REGF_KEY_VALUE_SIGNATURE)) return FALSE;
+    if (KeyValue->NameLength > (Size - FIELD_OFFSET(REGF_KEY_VALUE, Name))) return FALSE;
+
+    Value->Cell = ValueList[Index];
+    Value->Type = KeyValue->Type;
+    Value->DataLength = KeyValue->DataLength & ~REGF_VALUE_SPECIAL_SIZE;
+    Value->Data = KeyValue->Data;
+    Value->Inline = (KeyValue->DataLength & REGF_VALUE_SPECIAL_SIZE) ? TRUE : FALSE;
+    Value->CompressedName = (KeyValue->Flags & REGF_VALUE_COMP_NAME) ? TRUE : FALSE;
+    Value->NameLength = KeyValue->NameLength;
+    Value->Name = KeyValue->Name;
+
+    return TRUE;
+}
+
+BOOLEAN
+RegFile::GetValueData(
+    PREGF_VALUE Value,
+    vector<UCHAR>& Buffer,
+    const UCHAR **Data,
+    PULONG DataLength
+)
+{
+    PREGF_BIG_DATA BigData;
+    const ULONG *Segments;
+    ULONG Size;
+
+    *Data = NULL;
+    *DataLength = 0;
+
+    if (Value->Inline)
+    {
+        if (Value->DataLength > sizeof(Value->Data)) return FALSE;
+
+        Buffer.resize(sizeof(Value->Data));
+        memcpy(Buffer.data(), &Value->Data, sizeof(Value->Data));
+
+        *Data = Buffer.data();
+        *DataLength = Value->DataLength;
+        return TRUE;
+    }
+
+    if (Value->DataLength == 0) return TRUE;
+
+    if ((Value->DataLength > REGF_BIG_DATA_SEGMENT) && (m_Minor >= REGF_BIG_DATA_MIN_MINOR))
+    {
+        BigData = (PREGF_BIG_DATA)GetCell(Value->Data, sizeof(REGF_BIG_DATA), NULL);
+        if (BigData && (BigData->Signature == REGF_BIG_DATA_SIGNATURE))
+        {
+            Segments = (const ULONG *)GetCell(BigData->List, BigData->Count * sizeof(ULONG), NULL);
+            if (Segments == NULL) return FALSE;
+
+            //
+            // Segments hold REGF_BIG_DATA_SEGMENT bytes, except the last one.
+            //
+
+            Buffer.resize(Value->DataLength);
+
+            for (ULONG i = 0, Copied = 0; (i < BigData->Count) && (Copied < Value->DataLength); i += 1)
+            {
+                ULONG Length = min(Value->DataLength - Copied, (ULONG)REGF_BIG_DATA_SEGMENT);
+                const UCHAR *Segment = GetCell(Segments[i], Length, NULL);
+
+                if (Segment == NULL) return FALSE;
+
+                memcpy(Buffer.data() + Copied, Segment, Length);
+                Copied += Length;
+
+                if (Copied == Value->DataLength)
+                {
+                    *Data = Buffer.data();
+                    *DataLength = Value->DataLength;
+                    return TRUE;
+                }
+            }
+
+            return FALSE;
+        }
+    }
+
+    //
+    // Older hives have big values in a single cell.
+    //
+    *Data = GetCell(Value->Data, Value->DataLength, &Size);
+    if (*Data == NULL) return FALSE;
+
+    *DataLength = Value->DataLength;
+    return TRUE;
+}
+
+BOOLEAN
+RegFile::GetSecurityDescriptor(
+    PREGF_KEY Key,
+    const UCHAR **Descriptor,
+    PULONG DescriptorLength
+)
+{
+    PREGF_KEY_SECURITY Security;
+    ULONG Size;
+
+    Security = (PREGF_KEY_SECURITY)GetCell(Key->Security, FIELD_OFFSET(REGF_KEY_SECURITY, Descriptor), &Size);
+    if ((Security == NULL) || (Security->Signature != REGF_SECURITY_SIGNATURE)) return FALSE;
+    if (Security->DescriptorLength > (Size - FIELD_OFFSET(REGF_KEY_SECURITY, Descriptor))) return FALSE;
+
+    *Descriptor = Security->Descriptor;
+    *DescriptorLength = Security->DescriptorLength;
+
+    return TRUE;
+}
+
+ULONG
+RegFile::GetName(
+    const UCHAR *Name,
+    USHORT NameLength,
+    BOOLEAN CompressedName,
+    LPWSTR Buffer,
+    ULONG NameSize
+)
+{
+    ULONG Length = CompressedName ? NameLength : (NameLength / sizeof(USHORT));
+    ULONG i;
+
+    if (NameSize == 0) return 0;
+
+    for (i = 0; (i < Length) && (i < (NameSize - 1)); i += 1)
+    {
+        Buffer[i] = CompressedName ? (WCHAR)Name[i] : (WCHAR)(Name[i * 2] | (Name[(i * 2) + 1] << 8));
+    }
+
+    Buffer[i] = L'\0';
+
+    return i;
+}
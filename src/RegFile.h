@@ -0,0 +1,314 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - RegFile.h
+
+Abstract:
+
+    - Offline parser for registry hive files (regf), e.g. hives extracted
+      from a disk image. The file is mapped and cells are resolved as
+      offsets in the view, every access is bounds checked.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __REGFILE_H__
+#define __REGFILE_H__
+
+#define REGF_SIGNATURE 'fger'
+#define REGF_BASE_BLOCK_SIZE 0x1000 // Bins (and cell offsets) start after the base block.
+
+#define REGF_KEY_NODE_SIGNATURE 'kn'
+#define REGF_KEY_VALUE_SIGNATURE 'kv'
+#define REGF_FAST_LEAF_SIGNATURE 'fl'
+#define REGF_HASH_LEAF_SIGNATURE 'hl'
+#define REGF_INDEX_LEAF_SIGNATURE 'il'
+#define REGF_INDEX_ROOT_SIGNATURE 'ir'
+#define REGF_SECURITY_SIGNATURE 'ks'
+#define REGF_BIG_DATA_SIGNATURE 'bd'
+
+#define REGF_CELL_NIL 0xFFFFFFFF
+
+#define REGF_KEY_COMP_NAME 0x20
+#define REGF_VALUE_COMP_NAME 0x1
+#define REGF_VALUE_SPECIAL_SIZE 0x80000000 // Up to 4 bytes stored in the Data field.
+
+//
+// Values bigger than a segment are stored in db cells since 1.4 hives.
+//
+#define REGF_BIG_DATA_SEGMENT 16344
+#define REGF_BIG_DATA_MIN_MINOR 4
+
+#define REGF_MAX_DEPTH 512
+
+#pragma pack(push, 1)
+typedef struct _REGF_BASE_BLOCK {
+    ULONG Signature;
+    ULONG Sequence1;
+    ULONG Sequence2; // Differs from Sequence1 if the hive was not flushed (see the .LOG files).
+    ULONG64 TimeStamp;
+    ULONG Major;
+    ULONG Minor;
+    ULONG Type;
+    ULONG Format;
+    ULONG RootCell;
+    ULONG Length; // Of the bins.
+    ULONG Cluster;
+    WCHAR FileName[32];
+    ULONG Reserved[99];
+    ULONG CheckSum; // Xor of the previous ULONGs.
+} REGF_BASE_BLOCK, *PREGF_BASE_BLOCK;
+
+typedef struct _REGF_KEY_NODE {
+    USHORT Signature;
+    USHORT Flags;
+    ULONG64 LastWriteTime;
+    ULONG Spare;
+    ULONG Parent;
+    ULONG SubKeyCounts[2]; // Stable, volatile (always 0 in a file).
+    ULONG SubKeyLists[2];
+    ULONG ValueCount;
+    ULONG ValueList;
+    ULONG Security;
+    ULONG Class;
+    ULONG MaxNameLen;
+    ULONG MaxClassLen;
+    ULONG MaxValueNameLen;
+    ULONG MaxValueDataLen;
+    ULONG WorkVar;
+    USHORT NameLength;
+    USHORT ClassLength;
+    UCHAR Name[1];
+} REGF_KEY_NODE, *PREGF_KEY_NODE;
+
+typedef struct _REGF_KEY_VALUE {
+    USHORT Signature;
+    USHORT NameLength;
+    ULONG DataLength;
+    ULONG Data;
+    ULONG Type;
+    USHORT Flags;
+    USHORT Spare;
+    UCHAR Name[1];
+} REGF_KEY_VALUE, *PREGF_KEY_VALUE;
+
+//
+// li and ri lists hold cells, lf and lh lists hold (cell, hint) pairs.
+//
+typedef struct _REGF_KEY_INDEX {
+    USHORT Signature;
+    USHORT Count;
+    ULONG List[1];
+} REGF_KEY_INDEX, *PREGF_KEY_INDEX;
+
+typedef struct _REGF_KEY_SECURITY {
+    USHORT Signature;
+    USHORT Reserved;
+    ULONG Flink;
+    ULONG Blink;
+    ULONG ReferenceCount;
+    ULONG DescriptorLength;
+    UCHAR Descriptor[1];
+} REGF_KEY_SECURITY, *PREGF_KEY_SECURITY;
+
+typedef struct _REGF_BIG_DATA {
+    USHORT Signature;
+    USHORT Count;
+    ULONG List; // Cell holding the segment cells.
+} REGF_BIG_DATA, *PREGF_BIG_DATA;
+#pragma pack(pop)
+
+class RegFile {
+public:
+    typedef struct _REGF_KEY {
+        ULONG Cell;
+        ULONG Parent;
+        ULONG Depth; // Relative to the key the walk started from.
+        ULONG64 LastWriteTime;
+        ULONG NumberOfSubKeys;
+        ULONG SubKeyList;
+        ULONG NumberOfValues;
+        ULONG ValueList;
+        ULONG Security;
+        BOOLEAN CompressedName; // One byte per character.
+        USHORT NameLength; // In bytes.
+        const UCHAR *Name; // In the view, not terminated.
+    } REGF_KEY, *PREGF_KEY;
+
+    typedef struct _REGF_VALUE {
+        ULONG Cell;
+        ULONG Type;
+        ULONG DataLength;
+        ULONG Data; // Cell, or the data itself (Inline).
+        BOOLEAN Inline;
+        BOOLEAN CompressedName;
+        USHORT NameLength; // 0 for the default value.
+        const UCHAR *Name;
+    } REGF_VALUE, *PREGF_VALUE;
+
+    //
+    // Returns FALSE to stop the walk.
+    //
+    typedef BOOLEAN (*PREGF_KEY_ROUTINE)(
+        PVOID Context,
+        PREGF_KEY Key
+    );
+
+    RegFile(
+    );
+
+    ~RegFile(
+    );
+
+    BOOLEAN
+    Open(
+        LPCSTR FileName
+    );
+
+    VOID
+    Close(
+    );
+
+    BOOLEAN
+    GetRootKey(
+        PREGF_KEY Key
+    );
+
+    //
+    // Path is relative to Parent, '\' separated and case insensitive.
+    //
+    BOOLEAN
+    OpenKey(
+        PREGF_KEY Parent,
+        LPCSTR Path,
+        PREGF_KEY Key
+    );
+
+    //
+    // Calls Routine for Key, then for its subkeys depth first, MaxDepth levels
+    // down (0 for all). Nothing is allocated per key, invalid cells are skipped.
+    // Returns FALSE if Routine stopped the walk.
+    //
+    BOOLEAN
+    Walk(
+        PREGF_KEY Key,
+        ULONG MaxDepth,
+        PREGF_KEY_ROUTINE Routine,
+        PVOID Context
+    );
+
+    BOOLEAN
+    GetValue(
+        PREGF_KEY Key,
+        ULONG Index,
+        PREGF_VALUE Value
+    );
+
+    //
+    // Data points in the view, or in Buffer for inline and big data values.
+    // Buffer is only resized, it can be kept from one value to the next.
+    //
+    BOOLEAN
+    GetValueData(
+        PREGF_VALUE Value,
+        vector<UCHAR>& Buffer,
+        const UCHAR **Data,
+        PULONG DataLength
+    );
+
+    BOOLEAN
+    GetSecurityDescriptor(
+        PREGF_KEY Key,
+        const UCHAR **Descriptor,
+        PULONG DescriptorLength
+    );
+
+    //
+    // Terminated copy of a key or value name, truncated to NameSize characters.
+    //
+    static
+    ULONG
+    GetName(
+        const UCHAR *Name,
+        USHORT NameLength,
+        BOOLEAN CompressedName,
+        LPWSTR Buffer,
+        ULONG NameSize
+    );
+
+    ULONG64 m_FileSize;
+    ULONG m_Major;
+    ULONG m_Minor;
+    BOOLEAN m_Dirty; // Sequence numbers differ.
+    BOOLEAN m_ValidCheckSum;
+    ULONG64 m_InvalidCells; // Skipped by the walks.
+
+private:
+    typedef struct _LIST_CURSOR {
+        ULONG List;
+        ULONG Index;
+        ULONG Leaf; // Current leaf of an ri list.
+        ULONG LeafIndex;
+    } LIST_CURSOR, *PLIST_CURSOR;
+
+    typedef struct _WALK_FRAME {
+        ULONG Cell;
+        LIST_CURSOR Cursor;
+    } WALK_FRAME, *PWALK_FRAME;
+
+    const UCHAR *
+    GetCell(
+        ULONG Cell,
+        ULONG MinSize,
+        PULONG Size
+    );
+
+    BOOLEAN
+    ReadKey(
+        ULONG Cell,
+        ULONG Depth,
+        PREGF_KEY Key
+    );
+
+    BOOLEAN
+    NextSubKey(
+        PLIST_CURSOR Cursor,
+        PULONG Cell
+    );
+
+    HANDLE m_File;
+    HANDLE m_Mapping;
+    const UCHAR *m_View;
+    ULONG64 m_End; // End of the bins in the view.
+    ULONG m_RootCell;
+
+    vector<WALK_FRAME> m_Stack; // Reserved once, REGF_MAX_DEPTH frames.
+};
+
+#endif
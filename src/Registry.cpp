@@ -37,6 +37,68 @@ Revision History:
 
 #include "MoonSolsDbgExt.h"
 
+static
+BOOLEAN
+DbgEngLoadHiveLayout(
+    PVOID Context,
+    ULONG64 Hive,
+    HiveMapCache::PHIVE_MAP_LAYOUT Layout
+)
+{
+    UNREFERENCED_PARAMETER(Context);
+
+    try
+    {
+        ExtRemoteTyped KeyHive("(nt!_HHIVE *)@$extin", Hive);
+
+        for (ULONG Type = 0; Type < HIVE_MAP_STORAGE_TYPES; Type += 1)
+        {
+            ExtRemoteTyped Storage = KeyHive.Field("Storage").ArrayElement(Type);
+
+            Layout->Directory[Type] = Storage.Field("Map").GetPtr();
+
+            //
+            // Small hives point Map at SmallDir, the directory is its only entry.
+            //
+            if (Layout->Directory[Type] == Storage.Field("SmallDir").GetPointerTo().GetPtr()) Layout->DirectorySize[Type] = 1;
+            else Layout->DirectorySize[Type] = HIVE_MAP_DIRECTORY_SIZE;
+        }
+
+        Layout->PointerSize = g_Ext->m_PtrSize;
+        Layout->EntrySize = GetTypeSize("nt!_HMAP_ENTRY");
+        Layout->BlockAddressOffset = ExtRemoteTyped::GetTypeFieldOffset("nt!_HMAP_ENTRY", "BlockAddress");
+
+        if (KeyHive.Field("Version").GetUlong() == 1) Layout->CellHeaderSize = sizeof(LONG) + sizeof(ULONG);
+        else Layout->CellHeaderSize = sizeof(LONG);
+    }
+    catch (...)
+    {
+        return FALSE;
+    }
+
+    return (Layout->EntrySize != 0);
+}
+
+static
+BOOLEAN
+DbgEngReadHiveMap(
+    PVOID Context,
+    ULONG64 Address,
+    PVOID Buffer,
+    ULONG Size
+)
+{
+    ULONG BytesRead = 0;
+
+    UNREFERENCED_PARAMETER(Context);
+
+    if (g_Ext->m_Data->ReadVirtual(Address, Buffer, Size, &BytesRead) != S_OK) return FALSE;
+
+    return (BytesRead == Size);
+}
+
+HiveMapCache g_HiveMapCache(DbgEngLoadHiveLayout, DbgEngReadHiveMap, NULL);
+
 ULONG64
 RegGetCellPaged(
     ExtRemoteTyped KeyHive,
@@ -46,6 +108,12 @@ RegGetCellPaged(
     ULONG Type, Table, Block, Offset;
     ULONG64 CellAddr;
 
+    //
+    // One lookup once the map table of the cell was read.
+    //
+    CellAddr = g_HiveMapCache.GetCellAddress(KeyHive.GetPtr(), CellIndex);
+    if (CellAddr) return CellAddr;
+
     Type = ((ULONG)((CellIndex & HCELL_TYPE_MASK) >> HCELL_TYPE_SHIFT));
     Table = (ULONG)((CellIndex & HCELL_TABLE_MASK) >> HCELL_TABLE_SHIFT);
     Block = (ULONG)((CellIndex & HCELL_BLOCK_MASK) >> HCELL_BLOCK_SHIFT);
@@ -249,32 +317,28 @@ CleanUp:
 }
 
 VOID
-RegReadKeyValue(
-    ExtRemoteTyped KeyHive,
-    ExtRemoteTyped KeyValue
+RegOutValueData(
+    ULONG Type,
+    const UCHAR *Data,
+    ULONG DataLength
 )
 {
     PUCHAR Buffer = NULL;
 
     UINT i;
-    ULONG64 Data;
 
-    if (KeyValue.Field("Signature").GetUshort() != CM_KEY_VALUE_SIGNATURE)
-    {
-        g_Ext->Err("Error: Invalid object (o=%I64X) signature.\n", KeyValue.GetPtr());
-        goto CleanUp;
-    }
+    //
+    // Strings are not always terminated, and short numbers are zero extended.
+    //
+    Buffer = (PUCHAR)malloc(DataLength + sizeof(ULONG64));
+    if (Buffer == NULL) return;
 
-    ULONG DataLength = (KeyValue.Field("DataLength").GetUlong()) & 0x7FFFFFFF;
-    Buffer = (PUCHAR)malloc(DataLength);
-    RtlZeroMemory(Buffer, DataLength);
+    RtlZeroMemory(Buffer, DataLength + sizeof(ULONG64));
+    if (Data) memcpy(Buffer, Data, DataLength);
 
-    switch (KeyValue.Field("Type").GetUlong())
+    switch (Type)
     {
         case REG_BINARY:
-            Data = RegGetCellPaged(KeyHive, KeyValue.Field("Data").GetUlong());
-            if (ExtRemoteTypedEx::ReadVirtual(Data, Buffer, DataLength, NULL) != S_OK) goto CleanUp;
-
             g_Ext->Dml("\n        REG_BINARY: \n        ");
             for (i = 0; i < DataLength; i += 1)
             {
@@ -299,42 +363,77 @@ RegReadKeyValue(
             if (((i + 1) % 0x10) != 0) g_Ext->Dml("\n");
         break;
         case REG_DWORD:
-            g_Ext->Dml("0x%08X (REG_DWORD)\n", KeyValue.Field("Data").GetUlong());
+            g_Ext->Dml("0x%08X (REG_DWORD)\n", *(PULONG)Buffer);
             break;
         case REG_DWORD_BIG_ENDIAN:
-            g_Ext->Dml("0x%08X (REG_DWORD_BIG_ENDIAN)\n", KeyValue.Field("Data").GetUlong());
+            g_Ext->Dml("0x%08X (REG_DWORD_BIG_ENDIAN)\n", *(PULONG)Buffer);
             break;
         case REG_EXPAND_SZ:
-            Data = RegGetCellPaged(KeyHive, KeyValue.Field("Data").GetUlong());
-            if (ExtRemoteTypedEx::ReadVirtual(Data, Buffer, DataLength, NULL) != S_OK) goto CleanUp;
-
             g_Ext->Dml("%S (REG_EXPAND_SZ)\n", Buffer);
             break;
         case REG_LINK:
-            Data = RegGetCellPaged(KeyHive, KeyValue.Field("Data").GetUlong());
-            if (ExtRemoteTypedEx::ReadVirtual(Data, Buffer, DataLength, NULL) != S_OK) goto CleanUp;
-
             g_Ext->Dml("%S (REG_LINK)\n", Buffer);
             break;
         case REG_MULTI_SZ:
-            Data = RegGetCellPaged(KeyHive, KeyValue.Field("Data").GetUlong());
-            if (ExtRemoteTypedEx::ReadVirtual(Data, Buffer, DataLength, NULL) != S_OK) goto CleanUp;
-
             g_Ext->Dml("%S (REG_MULTI_SZ)\n", Buffer);
             break;
         case REG_NONE:
+            g_Ext->Dml("(REG_NONE)\n");
             break;
         case REG_QWORD:
-            g_Ext->Dml("0x%I64X (REG_QWORD)\n", KeyValue.Field("Data").GetLong64());
+            g_Ext->Dml("0x%I64X (REG_QWORD)\n", *(PULONG64)Buffer);
             break;
         case REG_SZ:
-            Data = RegGetCellPaged(KeyHive, KeyValue.Field("Data").GetUlong());
-            if (ExtRemoteTypedEx::ReadVirtual(Data, Buffer, DataLength, NULL) != S_OK) goto CleanUp;
-
             g_Ext->Dml("%S (REG_SZ)\n", Buffer);
         break;
+        default:
+            g_Ext->Dml("%d bytes (type %d)\n", DataLength, Type);
+        break;
+    }
+
+    free(Buffer);
+}
+
+VOID
+RegReadKeyValue(
+    ExtRemoteTyped KeyHive,
+    ExtRemoteTyped KeyValue
+)
+{
+    PUCHAR Buffer = NULL;
+
+    ULONG64 Data;
+    ULONG InlineData;
+    ULONG DataLength;
+    ULONG Type;
+
+    if (KeyValue.Field("Signature").GetUshort() != CM_KEY_VALUE_SIGNATURE)
+    {
+        g_Ext->Err("Error: Invalid object (o=%I64X) signature.\n", KeyValue.GetPtr());
+        goto CleanUp;
     }
 
+    DataLength = (KeyValue.Field("DataLength").GetUlong()) & 0x7FFFFFFF;
+    Type = KeyValue.Field("Type").GetUlong();
+
+    //
+    // Up to 4 bytes (e.g. REG_DWORD) are stored in the Data field.
+    //
+    if ((KeyValue.Field("DataLength").GetUlong() & CM_KEY_VALUE_SPECIAL_SIZE) || (Type == REG_DWORD) || (Type == REG_DWORD_BIG_ENDIAN))
+    {
+        InlineData = KeyValue.Field("Data").GetUlong();
+        RegOutValueData(Type, (const UCHAR *)&InlineData, min(DataLength, (ULONG)sizeof(InlineData)));
+        goto CleanUp;
+    }
+
+    Buffer = (PUCHAR)malloc(DataLength);
+    if (Buffer == NULL) goto CleanUp;
+
+    Data = RegGetCellPaged(KeyHive, KeyValue.Field("Data").GetUlong());
+    if (ExtRemoteTypedEx::ReadVirtual(Data, Buffer, DataLength, NULL) != S_OK) goto CleanUp;
+
+    RegOutValueData(Type, Buffer, DataLength);
+
 CleanUp:
     if (Buffer) free(Buffer);
 }
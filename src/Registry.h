@@ -38,17 +38,6 @@ Revision History:
 #ifndef __REGISTRY_H__
 #define __REGISTRY_H__
 
-#define HCELL_TYPE_MASK 0x80000000
-#define HCELL_TYPE_SHIFT 31
-
-#define HCELL_TABLE_MASK 0x7fe00000
-#define HCELL_TABLE_SHIFT 21
-
-#define HCELL_BLOCK_MASK 0x001ff000
-#define HCELL_BLOCK_SHIFT 12
-
-#define HCELL_OFFSET_MASK 0x00000fff
-
 #define CM_FAST_LEAF_SIGNATURE 'fl'
 #define CM_HASH_LEAF_SIGNATURE 'hl'
 #define CM_INDEX_ROOT_SIGNATURE 'ir'
@@ -57,6 +46,8 @@ Revision History:
 #define CM_KEY_NODE_SIGNATURE 'kn'
 #define CM_KEY_VALUE_SIGNATURE 'kv'
 
+#define CM_KEY_VALUE_SPECIAL_SIZE 0x80000000 // Data stored in the Data field.
+
 #define CM_FLAG_UNTRUSTED 0x1
 
 #define CM_HIVE_SIGNATURE 0xbee0bee0
@@ -96,6 +87,11 @@ typedef struct _HIVE_OBJECT {
     ULONG64 FileFlush;
 } HIVE_OBJECT, *PHIVE_OBJECT;
 
+extern HiveMapCache g_HiveMapCache;
+
+//
+// Address of the data of the cell, through g_HiveMapCache.
+//
 ULONG64
 RegGetCellPaged(
     ExtRemoteTyped KeyHive,
@@ -108,6 +104,16 @@ RegReadKeyNode(
     ExtRemoteTyped KeyNode
 );
 
+//
+// Same output for the values of the hives in memory and of the hive files.
+//
+VOID
+RegOutValueData(
+    ULONG Type,
+    const UCHAR *Data,
+    ULONG DataLength
+);
+
 VOID
 RegReadKeyValue(
     ExtRemoteTyped KeyHive,
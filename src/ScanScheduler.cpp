@@ -0,0 +1,309 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - ScanScheduler.cpp
+
+Abstract:
+
+    - Producer/consumer scan of memory regions (VADs of several processes).
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdarg.h>
+#include <string.h>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <string>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "Entropy.h"
+#include "Spray.h"
+#include "PatternMatcher.h"
+#include "MalRules.h"
+#include "Security.h"
+#include "Arena.h"
+#include "ScanScheduler.h"
+
+ScanScheduler::ScanScheduler(
+    const READ_ROUTINE& Reader,
+    ULONG WorkerCount,
+    ULONG64 MemoryBudget
+)
+    : m_Reader(Reader),
+      m_Regions(NULL),
+      m_Next(0),
+      m_ActiveWorkers(0)
+{
+    RtlZeroMemory(&m_Progress, sizeof(m_Progress));
+
+    InitializeCriticalSection(&m_Lock);
+    InitializeConditionVariable(&m_Posted);
+    InitializeConditionVariable(&m_Served);
+
+    //
+    // Every worker holds one window, fewer workers if the budget cannot give each of them
+    // the minimum chunk.
+    //
+    if (!WorkerCount) WorkerCount = 1;
+    while ((WorkerCount > 1) && ((MemoryBudget / WorkerCount) < (SCAN_MIN_CHUNK_SIZE + SCAN_WINDOW_OVERHEAD))) WorkerCount -= 1;
+
+    ULONG64 ChunkSize = (MemoryBudget / WorkerCount) - SCAN_WINDOW_OVERHEAD;
+    if (ChunkSize < SCAN_MIN_CHUNK_SIZE) ChunkSize = SCAN_MIN_CHUNK_SIZE;
+    if (ChunkSize > MALSCORE_CHUNK_SIZE) ChunkSize = MALSCORE_CHUNK_SIZE;
+
+    m_WorkerCount = WorkerCount;
+    m_ChunkSize = (ULONG)ChunkSize;
+}
+
+ScanScheduler::~ScanScheduler(
+)
+{
+    DeleteCriticalSection(&m_Lock);
+}
+
+BOOLEAN
+ScanScheduler::ReadRegion(
+    PVOID Context,
+    ULONG64 Offset,
+    LPBYTE Buffer,
+    ULONG Length
+)
+{
+    PSCAN_READ_CONTEXT ReadContext = (PSCAN_READ_CONTEXT)Context;
+    ScanScheduler *Scheduler = ReadContext->Scheduler;
+    SCAN_READ Read = { 0 };
+
+    Read.ProcessObject = ReadContext->Region->ProcessObject;
+    Read.Address = ReadContext->Region->BaseAddress + Offset;
+    Read.Buffer = Buffer;
+    Read.Length = Length;
+
+    if (ReadContext->Inline)
+    {
+        //
+        // Single worker, running on the engine thread.
+        //
+        Scheduler->m_Progress.Reads += 1;
+
+        return Scheduler->m_Reader(Read.ProcessObject, Read.Address, Read.Buffer, Read.Length);
+    }
+
+    //
+    // Queued for the engine thread, the worker sleeps until it has been served.
+    //
+    EnterCriticalSection(&Scheduler->m_Lock);
+
+    Scheduler->m_Reads.push_back(&Read);
+    WakeConditionVariable(&Scheduler->m_Posted);
+
+    while (!Read.Done) SleepConditionVariableCS(&Scheduler->m_Served, &Scheduler->m_Lock, INFINITE);
+
+    LeaveCriticalSection(&Scheduler->m_Lock);
+
+    return Read.Result;
+}
+
+VOID
+ScanScheduler::Worker(
+    BOOLEAN Inline
+)
+{
+    for (;;)
+    {
+        SCAN_READ_CONTEXT ReadContext;
+        PSCAN_REGION Region;
+        MALSCORE_DETAILS Details;
+        PULONG RuleBuffer = NULL;
+        ULONG Score = 0;
+        BOOLEAN Readable;
+
+        EnterCriticalSection(&m_Lock);
+        Region = (m_Next < m_Regions->size()) ? &(*m_Regions)[m_Next++] : NULL;
+        LeaveCriticalSection(&m_Lock);
+
+        if (Region == NULL) break;
+
+        ReadContext.Scheduler = this;
+        ReadContext.Region = Region;
+        ReadContext.Inline = Inline;
+
+        Readable = GetMalScoreStream(FALSE, Region->BaseAddress, Region->Size, ReadRegion, &ReadContext, m_ChunkSize, Region->Flags, &Score, &Details);
+
+        if (Details.Rules.size())
+        {
+            RuleBuffer = (PULONG)g_CommandArena.Alloc(Details.Rules.size() * sizeof(ULONG));
+            if (RuleBuffer) memcpy(RuleBuffer, &Details.Rules[0], Details.Rules.size() * sizeof(ULONG));
+        }
+
+        EnterCriticalSection(&m_Lock);
+
+        Region->Score = Score;
+        Region->Readable = Readable;
+        Region->Rules = RuleBuffer;
+        Region->NumberOfRules = RuleBuffer ? (ULONG)Details.Rules.size() : 0;
+        Region->Entropy = Details.Entropy;
+
+        m_Progress.RegionsDone += 1;
+        m_Progress.BytesDone += Region->Size;
+        if (--m_Remaining[Region->Process] == 0) m_Progress.ProcessesDone += 1;
+
+        WakeConditionVariable(&m_Posted);
+
+        LeaveCriticalSection(&m_Lock);
+    }
+}
+
+VOID
+ScanScheduler::Run(
+    vector<SCAN_REGION>& Regions,
+    const PROGRESS_ROUTINE& Progress
+)
+{
+    vector<thread> Workers;
+    ULONG64 Start = GetTickCount64();
+    ULONG64 LastProgress = Start;
+
+    m_Regions = &Regions;
+    m_Next = 0;
+    m_Remaining.clear();
+    m_Reads.clear();
+
+    RtlZeroMemory(&m_Progress, sizeof(m_Progress));
+    m_Progress.Regions = (ULONG)Regions.size();
+    m_Progress.ChunkSize = m_ChunkSize;
+
+    for (SCAN_REGION& Region : Regions)
+    {
+        if (Region.Process >= m_Remaining.size()) m_Remaining.resize(Region.Process + 1, 0);
+        if (m_Remaining[Region.Process]++ == 0) m_Progress.Processes += 1;
+
+        m_Progress.Bytes += Region.Size;
+    }
+
+    if (m_WorkerCount > 1)
+    {
+        m_ActiveWorkers = 0;
+
+        for (ULONG i = 0; i < m_WorkerCount; i += 1)
+        {
+            EnterCriticalSection(&m_Lock);
+            m_ActiveWorkers += 1;
+            LeaveCriticalSection(&m_Lock);
+
+            try
+            {
+                Workers.push_back(thread([this]()
+                {
+                    Worker(FALSE);
+
+                    EnterCriticalSection(&m_Lock);
+                    m_ActiveWorkers -= 1;
+                    WakeConditionVariable(&m_Posted);
+                    LeaveCriticalSection(&m_Lock);
+                }));
+            }
+            catch (...)
+            {
+                //
+                // Could not create more threads, go on with what we have.
+                //
+                EnterCriticalSection(&m_Lock);
+                m_ActiveWorkers -= 1;
+                LeaveCriticalSection(&m_Lock);
+                break;
+            }
+        }
+    }
+
+    m_Progress.Workers = Workers.size() ? (ULONG)Workers.size() : 1;
+
+    if (Workers.empty())
+    {
+        Worker(TRUE);
+    }
+    else
+    {
+        //
+        // Producer side: serve the reads in the order they were queued until the last worker
+        // is done. Workers that are not waiting on a read are scoring meanwhile.
+        //
+        EnterCriticalSection(&m_Lock);
+
+        for (;;)
+        {
+            if (m_Reads.size())
+            {
+                PSCAN_READ Read = m_Reads.front();
+                m_Reads.pop_front();
+
+                LeaveCriticalSection(&m_Lock);
+                Read->Result = m_Reader(Read->ProcessObject, Read->Address, Read->Buffer, Read->Length);
+                EnterCriticalSection(&m_Lock);
+
+                Read->Done = TRUE;
+                m_Progress.Reads += 1;
+                WakeAllConditionVariable(&m_Served);
+            }
+            else if (m_ActiveWorkers == 0)
+            {
+                break;
+            }
+            else
+            {
+                SleepConditionVariableCS(&m_Posted, &m_Lock, SCAN_PROGRESS_INTERVAL);
+            }
+
+            if ((GetTickCount64() - LastProgress) >= SCAN_PROGRESS_INTERVAL)
+            {
+                SCAN_PROGRESS Current = m_Progress;
+
+                LastProgress = GetTickCount64();
+                Current.ElapsedMs = LastProgress - Start;
+
+                LeaveCriticalSection(&m_Lock);
+                Progress(Current);
+                EnterCriticalSection(&m_Lock);
+            }
+        }
+
+        LeaveCriticalSection(&m_Lock);
+
+        for (ULONG i = 0; i < Workers.size(); i += 1) Workers[i].join();
+    }
+
+    m_Progress.ElapsedMs = GetTickCount64() - Start;
+    m_Regions = NULL;
+
+    Progress(m_Progress);
+}
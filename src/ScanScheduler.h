@@ -0,0 +1,158 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - ScanScheduler.h
+
+Abstract:
+
+    - Producer/consumer scan of memory regions (VADs of several processes).
+      The engine thread reads on behalf of scoring workers, so reads and
+      pattern matching overlap without calling the engine from the workers.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __SCANSCHEDULER_H__
+#define __SCANSCHEDULER_H__
+
+//
+// Scoring windows of all the workers together, each one also needs a few pages for the
+// window margins and far branch targets.
+//
+#define SCAN_MEMORY_BUDGET (64 * 1024 * 1024)
+#define SCAN_MIN_CHUNK_SIZE (64 * 1024)
+#define SCAN_WINDOW_OVERHEAD (4 * 0x1000)
+
+#define SCAN_PROGRESS_INTERVAL 2000 // ms
+
+typedef struct _SCAN_REGION {
+    ULONG64 ProcessObject; // Implicit process of the reads.
+    ULONG64 BaseAddress;
+    ULONG64 Size;
+    ULONG Process; // Index of the process, progress is also counted per process.
+    ULONG Flags; // MALSCORE_REGION_*
+
+    ULONG Score;
+    BOOLEAN Readable;
+    PULONG Rules; // Indexes of the rules that hit, in the command arena.
+    ULONG NumberOfRules;
+    ENTROPY_SUMMARY Entropy;
+} SCAN_REGION, *PSCAN_REGION;
+
+typedef struct _SCAN_PROGRESS {
+    ULONG Processes;
+    ULONG ProcessesDone;
+    ULONG Regions;
+    ULONG RegionsDone;
+    ULONG64 Bytes;
+    ULONG64 BytesDone;
+
+    ULONG Workers;
+    ULONG ChunkSize;
+    ULONG64 Reads;
+    ULONG64 ElapsedMs;
+} SCAN_PROGRESS, *PSCAN_PROGRESS;
+
+class ScanScheduler {
+public:
+    //
+    // Same contract as a PMALSCORE_READER, with the process and address of the region.
+    //
+    typedef function<BOOLEAN(ULONG64 ProcessObject, ULONG64 Address, LPBYTE Buffer, ULONG Length)> READ_ROUTINE;
+    typedef function<VOID(const SCAN_PROGRESS& Progress)> PROGRESS_ROUTINE;
+
+    ScanScheduler(
+        const READ_ROUTINE& Reader,
+        ULONG WorkerCount,
+        ULONG64 MemoryBudget
+    );
+
+    ~ScanScheduler(
+    );
+
+    //
+    // Scores every region, results are stored in the regions. Reader and Progress are only
+    // called from the calling thread, Progress every SCAN_PROGRESS_INTERVAL and at the end.
+    //
+    VOID
+    Run(
+        vector<SCAN_REGION>& Regions,
+        const PROGRESS_ROUTINE& Progress
+    );
+
+    SCAN_PROGRESS m_Progress;
+
+private:
+    typedef struct _SCAN_READ {
+        ULONG64 ProcessObject;
+        ULONG64 Address;
+        LPBYTE Buffer;
+        ULONG Length;
+        BOOLEAN Result;
+        BOOLEAN Done;
+    } SCAN_READ, *PSCAN_READ;
+
+    typedef struct _SCAN_READ_CONTEXT {
+        ScanScheduler *Scheduler;
+        PSCAN_REGION Region;
+        BOOLEAN Inline;
+    } SCAN_READ_CONTEXT, *PSCAN_READ_CONTEXT;
+
+    ScanScheduler(const ScanScheduler&);
+    ScanScheduler& operator=(const ScanScheduler&);
+
+    static
+    BOOLEAN
+    ReadRegion(
+        PVOID Context,
+        ULONG64 Offset,
+        LPBYTE Buffer,
+        ULONG Length
+    );
+
+    VOID
+    Worker(
+        BOOLEAN Inline
+    );
+
+    READ_ROUTINE m_Reader;
+    ULONG m_WorkerCount;
+    ULONG m_ChunkSize;
+
+    CRITICAL_SECTION m_Lock;
+    CONDITION_VARIABLE m_Posted; // A read was queued or a region completed.
+    CONDITION_VARIABLE m_Served;
+
+    deque<PSCAN_READ> m_Reads;
+    vector<SCAN_REGION> *m_Regions;
+    vector<ULONG> m_Remaining; // Regions left per process.
+    ULONG m_Next;
+    ULONG m_ActiveWorkers;
+};
+
+#endif
@@ -0,0 +1,158 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - Scheduler.cpp
+
+Abstract:
+
+    - Worker pool. The calling thread takes part in the work, so a single
+      worker means the tasks are executed inline.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "Scheduler.h"
+
+TaskScheduler g_Scheduler;
+
+TaskScheduler::TaskScheduler(
+)
+{
+    SetWorkerCount(0);
+    ResetStats();
+}
+
+VOID
+TaskScheduler::SetWorkerCount(
+    ULONG WorkerCount
+)
+{
+    //
+    // 0 means one worker per logical processor.
+    //
+    if (!WorkerCount) WorkerCount = thread::hardware_concurrency();
+    if (!WorkerCount) WorkerCount = 1;
+    if (WorkerCount > SCHEDULER_MAX_WORKERS) WorkerCount = SCHEDULER_MAX_WORKERS;
+
+    m_WorkerCount = WorkerCount;
+}
+
+ULONG
+TaskScheduler::GetWorkerCount(
+)
+{
+    return m_WorkerCount;
+}
+
+ULONG
+TaskScheduler::Run(
+    ULONG Count,
+    const TASK_ROUTINE& Task,
+    vector<BOOLEAN> *Failed
+)
+{
+    vector<thread> Workers;
+    atomic<ULONG> Next(0);
+    atomic<ULONG> Failures(0);
+    ULONG WorkerCount;
+    ULONG64 Start;
+
+    if (Failed) Failed->assign(Count, FALSE);
+    if (!Count) return 0;
+
+    WorkerCount = (Count < m_WorkerCount) ? Count : m_WorkerCount;
+    Start = GetTickCount64();
+
+    //
+    // Tasks have very different costs (a 30MB image vs a 4KB one), indexes are handed
+    // out one at a time instead of being split in equal ranges.
+    //
+    auto Worker = [&Next, &Failures, &Task, Failed, Count]()
+    {
+        for (ULONG Index = Next++; Index < Count; Index = Next++)
+        {
+            try
+            {
+                Task(Index);
+            }
+            catch (...)
+            {
+                //
+                // Each index is handed out once, its entry is only written by this worker.
+                //
+                Failures += 1;
+                if (Failed) (*Failed)[Index] = TRUE;
+            }
+        }
+    };
+
+    for (ULONG i = 1; i < WorkerCount; i += 1)
+    {
+        try
+        {
+            Workers.push_back(thread(Worker));
+        }
+        catch (...)
+        {
+            //
+            // Could not create more threads, go on with what we have.
+            //
+            m_Stats.ThreadFailures += 1;
+            break;
+        }
+    }
+
+    Worker();
+
+    for (ULONG i = 0; i < Workers.size(); i += 1) Workers[i].join();
+
+    m_Stats.Runs += 1;
+    m_Stats.Tasks += Count;
+    m_Stats.Failures += Failures;
+    m_Stats.LastWorkers = (ULONG)Workers.size() + 1;
+    m_Stats.LastTasks = Count;
+    m_Stats.LastFailures = Failures;
+    m_Stats.LastElapsedMs = GetTickCount64() - Start;
+    m_Stats.ElapsedMs += m_Stats.LastElapsedMs;
+
+    return Failures;
+}
+
+VOID
+TaskScheduler::ResetStats(
+)
+{
+    RtlZeroMemory(&m_Stats, sizeof(m_Stats));
+}
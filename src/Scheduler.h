@@ -0,0 +1,101 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - Scheduler.h
+
+Abstract:
+
+    - Small worker pool used to spread CPU bound work (PE parsing, hashing)
+      over several threads.
+    - Tasks must not call into the debugger engine, it is not reentrant.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#define SCHEDULER_MAX_WORKERS 16
+
+class TaskScheduler {
+public:
+    typedef struct _SCHEDULER_STATS {
+        ULONG64 Runs;
+        ULONG64 Tasks;
+        ULONG64 Failures; // Tasks that threw.
+        ULONG64 ThreadFailures; // Workers that could not be created.
+        ULONG64 ElapsedMs;
+
+        ULONG LastWorkers;
+        ULONG LastTasks;
+        ULONG LastFailures;
+        ULONG64 LastElapsedMs;
+    } SCHEDULER_STATS, *PSCHEDULER_STATS;
+
+    //
+    // Called once per index in [0, Count), in no particular order and from any worker.
+    // Results must be stored by index to keep the output deterministic.
+    //
+    typedef function<VOID(ULONG Index)> TASK_ROUTINE;
+
+    TaskScheduler(
+    );
+
+    VOID
+    SetWorkerCount(
+        ULONG WorkerCount
+    );
+
+    ULONG
+    GetWorkerCount(
+    );
+
+    //
+    // Returns the number of tasks that threw, their exceptions are not propagated. Failed
+    // (optional) gets Count entries, TRUE for those tasks.
+    //
+    ULONG
+    Run(
+        ULONG Count,
+        const TASK_ROUTINE& Task,
+        vector<BOOLEAN> *Failed = NULL
+    );
+
+    VOID
+    ResetStats(
+    );
+
+    SCHEDULER_STATS m_Stats;
+
+private:
+    ULONG m_WorkerCount;
+};
+
+extern TaskScheduler g_Scheduler;
+
+#endif
@@ -35,8 +35,40 @@ Revision History:
 
 --*/
 
-#include "MoonSolsDbgExt.h"
+#include <windows.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <intrin.h>
+#include <vector>
+#include <string>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "Entropy.h"
+#include "Spray.h"
+#include "PatternMatcher.h"
+#include "MalRules.h"
+#include "Security.h"
+
+PMALSCORE_OUTPUT g_MalScoreOutput = NULL;
+
+static
+VOID
+MalScoreOut(
+    LPCSTR Format,
+    ...
+)
+{
+    va_list Args;
+
+    if (g_MalScoreOutput == NULL) return;
 
+    va_start(Args, Format);
+    g_MalScoreOutput(Format, Args);
+    va_end(Args);
+}
 
 const char *Blacklist_Functions[] = {
     "UrlDownloadToFile",
@@ -64,7 +96,7 @@ typedef struct _PATTERN_DATA {
     UCHAR Pattern[12]; // Max Size 12
 } PATTERN_DATA, *PPATTERN_DATA;
 
-typedef void (CALLBACK *DISPLAY_CALLBACK)(IN BOOLEAN Verbose, IN ULONG64 Base, IN ULONG Offset);
+typedef void (CALLBACK *DISPLAY_CALLBACK)(IN BOOLEAN Verbose, IN ULONG64 Base, IN ULONG64 Offset);
 
 typedef struct _PATTERN_ENTRY {
     ULONG Type;
@@ -80,7 +112,7 @@ typedef enum _PATTERN_TYPE {
     PatternNoneType = 0,
     PatternDataType = 1,
     PatternCustomType = 2
-};
+} PATTERN_TYPE;
 
 #define InitPattern(a) {PatternDataType, a, sizeof(a) - 1, NULL, {FALSE, 0, 0}}
 #define InitCustomPattern(a) {PatternCustomType, a, 1, NULL, {FALSE, 0, 0}}
@@ -137,10 +169,10 @@ CALLBACK
 call_pop_signature_callback(
     BOOLEAN Verbose,
     ULONG64 Base,
-    ULONG Offset
+    ULONG64 Offset
 )
 {
-    if (Verbose) g_Ext->Dml("    CALL next/POP signature @ <link cmd=\"u 0x%I64X\">0x%X</link>\n", Base + Offset, Offset);
+    if (Verbose) MalScoreOut("    CALL next/POP signature @ <link cmd=\"u 0x%I64X\">0x%I64X</link>\n", Base + Offset, Offset);
 }
 
 VOID
@@ -148,10 +180,10 @@ CALLBACK
 fpu_signature_callback(
     BOOLEAN Verbose,
     ULONG64 Base,
-    ULONG Offset
+    ULONG64 Offset
 )
 {
-    if (Verbose) g_Ext->Dml("    FLDZ/FSTENV [esp-12] signature @ <link cmd=\"u 0x%I64X\">0x%X</link>\n", Base + Offset, Offset);
+    if (Verbose) MalScoreOut("    FLDZ/FSTENV [esp-12] signature @ <link cmd=\"u 0x%I64X\">0x%I64X</link>\n", Base + Offset, Offset);
 }
 
 VOID
@@ -159,10 +191,10 @@ CALLBACK
 push_call_signature_callback(
     BOOLEAN Verbose,
     ULONG64 Base,
-    ULONG Offset
+    ULONG64 Offset
 )
 {
-    if (Verbose) g_Ext->Dml("    PUSH DWORD[]/CALL[] signature @ <link cmd=\"u 0x%I64X\">0x%X</link>\n", Base + Offset, Offset);
+    if (Verbose) MalScoreOut("    PUSH DWORD[]/CALL[] signature @ <link cmd=\"u 0x%I64X\">0x%I64X</link>\n", Base + Offset, Offset);
 }
 
 VOID
@@ -170,10 +202,10 @@ CALLBACK
 function_prolog_signature_callback(
     BOOLEAN Verbose,
     ULONG64 Base,
-    ULONG Offset
+    ULONG64 Offset
 )
 {
-    if (Verbose) g_Ext->Dml("    Function prolog signature @ <link cmd=\"u 0x%I64X\">0x%X</link>\n", Base + Offset, Offset);
+    if (Verbose) MalScoreOut("    Function prolog signature @ <link cmd=\"u 0x%I64X\">0x%I64X</link>\n", Base + Offset, Offset);
 }
 
 VOID
@@ -181,10 +213,10 @@ CALLBACK
 api_hashing_signature_callback(
     BOOLEAN Verbose,
     ULONG64 Base,
-    ULONG Offset
+    ULONG64 Offset
 )
 {
-    if (Verbose) g_Ext->Dml("    API-Hashing signature @ <link cmd=\"u 0x%I64X\">0x%X</link>\n", Base + Offset, Offset);
+    if (Verbose) MalScoreOut("    API-Hashing signature @ <link cmd=\"u 0x%I64X\">0x%I64X</link>\n", Base + Offset, Offset);
 }
 
 VOID
@@ -192,10 +224,10 @@ CALLBACK
 peb2_access_signature_callback(
     BOOLEAN Verbose,
     ULONG64 Base,
-    ULONG Offset
+    ULONG64 Offset
 )
 {
-    if (Verbose) g_Ext->Dml("    FS:[00h] signature @ <link cmd=\"u 0x%I64X\">0x%X</link>\n", Base + Offset, Offset);
+    if (Verbose) MalScoreOut("    FS:[00h] signature @ <link cmd=\"u 0x%I64X\">0x%I64X</link>\n", Base + Offset, Offset);
 }
 
 VOID
@@ -203,10 +235,10 @@ CALLBACK
 peb_access_signature_callback(
     BOOLEAN Verbose,
     ULONG64 Base,
-    ULONG Offset
+    ULONG64 Offset
 )
 {
-    if (Verbose) g_Ext->Dml("    FS:[30h] signature @ <link cmd=\"u 0x%I64X\">0x%X</link>\n", Base + Offset, Offset);
+    if (Verbose) MalScoreOut("    FS:[30h] signature @ <link cmd=\"u 0x%I64X\">0x%I64X</link>\n", Base + Offset, Offset);
 }
 
 PATTERN_ENTRY g_PatternTable[] = {
@@ -308,8 +340,6 @@ InitPatternTable(
 PPATTERN_ENTRY PatternTable
 )
 {
-    BOOLEAN Matched = FALSE;
-
     for (UINT i = 0; PatternTable[i].PatternSize; i += 1)
     {
         if ((PatternTable[i].Type == PatternCustomType) && (PatternTable[i].Data.Initialized == FALSE))
@@ -321,7 +351,13 @@ PPATTERN_ENTRY PatternTable
             {
                 if (memcmp(&PatternTable[i].Pattern[2 * j], "??", 2) != 0)
                 {
-                    sscanf_s(&PatternTable[i].Pattern[2 * j], "%02x", &PatternTable[i].Data.Pattern[j]);
+                    UINT Byte = 0;
+
+                    //
+                    // %x stores an int, not a byte.
+                    //
+                    sscanf_s(&PatternTable[i].Pattern[2 * j], "%02x", &Byte);
+                    PatternTable[i].Data.Pattern[j] = (UCHAR)Byte;
                     // g_Ext->Dml("PatternTable[i].Data.Pattern[%d] = 0x%x\n", j, PatternTable[i].Data.Pattern[j]);
                     PatternTable[i].Data.PatternBitMask |= (1 << j);
                 }
@@ -346,7 +382,7 @@ MatchPattern(
     BOOLEAN Verbose,
     PUCHAR Input,
     ULONG64 VirtualAddress,
-    ULONG Offset,
+    ULONG64 Offset,
     PPATTERN_ENTRY PatternTable
 )
 {
@@ -396,64 +432,836 @@ MatchPattern(
     return Matched;
 }
 
+//
+// g_PatternTable and Blacklist_Functions compiled once, when the extension is loaded.
+// Ids below g_NumberOfPatterns are g_PatternTable indexes, Blacklist_Functions follow
+// up to g_NumberOfBuiltinIds.
+//
+static PatternMatcher g_MalScoreMatcher;
+static ULONG g_NumberOfPatterns = 0;
+static ULONG g_NumberOfBuiltinIds = 0;
+
+//
+// Rule strings are compiled with the built-in patterns, ids from g_NumberOfBuiltinIds on
+// are g_MalScoreRules.m_Strings indexes. Scans use g_RuleMatcher while rules are loaded.
+//
+MalScoreRules g_MalScoreRules;
+static PatternMatcher g_RuleMatcher;
+static const PatternMatcher *g_ActiveMatcher = &g_MalScoreMatcher;
+
+#define MALSCORE_RULES_CACHE_EXTENSION ".cache"
+
+static
+VOID
+AddBuiltinPattern(
+    PatternMatcher *Matcher,
+    PSHA256_CONTEXT Key,
+    ULONG Id,
+    const UCHAR *Bytes,
+    const UCHAR *Mask,
+    ULONG Length
+)
+{
+    if (Matcher) Matcher->Add(Id, Bytes, Mask, Length);
+
+    if (Key)
+    {
+        SHA256Update(Key, (const UCHAR *)&Id, sizeof(Id));
+        SHA256Update(Key, Bytes, Length);
+        if (Mask) SHA256Update(Key, Mask, Length);
+    }
+}
+
+//
+// Adds the built-in patterns to Matcher and/or Key, compiled rules are keyed with them so
+// that a cache written by a build with other patterns is not reused.
+//
+static
+VOID
+AddBuiltinPatterns(
+    PatternMatcher *Matcher,
+    PSHA256_CONTEXT Key
+)
+{
+    for (g_NumberOfPatterns = 0; g_PatternTable[g_NumberOfPatterns].PatternSize; g_NumberOfPatterns += 1)
+    {
+        PPATTERN_ENTRY Entry = &g_PatternTable[g_NumberOfPatterns];
+
+        if (Entry->Type == PatternDataType)
+        {
+            AddBuiltinPattern(Matcher, Key, g_NumberOfPatterns, (PUCHAR)Entry->Pattern, NULL, Entry->PatternSize);
+        }
+        else if ((Entry->Type == PatternCustomType) && Entry->Data.Initialized)
+        {
+            UCHAR Mask[sizeof(Entry->Data.Pattern)];
+
+            for (ULONG j = 0; j < Entry->PatternSize; j += 1) Mask[j] = (Entry->Data.PatternBitMask & (1 << j)) ? 0xFF : 0;
+
+            AddBuiltinPattern(Matcher, Key, g_NumberOfPatterns, Entry->Data.Pattern, Mask, Entry->PatternSize);
+        }
+    }
+
+    for (g_NumberOfBuiltinIds = g_NumberOfPatterns; Blacklist_Functions[g_NumberOfBuiltinIds - g_NumberOfPatterns]; g_NumberOfBuiltinIds += 1)
+    {
+        LPCSTR Name = Blacklist_Functions[g_NumberOfBuiltinIds - g_NumberOfPatterns];
+
+        AddBuiltinPattern(Matcher, Key, g_NumberOfBuiltinIds, (const UCHAR *)Name, NULL, (ULONG)strlen(Name));
+    }
+}
+
+static
+BOOLEAN
+BuildMalScoreMatcher(
+)
+{
+    InitPatternTable(g_PatternTable);
+
+    AddBuiltinPatterns(&g_MalScoreMatcher, NULL);
+    g_MalScoreMatcher.Compile();
+
+    return TRUE;
+}
+
+static BOOLEAN g_MalScoreMatcherReady = BuildMalScoreMatcher();
+
+//
+// SHA256 of the built-in patterns followed by the rule file.
+//
+static
+BOOLEAN
+GetMalScoreRulesKey(
+    LPCSTR FileName,
+    PSHA256_CONTEXT Key
+)
+{
+    FILE *File = NULL;
+    UCHAR Buffer[0x10000];
+    SIZE_T Size;
+
+    if (fopen_s(&File, FileName, "rb") || (File == NULL)) return FALSE;
+
+    SHA256Init(Key);
+    AddBuiltinPatterns(NULL, Key);
+
+    while ((Size = fread(Buffer, 1, sizeof(Buffer), File)) != 0) SHA256Update(Key, Buffer, Size);
+
+    fclose(File);
+
+    SHA256Final(Key);
+
+    return TRUE;
+}
+
+VOID
+UnloadMalScoreRules(
+)
+{
+    g_ActiveMatcher = &g_MalScoreMatcher;
+
+    g_MalScoreRules.Clear();
+    g_RuleMatcher = PatternMatcher();
+}
+
+BOOLEAN
+LoadMalScoreRules(
+    LPCSTR FileName,
+    BOOLEAN UseCache,
+    PBOOLEAN FromCache,
+    LPSTR Error,
+    ULONG ErrorSize
+)
+{
+    SHA256_CONTEXT Key;
+    CHAR CacheName[MAX_PATH];
+    UCHAR Digest[SHA256_DIGEST_SIZE];
+    FILE *File = NULL;
+    BOOLEAN Result = FALSE;
+
+    UnloadMalScoreRules();
+    *FromCache = FALSE;
+
+    if (!GetMalScoreRulesKey(FileName, &Key))
+    {
+        sprintf_s(Error, ErrorSize, "cannot open %s", FileName);
+        goto CleanUp;
+    }
+
+    sprintf_s(CacheName, sizeof(CacheName), "%s%s", FileName, MALSCORE_RULES_CACHE_EXTENSION);
+
+    if (UseCache && !fopen_s(&File, CacheName, "rb") && File)
+    {
+        *FromCache = (fread(Digest, sizeof(Digest), 1, File) == 1) &&
+                     (memcmp(Digest, Key.Digest, sizeof(Digest)) == 0) &&
+                     g_MalScoreRules.Load(File) &&
+                     g_RuleMatcher.Load(File);
+
+        fclose(File);
+    }
+
+    if (!*FromCache)
+    {
+        if (!g_MalScoreRules.Parse(FileName, Error, ErrorSize)) goto CleanUp;
+
+        g_RuleMatcher = PatternMatcher();
+        AddBuiltinPatterns(&g_RuleMatcher, NULL);
+
+        for (ULONG i = 0; i < g_MalScoreRules.m_Strings.size(); i += 1)
+        {
+            MalScoreRules::PRULE_STRING String = &g_MalScoreRules.m_Strings[i];
+
+            g_RuleMatcher.Add(g_NumberOfBuiltinIds + i, &String->Bytes[0], &String->Mask[0], (ULONG)String->Bytes.size());
+        }
+
+        g_RuleMatcher.Compile();
+
+        //
+        // The cache only makes the next load faster, failing to write it is not an error.
+        //
+        if (UseCache && !fopen_s(&File, CacheName, "wb") && File)
+        {
+            BOOLEAN Saved = (fwrite(Key.Digest, sizeof(Key.Digest), 1, File) == 1) &&
+                            g_MalScoreRules.Save(File) &&
+                            g_RuleMatcher.Save(File);
+
+            fclose(File);
+            if (!Saved) remove(CacheName);
+        }
+    }
+
+    g_ActiveMatcher = &g_RuleMatcher;
+    Result = TRUE;
+
+CleanUp:
+    if (!Result) UnloadMalScoreRules();
+
+    return Result;
+}
+
+//
+// First bytes of the GetMalScore() heuristics: jmp short, jmp near, jnz, loop and jb.
+// Any other offset can only score through a pattern or API name match.
+//
+#define MALSCORE_BLOCK_SIZE 32
+
+//
+// 1: lead bytes found with AVX2 when available, SSE2 otherwise. 2: SSE2 only. 0: every
+// offset is a candidate, as before the prefilter. The tests compare the three.
+//
+#ifndef MALSCORE_PREFILTER
+#define MALSCORE_PREFILTER 1
+#endif
+
+static const UCHAR g_LeadBytes[] = { 0xEB, 0xE9, 0x75, 0xE2, 0x72 };
+
+typedef ULONG (*PLEAD_BYTES_ROUTINE)(const UCHAR *Block);
+
+static
 ULONG
-GetMalScore(
+GetLeadBytesSse2(
+    const UCHAR *Block
+)
+{
+    ULONG Mask = 0;
+
+    for (ULONG Offset = 0; Offset < MALSCORE_BLOCK_SIZE; Offset += 16)
+    {
+        __m128i b = _mm_loadu_si128((const __m128i *)(Block + Offset));
+        __m128i r = _mm_cmpeq_epi8(b, _mm_set1_epi8((char)g_LeadBytes[0]));
+
+        for (ULONG i = 1; i < _countof(g_LeadBytes); i += 1)
+        {
+            r = _mm_or_si128(r, _mm_cmpeq_epi8(b, _mm_set1_epi8((char)g_LeadBytes[i])));
+        }
+
+        Mask |= (ULONG)_mm_movemask_epi8(r) << Offset;
+    }
+
+    return Mask;
+}
+
+static
+ULONG
+GetLeadBytesAvx2(
+    const UCHAR *Block
+)
+{
+    __m256i b = _mm256_loadu_si256((const __m256i *)Block);
+    __m256i r = _mm256_cmpeq_epi8(b, _mm256_set1_epi8((char)g_LeadBytes[0]));
+
+    for (ULONG i = 1; i < _countof(g_LeadBytes); i += 1)
+    {
+        r = _mm256_or_si256(r, _mm256_cmpeq_epi8(b, _mm256_set1_epi8((char)g_LeadBytes[i])));
+    }
+
+    return (ULONG)_mm256_movemask_epi8(r);
+}
+
+static
+PLEAD_BYTES_ROUTINE
+GetLeadBytesRoutine(
+    VOID
+)
+{
+    if ((MALSCORE_PREFILTER == 1) && (GetHashFeatures() & HASH_FEATURE_AVX2)) return GetLeadBytesAvx2;
+
+    return GetLeadBytesSse2;
+}
+
+static PLEAD_BYTES_ROUTINE g_GetLeadBytes = GetLeadBytesRoutine();
+
+//
+// One bit per offset of the block starting at Start that a heuristic or a match could
+// score at. The last partial block is checked a byte at a time.
+//
+static
+ULONG
+GetCandidates(
+    const UCHAR *Buffer,
+    ULONG BufferLen,
+    ULONG Start,
+    const vector<PatternMatcher::PATTERN_MATCH>& Matches,
+    ULONG NextMatch
+)
+{
+    ULONG Mask = 0;
+
+    if (!MALSCORE_PREFILTER)
+    {
+        Mask = ((Start + MALSCORE_BLOCK_SIZE) <= BufferLen) ? MAXULONG : (1UL << (BufferLen - Start)) - 1;
+    }
+    else if ((Start + MALSCORE_BLOCK_SIZE) <= BufferLen)
+    {
+        Mask = g_GetLeadBytes(Buffer + Start);
+    }
+    else
+    {
+        for (ULONG i = 0; (Start + i) < BufferLen; i += 1)
+        {
+            if (memchr(g_LeadBytes, Buffer[Start + i], sizeof(g_LeadBytes))) Mask |= 1UL << i;
+        }
+    }
+
+    for (ULONG m = NextMatch; (m < Matches.size()) && (Matches[m].Offset < (Start + MALSCORE_BLOCK_SIZE)); m += 1)
+    {
+        if (Matches[m].Offset >= Start) Mask |= 1UL << (Matches[m].Offset - Start);
+    }
+
+    return Mask;
+}
+
+//
+// Bytes read around an offset by the heuristics: the loop init is searched up to 0x4F bytes
+// back, jmp short targets are read up to 0x105 bytes ahead, and a match needs the longest
+// pattern or API name after its start. Branch targets further away are read through the
+// far page.
+//
+#define MALSCORE_BACK_SIZE 0x100
+#define MALSCORE_FORWARD_SIZE 0x1000
+#define MALSCORE_FAR_SIZE 0x1000
+
+//
+// Runs of a repeated unit score MALSCORE_SPRAY_SCORE per MALSCORE_SPRAY_SIZE bytes when
+// the unit is what an exploit sprays (see GetSprayType()).
+//
+#define MALSCORE_SPRAY_SIZE 0x900
+#define MALSCORE_SPRAY_SCORE 2000
+#define MALSCORE_SPRAY_VERBOSE_RUNS 16
+
+//
+// The first 64 KB of an address space are never mapped.
+//
+#define MALSCORE_LOWEST_ADDRESS 0x10000
+
+typedef enum _MALSCORE_SPRAY_TYPE {
+    SprayTypeFill = 0, // Padding, heap fill, arrays of identical pointers or structures.
+    SprayTypeSled,
+    SprayTypeAddress
+} MALSCORE_SPRAY_TYPE;
+
+static LPCSTR g_SprayTypeNames[] = { "fill", "sled", "sprayed address" };
+
+typedef struct _MALSCORE_STATE {
+    PMALSCORE_READER Reader;
+    PVOID Context;
+    ULONG64 Length;
+    ULONG Flags; // MALSCORE_REGION_*
+
+    //
+    // Region bytes [WindowStart, WindowStart + WindowSize), zeroes outside of the region.
+    //
+    LPBYTE Window;
+    LONG64 WindowStart;
+    ULONG WindowSize;
+
+    UCHAR Far[MALSCORE_FAR_SIZE];
+    ULONG64 FarStart; // MAXULONG64 when empty.
+
+    //
+    // Carried from one chunk to the next.
+    //
+    ULONG64 Next; // Loops skip ahead of the chunk end.
+    ULONG Score;
+
+    PULONG64 RuleHits; // Per rule, one bit per string found. NULL without rules.
+
+    //
+    // Pages are added once every offset in them was scored, from the window or the far page.
+    //
+    ENTROPY_CONTEXT Entropy;
+    ULONG64 NextPage;
+    ULONG64 HighRunStart;
+    ULONG HighRunPages;
+
+    SPRAY_CONTEXT Spray; // Fed with the same pages.
+    ULONG NumberOfSprays;
+} MALSCORE_STATE, *PMALSCORE_STATE;
+
+static
+UCHAR
+GetMalScoreByte(
+    PMALSCORE_STATE State,
+    ULONG64 Offset
+)
+{
+    if (Offset >= State->Length) return 0;
+
+    if (((LONG64)Offset >= State->WindowStart) && ((LONG64)Offset < (State->WindowStart + State->WindowSize)))
+    {
+        return State->Window[Offset - State->WindowStart];
+    }
+
+    if ((State->FarStart == MAXULONG64) || (Offset < State->FarStart) || ((Offset - State->FarStart) >= MALSCORE_FAR_SIZE))
+    {
+        State->FarStart = Offset & ~(MALSCORE_FAR_SIZE - 1);
+
+        RtlZeroMemory(State->Far, sizeof(State->Far));
+        State->Reader(State->Context, State->FarStart, State->Far, (ULONG)min(State->Length - State->FarStart, (ULONG64)MALSCORE_FAR_SIZE));
+    }
+
+    return State->Far[Offset - State->FarStart];
+}
+
+//
+// Reads the window of the chunk starting at ChunkStart, FALSE if the reader failed.
+//
+static
+BOOLEAN
+ReadMalScoreWindow(
+    PMALSCORE_STATE State,
+    ULONG64 ChunkStart,
+    ULONG ChunkSize
+)
+{
+    LONG64 Start = (LONG64)ChunkStart - MALSCORE_BACK_SIZE;
+    LONG64 End = min((LONG64)ChunkStart + ChunkSize + MALSCORE_FORWARD_SIZE, (LONG64)State->Length);
+    LONG64 ReadStart = max(Start, (LONG64)0);
+
+    RtlZeroMemory(State->Window, State->WindowSize);
+    State->WindowStart = Start;
+
+    return State->Reader(State->Context, (ULONG64)ReadStart, State->Window + (ReadStart - Start), (ULONG)(End - ReadStart));
+}
+
+static
+VOID
+CloseEntropyRun(
     BOOLEAN Verbose,
     ULONG64 VirtualAddress,
-    LPBYTE Buffer,
-    ULONG BufferLen
+    PMALSCORE_STATE State
 )
 {
-    ULONG i;
-    ULONG val = 0, val2 = 0, val3 = 0, addr = 0;
+    if (State->HighRunPages >= MALSCORE_ENTROPY_RUN_PAGES)
+    {
+        if (Verbose) MalScoreOut("    High entropy pages @ <link cmd=\"db 0x%I64X\">0x%I64X</link> (%d pages)\n",
+                                VirtualAddress + State->HighRunStart, State->HighRunStart, State->HighRunPages);
 
-    InitPatternTable(g_PatternTable);
-    ULONG MaxPatternLen = GetMaxPatternLen();
+        State->Score += MALSCORE_ENTROPY_SCORE;
+    }
+
+    State->HighRunPages = 0;
+}
+
+//
+// Length of the x86 instructions a sled can be made of, 0 for the other opcodes: one byte
+// instructions without memory operands, and immediates to a register, so that 0x0C0C0C0C
+// runs as or al, 0Ch.
+//
+static
+ULONG
+GetSledLength(
+    UCHAR Opcode
+)
+{
+    if ((Opcode >= 0x40) && (Opcode <= 0x4F)) return 1; // inc/dec r32
+    if ((Opcode >= 0x90) && (Opcode <= 0x99)) return 1; // nop, xchg eax, r32, cwde, cdq
+    if ((Opcode >= 0xB0) && (Opcode <= 0xB7)) return 2; // mov r8, imm8
+    if ((Opcode >= 0xB8) && (Opcode <= 0xBF)) return 5; // mov r32, imm32
+
+    switch (Opcode)
+    {
+        case 0x27: case 0x2F: case 0x37: case 0x3F: // daa, das, aaa, aas
+        case 0x9E: case 0x9F: // sahf, lahf
+        case 0xF5: case 0xF8: case 0xF9: case 0xFC: case 0xFD: // cmc, clc, stc, cld, std
+            return 1;
+        case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x34: case 0x3C: case 0xA8: // op al, imm8
+            return 2;
+        case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x35: case 0x3D: case 0xA9: // op eax, imm32
+            return 5;
+    }
+
+    return 0;
+}
+
+//
+// A sled runs into the payload wherever execution lands in it: decoding from each byte of
+// the unit only meets sled instructions. Offsets are followed modulo the unit until they
+// come back to one already checked.
+//
+static
+BOOLEAN
+IsSled(
+    const SPRAY_RUN *Run
+)
+{
+    ULONG Checked = 0;
+
+    for (ULONG Start = 0; Start < Run->Unit; Start += 1)
+    {
+        for (ULONG i = Start; !(Checked & (1UL << i)); )
+        {
+            ULONG Length = GetSledLength(Run->Pattern[i]);
+
+            if (Length == 0) return FALSE;
+
+            Checked |= 1UL << i;
+            i = (i + Length) % Run->Unit;
+        }
+    }
+
+    return TRUE;
+}
+
+//
+// Sprays are made of the address the exploit jumps to, in the sprayed region itself. The
+// pointers are aligned dwords for units up to 4 bytes, and aligned qwords for 8 byte units.
+// Identical pointers to anywhere else are arrays, 16 byte units structures.
+//
+static
+BOOLEAN
+IsSprayedAddress(
+    const SPRAY_RUN *Run,
+    ULONG64 VirtualAddress,
+    ULONG64 Length
+)
+{
+    ULONG Size = (Run->Unit <= sizeof(ULONG)) ? sizeof(ULONG) : Run->Unit;
+    ULONG Skip;
+    ULONG64 Address = 0;
+
+    if (Size > sizeof(ULONG64)) return FALSE;
+
+    Skip = (ULONG)((Size - ((VirtualAddress + Run->Offset) % Size)) % Size);
+
+    for (ULONG i = 0; i < Size; i += 1)
+    {
+        Address |= (ULONG64)Run->Pattern[(Skip + i) % Run->Unit] << (i * 8);
+    }
+
+    return (Address >= MALSCORE_LOWEST_ADDRESS) && (Address >= VirtualAddress) && ((Address - VirtualAddress) < Length);
+}
+
+static
+MALSCORE_SPRAY_TYPE
+GetSprayType(
+    ULONG64 VirtualAddress,
+    PMALSCORE_STATE State,
+    const SPRAY_RUN *Run
+)
+{
+    if (IsSled(Run)) return SprayTypeSled;
+
+    if ((State->Flags & MALSCORE_REGION_WRITABLE) && IsSprayedAddress(Run, VirtualAddress, State->Length))
+    {
+        return SprayTypeAddress;
+    }
+
+    return SprayTypeFill;
+}
+
+static
+VOID
+ScoreMalSprays(
+    BOOLEAN Verbose,
+    ULONG64 VirtualAddress,
+    PMALSCORE_STATE State,
+    const vector<SPRAY_RUN>& Runs
+)
+{
+    for (ULONG r = 0; r < Runs.size(); r += 1)
+    {
+        const SPRAY_RUN *Run = &Runs[r];
+        MALSCORE_SPRAY_TYPE Type = GetSprayType(VirtualAddress, State, Run);
+
+        if (Type == SprayTypeFill) continue;
+
+        if (Verbose && (State->NumberOfSprays < MALSCORE_SPRAY_VERBOSE_RUNS))
+        {
+            MalScoreOut("    Heap-spray signature detected @ <link cmd=\"db 0x%I64X\">0x%I64X</link> (0x%I64X bytes of ",
+                       VirtualAddress + Run->Offset, Run->Offset, Run->Length);
+            for (ULONG i = 0; i < Run->Unit; i += 1) MalScoreOut("%02X", Run->Pattern[i]);
+            MalScoreOut(", %s)\n", g_SprayTypeNames[Type]);
+        }
+
+        State->NumberOfSprays += 1;
+        State->Score += (ULONG)(Run->Length / MALSCORE_SPRAY_SIZE) * MALSCORE_SPRAY_SCORE;
+    }
+}
+
+static
+VOID
+FeedMalSprays(
+    BOOLEAN Verbose,
+    ULONG64 VirtualAddress,
+    PMALSCORE_STATE State,
+    const UCHAR *Data,
+    ULONG Length
+)
+{
+    vector<SPRAY_RUN> Runs;
+
+    SprayUpdate(&State->Spray, Data, Length, Runs);
+    ScoreMalSprays(Verbose, VirtualAddress, State, Runs);
+}
+
+//
+// Adds the pages ending at or before Limit to the entropy map and the spray detector. The
+// pages found in the window go to the detector at once.
+//
+static
+VOID
+ScoreMalPages(
+    BOOLEAN Verbose,
+    ULONG64 VirtualAddress,
+    PMALSCORE_STATE State,
+    ULONG64 Limit
+)
+{
+    ULONG64 SpanStart = State->NextPage;
+
+    while (State->NextPage < State->Length)
+    {
+        ULONG64 Offset = State->NextPage;
+        ULONG Size = (ULONG)min(State->Length - Offset, (ULONG64)ENTROPY_PAGE_SIZE);
+        const UCHAR *Page;
+
+        if ((Offset + Size) > Limit) break;
+
+        if (((LONG64)Offset >= State->WindowStart) && (((LONG64)Offset + Size) <= (State->WindowStart + State->WindowSize)))
+        {
+            Page = State->Window + ((LONG64)Offset - State->WindowStart);
+        }
+        else
+        {
+            if (Offset > SpanStart)
+            {
+                FeedMalSprays(Verbose, VirtualAddress, State, State->Window + ((LONG64)SpanStart - State->WindowStart), (ULONG)(Offset - SpanStart));
+            }
+
+            //
+            // Skipped ahead of the window, or started before it.
+            //
+            if (State->FarStart != Offset)
+            {
+                State->FarStart = Offset;
+
+                RtlZeroMemory(State->Far, sizeof(State->Far));
+                State->Reader(State->Context, Offset, State->Far, Size);
+            }
+
+            Page = State->Far;
+
+            FeedMalSprays(Verbose, VirtualAddress, State, Page, Size);
+            SpanStart = Offset + Size;
+        }
+
+        if (EntropyUpdate(&State->Entropy, Page, Size) >= ENTROPY_HIGH)
+        {
+            if (State->HighRunPages == 0) State->HighRunStart = Offset;
+            State->HighRunPages += 1;
+        }
+        else
+        {
+            CloseEntropyRun(Verbose, VirtualAddress, State);
+        }
+
+        State->NextPage = Offset + Size;
+    }
+
+    if (State->NextPage > SpanStart)
+    {
+        FeedMalSprays(Verbose, VirtualAddress, State, State->Window + ((LONG64)SpanStart - State->WindowStart), (ULONG)(State->NextPage - SpanStart));
+    }
+}
+
+//
+// Region offset of a branch target, MAXULONG64 outside of the region.
+//
+static
+ULONG64
+GetMalScoreTarget(
+    PMALSCORE_STATE State,
+    ULONG64 Offset,
+    LONG64 Delta
+)
+{
+    LONG64 Target = (LONG64)Offset + Delta;
+
+    if ((Target < 0) || ((ULONG64)Target >= State->Length)) return MAXULONG64;
+
+    return (ULONG64)Target;
+}
 
-    ULONG MaxBlLen = GetMaxBlacklistedLen();
+//
+// Scores the offsets [State->Next, State->Next + ChunkSize) below End, from the window.
+//
+static
+VOID
+ScoreMalChunk(
+    BOOLEAN Verbose,
+    ULONG64 VirtualAddress,
+    PMALSCORE_STATE State,
+    ULONG ChunkSize,
+    ULONG64 End
+)
+{
+    ULONG i;
+    ULONG val = 0, val2 = 0, addr = 0;
+    ULONG64 Target;
+
+    UINT MalScoreIndex = State->Score;
+
+    //
+    // Indexed with chunk offsets, the window starts MALSCORE_BACK_SIZE bytes before the
+    // chunk and ends MALSCORE_FORWARD_SIZE bytes after it.
+    //
+    ULONG64 ChunkStart = State->Next;
+    LPBYTE Buffer = State->Window + MALSCORE_BACK_SIZE;
+
+    ULONG ChunkLength = (ULONG)min((ULONG64)ChunkSize, End - ChunkStart);
+    ULONG ScanLength = (ULONG)min((ULONG64)ChunkSize + MALSCORE_FORWARD_SIZE, State->Length - ChunkStart);
+
+    //
+    // Every pattern, API name and rule string found in one pass, then consumed in offset order.
+    //
+    vector<PatternMatcher::PATTERN_MATCH> Matches, RuleMatches;
+    ULONG NextMatch = 0;
+
+    //
+    // Candidate offsets of the current block, the heuristics only run on those.
+    //
+    ULONG Block = MAXULONG;
+    ULONG Candidates = 0;
+
+    g_ActiveMatcher->Scan(Buffer, ScanLength, Matches);
+
+    //
+    // Rule strings only count for their rules, the heuristics see the built-in matches.
+    //
+    if (State->RuleHits)
+    {
+        ULONG Kept = 0;
 
-    UINT MalScoreIndex = 0;
+        for (ULONG m = 0; m < Matches.size(); m += 1)
+        {
+            if (Matches[m].Id >= g_NumberOfBuiltinIds) RuleMatches.push_back(Matches[m]);
+            else Matches[Kept++] = Matches[m];
+        }
+
+        Matches.resize(Kept);
+    }
 
-    BOOLEAN bHeapSpray = FALSE;
+    UINT a;
 
-    for (UINT a = 0; a < BufferLen - MaxPatternLen; a++)
+    for (a = 0; a < ChunkLength; a++)
     {
-        if (MatchPattern(Verbose, Buffer + a, VirtualAddress, a, g_PatternTable))
+        while ((NextMatch < Matches.size()) && (Matches[NextMatch].Offset < a)) NextMatch += 1;
+
+        if ((a / MALSCORE_BLOCK_SIZE) != Block)
         {
+            Block = a / MALSCORE_BLOCK_SIZE;
+            Candidates = GetCandidates(Buffer, ScanLength, Block * MALSCORE_BLOCK_SIZE, Matches, NextMatch);
+        }
+
+        ULONG Pending = Candidates & (MAXULONG << (a % MALSCORE_BLOCK_SIZE));
+
+        while (!Pending)
+        {
+            Block += 1;
+            if ((Block * MALSCORE_BLOCK_SIZE) >= ChunkLength) break;
+
+            Candidates = GetCandidates(Buffer, ScanLength, Block * MALSCORE_BLOCK_SIZE, Matches, NextMatch);
+            Pending = Candidates;
+        }
+
+        if (!Pending)
+        {
+            a = ChunkLength;
+            break;
+        }
+
+        unsigned long Bit;
+
+        _BitScanForward(&Bit, Pending);
+        a = (Block * MALSCORE_BLOCK_SIZE) + Bit;
+        if (a >= ChunkLength) break;
+
+        while ((NextMatch < Matches.size()) && (Matches[NextMatch].Offset < a)) NextMatch += 1;
+
+        BOOLEAN HasMatch = (NextMatch < Matches.size()) && (Matches[NextMatch].Offset == a);
+
+        if (HasMatch && (Matches[NextMatch].Id < g_NumberOfPatterns))
+        {
+            //
+            // Lowest id first, the table entry MatchPattern() would have stopped at.
+            //
+            PPATTERN_ENTRY Entry = &g_PatternTable[Matches[NextMatch].Id];
+
+            if (Entry->CallbackRoutine) Entry->CallbackRoutine(Verbose, VirtualAddress, ChunkStart + a);
             MalScoreIndex = MalScoreIndex + 10;
         }
-        else if (Buffer[a] == 0xEB && (Buffer[a + 1] < BufferLen) && Buffer[a + 2 + Buffer[a + 1]] == 0xE8) // JMP + CALL
+        else if (Buffer[a] == 0xEB && (Buffer[a + 1] < State->Length) && Buffer[a + 2 + Buffer[a + 1]] == 0xE8) // JMP + CALL
         {
             // addr = (DWORD)((Buffer + a + 2 + *(Buffer + a + 1)) - Buffer);
             addr = a + 2 + Buffer[a + 1];
             val = (Buffer[addr + 1]) | (Buffer[addr + 2] << 8) | (Buffer[addr + 3] << 16) | (Buffer[addr + 4] << 24);
 
-            if ((addr + val + 5) >= BufferLen) continue; // Invalid range
+            Target = GetMalScoreTarget(State, ChunkStart + addr + 5, (LONG)val);
+            if (Target == MAXULONG64) continue; // Invalid range
 
-            switch (Buffer[addr + val + 5])
+            switch (GetMalScoreByte(State, Target))
             {
             case 0x58:
             case 0x59:
             case 0x5A:
             case 0x5B:
-                if (Verbose) g_Ext->Dml("    JMP [0xEB]/CALL/POP signature found @ <link cmd=\"u 0x%I64X\">0x%X</link>\n",
-                                        VirtualAddress + a, a);
+                if (Verbose) MalScoreOut("    JMP [0xEB]/CALL/POP signature found @ <link cmd=\"u 0x%I64X\">0x%I64X</link>\n",
+                                        VirtualAddress + ChunkStart + a, ChunkStart + a);
                 // if (DEBUG == 1) Disasm(Buffer + a);
                 MalScoreIndex = MalScoreIndex + 10;
                 break;
 
             case 0x5E:
             case 0x5f:
-                if (Verbose) g_Ext->Dml("    JMP [0xEB]/CALL/POP signature found @ <link cmd=\"u 0x%I64X\">0x%X</link>\n",
-                    VirtualAddress + a, a);
+                if (Verbose) MalScoreOut("    JMP [0xEB]/CALL/POP signature found @ <link cmd=\"u 0x%I64X\">0x%I64X</link>\n",
+                    VirtualAddress + ChunkStart + a, ChunkStart + a);
                 // if (DEBUG == 1) Disasm(Buffer + a);
                 MalScoreIndex = MalScoreIndex + 10;
                 break;
 
             case 0x33:
             case 0xc9:
-                if (Verbose) g_Ext->Dml("    JMP [0xEB]/CALL signature found @ <link cmd=\"u 0x%I64X\">0x%X</link>\n",
-                    VirtualAddress + a, a);
+                if (Verbose) MalScoreOut("    JMP [0xEB]/CALL signature found @ <link cmd=\"u 0x%I64X\">0x%I64X</link>\n",
+                    VirtualAddress + ChunkStart + a, ChunkStart + a);
                 // if (DEBUG == 1) Disasm(Buffer + a);
                 MalScoreIndex = MalScoreIndex + 10;
                 break;
@@ -463,36 +1271,41 @@ GetMalScore(
         {
             val = (Buffer[a + 1]) | (Buffer[a + 2] << 8) | (Buffer[a + 3] << 16) | (Buffer[a + 4] << 24);
 
-            if ((a + val + 5) >= BufferLen) continue; // Invalid range
+            Target = GetMalScoreTarget(State, ChunkStart + a + 5, (LONG)val);
+            if (Target == MAXULONG64) continue; // Invalid range
 
-            if (Buffer[a + val + 5] == 0xE8)
+            if (GetMalScoreByte(State, Target) == 0xE8)
             {
-                val2 = (Buffer[a + val + 1]) | (Buffer[a + val + 2] << 8) | (Buffer[a + val + 3] << 16) | (Buffer[a + val + 4] << 24);
+                //
+                // Offsets before the region wrap past its end and read as zeroes.
+                //
+                val2 = (GetMalScoreByte(State, Target - 4)) | (GetMalScoreByte(State, Target - 3) << 8) |
+                       (GetMalScoreByte(State, Target - 2) << 16) | (GetMalScoreByte(State, Target - 1) << 24);
 
                 char Opcode = 0;
                 if (val2 == 0)
                 {
-                    if ((a + val + 5 + 5) >= BufferLen) continue; // Invalid range
-
-                    Opcode = Buffer[a + val + 5 + 5];
+                    Target = GetMalScoreTarget(State, Target, 5);
                 }
                 else
                 {
                     val2 ^= 0xffffffff;
 
-                    if ((a + val + 5 - val2 + 4) >= BufferLen) continue; // Invalid range
-
-                    Opcode = Buffer[a + val + 5 - val2 + 4];
+                    Target = GetMalScoreTarget(State, Target, 4 - (LONG64)(LONG)val2);
                 }
 
+                if (Target == MAXULONG64) continue; // Invalid range
+
+                Opcode = GetMalScoreByte(State, Target);
+
                 switch (Opcode)
                 {
                 case 0x58:
                 case 0x59:
                 case 0x5A:
                 case 0x5B:
-                    if (Verbose) g_Ext->Dml("    JMP [0xE9]/CALL/POP signature found @ <link cmd=\"u 0x%I64X\">0x%X</link>\n",
-                        VirtualAddress + a, a);
+                    if (Verbose) MalScoreOut("    JMP [0xE9]/CALL/POP signature found @ <link cmd=\"u 0x%I64X\">0x%I64X</link>\n",
+                        VirtualAddress + ChunkStart + a, ChunkStart + a);
                     // if (DEBUG == 1) Disasm(Buffer + a);
                     MalScoreIndex = MalScoreIndex + 10;
                     break;
@@ -500,8 +1313,8 @@ GetMalScore(
                 case 0x5D:
                 case 0x5E:
                 case 0x5F:
-                    if (Verbose) g_Ext->Dml("    JMP [0xE9]/CALL/POP signature found @ <link cmd=\"u 0x%I64X\">0x%X</link>\n",
-                        VirtualAddress + a, a);
+                    if (Verbose) MalScoreOut("    JMP [0xE9]/CALL/POP signature found @ <link cmd=\"u 0x%I64X\">0x%I64X</link>\n",
+                        VirtualAddress + ChunkStart + a, ChunkStart + a);
                     // if (DEBUG == 1) Disasm(Buffer + a);
                     MalScoreIndex = MalScoreIndex + 10;
                     break;
@@ -512,7 +1325,7 @@ GetMalScore(
         {
             unsigned int loopinitstart = 0, p = 0, r = 0, loinitdist = 0x20;
             BYTE LO = 0;
-            unsigned long base = 0, lostart = 0;
+            LONG base = 0, lostart = 0; // The loop start can be before the region.
 
             base = a; //  address of loop opcode
             LO = *(Buffer + a + 1) + 1;
@@ -525,7 +1338,7 @@ GetMalScore(
                 // loinitdist is the distance length from lostart. from here we scan 0x20 bytes for a loop init via ECX
                 for (p = 0; p <= loinitdist; p++)
                 {
-                    if (MatchPattern(Verbose, Buffer + lostart - loinitdist + p, VirtualAddress, lostart - loinitdist + p, g_InitEcx))
+                    if (MatchPattern(Verbose, Buffer + (LONG)(lostart - loinitdist + p), VirtualAddress, ChunkStart + (LONG)(lostart - loinitdist + p), g_InitEcx))
                     {
                         // variable loopinitstart stores start of loop init via ECX register
                         loopinitstart = p;
@@ -533,11 +1346,11 @@ GetMalScore(
                         for (r = 0; r <= LO; r++)
                         {
                             // scan for several XORs and ROLs (ADD missing currently)
-                            if (MatchPattern(Verbose, Buffer + base - LO + r, VirtualAddress, base - LO + r, g_PatternLoop))
+                            if (MatchPattern(Verbose, Buffer + (LONG)(base - LO + r), VirtualAddress, ChunkStart + (LONG)(base - LO + r), g_PatternLoop))
                             {
-                                if (Verbose) g_Ext->Dml("    Decryption loop detected at offset <link cmd=\"u 0x%I64X\">0x%08x</link>\n\n",
-                                                        VirtualAddress + lostart - loinitdist + loopinitstart,
-                                                        lostart - loinitdist + loopinitstart);
+                                if (Verbose) MalScoreOut("    Decryption loop detected at offset <link cmd=\"u 0x%I64X\">0x%08I64X</link>\n\n",
+                                                        VirtualAddress + ChunkStart + (LONG)(lostart - loinitdist + loopinitstart),
+                                                        ChunkStart + (LONG)(lostart - loinitdist + loopinitstart));
                                 // Disasm(Buffer + lostart - loinitdist + loopinitstart);
                                 // if (Verbose) g_Ext->Dml("<link cmd=\"u 0x%I64X\">Disass detected loop @ 0x%X</link>\n", VirtualAddress + lostart - loinitdist + loopinitstart);
                                 MalScoreIndex = MalScoreIndex + 10;
@@ -549,64 +1362,466 @@ GetMalScore(
                 }
             }
         }
-        else if (Buffer[a] == 0x90)
+        else if (HasMatch)
         {
-            ULONG PatternLength = 0x900;
-            for (i = 0; i < PatternLength; i += 1)
+            for (ULONG m = NextMatch; (m < Matches.size()) && (Matches[m].Offset == a); m += 1)
             {
-                if (Buffer[a + i] != 0x90) break;
-            }
+                i = Matches[m].Id - g_NumberOfPatterns;
 
-            if (i == PatternLength)
-            {
-                if (Verbose && !bHeapSpray)
-                {
-                    g_Ext->Dml("    Heap-spray signature detected @ <link cmd=\"u 0x%I64X\">0x%X</link>\n", VirtualAddress + a, a);
-                    bHeapSpray = TRUE;
-                }
-                MalScoreIndex += 2000;
-                a += i;
+                if (Verbose) MalScoreOut("    API-Name \"%s\" string found at offset: 0x%I64x\n", Blacklist_Functions[i], ChunkStart + a);
+                // if (DEBUG == 1) HexDump("PE-File", Buffer + a, 256);
+                MalScoreIndex = MalScoreIndex + 2;
             }
         }
-        else
+    }
+
+    State->Next = ChunkStart + a;
+
+    //
+    // Rule strings starting in the offsets consumed by this chunk, up to the end of the
+    // region for the last one.
+    //
+    ULONG64 Consumed = (State->Next >= End) ? State->Length : State->Next;
+
+    for (ULONG m = 0; m < RuleMatches.size(); m += 1)
+    {
+        ULONG String = RuleMatches[m].Id - g_NumberOfBuiltinIds;
+        ULONG Rule;
+
+        if ((ChunkStart + RuleMatches[m].Offset) >= Consumed) break;
+        if (String >= g_MalScoreRules.m_Strings.size()) continue;
+
+        Rule = g_MalScoreRules.m_Strings[String].Rule;
+        State->RuleHits[Rule] |= 1ULL << (String - g_MalScoreRules.m_Rules[Rule].FirstString);
+    }
+
+    State->Score = MalScoreIndex;
+
+    ScoreMalPages(Verbose, VirtualAddress, State, Consumed);
+}
+
+BOOLEAN
+GetMalScoreStream(
+    BOOLEAN Verbose,
+    ULONG64 VirtualAddress,
+    ULONG64 Length,
+    PMALSCORE_READER Reader,
+    PVOID Context,
+    ULONG ChunkSize,
+    ULONG Flags,
+    PULONG Score,
+    PMALSCORE_DETAILS Details
+)
+{
+    PMALSCORE_STATE State = NULL;
+    BOOLEAN Result = FALSE;
+
+    ULONG MaxPatternLen = GetMaxPatternLen();
+    ULONG64 End;
+
+    vector<SPRAY_RUN> Runs;
+
+    *Score = 0;
+    if (Details) RtlZeroMemory(&Details->Entropy, sizeof(Details->Entropy));
+
+    if (Length <= MaxPatternLen) return TRUE;
+
+    End = Length - MaxPatternLen;
+
+    if ((ChunkSize == 0) || (ChunkSize > MALSCORE_CHUNK_SIZE)) ChunkSize = MALSCORE_CHUNK_SIZE;
+    if (ChunkSize > End) ChunkSize = (ULONG)End;
+
+    State = (PMALSCORE_STATE)calloc(1, sizeof(MALSCORE_STATE));
+    if (State == NULL) goto CleanUp;
+
+    State->Reader = Reader;
+    State->Context = Context;
+    State->Length = Length;
+    State->Flags = Flags;
+    State->FarStart = MAXULONG64;
+    EntropyInit(&State->Entropy, Length);
+    SprayInit(&State->Spray, MALSCORE_SPRAY_SIZE);
+    State->WindowSize = MALSCORE_BACK_SIZE + ChunkSize + MALSCORE_FORWARD_SIZE;
+    State->Window = (LPBYTE)malloc(State->WindowSize);
+    if (State->Window == NULL) goto CleanUp;
+
+    if (g_MalScoreRules.m_Rules.size())
+    {
+        State->RuleHits = (PULONG64)calloc(g_MalScoreRules.m_Rules.size(), sizeof(ULONG64));
+        if (State->RuleHits == NULL) goto CleanUp;
+    }
+
+    while (State->Next < End)
+    {
+        //
+        // Later windows are scored even if unreadable, as zeroes.
+        //
+        if (!ReadMalScoreWindow(State, State->Next, ChunkSize) && (State->Next == 0)) goto CleanUp;
+
+        ScoreMalChunk(Verbose, VirtualAddress, State, ChunkSize, End);
+    }
+
+    CloseEntropyRun(Verbose, VirtualAddress, State);
+
+    SprayFinal(&State->Spray, Runs);
+    ScoreMalSprays(Verbose, VirtualAddress, State, Runs);
+
+    if (Verbose && (State->NumberOfSprays > MALSCORE_SPRAY_VERBOSE_RUNS))
+    {
+        MalScoreOut("    ... %d heap-spray signatures in total\n", State->NumberOfSprays);
+    }
+
+    if (Details) EntropyFinal(&State->Entropy, &Details->Entropy);
+
+    for (ULONG i = 0; State->RuleHits && (i < g_MalScoreRules.m_Rules.size()); i += 1)
+    {
+        MalScoreRules::PRULE Rule = &g_MalScoreRules.m_Rules[i];
+        ULONG Count = 0;
+
+        for (ULONG64 Bits = State->RuleHits[i]; Bits; Bits &= Bits - 1) Count += 1;
+        if (Count < Rule->Condition) continue;
+
+        if (Verbose) MalScoreOut("    Rule \"%s\" matched (%d/%d strings, weight %d)\n",
+                                Rule->Name.c_str(), Count, Rule->NumberOfStrings, Rule->Weight);
+
+        State->Score += Rule->Weight;
+        if (Details) Details->Rules.push_back(i);
+    }
+
+    *Score = State->Score;
+    Result = TRUE;
+
+CleanUp:
+    if (State)
+    {
+        if (State->Window) free(State->Window);
+        if (State->RuleHits) free(State->RuleHits);
+        free(State);
+    }
+
+    return Result;
+}
+
+static
+BOOLEAN
+ReadMalScoreBuffer(
+    PVOID Context,
+    ULONG64 Offset,
+    LPBYTE Buffer,
+    ULONG Length
+)
+{
+    memcpy(Buffer, (LPBYTE)Context + Offset, Length);
+
+    return TRUE;
+}
+
+ULONG
+GetMalScore(
+    BOOLEAN Verbose,
+    ULONG64 VirtualAddress,
+    LPBYTE Buffer,
+    ULONG BufferLen
+)
+{
+    ULONG MalScore = 0;
+
+    GetMalScoreStream(Verbose, VirtualAddress, BufferLen, ReadMalScoreBuffer, Buffer, 0, MALSCORE_REGION_WRITABLE, &MalScore);
+
+    return MalScore;
+}
+
+//
+// Instructions of the benign code corpus, Immediate random bytes follow Bytes.
+//
+typedef struct _MALSCORE_CORPUS_INSTRUCTION {
+    UCHAR Length;
+    UCHAR Immediate;
+    UCHAR Bytes[3];
+} MALSCORE_CORPUS_INSTRUCTION, *PMALSCORE_CORPUS_INSTRUCTION;
+
+static const MALSCORE_CORPUS_INSTRUCTION g_CorpusCode[] = {
+    { 3, 0, { 0x8B, 0x45, 0x08 } }, // mov eax, [ebp+8]
+    { 3, 0, { 0x89, 0x45, 0xFC } }, // mov [ebp-4], eax
+    { 3, 0, { 0x83, 0xEC, 0x10 } }, // sub esp, 10h
+    { 3, 0, { 0x8D, 0x4D, 0xF0 } }, // lea ecx, [ebp-10h]
+    { 2, 0, { 0x85, 0xC0 } }, // test eax, eax
+    { 2, 0, { 0x33, 0xC0 } }, // xor eax, eax
+    { 2, 0, { 0x3B, 0xC1 } }, // cmp eax, ecx
+    { 2, 0, { 0x74, 0x05 } }, // jz $+7
+    { 2, 0, { 0x75, 0x07 } }, // jnz $+9
+    { 2, 0, { 0x6A, 0x00 } }, // push 0
+    { 1, 0, { 0x50 } }, // push eax
+    { 1, 0, { 0x56 } }, // push esi
+    { 1, 0, { 0x5E } }, // pop esi
+    { 1, 0, { 0xC3 } }, // ret
+    { 1, 4, { 0xE8 } }, // call rel32
+    { 2, 4, { 0xFF, 0x15 } }, // call [imm32]
+    { 1, 4, { 0xB8 } } // mov eax, imm32
+};
+
+//
+// xor ecx, ecx, then xor byte [esi+ecx], 5Ah / inc ecx / cmp ecx, 100h / jnz back.
+//
+static const UCHAR g_CorpusDecryptLoop[] = {
+    0x33, 0xC9,
+    0x80, 0x34, 0x0E, 0x5A,
+    0x41,
+    0x81, 0xF9, 0x00, 0x01, 0x00, 0x00,
+    0x75, 0xF3
+};
+
+//
+// jmp short/call/pop ecx and jmp near/call next/pop eax.
+//
+static const UCHAR g_CorpusJmpCallPop[][11] = {
+    { 0xEB, 0x00, 0xE8, 0x02, 0x00, 0x00, 0x00, 0xCC, 0xCC, 0x59, 0xCC },
+    { 0xE9, 0x00, 0x00, 0x00, 0x00, 0xE8, 0x00, 0x00, 0x00, 0x00, 0x58 }
+};
+
+typedef enum _MALSCORE_CORPUS_FILLER {
+    CorpusFillerRandom = 0,
+    CorpusFillerZero,
+    CorpusFillerText,
+    CorpusFillerCode,
+    CorpusFillerSpray
+} MALSCORE_CORPUS_FILLER;
+
+typedef enum _MALSCORE_CORPUS_PLANT {
+    CorpusPlantNone = 0,
+    CorpusPlantPattern, // g_PatternTable entries of Callback.
+    CorpusPlantJmpCallPop,
+    CorpusPlantDecryptLoop,
+    CorpusPlantApiName,
+    CorpusPlantNopSled,
+    CorpusPlantPadding,
+    CorpusPlantHeapFill,
+    CorpusPlantPointerArray,
+    CorpusPlantAddressSpray
+} MALSCORE_CORPUS_PLANT;
+
+//
+// Fills that repeat as much as a spray and must not score: debug heap fills, and arrays of
+// identical pointers and structures (a 64-bit pointer, a 32-bit one, a 16 byte structure).
+//
+static const ULONG g_CorpusHeapFill[] = { 0xFEEEFEEE, 0xBAADF00D, 0xABABABAB, 0xCDCDCDCD };
+
+static const UCHAR g_CorpusPointerArray[][16] = {
+    { 0x10, 0x2C, 0x3B, 0x5A, 0xD4, 0x01, 0x00, 0x00, 0x10, 0x2C, 0x3B, 0x5A, 0xD4, 0x01, 0x00, 0x00 },
+    { 0x58, 0x1C, 0xA4, 0x02, 0x58, 0x1C, 0xA4, 0x02, 0x58, 0x1C, 0xA4, 0x02, 0x58, 0x1C, 0xA4, 0x02 },
+    { 0x01, 0x00, 0x00, 0x00, 0x58, 0x1C, 0xA4, 0x02, 0xFF, 0xFF, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00 }
+};
+
+typedef struct _MALSCORE_CORPUS {
+    LPCSTR Name;
+    MALSCORE_CORPUS_FILLER Filler;
+    MALSCORE_CORPUS_PLANT Plant;
+    DISPLAY_CALLBACK Callback;
+} MALSCORE_CORPUS, *PMALSCORE_CORPUS;
+
+static const MALSCORE_CORPUS g_MalScoreCorpora[] = {
+    { "Random", CorpusFillerRandom, CorpusPlantNone, NULL },
+    { "Zero", CorpusFillerZero, CorpusPlantNone, NULL },
+    { "Text", CorpusFillerText, CorpusPlantNone, NULL },
+    { "Code", CorpusFillerCode, CorpusPlantNone, NULL },
+    { "FS:[30h]", CorpusFillerCode, CorpusPlantPattern, peb_access_signature_callback },
+    { "FS:[00h]", CorpusFillerCode, CorpusPlantPattern, peb2_access_signature_callback },
+    { "API hashing", CorpusFillerCode, CorpusPlantPattern, api_hashing_signature_callback },
+    { "Function prolog", CorpusFillerCode, CorpusPlantPattern, function_prolog_signature_callback },
+    { "PUSH/CALL", CorpusFillerCode, CorpusPlantPattern, push_call_signature_callback },
+    { "FLDZ/FSTENV", CorpusFillerCode, CorpusPlantPattern, fpu_signature_callback },
+    { "CALL/POP", CorpusFillerCode, CorpusPlantPattern, call_pop_signature_callback },
+    { "JMP/CALL/POP", CorpusFillerCode, CorpusPlantJmpCallPop, NULL },
+    { "Decryption loop", CorpusFillerCode, CorpusPlantDecryptLoop, NULL },
+    { "API names", CorpusFillerCode, CorpusPlantApiName, NULL },
+    { "NOP sled", CorpusFillerCode, CorpusPlantNopSled, NULL },
+    { "Spray", CorpusFillerSpray, CorpusPlantNone, NULL },
+    { "Address spray", CorpusFillerZero, CorpusPlantAddressSpray, NULL },
+    { "Padding", CorpusFillerZero, CorpusPlantPadding, NULL },
+    { "Heap fill", CorpusFillerZero, CorpusPlantHeapFill, NULL },
+    { "Pointer array", CorpusFillerZero, CorpusPlantPointerArray, NULL }
+};
+
+static
+ULONG
+GetCorpusRandom(
+    PULONG Seed
+)
+{
+    *Seed = (*Seed * 1103515245) + 12345;
+
+    return *Seed >> 16;
+}
+
+BOOLEAN
+GetMalScoreCorpus(
+    ULONG Index,
+    LPBYTE Buffer,
+    ULONG Size,
+    LPCSTR *Name
+)
+{
+    const MALSCORE_CORPUS *Corpus;
+    vector<PPATTERN_ENTRY> Patterns;
+    ULONG Seed = 0x12345678;
+    ULONG NumberOfApiNames = 0;
+
+    if (Index >= _countof(g_MalScoreCorpora)) return FALSE;
+
+    Corpus = &g_MalScoreCorpora[Index];
+    *Name = Corpus->Name;
+
+    for (ULONG j = 0; j < Size; )
+    {
+        const MALSCORE_CORPUS_INSTRUCTION *Instruction;
+
+        switch (Corpus->Filler)
         {
-            for (i = 0; Blacklist_Functions[i]; i++)
-            {
-                if (memcmp(Blacklist_Functions[i], Buffer + a, strlen(Blacklist_Functions[i])) == 0)
+            case CorpusFillerRandom:
+                Buffer[j++] = (UCHAR)GetCorpusRandom(&Seed);
+                break;
+            case CorpusFillerZero:
+                Buffer[j++] = 0;
+                break;
+            case CorpusFillerText:
+                Buffer[j++] = (UCHAR)('A' + (GetCorpusRandom(&Seed) % 58)); // Letters and a few symbols.
+                break;
+            case CorpusFillerSpray:
+                Buffer[j] = ((j % 0x10000) < 0x20) ? (UCHAR)GetCorpusRandom(&Seed) : 0x0C; // Blocks with a header.
+                j += 1;
+                break;
+            case CorpusFillerCode:
+                Instruction = &g_CorpusCode[GetCorpusRandom(&Seed) % _countof(g_CorpusCode)];
+
+                for (ULONG k = 0; (k < Instruction->Length) && (j < Size); k += 1) Buffer[j++] = Instruction->Bytes[k];
+                for (ULONG k = 0; (k < Instruction->Immediate) && (j < Size); k += 1) Buffer[j++] = (UCHAR)GetCorpusRandom(&Seed);
+                break;
+        }
+    }
+
+    if (Corpus->Plant == CorpusPlantNone) return TRUE;
+
+    //
+    // Custom patterns are planted from their compiled bytes, wildcards get random ones.
+    //
+    InitPatternTable(g_PatternTable);
+
+    for (ULONG i = 0; g_PatternTable[i].PatternSize; i += 1)
+    {
+        if (g_PatternTable[i].CallbackRoutine == Corpus->Callback) Patterns.push_back(&g_PatternTable[i]);
+    }
+
+    while (Blacklist_Functions[NumberOfApiNames]) NumberOfApiNames += 1;
+
+    //
+    // One idiom per MALSCORE_CORPUS_STRIDE bytes, a few bytes into the page.
+    //
+    for (ULONG k = 0; ((k + 1) * MALSCORE_CORPUS_STRIDE) <= Size; k += 1)
+    {
+        LPBYTE Target = Buffer + (k * MALSCORE_CORPUS_STRIDE) + 0x100;
+        ULONG BlockSize = MALSCORE_CORPUS_STRIDE - 0x100; // Up to the next page.
+        PPATTERN_ENTRY Entry;
+        LPCSTR ApiName;
+        ULONG Address;
+
+        switch (Corpus->Plant)
+        {
+            case CorpusPlantNone:
+                break;
+            case CorpusPlantPattern:
+                if (Patterns.empty()) break;
+
+                Entry = Patterns[k % Patterns.size()];
+
+                for (ULONG j = 0; j < Entry->PatternSize; j += 1)
                 {
-                    if (Verbose) g_Ext->Dml("    API-Name \"%s\" string found at offset: 0x%x\n", Blacklist_Functions[i], a);
-                    // if (DEBUG == 1) HexDump("PE-File", Buffer + a, 256);
-                    MalScoreIndex = MalScoreIndex + 2;
+                    if (Entry->Type == PatternDataType) Target[j] = Entry->Pattern[j];
+                    else if (Entry->Data.PatternBitMask & (1 << j)) Target[j] = Entry->Data.Pattern[j];
+                    else Target[j] = (UCHAR)GetCorpusRandom(&Seed);
                 }
-            }
+                break;
+            case CorpusPlantJmpCallPop:
+                memcpy(Target, g_CorpusJmpCallPop[k % _countof(g_CorpusJmpCallPop)], sizeof(g_CorpusJmpCallPop[0]));
+                break;
+            case CorpusPlantDecryptLoop:
+                memcpy(Target, g_CorpusDecryptLoop, sizeof(g_CorpusDecryptLoop));
+                break;
+            case CorpusPlantApiName:
+                ApiName = Blacklist_Functions[k % NumberOfApiNames];
+                memcpy(Target, ApiName, strlen(ApiName));
+                break;
+            case CorpusPlantNopSled:
+                //
+                // A slide of two pages every 16 pages, then a jmp to the payload.
+                //
+                if ((k % 16) || (((k + 3) * MALSCORE_CORPUS_STRIDE) > Size)) break;
+
+                memset(Target, 0x90, 2 * MALSCORE_CORPUS_STRIDE);
+                Target[2 * MALSCORE_CORPUS_STRIDE] = 0xEB;
+                break;
+            case CorpusPlantPadding:
+                memset(Target, (k % 2) ? 0xFF : 0xCC, BlockSize);
+                break;
+            case CorpusPlantHeapFill:
+                for (ULONG j = 0; j < BlockSize; j += sizeof(ULONG))
+                {
+                    memcpy(Target + j, &g_CorpusHeapFill[k % _countof(g_CorpusHeapFill)], sizeof(ULONG));
+                }
+                break;
+            case CorpusPlantPointerArray:
+                for (ULONG j = 0; j < BlockSize; j += sizeof(g_CorpusPointerArray[0]))
+                {
+                    memcpy(Target + j, g_CorpusPointerArray[k % _countof(g_CorpusPointerArray)], sizeof(g_CorpusPointerArray[0]));
+                }
+                break;
+            case CorpusPlantAddressSpray:
+                //
+                // Addresses of the middle of the buffer, where the payload would be.
+                //
+                Address = (Size / 2) & ~0xFFFF;
+                for (ULONG j = 0; j < BlockSize; j += sizeof(ULONG)) memcpy(Target + j, &Address, sizeof(ULONG));
+                break;
         }
     }
 
-    return MalScoreIndex;
+    return TRUE;
 }
 
-ULONG
-GetMalScoreEx(
-    BOOLEAN Verbose,
-    MsProcessObject *ProcObj,
-    ULONG64 BaseAddress,
-    ULONG Length
+BOOLEAN
+RunMalScoreBench(
+    ULONG Size,
+    vector<MALSCORE_BENCH>& Results,
+    PULONG Checksum
 )
 {
-    LPBYTE Buffer = NULL;
-    ULONG MalScore = 0;
+    LPBYTE Buffer = (LPBYTE)malloc(Size);
+    MALSCORE_BENCH Bench;
 
-    Buffer = (LPBYTE)malloc(Length);
-    RtlZeroMemory(Buffer, Length);
+    *Checksum = 0x811C9DC5;
+    if (Buffer == NULL) return FALSE;
 
-    ProcObj->SwitchContext();
-    if (ExtRemoteTypedEx::ReadVirtual(BaseAddress, Buffer, Length, NULL) != S_OK) goto CleanUp;
-    ProcObj->RestoreContext();
+    for (ULONG i = 0; GetMalScoreCorpus(i, Buffer, Size, &Bench.Name); i += 1)
+    {
+        ULONG64 Start = GetTickCount64();
 
-    MalScore = GetMalScore(Verbose, BaseAddress, Buffer, Length);
+        Bench.Score = GetMalScore(FALSE, 0ULL, Buffer, Size);
+        Bench.ElapsedMs = GetTickCount64() - Start;
 
-CleanUp:
-    if (Buffer) free(Buffer);
+        //
+        // Not timed, only compared with the score of the whole buffer.
+        //
+        Bench.ChunkedScore = 0;
+        GetMalScoreStream(FALSE, 0ULL, Size, ReadMalScoreBuffer, Buffer, MALSCORE_BENCH_CHUNK_SIZE, MALSCORE_REGION_WRITABLE, &Bench.ChunkedScore);
 
-    return MalScore;
-}
\ No newline at end of file
+        for (ULONG j = 0; j < sizeof(Bench.Score); j += 1)
+        {
+            *Checksum = (*Checksum ^ ((Bench.Score >> (j * 8)) & 0xFF)) * 0x01000193;
+        }
+
+        Results.push_back(Bench);
+    }
+
+    free(Buffer);
+
+    return TRUE;
+}
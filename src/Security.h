@@ -38,6 +38,24 @@ Revision History:
 #ifndef __SECURITY_H__
 #define __SECURITY_H__
 
+//
+// Offsets scored per window by the streaming scorer, the window adds a few pages around them.
+//
+#define MALSCORE_CHUNK_SIZE (1024 * 1024)
+
+//
+// Reads Length bytes at Offset of the scored region. Bytes that cannot be read are left as
+// zeroes, FALSE if the first one cannot be read.
+//
+typedef BOOLEAN (*PMALSCORE_READER)(PVOID Context, ULONG64 Offset, LPBYTE Buffer, ULONG Length);
+
+//
+// Receives the output of the verbose scorer, DML included. Dropped while NULL.
+//
+typedef VOID (*PMALSCORE_OUTPUT)(LPCSTR Format, va_list Args);
+
+extern PMALSCORE_OUTPUT g_MalScoreOutput;
+
 ULONG
 GetMalScore(
     BOOLEAN Verbose,
@@ -46,11 +64,96 @@ GetMalScore(
     ULONG BufferLen
 );
 
-ULONG
-GetMalScoreEx(
+//
+// Runs of high entropy pages (packed or encrypted payloads) add MALSCORE_ENTROPY_SCORE each.
+//
+#define MALSCORE_ENTROPY_RUN_PAGES 2
+#define MALSCORE_ENTROPY_SCORE 50
+
+//
+// Region flags of GetMalScoreStream(). Sprayed addresses only score in writable regions.
+//
+#define MALSCORE_REGION_WRITABLE 0x1
+
+typedef struct _MALSCORE_DETAILS {
+    vector<ULONG> Rules; // Indexes in g_MalScoreRules.m_Rules of the rules that hit.
+    ENTROPY_SUMMARY Entropy;
+} MALSCORE_DETAILS, *PMALSCORE_DETAILS;
+
+//
+// Scores Length bytes read through Reader, ChunkSize (0 for MALSCORE_CHUNK_SIZE) offsets
+// at a time with bounded memory. Flags are MALSCORE_REGION_*. Same score as GetMalScore() on the whole region, whatever
+// the chunk size. FALSE if the start of the region cannot be read.
+// The weights of the loaded rules that hit are added to the score. Details (optional) gets
+// the rules that hit and the entropy map of the region.
+//
+BOOLEAN
+GetMalScoreStream(
     BOOLEAN Verbose,
-    MsProcessObject *ProcObj,
-    ULONG64 BaseAddress,
-    ULONG Length
+    ULONG64 VirtualAddress,
+    ULONG64 Length,
+    PMALSCORE_READER Reader,
+    PVOID Context,
+    ULONG ChunkSize,
+    ULONG Flags,
+    PULONG Score,
+    PMALSCORE_DETAILS Details = NULL
+);
+
+extern MalScoreRules g_MalScoreRules;
+
+//
+// Compiles the rules of FileName with the built-in patterns, or loads them from
+// FileName.cache when it was written for the same file and built-in patterns. Rules loaded
+// before are dropped, even on failure. Not to be called while regions are being scored.
+//
+BOOLEAN
+LoadMalScoreRules(
+    LPCSTR FileName,
+    BOOLEAN UseCache,
+    PBOOLEAN FromCache,
+    LPSTR Error,
+    ULONG ErrorSize
+);
+
+VOID
+UnloadMalScoreRules(
+);
+
+//
+// Deterministic synthetic buffers of !ms_malscore /bench: random, zero, text, benign code,
+// and benign code with one instance of a heuristic every MALSCORE_CORPUS_STRIDE bytes
+// (each g_PatternTable signature, jmp/call/pop, decryption loops, API names, nop slides),
+// sprays, and zeroes with a block per page of sprayed addresses or of benign fills
+// (padding, heap fill, pointer arrays) that must not score. FALSE past the last corpus.
+//
+#define MALSCORE_CORPUS_STRIDE 0x1000
+
+BOOLEAN
+GetMalScoreCorpus(
+    ULONG Index,
+    LPBYTE Buffer,
+    ULONG Size,
+    LPCSTR *Name
+);
+
+typedef struct _MALSCORE_BENCH {
+    LPCSTR Name;
+    ULONG Score;
+    ULONG ChunkedScore; // Scored MALSCORE_BENCH_CHUNK_SIZE offsets at a time, same as Score.
+    ULONG64 ElapsedMs; // Of the whole buffer.
+} MALSCORE_BENCH, *PMALSCORE_BENCH;
+
+#define MALSCORE_BENCH_CHUNK_SIZE 0x10000
+
+//
+// Scores every corpus of Size bytes, whole and in chunks. Checksum is the FNV-1a of the
+// scores, detections must not change with the optimizations. FALSE if out of memory.
+//
+BOOLEAN
+RunMalScoreBench(
+    ULONG Size,
+    vector<MALSCORE_BENCH>& Results,
+    PULONG Checksum
 );
 #endif
\ No newline at end of file
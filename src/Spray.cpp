@@ -0,0 +1,290 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - Spray.cpp
+
+Abstract:
+
+    - A run of a unit dividing SPRAY_PERIOD is a range where every byte equals
+      the byte SPRAY_PERIOD further. Outside of runs, only a probe of
+      SPRAY_PROBE_SIZE bytes every Stride is compared, short enough to land
+      inside any run of MinLength. Runs are then extended a vector at a time.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <string.h>
+#include <intrin.h>
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+#include "Spray.h"
+
+//
+// One bit per byte of the vector at Data equal to the byte SPRAY_PERIOD further.
+//
+static
+ULONG
+ComparePeriod(
+    const UCHAR *Data
+)
+{
+    __m128i a = _mm_loadu_si128((const __m128i *)Data);
+    __m128i b = _mm_loadu_si128((const __m128i *)(Data + SPRAY_PERIOD));
+
+    return (ULONG)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+}
+
+#define SPRAY_PERIOD_MASK ((1UL << SPRAY_PERIOD) - 1)
+
+//
+// Stream byte at Offset, from the history before Data.
+//
+static
+UCHAR
+GetSprayByte(
+    PSPRAY_CONTEXT Context,
+    const UCHAR *Data,
+    ULONG64 Offset
+)
+{
+    if (Offset >= Context->Position) return Data[Offset - Context->Position];
+
+    return Context->History[Context->HistoryLength - (ULONG)(Context->Position - Offset)];
+}
+
+static
+VOID
+OpenRun(
+    PSPRAY_CONTEXT Context,
+    const UCHAR *Data,
+    ULONG64 Start
+)
+{
+    PSPRAY_RUN Run = &Context->Run;
+
+    RtlZeroMemory(Run, sizeof(SPRAY_RUN));
+    Run->Offset = Start;
+
+    for (ULONG i = 0; i < SPRAY_PERIOD; i += 1) Run->Pattern[i] = GetSprayByte(Context, Data, Start + i);
+
+    //
+    // The period of the first SPRAY_PERIOD bytes divides SPRAY_PERIOD, it is the one of the run.
+    //
+    for (Run->Unit = 1; Run->Unit < SPRAY_PERIOD; Run->Unit *= 2)
+    {
+        if (memcmp(Run->Pattern, Run->Pattern + Run->Unit, SPRAY_PERIOD - Run->Unit) == 0) break;
+    }
+
+    RtlZeroMemory(Run->Pattern + Run->Unit, SPRAY_PERIOD - Run->Unit);
+
+    Context->InRun = TRUE;
+}
+
+//
+// End is the first byte that differs from the one SPRAY_PERIOD further.
+//
+static
+VOID
+CloseRun(
+    PSPRAY_CONTEXT Context,
+    ULONG64 End,
+    vector<SPRAY_RUN>& Runs
+)
+{
+    PSPRAY_RUN Run = &Context->Run;
+    BOOLEAN Zero = TRUE;
+
+    Run->Length = (End - Run->Offset) + SPRAY_PERIOD;
+
+    for (ULONG i = 0; i < Run->Unit; i += 1) if (Run->Pattern[i]) Zero = FALSE;
+
+    if ((Run->Length >= Context->MinLength) && !Zero) Runs.push_back(*Run);
+
+    Context->InRun = FALSE;
+    Context->Floor = End + 1;
+    Context->Next = End + 1;
+}
+
+//
+// Buffer holds the stream bytes [Base, End). Probes start below Limit.
+//
+static
+VOID
+SprayScan(
+    PSPRAY_CONTEXT Context,
+    const UCHAR *Data,
+    const UCHAR *Buffer,
+    ULONG64 Base,
+    ULONG64 End,
+    ULONG64 Limit,
+    vector<SPRAY_RUN>& Runs
+)
+{
+    for (;;)
+    {
+        if (Context->InRun)
+        {
+            ULONG64 i = Context->Next;
+            ULONG Mask = SPRAY_PERIOD_MASK;
+
+            for (; (i + (2 * SPRAY_PERIOD)) <= End; i += SPRAY_PERIOD)
+            {
+                Mask = ComparePeriod(Buffer + (i - Base));
+                if (Mask != SPRAY_PERIOD_MASK) break;
+            }
+
+            if (Mask != SPRAY_PERIOD_MASK)
+            {
+                unsigned long Bit = 0;
+
+                _BitScanForward(&Bit, ~Mask);
+                CloseRun(Context, i + Bit, Runs);
+                continue;
+            }
+
+            while (((i + SPRAY_PERIOD) < End) && (Buffer[i - Base] == Buffer[i - Base + SPRAY_PERIOD])) i += 1;
+
+            if ((i + SPRAY_PERIOD) < End)
+            {
+                CloseRun(Context, i, Runs);
+                continue;
+            }
+
+            Context->Next = i;
+            return;
+        }
+
+        ULONG64 Probe = Context->Next;
+
+        if ((Probe >= Limit) || ((Probe + SPRAY_PROBE_SIZE) > End)) return;
+
+        if ((ComparePeriod(Buffer + (Probe - Base)) & ComparePeriod(Buffer + (Probe - Base) + SPRAY_PERIOD)) != SPRAY_PERIOD_MASK)
+        {
+            Context->Next = Probe + Context->Stride;
+            continue;
+        }
+
+        //
+        // The previous probe missed, or the previous run ended, the run starts after.
+        //
+        ULONG64 Low = max(Context->Floor, Context->Position - Context->HistoryLength);
+        ULONG64 Start = Probe;
+
+        if (Probe > Context->Stride) Low = max(Low, Probe - Context->Stride);
+
+        while ((Start >= SPRAY_PERIOD) && ((Start - SPRAY_PERIOD) >= max(Low, Context->Position)) &&
+               (ComparePeriod(Data + (Start - SPRAY_PERIOD - Context->Position)) == SPRAY_PERIOD_MASK))
+        {
+            Start -= SPRAY_PERIOD;
+        }
+
+        while ((Start > Low) && (GetSprayByte(Context, Data, Start - 1) == GetSprayByte(Context, Data, Start - 1 + SPRAY_PERIOD)))
+        {
+            Start -= 1;
+        }
+
+        OpenRun(Context, Data, Start);
+        Context->Next = Probe + (2 * SPRAY_PERIOD);
+    }
+}
+
+VOID
+SprayInit(
+    PSPRAY_CONTEXT Context,
+    ULONG MinLength
+)
+{
+    RtlZeroMemory(Context, sizeof(SPRAY_CONTEXT));
+
+    Context->MinLength = max(MinLength, (ULONG)SPRAY_MIN_LENGTH);
+    Context->Stride = min(Context->MinLength - SPRAY_PROBE_SIZE, (ULONG)SPRAY_MAX_STRIDE);
+}
+
+VOID
+SprayUpdate(
+    PSPRAY_CONTEXT Context,
+    const UCHAR *Data,
+    ULONG Length,
+    vector<SPRAY_RUN>& Runs
+)
+{
+    ULONG64 Start = Context->Position;
+    ULONG Keep = Context->Stride + SPRAY_PROBE_SIZE + SPRAY_PERIOD;
+
+    if (Length == 0) return;
+
+    //
+    // Probes and runs straddling the previous buffer are checked on a copy of its last
+    // bytes followed by the first ones of Data.
+    //
+    if (Context->HistoryLength)
+    {
+        UCHAR Junction[2 * SPRAY_PROBE_SIZE];
+        ULONG Tail = min(Context->HistoryLength, (ULONG)SPRAY_PROBE_SIZE);
+        ULONG Head = min(Length, (ULONG)SPRAY_PROBE_SIZE);
+
+        memcpy(Junction, Context->History + Context->HistoryLength - Tail, Tail);
+        memcpy(Junction + Tail, Data, Head);
+
+        SprayScan(Context, Data, Junction, Start - Tail, Start + Head, Start, Runs);
+    }
+
+    SprayScan(Context, Data, Data, Start, Start + Length, MAXULONG64, Runs);
+
+    //
+    // Only the bytes a backward extension can reach are kept.
+    //
+    if (Length >= Keep)
+    {
+        memcpy(Context->History, Data + Length - Keep, Keep);
+        Context->HistoryLength = Keep;
+    }
+    else
+    {
+        ULONG Old = min(Context->HistoryLength, Keep - Length);
+
+        memmove(Context->History, Context->History + Context->HistoryLength - Old, Old);
+        memcpy(Context->History + Old, Data, Length);
+        Context->HistoryLength = Old + Length;
+    }
+
+    Context->Position += Length;
+}
+
+VOID
+SprayFinal(
+    PSPRAY_CONTEXT Context,
+    vector<SPRAY_RUN>& Runs
+)
+{
+    if (Context->InRun) CloseRun(Context, max(Context->Position, (ULONG64)SPRAY_PERIOD) - SPRAY_PERIOD, Runs);
+}
@@ -0,0 +1,111 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - Spray.h
+
+Abstract:
+
+    - Streaming detection of long runs of a repeated 1, 2, 4, 8 or 16 byte
+      unit: nop slides, 0x0c0c0c0c sprays, sprayed ROP gadget addresses.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __SPRAY_H__
+#define __SPRAY_H__
+
+//
+// Every supported unit divides SPRAY_PERIOD, a run is a range where each byte equals the
+// byte SPRAY_PERIOD further.
+//
+#define SPRAY_PERIOD 16
+
+//
+// Runs are found from probes SPRAY_PROBE_SIZE bytes long, at most SPRAY_MAX_STRIDE apart,
+// so MinLength is at least SPRAY_MIN_LENGTH.
+//
+#define SPRAY_PROBE_SIZE (3 * SPRAY_PERIOD)
+#define SPRAY_MIN_LENGTH (SPRAY_PROBE_SIZE + SPRAY_PERIOD)
+#define SPRAY_MAX_STRIDE 0x1000
+#define SPRAY_HISTORY_SIZE (SPRAY_MAX_STRIDE + SPRAY_PROBE_SIZE + SPRAY_PERIOD)
+
+typedef struct _SPRAY_RUN {
+    ULONG64 Offset; // In the stream.
+    ULONG64 Length;
+    ULONG Unit; // 1, 2, 4, 8 or 16.
+    UCHAR Pattern[SPRAY_PERIOD]; // Unit bytes.
+} SPRAY_RUN, *PSPRAY_RUN;
+
+typedef struct _SPRAY_CONTEXT {
+    ULONG MinLength;
+    ULONG Stride; // Between two probes.
+    ULONG64 Position; // Bytes seen so far.
+
+    //
+    // Last bytes seen, probes near the start of a buffer look back into them.
+    //
+    UCHAR History[SPRAY_HISTORY_SIZE];
+    ULONG HistoryLength;
+
+    //
+    // Next probe, or next byte to compare when in a run. Runs cannot start before Floor.
+    //
+    ULONG64 Next;
+    ULONG64 Floor;
+    BOOLEAN InRun;
+    SPRAY_RUN Run;
+} SPRAY_CONTEXT, *PSPRAY_CONTEXT;
+
+//
+// Runs shorter than MinLength bytes, or made of zeroes, are not reported.
+//
+VOID
+SprayInit(
+    PSPRAY_CONTEXT Context,
+    ULONG MinLength
+);
+
+//
+// Adds the next Length bytes of the stream, runs that ended are appended to Runs.
+//
+VOID
+SprayUpdate(
+    PSPRAY_CONTEXT Context,
+    const UCHAR *Data,
+    ULONG Length,
+    vector<SPRAY_RUN>& Runs
+);
+
+VOID
+SprayFinal(
+    PSPRAY_CONTEXT Context,
+    vector<SPRAY_RUN>& Runs
+);
+
+#endif
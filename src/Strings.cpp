@@ -0,0 +1,1098 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - Strings.cpp
+
+Abstract:
+
+    - Printable and zero bytes are classified 64 at a time with SSE2, strings
+      are then the runs of printable bytes (ASCII) or of printable bytes each
+      followed by a zero (UTF-16LE), walked a run at a time on the masks.
+    - Index file: header, records, processes, trigram postings (delta coded
+      record offsets) and the directory of the trigrams.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <intrin.h>
+#include <vector>
+#include <string>
+#include <queue>
+#include <algorithm>
+#include <functional>
+using namespace std;
+
+#include "Strings.h"
+
+#define STRINGS_BLOCK_SIZE 64
+
+#define STRINGS_EVEN_BITS 0x5555555555555555ULL
+#define STRINGS_ODD_BITS 0xAAAAAAAAAAAAAAAAULL
+
+static
+BOOLEAN
+IsPrintable(
+    UCHAR Byte
+)
+{
+    return ((Byte >= 0x20) && (Byte < 0x7F)) || (Byte == '\t');
+}
+
+static
+VOID
+ClassifyBlock(
+    const UCHAR *Data,
+    PULONG64 Printable,
+    PULONG64 Zero
+)
+{
+    const __m128i Low = _mm_set1_epi8(0x1F);
+    const __m128i High = _mm_set1_epi8(0x7F);
+    const __m128i Tab = _mm_set1_epi8('\t');
+
+    *Printable = 0;
+    *Zero = 0;
+
+    for (ULONG Offset = 0; Offset < STRINGS_BLOCK_SIZE; Offset += 16)
+    {
+        __m128i b = _mm_loadu_si128((const __m128i *)(Data + Offset));
+
+        //
+        // Signed compares, bytes above 0x7F are negative.
+        //
+        __m128i r = _mm_and_si128(_mm_cmpgt_epi8(b, Low), _mm_cmplt_epi8(b, High));
+        r = _mm_or_si128(r, _mm_cmpeq_epi8(b, Tab));
+
+        *Printable |= (ULONG64)(ULONG)_mm_movemask_epi8(r) << Offset;
+        *Zero |= (ULONG64)(ULONG)_mm_movemask_epi8(_mm_cmpeq_epi8(b, _mm_setzero_si128())) << Offset;
+    }
+}
+
+static
+VOID
+ClassifyBytes(
+    const UCHAR *Data,
+    ULONG Count,
+    PULONG64 Printable,
+    PULONG64 Zero
+)
+{
+    *Printable = 0;
+    *Zero = 0;
+
+    for (ULONG i = 0; i < Count; i += 1)
+    {
+        if (IsPrintable(Data[i])) *Printable |= 1ULL << i;
+        if (Data[i] == 0) *Zero |= 1ULL << i;
+    }
+}
+
+static
+VOID
+AppendRun(
+    PSTRING_RUN Run,
+    const UCHAR *Bytes,
+    ULONG64 Base,
+    ULONG From,
+    ULONG To,
+    BOOLEAN Wide
+)
+{
+    if (!Wide)
+    {
+        ULONG Count = min(To - From, STRINGS_MAX_LENGTH - Run->TextLength);
+
+        memcpy(Run->Text + Run->TextLength, Bytes + From, Count);
+        Run->TextLength += Count;
+        return;
+    }
+
+    //
+    // Low bytes only, at even distances from the start of the run.
+    //
+    if ((Base + From - Run->Start) & 1) From += 1;
+
+    for (ULONG i = From; (i < To) && (Run->TextLength < STRINGS_MAX_LENGTH); i += 2) Run->Text[Run->TextLength++] = Bytes[i];
+}
+
+static
+VOID
+CloseRun(
+    PSTRINGS_CONTEXT Context,
+    PSTRING_RUN Run,
+    ULONG64 End,
+    BOOLEAN Wide,
+    vector<STRING_HIT>& Hits
+)
+{
+    ULONG Length = (ULONG)((End - Run->Start) / (Wide ? 2 : 1));
+
+    if (Length >= Context->MinLength)
+    {
+        STRING_HIT Hit;
+
+        Hit.Offset = Run->Start;
+        Hit.Length = Length;
+        Hit.Wide = Wide;
+        Hit.Text.assign(Run->Text, Run->TextLength);
+
+        Hits.push_back(Hit);
+    }
+
+    Run->InRun = FALSE;
+}
+
+//
+// _BitScanForward64/_BitScanReverse64 only exist on x64, 32-bit builds scan the halves.
+//
+static
+BOOLEAN
+ScanForward64(
+    PULONG Index,
+    ULONG64 Mask
+)
+{
+    unsigned long Bit;
+
+#if defined(_M_X64)
+    if (!_BitScanForward64(&Bit, Mask)) return FALSE;
+#else
+    if (!_BitScanForward(&Bit, (ULONG)Mask))
+    {
+        if (!_BitScanForward(&Bit, (ULONG)(Mask >> 32))) return FALSE;
+        Bit += 32;
+    }
+#endif
+
+    *Index = Bit;
+    return TRUE;
+}
+
+static
+BOOLEAN
+ScanReverse64(
+    PULONG Index,
+    ULONG64 Mask
+)
+{
+    unsigned long Bit;
+
+#if defined(_M_X64)
+    if (!_BitScanReverse64(&Bit, Mask)) return FALSE;
+#else
+    if (_BitScanReverse(&Bit, (ULONG)(Mask >> 32))) Bit += 32;
+    else if (!_BitScanReverse(&Bit, (ULONG)Mask)) return FALSE;
+#endif
+
+    *Index = Bit;
+    return TRUE;
+}
+
+//
+// Clears the runs of Mask shorter than MinBytes that start and end inside of the block,
+// most of them in binary data. Runs at the edges may continue in the next or previous
+// block and are kept.
+//
+static
+ULONG64
+KeepLongRuns(
+    ULONG64 Mask,
+    ULONG Count,
+    ULONG MinBytes,
+    BOOLEAN InRun
+)
+{
+    ULONG64 Top = 1ULL << (Count - 1);
+    ULONG64 Long = Mask, Keep;
+    ULONG Width, Shift, Bit;
+
+    //
+    // Bits starting MinBytes set bits, then the bits they cover.
+    //
+    if (MinBytes > Count) Long = 0;
+
+    for (Width = 1; Long && (Width < MinBytes); Width += Shift)
+    {
+        Shift = min(Width, MinBytes - Width);
+        Long &= Long >> Shift;
+    }
+
+    Keep = Long;
+
+    for (Width = 1; Keep && (Width < MinBytes); Width += Shift)
+    {
+        Shift = min(Width, MinBytes - Width);
+        Keep |= Keep << Shift;
+    }
+
+    if (Mask & Top)
+    {
+        ULONG64 Clear = ~Mask & (Top - 1);
+
+        if (!ScanReverse64(&Bit, Clear)) return Mask;
+
+        Keep |= Mask & (MAXULONG64 << (Bit + 1));
+    }
+
+    if (InRun && (Mask & 1))
+    {
+        ULONG64 Clear = ~Mask & (Top | (Top - 1));
+
+        if (!ScanForward64(&Bit, Clear)) return Mask;
+
+        Keep |= Mask & ((1ULL << Bit) - 1);
+    }
+
+    return Keep & Mask;
+}
+
+//
+// Mask has one bit per byte of the run, Count bytes at Bytes from Context->Position.
+//
+static
+VOID
+WalkRuns(
+    PSTRINGS_CONTEXT Context,
+    PSTRING_RUN Run,
+    ULONG64 Mask,
+    ULONG Count,
+    const UCHAR *Bytes,
+    BOOLEAN Wide,
+    vector<STRING_HIT>& Hits
+)
+{
+    ULONG64 Valid = (Count == STRINGS_BLOCK_SIZE) ? MAXULONG64 : ((1ULL << Count) - 1);
+    ULONG64 Base = Context->Position;
+    ULONG i = 0;
+
+    Mask = KeepLongRuns(Mask & Valid, Count, Context->MinLength * (Wide ? 2 : 1), Run->InRun);
+
+    while (i < Count)
+    {
+        ULONG64 Above = MAXULONG64 << i;
+        ULONG Bit;
+
+        if (Run->InRun)
+        {
+            ULONG64 Ends = ~Mask & Valid & Above;
+
+            if (Ends == 0)
+            {
+                AppendRun(Run, Bytes, Base, i, Count, Wide);
+                break;
+            }
+
+            ScanForward64(&Bit, Ends);
+
+            AppendRun(Run, Bytes, Base, i, Bit, Wide);
+            CloseRun(Context, Run, Base + Bit, Wide, Hits);
+            i = Bit;
+        }
+        else
+        {
+            ULONG64 Starts = Mask & Valid & Above;
+
+            if (Starts == 0) break;
+
+            ScanForward64(&Bit, Starts);
+
+            Run->InRun = TRUE;
+            Run->Start = Base + Bit;
+            Run->TextLength = 0;
+            i = Bit;
+        }
+    }
+}
+
+//
+// Count bytes at Bytes, NextZero tells if the byte after them is zero.
+//
+static
+VOID
+ProcessBlock(
+    PSTRINGS_CONTEXT Context,
+    const UCHAR *Bytes,
+    ULONG Count,
+    ULONG64 Printable,
+    ULONG64 Zero,
+    BOOLEAN NextZero,
+    vector<STRING_HIT>& Hits
+)
+{
+    ULONG64 Valid = (Count == STRINGS_BLOCK_SIZE) ? MAXULONG64 : ((1ULL << Count) - 1);
+    ULONG64 Characters;
+
+    Printable &= Valid;
+    Zero &= Valid;
+
+    //
+    // Printable bytes followed by a zero, UTF-16LE characters.
+    //
+    Characters = Printable & ((Zero >> 1) | ((ULONG64)(NextZero ? 1 : 0) << (Count - 1)));
+
+    WalkRuns(Context, &Context->Ascii, Printable, Count, Bytes, FALSE, Hits);
+
+    for (ULONG Parity = 0; Parity < 2; Parity += 1)
+    {
+        ULONG64 Starts = Characters & (((Context->Position + Parity) & 1) ? STRINGS_ODD_BITS : STRINGS_EVEN_BITS);
+        ULONG64 Mask = (Starts | (Starts << 1) | (Context->WideCarry[Parity] ? 1 : 0)) & Valid;
+
+        Context->WideCarry[Parity] = ((Starts >> (Count - 1)) & 1) ? TRUE : FALSE;
+
+        WalkRuns(Context, &Context->Wide[Parity], Mask, Count, Bytes, TRUE, Hits);
+    }
+
+    Context->Position += Count;
+}
+
+VOID
+StringsInit(
+    PSTRINGS_CONTEXT Context,
+    ULONG MinLength
+)
+{
+    RtlZeroMemory(Context, sizeof(STRINGS_CONTEXT));
+
+    Context->MinLength = MinLength ? MinLength : 1;
+}
+
+VOID
+StringsUpdate(
+    PSTRINGS_CONTEXT Context,
+    const UCHAR *Data,
+    ULONG Length,
+    vector<STRING_HIT>& Hits
+)
+{
+    ULONG64 Printable, Zero;
+    ULONG i = 0;
+
+    if (Length == 0) return;
+
+    if (Context->HasHeld)
+    {
+        ClassifyBytes(&Context->Held, 1, &Printable, &Zero);
+        ProcessBlock(Context, &Context->Held, 1, Printable, Zero, Data[0] == 0, Hits);
+    }
+
+    for (; (i + STRINGS_BLOCK_SIZE) < Length; i += STRINGS_BLOCK_SIZE)
+    {
+        ClassifyBlock(Data + i, &Printable, &Zero);
+        ProcessBlock(Context, Data + i, STRINGS_BLOCK_SIZE, Printable, Zero, Data[i + STRINGS_BLOCK_SIZE] == 0, Hits);
+    }
+
+    if ((i + 1) < Length)
+    {
+        ClassifyBytes(Data + i, Length - 1 - i, &Printable, &Zero);
+        ProcessBlock(Context, Data + i, Length - 1 - i, Printable, Zero, Data[Length - 1] == 0, Hits);
+    }
+
+    Context->Held = Data[Length - 1];
+    Context->HasHeld = TRUE;
+}
+
+VOID
+StringsFinal(
+    PSTRINGS_CONTEXT Context,
+    vector<STRING_HIT>& Hits
+)
+{
+    if (Context->HasHeld)
+    {
+        ULONG64 Printable, Zero;
+
+        ClassifyBytes(&Context->Held, 1, &Printable, &Zero);
+        ProcessBlock(Context, &Context->Held, 1, Printable, Zero, FALSE, Hits);
+        Context->HasHeld = FALSE;
+    }
+
+    if (Context->Ascii.InRun) CloseRun(Context, &Context->Ascii, Context->Position, FALSE, Hits);
+
+    for (ULONG Parity = 0; Parity < 2; Parity += 1)
+    {
+        if (Context->Wide[Parity].InRun) CloseRun(Context, &Context->Wide[Parity], Context->Position, TRUE, Hits);
+    }
+}
+
+BOOLEAN
+GetStrings(
+    ULONG64 Length,
+    PSTRINGS_READER Reader,
+    PVOID ReaderContext,
+    ULONG MinLength,
+    vector<STRING_HIT>& Hits
+)
+{
+    STRINGS_CONTEXT Context;
+    LPBYTE Buffer = NULL;
+    BOOLEAN Readable = FALSE;
+
+    if (Length == 0) return FALSE;
+
+    Buffer = (LPBYTE)malloc((size_t)min(Length, (ULONG64)STRINGS_CHUNK_SIZE));
+    if (Buffer == NULL) return FALSE;
+
+    StringsInit(&Context, MinLength);
+
+    for (ULONG64 Offset = 0; Offset < Length; Offset += STRINGS_CHUNK_SIZE)
+    {
+        ULONG Size = (ULONG)min(Length - Offset, (ULONG64)STRINGS_CHUNK_SIZE);
+
+        if (Reader(ReaderContext, Offset, Buffer, Size)) Readable = TRUE;
+        else RtlZeroMemory(Buffer, Size);
+
+        StringsUpdate(&Context, Buffer, Size, Hits);
+    }
+
+    StringsFinal(&Context, Hits);
+
+    free(Buffer);
+
+    return Readable;
+}
+
+#define STRING_INDEX_SIGNATURE 0x4953534D // MSSI
+#define STRING_INDEX_VERSION 1
+
+//
+// Header, in ULONG64 fields.
+//
+#define STRING_INDEX_HEADER_SIGNATURE 0
+#define STRING_INDEX_HEADER_STRINGS 1
+#define STRING_INDEX_HEADER_RECORDS 2
+#define STRING_INDEX_HEADER_RECORDS_SIZE 3
+#define STRING_INDEX_HEADER_PROCESSES 4
+#define STRING_INDEX_HEADER_PROCESSES_COUNT 5
+#define STRING_INDEX_HEADER_POSTINGS 6
+#define STRING_INDEX_HEADER_POSTINGS_SIZE 7
+#define STRING_INDEX_HEADER_DIRECTORY 8
+#define STRING_INDEX_HEADER_DIRECTORY_COUNT 9
+#define STRING_INDEX_HEADER_FIELDS 10
+
+//
+// Record: process, VAD base (low, high), offset, length (wide in the top bit), text length,
+// then the text.
+//
+#define STRING_RECORD_FIELDS 6
+#define STRING_RECORD_WIDE 0x80000000
+
+static
+ULONG
+GetGram(
+    const CHAR *Text
+)
+{
+    return ((ULONG)(UCHAR)tolower((UCHAR)Text[0]) << 16) |
+           ((ULONG)(UCHAR)tolower((UCHAR)Text[1]) << 8) |
+           (ULONG)(UCHAR)tolower((UCHAR)Text[2]);
+}
+
+static
+VOID
+GetRunName(
+    const string& FileName,
+    ULONG Run,
+    LPSTR Name,
+    ULONG NameSize
+)
+{
+    sprintf_s(Name, NameSize, "%s.%d.tmp", FileName.c_str(), Run);
+}
+
+static
+VOID
+PutVarint(
+    vector<UCHAR>& Buffer,
+    ULONG64 Value
+)
+{
+    while (Value >= 0x80)
+    {
+        Buffer.push_back((UCHAR)(Value | 0x80));
+        Value >>= 7;
+    }
+
+    Buffer.push_back((UCHAR)Value);
+}
+
+StringIndex::StringIndex(
+)
+{
+    m_File = NULL;
+    m_Writing = FALSE;
+
+    Reset();
+}
+
+StringIndex::~StringIndex(
+)
+{
+    Reset();
+}
+
+VOID
+StringIndex::Reset(
+)
+{
+    if (m_File) fclose(m_File);
+    m_File = NULL;
+
+    //
+    // An index that was not closed is left without its runs.
+    //
+    for (ULONG i = 0; m_Writing && (i < m_NumberOfRuns); i += 1)
+    {
+        CHAR Name[MAX_PATH];
+
+        GetRunName(m_FileName, i, Name, sizeof(Name));
+        remove(Name);
+    }
+
+    m_Writing = FALSE;
+    m_FileName.clear();
+    m_Processes.clear();
+    m_NumberOfStrings = 0;
+    m_RecordsOffset = 0;
+    m_RecordsSize = 0;
+    m_PostingsOffset = 0;
+    m_PostingsSize = 0;
+    m_Pending.clear();
+    m_NumberOfRuns = 0;
+    m_Directory.clear();
+}
+
+BOOLEAN
+StringIndex::Create(
+    LPCSTR FileName
+)
+{
+    ULONG64 Header[STRING_INDEX_HEADER_FIELDS] = { 0 };
+
+    Reset();
+
+    if (fopen_s(&m_File, FileName, "wb+") || (m_File == NULL))
+    {
+        m_File = NULL;
+        return FALSE;
+    }
+
+    m_FileName = FileName;
+    m_Writing = TRUE;
+
+    //
+    // Written for real by Close().
+    //
+    if (fwrite(Header, sizeof(Header), 1, m_File) != 1)
+    {
+        Reset();
+        return FALSE;
+    }
+
+    m_RecordsOffset = sizeof(Header);
+
+    return TRUE;
+}
+
+ULONG
+StringIndex::AddProcess(
+    ULONG64 ProcessId,
+    ULONG64 ProcessObject,
+    LPCSTR ImageFileName
+)
+{
+    INDEX_PROCESS Process = { 0 };
+
+    Process.ProcessId = ProcessId;
+    Process.ProcessObject = ProcessObject;
+    strncpy_s(Process.ImageFileName, sizeof(Process.ImageFileName), ImageFileName, _TRUNCATE);
+
+    m_Processes.push_back(Process);
+
+    return (ULONG)(m_Processes.size() - 1);
+}
+
+BOOLEAN
+StringIndex::Add(
+    ULONG Process,
+    ULONG64 VadBase,
+    const vector<STRING_HIT>& Hits
+)
+{
+    vector<ULONG> Grams;
+
+    if (!m_Writing) return FALSE;
+
+    for (const STRING_HIT& Hit : Hits)
+    {
+        ULONG Fields[STRING_RECORD_FIELDS];
+        ULONG TextLength = (ULONG)min(Hit.Text.size(), (size_t)STRINGS_MAX_LENGTH);
+
+        Fields[0] = Process;
+        Fields[1] = (ULONG)VadBase;
+        Fields[2] = (ULONG)(VadBase >> 32);
+        Fields[3] = (ULONG)Hit.Offset;
+        Fields[4] = Hit.Length | (Hit.Wide ? STRING_RECORD_WIDE : 0);
+        Fields[5] = TextLength;
+
+        if (fwrite(Fields, sizeof(Fields), 1, m_File) != 1) return FALSE;
+        if (fwrite(Hit.Text.data(), 1, TextLength, m_File) != TextLength) return FALSE;
+
+        Grams.clear();
+        for (ULONG i = 0; (i + 3) <= TextLength; i += 1) Grams.push_back(GetGram(Hit.Text.data() + i));
+
+        sort(Grams.begin(), Grams.end());
+        Grams.erase(unique(Grams.begin(), Grams.end()), Grams.end());
+
+        for (ULONG Gram : Grams)
+        {
+            GRAM_ENTRY Entry;
+
+            Entry.Record = m_RecordsSize;
+            Entry.Gram = Gram;
+            m_Pending.push_back(Entry);
+        }
+
+        m_RecordsSize += sizeof(Fields) + TextLength;
+        m_NumberOfStrings += 1;
+
+        if ((m_Pending.size() >= STRING_INDEX_RUN_ENTRIES) && !FlushRun()) return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+StringIndex::FlushRun(
+)
+{
+    CHAR Name[MAX_PATH];
+    FILE *Run = NULL;
+    BOOLEAN Result = FALSE;
+
+    sort(m_Pending.begin(), m_Pending.end(), [](const GRAM_ENTRY& a, const GRAM_ENTRY& b)
+    {
+        return (a.Gram != b.Gram) ? (a.Gram < b.Gram) : (a.Record < b.Record);
+    });
+
+    GetRunName(m_FileName, m_NumberOfRuns, Name, sizeof(Name));
+
+    if (fopen_s(&Run, Name, "wb") || (Run == NULL)) return FALSE;
+
+    m_NumberOfRuns += 1;
+
+    if (fwrite(m_Pending.data(), sizeof(GRAM_ENTRY), m_Pending.size(), Run) != m_Pending.size()) goto CleanUp;
+
+    m_Pending.clear();
+    Result = TRUE;
+
+CleanUp:
+    fclose(Run);
+
+    return Result;
+}
+
+BOOLEAN
+StringIndex::MergeRuns(
+)
+{
+    typedef struct _RUN_READER {
+        FILE *File;
+        vector<GRAM_ENTRY> Entries;
+        ULONG Next;
+    } RUN_READER, *PRUN_READER;
+
+    typedef pair<pair<ULONG, ULONG64>, ULONG> HEAP_ENTRY; // ((gram, record), run)
+
+    vector<RUN_READER> Runs(m_NumberOfRuns);
+    priority_queue<HEAP_ENTRY, vector<HEAP_ENTRY>, greater<HEAP_ENTRY>> Heap;
+    vector<UCHAR> Output;
+    ULONG64 Previous = 0;
+    BOOLEAN Result = FALSE;
+
+    //
+    // Refills the buffer of a run, FALSE once it is exhausted.
+    //
+    auto Fill = [](PRUN_READER Reader) -> BOOLEAN
+    {
+        Reader->Entries.resize(STRING_INDEX_MERGE_ENTRIES);
+        Reader->Entries.resize(fread(Reader->Entries.data(), sizeof(GRAM_ENTRY), STRING_INDEX_MERGE_ENTRIES, Reader->File));
+        Reader->Next = 0;
+
+        return Reader->Entries.size() ? TRUE : FALSE;
+    };
+
+    for (ULONG i = 0; i < m_NumberOfRuns; i += 1)
+    {
+        CHAR Name[MAX_PATH];
+
+        GetRunName(m_FileName, i, Name, sizeof(Name));
+
+        if (fopen_s(&Runs[i].File, Name, "rb") || (Runs[i].File == NULL))
+        {
+            Runs[i].File = NULL;
+            goto CleanUp;
+        }
+
+        if (Fill(&Runs[i])) Heap.push(HEAP_ENTRY(make_pair(Runs[i].Entries[0].Gram, Runs[i].Entries[0].Record), i));
+    }
+
+    m_PostingsSize = 0;
+
+    while (!Heap.empty())
+    {
+        HEAP_ENTRY Top = Heap.top();
+        PRUN_READER Reader = &Runs[Top.second];
+
+        Heap.pop();
+
+        if (m_Directory.empty() || (m_Directory.back().Gram != Top.first.first))
+        {
+            GRAM_DIRECTORY_ENTRY Entry;
+
+            Entry.Gram = Top.first.first;
+            Entry.Count = 0;
+            Entry.Offset = m_PostingsSize + Output.size();
+            m_Directory.push_back(Entry);
+
+            Previous = 0;
+        }
+
+        PutVarint(Output, Top.first.second - Previous);
+        Previous = Top.first.second;
+        m_Directory.back().Count += 1;
+
+        //
+        // The next entry of the same run takes its place.
+        //
+        Reader->Next += 1;
+
+        if ((Reader->Next < Reader->Entries.size()) || Fill(Reader))
+        {
+            PGRAM_ENTRY Next = &Reader->Entries[Reader->Next];
+
+            Heap.push(HEAP_ENTRY(make_pair(Next->Gram, Next->Record), Top.second));
+        }
+
+        if (Output.size() >= (1024 * 1024))
+        {
+            if (fwrite(Output.data(), 1, Output.size(), m_File) != Output.size()) goto CleanUp;
+            m_PostingsSize += Output.size();
+            Output.clear();
+        }
+    }
+
+    if (Output.size() && (fwrite(Output.data(), 1, Output.size(), m_File) != Output.size())) goto CleanUp;
+    m_PostingsSize += Output.size();
+
+    Result = TRUE;
+
+CleanUp:
+    for (RUN_READER& Reader : Runs) if (Reader.File) fclose(Reader.File);
+
+    return Result;
+}
+
+BOOLEAN
+StringIndex::Close(
+)
+{
+    ULONG64 Header[STRING_INDEX_HEADER_FIELDS] = { 0 };
+    ULONG NumberOfRuns;
+    BOOLEAN Result = FALSE;
+
+    if (!m_Writing) return FALSE;
+
+    Header[STRING_INDEX_HEADER_SIGNATURE] = STRING_INDEX_SIGNATURE | ((ULONG64)STRING_INDEX_VERSION << 32);
+    Header[STRING_INDEX_HEADER_STRINGS] = m_NumberOfStrings;
+    Header[STRING_INDEX_HEADER_RECORDS] = m_RecordsOffset;
+    Header[STRING_INDEX_HEADER_RECORDS_SIZE] = m_RecordsSize;
+
+    Header[STRING_INDEX_HEADER_PROCESSES] = m_RecordsOffset + m_RecordsSize;
+    Header[STRING_INDEX_HEADER_PROCESSES_COUNT] = m_Processes.size();
+
+    if (m_Processes.size() &&
+        (fwrite(m_Processes.data(), sizeof(INDEX_PROCESS), m_Processes.size(), m_File) != m_Processes.size())) goto CleanUp;
+
+    if (m_Pending.size() && !FlushRun()) goto CleanUp;
+
+    m_PostingsOffset = Header[STRING_INDEX_HEADER_PROCESSES] + (m_Processes.size() * sizeof(INDEX_PROCESS));
+    if (!MergeRuns()) goto CleanUp;
+
+    Header[STRING_INDEX_HEADER_POSTINGS] = m_PostingsOffset;
+    Header[STRING_INDEX_HEADER_POSTINGS_SIZE] = m_PostingsSize;
+    Header[STRING_INDEX_HEADER_DIRECTORY] = m_PostingsOffset + m_PostingsSize;
+    Header[STRING_INDEX_HEADER_DIRECTORY_COUNT] = m_Directory.size();
+
+    if (m_Directory.size() &&
+        (fwrite(m_Directory.data(), sizeof(GRAM_DIRECTORY_ENTRY), m_Directory.size(), m_File) != m_Directory.size())) goto CleanUp;
+
+    if (_fseeki64(m_File, 0, SEEK_SET) || (fwrite(Header, sizeof(Header), 1, m_File) != 1)) goto CleanUp;
+
+    Result = TRUE;
+
+CleanUp:
+    //
+    // Runs are not needed anymore, the index is removed if it could not be completed.
+    //
+    NumberOfRuns = m_NumberOfRuns;
+    fclose(m_File);
+    m_File = NULL;
+
+    for (ULONG i = 0; i < NumberOfRuns; i += 1)
+    {
+        CHAR Name[MAX_PATH];
+
+        GetRunName(m_FileName, i, Name, sizeof(Name));
+        remove(Name);
+    }
+
+    if (!Result) remove(m_FileName.c_str());
+
+    m_NumberOfRuns = 0;
+    m_Writing = FALSE;
+    m_Pending.clear();
+    m_Pending.shrink_to_fit();
+
+    return Result;
+}
+
+BOOLEAN
+StringIndex::Open(
+    LPCSTR FileName
+)
+{
+    ULONG64 Header[STRING_INDEX_HEADER_FIELDS];
+    ULONG64 FileSize;
+
+    Reset();
+
+    if (fopen_s(&m_File, FileName, "rb") || (m_File == NULL))
+    {
+        m_File = NULL;
+        return FALSE;
+    }
+
+    m_FileName = FileName;
+
+    if (_fseeki64(m_File, 0, SEEK_END)) goto Failed;
+    FileSize = _ftelli64(m_File);
+    if (_fseeki64(m_File, 0, SEEK_SET)) goto Failed;
+
+    if (fread(Header, sizeof(Header), 1, m_File) != 1) goto Failed;
+    if (Header[STRING_INDEX_HEADER_SIGNATURE] != (STRING_INDEX_SIGNATURE | ((ULONG64)STRING_INDEX_VERSION << 32))) goto Failed;
+
+    //
+    // Sections follow each other up to the end of the file.
+    //
+    if ((Header[STRING_INDEX_HEADER_RECORDS] + Header[STRING_INDEX_HEADER_RECORDS_SIZE]) != Header[STRING_INDEX_HEADER_PROCESSES]) goto Failed;
+    if ((Header[STRING_INDEX_HEADER_PROCESSES] + (Header[STRING_INDEX_HEADER_PROCESSES_COUNT] * sizeof(INDEX_PROCESS))) !=
+        Header[STRING_INDEX_HEADER_POSTINGS]) goto Failed;
+    if ((Header[STRING_INDEX_HEADER_POSTINGS] + Header[STRING_INDEX_HEADER_POSTINGS_SIZE]) != Header[STRING_INDEX_HEADER_DIRECTORY]) goto Failed;
+    if ((Header[STRING_INDEX_HEADER_DIRECTORY] + (Header[STRING_INDEX_HEADER_DIRECTORY_COUNT] * sizeof(GRAM_DIRECTORY_ENTRY))) != FileSize) goto Failed;
+
+    m_NumberOfStrings = Header[STRING_INDEX_HEADER_STRINGS];
+    m_RecordsOffset = Header[STRING_INDEX_HEADER_RECORDS];
+    m_RecordsSize = Header[STRING_INDEX_HEADER_RECORDS_SIZE];
+    m_PostingsOffset = Header[STRING_INDEX_HEADER_POSTINGS];
+    m_PostingsSize = Header[STRING_INDEX_HEADER_POSTINGS_SIZE];
+
+    m_Processes.resize((size_t)Header[STRING_INDEX_HEADER_PROCESSES_COUNT]);
+    if (_fseeki64(m_File, Header[STRING_INDEX_HEADER_PROCESSES], SEEK_SET)) goto Failed;
+    if (m_Processes.size() && (fread(m_Processes.data(), sizeof(INDEX_PROCESS), m_Processes.size(), m_File) != m_Processes.size())) goto Failed;
+
+    m_Directory.resize((size_t)Header[STRING_INDEX_HEADER_DIRECTORY_COUNT]);
+    if (_fseeki64(m_File, Header[STRING_INDEX_HEADER_DIRECTORY], SEEK_SET)) goto Failed;
+    if (m_Directory.size() && (fread(m_Directory.data(), sizeof(GRAM_DIRECTORY_ENTRY), m_Directory.size(), m_File) != m_Directory.size())) goto Failed;
+
+    for (ULONG i = 0; i < m_Directory.size(); i += 1)
+    {
+        if (m_Directory[i].Offset > m_PostingsSize) goto Failed;
+        if (i && (m_Directory[i].Gram <= m_Directory[i - 1].Gram)) goto Failed;
+        if (i && (m_Directory[i].Offset < m_Directory[i - 1].Offset)) goto Failed;
+    }
+
+    return TRUE;
+
+Failed:
+    Reset();
+
+    return FALSE;
+}
+
+BOOLEAN
+StringIndex::ReadPostings(
+    PGRAM_DIRECTORY_ENTRY Entry,
+    vector<ULONG64>& Records
+)
+{
+    ULONG64 End = ((Entry + 1) < (m_Directory.data() + m_Directory.size())) ? Entry[1].Offset : m_PostingsSize;
+    vector<UCHAR> Buffer((size_t)(End - Entry->Offset));
+    ULONG64 Record = 0;
+    ULONG i = 0;
+
+    Records.clear();
+
+    if (_fseeki64(m_File, m_PostingsOffset + Entry->Offset, SEEK_SET)) return FALSE;
+    if (Buffer.size() && (fread(Buffer.data(), 1, Buffer.size(), m_File) != Buffer.size())) return FALSE;
+
+    while ((i < Buffer.size()) && (Records.size() < Entry->Count))
+    {
+        ULONG64 Delta = 0;
+
+        for (ULONG Shift = 0; i < Buffer.size(); Shift += 7)
+        {
+            UCHAR Byte = Buffer[i++];
+
+            Delta |= (ULONG64)(Byte & 0x7F) << Shift;
+            if (!(Byte & 0x80) || (Shift >= 63)) break;
+        }
+
+        Record += Delta;
+        Records.push_back(Record);
+    }
+
+    return (Records.size() == Entry->Count) ? TRUE : FALSE;
+}
+
+BOOLEAN
+StringIndex::ReadRecord(
+    ULONG64 Record,
+    PINDEX_RESULT Result
+)
+{
+    ULONG Fields[STRING_RECORD_FIELDS];
+    CHAR Text[STRINGS_MAX_LENGTH];
+
+    if ((Record + sizeof(Fields)) > m_RecordsSize) return FALSE;
+
+    if (_fseeki64(m_File, m_RecordsOffset + Record, SEEK_SET)) return FALSE;
+    if (fread(Fields, sizeof(Fields), 1, m_File) != 1) return FALSE;
+
+    if ((Fields[0] >= m_Processes.size()) || (Fields[5] > STRINGS_MAX_LENGTH)) return FALSE;
+    if (fread(Text, 1, Fields[5], m_File) != Fields[5]) return FALSE;
+
+    Result->Process = Fields[0];
+    Result->VadBase = Fields[1] | ((ULONG64)Fields[2] << 32);
+    Result->Offset = Fields[3];
+    Result->Length = Fields[4] & ~STRING_RECORD_WIDE;
+    Result->Wide = (Fields[4] & STRING_RECORD_WIDE) ? TRUE : FALSE;
+    Result->Text.assign(Text, Fields[5]);
+
+    return TRUE;
+}
+
+BOOLEAN
+StringIndex::Find(
+    LPCSTR Text,
+    ULONG MaxResults,
+    vector<INDEX_RESULT>& Results
+)
+{
+    string Query(Text);
+    vector<ULONG64> Candidates, Records, Common;
+    vector<PGRAM_DIRECTORY_ENTRY> Entries;
+    INDEX_RESULT Result;
+
+    Results.clear();
+
+    if ((m_File == NULL) || m_Writing || Query.empty()) return FALSE;
+
+    transform(Query.begin(), Query.end(), Query.begin(), [](CHAR c) { return (CHAR)tolower((UCHAR)c); });
+
+    auto Matches = [&Query](INDEX_RESULT& Result) -> BOOLEAN
+    {
+        string Lower(Result.Text);
+
+        transform(Lower.begin(), Lower.end(), Lower.begin(), [](CHAR c) { return (CHAR)tolower((UCHAR)c); });
+
+        return (Lower.find(Query) != string::npos) ? TRUE : FALSE;
+    };
+
+    if (Query.size() < 3)
+    {
+        for (ULONG64 Record = 0; (Record < m_RecordsSize) && (Results.size() < MaxResults);
+             Record += (STRING_RECORD_FIELDS * sizeof(ULONG)) + Result.Text.size())
+        {
+            if (!ReadRecord(Record, &Result)) return FALSE;
+            if (Matches(Result)) Results.push_back(Result);
+        }
+
+        return TRUE;
+    }
+
+    for (ULONG i = 0; (i + 3) <= Query.size(); i += 1)
+    {
+        GRAM_DIRECTORY_ENTRY Key;
+        vector<GRAM_DIRECTORY_ENTRY>::iterator Entry;
+
+        Key.Gram = GetGram(Query.data() + i);
+
+        Entry = lower_bound(m_Directory.begin(), m_Directory.end(), Key,
+                            [](const GRAM_DIRECTORY_ENTRY& a, const GRAM_DIRECTORY_ENTRY& b) { return a.Gram < b.Gram; });
+
+        //
+        // A trigram found nowhere, neither is the query.
+        //
+        if ((Entry == m_Directory.end()) || (Entry->Gram != Key.Gram)) return TRUE;
+
+        Entries.push_back(&*Entry);
+    }
+
+    sort(Entries.begin(), Entries.end());
+    Entries.erase(unique(Entries.begin(), Entries.end()), Entries.end());
+    sort(Entries.begin(), Entries.end(), [](PGRAM_DIRECTORY_ENTRY a, PGRAM_DIRECTORY_ENTRY b) { return a->Count < b->Count; });
+
+    //
+    // Rarest trigrams first, every candidate is checked on its text in the end.
+    //
+    for (ULONG i = 0; i < Entries.size(); i += 1)
+    {
+        if (i && (Candidates.size() <= STRING_INDEX_MIN_CANDIDATES)) break;
+
+        if (!ReadPostings(Entries[i], i ? Records : Candidates)) return FALSE;
+        if (i == 0) continue;
+
+        Common.clear();
+        set_intersection(Candidates.begin(), Candidates.end(), Records.begin(), Records.end(), back_inserter(Common));
+        Candidates.swap(Common);
+    }
+
+    for (ULONG i = 0; (i < Candidates.size()) && (Results.size() < MaxResults); i += 1)
+    {
+        if (!ReadRecord(Candidates[i], &Result)) return FALSE;
+        if (Matches(Result)) Results.push_back(Result);
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,261 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - Strings.h
+
+Abstract:
+
+    - Streaming ASCII and UTF-16LE string extraction.
+    - StringIndex, on-disk index of the strings of process memory searched
+      by substring through a trigram index.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __STRINGS_H__
+#define __STRINGS_H__
+
+#define STRINGS_MIN_LENGTH 5
+#define STRINGS_MAX_LENGTH 512 // Characters kept per string, longer ones are truncated.
+
+typedef struct _STRING_HIT {
+    ULONG64 Offset; // In the stream.
+    ULONG Length; // In characters, before truncation.
+    BOOLEAN Wide;
+    string Text;
+} STRING_HIT, *PSTRING_HIT;
+
+typedef struct _STRING_RUN {
+    BOOLEAN InRun;
+    ULONG64 Start;
+    ULONG TextLength;
+    CHAR Text[STRINGS_MAX_LENGTH];
+} STRING_RUN, *PSTRING_RUN;
+
+typedef struct _STRINGS_CONTEXT {
+    ULONG MinLength;
+    ULONG64 Position; // Bytes classified so far.
+
+    //
+    // The last byte of a buffer is classified with the first one of the next buffer, a
+    // UTF-16LE character needs its high byte.
+    //
+    UCHAR Held;
+    BOOLEAN HasHeld;
+
+    STRING_RUN Ascii;
+    STRING_RUN Wide[2]; // Starting at even and odd offsets.
+    BOOLEAN WideCarry[2]; // High byte of the last character still to come.
+} STRINGS_CONTEXT, *PSTRINGS_CONTEXT;
+
+VOID
+StringsInit(
+    PSTRINGS_CONTEXT Context,
+    ULONG MinLength
+);
+
+//
+// Adds the next Length bytes of the stream, strings that ended are appended to Hits.
+//
+VOID
+StringsUpdate(
+    PSTRINGS_CONTEXT Context,
+    const UCHAR *Data,
+    ULONG Length,
+    vector<STRING_HIT>& Hits
+);
+
+VOID
+StringsFinal(
+    PSTRINGS_CONTEXT Context,
+    vector<STRING_HIT>& Hits
+);
+
+#define STRINGS_CHUNK_SIZE (1024 * 1024) // Read at once by GetStrings().
+
+//
+// Same as PMALSCORE_READER, unreadable bytes are returned as zeroes.
+//
+typedef BOOLEAN (*PSTRINGS_READER)(PVOID Context, ULONG64 Offset, LPBYTE Buffer, ULONG Length);
+
+//
+// Extracts the strings of Length bytes read a chunk at a time, in one pass. FALSE if
+// nothing could be read.
+//
+BOOLEAN
+GetStrings(
+    ULONG64 Length,
+    PSTRINGS_READER Reader,
+    PVOID ReaderContext,
+    ULONG MinLength,
+    vector<STRING_HIT>& Hits
+);
+
+//
+// Trigram postings are sorted in runs of STRING_INDEX_RUN_ENTRIES in memory, spilled to
+// temporary files, then merged. Memory stays bounded whatever the size of the input.
+// The tests also build with small runs, to merge many of them.
+//
+#ifndef STRING_INDEX_RUN_ENTRIES
+#define STRING_INDEX_RUN_ENTRIES (4 * 1024 * 1024)
+#endif
+
+#ifndef STRING_INDEX_MERGE_ENTRIES
+#define STRING_INDEX_MERGE_ENTRIES 4096 // Read at once from each run while merging.
+#endif
+
+//
+// Queries stop narrowing candidates down once they are that few, they are checked anyway.
+//
+#define STRING_INDEX_MIN_CANDIDATES 64
+
+#define STRINGS_MAX_RESULTS 100 // Default of !ms_strings /find.
+
+class StringIndex {
+public:
+    typedef struct _INDEX_PROCESS {
+        ULONG64 ProcessId;
+        ULONG64 ProcessObject;
+        CHAR ImageFileName[16];
+    } INDEX_PROCESS, *PINDEX_PROCESS;
+
+    typedef struct _INDEX_RESULT {
+        ULONG Process; // In m_Processes.
+        ULONG64 VadBase;
+        ULONG Offset;
+        ULONG Length;
+        BOOLEAN Wide;
+        string Text;
+    } INDEX_RESULT, *PINDEX_RESULT;
+
+    StringIndex(
+    );
+
+    ~StringIndex(
+    );
+
+    BOOLEAN
+    Create(
+        LPCSTR FileName
+    );
+
+    //
+    // Returns the index of the process, to be passed to Add().
+    //
+    ULONG
+    AddProcess(
+        ULONG64 ProcessId,
+        ULONG64 ProcessObject,
+        LPCSTR ImageFileName
+    );
+
+    BOOLEAN
+    Add(
+        ULONG Process,
+        ULONG64 VadBase,
+        const vector<STRING_HIT>& Hits
+    );
+
+    //
+    // Merges the postings and writes the directory, the index can then be opened.
+    //
+    BOOLEAN
+    Close(
+    );
+
+    BOOLEAN
+    Open(
+        LPCSTR FileName
+    );
+
+    //
+    // Case insensitive. Queries shorter than a trigram scan every string.
+    //
+    BOOLEAN
+    Find(
+        LPCSTR Text,
+        ULONG MaxResults,
+        vector<INDEX_RESULT>& Results
+    );
+
+    vector<INDEX_PROCESS> m_Processes;
+    ULONG64 m_NumberOfStrings;
+
+private:
+    typedef struct _GRAM_ENTRY {
+        ULONG64 Record; // Offset in the records.
+        ULONG Gram;
+    } GRAM_ENTRY, *PGRAM_ENTRY;
+
+    typedef struct _GRAM_DIRECTORY_ENTRY {
+        ULONG Gram;
+        ULONG Count;
+        ULONG64 Offset; // In the postings.
+    } GRAM_DIRECTORY_ENTRY, *PGRAM_DIRECTORY_ENTRY;
+
+    BOOLEAN
+    FlushRun(
+    );
+
+    BOOLEAN
+    MergeRuns(
+    );
+
+    BOOLEAN
+    ReadPostings(
+        PGRAM_DIRECTORY_ENTRY Entry,
+        vector<ULONG64>& Records
+    );
+
+    BOOLEAN
+    ReadRecord(
+        ULONG64 Record,
+        PINDEX_RESULT Result
+    );
+
+    VOID
+    Reset(
+    );
+
+    FILE *m_File;
+    string m_FileName;
+    BOOLEAN m_Writing;
+
+    ULONG64 m_RecordsOffset;
+    ULONG64 m_RecordsSize;
+    ULONG64 m_PostingsOffset;
+    ULONG64 m_PostingsSize;
+
+    vector<GRAM_ENTRY> m_Pending;
+    ULONG m_NumberOfRuns;
+
+    vector<GRAM_DIRECTORY_ENTRY> m_Directory; // Sorted by gram.
+};
+
+#endif
@@ -0,0 +1,218 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - SymbolCache.cpp
+
+Abstract:
+
+    - Direct-mapped cache of resolved (and unresolved) symbol names.
+    - Standard C++ only, the debugger engine is reached through the resolver
+      callback given to the constructor (test/SymbolCacheTest.cpp uses a fake).
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "SymbolCache.h"
+
+SymbolCache::SymbolCache(
+    PSYMBOL_RESOLVER Resolver,
+    void *Context
+) :
+    m_Resolver(Resolver),
+    m_Context(Context)
+{
+    ResetStats();
+}
+
+SymbolCache::PSYMBOL_CACHE_ENTRY
+SymbolCache::GetSlot(
+    uint64_t Offset,
+    uint64_t Tag
+)
+{
+    uint64_t Hash;
+
+    //
+    // Allocated on first use, most sessions never resolve a symbol.
+    //
+    if (m_Entries.empty())
+    {
+        SYMBOL_CACHE_ENTRY Empty;
+
+        memset(&Empty, 0, sizeof(Empty));
+        m_Entries.resize(SYMBOL_CACHE_SIZE, Empty);
+    }
+
+    Hash = (Offset ^ (Tag >> 4)) * 0x9E3779B97F4A7C15ULL;
+
+    return &m_Entries[(uint32_t)(Hash >> 52) & (SYMBOL_CACHE_SIZE - 1)];
+}
+
+bool
+SymbolCache::Lookup(
+    uint64_t Offset,
+    uint64_t Tag,
+    char *Name,
+    uint32_t NameSize
+)
+{
+    PSYMBOL_CACHE_ENTRY Entry;
+    const char *End;
+    size_t Len;
+    bool Resolved;
+
+    if (NameSize == 0) return false;
+
+    m_Stats.Lookups += 1;
+
+    Entry = GetSlot(Offset, Tag);
+
+    if (Entry->Valid && (Entry->Offset == Offset) && (Entry->Tag == Tag))
+    {
+        if (Entry->Resolved)
+        {
+            m_Stats.Hits += 1;
+
+            Len = strlen(Entry->Name);
+            if (Len >= NameSize) Len = NameSize - 1;
+
+            memcpy(Name, Entry->Name, Len);
+            Name[Len] = '\0';
+        }
+        else
+        {
+            m_Stats.NegativeHits += 1;
+        }
+
+        return Entry->Resolved;
+    }
+
+    m_Stats.Misses += 1;
+
+    memset(Name, 0, NameSize);
+    Resolved = m_Resolver(m_Context, Offset, Name, NameSize);
+
+    if (Resolved)
+    {
+        //
+        // Truncated names are not cached, a caller with a larger buffer would get a partial name.
+        //
+        End = (const char *)memchr(Name, '\0', NameSize);
+        Len = End ? (size_t)(End - Name) : NameSize;
+        if ((Len >= sizeof(Entry->Name)) || (Len + 1 >= NameSize))
+        {
+            m_Stats.Uncacheable += 1;
+            return Resolved;
+        }
+    }
+
+    if (Entry->Valid) m_Stats.Evictions += 1;
+
+    Entry->Offset = Offset;
+    Entry->Tag = Tag;
+    Entry->Resolved = Resolved;
+    Entry->Valid = true;
+
+    if (Resolved) memcpy(Entry->Name, Name, Len + 1);
+    else Entry->Name[0] = '\0';
+
+    return Resolved;
+}
+
+uint32_t
+SymbolCache::LookupBatch(
+    uint32_t Count,
+    const uint64_t *Offsets,
+    uint64_t Tag,
+    char *Names,
+    uint32_t NameSize
+)
+{
+    std::vector<uint32_t> Order(Count);
+    uint32_t ResolvedCount = 0;
+    uint32_t Previous = (uint32_t)-1;
+
+    if (NameSize == 0) return 0;
+
+    //
+    // Dispatch tables (IRP_MJ_*, FastIo, callbacks) contain the same routine many times.
+    // Sort the requests so that each distinct address is resolved once.
+    //
+    for (uint32_t i = 0; i < Count; i += 1) Order[i] = i;
+
+    std::sort(Order.begin(), Order.end(), [Offsets](uint32_t a, uint32_t b) { return Offsets[a] < Offsets[b]; });
+
+    for (uint32_t i = 0; i < Count; i += 1)
+    {
+        uint32_t Index = Order[i];
+        char *Name = Names + ((size_t)Index * NameSize);
+        bool Resolved;
+
+        if ((Previous != (uint32_t)-1) && (Offsets[Previous] == Offsets[Index]))
+        {
+            memcpy(Name, Names + ((size_t)Previous * NameSize), NameSize);
+            Resolved = (Name[0] != '\0');
+            m_Stats.Lookups += 1;
+            if (Resolved) m_Stats.Hits += 1;
+            else m_Stats.NegativeHits += 1;
+        }
+        else if (Offsets[Index] == 0)
+        {
+            memset(Name, 0, NameSize);
+            Resolved = false;
+        }
+        else
+        {
+            Resolved = Lookup(Offsets[Index], Tag, Name, NameSize);
+            if (!Resolved) memset(Name, 0, NameSize);
+        }
+
+        if (Resolved) ResolvedCount += 1;
+        Previous = Index;
+    }
+
+    return ResolvedCount;
+}
+
+void
+SymbolCache::Flush(
+)
+{
+    for (size_t i = 0; i < m_Entries.size(); i += 1) m_Entries[i].Valid = false;
+}
+
+void
+SymbolCache::ResetStats(
+)
+{
+    memset(&m_Stats, 0, sizeof(m_Stats));
+}
@@ -0,0 +1,128 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - SymbolCache.h
+
+Abstract:
+
+    - Bounded address-to-name cache used by GetNameByOffset().
+    - The cache does not talk to the debugger engine directly, names are
+      obtained through a resolver callback.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __SYMBOLCACHE_H__
+#define __SYMBOLCACHE_H__
+
+//
+// Standard types only, the cache is built and tested without the Windows headers.
+//
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define SYMBOL_CACHE_SIZE 4096 // Must be a power of 2.
+#define SYMBOL_CACHE_NAME_SIZE 256
+
+//
+// Returns true if Offset has been resolved into Name.
+//
+typedef bool (*PSYMBOL_RESOLVER)(void *Context, uint64_t Offset, char *Name, uint32_t NameSize);
+
+class SymbolCache {
+public:
+    typedef struct _SYMBOL_CACHE_ENTRY {
+        uint64_t Offset;
+        uint64_t Tag; // Address space the offset belongs to (0 for kernel addresses).
+
+        bool Valid;
+        bool Resolved; // false for cached misses.
+
+        char Name[SYMBOL_CACHE_NAME_SIZE];
+    } SYMBOL_CACHE_ENTRY, *PSYMBOL_CACHE_ENTRY;
+
+    typedef struct _SYMBOL_CACHE_STATS {
+        uint64_t Lookups;
+        uint64_t Hits;
+        uint64_t NegativeHits;
+        uint64_t Misses;
+        uint64_t Evictions;
+        uint64_t Uncacheable; // Names too long to be stored.
+    } SYMBOL_CACHE_STATS, *PSYMBOL_CACHE_STATS;
+
+    SymbolCache(
+        PSYMBOL_RESOLVER Resolver,
+        void *Context
+    );
+
+    bool
+    Lookup(
+        uint64_t Offset,
+        uint64_t Tag,
+        char *Name,
+        uint32_t NameSize
+    );
+
+    //
+    // Names holds Count names of NameSize bytes, empty for unresolved (or 0) offsets.
+    // Returns the number of resolved offsets.
+    //
+    uint32_t
+    LookupBatch(
+        uint32_t Count,
+        const uint64_t *Offsets,
+        uint64_t Tag,
+        char *Names,
+        uint32_t NameSize
+    );
+
+    void
+    Flush(
+    );
+
+    void
+    ResetStats(
+    );
+
+    SYMBOL_CACHE_STATS m_Stats;
+
+private:
+    PSYMBOL_CACHE_ENTRY
+    GetSlot(
+        uint64_t Offset,
+        uint64_t Tag
+    );
+
+    PSYMBOL_RESOLVER m_Resolver;
+    void *m_Context;
+
+    std::vector<SYMBOL_CACHE_ENTRY> m_Entries;
+};
+
+#endif
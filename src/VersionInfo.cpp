@@ -0,0 +1,336 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - VersionInfo.cpp
+
+Abstract:
+
+    - Every block is { wLength, wValueLength, wType, szKey, Value, Children }
+      with the value and the children aligned on 32 bits. All the offsets are
+      checked against the enclosing block, sizes found in the resource are
+      never trusted.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include "VersionInfo.h"
+
+#define VERSION_ALIGN(Offset) (((Offset) + 3) & ~3UL)
+
+#define VERSION_BLOCK_HEADER_SIZE (3 * sizeof(USHORT))
+#define VERSION_FIXED_INFO_SIZE 52 // VS_FIXEDFILEINFO
+
+typedef struct _VERSION_BLOCK {
+    ULONG End;
+    const USHORT *Key;
+    ULONG KeyLength;
+    ULONG ValueOffset;
+    ULONG ValueSize; // In bytes.
+    ULONG Children;
+} VERSION_BLOCK, *PVERSION_BLOCK;
+
+static LPCSTR VerStringNames[VersionMaxString] = {
+    "ProductVersion",
+    "FileVersion",
+    "CompanyName",
+    "FileDescription",
+    "OriginalFilename",
+    "InternalName",
+    "ProductName",
+    "LegalCopyright"
+};
+
+static
+USHORT
+VerReadUshort(
+    const UCHAR *Data
+)
+{
+    return (USHORT)(Data[0] | (Data[1] << 8));
+}
+
+static
+ULONG
+VerReadUlong(
+    const UCHAR *Data
+)
+{
+    return (ULONG)VerReadUshort(Data) | ((ULONG)VerReadUshort(Data + 2) << 16);
+}
+
+static
+BOOLEAN
+VerReadBlock(
+    const UCHAR *Data,
+    ULONG Offset,
+    ULONG Limit,
+    PVERSION_BLOCK Block
+)
+{
+    ULONG Length, ValueLength, Type, Key;
+
+    if ((Offset > Limit) || ((Limit - Offset) < VERSION_BLOCK_HEADER_SIZE)) return FALSE;
+
+    Length = VerReadUshort(Data + Offset);
+    ValueLength = VerReadUshort(Data + Offset + 2);
+    Type = VerReadUshort(Data + Offset + 4);
+
+    if (Length < VERSION_BLOCK_HEADER_SIZE) return FALSE;
+
+    //
+    // Some linkers get the length of the last block wrong, stay within the parent.
+    //
+    Block->End = ((Limit - Offset) < Length) ? Limit : (Offset + Length);
+
+    Key = Offset + VERSION_BLOCK_HEADER_SIZE;
+    Block->Key = (const USHORT *)(Data + Key);
+    Block->KeyLength = 0;
+
+    while (TRUE)
+    {
+        if ((Key + sizeof(USHORT)) > Block->End) return FALSE;
+        if (VerReadUshort(Data + Key) == 0) break;
+
+        Block->KeyLength += 1;
+        Key += sizeof(USHORT);
+    }
+
+    //
+    // wValueLength is in characters for text values, but not every compiler agrees.
+    // Whatever is left past the end of the block is ignored.
+    //
+    Block->ValueOffset = min(VERSION_ALIGN(Key + sizeof(USHORT)), Block->End);
+    Block->ValueSize = min((Type == 1) ? (ValueLength * (ULONG)sizeof(USHORT)) : ValueLength, Block->End - Block->ValueOffset);
+    Block->Children = min(VERSION_ALIGN(Block->ValueOffset + Block->ValueSize), Block->End);
+
+    return TRUE;
+}
+
+static
+BOOLEAN
+VerIsKey(
+    PVERSION_BLOCK Block,
+    LPCSTR Name
+)
+{
+    ULONG i;
+
+    for (i = 0; i < Block->KeyLength; i += 1)
+    {
+        USHORT c = VerReadUshort((const UCHAR *)&Block->Key[i]);
+
+        if ((Name[i] == '\0') || (c > 0x7F)) return FALSE;
+        if ((c | 0x20) != ((USHORT)Name[i] | 0x20)) return FALSE;
+    }
+
+    return (Name[i] == '\0') ? TRUE : FALSE;
+}
+
+static
+BOOLEAN
+VerGetLangCodePage(
+    PVERSION_BLOCK Block,
+    PULONG LangCodePage
+)
+{
+    ULONG Value = 0;
+
+    if (Block->KeyLength != 8) return FALSE;
+
+    for (ULONG i = 0; i < Block->KeyLength; i += 1)
+    {
+        USHORT c = VerReadUshort((const UCHAR *)&Block->Key[i]);
+
+        if ((c >= '0') && (c <= '9')) Value = (Value << 4) | (c - '0');
+        else if (((c | 0x20) >= 'a') && ((c | 0x20) <= 'f')) Value = (Value << 4) | ((c | 0x20) - 'a' + 10);
+        else return FALSE;
+    }
+
+    *LangCodePage = Value;
+
+    return TRUE;
+}
+
+static
+ULONG
+VerGetTableRank(
+    ULONG LangCodePage,
+    ULONG Translation,
+    BOOLEAN HasTranslation
+)
+{
+    if (HasTranslation && (LangCodePage == Translation)) return 0;
+    if (HasTranslation && ((LangCodePage >> 16) == (Translation >> 16))) return 1;
+    if ((LangCodePage >> 16) == 0x0409) return 2;
+    if ((LangCodePage >> 16) == 0x0000) return 3;
+
+    return 4;
+}
+
+static
+VOID
+VerGetStrings(
+    const UCHAR *Data,
+    PVERSION_BLOCK Table,
+    PVERSION_INFO Info
+)
+{
+    VERSION_BLOCK String;
+    ULONG Found = 0;
+
+    for (ULONG Offset = Table->Children;
+         (Found < VersionMaxString) && VerReadBlock(Data, Offset, Table->End, &String);
+         Offset = VERSION_ALIGN(String.End))
+    {
+        for (ULONG Id = 0; Id < VersionMaxString; Id += 1)
+        {
+            if (Info->Strings[Id].Buffer || !VerIsKey(&String, VerStringNames[Id])) continue;
+
+            Info->Strings[Id].Buffer = (const USHORT *)(Data + String.ValueOffset);
+            Info->Strings[Id].Length = 0;
+
+            while ((Info->Strings[Id].Length < (String.ValueSize / sizeof(USHORT))) &&
+                   VerReadUshort(Data + String.ValueOffset + (Info->Strings[Id].Length * sizeof(USHORT))))
+            {
+                Info->Strings[Id].Length += 1;
+            }
+
+            Found += 1;
+            break;
+        }
+    }
+}
+
+BOOLEAN
+VerParseVersionInfo(
+    const UCHAR *Data,
+    ULONG Size,
+    PVERSION_INFO Info
+)
+{
+    VERSION_BLOCK Root, Child;
+    VERSION_BLOCK StringFileInfo = { 0 };
+    BOOLEAN HasStringFileInfo = FALSE;
+    ULONG Translation = 0;
+    BOOLEAN HasTranslation = FALSE;
+
+    RtlZeroMemory(Info, sizeof(*Info));
+
+    if ((Data == NULL) || !VerReadBlock(Data, 0, Size, &Root)) return FALSE;
+    if (!VerIsKey(&Root, "VS_VERSION_INFO")) return FALSE;
+
+    if ((Root.ValueSize >= VERSION_FIXED_INFO_SIZE) &&
+        (VerReadUlong(Data + Root.ValueOffset) == VERSION_FIXED_SIGNATURE))
+    {
+        Info->HasFixedInfo = TRUE;
+        Info->FileVersionMS = VerReadUlong(Data + Root.ValueOffset + 8);
+        Info->FileVersionLS = VerReadUlong(Data + Root.ValueOffset + 12);
+        Info->ProductVersionMS = VerReadUlong(Data + Root.ValueOffset + 16);
+        Info->ProductVersionLS = VerReadUlong(Data + Root.ValueOffset + 20);
+    }
+
+    for (ULONG Offset = Root.Children; VerReadBlock(Data, Offset, Root.End, &Child); Offset = VERSION_ALIGN(Child.End))
+    {
+        if (VerIsKey(&Child, "StringFileInfo"))
+        {
+            StringFileInfo = Child;
+            HasStringFileInfo = TRUE;
+        }
+        else if (VerIsKey(&Child, "VarFileInfo"))
+        {
+            VERSION_BLOCK Var;
+
+            for (ULONG VarOffset = Child.Children; VerReadBlock(Data, VarOffset, Child.End, &Var); VarOffset = VERSION_ALIGN(Var.End))
+            {
+                if (!VerIsKey(&Var, "Translation") || (Var.ValueSize < sizeof(ULONG))) continue;
+
+                //
+                // { wLanguage, wCodePage }, same order as the string table names.
+                //
+                Translation = ((ULONG)VerReadUshort(Data + Var.ValueOffset) << 16) |
+                              VerReadUshort(Data + Var.ValueOffset + sizeof(USHORT));
+                HasTranslation = TRUE;
+                break;
+            }
+        }
+    }
+
+    if (HasStringFileInfo)
+    {
+        VERSION_BLOCK Table, Best = { 0 };
+        ULONG BestRank = MAXULONG;
+
+        //
+        // Only the headers of the string tables are read until the best one is known.
+        //
+        for (ULONG Offset = StringFileInfo.Children;
+             (BestRank != 0) && VerReadBlock(Data, Offset, StringFileInfo.End, &Table);
+             Offset = VERSION_ALIGN(Table.End))
+        {
+            ULONG LangCodePage, Rank;
+
+            if (!VerGetLangCodePage(&Table, &LangCodePage)) continue;
+
+            Rank = VerGetTableRank(LangCodePage, Translation, HasTranslation);
+            if (Rank < BestRank)
+            {
+                Best = Table;
+                BestRank = Rank;
+                Info->LangCodePage = LangCodePage;
+            }
+        }
+
+        if (BestRank != MAXULONG) VerGetStrings(Data, &Best, Info);
+    }
+
+    return TRUE;
+}
+
+ULONG
+VerCopyString(
+    PVERSION_STRING String,
+    PUSHORT Buffer,
+    ULONG BufferCount
+)
+{
+    ULONG Count;
+
+    if (!BufferCount) return 0;
+
+    Count = (String->Buffer == NULL) ? 0 : min(String->Length, BufferCount - 1);
+
+    for (ULONG i = 0; i < Count; i += 1)
+    {
+        Buffer[i] = VerReadUshort((const UCHAR *)&String->Buffer[i]);
+    }
+
+    Buffer[Count] = 0;
+
+    return Count;
+}
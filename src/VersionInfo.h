@@ -0,0 +1,99 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - VersionInfo.h
+
+Abstract:
+
+    - VS_VERSIONINFO parser, replaces VerQueryValueW. Works on the raw
+      RT_VERSION resource and has no dependency on the Windows version APIs.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __VERSIONINFO_H__
+#define __VERSIONINFO_H__
+
+#define VERSION_FIXED_SIGNATURE 0xFEEF04BD
+
+typedef enum _VERSION_STRING_ID {
+    VersionProductVersion = 0,
+    VersionFileVersion = 1,
+    VersionCompanyName = 2,
+    VersionFileDescription = 3,
+    VersionOriginalFilename = 4,
+    VersionInternalName = 5,
+    VersionProductName = 6,
+    VersionLegalCopyright = 7,
+    VersionMaxString = 8
+} VERSION_STRING_ID;
+
+//
+// Strings point into the resource, they are UTF-16LE and not always null terminated.
+//
+typedef struct _VERSION_STRING {
+    const USHORT *Buffer;
+    ULONG Length; // In characters, without the terminating null.
+} VERSION_STRING, *PVERSION_STRING;
+
+typedef struct _VERSION_INFO {
+    BOOLEAN HasFixedInfo;
+    ULONG FileVersionMS;
+    ULONG FileVersionLS;
+    ULONG ProductVersionMS;
+    ULONG ProductVersionLS;
+
+    //
+    // String table actually used, e.g. 0x040904B0.
+    //
+    ULONG LangCodePage;
+    VERSION_STRING Strings[VersionMaxString];
+} VERSION_INFO, *PVERSION_INFO;
+
+//
+// The translation listed first in VarFileInfo is used, then U.S. English, then
+// language neutral, then the first string table. Only the selected table is walked.
+//
+BOOLEAN
+VerParseVersionInfo(
+    const UCHAR *Data,
+    ULONG Size,
+    PVERSION_INFO Info
+);
+
+//
+// Copies a string into a null terminated buffer, truncating if needed.
+//
+ULONG
+VerCopyString(
+    PVERSION_STRING String,
+    PUSHORT Buffer,
+    ULONG BufferCount
+);
+
+#endif
@@ -0,0 +1,410 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - ArenaBench.cpp
+
+Abstract:
+
+    - Heap allocations and time of a command that builds and walks synthetic
+      process objects, with the former model (heap vectors and buffers shared
+      through a global reference count map, objects copied by range-for loops)
+      and with the command arena (ArenaVector, buffers in the arena, objects
+      walked by reference and released by the scope).
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <new>
+#include <vector>
+using namespace std;
+
+#include "Arena.h"
+#include "Test.h"
+
+#define BENCH_PROCESSES 100
+#define BENCH_DLLS 60
+#define BENCH_HANDLES 400
+#define BENCH_VADS 300
+#define BENCH_THREADS 20
+#define BENCH_IMAGE_SIZE 0x1000
+#define BENCH_STRING_SIZE 0x200
+#define BENCH_RUNS 5
+
+static ULONG64 g_HeapAllocations = 0;
+
+//
+// Every operator new of this program, vectors and map nodes.
+//
+PVOID
+operator new(
+    size_t Size
+)
+{
+    PVOID Buffer = malloc(Size ? Size : 1);
+
+    if (Buffer == NULL) throw bad_alloc();
+    g_HeapAllocations += 1;
+
+    return Buffer;
+}
+
+VOID
+operator delete(
+    PVOID Buffer
+) noexcept
+{
+    free(Buffer);
+}
+
+VOID
+operator delete(
+    PVOID Buffer,
+    size_t Size
+) noexcept
+{
+    UNREFERENCED_PARAMETER(Size);
+    free(Buffer);
+}
+
+static
+PVOID
+CountedAlloc(
+    SIZE_T Size
+)
+{
+    g_HeapAllocations += 1;
+    return malloc(Size);
+}
+
+typedef struct _BENCH_HANDLE {
+    ULONG64 Object;
+    ULONG Handle;
+    ULONG Access;
+    CHAR Type[32];
+    ULONG64 Name;
+} BENCH_HANDLE, *PBENCH_HANDLE;
+
+typedef struct _BENCH_VAD {
+    ULONG64 Start;
+    ULONG64 End;
+    ULONG Protection;
+    ULONG Flags;
+    CHAR Name[64];
+} BENCH_VAD, *PBENCH_VAD;
+
+typedef struct _BENCH_THREAD {
+    ULONG64 Thread;
+    ULONG64 StartAddress;
+    ULONG ThreadId;
+    ULONG State;
+} BENCH_THREAD, *PBENCH_THREAD;
+
+//
+// Former model, REF_POINTER and DEREF_POINTER on a global map.
+//
+static map<PVOID, ULONG> g_References;
+
+static
+VOID
+RefPointer(
+    PVOID Buffer
+)
+{
+    if (Buffer) g_References[Buffer] += 1;
+}
+
+static
+VOID
+DerefPointer(
+    PVOID Buffer
+)
+{
+    if (Buffer && (g_References[Buffer] >= 1))
+    {
+        g_References[Buffer] -= 1;
+
+        if (g_References[Buffer] == 0)
+        {
+            g_References.erase(Buffer);
+            free(Buffer);
+        }
+    }
+}
+
+class HeapDll {
+public:
+    HeapDll() : m_Image(NULL) {}
+
+    HeapDll(const HeapDll& Other) : m_Image(Other.m_Image) { RefPointer(m_Image); }
+
+    HeapDll& operator=(const HeapDll& Other)
+    {
+        RefPointer(Other.m_Image);
+        DerefPointer(m_Image);
+        m_Image = Other.m_Image;
+
+        return *this;
+    }
+
+    ~HeapDll() { DerefPointer(m_Image); }
+
+    PUCHAR m_Image;
+};
+
+class HeapProcess {
+public:
+    HeapProcess() : m_CommandLine(NULL), m_ImagePath(NULL), m_Image(NULL) {}
+
+    HeapProcess(const HeapProcess& Other) :
+        m_CommandLine(Other.m_CommandLine),
+        m_ImagePath(Other.m_ImagePath),
+        m_Image(Other.m_Image),
+        m_Dlls(Other.m_Dlls),
+        m_Handles(Other.m_Handles),
+        m_Vads(Other.m_Vads),
+        m_Threads(Other.m_Threads)
+    {
+        RefPointer(m_CommandLine);
+        RefPointer(m_ImagePath);
+        RefPointer(m_Image);
+    }
+
+    ~HeapProcess()
+    {
+        DerefPointer(m_CommandLine);
+        DerefPointer(m_ImagePath);
+        DerefPointer(m_Image);
+    }
+
+    PWSTR m_CommandLine;
+    PWSTR m_ImagePath;
+    PUCHAR m_Image;
+
+    vector<HeapDll> m_Dlls;
+    vector<BENCH_HANDLE> m_Handles;
+    vector<BENCH_VAD> m_Vads;
+    vector<BENCH_THREAD> m_Threads;
+
+private:
+    HeapProcess& operator=(const HeapProcess&);
+};
+
+class ArenaProcess {
+public:
+    ArenaProcess() : m_CommandLine(NULL), m_ImagePath(NULL), m_Image(NULL) {}
+
+    ArenaProcess(ArenaProcess&& Other) = default;
+
+    PWSTR m_CommandLine;
+    PWSTR m_ImagePath;
+    PUCHAR m_Image;
+
+    ArenaVector<PUCHAR> m_Dlls;
+    ArenaVector<BENCH_HANDLE> m_Handles;
+    ArenaVector<BENCH_VAD> m_Vads;
+    ArenaVector<BENCH_THREAD> m_Threads;
+
+private:
+    ArenaProcess(const ArenaProcess&);
+    ArenaProcess& operator=(const ArenaProcess&);
+};
+
+template <typename PROCESS>
+static
+VOID
+FillTables(
+    PROCESS& Process,
+    ULONG Index
+)
+{
+    for (ULONG i = 0; i < BENCH_HANDLES; i += 1)
+    {
+        BENCH_HANDLE Handle = { 0xFFFF800000000000ULL + i, 4 * i, 0x1F0FFF, "File", 0 };
+        Process.m_Handles.push_back(Handle);
+    }
+
+    for (ULONG i = 0; i < BENCH_VADS; i += 1)
+    {
+        BENCH_VAD Vad = { 0x10000ULL * i, (0x10000ULL * i) + 0xFFFF, 4, Index, "" };
+        Process.m_Vads.push_back(Vad);
+    }
+
+    for (ULONG i = 0; i < BENCH_THREADS; i += 1)
+    {
+        BENCH_THREAD Thread = { 0xFFFF900000000000ULL + i, 0x7FF600001000ULL, 4 * (Index + i), 5 };
+        Process.m_Threads.push_back(Thread);
+    }
+}
+
+//
+// Sum of what the command prints, the same for both models.
+//
+static
+ULONG64
+WalkProcess(
+    const PUCHAR Image,
+    ULONG Dlls,
+    const BENCH_VAD *Vads,
+    ULONG NumberOfVads
+)
+{
+    ULONG64 Sum = Image[0] + Dlls;
+
+    for (ULONG i = 0; i < NumberOfVads; i += 1) Sum += Vads[i].End - Vads[i].Start;
+
+    return Sum;
+}
+
+static
+ULONG64
+RunHeapCommand(
+)
+{
+    vector<HeapProcess> Processes;
+    ULONG64 Sum = 0;
+
+    for (ULONG Index = 0; Index < BENCH_PROCESSES; Index += 1)
+    {
+        HeapProcess Process;
+
+        Process.m_CommandLine = (PWSTR)CountedAlloc(BENCH_STRING_SIZE);
+        Process.m_ImagePath = (PWSTR)CountedAlloc(BENCH_STRING_SIZE);
+        Process.m_Image = (PUCHAR)CountedAlloc(BENCH_IMAGE_SIZE);
+        RefPointer(Process.m_CommandLine);
+        RefPointer(Process.m_ImagePath);
+        RefPointer(Process.m_Image);
+        Process.m_Image[0] = (UCHAR)Index;
+
+        for (ULONG i = 0; i < BENCH_DLLS; i += 1)
+        {
+            HeapDll Dll;
+
+            Dll.m_Image = (PUCHAR)CountedAlloc(BENCH_IMAGE_SIZE);
+            RefPointer(Dll.m_Image);
+            Process.m_Dlls.push_back(Dll);
+        }
+
+        FillTables(Process, Index);
+        Processes.push_back(Process);
+    }
+
+    //
+    // for (auto Process : Processes), twice as !ms_process did.
+    //
+    for (ULONG Pass = 0; Pass < 2; Pass += 1)
+    {
+        for (auto Process : Processes)
+        {
+            Sum += WalkProcess(Process.m_Image, (ULONG)Process.m_Dlls.size(), &Process.m_Vads[0], (ULONG)Process.m_Vads.size());
+        }
+    }
+
+    return Sum;
+}
+
+static
+ULONG64
+RunArenaCommand(
+)
+{
+    ArenaScope Scope;
+    ArenaVector<ArenaProcess> Processes;
+    ULONG64 Sum = 0;
+
+    for (ULONG Index = 0; Index < BENCH_PROCESSES; Index += 1)
+    {
+        ArenaProcess Process;
+
+        Process.m_CommandLine = (PWSTR)g_CommandArena.Alloc(BENCH_STRING_SIZE);
+        Process.m_ImagePath = (PWSTR)g_CommandArena.Alloc(BENCH_STRING_SIZE);
+        Process.m_Image = (PUCHAR)g_CommandArena.Alloc(BENCH_IMAGE_SIZE);
+        Process.m_Image[0] = (UCHAR)Index;
+
+        for (ULONG i = 0; i < BENCH_DLLS; i += 1) Process.m_Dlls.push_back((PUCHAR)g_CommandArena.Alloc(BENCH_IMAGE_SIZE));
+
+        FillTables(Process, Index);
+        Processes.push_back(move(Process));
+    }
+
+    for (ULONG Pass = 0; Pass < 2; Pass += 1)
+    {
+        for (auto& Process : Processes)
+        {
+            Sum += WalkProcess(Process.m_Image, (ULONG)Process.m_Dlls.size(), &Process.m_Vads[0], (ULONG)Process.m_Vads.size());
+        }
+    }
+
+    return Sum;
+}
+
+int
+main(
+)
+{
+    static const LPCSTR Names[] = { "Reference map", "Command arena" };
+    ULONG64 Sums[2] = { 0 };
+
+    printf("Command objects (%d processes, %d DLLs, %d handles, %d VADs each, best of %d):\n",
+           BENCH_PROCESSES, BENCH_DLLS, BENCH_HANDLES, BENCH_VADS, BENCH_RUNS);
+
+    for (ULONG Model = 0; Model < 2; Model += 1)
+    {
+        ULONG64 Allocations = 0;
+        double Best = 0.0;
+
+        for (ULONG Run = 0; Run < BENCH_RUNS; Run += 1)
+        {
+            ULONG64 Before = g_HeapAllocations;
+            ULONG64 Chunks = g_CommandArena.m_Stats.Chunks;
+            double Start = TestSeconds();
+
+            Sums[Model] = Model ? RunArenaCommand() : RunHeapCommand();
+
+            double Seconds = TestSeconds() - Start;
+            if (!Best || (Seconds < Best)) Best = Seconds;
+
+            //
+            // Arena chunks come from malloc as well.
+            //
+            Allocations = (g_HeapAllocations - Before) + (g_CommandArena.m_Stats.Chunks - Chunks);
+        }
+
+        printf("    %-16s %8.2f ms  %8llu heap allocations\n",
+               Names[Model], Best * 1000, (unsigned long long)Allocations);
+    }
+
+    CHECK(Sums[0] == Sums[1]);
+    CHECK(g_References.empty());
+
+    return TestResult("ArenaBench");
+}
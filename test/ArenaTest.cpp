@@ -0,0 +1,318 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - ArenaTest.cpp
+
+Abstract:
+
+    - Command arena: alignment, buffers that do not overlap (also from several
+      threads), chunks of their own for large buffers, reset by the outermost
+      scope only, empty again after a command that maps an image, and
+      ArenaVector against vector on the same operations.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <string.h>
+#include <new>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "Arena.h"
+#include "Test.h"
+
+#define TEST_THREADS 4
+#define TEST_ALLOCATIONS 20000
+
+typedef struct _TEST_BUFFER {
+    PUCHAR Buffer;
+    ULONG Size;
+    UCHAR Fill;
+} TEST_BUFFER, *PTEST_BUFFER;
+
+//
+// Fills every buffer before checking any, so an overlap shows as a wrong byte.
+//
+static
+BOOLEAN
+CheckBuffers(
+    vector<TEST_BUFFER>& Buffers
+)
+{
+    for (ULONG i = 0; i < Buffers.size(); i += 1) memset(Buffers[i].Buffer, Buffers[i].Fill, Buffers[i].Size);
+
+    for (ULONG i = 0; i < Buffers.size(); i += 1)
+    {
+        for (ULONG j = 0; j < Buffers[i].Size; j += 1)
+        {
+            if (Buffers[i].Buffer[j] != Buffers[i].Fill) return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static
+VOID
+TestAlloc(
+)
+{
+    unsigned long long Seed = 0xA7;
+    vector<TEST_BUFFER> Buffers;
+    BOOLEAN Aligned = TRUE;
+
+    g_CommandArena.Reset();
+    g_CommandArena.ResetStats();
+
+    for (ULONG i = 0; i < TEST_ALLOCATIONS; i += 1)
+    {
+        TEST_BUFFER Buffer;
+
+        //
+        // Mostly small, a few past the quarter chunk that get a chunk of their own.
+        //
+        Buffer.Size = (i % 1000) ? (TestRandom(&Seed) % 600) : (ARENA_CHUNK_SIZE / 4) + 1;
+        Buffer.Fill = (UCHAR)i;
+        Buffer.Buffer = (PUCHAR)g_CommandArena.Alloc(Buffer.Size);
+
+        if (Buffer.Buffer == NULL) break;
+        if ((ULONG_PTR)Buffer.Buffer % ARENA_ALIGNMENT) Aligned = FALSE;
+
+        Buffers.push_back(Buffer);
+    }
+
+    CHECK(Buffers.size() == TEST_ALLOCATIONS);
+    CHECK(Aligned);
+    CHECK(CheckBuffers(Buffers));
+
+    CHECK(g_CommandArena.m_Stats.Allocations == TEST_ALLOCATIONS);
+    CHECK(g_CommandArena.m_Stats.PeakBytes == g_CommandArena.m_Stats.Bytes);
+
+    //
+    // 20 large chunks, the small buffers (at most 608 bytes each) in a handful of chunks.
+    //
+    CHECK(g_CommandArena.m_Stats.Chunks > TEST_ALLOCATIONS / 1000);
+    CHECK(g_CommandArena.m_Stats.Chunks < (TEST_ALLOCATIONS / 1000) + 16);
+
+    //
+    // Zero bytes still get a buffer of their own.
+    //
+    PVOID Empty = g_CommandArena.Alloc(0);
+    PVOID Next = g_CommandArena.Alloc(1);
+    CHECK(Empty && Next && (Empty != Next));
+
+    ULONG64 Peak = g_CommandArena.m_Stats.PeakBytes;
+
+    g_CommandArena.Reset();
+    CHECK(g_CommandArena.m_Stats.Resets == 1);
+
+    //
+    // Bytes in use start over after a reset, the peak stays.
+    //
+    g_CommandArena.Alloc(16);
+    CHECK(g_CommandArena.m_Stats.PeakBytes == Peak);
+    CHECK(g_CommandArena.m_Stats.Bytes == Peak + 16);
+    g_CommandArena.Reset();
+}
+
+static
+VOID
+TestThreads(
+)
+{
+    vector<TEST_BUFFER> Buffers[TEST_THREADS];
+    vector<thread> Threads;
+
+    g_CommandArena.Reset();
+    g_CommandArena.ResetStats();
+
+    for (ULONG t = 0; t < TEST_THREADS; t += 1)
+    {
+        Threads.push_back(thread([&Buffers, t]() {
+            unsigned long long Seed = t;
+
+            for (ULONG i = 0; i < TEST_ALLOCATIONS / TEST_THREADS; i += 1)
+            {
+                TEST_BUFFER Buffer;
+
+                Buffer.Size = 1 + (TestRandom(&Seed) % 256);
+                Buffer.Fill = (UCHAR)((t << 6) | (i & 0x3F));
+                Buffer.Buffer = (PUCHAR)g_CommandArena.Alloc(Buffer.Size);
+
+                if (Buffer.Buffer) Buffers[t].push_back(Buffer);
+            }
+        }));
+    }
+
+    for (ULONG t = 0; t < TEST_THREADS; t += 1) Threads[t].join();
+
+    vector<TEST_BUFFER> All;
+
+    for (ULONG t = 0; t < TEST_THREADS; t += 1) All.insert(All.end(), Buffers[t].begin(), Buffers[t].end());
+
+    CHECK(All.size() == TEST_ALLOCATIONS);
+    CHECK(CheckBuffers(All));
+    CHECK(g_CommandArena.m_Stats.Allocations == TEST_ALLOCATIONS);
+
+    g_CommandArena.Reset();
+}
+
+static
+VOID
+TestScopes(
+)
+{
+    g_CommandArena.Reset();
+    g_CommandArena.ResetStats();
+
+    {
+        ArenaScope Outer;
+
+        {
+            ArenaScope Inner;
+            g_CommandArena.Alloc(100);
+        }
+
+        //
+        // A helper with its own scope must not release the buffers of the command.
+        //
+        CHECK(g_CommandArena.m_Stats.Resets == 0);
+    }
+
+    CHECK(g_CommandArena.m_Stats.Resets == 1);
+}
+
+//
+// A command that maps an image (a chunk of its own) and builds a few objects: everything is
+// released when its scope exits, nothing is left for the rest of the session.
+//
+#define TEST_IMAGE_SIZE (3 * 1024 * 1024 + 0x234)
+
+static
+VOID
+TestImageScope(
+)
+{
+    g_CommandArena.Reset();
+    g_CommandArena.ResetStats();
+
+    for (ULONG Command = 0; Command < 3; Command += 1)
+    {
+        ArenaScope Scope;
+        PUCHAR Image = (PUCHAR)g_CommandArena.Alloc(TEST_IMAGE_SIZE);
+
+        CHECK(Image != NULL);
+        if (Image == NULL) continue;
+
+        memset(Image, 0x4D, TEST_IMAGE_SIZE);
+
+        for (ULONG i = 0; i < 100; i += 1) CHECK(g_CommandArena.Alloc(200) != NULL);
+
+        CHECK(g_CommandArena.GetBytes() >= TEST_IMAGE_SIZE);
+        CHECK(g_CommandArena.GetNumberOfChunks() == 2);
+    }
+
+    CHECK(g_CommandArena.GetBytes() == 0);
+    CHECK(g_CommandArena.GetNumberOfChunks() == 0);
+    CHECK(g_CommandArena.m_Stats.Resets == 3);
+    CHECK(g_CommandArena.m_Stats.PeakBytes < (2 * TEST_IMAGE_SIZE));
+}
+
+//
+// The same random operations on a vector and on an ArenaVector, the contents must stay equal.
+//
+static
+VOID
+TestVector(
+)
+{
+    ArenaScope Scope;
+    unsigned long long Seed = 0x56;
+    vector<ULONG64> Reference;
+    ArenaVector<ULONG64> Vector;
+    ULONG64 Before = g_CommandArena.m_Stats.Allocations;
+    BOOLEAN Equal = TRUE;
+
+    for (ULONG i = 0; i < TEST_ALLOCATIONS; i += 1)
+    {
+        ULONG Operation = TestRandom(&Seed) % 8;
+        ULONG64 Value = TestRandom(&Seed);
+
+        if ((Operation == 0) && Reference.size())
+        {
+            ULONG Index = (ULONG)(Value % Reference.size());
+
+            Reference.erase(Reference.begin() + Index);
+            Vector.erase(Vector.begin() + Index);
+        }
+        else if (Operation == 1)
+        {
+            ULONG Index = (ULONG)(Value % (Reference.size() + 1));
+
+            Reference.insert(Reference.begin() + Index, Value);
+            Vector.insert(Vector.begin() + Index, Value);
+        }
+        else if ((Operation == 2) && ((Value % 100) == 0))
+        {
+            Reference.clear();
+            Vector.clear();
+            Vector.shrink_to_fit();
+        }
+        else
+        {
+            Reference.push_back(Value);
+            Vector.push_back(Value);
+        }
+
+        if ((Reference.size() != Vector.size()) ||
+            (Reference.size() && memcmp(&Reference[0], &Vector[0], Reference.size() * sizeof(ULONG64))))
+        {
+            Equal = FALSE;
+            break;
+        }
+    }
+
+    CHECK(Equal);
+    CHECK(g_CommandArena.m_Stats.Allocations > Before);
+}
+
+int
+main(
+)
+{
+    TestAlloc();
+    TestThreads();
+    TestScopes();
+    TestImageScope();
+    TestVector();
+
+    return TestResult("Arena");
+}
@@ -0,0 +1,231 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - DisasmTest.cpp
+
+Abstract:
+
+    - X86Decode() lengths and control flow of reference encodings in both
+      modes, and X86FindHook() on hand-written function starts.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <string.h>
+using namespace std;
+
+#include "Disasm.h"
+#include "Test.h"
+
+typedef struct _TEST_ENCODING {
+    BOOLEAN Is64Bit;
+    ULONG Length; // 0 if invalid.
+    X86_FLOW Flow;
+    ULONG Size;
+    UCHAR Bytes[16];
+} TEST_ENCODING, *PTEST_ENCODING;
+
+//
+// Lengths as reported by objdump.
+//
+static const TEST_ENCODING g_Encodings[] = {
+    { TRUE, 1, X86FlowNone, 1, { 0x90 } }, // nop
+    { TRUE, 3, X86FlowNone, 3, { 0x48, 0x89, 0xE5 } }, // mov rbp, rsp
+    { TRUE, 7, X86FlowNone, 7, { 0x48, 0x8B, 0x05, 0x10, 0x20, 0x30, 0x00 } }, // mov rax, [rip+0x302010]
+    { TRUE, 4, X86FlowNone, 4, { 0x8B, 0x44, 0x24, 0x08 } }, // mov eax, [rsp+8]
+    { TRUE, 7, X86FlowNone, 7, { 0x8B, 0x04, 0x25, 0x00, 0x10, 0x00, 0x00 } }, // mov eax, [0x1000]
+    { TRUE, 7, X86FlowNone, 7, { 0x8B, 0x84, 0x88, 0x00, 0x10, 0x00, 0x00 } }, // mov eax, [rax+rcx*4+0x1000]
+    { TRUE, 10, X86FlowNone, 10, { 0x48, 0xB8, 1, 2, 3, 4, 5, 6, 7, 8 } }, // mov rax, imm64
+    { TRUE, 5, X86FlowNone, 5, { 0xB8, 1, 2, 3, 4 } }, // mov eax, imm32
+    { TRUE, 4, X86FlowNone, 4, { 0x66, 0xB8, 1, 2 } }, // mov ax, imm16
+    { TRUE, 7, X86FlowNone, 7, { 0x48, 0xC7, 0xC0, 1, 2, 3, 4 } }, // mov rax, simm32
+    { TRUE, 3, X86FlowNone, 3, { 0xF6, 0xC1, 0x01 } }, // test cl, 1
+    { TRUE, 2, X86FlowNone, 2, { 0xF6, 0xD1 } }, // not cl
+    { TRUE, 6, X86FlowNone, 6, { 0xF7, 0xC1, 1, 2, 3, 4 } }, // test ecx, imm32
+    { TRUE, 5, X86FlowNone, 5, { 0x66, 0xF7, 0xC1, 0x01, 0x00 } }, // test cx, imm16
+    { TRUE, 9, X86FlowNone, 9, { 0xA1, 1, 2, 3, 4, 5, 6, 7, 8 } }, // mov eax, [moffs64]
+    { TRUE, 6, X86FlowNone, 6, { 0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00 } }, // nop word [rax+rax]
+    { TRUE, 4, X86FlowNone, 4, { 0xF3, 0x0F, 0x1E, 0xFA } }, // endbr64
+    { TRUE, 6, X86FlowNone, 6, { 0x66, 0x0F, 0x3A, 0x0F, 0xC1, 0x08 } }, // palignr xmm0, xmm1, 8
+    { TRUE, 6, X86FlowNone, 6, { 0x66, 0x0F, 0x38, 0x00, 0x04, 0x24 } }, // pshufb xmm0, [rsp]
+    { TRUE, 3, X86FlowNone, 3, { 0xC5, 0xF8, 0x77 } }, // vzeroupper
+    { TRUE, 9, X86FlowNone, 9, { 0xC4, 0xE2, 0x79, 0x18, 0x05, 1, 2, 3, 4 } }, // vbroadcastss xmm0, [rip+x]
+    { TRUE, 6, X86FlowNone, 6, { 0x62, 0xF1, 0x7C, 0x48, 0x28, 0xC1 } }, // vmovaps zmm0, zmm1
+    { TRUE, 5, X86FlowCall, 5, { 0xE8, 1, 2, 3, 4 } }, // call rel32
+    { TRUE, 5, X86FlowJmp, 5, { 0xE9, 1, 2, 3, 4 } }, // jmp rel32
+    { TRUE, 2, X86FlowJmp, 2, { 0xEB, 0xFE } }, // jmp $
+    { TRUE, 2, X86FlowJcc, 2, { 0x74, 0x10 } }, // je rel8
+    { TRUE, 6, X86FlowJcc, 6, { 0x0F, 0x84, 1, 2, 3, 4 } }, // je rel32
+    { TRUE, 2, X86FlowJcc, 2, { 0xE2, 0x10 } }, // loop rel8
+    { TRUE, 6, X86FlowJmpIndirect, 6, { 0xFF, 0x25, 0, 0, 0, 0 } }, // jmp [rip]
+    { TRUE, 6, X86FlowCallIndirect, 6, { 0xFF, 0x15, 0, 0, 0, 0 } }, // call [rip]
+    { TRUE, 2, X86FlowJmpIndirect, 2, { 0xFF, 0xE0 } }, // jmp rax
+    { TRUE, 3, X86FlowCallIndirect, 3, { 0x41, 0xFF, 0xD3 } }, // call r11
+    { TRUE, 1, X86FlowRet, 1, { 0xC3 } }, // ret
+    { TRUE, 3, X86FlowRet, 3, { 0xC2, 0x08, 0x00 } }, // ret 8
+    { TRUE, 1, X86FlowInt3, 1, { 0xCC } }, // int3
+    { TRUE, 0, X86FlowNone, 1, { 0x06 } }, // push es, invalid in 64-bit mode.
+    { TRUE, 0, X86FlowNone, 3, { 0xE8, 0x00, 0x00 } }, // Truncated.
+    { TRUE, 0, X86FlowNone, 16, { 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x90 } }, // Longer than 15 bytes.
+
+    { FALSE, 1, X86FlowNone, 1, { 0x06 } }, // push es
+    { FALSE, 1, X86FlowNone, 1, { 0x40 } }, // inc eax
+    { FALSE, 5, X86FlowNone, 5, { 0xA1, 1, 2, 3, 4 } }, // mov eax, [moffs32]
+    { FALSE, 4, X86FlowCall, 4, { 0x66, 0xE8, 1, 2 } }, // call rel16
+    { FALSE, 5, X86FlowNone, 5, { 0x67, 0x8B, 0x06, 0x00, 0x10 } }, // mov eax, [0x1000], 16-bit addressing.
+    { FALSE, 2, X86FlowNone, 2, { 0xC4, 0x00 } }, // les eax, [eax]
+    { FALSE, 3, X86FlowNone, 3, { 0xC5, 0xF8, 0x77 } }, // vzeroupper
+    { FALSE, 6, X86FlowCallIndirect, 6, { 0xFF, 0x15, 0x00, 0x10, 0x00, 0x00 } }, // call [0x1000]
+};
+
+static
+VOID
+TestEncodings(
+)
+{
+    for (ULONG i = 0; i < _countof(g_Encodings); i += 1)
+    {
+        const TEST_ENCODING *Encoding = &g_Encodings[i];
+        X86_INSTRUCTION Instruction;
+        ULONG Length = X86Decode(Encoding->Bytes, Encoding->Size, Encoding->Is64Bit, &Instruction);
+
+        if (Length != Encoding->Length) printf("       encoding %u: length %u, expected %u\n", i, Length, Encoding->Length);
+        CHECK(Length == Encoding->Length);
+        if (Length) CHECK(Instruction.Flow == Encoding->Flow);
+    }
+}
+
+static
+VOID
+TestOperands(
+)
+{
+    static const UCHAR RipRelative[] = { 0x48, 0x8B, 0x05, 0xF0, 0xFF, 0xFF, 0xFF }; // mov rax, [rip-0x10]
+    static const UCHAR MovImmediate[] = { 0x48, 0xB8, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11 };
+    static const UCHAR JmpBack[] = { 0xEB, 0xFE };
+    X86_INSTRUCTION Instruction;
+
+    CHECK(X86Decode(RipRelative, sizeof(RipRelative), TRUE, &Instruction) == sizeof(RipRelative));
+    CHECK(Instruction.RipRelative && (Instruction.Displacement == -0x10) && (Instruction.Rex == 0x48));
+
+    CHECK(X86Decode(RipRelative, sizeof(RipRelative), FALSE, &Instruction) == 1); // dec eax
+
+    CHECK(X86Decode(MovImmediate, sizeof(MovImmediate), TRUE, &Instruction) == sizeof(MovImmediate));
+    CHECK(Instruction.Immediate == 0x1122334455667788ULL);
+
+    CHECK(X86Decode(JmpBack, sizeof(JmpBack), TRUE, &Instruction) == sizeof(JmpBack));
+    CHECK(Instruction.Relative == -2);
+}
+
+#define TEST_MODULE_BASE 0x10000ULL
+#define TEST_MODULE_END 0x20000ULL
+#define TEST_FUNCTION_ADDRESS 0x11000ULL
+
+typedef struct _TEST_FUNCTION {
+    LPCSTR Name;
+    BOOLEAN Is64Bit;
+    X86_HOOK_TYPE Type; // X86HookNone if clean.
+    ULONG Offset;
+    ULONG64 Target;
+    ULONG Size;
+    UCHAR Bytes[32];
+} TEST_FUNCTION, *PTEST_FUNCTION;
+
+static const TEST_FUNCTION g_Functions[] = {
+    { "jmp out", TRUE, X86HookBranch, 0, 0x50000ULL, 5, { 0xE9, 0xFB, 0xEF, 0x03, 0x00 } },
+    { "hot patch", FALSE, X86HookBranch, 5, 0x50000ULL, 10, { 0x8B, 0xFF, 0x55, 0x8B, 0xEC, 0xE9, 0xF6, 0xEF, 0x03, 0x00 } },
+    { "mov/jmp reg", TRUE, X86HookRegister, 10, 0x1122334455667788ULL, 12,
+      { 0x48, 0xB8, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11, 0xFF, 0xE0 } },
+    { "push/ret", FALSE, X86HookPushRet, 5, 0x50000ULL, 6, { 0x68, 0x00, 0x00, 0x05, 0x00, 0xC3 } },
+    { "jmp [rip]", TRUE, X86HookIndirect, 0, 0x7FF612345678ULL, 14,
+      { 0xFF, 0x25, 0x00, 0x00, 0x00, 0x00, 0x78, 0x56, 0x34, 0x12, 0xF6, 0x7F, 0x00, 0x00 } },
+    { "followed jmp", TRUE, X86HookBranch, 4, 0x50000ULL, 9, { 0xEB, 0x02, 0xCC, 0xCC, 0xE9, 0xF7, 0xEF, 0x03, 0x00 } },
+    { "prolog", TRUE, X86HookNone, 0, 0, 12,
+      { 0x55, 0x48, 0x89, 0xE5, 0x48, 0x83, 0xEC, 0x20, 0x31, 0xC0, 0xC9, 0xC3 } },
+    { "call inside", TRUE, X86HookNone, 0, 0, 6, { 0xE8, 0x00, 0x01, 0x00, 0x00, 0xC3 } },
+    { "syscall stub", FALSE, X86HookNone, 0, 0, 13,
+      { 0xB8, 0x26, 0x00, 0x00, 0x00, 0xBA, 0x00, 0x03, 0xFE, 0x7F, 0xFF, 0x12, 0xC3 } },
+};
+
+static
+VOID
+TestHooks(
+)
+{
+    for (ULONG i = 0; i < _countof(g_Functions); i += 1)
+    {
+        const TEST_FUNCTION *Function = &g_Functions[i];
+        X86_HOOK Hook;
+        BOOLEAN Hooked;
+
+        Hooked = X86FindHook(Function->Bytes, Function->Size, TEST_FUNCTION_ADDRESS, Function->Is64Bit,
+                             TEST_MODULE_BASE, TEST_MODULE_END, HOOK_SCAN_DEPTH, &Hook);
+
+        if (Hooked != (Function->Type != X86HookNone)) printf("       %s: %s\n", Function->Name, Hooked ? "hooked" : "clean");
+        CHECK(Hooked == (Function->Type != X86HookNone));
+        if (!Hooked) continue;
+
+        CHECK(Hook.Type == Function->Type);
+        CHECK(Hook.Offset == Function->Offset);
+        CHECK(Hook.Target == Function->Target);
+    }
+
+    CHECK(strcmp(X86HookTypeName(X86HookNone), "none") == 0);
+    CHECK(strcmp(X86HookTypeName(X86HookPushRet), "push/ret") == 0);
+}
+
+//
+// Without module, only the first three instructions are looked at.
+//
+static
+VOID
+TestWithoutModule(
+)
+{
+    static const UCHAR Late[] = { 0x90, 0x90, 0x90, 0xE9, 0x00, 0x00, 0x00, 0x00 };
+    static const UCHAR Early[] = { 0x90, 0xE8, 0x00, 0x00, 0x00, 0x00 };
+    X86_HOOK Hook;
+
+    CHECK(!X86FindHook(Late, sizeof(Late), TEST_FUNCTION_ADDRESS, TRUE, 0, 0, HOOK_SCAN_DEPTH, &Hook));
+    CHECK(X86FindHook(Early, sizeof(Early), TEST_FUNCTION_ADDRESS, TRUE, 0, 0, HOOK_SCAN_DEPTH, &Hook));
+    CHECK((Hook.Type == X86HookBranch) && (Hook.Offset == 1) && (Hook.Target == TEST_FUNCTION_ADDRESS + sizeof(Early)));
+}
+
+int
+main(
+)
+{
+    TestEncodings();
+    TestOperands();
+    TestHooks();
+    TestWithoutModule();
+
+    return TestResult("Disasm");
+}
@@ -0,0 +1,109 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - EntropyBench.cpp
+
+Abstract:
+
+    - Throughput of the per-page entropy map on random, zero, ASCII and UTF-16
+      data, the driver of the !ms_hash /bench entropy line outside of the
+      debugger. The requirement is 2 GB/s per core on each of them.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <string.h>
+#include <vector>
+using namespace std;
+
+#include "Entropy.h"
+#include "Test.h"
+
+//
+// Fits in the caches of a server core, the histograms are measured and not the memory.
+//
+#define BENCH_DATA_SIZE (8 * 1024 * 1024)
+#define BENCH_RUNS 20
+#define BENCH_TARGET_MBS 2000
+
+static const CHAR g_Text[] = "The quick brown fox jumps over the lazy dog.\r\n";
+
+int
+main(
+)
+{
+    static const LPCSTR Names[] = { "Random", "Zero", "Text", "UTF-16 text" };
+    vector<UCHAR> Data(BENCH_DATA_SIZE);
+    unsigned long long Seed = 0x45;
+    ULONG Checksum = 0;
+
+    printf("Entropy map throughput (%d MB, best of %d, target %d MB/s):\n",
+           BENCH_DATA_SIZE / (1024 * 1024), BENCH_RUNS, BENCH_TARGET_MBS);
+
+    for (ULONG Kind = 0; Kind < _countof(Names); Kind += 1)
+    {
+        ENTROPY_SUMMARY Summary;
+        double Best = 0.0;
+
+        for (ULONG i = 0; i < Data.size(); i += 1)
+        {
+            switch (Kind)
+            {
+                case 0: Data[i] = (UCHAR)TestRandom(&Seed); break;
+                case 1: Data[i] = 0; break;
+                case 2: Data[i] = g_Text[i % (sizeof(g_Text) - 1)]; break;
+                case 3: Data[i] = (i & 1) ? 0 : g_Text[(i / 2) % (sizeof(g_Text) - 1)]; break;
+            }
+        }
+
+        for (ULONG Run = 0; Run < BENCH_RUNS; Run += 1)
+        {
+            double Start = TestSeconds();
+
+            GetEntropySummary(&Data[0], Data.size(), &Summary);
+
+            double Seconds = TestSeconds() - Start;
+            if (!Best || (Seconds < Best)) Best = Seconds;
+        }
+
+        double Mbs = Best ? (BENCH_DATA_SIZE / Best) / (1000 * 1000) : 0.0;
+
+        printf("    %-16s %6.2f ms  %6.0f MB/s  entropy %u.%02u%s\n",
+               Names[Kind], Best * 1000, Mbs,
+               Summary.Entropy / ENTROPY_SCALE, ((Summary.Entropy % ENTROPY_SCALE) * 100) / ENTROPY_SCALE,
+               (Mbs < BENCH_TARGET_MBS) ? "  below target" : "");
+
+        Checksum = (Checksum * 31) + Summary.Entropy + Summary.NumberOfHighPages;
+    }
+
+    printf("    checksum 0x%08X\n", Checksum);
+
+    return TestResult("EntropyBench");
+}
@@ -0,0 +1,210 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - EntropyTest.cpp
+
+Abstract:
+
+    - GetPageEntropy() against a naive one-table histogram with log2() in double,
+      on pages built to hit the single byte and interleaved table paths, and the
+      page by page summary against the whole range.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+using namespace std;
+
+#include "Entropy.h"
+#include "Test.h"
+
+static
+ULONG
+GetNaiveEntropy(
+    const UCHAR *Data,
+    ULONG Length,
+    PULONG64 Histogram
+)
+{
+    ULONG64 Counts[256] = { 0 };
+    double Entropy = 0.0;
+
+    for (ULONG i = 0; i < Length; i += 1) Counts[Data[i]] += 1;
+
+    for (ULONG Byte = 0; Byte < 256; Byte += 1)
+    {
+        double p = (double)Counts[Byte] / Length;
+
+        if (Counts[Byte]) Entropy -= p * log2(p);
+        if (Histogram) Histogram[Byte] += Counts[Byte];
+    }
+
+    return (ULONG)((Entropy * ENTROPY_SCALE) + 0.5);
+}
+
+//
+// Random bytes from an alphabet of Symbols values, with runs of Run bytes.
+//
+static
+VOID
+FillPage(
+    PUCHAR Page,
+    ULONG Length,
+    ULONG Symbols,
+    ULONG Run,
+    unsigned long long *Seed
+)
+{
+    for (ULONG i = 0; i < Length; i += Run)
+    {
+        UCHAR Byte = (UCHAR)(TestRandom(Seed) % Symbols);
+
+        memset(Page + i, Byte, min(Run, Length - i));
+    }
+}
+
+static
+VOID
+TestPages(
+)
+{
+    static const ULONG Symbols[] = { 1, 2, 3, 16, 64, 200, 256 };
+    static const ULONG Runs[] = { 1, 2, 3, 8, 15, 16, 17, 64, 4096 };
+    static const ULONG Lengths[] = { ENTROPY_PAGE_SIZE, ENTROPY_PAGE_SIZE - 1, 1000, 17, 15, 1 };
+    unsigned long long Seed = 0x45;
+    UCHAR Page[ENTROPY_PAGE_SIZE + 1];
+    ULONG Different = 0;
+
+    for (ULONG s = 0; s < _countof(Symbols); s += 1)
+    {
+        for (ULONG r = 0; r < _countof(Runs); r += 1)
+        {
+            for (ULONG l = 0; l < _countof(Lengths); l += 1)
+            {
+                ULONG64 Histogram[256] = { 0 }, NaiveHistogram[256] = { 0 };
+                ULONG Length = Lengths[l];
+
+                //
+                // Unaligned as well, pages of a section are not always aligned in the buffer.
+                //
+                FillPage(Page + (l & 1), Length, Symbols[s], Runs[r], &Seed);
+
+                ULONG Entropy = GetPageEntropy(Page + (l & 1), Length, Histogram);
+                ULONG Naive = GetNaiveEntropy(Page + (l & 1), Length, NaiveHistogram);
+
+                //
+                // The table is in float, the rounding can differ by one.
+                //
+                if (Entropy != Naive) Different += 1;
+                CHECK((Entropy + 1 >= Naive) && (Entropy <= Naive + 1));
+                CHECK(memcmp(Histogram, NaiveHistogram, sizeof(Histogram)) == 0);
+            }
+        }
+    }
+
+    CHECK(Different < 8);
+
+    //
+    // UTF-16 text, every other byte is zero.
+    //
+    for (ULONG i = 0; i < ENTROPY_PAGE_SIZE; i += 1) Page[i] = (i & 1) ? 0 : (UCHAR)('a' + (i / 2) % 26);
+    CHECK(GetPageEntropy(Page, ENTROPY_PAGE_SIZE, NULL) == GetNaiveEntropy(Page, ENTROPY_PAGE_SIZE, NULL));
+
+    memset(Page, 0, ENTROPY_PAGE_SIZE);
+    CHECK(GetPageEntropy(Page, ENTROPY_PAGE_SIZE, NULL) == 0);
+    CHECK(GetPageEntropy(Page, 0, NULL) == 0);
+
+    for (ULONG i = 0; i < ENTROPY_PAGE_SIZE; i += 1) Page[i] = (UCHAR)i;
+    CHECK(GetPageEntropy(Page, ENTROPY_PAGE_SIZE, NULL) == 8 * ENTROPY_SCALE);
+}
+
+static
+VOID
+TestSummary(
+)
+{
+    vector<UCHAR> Data(64 * ENTROPY_PAGE_SIZE + 100);
+    unsigned long long Seed = 0x4D;
+    ENTROPY_SUMMARY Summary;
+    ULONG MaxPage = 0, HighPages = 0;
+
+    //
+    // Zero, text and random quarters.
+    //
+    for (ULONG i = 0; i < Data.size(); i += 1)
+    {
+        ULONG Quarter = (i / ENTROPY_PAGE_SIZE) / 16;
+
+        if (Quarter == 0) Data[i] = 0;
+        else if (Quarter == 1) Data[i] = "the quick brown fox jumps over the lazy dog\n"[i % 44];
+        else Data[i] = (UCHAR)TestRandom(&Seed);
+    }
+
+    GetEntropySummary(&Data[0], Data.size(), &Summary);
+
+    for (ULONG64 Offset = 0; Offset < Data.size(); Offset += ENTROPY_PAGE_SIZE)
+    {
+        ULONG Length = (ULONG)min(Data.size() - Offset, (size_t)ENTROPY_PAGE_SIZE);
+        ULONG Entropy = GetPageEntropy(&Data[Offset], Length, NULL);
+
+        MaxPage = max(MaxPage, Entropy);
+        if (Entropy >= ENTROPY_HIGH) HighPages += 1;
+    }
+
+    CHECK(Summary.NumberOfPages == 65);
+    CHECK(Summary.MaxPageEntropy == MaxPage);
+    CHECK(Summary.NumberOfHighPages == HighPages);
+
+    //
+    // The short last page has random bytes as well, but 100 bytes cannot get to 7.25 bits.
+    //
+    CHECK(HighPages == 32);
+
+    CHECK(Summary.Entropy == GetNaiveEntropy(&Data[0], (ULONG)Data.size(), NULL));
+
+    //
+    // 65 pages in 64 columns, the sixteenth column has the first text page.
+    //
+    CHECK(strlen(Summary.Map) == ENTROPY_MAP_WIDTH);
+    CHECK(memcmp(Summary.Map, "...............", 15) == 0);
+    CHECK(Summary.Map[ENTROPY_MAP_WIDTH - 2] == '7');
+}
+
+int
+main(
+)
+{
+    TestPages();
+    TestSummary();
+
+    return TestResult("Entropy");
+}
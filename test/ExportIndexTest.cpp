@@ -0,0 +1,367 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - ExportIndexTest.cpp
+
+Abstract:
+
+    - Imports resolved through the export index, as CheckImports() does for a
+      process: synthetic modules (TestImage.h) forward to each other by name
+      and by ordinal, with ordinal bases other than 1, loops and chains longer
+      than EXPORT_INDEX_MAX_FORWARDS. The IAT of a synthetic image is then
+      checked with slots left as the loader wrote them or patched.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <string>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "FuzzyHash.h"
+#include "Entropy.h"
+#include "HashStream.h"
+#include "Arena.h"
+#include "ImageIdentity.h"
+#include "DbgHelpEx.h"
+#include "ExportIndex.h"
+#include "TestImage.h"
+#include "Test.h"
+
+#define TEST_TEXT 0x1000 // First section of a TestImage.
+#define TEST_OUTSIDE 0x10000 // Not in any module.
+
+#define TEST_NTDLL 0x77000000
+#define TEST_KERNELBASE 0x76000000
+#define TEST_KERNEL32 0x75000000
+#define TEST_CHAIN 0x60000000 // chain0.dll to chain4.dll, 1MB apart.
+
+typedef enum _TEST_IAT {
+    TestIatExpected, // As written by the loader.
+    TestIatOutside, // Patched to an address outside of every module.
+    TestIatLoaded, // Patched to an address inside of a loaded module.
+    TestIatModuleEnd, // Patched to the first byte after ntdll.dll.
+    TestIatEmpty
+} TEST_IAT;
+
+typedef struct _TEST_CASE {
+    LPCSTR ModuleName;
+    LPCSTR Name; // Empty for an import by ordinal.
+    ULONG Ordinal;
+    ULONG64 Base; // Of the module the import resolves to, 0 if it cannot be resolved.
+    ULONG Rva;
+    TEST_IAT Iat;
+} TEST_CASE, *PTEST_CASE;
+
+static const TEST_CASE g_Cases[] = {
+    { "KERNEL32.dll", "GetVersion", 0, TEST_KERNEL32, TEST_TEXT + 0x60, TestIatExpected },
+    { "kernel32.dll", "HeapAlloc", 0, TEST_NTDLL, TEST_TEXT + 0x20, TestIatExpected }, // Two hops, "NTDLL.RtlAllocateHeap" last.
+    { "kernel32.dll", "HeapFree", 0, TEST_NTDLL, TEST_TEXT + 0x30, TestIatOutside },
+    { "kernel32.dll", "CloseHandle", 0, TEST_NTDLL, TEST_TEXT + 0x50, TestIatExpected }, // Then "NTDLL.#13".
+    { "kernel32.dll", "", 0x6B, TEST_KERNEL32, TEST_TEXT + 0x70, TestIatExpected },
+    { "kernel32.dll", "", 0x6C, TEST_KERNELBASE, TEST_TEXT + 0x40, TestIatExpected }, // "kernelbase.#3"
+    { "ntdll.dll", "", 13, TEST_NTDLL, TEST_TEXT + 0x50, TestIatExpected },
+    { "ntdll.dll", "", 5, 0, 0, TestIatEmpty }, // Index in the table, not an ordinal.
+    { "ntdll.dll", "", 16, 0, 0, TestIatOutside }, // Past the table.
+    { "ntdll.dll", "ntclose", 0, 0, 0, TestIatLoaded },
+    { "kernel32.dll", "Loop", 0, 0, 0, TestIatOutside }, // loopa -> loopb -> loopa
+    { "kernel32.dll", "Missing", 0, 0, 0, TestIatEmpty }, // Forwarded to a module that is not loaded.
+    { "kernel32.dll", "NotExported", 0, 0, 0, TestIatLoaded },
+    { "kernel32.dll", "LongName", 0, 0, 0, TestIatModuleEnd }, // Forwarder module name too long.
+    { "kernel32.dll", "LocalFree", 0, TEST_KERNELBASE, TEST_TEXT + 0x40, TestIatExpected }, // "KernelBase.dll.LocalFree"
+    { "chain1.dll", "F", 0, TEST_CHAIN + 0x400000, TEST_TEXT + 0x80, TestIatExpected }, // EXPORT_INDEX_MAX_FORWARDS - 1 hops.
+    { "chain0.dll", "F", 0, 0, 0, TestIatLoaded }, // One hop too many.
+    { "api-ms-win-core-heap-l1-1-0.dll", "HeapAlloc", 0, 0, 0, TestIatLoaded },
+    { "api-ms-win-core-heap-l1-1-0.dll", "HeapFree", 0, 0, 0, TestIatOutside },
+    { "kernelbase.dll", "HeapAlloc", 0, TEST_NTDLL, TEST_TEXT + 0x20, TestIatLoaded }, // Into another function.
+    { "KERNELBASE", "LocalFree", 0, TEST_KERNELBASE, TEST_TEXT + 0x40, TestIatExpected },
+};
+
+static
+ULONG64
+GetBase(
+    BOOLEAN Is64Bit,
+    ULONG64 Base
+)
+{
+    return Is64Bit ? (0x7FF000000000ULL + Base) : Base;
+}
+
+static
+VOID
+LoadModule(
+    ExportIndex& Index,
+    ExportIndex::LOADED_MODULE_MAP& Modules,
+    LPCSTR Name,
+    BOOLEAN Is64Bit,
+    ULONG64 Base,
+    ULONG OrdinalBase,
+    ULONG NumberOfFunctions,
+    const vector<TEST_EXPORT>& Exports
+)
+{
+    TestImage Image(Is64Bit, GetBase(Is64Bit, Base));
+    vector<UCHAR> Code(0x1000, 0xC3), Mapped;
+    ExportIndex::LOADED_MODULE Module = { 0 };
+    PEFile File;
+    string Key;
+
+    CHECK(Image.AddSection(".text", IMAGE_SCN_CNT_CODE | IMAGE_SCN_MEM_EXECUTE | IMAGE_SCN_MEM_READ) == TEST_TEXT);
+    Image.Put(Code.data(), (ULONG)Code.size());
+
+    Image.AddSection(".rdata", IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ);
+    Image.AddExports(Name, OrdinalBase, NumberOfFunctions, Exports);
+    Image.GetImage(Mapped);
+
+    File.m_ImageBase = Image.m_ImageBase;
+    CHECK(File.SetImage(Mapped.data(), (ULONG)Mapped.size()));
+    CHECK(File.RtlGetExports());
+
+    //
+    // As CheckImports() fills the list of the loaded modules.
+    //
+    strcpy_s(Module.Name, sizeof(Module.Name), Name);
+    ExportIndex::NormalizeModuleName(Module.Name, sizeof(Module.Name));
+
+    Module.PtrSize = Is64Bit ? sizeof(ULONG64) : sizeof(ULONG);
+    Module.Base = File.m_ImageBase;
+    Module.Size = File.m_ImageSize;
+
+    Index.AddModule(Module.Name, Module.PtrSize, &File);
+
+    ExportIndex::MakeModuleKey(Key, Module.Name, Module.PtrSize);
+    Modules[Key] = Module;
+}
+
+static
+VOID
+LoadModules(
+    ExportIndex& Index,
+    ExportIndex::LOADED_MODULE_MAP& Modules,
+    BOOLEAN Is64Bit
+)
+{
+    CHAR Name[32], Forwarder[32];
+
+    LoadModule(Index, Modules, "ntdll.dll", Is64Bit, TEST_NTDLL, 8, 8, {
+        { "NtClose", 0, TEST_TEXT + 0x10, "" },
+        { "RtlAllocateHeap", 1, TEST_TEXT + 0x20, "" },
+        { "RtlFreeHeap", 2, TEST_TEXT + 0x30, "" },
+        { "", 5, TEST_TEXT + 0x50, "" } // Ordinal 13.
+    });
+
+    LoadModule(Index, Modules, "KernelBase.dll", Is64Bit, TEST_KERNELBASE, 1, 4, {
+        { "CloseHandle", 0, 0, "NTDLL.#13" },
+        { "HeapAlloc", 1, 0, "NTDLL.RtlAllocateHeap" },
+        { "LocalFree", 2, TEST_TEXT + 0x40, "" }
+    });
+
+    LoadModule(Index, Modules, "kernel32.dll", Is64Bit, TEST_KERNEL32, 0x64, 11, {
+        { "CloseHandle", 0, 0, "KERNELBASE.CloseHandle" },
+        { "HeapAlloc", 1, 0, "KERNELBASE.HeapAlloc" },
+        { "HeapFree", 2, 0, "NTDLL.RtlFreeHeap" },
+        { "Loop", 3, 0, "LOOPA.Loop" },
+        { "Missing", 4, 0, "MISSING.Function" },
+        { "NotExported", 5, 0, "NTDLL.NotExported" },
+        { "GetVersion", 6, TEST_TEXT + 0x60, "" },
+        { "", 7, TEST_TEXT + 0x70, "" }, // Ordinal 0x6B.
+        { "", 8, 0, "kernelbase.#3" }, // Ordinal 0x6C.
+        { "LongName", 9, 0, string(64, 'A') + ".F" },
+        { "LocalFree", 10, 0, "KernelBase.dll.LocalFree" }
+    });
+
+    LoadModule(Index, Modules, "loopa.dll", Is64Bit, 0x74000000, 1, 1, { { "Loop", 0, 0, "LOOPB.Loop" } });
+    LoadModule(Index, Modules, "loopb.dll", Is64Bit, 0x73000000, 1, 1, { { "Loop", 0, 0, "loopa.Loop" } });
+
+    for (ULONG i = 0; i < EXPORT_INDEX_MAX_FORWARDS; i += 1)
+    {
+        sprintf_s(Name, sizeof(Name), "chain%u.dll", i);
+        sprintf_s(Forwarder, sizeof(Forwarder), "CHAIN%u.F", i + 1);
+
+        LoadModule(Index, Modules, Name, Is64Bit, TEST_CHAIN + (i * 0x100000), 1, 1, { { "F", 0, 0, Forwarder } });
+    }
+
+    sprintf_s(Name, sizeof(Name), "chain%u.dll", EXPORT_INDEX_MAX_FORWARDS);
+    LoadModule(Index, Modules, Name, Is64Bit, TEST_CHAIN + (EXPORT_INDEX_MAX_FORWARDS * 0x100000), 1, 1, { { "F", 0, TEST_TEXT + 0x80, "" } });
+}
+
+static
+VOID
+TestImports(
+    ExportIndex& Index,
+    ExportIndex::LOADED_MODULE_MAP& Modules,
+    BOOLEAN Is64Bit
+)
+{
+    ArenaScope Scope;
+    TestImage Image(Is64Bit, GetBase(Is64Bit, 0x400000));
+    vector<TEST_IMPORT> Imports;
+    vector<UCHAR> Mapped;
+    PEFile File;
+    ULONG NumberOfHooked = 0;
+    string Key;
+
+    for (ULONG i = 0; i < _countof(g_Cases); i += 1)
+    {
+        TEST_IMPORT Import = { g_Cases[i].ModuleName, g_Cases[i].Name, g_Cases[i].Ordinal, 0 };
+
+        Imports.push_back(Import);
+    }
+
+    Image.AddSection(".rdata", IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ);
+    Image.AddImports(Imports);
+    Image.GetImage(Mapped);
+
+    File.m_ImageBase = Image.m_ImageBase;
+    CHECK(File.SetImage(Mapped.data(), (ULONG)Mapped.size()));
+    CHECK(File.RtlGetImports());
+    CHECK(File.m_ImportThunkSize == (Is64Bit ? sizeof(ULONG64) : sizeof(ULONG)));
+    CHECK(File.m_Imports.size() == _countof(g_Cases));
+    if (File.m_Imports.size() != _countof(g_Cases)) return;
+
+    ExportIndex::MakeModuleKey(Key, "ntdll.dll", File.m_ImportThunkSize);
+
+    //
+    // What RtlReadImportAddresses() would have read from the process.
+    //
+    for (ULONG i = 0; i < _countof(g_Cases); i += 1)
+    {
+        PEFile::PIMPORT_INFO Import = &File.m_Imports[i];
+        ULONG64 Expected = g_Cases[i].Base ? GetBase(Is64Bit, g_Cases[i].Base) + g_Cases[i].Rva : 0;
+
+        CHECK(strcmp(Import->Name, g_Cases[i].Name) == 0);
+        CHECK(Import->Ordinal == g_Cases[i].Ordinal);
+
+        switch (g_Cases[i].Iat)
+        {
+            case TestIatExpected: Import->Address = Expected; break;
+            case TestIatOutside: Import->Address = GetBase(Is64Bit, TEST_OUTSIDE); break;
+            case TestIatLoaded: Import->Address = GetBase(Is64Bit, TEST_NTDLL) + TEST_TEXT + 0x10; break;
+            case TestIatModuleEnd: Import->Address = Modules[Key].Base + Modules[Key].Size; break;
+            case TestIatEmpty: Import->Address = 0; break;
+        }
+    }
+
+    Index.CheckImports(Modules, &File);
+
+    for (ULONG i = 0; i < _countof(g_Cases); i += 1)
+    {
+        PEFile::PIMPORT_INFO Import = &File.m_Imports[i];
+        BOOLEAN IsHooked;
+
+        //
+        // A resolved slot must hold the export, others at least have to point to a module.
+        //
+        if (g_Cases[i].Base) IsHooked = (g_Cases[i].Iat != TestIatExpected);
+        else IsHooked = (g_Cases[i].Iat == TestIatOutside) || (g_Cases[i].Iat == TestIatModuleEnd);
+
+        CHECK(Import->IsResolved == (g_Cases[i].Base != 0));
+        if (g_Cases[i].Base) CHECK(Import->Expected == (GetBase(Is64Bit, g_Cases[i].Base) + g_Cases[i].Rva));
+        CHECK(Import->IsHooked == IsHooked);
+
+        if (IsHooked) NumberOfHooked += 1;
+    }
+
+    CHECK(File.m_NumberOfHookedImports == NumberOfHooked);
+
+    //
+    // Counters are reset by every check.
+    //
+    Index.CheckImports(Modules, &File);
+    CHECK(File.m_NumberOfHookedImports == NumberOfHooked);
+}
+
+//
+// Same modules seen by imports of the other bitness or with another size (side-by-side).
+//
+static
+VOID
+TestModuleKeys(
+    ExportIndex& Index,
+    ExportIndex::LOADED_MODULE_MAP& Modules
+)
+{
+    PEFile::IMPORT_INFO Import = { "kernel32.dll", "GetVersion", 0 };
+    ExportIndex::LOADED_MODULE_MAP Resized = Modules;
+    string Key;
+    ULONG64 Expected;
+
+    CHECK(Index.ResolveImport(Modules, sizeof(ULONG), &Import, &Expected));
+    CHECK(Expected == (TEST_KERNEL32 + TEST_TEXT + 0x60));
+
+    CHECK(Index.ResolveImport(Modules, sizeof(ULONG64), &Import, &Expected));
+    CHECK(Expected == (GetBase(TRUE, TEST_KERNEL32) + TEST_TEXT + 0x60));
+
+    ExportIndex::MakeModuleKey(Key, "kernel32.dll", sizeof(ULONG));
+    Resized[Key].Size += 0x1000;
+    CHECK(!Index.ResolveImport(Resized, sizeof(ULONG), &Import, &Expected));
+    CHECK(Index.ResolveImport(Resized, sizeof(ULONG64), &Import, &Expected));
+
+    ExportIndex::MakeModuleKey(Key, "ntdll.dll", sizeof(ULONG64));
+    Resized.erase(Key);
+    strcpy_s(Import.Name, sizeof(Import.Name), "HeapAlloc");
+    CHECK(!Index.ResolveImport(Resized, sizeof(ULONG64), &Import, &Expected));
+    CHECK(Index.ResolveImport(Modules, sizeof(ULONG64), &Import, &Expected));
+    CHECK(Expected == (GetBase(TRUE, TEST_NTDLL) + TEST_TEXT + 0x20));
+}
+
+int
+main(
+)
+{
+    ArenaScope Scope;
+    ExportIndex Index;
+    ExportIndex::LOADED_MODULE_MAP Modules;
+    CHAR Name[64];
+
+    strcpy_s(Name, sizeof(Name), "NTDLL");
+    ExportIndex::NormalizeModuleName(Name, sizeof(Name));
+    CHECK(strcmp(Name, "ntdll.dll") == 0);
+
+    strcpy_s(Name, sizeof(Name), "Api-MS-Win-Core-Heap-L1-1-0.DLL");
+    ExportIndex::NormalizeModuleName(Name, sizeof(Name));
+    CHECK(strcmp(Name, "api-ms-win-core-heap-l1-1-0.dll") == 0);
+
+    LoadModules(Index, Modules, FALSE);
+    LoadModules(Index, Modules, TRUE);
+
+    TestImports(Index, Modules, FALSE);
+    TestImports(Index, Modules, TRUE);
+    TestModuleKeys(Index, Modules);
+
+    return TestResult("ExportIndex");
+}
@@ -0,0 +1,467 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - ExportsTest.cpp
+
+Abstract:
+
+    - RtlGetExports() and the indexes of RtlBuildExportIndex() on synthetic
+      export directories (TestImage.h): ordinal bases other than 1, unused
+      function slots, functions only exported by ordinal, aliases and
+      forwarders. Every name is looked up, addresses are looked up against
+      a std::map of the exports.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <vector>
+#include <string>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "FuzzyHash.h"
+#include "Entropy.h"
+#include "HashStream.h"
+#include "Arena.h"
+#include "ImageIdentity.h"
+#include "DbgHelpEx.h"
+#include "TestImage.h"
+#include "Test.h"
+
+#define TEST_FUNCTIONS 600
+#define TEST_CODE_SIZE 0x4000
+#define TEST_SEEDS 4
+
+static const ULONG g_Bases[] = { 1, 0, 7, 0x100 };
+
+//
+// What RtlGetExports() must return: the names in the order of the name table (sorted),
+// then the functions without a name in ordinal order, unused slots skipped.
+//
+typedef struct _TEST_EXPECTED {
+    string Name;
+    ULONG Index;
+    ULONG Rva; // Of the code, or 0 for a forwarder.
+    string Forwarder;
+} TEST_EXPECTED, *PTEST_EXPECTED;
+
+static
+VOID
+GetExports(
+    unsigned long long *Seed,
+    ULONG Text,
+    vector<TEST_EXPORT>& Exports
+)
+{
+    CHAR Name[64];
+
+    Exports.clear();
+
+    for (ULONG Index = 0; Index < TEST_FUNCTIONS; Index += 1)
+    {
+        ULONG Kind = TestRandom(Seed) % 10;
+        TEST_EXPORT Export;
+
+        //
+        // 0: unused slot, 1-2: by ordinal only, 3: forwarder, else named, some twice.
+        //
+        if (Kind == 0) continue;
+
+        Export.Index = Index;
+        Export.Rva = Text + (TestRandom(Seed) % (TEST_CODE_SIZE / 16)) * 16; // Some functions share their code.
+
+        if (Kind == 3)
+        {
+            sprintf_s(Name, sizeof(Name), (Index % 2) ? "NTDLL.Rtl%u" : "api-ms-win-core-%u.#%u", Index, Index + 3);
+            Export.Forwarder = Name;
+        }
+
+        if (Kind >= 3)
+        {
+            //
+            // Names that differ by their case or their end, to collide in the name index.
+            //
+            sprintf_s(Name, sizeof(Name), (Index % 3) ? "Function%u" : "function%u", Index);
+            Export.Name = Name;
+        }
+
+        Exports.push_back(Export);
+
+        if (Kind == 9)
+        {
+            sprintf_s(Name, sizeof(Name), "Function%uAlias", Index);
+            Export.Name = Name;
+            Exports.push_back(Export);
+        }
+    }
+}
+
+static
+VOID
+GetExpected(
+    const vector<TEST_EXPORT>& Exports,
+    vector<TEST_EXPECTED>& Expected
+)
+{
+    vector<TEST_EXPECTED> ByOrdinal;
+    vector<BOOLEAN> Named(TEST_FUNCTIONS, FALSE);
+
+    Expected.clear();
+
+    for (ULONG i = 0; i < Exports.size(); i += 1)
+    {
+        TEST_EXPECTED Export = { Exports[i].Name, Exports[i].Index, Exports[i].Forwarder.empty() ? Exports[i].Rva : 0, Exports[i].Forwarder };
+
+        if (Export.Name.empty()) continue;
+
+        Expected.push_back(Export);
+        Named[Export.Index] = TRUE;
+    }
+
+    sort(Expected.begin(), Expected.end(), [](const TEST_EXPECTED& a, const TEST_EXPECTED& b) { return a.Name < b.Name; });
+
+    for (ULONG i = 0; i < Exports.size(); i += 1)
+    {
+        if (Named[Exports[i].Index]) continue;
+
+        TEST_EXPECTED Export = { "", Exports[i].Index, Exports[i].Forwarder.empty() ? Exports[i].Rva : 0, Exports[i].Forwarder };
+
+        Expected.push_back(Export);
+    }
+}
+
+//
+// Closest export at or below Rva that is not a forwarder, the last one in the export
+// list for equal addresses.
+//
+static
+PEFile::PEXPORT_INFO
+FindByAddress(
+    PEFile& File,
+    const map<ULONG64, ULONG>& Addresses,
+    ULONG64 Rva
+)
+{
+    map<ULONG64, ULONG>::const_iterator It = Addresses.upper_bound(Rva);
+
+    if (It == Addresses.begin()) return NULL;
+    --It;
+
+    return &File.m_Exports[It->second];
+}
+
+static
+VOID
+CheckIndexes(
+    PEFile& File,
+    unsigned long long *Seed
+)
+{
+    map<ULONG64, ULONG> Addresses;
+    vector<ULONG> Order(File.m_ExportRvaIndex.begin(), File.m_ExportRvaIndex.end());
+
+    //
+    // The address index is a stable sort of the exports.
+    //
+    CHECK(Order.size() == File.m_Exports.size());
+
+    for (ULONG i = 1; i < Order.size(); i += 1)
+    {
+        PEFile::PEXPORT_INFO Previous = &File.m_Exports[Order[i - 1]];
+        PEFile::PEXPORT_INFO Next = &File.m_Exports[Order[i]];
+
+        CHECK((Previous->Address < Next->Address) || ((Previous->Address == Next->Address) && (Order[i - 1] < Order[i])));
+    }
+
+    sort(Order.begin(), Order.end());
+    for (ULONG i = 0; i < Order.size(); i += 1) CHECK(Order[i] == i);
+
+    for (ULONG i = 0; i < File.m_Exports.size(); i += 1)
+    {
+        if (!File.m_Exports[i].IsForwarder) Addresses[File.m_Exports[i].Address] = i;
+    }
+
+    //
+    // Every export, the bytes around it and random addresses.
+    //
+    for (ULONG i = 0; i < File.m_Exports.size(); i += 1)
+    {
+        for (LONG Delta = -1; Delta <= 1; Delta += 1)
+        {
+            ULONG64 Rva = File.m_Exports[i].Address + Delta;
+
+            CHECK(File.RtlFindExportByAddress(Rva) == FindByAddress(File, Addresses, Rva));
+        }
+    }
+
+    for (ULONG i = 0; i < 10000; i += 1)
+    {
+        ULONG64 Rva = TestRandom(Seed) % (File.m_ImageSize + 0x100);
+
+        CHECK(File.RtlFindExportByAddress(Rva) == FindByAddress(File, Addresses, Rva));
+    }
+
+    CHECK(File.RtlFindExportByAddress(0) == FindByAddress(File, Addresses, 0));
+    CHECK(File.RtlFindExportByAddress(MAXULONG64) == FindByAddress(File, Addresses, MAXULONG64));
+
+    //
+    // Every name, and names that are not exported.
+    //
+    for (ULONG i = 0; i < File.m_Exports.size(); i += 1)
+    {
+        PEFile::PEXPORT_INFO ExportInfo = &File.m_Exports[i];
+        string Name = ExportInfo->Name;
+
+        if (Name.empty()) continue;
+
+        CHECK(File.RtlFindExportByName(ExportInfo->Name) == ExportInfo);
+        CHECK(File.RtlFindExportByName((Name + "X").c_str()) == NULL);
+        CHECK(File.RtlFindExportByName(Name.substr(0, Name.size() - 1).c_str()) != ExportInfo);
+    }
+
+    CHECK(File.RtlFindExportByName("") == NULL);
+    CHECK(File.RtlFindExportByName(NULL) == NULL);
+    CHECK(File.RtlFindExportByName("Function") == NULL);
+}
+
+static
+VOID
+TestExports(
+    BOOLEAN Is64Bit,
+    ULONG Base,
+    unsigned long long Seed
+)
+{
+    ArenaScope Scope;
+    TestImage Image(Is64Bit, Is64Bit ? 0x180000000ULL : 0x10000000ULL);
+    vector<TEST_EXPORT> Exports;
+    vector<TEST_EXPECTED> Expected;
+    vector<UCHAR> Code(TEST_CODE_SIZE, 0xC3), Mapped;
+    PEFile File;
+    ULONG Text, Patched, Hooked, HookedRva, NumberOfHooked = 0;
+
+    Text = Image.AddSection(".text", IMAGE_SCN_CNT_CODE | IMAGE_SCN_MEM_EXECUTE | IMAGE_SCN_MEM_READ);
+
+    GetExports(&Seed, Text, Exports);
+
+    //
+    // One function jumps out of the module (with the ones sharing its code), one slot of
+    // the table points out of it.
+    //
+    Hooked = (ULONG)(find_if(Exports.begin(), Exports.end(), [](const TEST_EXPORT& e) { return e.Forwarder.empty(); }) - Exports.begin());
+    Patched = (ULONG)(find_if(Exports.begin() + Hooked + 1, Exports.end(), [&Exports, Hooked](const TEST_EXPORT& e)
+    {
+        return e.Forwarder.empty() && (e.Rva != Exports[Hooked].Rva);
+    }) - Exports.begin());
+
+    HookedRva = Exports[Hooked].Rva;
+    Code[HookedRva - Text] = 0xE9;
+    *(PULONG)&Code[HookedRva - Text + 1] = 0x40000000;
+
+    Image.Put(Code.data(), (ULONG)Code.size());
+
+    Image.AddSection(".rdata", IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ);
+    Exports[Patched].Rva = 0x7FFF0000;
+    for (ULONG i = 0; i < Exports.size(); i += 1)
+    {
+        if (Exports[i].Index == Exports[Patched].Index) Exports[i].Rva = 0x7FFF0000; // Aliases share the slot.
+    }
+
+    Image.AddExports("test.dll", Base, TEST_FUNCTIONS, Exports);
+    Image.GetImage(Mapped);
+
+    GetExpected(Exports, Expected);
+
+    File.m_ImageBase = Image.m_ImageBase;
+    CHECK(File.SetImage(Mapped.data(), (ULONG)Mapped.size()));
+    CHECK(File.RtlGetExports());
+
+    CHECK(File.m_OrdinalBase == Base);
+    CHECK(File.m_Exports.size() == Expected.size());
+    CHECK(File.m_NumberOfExportedFunctions == Expected.size());
+
+    for (ULONG i = 0; (i < File.m_Exports.size()) && (i < Expected.size()); i += 1)
+    {
+        PEFile::PEXPORT_INFO ExportInfo = &File.m_Exports[i];
+        BOOLEAN IsPatched = (Expected[i].Index == Exports[Patched].Index);
+        BOOLEAN IsHooked = Expected[i].Forwarder.empty() && (Expected[i].Rva == HookedRva);
+
+        CHECK(ExportInfo->Index == i);
+        CHECK(Expected[i].Name == ExportInfo->Name);
+        CHECK(ExportInfo->Ordinal == Expected[i].Index);
+        CHECK((ExportInfo->Ordinal + File.m_OrdinalBase) == (Base + Expected[i].Index));
+        CHECK(ExportInfo->IsForwarder == !Expected[i].Forwarder.empty());
+        CHECK(Expected[i].Forwarder == ExportInfo->Forwarder);
+        CHECK(ExportInfo->IsTablePatched == IsPatched);
+        CHECK(ExportInfo->IsHooked == IsHooked);
+        if (IsHooked) CHECK(ExportInfo->HookTarget > (Image.m_ImageBase + Mapped.size()));
+
+        if (!ExportInfo->IsForwarder) CHECK(ExportInfo->Address == Expected[i].Rva);
+        if (IsPatched || IsHooked) NumberOfHooked += 1;
+    }
+
+    CHECK(NumberOfHooked > 1);
+    CHECK(File.m_NumberOfHookedAPIs == NumberOfHooked);
+
+    CheckIndexes(File, &Seed);
+}
+
+//
+// Directories written wrong: name ordinals past the function table, names out of the
+// image, tables out of the image, functions on the bounds of the directory and image.
+//
+static
+VOID
+TestCorrupted(
+    BOOLEAN Is64Bit
+)
+{
+    unsigned long long Seed = 0x31;
+    ArenaScope Scope;
+    TestImage Image(Is64Bit, 0x10000000ULL);
+    vector<TEST_EXPORT> Exports;
+    vector<UCHAR> Code(TEST_CODE_SIZE, 0xC3), Mapped;
+    PIMAGE_EXPORT_DIRECTORY Directory;
+    PULONG Functions, Names;
+    PUSHORT NameOrdinals;
+    ULONG Text, Rva, DirectoryEnd, BadOrdinal, BadName;
+    ULONG Empty, AtDirectory, AtDirectoryEnd, AtImageEnd;
+
+    Text = Image.AddSection(".text", IMAGE_SCN_CNT_CODE | IMAGE_SCN_MEM_EXECUTE | IMAGE_SCN_MEM_READ);
+    Image.Put(Code.data(), (ULONG)Code.size());
+
+    GetExports(&Seed, Text, Exports);
+
+    Image.AddSection(".rdata", IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ);
+    Rva = Image.AddExports("test.dll", 0x10, TEST_FUNCTIONS, Exports);
+    DirectoryEnd = Image.Put(NULL, 0, 1);
+
+    Image.GetImage(Mapped);
+
+    Directory = (PIMAGE_EXPORT_DIRECTORY)Image.Get(Rva);
+    Functions = (PULONG)Image.Get(Directory->AddressOfFunctions);
+    Names = (PULONG)Image.Get(Directory->AddressOfNames);
+    NameOrdinals = (PUSHORT)Image.Get(Directory->AddressOfNameOrdinals);
+
+    //
+    // Named functions patched to an empty slot, to the start and the end of the directory,
+    // and to the end of the image.
+    //
+    Empty = 20;
+    AtDirectory = 60;
+    AtDirectoryEnd = 100;
+    AtImageEnd = 140;
+
+    CHECK((NameOrdinals[Empty] != NameOrdinals[AtDirectory]) &&
+          (NameOrdinals[Empty] != NameOrdinals[AtDirectoryEnd]) &&
+          (NameOrdinals[Empty] != NameOrdinals[AtImageEnd]) &&
+          (NameOrdinals[AtDirectory] != NameOrdinals[AtDirectoryEnd]) &&
+          (NameOrdinals[AtDirectory] != NameOrdinals[AtImageEnd]) &&
+          (NameOrdinals[AtDirectoryEnd] != NameOrdinals[AtImageEnd]));
+
+    Functions[NameOrdinals[Empty]] = 0;
+    Functions[NameOrdinals[AtDirectory]] = Rva;
+    Functions[NameOrdinals[AtDirectoryEnd]] = DirectoryEnd;
+    Functions[NameOrdinals[AtImageEnd]] = (ULONG)Mapped.size();
+
+    BadOrdinal = 3;
+    BadName = 5;
+    NameOrdinals[BadOrdinal] = TEST_FUNCTIONS;
+    Names[BadName] = 0x7FFFFFF0;
+
+    for (ULONG Case = 0; Case < 3; Case += 1)
+    {
+        PEFile File;
+        PEFile::PEXPORT_INFO ExportInfo;
+        BOOLEAN Unreadable = FALSE;
+
+        if (Case == 1) Directory->AddressOfFunctions = 0x7FFFFFF0;
+        if (Case == 2) Directory->NumberOfNames = 0x40000000;
+
+        Image.GetImage(Mapped);
+
+        File.m_ImageBase = Image.m_ImageBase;
+        CHECK(File.SetImage(Mapped.data(), (ULONG)Mapped.size()));
+
+        if (Case)
+        {
+            CHECK(!File.RtlGetExports());
+            CHECK(File.m_Exports.empty());
+            continue;
+        }
+
+        CHECK(File.RtlGetExports());
+
+        for (ULONG i = 0; i < File.m_Exports.size(); i += 1)
+        {
+            CHECK(File.m_Exports[i].Ordinal < TEST_FUNCTIONS);
+            if (strcmp(File.m_Exports[i].Name, "*unreadable*") == 0) Unreadable = TRUE;
+        }
+
+        CHECK(Unreadable);
+        CHECK(File.RtlFindExportByName("*unreadable*") != NULL);
+
+        ExportInfo = File.RtlFindExportByName((LPCSTR)Image.Get(Names[Empty]));
+        CHECK(ExportInfo && (ExportInfo->Address == 0) && !ExportInfo->IsForwarder);
+
+        ExportInfo = File.RtlFindExportByName((LPCSTR)Image.Get(Names[AtDirectory]));
+        CHECK(ExportInfo && ExportInfo->IsForwarder && !ExportInfo->IsTablePatched);
+
+        ExportInfo = File.RtlFindExportByName((LPCSTR)Image.Get(Names[AtDirectoryEnd]));
+        CHECK(ExportInfo && !ExportInfo->IsForwarder && !ExportInfo->IsTablePatched);
+
+        ExportInfo = File.RtlFindExportByName((LPCSTR)Image.Get(Names[AtImageEnd]));
+        CHECK(ExportInfo && !ExportInfo->IsForwarder && ExportInfo->IsTablePatched);
+
+        CheckIndexes(File, &Seed);
+    }
+}
+
+int
+main(
+)
+{
+    for (ULONG i = 0; i < TEST_SEEDS; i += 1)
+    {
+        TestExports(FALSE, g_Bases[i % _countof(g_Bases)], 0x3100 + i);
+        TestExports(TRUE, g_Bases[(i + 1) % _countof(g_Bases)], 0x3180 + i);
+    }
+
+    TestCorrupted(FALSE);
+    TestCorrupted(TRUE);
+
+    return TestResult("Exports");
+}
@@ -0,0 +1,731 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - FuzzyHashTest.cpp
+
+Abstract:
+
+    - CTPH and TLSH digests of fixed inputs, the streaming CTPH against a
+      naive one pass per blocksize, scores and distances of edited inputs,
+      and the index queries against a comparison with every entry.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <unordered_map>
+using namespace std;
+
+#include "FuzzyHash.h"
+#include "Test.h"
+
+#define TEST_FAMILIES 24
+#define TEST_VARIANTS 3 // Edited copies of every family sample.
+#define TEST_UNRELATED 64
+
+//
+// Digests of the inputs of GetKnownInput(), they were checked against NaiveCtph()
+// when they were recorded.
+//
+typedef struct _TEST_KNOWN_ANSWER {
+    ULONG Input;
+    ULONG Length;
+    LPCSTR Ctph;
+    LPCSTR Tlsh; // "" when the input has no digest.
+} TEST_KNOWN_ANSWER, *PTEST_KNOWN_ANSWER;
+
+static const TEST_KNOWN_ANSWER g_KnownAnswers[] = {
+    { 0, 0, "3::", "" },
+    { 0, 49, "3:Iq103+54vmkCNMK:Iq103+54vmkCNMK", "" },
+    { 1, 4096, "96:IsgAqbubNTrmDr5uumfN/ZjWvAuFObdve5EPLB6t7F/Z27HtFbKQS+VgI:IsVqbu5JpZjWvA9bte5EPLwdF/Z8HtF7", "4B188E75716F1B954B232BB4DCB7D10A42B35CB70D66984E3EE91E84A18DC7C8072B07" },
+    { 2, 4096, "96:KB3Tjrun3IKzq9W9Fy05d9bgUgN+ennQu3GyJ3UAMqxnLrpS:0rE2CcnQPu3I", "9018481FA348BDDCBB7B25C2DC4598CDEB159A73FF2719AAED0D082A91C050C16C8E59" },
+    { 2, 65536, "768:0i2Vx7iZ+QonZywhUaMe2EfNID+mRi5bt0A7TgQnc0odTD1FLVqTfbDSrt1K035B:MvnHozipGQhe0DGaztob37X", "8935361FA358BD9C7B7B21C2DC45D4CDEB199A73FB2729BAAD0D092AE1C051C06C8D49" },
+    { 3, 1 << 20, "1536:e+6Q1xCdgWxZZ0shZa57Jx2jpdOQ5BCanSzhM:J6hgQZ0sPQ7L27L/7SzG", "E05213152D930AF8298E621854C180CFBF56816231BEF1076315BAA791DEB44FDE9C77" },
+};
+
+static const CHAR g_Base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static const LPCSTR g_Words[] = {
+    "process", "thread", "handle", "kernel32", "ntdll", "GetProcAddress", "LoadLibraryA",
+    "VirtualAlloc", "\r\n", " ", "0x", "00000000", "MZ", "PE", ".text", ".data", "\\Device\\",
+    "HKEY_LOCAL_MACHINE", "SOFTWARE", "Microsoft", "Windows", "CurrentVersion", "Run", "svchost.exe"
+};
+
+//
+// 0 is a counter, 1 random bytes, 2 text made of a few words, 3 sparse data: mostly
+// zeroes, as data sections are.
+//
+static
+VOID
+GetKnownInput(
+    ULONG Input,
+    ULONG Length,
+    vector<UCHAR>& Data
+)
+{
+    unsigned long long Seed = 0x38 + Input;
+
+    Data.clear();
+
+    while (Data.size() < Length)
+    {
+        switch (Input)
+        {
+            case 0:
+                Data.push_back((UCHAR)Data.size());
+            break;
+            case 1:
+                Data.push_back((UCHAR)TestRandom(&Seed));
+            break;
+            case 2:
+            {
+                LPCSTR Word = g_Words[TestRandom(&Seed) % _countof(g_Words)];
+
+                Data.insert(Data.end(), Word, Word + strlen(Word));
+            }
+            break;
+            default:
+                Data.push_back(((TestRandom(&Seed) % 16) == 0) ? (UCHAR)TestRandom(&Seed) : 0);
+            break;
+        }
+    }
+
+    Data.resize(Length);
+}
+
+//
+// Pieces of one blocksize, the hash of a piece is reset at every trigger point until
+// Limit - 1 pieces, the last character then covers the rest of the input.
+//
+static
+string
+NaivePart(
+    const vector<UCHAR>& Data,
+    ULONG BlockSize,
+    ULONG Limit,
+    PULONG Triggers
+)
+{
+    UCHAR Window[7] = { 0 };
+    ULONG h1 = 0, h2 = 0, h3 = 0, h = 0;
+    ULONG Piece = 0x28021967;
+    CHAR Pending = '\0';
+    string Part;
+
+    *Triggers = 0;
+
+    for (ULONG i = 0; i < Data.size(); i += 1)
+    {
+        UCHAR c = Data[i];
+
+        h2 = h2 - h1 + (7 * (ULONG)c);
+        h1 = h1 + c - Window[i % 7];
+        Window[i % 7] = c;
+        h3 = (h3 << 5) ^ c;
+        h = h1 + h2 + h3;
+
+        Piece = (Piece * 0x01000193) ^ c;
+
+        if ((h % BlockSize) != (BlockSize - 1)) continue;
+
+        *Triggers += 1;
+
+        if (Part.size() < (Limit - 1))
+        {
+            Part += g_Base64[Piece % 64];
+            Piece = 0x28021967;
+        }
+        else
+        {
+            Pending = g_Base64[Piece % 64];
+        }
+    }
+
+    if (h != 0) Part += g_Base64[Piece % 64];
+    else if (Pending) Part += Pending;
+
+    return Part;
+}
+
+//
+// One pass over the input per blocksize: the first blocksize that fits the input in
+// 64 pieces, halved while it gives less than 32 pieces.
+//
+static
+string
+NaiveCtph(
+    const vector<UCHAR>& Data
+)
+{
+    ULONG BlockSize = 3;
+    ULONG Triggers, Unused;
+    string Part1, Part2;
+    CHAR Prefix[16];
+
+    while (((ULONG64)BlockSize * 64) < Data.size()) BlockSize *= 2;
+
+    for (;;)
+    {
+        Part1 = NaivePart(Data, BlockSize, 64, &Triggers);
+        if ((BlockSize == 3) || (Triggers >= 32)) break;
+
+        BlockSize /= 2;
+    }
+
+    //
+    // The twice larger blocksize is only tracked once this one has a trigger point.
+    //
+    if (Triggers) Part2 = NaivePart(Data, BlockSize * 2, 32, &Unused);
+    else if (!Part1.empty()) Part2 = Part1.substr(Part1.size() - 1);
+
+    sprintf_s(Prefix, sizeof(Prefix), "%u:", BlockSize);
+
+    return Prefix + Part1 + ":" + Part2;
+}
+
+static
+VOID
+GetDigests(
+    const vector<UCHAR>& Data,
+    PFUZZY_DIGESTS Digests
+)
+{
+    FuzzyHash(Data.data(), Data.size(), Digests);
+}
+
+static
+string
+GetTlshString(
+    PTLSH_DIGEST Digest
+)
+{
+    CHAR String[TLSH_STRING_SIZE];
+
+    TlshToString(Digest, String, sizeof(String));
+
+    return String;
+}
+
+//
+// A few bytes overwritten, inserted and deleted at random places.
+//
+static
+VOID
+Edit(
+    vector<UCHAR>& Data,
+    ULONG Edits,
+    unsigned long long *Seed
+)
+{
+    for (ULONG i = 0; i < Edits; i += 1)
+    {
+        ULONG Offset = TestRandom(Seed) % (ULONG)Data.size();
+
+        switch (TestRandom(Seed) % 3)
+        {
+            case 0: Data[Offset] ^= (UCHAR)(1 + (TestRandom(Seed) % 255)); break;
+            case 1: Data.insert(Data.begin() + Offset, (UCHAR)TestRandom(Seed)); break;
+            default: Data.erase(Data.begin() + Offset); break;
+        }
+    }
+}
+
+static
+VOID
+TestKnownAnswers(
+)
+{
+    vector<UCHAR> Data;
+
+    for (ULONG i = 0; i < _countof(g_KnownAnswers); i += 1)
+    {
+        PTEST_KNOWN_ANSWER Answer = (PTEST_KNOWN_ANSWER)&g_KnownAnswers[i];
+        FUZZY_DIGESTS Digests;
+
+        GetKnownInput(Answer->Input, Answer->Length, Data);
+        GetDigests(Data, &Digests);
+
+        CHECK(strcmp(Digests.Ctph, Answer->Ctph) == 0);
+        CHECK(strcmp(Digests.Ctph, NaiveCtph(Data).c_str()) == 0);
+        CHECK(GetTlshString(&Digests.Tlsh) == Answer->Tlsh);
+    }
+}
+
+static
+VOID
+TestStreaming(
+)
+{
+    static const ULONG Lengths[] = { 0, 1, 6, 7, 8, 63, 64, 65, 191, 192, 193, 1000, 4095, 4096, 12289, 100000, 300000 };
+    unsigned long long Seed = 0x3801;
+    vector<UCHAR> Data;
+
+    for (ULONG Input = 0; Input < 4; Input += 1)
+    {
+        for (ULONG i = 0; i < _countof(Lengths); i += 1)
+        {
+            FUZZY_DIGESTS Expected, Digests;
+            FUZZY_CONTEXT Context;
+            ULONG Chunk;
+
+            GetKnownInput(Input, Lengths[i], Data);
+            GetDigests(Data, &Expected);
+
+            CHECK(strcmp(Expected.Ctph, NaiveCtph(Data).c_str()) == 0);
+
+            //
+            // Chunks of random sizes, some of them empty.
+            //
+            FuzzyInit(&Context);
+
+            for (ULONG Offset = 0; Offset < Data.size(); Offset += Chunk)
+            {
+                Chunk = TestRandom(&Seed) % 4096;
+                Chunk = min(Chunk, (ULONG)Data.size() - Offset);
+
+                FuzzyUpdate(&Context, Data.data() + Offset, Chunk);
+            }
+
+            FuzzyFinal(&Context, &Digests);
+
+            CHECK(strcmp(Digests.Ctph, Expected.Ctph) == 0);
+            CHECK(memcmp(&Digests.Tlsh, &Expected.Tlsh, sizeof(TLSH_DIGEST)) == 0);
+        }
+    }
+
+    //
+    // Random lengths and contents, up to blocksizes large enough to fill the 64 pieces.
+    //
+    for (ULONG i = 0; i < 200; i += 1)
+    {
+        ULONG Length = TestRandom(&Seed) % ((i < 150) ? 8192 : 262144);
+        FUZZY_DIGESTS Digests;
+
+        GetKnownInput(1 + (i % 3), Length, Data);
+        Edit(Data, 1 + (i % 8), &Seed);
+        if (i % 2) Data.insert(Data.end(), 8, 0); // The rolling hash ends at 0.
+        GetDigests(Data, &Digests);
+
+        CHECK(strcmp(Digests.Ctph, NaiveCtph(Data).c_str()) == 0);
+    }
+
+    //
+    // The rolling hash of zeroes is 0: no trigger point and no last character.
+    //
+    Data.assign(100000, 0);
+    CHECK(strcmp(NaiveCtph(Data).c_str(), "3::") == 0);
+
+    FUZZY_DIGESTS Zeroes;
+
+    GetDigests(Data, &Zeroes);
+    CHECK(strcmp(Zeroes.Ctph, "3::") == 0);
+    CHECK(!Zeroes.Tlsh.Valid);
+}
+
+static
+VOID
+TestTlsh(
+)
+{
+    unsigned long long Seed = 0x3802;
+    vector<UCHAR> Data;
+    FUZZY_DIGESTS Short, Long, Edited;
+    TLSH_DIGEST Parsed;
+    CHAR String[TLSH_STRING_SIZE];
+
+    GetKnownInput(1, TLSH_MIN_LENGTH - 1, Data);
+    GetDigests(Data, &Short);
+    CHECK(!Short.Tlsh.Valid);
+    CHECK(GetTlshString(&Short.Tlsh).empty());
+
+    GetKnownInput(1, 256, Data);
+    GetDigests(Data, &Short);
+    CHECK(Short.Tlsh.Valid);
+
+    GetKnownInput(2, 65536, Data);
+    GetDigests(Data, &Long);
+    CHECK(Long.Tlsh.Valid);
+    CHECK(Long.Tlsh.Lvalue != Short.Tlsh.Lvalue);
+
+    //
+    // String form and back, the hex digits are accepted in both cases.
+    //
+    TlshToString(&Long.Tlsh, String, sizeof(String));
+    CHECK(strlen(String) == (TLSH_STRING_SIZE - 1));
+    CHECK(TlshFromString(String, &Parsed));
+    CHECK(memcmp(&Parsed, &Long.Tlsh, sizeof(TLSH_DIGEST)) == 0);
+
+    for (ULONG i = 0; String[i]; i += 1) String[i] = (CHAR)tolower(String[i]);
+    CHECK(TlshFromString(String, &Parsed));
+    CHECK(memcmp(&Parsed, &Long.Tlsh, sizeof(TLSH_DIGEST)) == 0);
+
+    String[17] = 'g';
+    CHECK(!TlshFromString(String, &Parsed));
+    CHECK(!Parsed.Valid);
+    CHECK(!TlshFromString("0123", &Parsed));
+
+    CHECK(TlshDistance(&Long.Tlsh, &Long.Tlsh) == 0);
+    CHECK(TlshDistance(&Long.Tlsh, &Short.Tlsh) == TlshDistance(&Short.Tlsh, &Long.Tlsh));
+
+    Edit(Data, 8, &Seed);
+    GetDigests(Data, &Edited);
+    CHECK(TlshDistance(&Long.Tlsh, &Edited.Tlsh) <= 20);
+
+    //
+    // Checksum 1, length 1 (mod 256), Q1 1 (mod 16), Q2 2 - 1 times 12, and the
+    // quartiles of the first buckets: 3 apart counts 6, then 6 + 2 + 1.
+    //
+    TLSH_DIGEST Zero, Other;
+
+    CHECK(TlshFromString("000000" "0000000000000000000000000000000000000000000000000000000000000000", &Zero));
+    CHECK(TlshFromString("01FFF2" "031B000000000000000000000000000000000000000000000000000000000000", &Other));
+    CHECK(TlshDistance(&Zero, &Other) == 30);
+
+    CHECK(TlshFromString("008000" "0000000000000000000000000000000000000000000000000000000000000000", &Other));
+    CHECK(TlshDistance(&Zero, &Other) == (128 * 12));
+}
+
+//
+// Identical inputs score 100 and are at distance 0, a few edits keep them close,
+// unrelated inputs are far apart.
+//
+static
+VOID
+TestScores(
+)
+{
+    unsigned long long Seed = 0x3803;
+
+    for (ULONG i = 0; i < TEST_FAMILIES; i += 1)
+    {
+        vector<UCHAR> Data, Copy, Other;
+        FUZZY_DIGESTS Digests, CopyDigests, OtherDigests;
+        ULONG Length = 16384 + (TestRandom(&Seed) % 65536);
+        ULONG Score;
+
+        GetKnownInput(1 + (i % 3), Length, Data);
+        Data[0] = (UCHAR)i;
+        Edit(Data, 4, &Seed); // Distinct samples for the same input kinds.
+
+        GetDigests(Data, &Digests);
+        CHECK(CtphCompare(Digests.Ctph, Digests.Ctph) == 100);
+        CHECK(TlshDistance(&Digests.Tlsh, &Digests.Tlsh) == 0);
+
+        Copy = Data;
+        GetDigests(Copy, &CopyDigests);
+        CHECK(strcmp(CopyDigests.Ctph, Digests.Ctph) == 0);
+        CHECK(CtphCompare(CopyDigests.Ctph, Digests.Ctph) == 100);
+
+        Edit(Copy, 3, &Seed);
+        GetDigests(Copy, &CopyDigests);
+
+        Score = CtphCompare(Digests.Ctph, CopyDigests.Ctph);
+        CHECK(Score >= 70);
+        CHECK(Score == CtphCompare(CopyDigests.Ctph, Digests.Ctph));
+        CHECK(TlshDistance(&Digests.Tlsh, &CopyDigests.Tlsh) <= 30);
+
+        GetKnownInput(1 + ((i + 1) % 3), Length, Other);
+        GetDigests(Other, &OtherDigests);
+
+        CHECK(CtphCompare(Digests.Ctph, OtherDigests.Ctph) == 0);
+        CHECK(TlshDistance(&Digests.Tlsh, &OtherDigests.Tlsh) > FUZZY_MATCH_MAX_TLSH_DISTANCE);
+    }
+
+    //
+    // One substitution costs 2 over 40 characters: 100 - ((2 * 64 / 40) * 100 / 64),
+    // capped for small blocksizes to 20 per 3 bytes of blocksize.
+    //
+    CHECK(CtphCompare("48:ABCDEFGHIJKLMNOPQRST:", "48:ABCDEFGHIJKLMNOPQRSX:") == 96);
+    CHECK(CtphCompare("48:ABCDEFGHIJKLMNOPQRST:", "48:ABCDEFGHIJKLMNOPQRSTU:") == 99);
+    CHECK(CtphCompare("3:ABCDEFGHIJKLMNOPQRST:", "3:ABCDEFGHIJKLMNOPQRSX:") == 20);
+    CHECK(CtphCompare("12:ABCDEFGHIJKLMNOPQRST:", "12:ABCDEFGHIJKLMNOPQRSX:") == 80);
+    CHECK(CtphCompare("48:xyz:ABCDEFGHIJKLMNOPQRST", "96:ABCDEFGHIJKLMNOPQRSX:xyz") == 96);
+    CHECK(CtphCompare("96:ABCDEFGHIJKLMNOPQRSX:xyz", "48:xyz:ABCDEFGHIJKLMNOPQRST") == 96);
+    CHECK(CtphCompare("48:ABCDEFGHIJKLMNOPQRST:", "192:ABCDEFGHIJKLMNOPQRST:") == 0);
+    CHECK(CtphCompare("48:AAAAAAAAAABCDEFGHIJKLMNOPQRST:", "48:AAABCDEFGHIJKLMNOPQRST:") == 100);
+    CHECK(CtphCompare("48:ABCDEFxHIJKLMxOPQRSTxV:", "48:ABCDEFyHIJKLMyOPQRSTyV:") == 0);
+
+    //
+    // Not digests.
+    //
+    CHECK(CtphCompare("", "3::") == 0);
+    CHECK(CtphCompare("3:abc", "3:abc") == 0);
+    CHECK(CtphCompare("x:abcdefgh:ab", "x:abcdefgh:ab") == 0);
+}
+
+//
+// Every entry that scores or is close enough, in the order of FuzzyIndex::Find().
+//
+static
+VOID
+FindAll(
+    FuzzyIndex& Index,
+    PFUZZY_DIGESTS Digests,
+    ULONG MaxTlshDistance,
+    ULONG MaxResults,
+    vector<FuzzyIndex::FUZZY_MATCH>& Matches
+)
+{
+    Matches.clear();
+
+    for (ULONG i = 0; i < Index.m_Entries.size(); i += 1)
+    {
+        FuzzyIndex::FUZZY_MATCH Match = { i, CtphCompare(Digests->Ctph, Index.m_Entries[i].Digests.Ctph), MAXULONG };
+
+        if (Digests->Tlsh.Valid && Index.m_Entries[i].Digests.Tlsh.Valid)
+        {
+            ULONG Distance = TlshDistance(&Digests->Tlsh, &Index.m_Entries[i].Digests.Tlsh);
+
+            if (Distance <= MaxTlshDistance) Match.TlshDistance = Distance;
+        }
+
+        if (Match.CtphScore || (Match.TlshDistance != MAXULONG)) Matches.push_back(Match);
+    }
+
+    sort(Matches.begin(), Matches.end(), [](const FuzzyIndex::FUZZY_MATCH& a, const FuzzyIndex::FUZZY_MATCH& b)
+    {
+        if (a.CtphScore != b.CtphScore) return a.CtphScore > b.CtphScore;
+        if (a.TlshDistance != b.TlshDistance) return a.TlshDistance < b.TlshDistance;
+        return a.Index < b.Index;
+    });
+
+    if (Matches.size() > MaxResults) Matches.resize(MaxResults);
+}
+
+static
+BOOLEAN
+SameMatches(
+    const vector<FuzzyIndex::FUZZY_MATCH>& Matches1,
+    const vector<FuzzyIndex::FUZZY_MATCH>& Matches2
+)
+{
+    if (Matches1.size() != Matches2.size()) return FALSE;
+
+    for (ULONG i = 0; i < Matches1.size(); i += 1)
+    {
+        if ((Matches1[i].Index != Matches2[i].Index) ||
+            (Matches1[i].CtphScore != Matches2[i].CtphScore) ||
+            (Matches1[i].TlshDistance != Matches2[i].TlshDistance)) return FALSE;
+    }
+
+    return TRUE;
+}
+
+static
+VOID
+TestIndex(
+)
+{
+    unsigned long long Seed = 0x3804;
+    vector<vector<UCHAR>> Samples;
+    vector<FUZZY_DIGESTS> Digests;
+    FuzzyIndex Index, Loaded;
+    char FileName[] = "/tmp/FuzzyHashTest.XXXXXX";
+    FILE *File;
+    ULONG Queries = 0, Found = 0;
+    int Fd;
+
+    //
+    // Families of a sample and its edited variants, with unrelated samples and a few
+    // small ones around the smallest blocksizes.
+    //
+    for (ULONG i = 0; i < TEST_FAMILIES; i += 1)
+    {
+        vector<UCHAR> Data;
+
+        GetKnownInput(1 + (i % 3), 8192 + (TestRandom(&Seed) % 131072), Data);
+        Data[0] = (UCHAR)i;
+        Edit(Data, 4, &Seed);
+        Samples.push_back(Data);
+
+        for (ULONG j = 0; j < TEST_VARIANTS; j += 1)
+        {
+            vector<UCHAR> Variant = Data;
+
+            Edit(Variant, 1 + (j * 4), &Seed);
+            Samples.push_back(Variant);
+        }
+    }
+
+    for (ULONG i = 0; i < TEST_UNRELATED; i += 1)
+    {
+        vector<UCHAR> Data;
+
+        GetKnownInput(1 + (i % 3), (i < 8) ? (TestRandom(&Seed) % 512) : (1024 + (TestRandom(&Seed) % 65536)), Data);
+        Edit(Data, 1 + (TestRandom(&Seed) % 4), &Seed);
+        Samples.push_back(Data);
+    }
+
+    Digests.resize(Samples.size());
+
+    for (ULONG i = 0; i < Samples.size(); i += 1)
+    {
+        CHAR Name[32];
+
+        GetDigests(Samples[i], &Digests[i]);
+
+        sprintf_s(Name, sizeof(Name), "sample%u", i);
+        Index.Add(Name, &Digests[i]);
+    }
+
+    CHECK(Index.m_Entries.size() == Samples.size());
+
+    //
+    // The same entries through a file, names with commas, comments, empty lines, a
+    // CRLF, an entry without TLSH and lines without any digest.
+    //
+    Fd = mkstemp(FileName);
+    CHECK(Fd >= 0);
+    if (Fd >= 0) close(Fd);
+
+    File = fopen(FileName, "w");
+    CHECK(File != NULL);
+
+    if (File)
+    {
+        fprintf(File, "# name,ctph,tlsh\n\n");
+
+        for (ULONG i = 0; i < Samples.size(); i += 1)
+        {
+            fprintf(File, "%s%u,%s,%s%s", (i % 5) ? "sample" : "sample,with,commas", i, Digests[i].Ctph,
+                    (i == 7) ? "" : GetTlshString(&Digests[i].Tlsh).c_str(), (i % 2) ? "\r\n" : "\n");
+        }
+
+        fprintf(File, "no digests,,\n");
+        fprintf(File, "no commas\n");
+        fclose(File);
+    }
+
+    CHECK(Loaded.Load(FileName) == Samples.size());
+    CHECK(Loaded.m_Entries.size() == Samples.size());
+    remove(FileName);
+
+    for (ULONG i = 0; (i < Samples.size()) && (i < Loaded.m_Entries.size()); i += 1)
+    {
+        CHECK(strcmp(Loaded.m_Entries[i].Digests.Ctph, Digests[i].Ctph) == 0);
+
+        if (i == 7) CHECK(!Loaded.m_Entries[i].Digests.Tlsh.Valid);
+        else CHECK(memcmp(&Loaded.m_Entries[i].Digests.Tlsh, &Digests[i].Tlsh, sizeof(TLSH_DIGEST)) == 0);
+    }
+
+    CHECK(Loaded.m_Entries[5].Name == "sample,with,commas5");
+    CHECK(Loaded.m_Entries[6].Name == "sample6");
+
+    //
+    // Every sample, and new edits of the family samples, against a comparison with
+    // every entry.
+    //
+    for (ULONG i = 0; i < Samples.size() + TEST_FAMILIES; i += 1)
+    {
+        vector<FuzzyIndex::FUZZY_MATCH> Matches, Expected;
+        FUZZY_DIGESTS Query;
+        ULONG Family = (i < Samples.size()) ? MAXULONG : ((i - (ULONG)Samples.size()) * (1 + TEST_VARIANTS));
+
+        if (Family == MAXULONG)
+        {
+            Query = Digests[i];
+        }
+        else
+        {
+            vector<UCHAR> Data = Samples[Family];
+
+            Edit(Data, 2, &Seed);
+            GetDigests(Data, &Query);
+        }
+
+        for (ULONG Pass = 0; Pass < 2; Pass += 1)
+        {
+            FuzzyIndex& Queried = Pass ? Loaded : Index;
+            ULONG MaxResults = (i % 3) ? FUZZY_MATCH_MAX_RESULTS : 2;
+
+            Queried.Find(&Query, FUZZY_MATCH_MAX_TLSH_DISTANCE, MaxResults, Matches);
+            FindAll(Queried, &Query, FUZZY_MATCH_MAX_TLSH_DISTANCE, MaxResults, Expected);
+
+            CHECK(SameMatches(Matches, Expected));
+
+            //
+            // The sample itself, or its family sample for the new edits, comes first.
+            //
+            if (Family == MAXULONG)
+            {
+                CHECK(!Matches.empty() && (Matches[0].CtphScore == 100));
+            }
+            else
+            {
+                Queries += 1;
+
+                for (ULONG j = 0; j < Matches.size(); j += 1)
+                {
+                    if (Matches[j].Index == Family) Found += 1;
+                }
+
+                CHECK(!Matches.empty() && ((Matches[0].Index / (1 + TEST_VARIANTS)) == (Family / (1 + TEST_VARIANTS))));
+            }
+        }
+    }
+
+    CHECK(Found == Queries);
+
+    //
+    // TLSH only.
+    //
+    vector<FuzzyIndex::FUZZY_MATCH> Matches, Expected;
+    FUZZY_DIGESTS Query = Digests[1];
+
+    Query.Ctph[0] = '\0';
+    Index.Find(&Query, FUZZY_MATCH_MAX_TLSH_DISTANCE, MAXULONG, Matches);
+    FindAll(Index, &Query, FUZZY_MATCH_MAX_TLSH_DISTANCE, MAXULONG, Expected);
+
+    CHECK(SameMatches(Matches, Expected));
+    CHECK(!Matches.empty() && (Matches[0].Index == 1) && (Matches[0].TlshDistance == 0) && (Matches[0].CtphScore == 0));
+
+    Index.Find(&Query, 0, MAXULONG, Matches);
+    CHECK(!Matches.empty());
+    for (ULONG j = 0; j < Matches.size(); j += 1) CHECK(Matches[j].TlshDistance == 0);
+}
+
+int
+main(
+)
+{
+    TestKnownAnswers();
+    TestStreaming();
+    TestTlsh();
+    TestScores();
+    TestIndex();
+
+    return TestResult("FuzzyHash");
+}
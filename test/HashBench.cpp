@@ -0,0 +1,148 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - HashBench.cpp
+
+Abstract:
+
+    - Throughput in GB/s of MD5, SHA-1 and SHA-256 one by one and of the single
+      pass MultiHash over the same buffer, the driver of the !ms_hash /bench
+      lines outside of the debugger.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <string.h>
+#include <vector>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "Test.h"
+
+#define BENCH_SIZE (64 * 1024 * 1024)
+#define BENCH_RUNS 5
+
+enum {
+    BenchMd5,
+    BenchSha1,
+    BenchSha256,
+    BenchMulti,
+    BenchCount
+};
+
+static
+VOID
+RunHash(
+    ULONG Algorithm,
+    const UCHAR *Data,
+    ULONG Length,
+    PHASH_DIGESTS Digests
+)
+{
+    MD5_CONTEXT Md5;
+    SHA1_CONTEXT Sha1;
+    SHA256_CONTEXT Sha256;
+
+    switch (Algorithm)
+    {
+        case BenchMd5:
+            MD5Init(&Md5);
+            MD5Update(&Md5, (PUCHAR)Data, Length);
+            MD5Final(&Md5);
+            memcpy(Digests->Md5, Md5.Digest, sizeof(Digests->Md5));
+        break;
+
+        case BenchSha1:
+            SHA1Init(&Sha1);
+            SHA1Update(&Sha1, Data, Length);
+            SHA1Final(&Sha1);
+            memcpy(Digests->Sha1, Sha1.Digest, sizeof(Digests->Sha1));
+        break;
+
+        case BenchSha256:
+            SHA256Init(&Sha256);
+            SHA256Update(&Sha256, Data, Length);
+            SHA256Final(&Sha256);
+            memcpy(Digests->Sha256, Sha256.Digest, sizeof(Digests->Sha256));
+        break;
+
+        case BenchMulti:
+            MultiHash(Data, Length, Digests);
+        break;
+    }
+}
+
+int
+main(
+)
+{
+    static const LPCSTR Names[] = { "MD5", "SHA1", "SHA256", "MD5+SHA1+SHA256" };
+    vector<UCHAR> Buffer(BENCH_SIZE);
+    HASH_DIGESTS Separate, Multi;
+    double Best[BenchCount];
+    ULONG Features = GetHashFeatures();
+
+    for (ULONG i = 0; i < BENCH_SIZE; i += 1) Buffer[i] = (UCHAR)((i * 2654435761UL) >> 24);
+
+    for (ULONG Algorithm = 0; Algorithm < BenchCount; Algorithm += 1)
+    {
+        Best[Algorithm] = 0.0;
+
+        for (ULONG Run = 0; Run < BENCH_RUNS; Run += 1)
+        {
+            double Start = TestSeconds();
+
+            RunHash(Algorithm, &Buffer[0], BENCH_SIZE, (Algorithm == BenchMulti) ? &Multi : &Separate);
+
+            double Seconds = TestSeconds() - Start;
+            if (!Best[Algorithm] || (Seconds < Best[Algorithm])) Best[Algorithm] = Seconds;
+        }
+    }
+
+    printf("Hash throughput (%d MB, best of %d, SHA-NI: %s, AVX2: %s):\n",
+           BENCH_SIZE / (1024 * 1024), BENCH_RUNS,
+           (Features & HASH_FEATURE_SHANI) ? "Yes" : "No",
+           (Features & HASH_FEATURE_AVX2) ? "Yes" : "No");
+
+    for (ULONG Algorithm = 0; Algorithm < BenchCount; Algorithm += 1)
+    {
+        printf("    %-16s %6.0f ms  %5.2f GB/s\n",
+               Names[Algorithm], Best[Algorithm] * 1000, (BENCH_SIZE / Best[Algorithm]) / 1e9);
+    }
+
+    double Passes = Best[BenchMd5] + Best[BenchSha1] + Best[BenchSha256];
+
+    printf("    %-16s %6.0f ms  %5.2f GB/s\n", "Three passes", Passes * 1000, (BENCH_SIZE / Passes) / 1e9);
+
+    CHECK(memcmp(&Separate, &Multi, sizeof(Multi)) == 0);
+
+    return TestResult("HashBench");
+}
@@ -0,0 +1,273 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - HashStreamTest.cpp
+
+Abstract:
+
+    - HashStream on a fake target with unreadable pages: the "as read"
+      digests are the ones of the zero-filled range, the "readable" ones the
+      ones of the readable pages put end to end, and the unreadable bitmap
+      has the holes. Holes in the first page, across a chunk boundary and in
+      the last page, ranges that do not start on a page, one stream reused.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <string.h>
+#include <functional>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "FuzzyHash.h"
+#include "HashStream.h"
+#include "Test.h"
+
+#define TEST_PAGE_SIZE HASH_STREAM_PAGE_SIZE
+#define TEST_BASE 0x7FF600000000ULL
+#define TEST_PAGES ((5 * HASH_STREAM_CHUNK_SIZE) / TEST_PAGE_SIZE)
+
+static vector<UCHAR> g_Target; // TEST_PAGES pages at TEST_BASE.
+static vector<BOOLEAN> g_Unreadable; // Per page of g_Target.
+
+//
+// Same contract as ReadVirtualPages(): one Hole call per unreadable page.
+//
+static
+ULONG
+ReadTarget(
+    ULONG64 Address,
+    PUCHAR Buffer,
+    ULONG Size,
+    const HashStream::HOLE_ROUTINE& Hole
+)
+{
+    ULONG NumberOfHoles = 0;
+
+    for (ULONG Offset = 0; Offset < Size; )
+    {
+        ULONG64 Current = Address + Offset;
+        ULONG Page = (ULONG)((Current - TEST_BASE) / TEST_PAGE_SIZE);
+        ULONG PageEnd = (ULONG)(((TEST_BASE + ((ULONG64)(Page + 1) * TEST_PAGE_SIZE)) - Address));
+
+        if (PageEnd > Size) PageEnd = Size;
+
+        if (g_Unreadable[Page])
+        {
+            RtlZeroMemory(Buffer + Offset, PageEnd - Offset);
+            Hole(Offset, PageEnd - Offset);
+            NumberOfHoles += 1;
+        }
+        else
+        {
+            memcpy(Buffer + Offset, &g_Target[(SIZE_T)(Current - TEST_BASE)], PageEnd - Offset);
+        }
+
+        Offset = PageEnd;
+    }
+
+    return NumberOfHoles;
+}
+
+typedef struct _TEST_RANGE {
+    LPCSTR Name;
+    ULONG Offset; // From TEST_BASE.
+    ULONG Size;
+    ULONG Holes[6]; // Unreadable pages relative to the page of Offset, ~0 ends the list.
+} TEST_RANGE, *PTEST_RANGE;
+
+#define TEST_CHUNK_PAGES (HASH_STREAM_CHUNK_SIZE / TEST_PAGE_SIZE)
+#define TEST_END ((ULONG)~0)
+
+static const TEST_RANGE g_Ranges[] = {
+    { "No hole", 0, (2 * HASH_STREAM_CHUNK_SIZE) + TEST_PAGE_SIZE, { TEST_END } },
+    { "First page", 0, (2 * HASH_STREAM_CHUNK_SIZE) + TEST_PAGE_SIZE, { 0, TEST_END } },
+    { "Across a chunk", 0, (2 * HASH_STREAM_CHUNK_SIZE) + TEST_PAGE_SIZE, { TEST_CHUNK_PAGES - 1, TEST_CHUNK_PAGES, TEST_END } },
+    { "Last page", 0, (2 * HASH_STREAM_CHUNK_SIZE) + TEST_PAGE_SIZE, { 2 * TEST_CHUNK_PAGES, TEST_END } },
+    { "All three", 0, (2 * HASH_STREAM_CHUNK_SIZE) + TEST_PAGE_SIZE, { 0, TEST_CHUNK_PAGES - 1, TEST_CHUNK_PAGES, (2 * TEST_CHUNK_PAGES) - 1, 2 * TEST_CHUNK_PAGES, TEST_END } },
+    { "Unaligned", 0x123, (2 * HASH_STREAM_CHUNK_SIZE) + 0x2345, { 0, TEST_CHUNK_PAGES, (2 * TEST_CHUNK_PAGES) + 2, TEST_END } },
+    { "One chunk", 0x10000, HASH_STREAM_CHUNK_SIZE, { 3, TEST_END } },
+    { "One page", 0x20000, TEST_PAGE_SIZE, { TEST_END } },
+    { "Unreadable page", 0x20000, 0x800, { 0, TEST_END } },
+    { "Unreadable", 0, 5 * TEST_PAGE_SIZE, { 0, 1, 2, 3, 4, TEST_END } },
+    { "Long", 0x1000, (4 * HASH_STREAM_CHUNK_SIZE) - 0x1000, { 7, (2 * TEST_CHUNK_PAGES) - 1, (4 * TEST_CHUNK_PAGES) - 2, TEST_END } }
+};
+
+static
+VOID
+TestRange(
+    HashStream *Streams[],
+    ULONG NumberOfStreams,
+    const TEST_RANGE *Range
+)
+{
+    ULONG64 Address = TEST_BASE + Range->Offset;
+    ULONG FirstPage = Range->Offset / TEST_PAGE_SIZE;
+    ULONG NumberOfPages = ((Range->Offset + Range->Size + TEST_PAGE_SIZE - 1) / TEST_PAGE_SIZE) - FirstPage;
+    ULONG NumberOfHoles = 0;
+    vector<UCHAR> AsRead(g_Target.begin() + Range->Offset, g_Target.begin() + Range->Offset + Range->Size);
+    vector<UCHAR> Readable;
+    HASH_DIGESTS ExpectedAsRead, ExpectedReadable;
+    FUZZY_DIGESTS ExpectedFuzzy;
+    STREAM_DIGESTS Digests;
+
+    g_Unreadable.assign(TEST_PAGES, FALSE);
+
+    for (ULONG i = 0; Range->Holes[i] != TEST_END; i += 1)
+    {
+        g_Unreadable[FirstPage + Range->Holes[i]] = TRUE;
+        NumberOfHoles += 1;
+    }
+
+    //
+    // Expected digests, page by page of the range.
+    //
+    for (ULONG Offset = 0; Offset < Range->Size; )
+    {
+        ULONG Page = (Range->Offset + Offset) / TEST_PAGE_SIZE;
+        ULONG PageEnd = min(((Page + 1) * TEST_PAGE_SIZE) - Range->Offset, Range->Size);
+
+        if (g_Unreadable[Page]) memset(&AsRead[Offset], 0, PageEnd - Offset);
+        else Readable.insert(Readable.end(), AsRead.begin() + Offset, AsRead.begin() + PageEnd);
+
+        Offset = PageEnd;
+    }
+
+    MultiHash(&AsRead[0], AsRead.size(), &ExpectedAsRead);
+    MultiHash(Readable.size() ? &Readable[0] : NULL, Readable.size(), &ExpectedReadable);
+    FuzzyHash(&AsRead[0], AsRead.size(), &ExpectedFuzzy);
+
+    for (ULONG i = 0; i < NumberOfStreams; i += 1)
+    {
+        HashStream& Stream = *Streams[i];
+
+        CHECK(Stream.HashVirtual(Address, Range->Size, &Digests));
+
+        if (memcmp(&Digests.AsRead, &ExpectedAsRead, sizeof(HASH_DIGESTS)) ||
+            memcmp(&Digests.Readable, &ExpectedReadable, sizeof(HASH_DIGESTS)))
+        {
+            printf("       %s: different digests\n", Range->Name);
+        }
+
+        CHECK(memcmp(&Digests.AsRead, &ExpectedAsRead, sizeof(HASH_DIGESTS)) == 0);
+        CHECK(memcmp(&Digests.Readable, &ExpectedReadable, sizeof(HASH_DIGESTS)) == 0);
+        CHECK(strcmp(Digests.Fuzzy.Ctph, ExpectedFuzzy.Ctph) == 0);
+        CHECK(memcmp(&Digests.Fuzzy.Tlsh, &ExpectedFuzzy.Tlsh, sizeof(TLSH_DIGEST)) == 0);
+
+        CHECK(Digests.Size == Range->Size);
+        CHECK(Digests.NumberOfPages == NumberOfPages);
+        CHECK(Digests.NumberOfUnreadablePages == NumberOfHoles);
+
+        CHECK(Stream.m_UnreadableBitmap.size() == ((NumberOfPages + 7) / 8));
+
+        for (ULONG Page = 0; Page < NumberOfPages; Page += 1)
+        {
+            CHECK(Stream.IsPageReadable(Page) == !g_Unreadable[FirstPage + Page]);
+        }
+
+        CHECK(!Stream.IsPageReadable(((NumberOfPages + 7) / 8) * 8));
+    }
+}
+
+//
+// One stream for every range, as !ms_process /vads /hashes does, and a stream per range.
+//
+static
+VOID
+TestRanges(
+)
+{
+    HashStream Shared(ReadTarget);
+
+    for (ULONG i = 0; i < _countof(g_Ranges); i += 1)
+    {
+        HashStream Stream(ReadTarget);
+        HashStream *Streams[] = { &Stream, &Shared };
+
+        TestRange(Streams, _countof(Streams), &g_Ranges[i]);
+    }
+}
+
+//
+// The holes are reported by the reader from the engine thread while the previous chunk is
+// being hashed, from random ranges.
+//
+static
+VOID
+TestRandomHoles(
+)
+{
+    HashStream Stream(ReadTarget);
+    HashStream *Streams[] = { &Stream };
+    unsigned long long Seed = 0x35;
+
+    for (ULONG Run = 0; Run < 8; Run += 1)
+    {
+        TEST_RANGE Range = { "Random", 0, 0, { TEST_END } };
+        ULONG Holes = TestRandom(&Seed) % _countof(Range.Holes);
+
+        Range.Offset = TestRandom(&Seed) % HASH_STREAM_CHUNK_SIZE;
+        Range.Size = 1 + (TestRandom(&Seed) % ((2 * HASH_STREAM_CHUNK_SIZE) + 0x3000));
+
+        ULONG NumberOfPages = ((Range.Offset + Range.Size + TEST_PAGE_SIZE - 1) / TEST_PAGE_SIZE) - (Range.Offset / TEST_PAGE_SIZE);
+
+        for (ULONG i = 0, Count = 0; i < Holes; i += 1)
+        {
+            ULONG Page = TestRandom(&Seed) % NumberOfPages;
+            ULONG j;
+
+            for (j = 0; (j < Count) && (Range.Holes[j] != Page); j += 1);
+            if (j < Count) continue;
+
+            Range.Holes[Count++] = Page;
+            Range.Holes[Count] = TEST_END;
+        }
+
+        TestRange(Streams, _countof(Streams), &Range);
+    }
+}
+
+int
+main(
+)
+{
+    unsigned long long Seed = 0x53;
+
+    g_Target.resize((SIZE_T)TEST_PAGES * TEST_PAGE_SIZE);
+    for (SIZE_T i = 0; i < g_Target.size(); i += 1) g_Target[i] = (UCHAR)TestRandom(&Seed);
+
+    TestRanges();
+    TestRandomHoles();
+
+    return TestResult("HashStream");
+}
@@ -0,0 +1,298 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - HashTest.cpp
+
+Abstract:
+
+    - SHA-1 and SHA-256 against the FIPS 180 examples, and the digests of
+      messages of every length up to 300 bytes and around the slice size
+      against digests computed by another implementation (XOR of all digests).
+    - MultiHash, MultiHashUpdate in random pieces and MultiHashBatch against
+      the one-algorithm contexts and the MD5 reference.
+    - Built with and without the SHA-NI code paths.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <string.h>
+#include <vector>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "Test.h"
+
+#if HASH_SHANI_SUPPORT
+#define TEST_NAME "Hash"
+#define TEST_PATHS ""
+#else
+#define TEST_NAME "Hash (scalar SHA)"
+#define TEST_PATHS " (SHA-NI paths not built)"
+#endif
+
+static const ULONG g_Lengths[] = { 1000, 4095, 4096, 16 * 1024 - 1, 16 * 1024, 16 * 1024 + 1, 65543, 1000000 };
+
+//
+// XOR of the digests of the messages of g_Lengths and of 0 to 299 bytes, from Python hashlib.
+//
+static const UCHAR g_Md5Xor[MD5_DIGEST_SIZE] = {
+    0x74, 0x8E, 0xF9, 0xBF, 0xD3, 0x02, 0x7F, 0x22, 0x77, 0xA1, 0xB3, 0xDC, 0x16, 0x2E, 0xC3, 0x3F
+};
+
+static const UCHAR g_Sha1Xor[SHA1_DIGEST_SIZE] = {
+    0x7F, 0xB9, 0xC3, 0xDD, 0x4E, 0x00, 0x82, 0x49, 0xE2, 0x95, 0xC0, 0x60, 0x5D, 0x7F, 0xE8, 0x43,
+    0x65, 0xFF, 0xD9, 0xF6
+};
+
+static const UCHAR g_Sha256Xor[SHA256_DIGEST_SIZE] = {
+    0xEB, 0x0A, 0x50, 0x25, 0xC9, 0x1A, 0x0A, 0x25, 0xC9, 0x0B, 0x9E, 0x03, 0xAE, 0xFE, 0xDE, 0xD9,
+    0xFE, 0x5D, 0xC4, 0xBB, 0x9F, 0x29, 0xB6, 0xAF, 0xE8, 0xDA, 0xD3, 0xB9, 0xAF, 0x2D, 0x32, 0x6E
+};
+
+static vector<UCHAR> g_Data;
+
+static
+VOID
+InitData(
+)
+{
+    g_Data.resize(1000000);
+
+    for (ULONG i = 0; i < g_Data.size(); i += 1) g_Data[i] = (UCHAR)((i * 131) + (i >> 8));
+}
+
+static
+VOID
+GetMd5(
+    const UCHAR *Data,
+    ULONG Length,
+    PUCHAR Digest
+)
+{
+    MD5_CONTEXT Context;
+
+    MD5Init(&Context);
+    MD5Update(&Context, (PUCHAR)Data, Length);
+    MD5Final(&Context);
+
+    memcpy(Digest, Context.Digest, MD5_DIGEST_SIZE);
+}
+
+static
+VOID
+XorDigest(
+    PUCHAR Result,
+    const UCHAR *Digest,
+    ULONG Size
+)
+{
+    for (ULONG i = 0; i < Size; i += 1) Result[i] ^= Digest[i];
+}
+
+static
+BOOLEAN
+CheckHex(
+    const UCHAR *Digest,
+    ULONG Size,
+    LPCSTR Hex
+)
+{
+    CHAR Buffer[2 * SHA256_DIGEST_SIZE + 1];
+
+    for (ULONG i = 0; i < Size; i += 1) sprintf_s(Buffer + (2 * i), 3, "%02x", Digest[i]);
+
+    return strcmp(Buffer, Hex) == 0;
+}
+
+static
+VOID
+TestVectors(
+)
+{
+    static const UCHAR Abc[] = "abc";
+    static const UCHAR Long[] = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    vector<UCHAR> Million(1000000, 'a');
+    SHA1_CONTEXT Sha1;
+    SHA256_CONTEXT Sha256;
+
+    SHA1Init(&Sha1);
+    SHA1Update(&Sha1, Abc, 3);
+    SHA1Final(&Sha1);
+    CHECK(CheckHex(Sha1.Digest, SHA1_DIGEST_SIZE, "a9993e364706816aba3e25717850c26c9cd0d89d"));
+
+    SHA1Init(&Sha1);
+    SHA1Update(&Sha1, Long, sizeof(Long) - 1);
+    SHA1Final(&Sha1);
+    CHECK(CheckHex(Sha1.Digest, SHA1_DIGEST_SIZE, "84983e441c3bd26ebaae4aa1f95129e5e54670f1"));
+
+    SHA1Init(&Sha1);
+    SHA1Update(&Sha1, &Million[0], Million.size());
+    SHA1Final(&Sha1);
+    CHECK(CheckHex(Sha1.Digest, SHA1_DIGEST_SIZE, "34aa973cd4c4daa4f61eeb2bdbad27316534016f"));
+
+    SHA256Init(&Sha256);
+    SHA256Update(&Sha256, Abc, 3);
+    SHA256Final(&Sha256);
+    CHECK(CheckHex(Sha256.Digest, SHA256_DIGEST_SIZE, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"));
+
+    SHA256Init(&Sha256);
+    SHA256Update(&Sha256, Long, sizeof(Long) - 1);
+    SHA256Final(&Sha256);
+    CHECK(CheckHex(Sha256.Digest, SHA256_DIGEST_SIZE, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"));
+
+    SHA256Init(&Sha256);
+    SHA256Update(&Sha256, &Million[0], Million.size());
+    SHA256Final(&Sha256);
+    CHECK(CheckHex(Sha256.Digest, SHA256_DIGEST_SIZE, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"));
+}
+
+//
+// Every message goes through MultiHash, the result must be the digests of the reference implementations.
+//
+static
+VOID
+TestLengths(
+)
+{
+    vector<ULONG> Lengths;
+    HASH_DIGESTS Xor;
+    BOOLEAN SameMd5 = TRUE;
+
+    RtlZeroMemory(&Xor, sizeof(Xor));
+
+    for (ULONG Length = 0; Length < 300; Length += 1) Lengths.push_back(Length);
+    Lengths.insert(Lengths.end(), g_Lengths, g_Lengths + _countof(g_Lengths));
+
+    for (ULONG i = 0; i < Lengths.size(); i += 1)
+    {
+        HASH_DIGESTS Digests;
+        UCHAR Md5[MD5_DIGEST_SIZE];
+
+        MultiHash(&g_Data[0], Lengths[i], &Digests);
+        GetMd5(&g_Data[0], Lengths[i], Md5);
+
+        if (memcmp(Md5, Digests.Md5, MD5_DIGEST_SIZE)) SameMd5 = FALSE;
+
+        XorDigest(Xor.Md5, Digests.Md5, MD5_DIGEST_SIZE);
+        XorDigest(Xor.Sha1, Digests.Sha1, SHA1_DIGEST_SIZE);
+        XorDigest(Xor.Sha256, Digests.Sha256, SHA256_DIGEST_SIZE);
+    }
+
+    CHECK(SameMd5);
+    CHECK(memcmp(Xor.Md5, g_Md5Xor, MD5_DIGEST_SIZE) == 0);
+    CHECK(memcmp(Xor.Sha1, g_Sha1Xor, SHA1_DIGEST_SIZE) == 0);
+    CHECK(memcmp(Xor.Sha256, g_Sha256Xor, SHA256_DIGEST_SIZE) == 0);
+}
+
+//
+// Streaming in pieces of random sizes, across block and slice boundaries.
+//
+static
+VOID
+TestUpdates(
+)
+{
+    unsigned long long Seed = 0x33;
+
+    for (ULONG Run = 0; Run < 50; Run += 1)
+    {
+        MULTI_HASH_CONTEXT Context;
+        HASH_DIGESTS Digests, Expected;
+        ULONG Length = TestRandom(&Seed) % (Run < 25 ? 1000 : (ULONG)g_Data.size());
+        ULONG Offset = 0;
+
+        MultiHashInit(&Context);
+
+        while (Offset < Length)
+        {
+            ULONG Piece = TestRandom(&Seed) % ((Run & 1) ? 130 : 40000);
+
+            Piece = min(Piece, Length - Offset);
+            MultiHashUpdate(&Context, &g_Data[Offset], Piece);
+            Offset += Piece;
+        }
+
+        MultiHashFinal(&Context, &Digests);
+        MultiHash(&g_Data[0], Length, &Expected);
+
+        CHECK(memcmp(&Digests, &Expected, sizeof(Digests)) == 0);
+    }
+}
+
+static
+VOID
+TestBatch(
+)
+{
+    unsigned long long Seed = 0x34;
+    vector<HASH_JOB> Jobs(500);
+    ULONG Different = 0;
+
+    for (ULONG i = 0; i < Jobs.size(); i += 1)
+    {
+        Jobs[i].Data = &g_Data[TestRandom(&Seed) % 1000];
+        Jobs[i].Length = (i % 50) ? (TestRandom(&Seed) % 2000) : (TestRandom(&Seed) % 100000);
+    }
+
+    MultiHashBatch(&Jobs[0], (ULONG)Jobs.size());
+
+    for (ULONG i = 0; i < Jobs.size(); i += 1)
+    {
+        HASH_DIGESTS Expected;
+
+        MultiHash(Jobs[i].Data, Jobs[i].Length, &Expected);
+        if (memcmp(&Jobs[i].Digests, &Expected, sizeof(Expected))) Different += 1;
+    }
+
+    CHECK(Different == 0);
+
+    MultiHashBatch(NULL, 0);
+}
+
+int
+main(
+)
+{
+    ULONG Features = GetHashFeatures();
+
+    printf("       hash features:%s%s%s\n",
+           (Features & HASH_FEATURE_AVX2) ? " AVX2" : "",
+           (Features & HASH_FEATURE_SHANI) ? " SHA-NI" : "",
+           TEST_PATHS);
+
+    InitData();
+    TestVectors();
+    TestLengths();
+    TestUpdates();
+    TestBatch();
+
+    return TestResult(TEST_NAME);
+}
@@ -0,0 +1,301 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - HiveMapCacheTest.cpp
+
+Abstract:
+
+    - HiveMapCache against fake hive memory: small hives whose map is the
+      SmallDir of the _DUAL, directory entries read on demand, and cached
+      failures.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <string.h>
+#include <map>
+#include <vector>
+using namespace std;
+
+#include "HiveMapCache.h"
+#include "Test.h"
+
+#define TEST_ENTRY_SIZE 0x18 // _HMAP_ENTRY, BlockAddress at 8.
+#define TEST_BLOCK_ADDRESS_OFFSET 8
+#define TEST_CELL_HEADER_SIZE sizeof(LONG)
+
+//
+// Fake memory from TEST_MEMORY_BASE: the _HMAP_TABLEs, then a full directory, then the
+// SmallDir of a small hive as the last pointer of the memory, nothing can be read past it.
+//
+#define TEST_MEMORY_BASE 0x10000ULL
+#define TEST_TABLES_OFFSET 0
+#define TEST_NUMBER_OF_TABLES 2
+#define TEST_DIRECTORY_OFFSET (TEST_NUMBER_OF_TABLES * HIVE_MAP_TABLE_SIZE * TEST_ENTRY_SIZE)
+#define TEST_SMALL_DIR_OFFSET (TEST_DIRECTORY_OFFSET + (HIVE_MAP_DIRECTORY_SIZE * sizeof(ULONG64)))
+#define TEST_MEMORY_SIZE (TEST_SMALL_DIR_OFFSET + sizeof(ULONG64))
+
+#define TEST_LARGE_HIVE 0x1000ULL
+#define TEST_SMALL_HIVE 0x2000ULL
+#define TEST_BAD_HIVE 0x3000ULL
+
+//
+// Directory entries of the large hive: two tables, a null one, one that cannot be read.
+//
+#define TEST_TABLE 5
+#define TEST_SECOND_TABLE 6
+#define TEST_NULL_TABLE 7
+#define TEST_UNREADABLE_TABLE 8
+
+typedef struct _FAKE_HIVES {
+    vector<UCHAR> Memory;
+    ULONG Loads;
+    ULONG Reads;
+} FAKE_HIVES, *PFAKE_HIVES;
+
+static
+ULONG64
+GetTableAddress(
+    ULONG Table
+)
+{
+    return TEST_MEMORY_BASE + TEST_TABLES_OFFSET + ((ULONG64)Table * HIVE_MAP_TABLE_SIZE * TEST_ENTRY_SIZE);
+}
+
+static
+ULONG64
+GetBlockAddress(
+    ULONG Table,
+    ULONG Block
+)
+{
+    return 0xFFFFF8A000000000ULL | ((ULONG64)Table << 24) | ((ULONG64)Block << 12);
+}
+
+static
+VOID
+InitFakeHives(
+    PFAKE_HIVES Hives
+)
+{
+    ULONG64 Pointer;
+
+    Hives->Memory.assign(TEST_MEMORY_SIZE, 0);
+    Hives->Loads = 0;
+    Hives->Reads = 0;
+
+    for (ULONG Table = 0; Table < TEST_NUMBER_OF_TABLES; Table += 1)
+    {
+        for (ULONG Block = 0; Block < HIVE_MAP_TABLE_SIZE; Block += 1)
+        {
+            Pointer = GetBlockAddress(Table, Block);
+            memcpy(&Hives->Memory[(SIZE_T)(GetTableAddress(Table) - TEST_MEMORY_BASE) + (Block * TEST_ENTRY_SIZE) + TEST_BLOCK_ADDRESS_OFFSET],
+                   &Pointer, sizeof(Pointer));
+        }
+    }
+
+    Pointer = GetTableAddress(0);
+    memcpy(&Hives->Memory[TEST_DIRECTORY_OFFSET + (TEST_TABLE * sizeof(ULONG64))], &Pointer, sizeof(Pointer));
+    memcpy(&Hives->Memory[TEST_SMALL_DIR_OFFSET], &Pointer, sizeof(Pointer));
+
+    Pointer = GetTableAddress(1);
+    memcpy(&Hives->Memory[TEST_DIRECTORY_OFFSET + (TEST_SECOND_TABLE * sizeof(ULONG64))], &Pointer, sizeof(Pointer));
+
+    Pointer = TEST_MEMORY_BASE + TEST_MEMORY_SIZE;
+    memcpy(&Hives->Memory[TEST_DIRECTORY_OFFSET + (TEST_UNREADABLE_TABLE * sizeof(ULONG64))], &Pointer, sizeof(Pointer));
+}
+
+static
+BOOLEAN
+FakeLoadLayout(
+    PVOID Context,
+    ULONG64 Hive,
+    HiveMapCache::PHIVE_MAP_LAYOUT Layout
+)
+{
+    PFAKE_HIVES Hives = (PFAKE_HIVES)Context;
+
+    Hives->Loads += 1;
+
+    if (Hive == TEST_LARGE_HIVE)
+    {
+        Layout->Directory[0] = TEST_MEMORY_BASE + TEST_DIRECTORY_OFFSET;
+        Layout->DirectorySize[0] = HIVE_MAP_DIRECTORY_SIZE;
+    }
+    else if (Hive == TEST_SMALL_HIVE)
+    {
+        Layout->Directory[0] = TEST_MEMORY_BASE + TEST_SMALL_DIR_OFFSET;
+        Layout->DirectorySize[0] = 1;
+    }
+    else
+    {
+        return FALSE;
+    }
+
+    Layout->Directory[1] = 0; // No volatile storage.
+    Layout->DirectorySize[1] = 0;
+    Layout->PointerSize = sizeof(ULONG64);
+    Layout->EntrySize = TEST_ENTRY_SIZE;
+    Layout->BlockAddressOffset = TEST_BLOCK_ADDRESS_OFFSET;
+    Layout->CellHeaderSize = TEST_CELL_HEADER_SIZE;
+
+    return TRUE;
+}
+
+static
+BOOLEAN
+FakeReadMap(
+    PVOID Context,
+    ULONG64 Address,
+    PVOID Buffer,
+    ULONG Size
+)
+{
+    PFAKE_HIVES Hives = (PFAKE_HIVES)Context;
+
+    Hives->Reads += 1;
+
+    if ((Address < TEST_MEMORY_BASE) || ((Address - TEST_MEMORY_BASE + Size) > Hives->Memory.size())) return FALSE;
+
+    memcpy(Buffer, &Hives->Memory[(SIZE_T)(Address - TEST_MEMORY_BASE)], Size);
+    return TRUE;
+}
+
+static
+ULONG
+GetCellIndex(
+    ULONG Type,
+    ULONG Table,
+    ULONG Block,
+    ULONG Offset
+)
+{
+    return (Type << HCELL_TYPE_SHIFT) | (Table << HCELL_TABLE_SHIFT) | (Block << HCELL_BLOCK_SHIFT) | Offset;
+}
+
+//
+// The SmallDir is the last readable pointer: reading a whole directory from it fails.
+//
+static
+VOID
+TestSmallHive(
+)
+{
+    FAKE_HIVES Hives;
+    InitFakeHives(&Hives);
+    HiveMapCache Cache(FakeLoadLayout, FakeReadMap, &Hives);
+    ULONG Reads;
+
+    CHECK(Cache.GetCellAddress(TEST_SMALL_HIVE, GetCellIndex(0, 0, 3, 0x20)) == GetBlockAddress(0, 3) + 0x20 + TEST_CELL_HEADER_SIZE);
+    CHECK(Cache.GetCellAddress(TEST_SMALL_HIVE, GetCellIndex(0, 0, 511, 0xFF8)) == GetBlockAddress(0, 511) + 0xFF8 + TEST_CELL_HEADER_SIZE);
+    CHECK(Cache.m_Stats.Tables == 1);
+    CHECK(Cache.m_Stats.Hits == 1);
+
+    //
+    // Past SmallDir and in the missing volatile storage: nothing is read.
+    //
+    Reads = Hives.Reads;
+    CHECK(Cache.GetCellAddress(TEST_SMALL_HIVE, GetCellIndex(0, 1, 0, 0x20)) == 0);
+    CHECK(Cache.GetCellAddress(TEST_SMALL_HIVE, GetCellIndex(1, 0, 0, 0x20)) == 0);
+    CHECK(Hives.Reads == Reads);
+    CHECK(Cache.m_Stats.Failures == 2);
+}
+
+//
+// Only the directory entries of the cells are read, failures are not read again.
+//
+static
+VOID
+TestLargeHive(
+)
+{
+    FAKE_HIVES Hives;
+    InitFakeHives(&Hives);
+    HiveMapCache Cache(FakeLoadLayout, FakeReadMap, &Hives);
+    ULONG Reads;
+
+    CHECK(Cache.GetCellAddress(TEST_LARGE_HIVE, GetCellIndex(0, TEST_TABLE, 7, 0x100)) == GetBlockAddress(0, 7) + 0x100 + TEST_CELL_HEADER_SIZE);
+    CHECK(Cache.GetCellAddress(TEST_LARGE_HIVE, GetCellIndex(0, TEST_SECOND_TABLE, 9, 0)) == GetBlockAddress(1, 9) + TEST_CELL_HEADER_SIZE);
+    CHECK(Hives.Reads == 4); // Two directory entries, two tables.
+    CHECK(Cache.m_Stats.Tables == 2);
+
+    for (ULONG i = 0; i < 3; i += 1)
+    {
+        CHECK(Cache.GetCellAddress(TEST_LARGE_HIVE, GetCellIndex(0, TEST_NULL_TABLE, 0, 0)) == 0);
+        CHECK(Cache.GetCellAddress(TEST_LARGE_HIVE, GetCellIndex(0, TEST_UNREADABLE_TABLE, 0, 0)) == 0);
+    }
+
+    CHECK(Hives.Reads == 4 + 1 + 2); // Null entry, then entry and table once.
+    CHECK(Cache.m_Stats.Failures == 6);
+    CHECK(Cache.m_Stats.Tables == 2);
+
+    //
+    // Flush() forgets the failures.
+    //
+    Cache.Flush();
+    Reads = Hives.Reads;
+    CHECK(Cache.GetCellAddress(TEST_LARGE_HIVE, GetCellIndex(0, TEST_NULL_TABLE, 0, 0)) == 0);
+    CHECK(Hives.Reads == Reads + 1);
+    CHECK(Hives.Loads == 2);
+}
+
+//
+// A hive whose layout cannot be loaded is not loaded again.
+//
+static
+VOID
+TestBadHive(
+)
+{
+    FAKE_HIVES Hives;
+    InitFakeHives(&Hives);
+    HiveMapCache Cache(FakeLoadLayout, FakeReadMap, &Hives);
+
+    for (ULONG i = 0; i < 4; i += 1)
+    {
+        CHECK(Cache.GetCellAddress(TEST_BAD_HIVE, GetCellIndex(0, 0, 0, 0x20)) == 0);
+        CHECK(Cache.GetCellAddress(TEST_SMALL_HIVE, GetCellIndex(0, 0, 0, 0x20)) == GetBlockAddress(0, 0) + 0x20 + TEST_CELL_HEADER_SIZE);
+    }
+
+    CHECK(Hives.Loads == 2);
+    CHECK(Cache.m_Stats.Failures == 4);
+    CHECK(Cache.m_Stats.Hives == 2);
+}
+
+int
+main(
+)
+{
+    TestSmallHive();
+    TestLargeHive();
+    TestBadHive();
+
+    return TestResult("HiveMapCache");
+}
@@ -0,0 +1,377 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - ImageIdentityTest.cpp
+
+Abstract:
+
+    - Image identities of the same DLLs mapped in two synthetic processes: the pages
+      the loader writes in each process (import address table, guard pointers, data)
+      differ, the identities must not, and the cache lookups of the second process
+      must all hit. A patched code page must still miss.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <string.h>
+#include <map>
+#include <vector>
+using namespace std;
+
+#include "ImageIdentity.h"
+#include "Test.h"
+
+#define TEST_PAGE_SIZE IMAGE_IDENTITY_PAGE_SIZE
+#define TEST_NUMBER_OF_IMAGES 32
+
+//
+// Layout of the synthetic images, in pages.
+//
+#define TEST_TEXT_PAGE 1 // 3 pages, RX
+#define TEST_RDATA_PAGE 4 // 3 pages, R: IAT at the start, debug directory, load config.
+#define TEST_DATA_PAGE 7 // RW
+#define TEST_CFG_PAGE 8 // R, guard check and dispatch pointers.
+#define TEST_NUMBER_OF_PAGES 9
+
+#define TEST_IAT_SIZE 0x200
+#define TEST_DEBUG_RVA ((TEST_RDATA_PAGE + 1) * TEST_PAGE_SIZE)
+#define TEST_CV_RVA (TEST_DEBUG_RVA + 0x100)
+#define TEST_CONFIG_RVA ((TEST_RDATA_PAGE + 2) * TEST_PAGE_SIZE)
+
+typedef struct _TEST_IMAGE {
+    ULONG64 Base;
+    vector<UCHAR> Memory;
+} TEST_IMAGE, *PTEST_IMAGE;
+
+typedef struct _TEST_PROCESS {
+    vector<TEST_IMAGE> *Images;
+    ULONG Id;
+    ULONG64 PatchedPage; // Base of a code page copied on write, 0 if none.
+    ULONG64 MissingPage; // Base of a page that is not resident, 0 if none.
+} TEST_PROCESS, *PTEST_PROCESS;
+
+static
+VOID
+BuildImage(
+    PTEST_IMAGE Image,
+    ULONG Index,
+    BOOLEAN Is64
+)
+{
+    PIMAGE_DOS_HEADER DosHeader;
+    PIMAGE_FILE_HEADER FileHeader;
+    PIMAGE_DATA_DIRECTORY DataDirectory;
+    PIMAGE_SECTION_HEADER Sections;
+    PIMAGE_DEBUG_DIRECTORY Debug;
+    PCV_INFO_PDB70 CvInfo;
+    PUCHAR Memory;
+    ULONG OptionalSize;
+
+    Image->Base = (Is64 ? 0x7FF800000000ULL : 0x10000000ULL) + ((ULONG64)Index * 0x100000);
+    Image->Memory.assign(TEST_NUMBER_OF_PAGES * TEST_PAGE_SIZE, 0);
+    Memory = Image->Memory.data();
+
+    DosHeader = (PIMAGE_DOS_HEADER)Memory;
+    DosHeader->e_magic = IMAGE_DOS_SIGNATURE;
+    DosHeader->e_lfanew = 0x80;
+
+    *(PULONG)(Memory + 0x80) = IMAGE_NT_SIGNATURE;
+    FileHeader = (PIMAGE_FILE_HEADER)(Memory + 0x84);
+    FileHeader->NumberOfSections = 4;
+    FileHeader->TimeDateStamp = 0x5E000000 + Index;
+
+    if (Is64)
+    {
+        PIMAGE_OPTIONAL_HEADER64 Optional = (PIMAGE_OPTIONAL_HEADER64)(FileHeader + 1);
+
+        Optional->Magic = IMAGE_NT_OPTIONAL_HDR64_MAGIC;
+        Optional->ImageBase = Image->Base;
+        Optional->SizeOfImage = TEST_NUMBER_OF_PAGES * TEST_PAGE_SIZE;
+        Optional->SizeOfHeaders = 0x400;
+        Optional->NumberOfRvaAndSizes = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+        DataDirectory = Optional->DataDirectory;
+        OptionalSize = sizeof(*Optional);
+    }
+    else
+    {
+        PIMAGE_OPTIONAL_HEADER32 Optional = (PIMAGE_OPTIONAL_HEADER32)(FileHeader + 1);
+
+        Optional->Magic = IMAGE_NT_OPTIONAL_HDR32_MAGIC;
+        Optional->ImageBase = (ULONG)Image->Base;
+        Optional->SizeOfImage = TEST_NUMBER_OF_PAGES * TEST_PAGE_SIZE;
+        Optional->SizeOfHeaders = 0x400;
+        Optional->NumberOfRvaAndSizes = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+        DataDirectory = Optional->DataDirectory;
+        OptionalSize = sizeof(*Optional);
+    }
+
+    FileHeader->SizeOfOptionalHeader = (USHORT)OptionalSize;
+
+    DataDirectory[IMAGE_DIRECTORY_ENTRY_IAT].VirtualAddress = TEST_RDATA_PAGE * TEST_PAGE_SIZE;
+    DataDirectory[IMAGE_DIRECTORY_ENTRY_IAT].Size = TEST_IAT_SIZE;
+    DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG].VirtualAddress = TEST_DEBUG_RVA;
+    DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG].Size = sizeof(IMAGE_DEBUG_DIRECTORY);
+    DataDirectory[IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG].VirtualAddress = TEST_CONFIG_RVA;
+    DataDirectory[IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG].Size = 0x100;
+
+    Sections = (PIMAGE_SECTION_HEADER)((PUCHAR)(FileHeader + 1) + OptionalSize);
+
+    memcpy(Sections[0].Name, ".text", 5);
+    Sections[0].VirtualAddress = TEST_TEXT_PAGE * TEST_PAGE_SIZE;
+    Sections[0].Misc.VirtualSize = 3 * TEST_PAGE_SIZE;
+    Sections[0].Characteristics = IMAGE_SCN_CNT_CODE | IMAGE_SCN_MEM_EXECUTE | IMAGE_SCN_MEM_READ;
+
+    memcpy(Sections[1].Name, ".rdata", 6);
+    Sections[1].VirtualAddress = TEST_RDATA_PAGE * TEST_PAGE_SIZE;
+    Sections[1].Misc.VirtualSize = 3 * TEST_PAGE_SIZE;
+    Sections[1].Characteristics = IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ;
+
+    memcpy(Sections[2].Name, ".data", 5);
+    Sections[2].VirtualAddress = TEST_DATA_PAGE * TEST_PAGE_SIZE;
+    Sections[2].Misc.VirtualSize = TEST_PAGE_SIZE;
+    Sections[2].Characteristics = IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ | IMAGE_SCN_MEM_WRITE;
+
+    memcpy(Sections[3].Name, ".00cfg", 6);
+    Sections[3].VirtualAddress = TEST_CFG_PAGE * TEST_PAGE_SIZE;
+    Sections[3].Misc.VirtualSize = 0x10;
+    Sections[3].Characteristics = IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ;
+
+    Debug = (PIMAGE_DEBUG_DIRECTORY)(Memory + TEST_DEBUG_RVA);
+    Debug->Type = IMAGE_DEBUG_TYPE_CODEVIEW;
+    Debug->AddressOfRawData = TEST_CV_RVA;
+
+    CvInfo = (PCV_INFO_PDB70)(Memory + TEST_CV_RVA);
+    CvInfo->Signature = CV_SIGNATURE_RSDS;
+    CvInfo->Guid.Data1 = 0xC0DE0000 + Index;
+    CvInfo->Age = 1;
+
+    //
+    // Load config: size, then the two guard pointers of .00cfg.
+    //
+    *(PULONG)(Memory + TEST_CONFIG_RVA) = 0x100;
+
+    if (Is64)
+    {
+        *(PULONG64)(Memory + TEST_CONFIG_RVA + LOAD_CONFIG64_GUARD_CHECK_OFFSET) = Image->Base + (TEST_CFG_PAGE * TEST_PAGE_SIZE);
+        *(PULONG64)(Memory + TEST_CONFIG_RVA + LOAD_CONFIG64_GUARD_DISPATCH_OFFSET) = Image->Base + (TEST_CFG_PAGE * TEST_PAGE_SIZE) + 8;
+    }
+    else
+    {
+        *(PULONG)(Memory + TEST_CONFIG_RVA + LOAD_CONFIG32_GUARD_CHECK_OFFSET) = (ULONG)(Image->Base + (TEST_CFG_PAGE * TEST_PAGE_SIZE));
+        *(PULONG)(Memory + TEST_CONFIG_RVA + LOAD_CONFIG32_GUARD_DISPATCH_OFFSET) = (ULONG)(Image->Base + (TEST_CFG_PAGE * TEST_PAGE_SIZE) + 4);
+    }
+
+    for (ULONG Offset = 0; Offset < 3 * TEST_PAGE_SIZE; Offset += 1)
+    {
+        Memory[(TEST_TEXT_PAGE * TEST_PAGE_SIZE) + Offset] = (UCHAR)((Offset * 7) + Index);
+    }
+}
+
+static
+PTEST_IMAGE
+FindImage(
+    PTEST_PROCESS Process,
+    ULONG64 Address
+)
+{
+    for (TEST_IMAGE& Image : *Process->Images)
+    {
+        if ((Address >= Image.Base) && (Address < (Image.Base + Image.Memory.size()))) return &Image;
+    }
+
+    return NULL;
+}
+
+static
+BOOLEAN
+ReadProcess(
+    PVOID Context,
+    ULONG64 Address,
+    PVOID Buffer,
+    ULONG Size
+)
+{
+    PTEST_PROCESS Process = (PTEST_PROCESS)Context;
+    PTEST_IMAGE Image = FindImage(Process, Address);
+
+    if (!Image || ((Address + Size) > (Image->Base + Image->Memory.size()))) return FALSE;
+
+    memcpy(Buffer, &Image->Memory[(size_t)(Address - Image->Base)], Size);
+    return TRUE;
+}
+
+//
+// Shared pages have the same physical address in every process, the pages the loader writes
+// (IAT, .data, .00cfg) and a patched page are private copies.
+//
+static
+BOOLEAN
+TranslateProcess(
+    PVOID Context,
+    ULONG64 Address,
+    PULONG64 PhysicalAddress
+)
+{
+    PTEST_PROCESS Process = (PTEST_PROCESS)Context;
+    PTEST_IMAGE Image = FindImage(Process, Address);
+    ULONG64 Page = Address & ~((ULONG64)TEST_PAGE_SIZE - 1);
+    ULONG64 Index;
+    BOOLEAN Private;
+
+    if (!Image || (Page == Process->MissingPage)) return FALSE;
+
+    Index = (Page - Image->Base) / TEST_PAGE_SIZE;
+    Private = ((Index == TEST_RDATA_PAGE) || (Index == TEST_DATA_PAGE) || (Index == TEST_CFG_PAGE) ||
+               (Page == Process->PatchedPage)) ? TRUE : FALSE;
+
+    *PhysicalAddress = (Image->Base >> 8) + (Index * TEST_PAGE_SIZE);
+    if (Private) *PhysicalAddress += (ULONG64)(Process->Id + 1) << 40;
+
+    return TRUE;
+}
+
+static
+VOID
+TestPages(
+    BOOLEAN Is64
+)
+{
+    vector<TEST_IMAGE> Images(1);
+    TEST_PROCESS Process = { &Images, 0, 0, 0 };
+    IMAGE_IDENTITY Identity;
+
+    BuildImage(&Images[0], 0, Is64);
+
+    CHECK(GetImageIdentity(Images[0].Base, ReadProcess, TranslateProcess, &Process, &Identity));
+    CHECK(Identity.Key.SizeOfImage == TEST_NUMBER_OF_PAGES * TEST_PAGE_SIZE);
+    CHECK(Identity.Key.TimeDateStamp == 0x5E000000);
+    CHECK(Identity.Key.PdbGuid.Data1 == 0xC0DE0000);
+    CHECK(Identity.Key.PdbAge == 1);
+    CHECK(Identity.Pages.size() == TEST_NUMBER_OF_PAGES);
+
+    if (Identity.Pages.size() != TEST_NUMBER_OF_PAGES) return;
+
+    //
+    // Headers, code and the read-only pages without loader writes are compared.
+    //
+    CHECK(Identity.Pages[0] != IMAGE_CACHE_PAGE_PRIVATE);
+    for (ULONG Page = TEST_TEXT_PAGE; Page < TEST_TEXT_PAGE + 3; Page += 1) CHECK(Identity.Pages[Page] != IMAGE_CACHE_PAGE_PRIVATE);
+    CHECK(Identity.Pages[TEST_RDATA_PAGE + 1] != IMAGE_CACHE_PAGE_PRIVATE);
+    CHECK(Identity.Pages[TEST_RDATA_PAGE + 2] != IMAGE_CACHE_PAGE_PRIVATE);
+
+    CHECK(Identity.Pages[TEST_RDATA_PAGE] == IMAGE_CACHE_PAGE_PRIVATE);
+    CHECK(Identity.Pages[TEST_DATA_PAGE] == IMAGE_CACHE_PAGE_PRIVATE);
+    CHECK(Identity.Pages[TEST_CFG_PAGE] == IMAGE_CACHE_PAGE_PRIVATE);
+
+    CHECK(!HasPrivatePages(&Identity, TEST_TEXT_PAGE * TEST_PAGE_SIZE, 3 * TEST_PAGE_SIZE));
+    CHECK(HasPrivatePages(&Identity, TEST_RDATA_PAGE * TEST_PAGE_SIZE, 3 * TEST_PAGE_SIZE));
+    CHECK(!HasPrivatePages(&Identity, (TEST_RDATA_PAGE + 1) * TEST_PAGE_SIZE, TEST_PAGE_SIZE));
+    CHECK(!HasPrivatePages(&Identity, 0, 0));
+
+    //
+    // Not resident: compared as invalid, not skipped.
+    //
+    Process.MissingPage = Images[0].Base + (TEST_TEXT_PAGE * TEST_PAGE_SIZE);
+    CHECK(GetImageIdentity(Images[0].Base, ReadProcess, TranslateProcess, &Process, &Identity));
+    CHECK(Identity.Pages[TEST_TEXT_PAGE] == IMAGE_CACHE_PAGE_INVALID);
+
+    Process.MissingPage = 0;
+    CHECK(!GetImageIdentity(Images[0].Base + TEST_PAGE_SIZE, ReadProcess, TranslateProcess, &Process, &Identity));
+    CHECK(!GetImageIdentity(0, ReadProcess, TranslateProcess, &Process, &Identity));
+}
+
+//
+// Same lookup as ImageCache::Load(): same key, then same pages.
+//
+static
+ULONG
+LookupAll(
+    map<IMAGE_CACHE_KEY, vector<ULONG64>>& Cache,
+    PTEST_PROCESS Process,
+    BOOLEAN Insert
+)
+{
+    ULONG Hits = 0;
+
+    for (TEST_IMAGE& Image : *Process->Images)
+    {
+        IMAGE_IDENTITY Identity;
+        map<IMAGE_CACHE_KEY, vector<ULONG64>>::iterator It;
+
+        if (!GetImageIdentity(Image.Base, ReadProcess, TranslateProcess, Process, &Identity)) continue;
+
+        It = Cache.find(Identity.Key);
+        if ((It != Cache.end()) && (It->second == Identity.Pages)) Hits += 1;
+        else if (Insert) Cache[Identity.Key] = Identity.Pages;
+    }
+
+    return Hits;
+}
+
+static
+VOID
+TestHitRate(
+)
+{
+    vector<TEST_IMAGE> Images(TEST_NUMBER_OF_IMAGES);
+    TEST_PROCESS First = { &Images, 0, 0, 0 };
+    TEST_PROCESS Second = { &Images, 1, 0, 0 };
+    map<IMAGE_CACHE_KEY, vector<ULONG64>> Cache;
+    ULONG Hits;
+
+    for (ULONG Index = 0; Index < TEST_NUMBER_OF_IMAGES; Index += 1) BuildImage(&Images[Index], Index, (Index & 1) ? TRUE : FALSE);
+
+    CHECK(LookupAll(Cache, &First, TRUE) == 0);
+    CHECK(Cache.size() == TEST_NUMBER_OF_IMAGES);
+
+    //
+    // Every DLL of the second process is served from the cache.
+    //
+    Hits = LookupAll(Cache, &Second, FALSE);
+    printf("       image cache: %u/%u hits in the second process\n", Hits, TEST_NUMBER_OF_IMAGES);
+    CHECK(Hits == TEST_NUMBER_OF_IMAGES);
+
+    //
+    // A patched code page is a private copy: the image has to be parsed again.
+    //
+    Second.PatchedPage = Images[3].Base + ((TEST_TEXT_PAGE + 1) * TEST_PAGE_SIZE);
+    CHECK(LookupAll(Cache, &Second, FALSE) == TEST_NUMBER_OF_IMAGES - 1);
+}
+
+int
+main(
+)
+{
+    TestPages(FALSE);
+    TestPages(TRUE);
+    TestHitRate();
+
+    return TestResult("ImageIdentity");
+}
@@ -0,0 +1,463 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - IntegrityTest.cpp
+
+Abstract:
+
+    - ImageIntegrity on a synthetic image (TestImage.h), 32 and 64-bit: the
+      reference is the file layout, memory is the mapped layout relocated
+      by the test, with its IAT filled and its data section written. An
+      untouched image compares clean, with or without a relocation delta,
+      and a single patched byte is reported at its RVA. The IAT, writable
+      sections and non-resident pages are not compared.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <string>
+using namespace std;
+
+#include "ImageIdentity.h"
+#include "Integrity.h"
+#include "TestImage.h"
+#include "Test.h"
+
+#define TEST_CODE_PAGES 3
+#define TEST_POINTER_STEP 0x1F3 // Between relocated pointers, more than INTEGRITY_PATCH_GAP, odd and even offsets.
+
+typedef struct _TEST_PE {
+    BOOLEAN Is64Bit;
+    ULONG64 PreferredBase;
+    vector<UCHAR> File;
+    vector<UCHAR> Image; // Mapped layout, at the preferred base.
+    vector<ULONG> Relocations;
+    vector<TEST_IMPORT> Imports;
+    ULONG Text, TextEnd; // Raw data of the compared sections.
+    ULONG RData, RDataEnd;
+    ULONG Data;
+    ULONG NumberOfPages; // Compared.
+} TEST_PE, *PTEST_PE;
+
+static vector<UCHAR> g_Memory; // Loaded image.
+static ULONG64 g_LoadBase;
+static vector<BOOLEAN> g_Unreadable; // Per page of g_Memory.
+
+//
+// Same contract as ReadVirtualPages(): one Hole call per unreadable page.
+//
+static
+ULONG
+ReadTarget(
+    ULONG64 Address,
+    PUCHAR Buffer,
+    ULONG Size,
+    const ImageIntegrity::HOLE_ROUTINE& Hole
+)
+{
+    ULONG NumberOfHoles = 0;
+
+    for (ULONG Offset = 0; Offset < Size; )
+    {
+        ULONG64 Rva = (Address + Offset) - g_LoadBase;
+        ULONG Page = (ULONG)(Rva / INTEGRITY_PAGE_SIZE);
+        ULONG PageEnd = (ULONG)((((ULONG64)(Page + 1) * INTEGRITY_PAGE_SIZE) - Rva) + Offset);
+
+        if (PageEnd > Size) PageEnd = Size;
+
+        if ((Rva >= g_Memory.size()) || g_Unreadable[Page])
+        {
+            RtlZeroMemory(Buffer + Offset, PageEnd - Offset);
+            Hole(Offset, PageEnd - Offset);
+            NumberOfHoles += 1;
+        }
+        else
+        {
+            memcpy(Buffer + Offset, &g_Memory[(SIZE_T)Rva], PageEnd - Offset);
+        }
+
+        Offset = PageEnd;
+    }
+
+    return NumberOfHoles;
+}
+
+static
+VOID
+GetPe(
+    BOOLEAN Is64Bit,
+    PTEST_PE Pe
+)
+{
+    static const LPCSTR Names[] = { "ExAllocatePoolWithTag", "ExFreePoolWithTag", "KeBugCheckEx", "RtlInitUnicodeString" };
+    unsigned long long Seed = Is64Bit ? 0x3664 : 0x3632;
+    ULONG PointerSize = Is64Bit ? sizeof(ULONG64) : sizeof(ULONG);
+    TestImage Image(Is64Bit, Is64Bit ? 0x140000000ULL : 0x400000ULL);
+    vector<UCHAR> Code(TEST_CODE_PAGES * TEST_IMAGE_SECTION_ALIGNMENT);
+    ULONG CodeSize = (ULONG)Code.size() - 0x123; // Raw data ends before the last page.
+    vector<ULONG> Pointers;
+    ULONG64 Table[8];
+
+    Pe->Is64Bit = Is64Bit;
+    Pe->PreferredBase = Image.m_ImageBase;
+    Pe->Relocations.clear();
+    Pe->Imports.clear();
+
+    //
+    // Code with absolute pointers into the image, one of them across a page boundary.
+    //
+    Pe->Text = Image.AddSection(".text", IMAGE_SCN_CNT_CODE | IMAGE_SCN_MEM_EXECUTE | IMAGE_SCN_MEM_READ);
+
+    for (ULONG i = 0; i < Code.size(); i += 1) Code[i] = (UCHAR)TestRandom(&Seed);
+
+    for (ULONG Offset = 0x10; (Offset + PointerSize) <= CodeSize; Offset += TEST_POINTER_STEP) Pointers.push_back(Offset);
+    Pointers.push_back(TEST_IMAGE_SECTION_ALIGNMENT - 2);
+
+    for (ULONG i = 0; i < Pointers.size(); i += 1)
+    {
+        ULONG64 Va = Pe->PreferredBase + Pe->Text + (TestRandom(&Seed) % CodeSize);
+
+        memcpy(&Code[Pointers[i]], &Va, PointerSize);
+        Pe->Relocations.push_back(Pe->Text + Pointers[i]);
+    }
+
+    Image.Put(Code.data(), CodeSize);
+
+    //
+    // Imports and a table of pointers in read-only data.
+    //
+    Pe->RData = Image.AddSection(".rdata", IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ);
+
+    for (ULONG i = 0; i < _countof(Names); i += 1)
+    {
+        TEST_IMPORT Import;
+
+        Import.ModuleName = (i < 2) ? "ntoskrnl.exe" : "HAL.dll";
+        Import.Name = Names[i];
+        Import.Ordinal = i;
+        Pe->Imports.push_back(Import);
+    }
+
+    Image.AddImports(Pe->Imports);
+
+    for (ULONG i = 0; i < _countof(Table); i += 1) Table[i] = Pe->PreferredBase + Pe->Text + (i * 0x40);
+
+    for (ULONG i = 0, Rva = Image.Put(NULL, sizeof(Table), PointerSize); i < _countof(Table); i += 1)
+    {
+        memcpy(Image.Get(Rva + (i * PointerSize)), &Table[i], PointerSize);
+        Pe->Relocations.push_back(Rva + (i * PointerSize));
+    }
+
+    Pe->Data = Image.AddSection(".data", IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ | IMAGE_SCN_MEM_WRITE);
+    Image.Put(Code.data(), 0x300);
+
+    Image.AddSection(".reloc", IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ | IMAGE_SCN_MEM_DISCARDABLE);
+    Image.AddRelocations(Pe->Relocations);
+
+    Image.GetImage(Pe->Image);
+    Image.GetFile(Pe->File);
+
+    //
+    // Raw data is compared, up to the file alignment.
+    //
+    Pe->TextEnd = Pe->Text + Image.GetSection(0)->SizeOfRawData;
+    Pe->RDataEnd = Pe->RData + Image.GetSection(1)->SizeOfRawData;
+
+    Pe->NumberOfPages = TEST_CODE_PAGES + ((Pe->RDataEnd - Pe->RData + INTEGRITY_PAGE_SIZE - 1) / INTEGRITY_PAGE_SIZE);
+}
+
+//
+// As the loader does: pointers relocated by Delta, IAT filled, data written.
+//
+static
+VOID
+Load(
+    PTEST_PE Pe,
+    LONG64 Delta,
+    BOOLEAN Relocate
+)
+{
+    ULONG PointerSize = Pe->Is64Bit ? sizeof(ULONG64) : sizeof(ULONG);
+
+    g_Memory = Pe->Image;
+    g_LoadBase = Pe->PreferredBase + Delta;
+    g_Unreadable.assign(g_Memory.size() / INTEGRITY_PAGE_SIZE, FALSE);
+
+    for (ULONG i = 0; Relocate && (i < Pe->Relocations.size()); i += 1)
+    {
+        ULONG64 Va = 0;
+
+        memcpy(&Va, &g_Memory[Pe->Relocations[i]], PointerSize);
+        Va += Delta;
+        memcpy(&g_Memory[Pe->Relocations[i]], &Va, PointerSize);
+    }
+
+    for (ULONG i = 0; i < Pe->Imports.size(); i += 1)
+    {
+        ULONG64 Address = 0xFFFFF80000401000ULL + (i * 0x1230);
+
+        memcpy(&g_Memory[Pe->Imports[i].IatRva], &Address, PointerSize);
+    }
+
+    for (ULONG i = 0; i < 0x100; i += 1) g_Memory[Pe->Data + i] ^= 0x5A;
+}
+
+static
+BOOLEAN
+GetPath(
+    LPCSTR FileName,
+    LPWSTR Path,
+    ULONG PathCount
+)
+{
+    return mbstowcs(Path, FileName, PathCount) < PathCount;
+}
+
+static
+INTEGRITY_STATUS
+Check(
+    LPCSTR FileName,
+    ImageIntegrity& Integrity
+)
+{
+    WCHAR Path[MAX_PATH];
+
+    CHECK(GetPath(FileName, Path, _countof(Path)));
+
+    if (Integrity.Capture(g_LoadBase, Path, ReadTarget))
+    {
+        Integrity.Compare();
+        Integrity.Close();
+    }
+
+    return Integrity.m_Status;
+}
+
+static
+VOID
+TestImageIntegrity(
+    BOOLEAN Is64Bit
+)
+{
+    char FileName[] = "/tmp/IntegrityTest.XXXXXX";
+    LONG64 Deltas[] = { 0, 0x120000, -0x10000 };
+    TEST_PE Pe;
+    int Fd;
+
+    GetPe(Is64Bit, &Pe);
+    if (Is64Bit) Deltas[1] = 0x7FF7C0000000LL;
+
+    Fd = mkstemp(FileName);
+    CHECK(Fd >= 0);
+    if (Fd >= 0) close(Fd);
+
+    CHECK(TestImage::WriteFile(FileName, Pe.File));
+
+    for (ULONG d = 0; d < _countof(Deltas); d += 1)
+    {
+        //
+        // Untouched, only the loader wrote to the image.
+        //
+        {
+            ImageIntegrity Integrity;
+
+            Load(&Pe, Deltas[d], TRUE);
+
+            CHECK(Check(FileName, Integrity) == IntegrityClean);
+            CHECK(Integrity.m_Patches.empty());
+            CHECK(Integrity.m_NumberOfPages == Pe.NumberOfPages);
+            CHECK(Integrity.m_NumberOfIdenticalPages == Pe.NumberOfPages);
+            CHECK(Integrity.m_NumberOfNonResidentPages == 0);
+        }
+
+        //
+        // One byte at a time: in the code, in a relocated pointer, across a page, at the
+        // end of the raw data, in the pointer table.
+        //
+        ULONG Rvas[] = { Pe.Text, Pe.Text + 0x10 + 1, Pe.Text + TEST_IMAGE_SECTION_ALIGNMENT - 1,
+                         Pe.Text + TEST_IMAGE_SECTION_ALIGNMENT + 1, Pe.TextEnd - 1, Pe.RData,
+                         Pe.Relocations.back() + 2, Pe.RDataEnd - 1 };
+
+        for (ULONG i = 0; i < _countof(Rvas); i += 1)
+        {
+            ImageIntegrity Integrity;
+            UCHAR Original;
+
+            Load(&Pe, Deltas[d], TRUE);
+            Original = g_Memory[Rvas[i]];
+            g_Memory[Rvas[i]] ^= 0x90;
+
+            CHECK(Check(FileName, Integrity) == IntegrityPatched);
+            CHECK(Integrity.m_Patches.size() == 1);
+            if (Integrity.m_Patches.size() != 1) continue;
+
+            CHECK(Integrity.m_Patches[0].Rva == Rvas[i]);
+            CHECK(Integrity.m_Patches[0].Size == 1);
+            CHECK(strcmp(Integrity.m_Patches[0].Section, (Rvas[i] < Pe.RData) ? ".text" : ".rdata") == 0);
+            CHECK(Integrity.m_Patches[0].Memory[0] == (UCHAR)(Original ^ 0x90));
+            CHECK(Integrity.m_Patches[0].Reference[0] == Original);
+            CHECK(Integrity.m_NumberOfIdenticalPages == (Pe.NumberOfPages - 1));
+        }
+
+        //
+        // Written by the loader or at run time: IAT slots and the writable section.
+        //
+        {
+            ImageIntegrity Integrity;
+
+            Load(&Pe, Deltas[d], TRUE);
+            g_Memory[Pe.Imports[0].IatRva] ^= 0xFF;
+            g_Memory[Pe.Data + 0x200] ^= 0xFF;
+
+            CHECK(Check(FileName, Integrity) == IntegrityClean);
+        }
+
+        //
+        // Without relocations in memory, every pointer differs. The pointers of the table are
+        // next to each other and reported as one range.
+        //
+        if (Deltas[d])
+        {
+            ImageIntegrity Integrity;
+            ULONG PointerSize = Is64Bit ? sizeof(ULONG64) : sizeof(ULONG);
+            vector<BOOLEAN> Relocated(Pe.Image.size(), FALSE);
+            vector<BOOLEAN> Reported(Pe.Image.size(), FALSE);
+
+            for (ULONG i = 0; i < Pe.Relocations.size(); i += 1)
+            {
+                fill(Relocated.begin() + Pe.Relocations[i], Relocated.begin() + Pe.Relocations[i] + PointerSize, TRUE);
+            }
+
+            Load(&Pe, Deltas[d], FALSE);
+
+            CHECK(Check(FileName, Integrity) == IntegrityPatched);
+
+            for (INTEGRITY_PATCH& Patch : Integrity.m_Patches)
+            {
+                CHECK(Relocated[Patch.Rva] && Relocated[Patch.Rva + Patch.Size - 1]);
+                fill(Reported.begin() + Patch.Rva, Reported.begin() + Patch.Rva + Patch.Size, TRUE);
+            }
+
+            for (ULONG i = 0; i < Pe.Relocations.size(); i += 1)
+            {
+                CHECK(find(Reported.begin() + Pe.Relocations[i], Reported.begin() + Pe.Relocations[i] + PointerSize, TRUE) !=
+                      (Reported.begin() + Pe.Relocations[i] + PointerSize));
+            }
+        }
+    }
+
+    //
+    // A page that is not resident is skipped, not reported.
+    //
+    {
+        ImageIntegrity Integrity;
+
+        Load(&Pe, Deltas[1], TRUE);
+        g_Unreadable[(Pe.Text / INTEGRITY_PAGE_SIZE) + 1] = TRUE;
+        g_Memory[Pe.Text + TEST_IMAGE_SECTION_ALIGNMENT + 0x80] ^= 0x90;
+
+        CHECK(Check(FileName, Integrity) == IntegrityClean);
+        CHECK(Integrity.m_NumberOfNonResidentPages == 1);
+        CHECK(Integrity.m_NumberOfPages == (Pe.NumberOfPages - 1));
+    }
+
+    //
+    // Results and excluded ranges are not carried over to the next comparison.
+    //
+    {
+        ImageIntegrity Integrity;
+        WCHAR Path[MAX_PATH];
+
+        Load(&Pe, Deltas[1], TRUE);
+        g_Memory[Pe.Text + 0x40] ^= 0x90;
+        g_Memory[Pe.RData + 0x8] ^= 0x90;
+
+        CHECK(GetPath(FileName, Path, _countof(Path)));
+        CHECK(Integrity.Capture(g_LoadBase, Path, ReadTarget));
+
+        for (ULONG Run = 0; Run < 3; Run += 1)
+        {
+            Integrity.Compare();
+
+            CHECK(Integrity.m_Status == IntegrityPatched);
+            CHECK(Integrity.m_Patches.size() == 2);
+            CHECK(Integrity.m_NumberOfPages == Pe.NumberOfPages);
+            CHECK(Integrity.m_NumberOfIdenticalPages == (Pe.NumberOfPages - 2));
+
+            for (ULONG i = 0; i < Integrity.m_Patches.size(); i += 1) CHECK(Integrity.m_Patches[i].Size == 1);
+        }
+
+        Integrity.Close();
+    }
+
+    //
+    // Another build in memory, a missing and a truncated reference.
+    //
+    {
+        ImageIntegrity Integrity;
+
+        Load(&Pe, Deltas[1], TRUE);
+        ((PIMAGE_NT_HEADERS32)&g_Memory[TEST_IMAGE_NT_HEADERS_OFFSET])->FileHeader.TimeDateStamp += 1;
+
+        CHECK(Check(FileName, Integrity) == IntegrityVersionMismatch);
+    }
+
+    {
+        ImageIntegrity Integrity;
+
+        Load(&Pe, Deltas[1], TRUE);
+        CHECK(Check("/tmp/IntegrityTest.missing/ntoskrnl.exe", Integrity) == IntegrityNoReference);
+    }
+
+    {
+        ImageIntegrity Integrity;
+        vector<UCHAR> Truncated(Pe.File.begin(), Pe.File.begin() + 0x100);
+
+        CHECK(TestImage::WriteFile(FileName, Truncated));
+        CHECK(Check(FileName, Integrity) == IntegrityInvalidReference);
+    }
+
+    remove(FileName);
+}
+
+int
+main(
+)
+{
+    TestImageIntegrity(FALSE);
+    TestImageIntegrity(TRUE);
+
+    return TestResult("Integrity");
+}
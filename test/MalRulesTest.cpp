@@ -0,0 +1,774 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - MalRulesTest.cpp
+
+Abstract:
+
+    - MalScore rule files: every directive and escape, the line and reason of
+      every error, the compiled cache written and read back or corrupted, and
+      rules hitting through GetMalScoreStream() with strings across chunks.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <string>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "Entropy.h"
+#include "Spray.h"
+#include "PatternMatcher.h"
+#include "MalRules.h"
+#include "Security.h"
+#include "Test.h"
+
+#define TEST_REGION_SIZE 0x40000
+
+static char g_FileName[] = "/tmp/MalRulesTest.XXXXXX";
+
+static
+BOOLEAN
+WriteText(
+    LPCSTR Text
+)
+{
+    FILE *File = fopen(g_FileName, "wb");
+
+    if (File == NULL) return FALSE;
+
+    fputs(Text, File);
+    fclose(File);
+
+    return TRUE;
+}
+
+static
+BOOLEAN
+ParseText(
+    MalScoreRules& Rules,
+    LPCSTR Text,
+    LPSTR Error,
+    ULONG ErrorSize
+)
+{
+    CHECK(WriteText(Text));
+
+    return Rules.Parse(g_FileName, Error, ErrorSize);
+}
+
+static
+VOID
+CheckString(
+    MalScoreRules& Rules,
+    ULONG Index,
+    ULONG Rule,
+    const vector<UCHAR>& Bytes,
+    const vector<UCHAR>& Mask
+)
+{
+    CHECK(Index < Rules.m_Strings.size());
+    if (Index >= Rules.m_Strings.size()) return;
+
+    CHECK(Rules.m_Strings[Index].Rule == Rule);
+    CHECK(Rules.m_Strings[Index].Bytes == Bytes);
+    CHECK(Rules.m_Strings[Index].Mask == Mask);
+}
+
+static
+VOID
+CheckRule(
+    MalScoreRules& Rules,
+    ULONG Index,
+    LPCSTR Name,
+    ULONG Weight,
+    ULONG Condition,
+    ULONG FirstString,
+    ULONG NumberOfStrings
+)
+{
+    CHECK(Index < Rules.m_Rules.size());
+    if (Index >= Rules.m_Rules.size()) return;
+
+    CHECK(Rules.m_Rules[Index].Name == Name);
+    CHECK(Rules.m_Rules[Index].Weight == Weight);
+    CHECK(Rules.m_Rules[Index].Condition == Condition);
+    CHECK(Rules.m_Rules[Index].FirstString == FirstString);
+    CHECK(Rules.m_Rules[Index].NumberOfStrings == NumberOfStrings);
+}
+
+//
+// Every directive, comments, indentation, CRLF, both cases of hex digits and every escape.
+//
+static
+VOID
+TestDirectives(
+)
+{
+    MalScoreRules Rules;
+    CHAR Error[512];
+    const vector<UCHAR> Ff1(1, 0xFF), Ff2(2, 0xFF), Ff4(4, 0xFF);
+
+    CHECK(ParseText(Rules,
+                    "# MalScore rules\n"
+                    "\n"
+                    "rule First # comment\n"
+                    "    weight 0x20\n"
+                    "\tcondition all\n"
+                    "hex 6a 30 ?? 648B\t7f # comment\n"
+                    "ascii \"a\\\\b\\\"c\\t\\r\\n\\x41\\xfF\"\n"
+                    "wide \"W\\x80\"  # comment\r\n"
+                    "rule Second\r\n"
+                    "hex ??41\n"
+                    "ascii \"#\"\n"
+                    "condition 2\n"
+                    "   # indented comment\n"
+                    "rule Third\n"
+                    "weight 017\n"
+                    "condition any\n"
+                    "wide \"x\"\n"
+                    "hex 00\n"
+                    "hex FF\n"
+                    "rule Fourth#comment\n"
+                    "condition 1 # comment\n"
+                    "weight 0\n"
+                    "hex 01",
+                    Error, sizeof(Error)));
+
+    CHECK(Error[0] == '\0');
+    CHECK(Rules.m_Rules.size() == 4);
+    CHECK(Rules.m_Strings.size() == 9);
+
+    CheckRule(Rules, 0, "First", 0x20, 3, 0, 3);
+    CheckRule(Rules, 1, "Second", RULE_DEFAULT_WEIGHT, 2, 3, 2);
+    CheckRule(Rules, 2, "Third", 15, 1, 5, 3);
+    CheckRule(Rules, 3, "Fourth", 0, 1, 8, 1);
+
+    CheckString(Rules, 0, 0, { 0x6A, 0x30, 0x00, 0x64, 0x8B, 0x7F }, { 0xFF, 0xFF, 0x00, 0xFF, 0xFF, 0xFF });
+    CheckString(Rules, 1, 0, { 'a', '\\', 'b', '"', 'c', '\t', '\r', '\n', 'A', 0xFF }, vector<UCHAR>(10, 0xFF));
+    CheckString(Rules, 2, 0, { 'W', 0, 0x80, 0 }, Ff4);
+    CheckString(Rules, 3, 1, { 0x00, 0x41 }, { 0x00, 0xFF });
+    CheckString(Rules, 4, 1, { '#' }, Ff1);
+    CheckString(Rules, 5, 2, { 'x', 0 }, Ff2);
+    CheckString(Rules, 6, 2, { 0x00 }, Ff1);
+    CheckString(Rules, 7, 2, { 0xFF }, Ff1);
+    CheckString(Rules, 8, 3, { 0x01 }, Ff1);
+
+    //
+    // Nothing but comments, and the limits of every length.
+    //
+    CHECK(ParseText(Rules, "# nothing\n\n", Error, sizeof(Error)));
+    CHECK(Rules.m_Rules.empty() && Rules.m_Strings.empty());
+
+    string Text = "rule " + string(RULE_MAX_NAME_LENGTH, 'n') + "\ncondition all\n";
+    for (ULONG i = 0; i < RULE_MAX_STRINGS; i += 1) Text += "hex " + string(RULE_MAX_STRING_LENGTH * 2, '1') + "\n";
+    Text += "rule w\nwide \"" + string(RULE_MAX_STRING_LENGTH / 2, 'w') + "\"\n";
+    Text += "rule a\nascii \"" + string(RULE_MAX_STRING_LENGTH, 'a') + "\"\n";
+
+    CHECK(ParseText(Rules, Text.c_str(), Error, sizeof(Error)));
+    CheckRule(Rules, 0, string(RULE_MAX_NAME_LENGTH, 'n').c_str(), RULE_DEFAULT_WEIGHT, RULE_MAX_STRINGS, 0, RULE_MAX_STRINGS);
+    CheckRule(Rules, 1, "w", RULE_DEFAULT_WEIGHT, 1, RULE_MAX_STRINGS, 1);
+    CheckRule(Rules, 2, "a", RULE_DEFAULT_WEIGHT, 1, RULE_MAX_STRINGS + 1, 1);
+    CHECK(Rules.m_Strings.size() == (RULE_MAX_STRINGS + 2));
+    CHECK(Rules.m_Strings[0].Bytes == vector<UCHAR>(RULE_MAX_STRING_LENGTH, 0x11));
+
+    //
+    // A file that cannot be opened.
+    //
+    CHECK(!Rules.Parse("/nonexistent/rules.txt", Error, sizeof(Error)));
+    CHECK(strcmp(Error, "cannot open /nonexistent/rules.txt") == 0);
+    CHECK(Rules.m_Rules.empty());
+}
+
+typedef struct _TEST_ERROR {
+    string Text;
+    ULONG Line;
+    LPCSTR Reason;
+} TEST_ERROR, *PTEST_ERROR;
+
+static
+VOID
+TestErrors(
+)
+{
+    string TooManyStrings = "rule a\n";
+    for (ULONG i = 0; i <= RULE_MAX_STRINGS; i += 1) TooManyStrings += "hex 90\n";
+
+    const TEST_ERROR Errors[] = {
+        { "weight 5\n", 1, "directive outside of a rule" },
+        { "\n# comment\nhex 00\n", 3, "directive outside of a rule" },
+        { "rule\n", 1, "rule name expected" },
+        { "rule   # comment\n", 1, "rule name expected" },
+        { "rule a b\n", 1, "rule name expected" },
+        { "rule " + string(RULE_MAX_NAME_LENGTH + 1, 'n') + "\n", 1, "rule name too long" },
+        { "rule a\nhex 6\n", 2, "invalid hex byte" },
+        { "rule a\nhex 6g\n", 2, "invalid hex byte" },
+        { "rule a\nhex 00 ?\n", 2, "invalid hex byte" },
+        { "rule a\nhex 00 ?0\n", 2, "invalid hex byte" },
+        { "rule a\nhex 0x00\n", 2, "invalid hex byte" },
+        { "rule a\nhex\n", 2, "hex string without significant byte" },
+        { "rule a\nhex ?? ?? # comment\n", 2, "hex string without significant byte" },
+        { "rule a\nascii abc\n", 2, "string must be quoted" },
+        { "rule a\nwide\n", 2, "string must be quoted" },
+        { "rule a\nascii \"abc\n", 2, "unterminated string" },
+        { "rule a\nascii \"abc\\\"\n", 2, "unterminated string" },
+        { "rule a\nascii \"\\q\"\n", 2, "invalid escape" },
+        { "rule a\nascii \"\\0\"\n", 2, "invalid escape" },
+        { "rule a\nascii \"\\x4\"\n", 2, "invalid \\x escape" },
+        { "rule a\nwide \"\\xg0\"\n", 2, "invalid \\x escape" },
+        { "rule a\nascii \"a\" b\n", 2, "unexpected text after the string" },
+        { "rule a\nascii \"\"\n", 2, "empty string" },
+        { "rule a\nwide \"\"\n", 2, "empty string" },
+        { "rule a\nhex " + string((RULE_MAX_STRING_LENGTH + 1) * 2, '1') + "\n", 2, "string too long" },
+        { "rule a\nascii \"" + string(RULE_MAX_STRING_LENGTH + 1, 'a') + "\"\n", 2, "string too long" },
+        { "rule a\nwide \"" + string((RULE_MAX_STRING_LENGTH / 2) + 1, 'w') + "\"\n", 2, "string too long" },
+        { "rule a\nweight\n", 2, "invalid weight" },
+        { "rule a\nweight x\n", 2, "invalid weight" },
+        { "rule a\nweight 5x\n", 2, "invalid weight" },
+        { "rule a\nweight -1\n", 2, "invalid weight" },
+        { "rule a\ncondition\n", 2, "invalid condition" },
+        { "rule a\ncondition some\n", 2, "invalid condition" },
+        { "rule a\ncondition allx\n", 2, "invalid condition" },
+        { "rule a\ncondition any2\n", 2, "invalid condition" },
+        { "rule a\ncondition 0\n", 2, "invalid condition" },
+        { "rule a\ncondition 2x\n", 2, "invalid condition" },
+        { "rule a\nstring \"a\"\n", 2, "unknown directive" },
+        { "rule a\nHEX 00\n", 2, "unknown directive" },
+        { "rule a\nrule b\nhex 00\n", 2, "rule without string" },
+        { "rule a\nhex 00\nrule b\n\n# comment\n", 5, "rule without string" },
+        { "rule a\ncondition 3\nhex 00\nhex 01\nrule b\nhex 02\n", 5, "condition needs more strings than the rule has" },
+        { "rule a\nhex 00\nrule b\ncondition 2\nhex 01\n", 5, "condition needs more strings than the rule has" },
+        { TooManyStrings, RULE_MAX_STRINGS + 2, "too many strings in the rule" },
+    };
+
+    for (ULONG i = 0; i < _countof(Errors); i += 1)
+    {
+        MalScoreRules Rules;
+        CHAR Error[512], Expected[512];
+
+        sprintf_s(Expected, sizeof(Expected), "%s(%u): %s", g_FileName, Errors[i].Line, Errors[i].Reason);
+
+        CHECK(!ParseText(Rules, Errors[i].Text.c_str(), Error, sizeof(Error)));
+        if (strcmp(Error, Expected) != 0) printf("       case %u: \"%s\"\n", i, Error);
+        CHECK(strcmp(Error, Expected) == 0);
+
+        //
+        // Rules parsed before the error are dropped.
+        //
+        CHECK(Rules.m_Rules.empty() && Rules.m_Strings.empty());
+    }
+}
+
+static
+BOOLEAN
+SaveBytes(
+    const MalScoreRules& Rules,
+    vector<UCHAR>& Bytes
+)
+{
+    FILE *File = tmpfile();
+    BOOLEAN Result;
+
+    if (File == NULL) return FALSE;
+
+    Result = Rules.Save(File);
+
+    Bytes.resize(ftell(File));
+    rewind(File);
+    if (fread(Bytes.data(), 1, Bytes.size(), File) != Bytes.size()) Result = FALSE;
+
+    fclose(File);
+
+    return Result;
+}
+
+//
+// Trailing is written after the cache, as LoadMalScoreRules() does with the matcher.
+//
+static
+BOOLEAN
+LoadBytes(
+    MalScoreRules& Rules,
+    const vector<UCHAR>& Bytes,
+    ULONG Trailing = 0
+)
+{
+    FILE *File = tmpfile();
+    vector<UCHAR> After(Trailing, 0xCC);
+    BOOLEAN Result;
+
+    if (File == NULL) return FALSE;
+
+    if (Bytes.size()) fwrite(Bytes.data(), 1, Bytes.size(), File);
+    if (After.size()) fwrite(After.data(), 1, After.size(), File);
+    rewind(File);
+
+    Result = Rules.Load(File);
+    if (Result) CHECK(ftell(File) == (long)Bytes.size());
+
+    fclose(File);
+
+    return Result;
+}
+
+static
+BOOLEAN
+IsSame(
+    const MalScoreRules& a,
+    const MalScoreRules& b
+)
+{
+    if ((a.m_Rules.size() != b.m_Rules.size()) || (a.m_Strings.size() != b.m_Strings.size())) return FALSE;
+
+    for (ULONG i = 0; i < a.m_Rules.size(); i += 1)
+    {
+        if ((a.m_Rules[i].Name != b.m_Rules[i].Name) ||
+            (a.m_Rules[i].Weight != b.m_Rules[i].Weight) ||
+            (a.m_Rules[i].Condition != b.m_Rules[i].Condition) ||
+            (a.m_Rules[i].FirstString != b.m_Rules[i].FirstString) ||
+            (a.m_Rules[i].NumberOfStrings != b.m_Rules[i].NumberOfStrings))
+        {
+            return FALSE;
+        }
+    }
+
+    for (ULONG i = 0; i < a.m_Strings.size(); i += 1)
+    {
+        if ((a.m_Strings[i].Rule != b.m_Strings[i].Rule) ||
+            (a.m_Strings[i].Bytes != b.m_Strings[i].Bytes) ||
+            (a.m_Strings[i].Mask != b.m_Strings[i].Mask))
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+//
+// Offsets of the fields of a saved cache.
+//
+typedef struct _TEST_LAYOUT {
+    vector<ULONG> Rules; // ULONG Fields[5], then the name.
+    vector<ULONG> Strings; // ULONG Fields[2], then the bytes and the mask.
+} TEST_LAYOUT, *PTEST_LAYOUT;
+
+static
+VOID
+GetLayout(
+    const MalScoreRules& Rules,
+    PTEST_LAYOUT Layout
+)
+{
+    ULONG Offset = 4 * sizeof(ULONG);
+
+    for (const MalScoreRules::RULE& Rule : Rules.m_Rules)
+    {
+        Layout->Rules.push_back(Offset);
+        Offset += (5 * sizeof(ULONG)) + (ULONG)Rule.Name.size();
+    }
+
+    for (const MalScoreRules::RULE_STRING& String : Rules.m_Strings)
+    {
+        Layout->Strings.push_back(Offset);
+        Offset += (2 * sizeof(ULONG)) + (2 * (ULONG)String.Bytes.size());
+    }
+}
+
+static
+VOID
+SetField(
+    vector<UCHAR>& Bytes,
+    ULONG Offset,
+    ULONG Value
+)
+{
+    memcpy(&Bytes[Offset], &Value, sizeof(Value));
+}
+
+static
+ULONG
+GetField(
+    const vector<UCHAR>& Bytes,
+    ULONG Offset
+)
+{
+    ULONG Value;
+
+    memcpy(&Value, &Bytes[Offset], sizeof(Value));
+
+    return Value;
+}
+
+static
+VOID
+TestCache(
+)
+{
+    unsigned long long Seed = 0x44;
+    MalScoreRules Rules, Loaded;
+    vector<UCHAR> Bytes, Corrupted;
+    TEST_LAYOUT Layout;
+    CHAR Error[512];
+    string Text;
+
+    //
+    // Random rules, written and read back.
+    //
+    for (ULONG i = 0; i < 200; i += 1)
+    {
+        ULONG NumberOfStrings = 1 + (TestRandom(&Seed) % RULE_MAX_STRINGS);
+        CHAR Line[64];
+
+        sprintf_s(Line, sizeof(Line), "rule r%u\nweight %u\ncondition %u\n",
+                  i, (ULONG)(TestRandom(&Seed) % 1000), 1 + (ULONG)(TestRandom(&Seed) % NumberOfStrings));
+        Text += Line;
+
+        for (ULONG j = 0; j < NumberOfStrings; j += 1)
+        {
+            ULONG Length = 1 + (TestRandom(&Seed) % 16);
+
+            Text += "hex";
+            for (ULONG k = 0; k < Length; k += 1)
+            {
+                if ((k > 0) && ((TestRandom(&Seed) % 4) == 0)) Text += " ??";
+                else
+                {
+                    sprintf_s(Line, sizeof(Line), " %02x", (ULONG)(TestRandom(&Seed) & 0xFF));
+                    Text += Line;
+                }
+            }
+            Text += "\n";
+        }
+    }
+
+    CHECK(ParseText(Rules, Text.c_str(), Error, sizeof(Error)));
+    CHECK(Rules.m_Rules.size() == 200);
+
+    CHECK(SaveBytes(Rules, Bytes));
+    CHECK(LoadBytes(Loaded, Bytes));
+    CHECK(IsSame(Rules, Loaded));
+    CHECK(LoadBytes(Loaded, Bytes, 100));
+    CHECK(IsSame(Rules, Loaded));
+
+    CHECK(SaveBytes(MalScoreRules(), Bytes));
+    CHECK(LoadBytes(Loaded, Bytes));
+    CHECK(Loaded.m_Rules.empty());
+
+    //
+    // Small rules for the corruptions: every truncation, then every field.
+    //
+    CHECK(ParseText(Rules,
+                    "rule one\nweight 3\nhex 01 ?? 02\nascii \"ab\"\n"
+                    "rule two\ncondition all\nwide \"c\"\nhex 03\nhex 04 05\n"
+                    "rule three\nhex 06\n",
+                    Error, sizeof(Error)));
+    CHECK(SaveBytes(Rules, Bytes));
+    GetLayout(Rules, &Layout);
+
+    CHECK(LoadBytes(Loaded, Bytes));
+    CHECK(IsSame(Rules, Loaded));
+
+    for (ULONG Size = 0; Size < Bytes.size(); Size += 1)
+    {
+        Corrupted.assign(Bytes.begin(), Bytes.begin() + Size);
+        CHECK(!LoadBytes(Loaded, Corrupted));
+        CHECK(Loaded.m_Rules.empty() && Loaded.m_Strings.empty());
+    }
+
+    //
+    // { Offset, Value } written over a valid cache.
+    //
+    const ULONG Fields[][2] = {
+        { 0, 0x4C524D4E }, // Signature
+        { 4, 2 }, // Version
+        { 8, 7 }, // More rules than strings.
+        { 12, 7 }, // One more string than the rules have.
+        { 12, 5 },
+        { 8, 0 }, { 12, 0 },
+        { 12, RULE_MAX_TOTAL_STRINGS + 1 },
+        { Layout.Rules[0], 0 }, // Name length
+        { Layout.Rules[0], RULE_MAX_NAME_LENGTH + 1 },
+        { Layout.Rules[1] + 8, 0 }, // Condition
+        { Layout.Rules[1] + 8, 4 }, // Condition > NumberOfStrings
+        { Layout.Rules[0] + 12, 1 }, // FirstString of the first rule.
+        { Layout.Rules[1] + 12, 1 }, // FirstString not right after the previous rule.
+        { Layout.Rules[1] + 12, 3 },
+        { Layout.Rules[2] + 12, 4 },
+        { Layout.Rules[2] + 12, 6 },
+        { Layout.Rules[1] + 16, 0 }, // NumberOfStrings
+        { Layout.Rules[1] + 16, RULE_MAX_STRINGS + 1 },
+        { Layout.Rules[2] + 16, 2 }, // Past the strings.
+        { Layout.Strings[0], 1 }, // String of another rule.
+        { Layout.Strings[2], 0 },
+        { Layout.Strings[5], 1 },
+        { Layout.Strings[5], 3 }, // Rule out of range.
+        { Layout.Strings[0] + 4, 0 }, // String length
+        { Layout.Strings[0] + 4, RULE_MAX_STRING_LENGTH + 1 },
+    };
+
+    CHECK(GetField(Bytes, 8) == 3);
+    CHECK(GetField(Bytes, 12) == 6);
+
+    for (ULONG i = 0; i < _countof(Fields); i += 1)
+    {
+        Corrupted = Bytes;
+        SetField(Corrupted, Fields[i][0], Fields[i][1]);
+
+        CHECK(!LoadBytes(Loaded, Corrupted, 64));
+        if (Loaded.m_Rules.size()) printf("       corruption %u loaded\n", i);
+        CHECK(Loaded.m_Rules.empty() && Loaded.m_Strings.empty());
+    }
+
+    //
+    // A string without bytes, as the last one of the file.
+    //
+    Corrupted = Bytes;
+    SetField(Corrupted, Layout.Strings[5] + 4, 0);
+    Corrupted.resize(Layout.Strings[5] + 8);
+    CHECK(!LoadBytes(Loaded, Corrupted));
+
+    //
+    // Rules Parse() never builds, written by Save(): a rule without name, a rule taking
+    // the last string of the previous one, a rule with too many strings.
+    //
+    {
+        MalScoreRules Invalid = Rules;
+
+        Invalid.m_Rules[2].Name.clear();
+        CHECK(SaveBytes(Invalid, Corrupted));
+        CHECK(!LoadBytes(Loaded, Corrupted));
+
+        Invalid = Rules;
+        Invalid.m_Rules[1].FirstString = 1;
+        Invalid.m_Rules[1].NumberOfStrings = 4;
+        CHECK(SaveBytes(Invalid, Corrupted));
+        CHECK(!LoadBytes(Loaded, Corrupted));
+
+        Invalid.Clear();
+        for (ULONG i = 0; i < (RULE_MAX_STRINGS + 2); i += 1)
+        {
+            MalScoreRules::RULE_STRING String = { (ULONG)(i > RULE_MAX_STRINGS), vector<UCHAR>(1, (UCHAR)i), vector<UCHAR>(1, 0xFF) };
+
+            Invalid.m_Strings.push_back(String);
+        }
+
+        Invalid.m_Rules.push_back({ "big", 1, 1, 0, RULE_MAX_STRINGS + 1 });
+        Invalid.m_Rules.push_back({ "small", 1, 1, RULE_MAX_STRINGS + 1, 1 });
+        CHECK(SaveBytes(Invalid, Corrupted));
+        CHECK(!LoadBytes(Loaded, Corrupted));
+
+        Invalid.m_Rules[0].NumberOfStrings = RULE_MAX_STRINGS;
+        Invalid.m_Rules[1].FirstString = RULE_MAX_STRINGS;
+        Invalid.m_Rules[1].NumberOfStrings = 2;
+        Invalid.m_Strings[RULE_MAX_STRINGS].Rule = 1;
+        CHECK(SaveBytes(Invalid, Corrupted));
+        CHECK(LoadBytes(Loaded, Corrupted));
+        CHECK(IsSame(Invalid, Loaded));
+    }
+
+    //
+    // Weights are not checked, any value is kept.
+    //
+    Corrupted = Bytes;
+    SetField(Corrupted, Layout.Rules[0] + 4, MAXULONG);
+    CHECK(LoadBytes(Loaded, Corrupted));
+    CHECK(Loaded.m_Rules.size() && (Loaded.m_Rules[0].Weight == MAXULONG));
+}
+
+static
+BOOLEAN
+ReadRegion(
+    PVOID Context,
+    ULONG64 Offset,
+    LPBYTE Buffer,
+    ULONG Length
+)
+{
+    memcpy(Buffer, (LPBYTE)Context + Offset, Length);
+
+    return TRUE;
+}
+
+static const ULONG g_ChunkSizes[] = { 0, 0x1000, 0x1234, 0x10001 };
+
+static
+VOID
+CheckScore(
+    vector<UCHAR>& Region,
+    ULONG Expected,
+    const vector<ULONG>& Hits
+)
+{
+    for (ULONG i = 0; i < _countof(g_ChunkSizes); i += 1)
+    {
+        MALSCORE_DETAILS Details;
+        ULONG Score = 0;
+
+        CHECK(GetMalScoreStream(FALSE, 0ULL, Region.size(), ReadRegion, Region.data(), g_ChunkSizes[i], 0, &Score, &Details));
+        if (Score != Expected) printf("       0x%X chunks: %u, %u expected\n", g_ChunkSizes[i], Score, Expected);
+        CHECK(Score == Expected);
+        CHECK(Details.Rules == Hits);
+    }
+}
+
+static
+VOID
+PutString(
+    vector<UCHAR>& Region,
+    ULONG Offset,
+    LPCSTR String,
+    BOOLEAN Wide
+)
+{
+    for (ULONG i = 0; String[i]; i += 1)
+    {
+        if (Wide)
+        {
+            Region[Offset + (2 * i)] = String[i];
+            Region[Offset + (2 * i) + 1] = 0;
+        }
+        else
+        {
+            Region[Offset + i] = String[i];
+        }
+    }
+}
+
+//
+// Rule strings found by the scorer: across the edges of every chunk size, at the end of
+// the region, with "??" bytes, and counted once for their rule whatever the number of hits.
+//
+static
+VOID
+TestScore(
+)
+{
+    vector<UCHAR> Region(TEST_REGION_SIZE, 0);
+    BOOLEAN FromCache = FALSE;
+    CHAR Error[512], CacheName[64];
+
+    CHECK(WriteText("rule Across\n"
+                    "weight 100\n"
+                    "condition all\n"
+                    "ascii \"MoonSolsAcrossChunks\"\n"
+                    "wide \"MoonSolsWide\"\n"
+                    "hex 4d 53 ?? ?? 52 55 4c 45\n"
+                    "rule TwoOfThree\n"
+                    "weight 20\n"
+                    "condition 2\n"
+                    "ascii \"QuasarOne\"\n"
+                    "ascii \"QuasarTwo\"\n"
+                    "ascii \"QuasarThree\"\n"
+                    "rule AtTheEnd\n"
+                    "weight 3\n"
+                    "ascii \"TAIL\"\n"));
+
+    CHECK(LoadMalScoreRules(g_FileName, FALSE, &FromCache, Error, sizeof(Error)));
+    CHECK(!FromCache);
+    CHECK(g_MalScoreRules.m_Rules.size() == 3);
+
+    CheckScore(Region, 0, {});
+
+    //
+    // Every string of Across once, each of them across the edge of a chunk size.
+    //
+    PutString(Region, 0x1000 - 7, "MoonSolsAcrossChunks", FALSE);
+    PutString(Region, 0x1234 * 3 - 5, "MoonSolsWide", TRUE);
+    CheckScore(Region, 0, {});
+
+    PutString(Region, 0x10001 - 3, "MS\x01\x02RULE", FALSE);
+    CheckScore(Region, 100, { 0 });
+
+    //
+    // One string of TwoOfThree, found many times, is not enough.
+    //
+    for (ULONG Offset = 0x2000; Offset < 0x3000; Offset += 0x100) PutString(Region, Offset, "QuasarTwo", FALSE);
+    CheckScore(Region, 100, { 0 });
+
+    PutString(Region, 0x20000 - 4, "QuasarThree", FALSE);
+    CheckScore(Region, 120, { 0, 1 });
+
+    //
+    // Last bytes of the region, past the last offset scored by the heuristics.
+    //
+    PutString(Region, TEST_REGION_SIZE - 4, "TAIL", FALSE);
+    CheckScore(Region, 123, { 0, 1, 2 });
+
+    //
+    // Same hits from the cache, then without rules.
+    //
+    sprintf_s(CacheName, sizeof(CacheName), "%s.cache", g_FileName);
+
+    CHECK(LoadMalScoreRules(g_FileName, TRUE, &FromCache, Error, sizeof(Error)));
+    CHECK(!FromCache);
+    CHECK(LoadMalScoreRules(g_FileName, TRUE, &FromCache, Error, sizeof(Error)));
+    CHECK(FromCache);
+    CheckScore(Region, 123, { 0, 1, 2 });
+
+    remove(CacheName);
+
+    UnloadMalScoreRules();
+    CheckScore(Region, 0, {});
+
+    //
+    // A rule file with an error leaves no rules loaded.
+    //
+    CHECK(WriteText("rule Broken\nhex 4d 5\n"));
+    CHECK(!LoadMalScoreRules(g_FileName, FALSE, &FromCache, Error, sizeof(Error)));
+    CHECK(strstr(Error, "(2): invalid hex byte") != NULL);
+    CHECK(g_MalScoreRules.m_Rules.empty());
+}
+
+int
+main(
+)
+{
+    int Fd;
+
+    Fd = mkstemp(g_FileName);
+    CHECK(Fd >= 0);
+    if (Fd >= 0) close(Fd);
+
+    TestDirectives();
+    TestErrors();
+    TestCache();
+    TestScore();
+
+    remove(g_FileName);
+
+    return TestResult("MalRules");
+}
@@ -0,0 +1,100 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - MalScoreBench.cpp
+
+Abstract:
+
+    - Throughput and score checksum of the synthetic MalScore corpora, the driver of
+      !ms_malscore /bench outside of the debugger. Fails if a score changes with the
+      chunk size.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdarg.h>
+#include <vector>
+#include <string>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "Entropy.h"
+#include "Spray.h"
+#include "PatternMatcher.h"
+#include "MalRules.h"
+#include "Security.h"
+#include "Test.h"
+
+#if !defined(MALSCORE_PREFILTER) || (MALSCORE_PREFILTER == 1)
+#define TEST_NAME "MalScoreBench"
+#elif MALSCORE_PREFILTER == 2
+#define TEST_NAME "MalScoreBench (SSE2 prefilter)"
+#else
+#define TEST_NAME "MalScoreBench (no prefilter)"
+#endif
+
+#define BENCH_CORPUS_SIZE (16 * 1024 * 1024)
+
+int
+main(
+)
+{
+    vector<MALSCORE_BENCH> Results;
+    ULONG64 TotalBytes = 0, TotalMs = 0;
+    ULONG Checksum;
+
+    CHECK(RunMalScoreBench(BENCH_CORPUS_SIZE, Results, &Checksum));
+
+    printf("MalScore throughput (%d MB per corpus, one idiom per 0x%X bytes):\n",
+           BENCH_CORPUS_SIZE / (1024 * 1024), MALSCORE_CORPUS_STRIDE);
+
+    for (ULONG i = 0; i < Results.size(); i += 1)
+    {
+        PMALSCORE_BENCH Bench = &Results[i];
+
+        TotalBytes += BENCH_CORPUS_SIZE;
+        TotalMs += Bench->ElapsedMs;
+
+        printf("    %-16s %6llu ms  %6llu MB/s  score %8u%s\n",
+               Bench->Name, (unsigned long long)Bench->ElapsedMs,
+               Bench->ElapsedMs ? ((unsigned long long)BENCH_CORPUS_SIZE * 1000) / (Bench->ElapsedMs * 1024 * 1024) : 0ULL,
+               Bench->Score,
+               (Bench->ChunkedScore == Bench->Score) ? "" : "  DIFFERENT in 64 KB chunks");
+
+        CHECK(Bench->ChunkedScore == Bench->Score);
+    }
+
+    printf("    %-16s %6llu ms  %6llu MB/s  checksum 0x%08X\n",
+           "Total", (unsigned long long)TotalMs,
+           TotalMs ? ((unsigned long long)TotalBytes * 1000) / (TotalMs * 1024 * 1024) : 0ULL,
+           Checksum);
+
+    return TestResult(TEST_NAME);
+}
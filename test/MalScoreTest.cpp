@@ -0,0 +1,304 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Module Name:
+
+    - MalScoreTest.cpp
+
+Abstract:
+
+    - Scores of the synthetic MalScore corpora: the same whatever the chunk size of the
+      streaming scorer, zero for the benign corpora and above the benign code for each
+      corpus planted with a heuristic.
+    - The same scores with and without the lead byte prefilter (MALSCORE_PREFILTER).
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdarg.h>
+#include <string.h>
+#include <vector>
+#include <string>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "Entropy.h"
+#include "Spray.h"
+#include "PatternMatcher.h"
+#include "MalRules.h"
+#include "Security.h"
+#include "Test.h"
+
+#if !defined(MALSCORE_PREFILTER) || (MALSCORE_PREFILTER == 1)
+#define TEST_NAME "MalScore"
+#elif MALSCORE_PREFILTER == 2
+#define TEST_NAME "MalScore (SSE2 prefilter)"
+#else
+#define TEST_NAME "MalScore (no prefilter)"
+#endif
+
+#define TEST_CORPUS_SIZE (1024 * 1024)
+
+static
+BOOLEAN
+ReadCorpus(
+    PVOID Context,
+    ULONG64 Offset,
+    LPBYTE Buffer,
+    ULONG Length
+)
+{
+    memcpy(Buffer, (LPBYTE)Context + Offset, Length);
+
+    return TRUE;
+}
+
+//
+// Corpora without anything to score, repeated fills included.
+//
+static LPCSTR g_BenignCorpora[] = { "Zero", "Text", "Padding", "Heap fill", "Pointer array" };
+
+static
+BOOLEAN
+IsBenignCorpus(
+    LPCSTR Name
+)
+{
+    for (ULONG i = 0; i < _countof(g_BenignCorpora); i += 1)
+    {
+        if (strcmp(Name, g_BenignCorpora[i]) == 0) return TRUE;
+    }
+
+    return FALSE;
+}
+
+//
+// Window edges fall on every kind of offset: pages, odd sizes, less than a block.
+//
+static const ULONG g_ChunkSizes[] = { 0x1000, 0x1234, 0x10001, 0x40000 };
+
+static
+VOID
+TestChunks(
+)
+{
+    vector<UCHAR> Buffer(TEST_CORPUS_SIZE);
+    ULONG CodeScore = 0;
+    LPCSTR Name;
+
+    for (ULONG i = 0; GetMalScoreCorpus(i, &Buffer[0], TEST_CORPUS_SIZE, &Name); i += 1)
+    {
+        ULONG Score = GetMalScore(FALSE, 0ULL, &Buffer[0], TEST_CORPUS_SIZE);
+
+        for (ULONG j = 0; j < _countof(g_ChunkSizes); j += 1)
+        {
+            ULONG ChunkedScore = 0;
+
+            CHECK(GetMalScoreStream(FALSE, 0ULL, TEST_CORPUS_SIZE, ReadCorpus, &Buffer[0], g_ChunkSizes[j], MALSCORE_REGION_WRITABLE, &ChunkedScore));
+            if (ChunkedScore != Score) printf("       %s: %u in 0x%X chunks, %u whole\n", Name, ChunkedScore, g_ChunkSizes[j], Score);
+            CHECK(ChunkedScore == Score);
+        }
+
+        if (IsBenignCorpus(Name))
+        {
+            if (Score != 0) printf("       %s: %u\n", Name, Score);
+            CHECK(Score == 0);
+        }
+        else if (strcmp(Name, "Code") == 0) CodeScore = Score;
+        else if (strcmp(Name, "Random") != 0) CHECK(Score > CodeScore);
+    }
+}
+
+//
+// Pages past 0x40000 cannot be read and are returned as zeroes.
+//
+static
+BOOLEAN
+ReadHoles(
+    PVOID Context,
+    ULONG64 Offset,
+    LPBYTE Buffer,
+    ULONG Length
+)
+{
+    if (Offset < 0x40000) return ReadCorpus(Context, Offset, Buffer, Length);
+
+    RtlZeroMemory(Buffer, Length);
+    return FALSE;
+}
+
+static
+BOOLEAN
+ReadNothing(
+    PVOID Context,
+    ULONG64 Offset,
+    LPBYTE Buffer,
+    ULONG Length
+)
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(Offset);
+
+    RtlZeroMemory(Buffer, Length);
+    return FALSE;
+}
+
+//
+// Only the start of the region has to be readable, the rest is scored as zeroes.
+//
+static
+VOID
+TestUnreadable(
+)
+{
+    vector<UCHAR> Buffer(TEST_CORPUS_SIZE);
+    ULONG Score = 0;
+    LPCSTR Name;
+
+    for (ULONG i = 0; GetMalScoreCorpus(i, &Buffer[0], TEST_CORPUS_SIZE, &Name); i += 1)
+    {
+        if (strcmp(Name, "FS:[30h]") == 0) break;
+    }
+
+    CHECK(GetMalScoreStream(FALSE, 0ULL, TEST_CORPUS_SIZE, ReadHoles, &Buffer[0], 0x10000, MALSCORE_REGION_WRITABLE, &Score));
+    CHECK((Score > 0) && (Score < GetMalScore(FALSE, 0ULL, &Buffer[0], TEST_CORPUS_SIZE)));
+
+    CHECK(!GetMalScoreStream(FALSE, 0ULL, TEST_CORPUS_SIZE, ReadNothing, NULL, 0x10000, MALSCORE_REGION_WRITABLE, &Score));
+}
+
+//
+// Sprayed addresses only score in writable regions, sleds score everywhere.
+//
+static
+VOID
+TestSprayFlags(
+)
+{
+    vector<UCHAR> Buffer(TEST_CORPUS_SIZE);
+    ULONG Score = 0;
+    LPCSTR Name;
+
+    for (ULONG i = 0; GetMalScoreCorpus(i, &Buffer[0], TEST_CORPUS_SIZE, &Name); i += 1)
+    {
+        if ((strcmp(Name, "Address spray") != 0) && (strcmp(Name, "Spray") != 0)) continue;
+
+        CHECK(GetMalScoreStream(FALSE, 0ULL, TEST_CORPUS_SIZE, ReadCorpus, &Buffer[0], 0x10000, 0, &Score));
+        if (strcmp(Name, "Address spray") == 0) CHECK(Score == 0);
+        else CHECK(Score == GetMalScore(FALSE, 0ULL, &Buffer[0], TEST_CORPUS_SIZE));
+    }
+}
+
+//
+// FNV-1a of the scores below, from a build scoring every offset (MALSCORE_PREFILTER 0).
+//
+#define TEST_PREFILTER_CHECKSUM 0x7F1EBFEC
+#define TEST_PREFILTER_SIZE (256 * 1024)
+
+//
+// xor ecx, ecx, then xor byte [esi+ecx], 5Ah / inc ecx / cmp ecx, 100h / jnz back. The
+// corpora only branch back with jnz, so TestPrefilter swaps in the other lead bytes.
+//
+static const UCHAR g_DecryptLoop[] = {
+    0x33, 0xC9,
+    0x80, 0x34, 0x0E, 0x5A,
+    0x41,
+    0x81, 0xF9, 0x00, 0x01, 0x00, 0x00,
+    0x75, 0xF3
+};
+
+//
+// Every corpus moved by 0 to 32 bytes so that planted instances fall on every offset of
+// a prefilter block, and cut to lengths ending inside of a block. The decryption loop
+// ends with jnz, loop and jb on every offset of a block.
+//
+static
+VOID
+TestPrefilter(
+)
+{
+    static const ULONG Lengths[] = { 1, 5, 31, 33, 0x1003, 0x10011 };
+    static const UCHAR Branches[] = { 0x75, 0xE2, 0x72 };
+    vector<UCHAR> Buffer(TEST_PREFILTER_SIZE);
+    ULONG Checksum = 0x811C9DC5;
+    ULONG Expected = 0;
+    LPCSTR Name;
+
+    for (ULONG b = 0; b < _countof(Branches); b += 1)
+    {
+        for (ULONG Offset = 0; Offset <= 32; Offset += 1)
+        {
+            UCHAR Loop[0x80] = { 0 };
+            ULONG Score;
+
+            memcpy(&Loop[0x40 + Offset], g_DecryptLoop, sizeof(g_DecryptLoop));
+            Loop[0x40 + Offset + sizeof(g_DecryptLoop) - 2] = Branches[b];
+
+            Score = GetMalScore(FALSE, 0ULL, Loop, sizeof(Loop));
+            if (!Expected) Expected = Score;
+            if (Score != Expected) printf("       loop ending with %02X at +%u: %u\n", Branches[b], Offset, Score);
+            CHECK(Score == Expected);
+        }
+    }
+
+    CHECK(Expected != 0);
+
+    for (ULONG i = 0; GetMalScoreCorpus(i, &Buffer[0], TEST_PREFILTER_SIZE, &Name); i += 1)
+    {
+        vector<ULONG> Scores;
+
+        for (ULONG Shift = 0; Shift <= 32; Shift += 1)
+        {
+            Scores.push_back(GetMalScore(FALSE, 0ULL, &Buffer[Shift], TEST_PREFILTER_SIZE - Shift));
+        }
+
+        for (ULONG l = 0; l < _countof(Lengths); l += 1)
+        {
+            Scores.push_back(GetMalScore(FALSE, 0ULL, &Buffer[TEST_PREFILTER_SIZE - Lengths[l]], Lengths[l]));
+        }
+
+        for (ULONG s = 0; s < Scores.size(); s += 1)
+        {
+            for (ULONG j = 0; j < 4; j += 1) Checksum = (Checksum ^ ((Scores[s] >> (j * 8)) & 0xFF)) * 0x01000193;
+        }
+    }
+
+    if (Checksum != TEST_PREFILTER_CHECKSUM) printf("       prefilter checksum 0x%08X\n", Checksum);
+    CHECK(Checksum == TEST_PREFILTER_CHECKSUM);
+}
+
+int
+main(
+)
+{
+    TestChunks();
+    TestUnreadable();
+    TestSprayFlags();
+    TestPrefilter();
+
+    return TestResult(TEST_NAME);
+}
@@ -0,0 +1,119 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - Md5MbBench.cpp
+
+Abstract:
+
+    - MD5 of 10,000 synthetic sections, one by one with the reference code and
+      through the multi-buffer engine, as in !ms_hash /bench.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <string.h>
+#include <vector>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "Md5Mb.h"
+#include "Test.h"
+
+#define BENCH_SIZE (64 * 1024 * 1024)
+#define BENCH_SECTIONS 10000
+#define BENCH_RUNS 5
+
+int
+main(
+)
+{
+    static const LPCSTR Names[] = { "Reference", "Multi-buffer" };
+    vector<UCHAR> Buffer(BENCH_SIZE);
+    vector<MD5_JOB> Sections(BENCH_SECTIONS);
+    vector<UCHAR> Reference(BENCH_SECTIONS * MD5_DIGEST_SIZE);
+    ULONG64 SectionBytes = 0;
+    ULONG Seed = 0x4d534d42, Mismatches = 0;
+    double Best[2] = { 0.0, 0.0 };
+
+    for (ULONG i = 0; i < BENCH_SIZE; i += 1) Buffer[i] = (UCHAR)((i * 2654435761UL) >> 24);
+
+    for (ULONG i = 0; i < BENCH_SECTIONS; i += 1)
+    {
+        Seed = (Seed * 1103515245) + 12345;
+        Sections[i].Length = 0x200 + ((Seed >> 8) % 0x8000);
+        Sections[i].Data = &Buffer[(Seed >> 4) % (BENCH_SIZE - Sections[i].Length)];
+        SectionBytes += Sections[i].Length;
+    }
+
+    for (ULONG Run = 0; Run < BENCH_RUNS; Run += 1)
+    {
+        double Start = TestSeconds();
+
+        for (ULONG i = 0; i < BENCH_SECTIONS; i += 1)
+        {
+            MD5_CONTEXT Context;
+
+            MD5Init(&Context);
+            MD5Update(&Context, (PUCHAR)Sections[i].Data, (ULONG)Sections[i].Length);
+            MD5Final(&Context);
+
+            memcpy(&Reference[i * MD5_DIGEST_SIZE], Context.Digest, MD5_DIGEST_SIZE);
+        }
+
+        double Seconds = TestSeconds() - Start;
+        if (!Best[0] || (Seconds < Best[0])) Best[0] = Seconds;
+
+        Start = TestSeconds();
+        MD5MultiBuffer(Sections.data(), BENCH_SECTIONS);
+
+        Seconds = TestSeconds() - Start;
+        if (!Best[1] || (Seconds < Best[1])) Best[1] = Seconds;
+    }
+
+    for (ULONG i = 0; i < BENCH_SECTIONS; i += 1)
+    {
+        if (memcmp(&Reference[i * MD5_DIGEST_SIZE], Sections[i].Digest, MD5_DIGEST_SIZE)) Mismatches += 1;
+    }
+
+    printf("MD5 of %d sections (%llu MB, %u lanes, best of %d):\n",
+           BENCH_SECTIONS, (unsigned long long)(SectionBytes / (1024 * 1024)), MD5MultiBufferLanes(), BENCH_RUNS);
+
+    for (ULONG i = 0; i < _countof(Names); i += 1)
+    {
+        printf("    %-16s %6.0f ms  %5.2f GB/s\n", Names[i], Best[i] * 1000, (SectionBytes / Best[i]) / 1e9);
+    }
+
+    printf("    %-16s %6.1fx\n", "Speedup", Best[0] / Best[1]);
+
+    CHECK(Mismatches == 0);
+
+    return TestResult("Md5MbBench");
+}
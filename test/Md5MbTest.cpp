@@ -0,0 +1,215 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - Md5MbTest.cpp
+
+Abstract:
+
+    - Multi-buffer MD5 against MD5Init/MD5Update/MD5Final: every length
+      around the padding boundaries, batches smaller and larger than the
+      lanes, one long message among short ones, and the queue.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <string.h>
+#include <vector>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "Md5Mb.h"
+#include "Test.h"
+
+#define TEST_DATA_SIZE (2 * 1024 * 1024)
+
+static vector<UCHAR> g_Data;
+
+static
+VOID
+GetMd5(
+    const UCHAR *Data,
+    SIZE_T Length,
+    PUCHAR Digest
+)
+{
+    MD5_CONTEXT Context;
+
+    MD5Init(&Context);
+    MD5Update(&Context, (PUCHAR)Data, (ULONG)Length);
+    MD5Final(&Context);
+
+    memcpy(Digest, Context.Digest, MD5_DIGEST_SIZE);
+}
+
+//
+// Number of jobs whose digest is not the one of MD5Final.
+//
+static
+ULONG
+RunJobs(
+    vector<MD5_JOB>& Jobs
+)
+{
+    ULONG Different = 0;
+
+    for (ULONG i = 0; i < Jobs.size(); i += 1) memset(Jobs[i].Digest, 0xCC, sizeof(Jobs[i].Digest));
+
+    MD5MultiBuffer(Jobs.data(), (ULONG)Jobs.size());
+
+    for (ULONG i = 0; i < Jobs.size(); i += 1)
+    {
+        UCHAR Expected[MD5_DIGEST_SIZE];
+
+        GetMd5(Jobs[i].Data, Jobs[i].Length, Expected);
+        if (memcmp(Expected, Jobs[i].Digest, MD5_DIGEST_SIZE)) Different += 1;
+    }
+
+    return Different;
+}
+
+static
+VOID
+TestLengths(
+)
+{
+    vector<MD5_JOB> Jobs(300);
+
+    //
+    // 55/56 and 119/120 bytes change the number of padding blocks.
+    //
+    for (ULONG i = 0; i < Jobs.size(); i += 1)
+    {
+        Jobs[i].Data = &g_Data[i];
+        Jobs[i].Length = i;
+    }
+
+    CHECK(RunJobs(Jobs) == 0);
+}
+
+static
+VOID
+TestCounts(
+)
+{
+    static const ULONG Counts[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 100, 10000 };
+    unsigned long long Seed = 0x34;
+
+    for (ULONG c = 0; c < _countof(Counts); c += 1)
+    {
+        vector<MD5_JOB> Jobs(Counts[c]);
+
+        for (ULONG i = 0; i < Jobs.size(); i += 1)
+        {
+            Jobs[i].Length = 0x200 + (TestRandom(&Seed) % 0x8000);
+            Jobs[i].Data = &g_Data[TestRandom(&Seed) % (TEST_DATA_SIZE - Jobs[i].Length)];
+        }
+
+        ULONG Different = RunJobs(Jobs);
+
+        if (Different) printf("       %u jobs: %u digest(s) differ\n", Counts[c], Different);
+        CHECK(Different == 0);
+    }
+}
+
+//
+// The long message keeps its lane after the others are done, then goes through the scalar drain.
+//
+static
+VOID
+TestSkewed(
+)
+{
+    vector<MD5_JOB> Jobs(40);
+
+    for (ULONG i = 0; i < Jobs.size(); i += 1)
+    {
+        Jobs[i].Data = &g_Data[0];
+        Jobs[i].Length = i ? (i * 37) : TEST_DATA_SIZE;
+    }
+
+    CHECK(RunJobs(Jobs) == 0);
+
+    //
+    // Same data, same digest, whatever the lane.
+    //
+    for (ULONG i = 0; i < Jobs.size(); i += 1) Jobs[i].Length = 1000;
+
+    CHECK(RunJobs(Jobs) == 0);
+    for (ULONG i = 1; i < Jobs.size(); i += 1) CHECK(memcmp(Jobs[0].Digest, Jobs[i].Digest, MD5_DIGEST_SIZE) == 0);
+}
+
+static
+VOID
+TestQueue(
+)
+{
+    Md5Queue Queue;
+    vector<HASH_DIGESTS> Digests(50);
+    ULONG Different = 0;
+
+    Queue.Flush();
+    CHECK(Queue.GetCount() == 0);
+
+    for (ULONG i = 0; i < Digests.size(); i += 1) Queue.Submit(&g_Data[i * 100], i * 1000, Digests[i].Md5);
+
+    CHECK(Queue.GetCount() == Digests.size());
+    Queue.Flush();
+    CHECK(Queue.GetCount() == 0);
+
+    for (ULONG i = 0; i < Digests.size(); i += 1)
+    {
+        UCHAR Expected[MD5_DIGEST_SIZE];
+
+        GetMd5(&g_Data[i * 100], i * 1000, Expected);
+        if (memcmp(Expected, Digests[i].Md5, MD5_DIGEST_SIZE)) Different += 1;
+    }
+
+    CHECK(Different == 0);
+}
+
+int
+main(
+)
+{
+    unsigned long long Seed = 0x4D;
+
+    g_Data.resize(TEST_DATA_SIZE);
+    for (ULONG i = 0; i < TEST_DATA_SIZE; i += 1) g_Data[i] = (UCHAR)TestRandom(&Seed);
+
+    printf("       %u MD5 lanes\n", MD5MultiBufferLanes());
+
+    TestLengths();
+    TestCounts();
+    TestSkewed();
+    TestQueue();
+
+    return TestResult("Md5Mb");
+}
@@ -0,0 +1,172 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - PatternMatcherBench.cpp
+
+Abstract:
+
+    - MB/s of the automaton and of the former scan (every pattern at every
+      offset) on a synthetic buffer, with a pattern set the size of the
+      MalScore one: hex patterns with wildcards and API names.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <string.h>
+#include <vector>
+using namespace std;
+
+#include "PatternMatcher.h"
+#include "Test.h"
+
+#define BENCH_SIZE (16 * 1024 * 1024)
+#define BENCH_NAIVE_SIZE (1024 * 1024)
+#define BENCH_HEX_PATTERNS 120
+#define BENCH_NAME_PATTERNS 400
+#define BENCH_RUNS 3
+
+typedef struct _BENCH_PATTERN {
+    vector<UCHAR> Bytes;
+    vector<UCHAR> Mask;
+} BENCH_PATTERN, *PBENCH_PATTERN;
+
+static
+ULONG
+NaiveScan(
+    const vector<BENCH_PATTERN>& Patterns,
+    const UCHAR *Buffer,
+    ULONG Length
+)
+{
+    ULONG Count = 0;
+
+    for (ULONG Offset = 0; Offset < Length; Offset += 1)
+    {
+        for (ULONG p = 0; p < Patterns.size(); p += 1)
+        {
+            const BENCH_PATTERN *Pattern = &Patterns[p];
+            ULONG i;
+
+            if (Pattern->Bytes.size() > (Length - Offset)) continue;
+
+            for (i = 0; i < Pattern->Bytes.size(); i += 1)
+            {
+                if (Pattern->Mask[i] && (Buffer[Offset + i] != Pattern->Bytes[i])) break;
+            }
+
+            if (i == Pattern->Bytes.size()) Count += 1;
+        }
+    }
+
+    return Count;
+}
+
+int
+main(
+)
+{
+    unsigned long long Seed = 0x4D5A;
+    vector<BENCH_PATTERN> Patterns;
+    vector<UCHAR> Buffer(BENCH_SIZE);
+    PatternMatcher Matcher;
+    double Best[2] = { 0.0, 0.0 };
+    ULONG Found[2] = { 0, 0 };
+
+    //
+    // Code-like hex patterns, one byte in five a wildcard, then API names.
+    //
+    for (ULONG p = 0; p < BENCH_HEX_PATTERNS + BENCH_NAME_PATTERNS; p += 1)
+    {
+        BENCH_PATTERN Pattern;
+        ULONG Length = (p < BENCH_HEX_PATTERNS) ? 4 + (TestRandom(&Seed) % 8) : 8 + (TestRandom(&Seed) % 16);
+
+        for (ULONG i = 0; i < Length; i += 1)
+        {
+            BOOLEAN Wildcard = (p < BENCH_HEX_PATTERNS) && i && ((TestRandom(&Seed) % 5) == 0);
+            UCHAR Byte = (p < BENCH_HEX_PATTERNS) ? (UCHAR)TestRandom(&Seed) : (UCHAR)('A' + (TestRandom(&Seed) % 52));
+
+            Pattern.Bytes.push_back(Wildcard ? 0 : Byte);
+            Pattern.Mask.push_back(Wildcard ? 0 : 0xFF);
+        }
+
+        Matcher.Add(p, &Pattern.Bytes[0], &Pattern.Mask[0], Length);
+        Patterns.push_back(Pattern);
+    }
+
+    Matcher.Compile();
+
+    for (ULONG i = 0; i < BENCH_SIZE; i += 1) Buffer[i] = (UCHAR)TestRandom(&Seed);
+
+    for (ULONG n = 0; n < BENCH_SIZE / 4096; n += 1)
+    {
+        const BENCH_PATTERN *Pattern = &Patterns[TestRandom(&Seed) % Patterns.size()];
+        ULONG Offset = TestRandom(&Seed) % (BENCH_SIZE - 64);
+
+        for (ULONG i = 0; i < Pattern->Bytes.size(); i += 1)
+        {
+            if (Pattern->Mask[i]) Buffer[Offset + i] = Pattern->Bytes[i];
+        }
+    }
+
+    for (ULONG Run = 0; Run < BENCH_RUNS; Run += 1)
+    {
+        vector<PatternMatcher::PATTERN_MATCH> Matches;
+        vector<PatternMatcher::PATTERN_MATCH> Prefix;
+        double Start = TestSeconds();
+
+        Matcher.Scan(&Buffer[0], BENCH_SIZE, Matches);
+
+        double Seconds = TestSeconds() - Start;
+        if (!Best[0] || (Seconds < Best[0])) Best[0] = Seconds;
+
+        Start = TestSeconds();
+        Found[1] = NaiveScan(Patterns, &Buffer[0], BENCH_NAIVE_SIZE);
+
+        Seconds = TestSeconds() - Start;
+        if (!Best[1] || (Seconds < Best[1])) Best[1] = Seconds;
+
+        Found[0] = Matcher.Scan(&Buffer[0], BENCH_NAIVE_SIZE, Prefix);
+    }
+
+    double Rates[2] = { (BENCH_SIZE / Best[0]) / (1024 * 1024), (BENCH_NAIVE_SIZE / Best[1]) / (1024 * 1024) };
+
+    printf("Pattern matching (%d patterns, %d states, best of %d):\n",
+           (ULONG)Patterns.size(), Matcher.GetNumberOfStates(), BENCH_RUNS);
+    printf("    %-16s %8.0f MB/s  %6.1f s per 2 GB\n", "Automaton", Rates[0], 2048 / Rates[0]);
+    printf("    %-16s %8.1f MB/s  %6.1f s per 2 GB\n", "Every pattern", Rates[1], 2048 / Rates[1]);
+
+    //
+    // Same matches over the part both scanned.
+    //
+    CHECK(Found[0] == Found[1]);
+    CHECK(Found[0] > 0);
+
+    return TestResult("PatternMatcherBench");
+}
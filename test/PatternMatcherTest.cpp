@@ -0,0 +1,385 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - PatternMatcherTest.cpp
+
+Abstract:
+
+    - Matches of the automaton against a naive scan of every pattern at every
+      offset: wildcards, patterns inside of other patterns, duplicates, dense
+      and sparse automata, and a saved then loaded automaton.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+using namespace std;
+
+#include "PatternMatcher.h"
+#include "Test.h"
+
+typedef struct _TEST_PATTERN {
+    ULONG Id;
+    vector<UCHAR> Bytes;
+    vector<UCHAR> Mask;
+} TEST_PATTERN, *PTEST_PATTERN;
+
+static
+VOID
+NaiveScan(
+    const vector<TEST_PATTERN>& Patterns,
+    const UCHAR *Buffer,
+    ULONG Length,
+    vector<PatternMatcher::PATTERN_MATCH>& Matches
+)
+{
+    for (ULONG Offset = 0; Offset < Length; Offset += 1)
+    {
+        for (ULONG p = 0; p < Patterns.size(); p += 1)
+        {
+            const TEST_PATTERN *Pattern = &Patterns[p];
+            ULONG i;
+
+            if (Pattern->Bytes.size() > (Length - Offset)) continue;
+
+            for (i = 0; i < Pattern->Bytes.size(); i += 1)
+            {
+                if (Pattern->Mask[i] && (Buffer[Offset + i] != Pattern->Bytes[i])) break;
+            }
+
+            if (i == Pattern->Bytes.size())
+            {
+                PatternMatcher::PATTERN_MATCH Match = { Offset, Pattern->Id };
+                Matches.push_back(Match);
+            }
+        }
+    }
+
+    sort(Matches.begin(), Matches.end(), [](const PatternMatcher::PATTERN_MATCH& a, const PatternMatcher::PATTERN_MATCH& b) {
+        return (a.Offset != b.Offset) ? (a.Offset < b.Offset) : (a.Id < b.Id);
+    });
+}
+
+static
+BOOLEAN
+SameMatches(
+    const vector<PatternMatcher::PATTERN_MATCH>& a,
+    const vector<PatternMatcher::PATTERN_MATCH>& b
+)
+{
+    if (a.size() != b.size()) return FALSE;
+
+    for (ULONG i = 0; i < a.size(); i += 1)
+    {
+        if ((a[i].Offset != b[i].Offset) || (a[i].Id != b[i].Id)) return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+// Patterns over a small alphabet so that they overlap and contain each other, with
+// wildcards anywhere but never a pattern of wildcards only.
+//
+static
+VOID
+GeneratePatterns(
+    vector<TEST_PATTERN>& Patterns,
+    ULONG Count,
+    ULONG MaxLength,
+    ULONG Alphabet,
+    unsigned long long *Seed
+)
+{
+    for (ULONG p = 0; p < Count; p += 1)
+    {
+        TEST_PATTERN Pattern;
+        ULONG Length = 1 + (TestRandom(Seed) % MaxLength);
+        BOOLEAN Significant = FALSE;
+
+        Pattern.Id = p;
+
+        for (ULONG i = 0; i < Length; i += 1)
+        {
+            BOOLEAN Wildcard = ((TestRandom(Seed) % 6) == 0) ? TRUE : FALSE;
+
+            if ((i == Length - 1) && !Significant) Wildcard = FALSE;
+
+            Pattern.Bytes.push_back(Wildcard ? 0 : (UCHAR)(TestRandom(Seed) % Alphabet));
+            Pattern.Mask.push_back(Wildcard ? 0 : 0xFF);
+            if (!Wildcard) Significant = TRUE;
+        }
+
+        Patterns.push_back(Pattern);
+
+        //
+        // Same bytes under another id.
+        //
+        if ((p % 50) == 49)
+        {
+            Pattern.Id = ++p;
+            Patterns.push_back(Pattern);
+        }
+    }
+}
+
+static
+VOID
+AddPatterns(
+    PatternMatcher& Matcher,
+    const vector<TEST_PATTERN>& Patterns
+)
+{
+    for (ULONG p = 0; p < Patterns.size(); p += 1)
+    {
+        const TEST_PATTERN *Pattern = &Patterns[p];
+
+        CHECK(Matcher.Add(Pattern->Id, &Pattern->Bytes[0], &Pattern->Mask[0], (ULONG)Pattern->Bytes.size()));
+    }
+
+    Matcher.Compile();
+}
+
+//
+// Random buffer of the same alphabet with copies of the patterns planted in it.
+//
+static
+VOID
+GenerateBuffer(
+    vector<UCHAR>& Buffer,
+    ULONG Length,
+    const vector<TEST_PATTERN>& Patterns,
+    ULONG Alphabet,
+    unsigned long long *Seed
+)
+{
+    Buffer.resize(Length);
+
+    for (ULONG i = 0; i < Length; i += 1) Buffer[i] = (UCHAR)(TestRandom(Seed) % Alphabet);
+
+    for (ULONG n = 0; n < Length / 64; n += 1)
+    {
+        const TEST_PATTERN *Pattern = &Patterns[TestRandom(Seed) % Patterns.size()];
+        ULONG Offset = TestRandom(Seed) % Length;
+
+        for (ULONG i = 0; (i < Pattern->Bytes.size()) && ((Offset + i) < Length); i += 1)
+        {
+            if (Pattern->Mask[i]) Buffer[Offset + i] = Pattern->Bytes[i];
+        }
+    }
+}
+
+static
+VOID
+TestRandomSets(
+)
+{
+    static const struct {
+        ULONG Count;
+        ULONG MaxLength;
+        ULONG Alphabet;
+    } Sets[] = {
+        { 1, 4, 4 },
+        { 10, 3, 2 },
+        { 50, 8, 4 },
+        { 200, 12, 16 },
+        { 300, 24, 256 },
+    };
+
+    unsigned long long Seed = 0x40;
+
+    for (ULONG s = 0; s < _countof(Sets); s += 1)
+    {
+        vector<TEST_PATTERN> Patterns;
+        PatternMatcher Matcher;
+
+        GeneratePatterns(Patterns, Sets[s].Count, Sets[s].MaxLength, Sets[s].Alphabet, &Seed);
+        AddPatterns(Matcher, Patterns);
+
+        CHECK(Matcher.IsDense());
+
+        for (ULONG Run = 0; Run < 4; Run += 1)
+        {
+            vector<UCHAR> Buffer;
+            vector<PatternMatcher::PATTERN_MATCH> Matches, Expected;
+
+            //
+            // Short buffers too, shorter than some patterns.
+            //
+            GenerateBuffer(Buffer, Run ? 20000 : 1 + (TestRandom(&Seed) % 16), Patterns, Sets[s].Alphabet, &Seed);
+
+            CHECK(Matcher.Scan(&Buffer[0], (ULONG)Buffer.size(), Matches) == Matches.size());
+            NaiveScan(Patterns, &Buffer[0], (ULONG)Buffer.size(), Expected);
+
+            if (!SameMatches(Matches, Expected))
+            {
+                printf("       set %u run %u: %u matches, %u expected\n", s, Run, (ULONG)Matches.size(), (ULONG)Expected.size());
+            }
+
+            CHECK(SameMatches(Matches, Expected));
+        }
+    }
+}
+
+//
+// Enough states to go past PATTERN_MAX_DENSE_ENTRIES, deep states keep sparse transitions.
+//
+static
+VOID
+TestSparse(
+)
+{
+    unsigned long long Seed = 0x41;
+    vector<TEST_PATTERN> Patterns;
+    PatternMatcher Matcher;
+    vector<UCHAR> Buffer;
+    vector<PatternMatcher::PATTERN_MATCH> Matches, Expected;
+
+    GeneratePatterns(Patterns, 8000, 24, 256, &Seed);
+    AddPatterns(Matcher, Patterns);
+
+    CHECK(!Matcher.IsDense());
+
+    GenerateBuffer(Buffer, 30000, Patterns, 256, &Seed);
+
+    Matcher.Scan(&Buffer[0], (ULONG)Buffer.size(), Matches);
+    NaiveScan(Patterns, &Buffer[0], (ULONG)Buffer.size(), Expected);
+
+    CHECK(Expected.size() > 300);
+    CHECK(SameMatches(Matches, Expected));
+}
+
+static
+VOID
+TestSaveLoad(
+)
+{
+    unsigned long long Seed = 0x42;
+    vector<TEST_PATTERN> Patterns;
+    PatternMatcher Matcher, Loaded, Broken;
+    vector<UCHAR> Buffer, Saved;
+    vector<PatternMatcher::PATTERN_MATCH> Matches, LoadedMatches;
+    FILE *File = tmpfile();
+
+    if (File == NULL)
+    {
+        CHECK(File != NULL);
+        return;
+    }
+
+    GeneratePatterns(Patterns, 100, 10, 8, &Seed);
+    AddPatterns(Matcher, Patterns);
+
+    CHECK(Matcher.Save(File));
+
+    Saved.resize((ULONG)ftell(File));
+    rewind(File);
+    CHECK(fread(&Saved[0], 1, Saved.size(), File) == Saved.size());
+
+    rewind(File);
+    CHECK(Loaded.Load(File));
+    CHECK(Loaded.GetNumberOfStates() == Matcher.GetNumberOfStates());
+    CHECK(Loaded.GetMaxLength() == Matcher.GetMaxLength());
+
+    GenerateBuffer(Buffer, 20000, Patterns, 8, &Seed);
+    Matcher.Scan(&Buffer[0], (ULONG)Buffer.size(), Matches);
+    Loaded.Scan(&Buffer[0], (ULONG)Buffer.size(), LoadedMatches);
+
+    CHECK(Matches.size() > 0);
+    CHECK(SameMatches(Matches, LoadedMatches));
+
+    fclose(File);
+
+    //
+    // Truncated file.
+    //
+    File = tmpfile();
+    if (File == NULL) return;
+
+    CHECK(fwrite(&Saved[0], 1, Saved.size() / 2, File) == Saved.size() / 2);
+    rewind(File);
+
+    CHECK(!Broken.Load(File));
+    CHECK(Broken.GetNumberOfStates() <= 1);
+
+    fclose(File);
+}
+
+static
+VOID
+TestHex(
+)
+{
+    static const UCHAR Buffer[] = { 0x90, 0x6A, 0x30, 0x58, 0x64, 0x8B, 0x00, 0x6A, 0x30, 0x59, 0x64, 0x8B };
+    static const UCHAR Wildcards[] = { 0x00, 0x00 };
+    PatternMatcher Matcher;
+    vector<PatternMatcher::PATTERN_MATCH> Matches;
+
+    CHECK(Matcher.AddHex(7, "6a30??648b"));
+    CHECK(Matcher.AddHex(8, "648B"));
+    CHECK(!Matcher.AddHex(9, "????"));
+    CHECK(!Matcher.AddHex(10, "6a3"));
+    CHECK(!Matcher.Add(11, Wildcards, Wildcards, sizeof(Wildcards)));
+
+    Matcher.Compile();
+
+    if (Matcher.Scan(Buffer, sizeof(Buffer), Matches) == 4)
+    {
+        CHECK((Matches[0].Offset == 1) && (Matches[0].Id == 7));
+        CHECK((Matches[1].Offset == 4) && (Matches[1].Id == 8));
+        CHECK((Matches[2].Offset == 7) && (Matches[2].Id == 7));
+        CHECK((Matches[3].Offset == 10) && (Matches[3].Id == 8));
+    }
+    else
+    {
+        CHECK(Matches.size() == 4);
+    }
+
+    //
+    // Both patterns at the end would end past the buffer.
+    //
+    Matches.clear();
+    CHECK(Matcher.Scan(Buffer, sizeof(Buffer) - 1, Matches) == 2);
+}
+
+int
+main(
+)
+{
+    TestRandomSets();
+    TestSparse();
+    TestSaveLoad();
+    TestHex();
+
+    return TestResult("PatternMatcher");
+}
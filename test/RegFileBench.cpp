@@ -0,0 +1,275 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - RegFileBench.cpp
+
+Abstract:
+
+    - Enumeration of a generated hive of about 200 MB, the size of a large
+      SOFTWARE hive: every key, value name and value data, as !ms_regfile
+      /values does without the output.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wctype.h>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "RegFile.h"
+#include "TestHive.h"
+#include "Test.h"
+
+//
+// 64 keys of 64 keys of 44 keys, 4 values each, a big value every 4096 keys.
+//
+#define BENCH_FANOUT_1 64
+#define BENCH_FANOUT_2 64
+#define BENCH_FANOUT_3 44
+#define BENCH_VALUES 4
+#define BENCH_BIG_VALUE_EVERY 4096
+#define BENCH_BIG_VALUE_SIZE (3 * REGF_BIG_DATA_SEGMENT)
+
+#define BENCH_RUNS 3
+
+//
+// Seconds for the whole hive.
+//
+#define BENCH_TARGET_SECONDS 3.0
+
+typedef struct _BENCH_CONTEXT {
+    RegFile *Hive;
+    vector<UCHAR> Buffer;
+    ULONG64 Keys;
+    ULONG64 Values;
+    ULONG64 DataBytes;
+    ULONG Sum;
+} BENCH_CONTEXT, *PBENCH_CONTEXT;
+
+static UCHAR g_Data[BENCH_BIG_VALUE_SIZE + 64]; // Values start at one of the first 64 bytes.
+
+static
+ULONG
+AddKey(
+    TestHive& Hive,
+    ULONG Parent,
+    ULONG Index,
+    ULONG Security,
+    unsigned long long *Seed
+)
+{
+    vector<ULONG> Values;
+    WCHAR Name[32];
+    ULONG Cell;
+
+    swprintf(Name, _countof(Name), L"{%08X-Key}", Index * 2654435761U);
+    Cell = Hive.AddKey(Parent, Name, TRUE, Security);
+
+    for (ULONG i = 0; i < BENCH_VALUES; i += 1)
+    {
+        ULONG Length = (i == 0) ? sizeof(ULONG) : (16 + (ULONG)(TestRandom(Seed) % 497));
+
+        if ((i == 1) && ((Index % BENCH_BIG_VALUE_EVERY) == 0)) Length = BENCH_BIG_VALUE_SIZE;
+
+        swprintf(Name, _countof(Name), L"Value%u", i);
+        Values.push_back(Hive.AddValue(Name, TRUE, (i == 0) ? 4 : 3, &g_Data[TestRandom(Seed) % 64], Length, TRUE));
+    }
+
+    Hive.SetValues(Cell, Values);
+
+    return Cell;
+}
+
+static
+VOID
+SetSubKeys(
+    TestHive& Hive,
+    ULONG Key,
+    const vector<ULONG>& SubKeys
+)
+{
+    vector<ULONG> Leaves;
+
+    //
+    // lh leaves of 16 under an ri list, as the kernel splits big lists.
+    //
+    for (ULONG i = 0; i < SubKeys.size(); i += 16)
+    {
+        vector<ULONG> Leaf(SubKeys.begin() + i, SubKeys.begin() + min((ULONG)SubKeys.size(), i + 16));
+
+        Leaves.push_back(Hive.AddList(REGF_HASH_LEAF_SIGNATURE, Leaf));
+    }
+
+    Hive.SetSubKeys(Key, Hive.AddList(REGF_INDEX_ROOT_SIGNATURE, Leaves), (ULONG)SubKeys.size());
+}
+
+static
+ULONG
+GetHive(
+    vector<UCHAR>& File
+)
+{
+    static const UCHAR Descriptor[] = { 1, 0, 4, 0x80, 0x14, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    unsigned long long Seed = 0x50;
+    TestHive Hive;
+    vector<ULONG> Level1;
+    ULONG Security, Root, Index = 0;
+
+    for (ULONG i = 0; i < sizeof(g_Data); i += 1) g_Data[i] = (UCHAR)TestRandom(&Seed);
+
+    Security = Hive.AddSecurity(Descriptor, sizeof(Descriptor));
+    Root = AddKey(Hive, REGF_CELL_NIL, Index++, Security, &Seed);
+
+    for (ULONG i = 0; i < BENCH_FANOUT_1; i += 1)
+    {
+        ULONG Key1 = AddKey(Hive, Root, Index++, Security, &Seed);
+        vector<ULONG> Level2;
+
+        for (ULONG j = 0; j < BENCH_FANOUT_2; j += 1)
+        {
+            ULONG Key2 = AddKey(Hive, Key1, Index++, Security, &Seed);
+            vector<ULONG> Level3;
+
+            for (ULONG k = 0; k < BENCH_FANOUT_3; k += 1) Level3.push_back(AddKey(Hive, Key2, Index++, Security, &Seed));
+
+            SetSubKeys(Hive, Key2, Level3);
+            Level2.push_back(Key2);
+        }
+
+        SetSubKeys(Hive, Key1, Level2);
+        Level1.push_back(Key1);
+    }
+
+    SetSubKeys(Hive, Root, Level1);
+
+    Hive.GetFile(Root, 5, File);
+
+    return Index;
+}
+
+static
+BOOLEAN
+EnumerateKey(
+    PVOID Context,
+    RegFile::PREGF_KEY Key
+)
+{
+    PBENCH_CONTEXT Bench = (PBENCH_CONTEXT)Context;
+    RegFile::REGF_VALUE Value;
+    const UCHAR *Data;
+    ULONG DataLength;
+    WCHAR Name[256];
+
+    RegFile::GetName(Key->Name, Key->NameLength, Key->CompressedName, Name, _countof(Name));
+    Bench->Sum += Name[1];
+    Bench->Keys += 1;
+
+    for (ULONG i = 0; Bench->Hive->GetValue(Key, i, &Value); i += 1)
+    {
+        RegFile::GetName(Value.Name, Value.NameLength, Value.CompressedName, Name, _countof(Name));
+
+        if (Bench->Hive->GetValueData(&Value, Bench->Buffer, &Data, &DataLength) && DataLength)
+        {
+            Bench->Sum += Data[0] + Data[DataLength - 1];
+            Bench->DataBytes += DataLength;
+        }
+
+        Bench->Values += 1;
+    }
+
+    return TRUE;
+}
+
+int
+main(
+)
+{
+    char FileName[] = "/tmp/RegFileBench.XXXXXX";
+    vector<UCHAR> File;
+    ULONG NumberOfKeys;
+    int Fd;
+
+    NumberOfKeys = GetHive(File);
+
+    Fd = mkstemp(FileName);
+    CHECK(Fd >= 0);
+    if (Fd >= 0) close(Fd);
+
+    CHECK(TestHive::WriteFile(FileName, File));
+
+    printf("RegFile enumeration (%u keys, %u MB hive, %.1f s target):\n",
+           NumberOfKeys, (ULONG)(File.size() / (1024 * 1024)), BENCH_TARGET_SECONDS);
+
+    vector<UCHAR>().swap(File);
+
+    for (ULONG Run = 0; Run < BENCH_RUNS; Run += 1)
+    {
+        BENCH_CONTEXT Context;
+        RegFile Hive;
+        RegFile::REGF_KEY Root;
+        double Start, Opened, Seconds;
+
+        Context.Hive = &Hive;
+        Context.Keys = 0;
+        Context.Values = 0;
+        Context.DataBytes = 0;
+        Context.Sum = 0;
+
+        Start = TestSeconds();
+
+        CHECK(Hive.Open(FileName));
+        CHECK(Hive.GetRootKey(&Root));
+
+        Opened = TestSeconds();
+
+        Hive.Walk(&Root, 0, EnumerateKey, &Context);
+
+        Seconds = TestSeconds() - Start;
+
+        printf("    open %5.1f ms  walk %6.0f ms  %6.0f MB/s  %7.0f keys/s  %llu values  %llu MB of data%s\n",
+               (Opened - Start) * 1000, (Seconds - (Opened - Start)) * 1000,
+               Seconds ? (Hive.m_FileSize / Seconds) / (1024 * 1024) : 0.0,
+               Seconds ? Context.Keys / Seconds : 0.0,
+               (unsigned long long)Context.Values, (unsigned long long)(Context.DataBytes / (1024 * 1024)),
+               (Seconds > BENCH_TARGET_SECONDS) ? "  below target" : "");
+
+        CHECK(Context.Keys == NumberOfKeys);
+        CHECK(Context.Values == (ULONG64)NumberOfKeys * BENCH_VALUES);
+        CHECK(Hive.m_InvalidCells == 0);
+    }
+
+    remove(FileName);
+
+    return TestResult("RegFileBench");
+}
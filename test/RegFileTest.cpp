@@ -0,0 +1,1064 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - RegFileTest.cpp
+
+Abstract:
+
+    - RegFile on synthetic hives: base block checks, keys spread over many
+      hbins (some bigger than a page), lf/lh/li/ri subkey lists, inline,
+      single cell and db values, walks and lookups against the tree the hive
+      was written from. Out of range, unaligned, free and truncated cells
+      are skipped or rejected without reading past the file.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wctype.h>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "RegFile.h"
+#include "TestHive.h"
+#include "Test.h"
+
+#define TEST_KEYS 3000
+#define TEST_MAX_DEPTH 6
+#define TEST_OUT_OF_RANGE 0x7FFFFFF8
+
+typedef struct _TEST_VALUE {
+    wstring Name;
+    BOOLEAN Compressed;
+    ULONG Type;
+    vector<UCHAR> Data;
+    ULONG Cell;
+} TEST_VALUE, *PTEST_VALUE;
+
+typedef struct _TEST_KEY {
+    wstring Name;
+    BOOLEAN Compressed;
+    ULONG Depth;
+    ULONG Parent; // Index in the tree.
+    vector<ULONG> SubKeys;
+    vector<TEST_VALUE> Values;
+    ULONG Cell;
+    ULONG List; // Subkey list cell.
+    USHORT ListSignature;
+} TEST_KEY, *PTEST_KEY;
+
+//
+// The tree in pre-order: the order of RegFile::Walk().
+//
+static vector<TEST_KEY> g_Tree;
+static vector<ULONG> g_PreOrder;
+static ULONG g_Security;
+static char g_FileName[] = "/tmp/RegFileTest.XXXXXX";
+
+static const UCHAR g_Descriptor[] = { 1, 0, 4, 0x80, 0x14, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+static
+VOID
+AddValues(
+    PTEST_KEY Key,
+    unsigned long long *Seed,
+    BOOLEAN Big
+)
+{
+    ULONG NumberOfValues = TestRandom(Seed) % 5;
+
+    for (ULONG i = 0; i < NumberOfValues; i += 1)
+    {
+        TEST_VALUE Value;
+        ULONG Length;
+        WCHAR Name[32];
+
+        //
+        // Default value, inline sizes, single cells and, rarely, values bigger than a segment.
+        //
+        switch (TestRandom(Seed) % 8)
+        {
+            case 0: Length = 0; break;
+            case 1: Length = 1 + (TestRandom(Seed) % 4); break;
+            case 2: Length = Big ? (REGF_BIG_DATA_SEGMENT + 1 + (TestRandom(Seed) % (2 * REGF_BIG_DATA_SEGMENT))) : 5; break;
+            default: Length = 5 + (TestRandom(Seed) % 300); break;
+        }
+
+        if (i == 0) Name[0] = L'\0';
+        else swprintf(Name, _countof(Name), (i & 1) ? L"Value%u" : L"Val\x00E9ur%u", i);
+
+        Value.Name = Name;
+        Value.Compressed = (i & 1) ? TRUE : FALSE;
+        Value.Type = 1 + (TestRandom(Seed) % 11);
+        Value.Data.resize(Length);
+        for (ULONG j = 0; j < Length; j += 1) Value.Data[j] = (UCHAR)TestRandom(Seed);
+
+        Key->Values.push_back(Value);
+    }
+}
+
+static
+VOID
+GetTree(
+    unsigned long long Seed,
+    BOOLEAN Big
+)
+{
+    g_Tree.clear();
+    g_PreOrder.clear();
+
+    TEST_KEY Root;
+
+    Root.Name = L"ROOT";
+    Root.Compressed = TRUE;
+    Root.Depth = 0;
+    Root.Parent = REGF_CELL_NIL;
+    Root.List = REGF_CELL_NIL;
+    Root.ListSignature = 0;
+    AddValues(&Root, &Seed, Big);
+    g_Tree.push_back(Root);
+
+    //
+    // Parents are picked at random among the keys so far, wide and deep subtrees.
+    //
+    for (ULONG i = 1; i < TEST_KEYS; i += 1)
+    {
+        TEST_KEY Key;
+        ULONG Parent = TestRandom(&Seed) % i;
+        WCHAR Name[32];
+
+        while (g_Tree[Parent].Depth >= TEST_MAX_DEPTH) Parent = g_Tree[Parent].Parent;
+
+        Key.Compressed = (TestRandom(&Seed) % 4) ? TRUE : FALSE;
+        swprintf(Name, _countof(Name), Key.Compressed ? L"Key%u" : L"Cl\x00E9\x4E2D%u", i);
+
+        Key.Name = Name;
+        Key.Depth = g_Tree[Parent].Depth + 1;
+        Key.Parent = Parent;
+        Key.List = REGF_CELL_NIL;
+        Key.ListSignature = 0;
+        AddValues(&Key, &Seed, Big);
+
+        g_Tree[Parent].SubKeys.push_back(i);
+        g_Tree.push_back(Key);
+    }
+
+    vector<ULONG> Stack(1, 0);
+
+    while (!Stack.empty())
+    {
+        ULONG Key = Stack.back();
+
+        Stack.pop_back();
+        g_PreOrder.push_back(Key);
+
+        for (ULONG i = (ULONG)g_Tree[Key].SubKeys.size(); i > 0; i -= 1) Stack.push_back(g_Tree[Key].SubKeys[i - 1]);
+    }
+}
+
+static
+ULONG
+WriteKey(
+    TestHive& Hive,
+    ULONG Index,
+    ULONG ParentCell,
+    unsigned long long *Seed,
+    BOOLEAN Big
+)
+{
+    static const USHORT Leaves[] = { REGF_FAST_LEAF_SIGNATURE, REGF_HASH_LEAF_SIGNATURE, REGF_INDEX_LEAF_SIGNATURE };
+    vector<ULONG> SubKeys;
+    vector<ULONG> Values;
+    ULONG Cell;
+
+    Cell = Hive.AddKey(ParentCell, g_Tree[Index].Name.c_str(), g_Tree[Index].Compressed, g_Security);
+    g_Tree[Index].Cell = Cell;
+
+    for (TEST_VALUE& Value : g_Tree[Index].Values)
+    {
+        Value.Cell = Hive.AddValue(Value.Name.c_str(), Value.Compressed, Value.Type,
+                                   Value.Data.empty() ? NULL : &Value.Data[0], (ULONG)Value.Data.size(), Big);
+        Values.push_back(Value.Cell);
+    }
+
+    if (!Values.empty()) Hive.SetValues(Cell, Values);
+
+    for (ULONG i = 0; i < g_Tree[Index].SubKeys.size(); i += 1)
+    {
+        SubKeys.push_back(WriteKey(Hive, g_Tree[Index].SubKeys[i], Cell, Seed, Big));
+    }
+
+    if (SubKeys.empty()) return Cell;
+
+    //
+    // Lists of more than 3 subkeys are split in leaves of an ri list once in two.
+    //
+    if ((SubKeys.size() > 3) && (TestRandom(Seed) & 1))
+    {
+        vector<ULONG> LeafCells;
+
+        for (ULONG i = 0; i < SubKeys.size(); )
+        {
+            ULONG Count = 1 + (ULONG)(TestRandom(Seed) % 4);
+            vector<ULONG> Leaf;
+
+            Count = min((ULONG)SubKeys.size() - i, Count);
+            Leaf.assign(SubKeys.begin() + i, SubKeys.begin() + i + Count);
+
+            LeafCells.push_back(Hive.AddList(Leaves[TestRandom(Seed) % _countof(Leaves)], Leaf));
+            i += Count;
+        }
+
+        g_Tree[Index].ListSignature = REGF_INDEX_ROOT_SIGNATURE;
+        g_Tree[Index].List = Hive.AddList(REGF_INDEX_ROOT_SIGNATURE, LeafCells);
+    }
+    else
+    {
+        g_Tree[Index].ListSignature = Leaves[TestRandom(Seed) % _countof(Leaves)];
+        g_Tree[Index].List = Hive.AddList(g_Tree[Index].ListSignature, SubKeys);
+    }
+
+    Hive.SetSubKeys(Cell, g_Tree[Index].List, (ULONG)SubKeys.size());
+
+    return Cell;
+}
+
+static
+VOID
+GetHive(
+    unsigned long long Seed,
+    ULONG Minor,
+    BOOLEAN Big,
+    vector<UCHAR>& File
+)
+{
+    TestHive Hive;
+
+    GetTree(Seed, Big);
+
+    g_Security = Hive.AddSecurity(g_Descriptor, sizeof(g_Descriptor));
+    WriteKey(Hive, 0, REGF_CELL_NIL, &Seed, Big);
+
+    Hive.GetFile(g_Tree[0].Cell, Minor, File);
+}
+
+static
+BOOLEAN
+OpenHive(
+    RegFile& Hive,
+    const vector<UCHAR>& File
+)
+{
+    CHECK(TestHive::WriteFile(g_FileName, File));
+
+    return Hive.Open(g_FileName);
+}
+
+static
+PULONG
+GetUlong(
+    vector<UCHAR>& File,
+    ULONG Cell,
+    ULONG Offset
+)
+{
+    return (PULONG)&File[REGF_BASE_BLOCK_SIZE + Cell + sizeof(LONG) + Offset];
+}
+
+static
+BOOLEAN
+IsName(
+    const UCHAR *Name,
+    USHORT NameLength,
+    BOOLEAN CompressedName,
+    const wstring& Expected
+)
+{
+    WCHAR Buffer[64];
+    ULONG Length = RegFile::GetName(Name, NameLength, CompressedName, Buffer, _countof(Buffer));
+
+    return (Length == Expected.size()) && (Expected == Buffer);
+}
+
+typedef struct _WALK_CONTEXT {
+    vector<RegFile::REGF_KEY> Keys;
+    ULONG Stop; // Stops the walk after that many keys.
+} WALK_CONTEXT, *PWALK_CONTEXT;
+
+static
+ULONG
+Walk(
+    RegFile& Hive,
+    RegFile::PREGF_KEY Key,
+    ULONG MaxDepth,
+    PWALK_CONTEXT Context
+)
+{
+    Context->Keys.clear();
+
+    Hive.Walk(Key, MaxDepth, [](PVOID Context, RegFile::PREGF_KEY Key) -> BOOLEAN
+    {
+        PWALK_CONTEXT Walk = (PWALK_CONTEXT)Context;
+
+        Walk->Keys.push_back(*Key);
+
+        return (Walk->Keys.size() != Walk->Stop);
+    }, Context);
+
+    return (ULONG)Context->Keys.size();
+}
+
+static
+VOID
+GetCells(
+    const WALK_CONTEXT& Context,
+    vector<ULONG>& Cells
+)
+{
+    Cells.clear();
+    for (const RegFile::REGF_KEY& Key : Context.Keys) Cells.push_back(Key.Cell);
+}
+
+//
+// Pre-order of the tree without the subkeys of Skipped, and without Skipped itself unless kept.
+//
+static
+VOID
+GetExpectedCells(
+    ULONG Skipped,
+    BOOLEAN KeepSkipped,
+    vector<ULONG>& Cells
+)
+{
+    ULONG SkippedDepth = 0;
+    BOOLEAN Skipping = FALSE;
+
+    Cells.clear();
+
+    for (ULONG Key : g_PreOrder)
+    {
+        if (Skipping && (g_Tree[Key].Depth <= SkippedDepth)) Skipping = FALSE;
+
+        if (Key == Skipped)
+        {
+            Skipping = TRUE;
+            SkippedDepth = g_Tree[Key].Depth;
+            if (KeepSkipped) Cells.push_back(g_Tree[Key].Cell);
+        }
+
+        if (!Skipping) Cells.push_back(g_Tree[Key].Cell);
+    }
+}
+
+//
+// Path from the root, lower case, for keys with ASCII names up to the root.
+//
+static
+BOOLEAN
+GetPath(
+    ULONG Key,
+    string& Path
+)
+{
+    Path.clear();
+
+    for (; Key != 0; Key = g_Tree[Key].Parent)
+    {
+        string Name;
+
+        if (!g_Tree[Key].Compressed) return FALSE;
+
+        for (WCHAR Character : g_Tree[Key].Name) Name += (CHAR)towlower(Character);
+        Path = Name + (Path.empty() ? "" : "\\") + Path;
+    }
+
+    return TRUE;
+}
+
+static
+VOID
+TestKeysAndValues(
+    ULONG Minor,
+    BOOLEAN Big
+)
+{
+    vector<UCHAR> File;
+    vector<UCHAR> Buffer;
+    vector<ULONG> Cells, Expected;
+    WALK_CONTEXT Context;
+    RegFile Hive;
+    RegFile::REGF_KEY Root, Key;
+    ULONG NumberOfDataCells = 0, NumberOfBigValues = 0, NumberOfPaths = 0;
+    string Path;
+
+    GetHive(0x50 + Minor, Minor, Big, File);
+
+    CHECK(OpenHive(Hive, File));
+    CHECK(Hive.m_Major == 1);
+    CHECK(Hive.m_Minor == Minor);
+    CHECK(Hive.m_ValidCheckSum);
+    CHECK(!Hive.m_Dirty);
+    CHECK(Hive.m_FileSize == File.size());
+    CHECK(Hive.GetRootKey(&Root));
+
+    //
+    // Every key once, depth first in list order, through every kind of list.
+    //
+    Context.Stop = 0;
+    CHECK(Walk(Hive, &Root, 0, &Context) == TEST_KEYS);
+    CHECK(Hive.m_InvalidCells == 0);
+
+    for (ULONG i = 0; (i < Context.Keys.size()) && (i < g_PreOrder.size()); i += 1)
+    {
+        PTEST_KEY Expected = &g_Tree[g_PreOrder[i]];
+        RegFile::PREGF_KEY Found = &Context.Keys[i];
+        RegFile::REGF_VALUE Value;
+        const UCHAR *Descriptor;
+        ULONG DescriptorLength;
+
+        CHECK(Found->Cell == Expected->Cell);
+        CHECK(Found->Depth == Expected->Depth);
+        CHECK(Found->Parent == ((Expected->Parent == REGF_CELL_NIL) ? REGF_CELL_NIL : g_Tree[Expected->Parent].Cell));
+        CHECK(Found->NumberOfSubKeys == Expected->SubKeys.size());
+        CHECK(Found->NumberOfValues == Expected->Values.size());
+        CHECK(IsName(Found->Name, Found->NameLength, Found->CompressedName, Expected->Name));
+
+        for (ULONG j = 0; j < Expected->Values.size(); j += 1)
+        {
+            PTEST_VALUE ExpectedValue = &Expected->Values[j];
+            const UCHAR *Data;
+            ULONG DataLength;
+
+            CHECK(Hive.GetValue(Found, j, &Value));
+            CHECK(Value.Cell == ExpectedValue->Cell);
+            CHECK(Value.Type == ExpectedValue->Type);
+            CHECK(Value.DataLength == ExpectedValue->Data.size());
+            CHECK(Value.Inline == (ExpectedValue->Data.size() <= sizeof(ULONG)));
+            CHECK(IsName(Value.Name, Value.NameLength, Value.CompressedName, ExpectedValue->Name));
+
+            CHECK(Hive.GetValueData(&Value, Buffer, &Data, &DataLength));
+            CHECK(DataLength == ExpectedValue->Data.size());
+            CHECK(!DataLength || (memcmp(Data, &ExpectedValue->Data[0], DataLength) == 0));
+
+            if (!Value.Inline) NumberOfDataCells += 1;
+            if (DataLength > REGF_BIG_DATA_SEGMENT) NumberOfBigValues += 1;
+        }
+
+        CHECK(!Hive.GetValue(Found, (ULONG)Expected->Values.size(), &Value));
+
+        CHECK(Hive.GetSecurityDescriptor(Found, &Descriptor, &DescriptorLength));
+        CHECK(DescriptorLength == sizeof(g_Descriptor));
+        CHECK(memcmp(Descriptor, g_Descriptor, sizeof(g_Descriptor)) == 0);
+    }
+
+    CHECK(NumberOfDataCells != 0);
+    CHECK(!Big || (NumberOfBigValues != 0));
+
+    //
+    // Keys with an ASCII path are opened from the root, case insensitive, with or without
+    // a trailing separator.
+    //
+    for (ULONG i = 1; i < g_Tree.size(); i += 1)
+    {
+        if (!GetPath(i, Path)) continue;
+
+        CHECK(Hive.OpenKey(&Root, Path.c_str(), &Key));
+        CHECK(Key.Cell == g_Tree[i].Cell);
+        CHECK(Key.Depth == g_Tree[i].Depth);
+
+        Path += "\\";
+        CHECK(Hive.OpenKey(&Root, Path.c_str(), &Key) && (Key.Cell == g_Tree[i].Cell));
+
+        Path += "NoSuchKey";
+        CHECK(!Hive.OpenKey(&Root, Path.c_str(), &Key));
+
+        NumberOfPaths += 1;
+    }
+
+    CHECK(NumberOfPaths > (TEST_KEYS / 30));
+    CHECK(Hive.OpenKey(&Root, "", &Key) && (Key.Cell == Root.Cell));
+    CHECK(!Hive.OpenKey(&Root, "NoSuchKey", &Key));
+
+    //
+    // Up to a depth, and stopped by the routine.
+    //
+    for (ULONG MaxDepth = 1; MaxDepth <= 3; MaxDepth += 1)
+    {
+        Expected.clear();
+        for (ULONG Index : g_PreOrder) if (g_Tree[Index].Depth <= MaxDepth) Expected.push_back(g_Tree[Index].Cell);
+
+        Walk(Hive, &Root, MaxDepth, &Context);
+        GetCells(Context, Cells);
+        CHECK(Cells == Expected);
+    }
+
+    Context.Stop = 10;
+    CHECK(!Hive.Walk(&Root, 0, [](PVOID Context, RegFile::PREGF_KEY Key) -> BOOLEAN
+    {
+        PWALK_CONTEXT Walk = (PWALK_CONTEXT)Context;
+
+        Walk->Keys.push_back(*Key);
+        return (Walk->Keys.size() != Walk->Stop);
+    }, (Context.Keys.clear(), &Context)));
+    CHECK(Context.Keys.size() == 10);
+
+    //
+    // From a subkey with subkeys, depths are relative to it.
+    //
+    Context.Stop = 0;
+
+    for (ULONG i = 1; i < g_PreOrder.size(); i += 1)
+    {
+        ULONG Start = g_PreOrder[i];
+        ULONG Count = 0;
+
+        if ((g_Tree[Start].Depth != 2) || (g_Tree[Start].SubKeys.size() < 2) || !GetPath(Start, Path)) continue;
+
+        CHECK(Hive.OpenKey(&Root, Path.c_str(), &Key));
+        Walk(Hive, &Key, 0, &Context);
+
+        for (ULONG j = i; (j < g_PreOrder.size()) && ((j == i) || (g_Tree[g_PreOrder[j]].Depth > 2)); j += 1)
+        {
+            CHECK((Count < Context.Keys.size()) && (Context.Keys[Count].Cell == g_Tree[g_PreOrder[j]].Cell));
+            CHECK((Count < Context.Keys.size()) && (Context.Keys[Count].Depth == g_Tree[g_PreOrder[j]].Depth - 2));
+            Count += 1;
+        }
+
+        CHECK(Count > 2);
+        CHECK(Count == Context.Keys.size());
+        break;
+    }
+}
+
+static
+VOID
+TestBaseBlock(
+)
+{
+    vector<UCHAR> Good, File;
+    PREGF_BASE_BLOCK BaseBlock;
+    WALK_CONTEXT Context;
+    RegFile Hive;
+    RegFile::REGF_KEY Root;
+
+    GetHive(0x11, 5, FALSE, Good);
+
+    Context.Stop = 0;
+
+    CHECK(!Hive.Open("/nonexistent/RegFileTest.hiv"));
+    CHECK(!Hive.GetRootKey(&Root));
+
+    File = Good;
+    ((PREGF_BASE_BLOCK)&File[0])->Signature = 'fges';
+    CHECK(!OpenHive(Hive, File));
+
+    File = Good;
+    ((PREGF_BASE_BLOCK)&File[0])->Major = 2;
+    CHECK(!OpenHive(Hive, File));
+
+    File.assign(Good.begin(), Good.begin() + REGF_BASE_BLOCK_SIZE - 1);
+    CHECK(!OpenHive(Hive, File));
+
+    //
+    // Only the base block: the root cell is past the end of the bins.
+    //
+    File.assign(Good.begin(), Good.begin() + REGF_BASE_BLOCK_SIZE);
+    CHECK(!OpenHive(Hive, File));
+
+    File = Good;
+    ((PREGF_BASE_BLOCK)&File[0])->RootCell = REGF_CELL_NIL;
+    CHECK(!OpenHive(Hive, File));
+
+    File = Good;
+    ((PREGF_BASE_BLOCK)&File[0])->RootCell = g_Security;
+    CHECK(!OpenHive(Hive, File));
+
+    File = Good;
+    ((PREGF_BASE_BLOCK)&File[0])->RootCell = TEST_OUT_OF_RANGE;
+    CHECK(!OpenHive(Hive, File));
+
+    File = Good;
+    ((PREGF_BASE_BLOCK)&File[0])->RootCell = g_Tree[0].Cell + 2;
+    CHECK(!OpenHive(Hive, File));
+
+    //
+    // A hive that was not flushed, or with a bad checksum, is still parsed.
+    //
+    File = Good;
+    BaseBlock = (PREGF_BASE_BLOCK)&File[0];
+    BaseBlock->Sequence2 += 1;
+    CHECK(OpenHive(Hive, File));
+    CHECK(Hive.m_Dirty);
+    CHECK(!Hive.m_ValidCheckSum);
+
+    File = Good;
+    ((PREGF_BASE_BLOCK)&File[0])->CheckSum ^= 1;
+    CHECK(OpenHive(Hive, File));
+    CHECK(!Hive.m_Dirty);
+    CHECK(!Hive.m_ValidCheckSum);
+    CHECK(Hive.GetRootKey(&Root));
+    CHECK(Walk(Hive, &Root, 0, &Context) == TEST_KEYS);
+
+    //
+    // Bins longer than the file end with the file, shorter bins hide the cells after them.
+    //
+    File = Good;
+    ((PREGF_BASE_BLOCK)&File[0])->Length = 0x7FFFF000;
+    CHECK(OpenHive(Hive, File));
+    CHECK(Hive.GetRootKey(&Root));
+    CHECK(Walk(Hive, &Root, 0, &Context) == TEST_KEYS);
+    CHECK(Hive.m_InvalidCells == 0);
+
+    File = Good;
+    ((PREGF_BASE_BLOCK)&File[0])->Length = TEST_HBIN_SIZE;
+    CHECK(OpenHive(Hive, File));
+    CHECK(Hive.GetRootKey(&Root));
+    Walk(Hive, &Root, 0, &Context);
+    CHECK(Context.Keys.size() < TEST_KEYS);
+    CHECK(Hive.m_InvalidCells != 0);
+    for (RegFile::REGF_KEY& Key : Context.Keys) CHECK(Key.Cell < TEST_HBIN_SIZE);
+
+    //
+    // Reopened on the good file.
+    //
+    CHECK(OpenHive(Hive, Good));
+    CHECK(Hive.m_ValidCheckSum);
+    CHECK(Hive.m_InvalidCells == 0);
+    CHECK(Hive.GetRootKey(&Root));
+    CHECK(Walk(Hive, &Root, 0, &Context) == TEST_KEYS);
+
+    Hive.Close();
+    CHECK(!Hive.GetRootKey(&Root));
+}
+
+//
+// First key below the root with an ASCII name, values, and a leaf list of several subkeys.
+//
+static
+ULONG
+GetVictim(
+)
+{
+    for (ULONG i = 0; i < g_Tree[0].SubKeys.size(); i += 1)
+    {
+        PTEST_KEY Key = &g_Tree[g_Tree[0].SubKeys[i]];
+
+        if (Key->Compressed && (Key->SubKeys.size() > 1) && (Key->ListSignature != REGF_INDEX_ROOT_SIGNATURE) && !Key->Values.empty())
+        {
+            return g_Tree[0].SubKeys[i];
+        }
+    }
+
+    return 0;
+}
+
+//
+// Walks the hive, the cells of the keys walked in Cells.
+//
+static
+BOOLEAN
+WalkHive(
+    RegFile& Hive,
+    const vector<UCHAR>& File,
+    vector<ULONG>& Cells
+)
+{
+    WALK_CONTEXT Context;
+    RegFile::REGF_KEY Root;
+
+    Cells.clear();
+    Context.Stop = 0;
+
+    if (!OpenHive(Hive, File) || !Hive.GetRootKey(&Root)) return FALSE;
+
+    Walk(Hive, &Root, 0, &Context);
+    GetCells(Context, Cells);
+
+    return TRUE;
+}
+
+static
+VOID
+TestCorruptedKeys(
+)
+{
+    vector<UCHAR> Good, File;
+    vector<ULONG> Cells, Expected;
+    RegFile Hive;
+    ULONG Victim;
+    LONG *CellSize;
+
+    GetHive(0x22, 5, TRUE, Good);
+
+    Victim = GetVictim();
+    CHECK(Victim != 0);
+    if (Victim == 0) return;
+
+    GetExpectedCells(Victim, FALSE, Expected);
+
+    //
+    // Key nodes of another kind, free, of a size out of range, too small or with a name past the
+    // cell: the key and its subtree are skipped, the rest of the hive is walked.
+    //
+    for (ULONG Case = 0; Case < 7; Case += 1)
+    {
+        File = Good;
+        CellSize = (LONG *)&File[REGF_BASE_BLOCK_SIZE + g_Tree[Victim].Cell];
+
+        switch (Case)
+        {
+            case 0: *(PUSHORT)GetUlong(File, g_Tree[Victim].Cell, 0) = REGF_KEY_VALUE_SIGNATURE; break;
+            case 1: *CellSize = -*CellSize; break;
+            case 2: *CellSize = LONG_MIN; break;
+            case 3: *CellSize = -0x7FFFFFF0; break;
+            case 4: *CellSize = -(LONG)sizeof(LONG); break;
+            case 5: *CellSize = -(LONG)(sizeof(LONG) + FIELD_OFFSET(REGF_KEY_NODE, Name) - 1); break;
+            case 6: *(PUSHORT)GetUlong(File, g_Tree[Victim].Cell, FIELD_OFFSET(REGF_KEY_NODE, NameLength)) = 0xFFFF; break;
+        }
+
+        CHECK(WalkHive(Hive, File, Cells));
+        if (Cells != Expected) printf("       corrupted key node %u: %u keys\n", Case, (ULONG)Cells.size());
+        CHECK(Cells == Expected);
+        CHECK(Hive.m_InvalidCells == 1);
+    }
+
+    //
+    // The entry of the victim in the list of the root (or in one of its ri leaves) out of
+    // range, or not on a cell boundary.
+    //
+    for (ULONG Case = 0; Case < 2; Case += 1)
+    {
+        ULONG Leaf = g_Tree[0].List;
+        ULONG Index;
+        PREGF_KEY_INDEX LeafIndex;
+
+        for (Index = 0; g_Tree[0].SubKeys[Index] != Victim; Index += 1);
+
+        File = Good;
+
+        if (g_Tree[0].ListSignature == REGF_INDEX_ROOT_SIGNATURE)
+        {
+            PREGF_KEY_INDEX IndexRoot = (PREGF_KEY_INDEX)GetUlong(File, g_Tree[0].List, 0);
+
+            for (ULONG i = 0; i < IndexRoot->Count; i += 1)
+            {
+                LeafIndex = (PREGF_KEY_INDEX)GetUlong(File, IndexRoot->List[i], 0);
+
+                if (Index < LeafIndex->Count)
+                {
+                    Leaf = IndexRoot->List[i];
+                    break;
+                }
+
+                Index -= LeafIndex->Count;
+            }
+        }
+
+        LeafIndex = (PREGF_KEY_INDEX)GetUlong(File, Leaf, 0);
+        if (LeafIndex->Signature != REGF_INDEX_LEAF_SIGNATURE) Index *= 2;
+
+        CHECK(LeafIndex->List[Index] == g_Tree[Victim].Cell);
+        LeafIndex->List[Index] = Case ? (g_Tree[Victim].Cell + 2) : TEST_OUT_OF_RANGE;
+
+        //
+        // A whole key node 2 bytes further, only its offset is wrong.
+        //
+        if (Case)
+        {
+            PUCHAR KeyNode = &File[REGF_BASE_BLOCK_SIZE + g_Tree[Victim].Cell];
+
+            memmove(KeyNode + 2, KeyNode, (ULONG)-*(PLONG)KeyNode - 2);
+        }
+
+        CHECK(WalkHive(Hive, File, Cells));
+        CHECK(Cells == Expected);
+        CHECK(Hive.m_InvalidCells == 1);
+    }
+
+    //
+    // A list that points back to its key: the first subkey is skipped as a loop.
+    //
+    File = Good;
+    *GetUlong(File, g_Tree[Victim].List, FIELD_OFFSET(REGF_KEY_INDEX, List)) = g_Tree[Victim].Cell;
+
+    GetExpectedCells(g_Tree[Victim].SubKeys[0], FALSE, Expected);
+    CHECK(WalkHive(Hive, File, Cells));
+    CHECK(Cells == Expected);
+    CHECK(Hive.m_InvalidCells == 1);
+
+    //
+    // A list of another kind: the key is walked, its subkeys are not.
+    //
+    File = Good;
+    *(PUSHORT)GetUlong(File, g_Tree[Victim].List, 0) = REGF_KEY_VALUE_SIGNATURE;
+
+    GetExpectedCells(Victim, TRUE, Expected);
+    CHECK(WalkHive(Hive, File, Cells));
+    CHECK(Cells == Expected);
+    CHECK(Hive.m_InvalidCells == 1);
+
+    //
+    // More entries than the list cell (or a leaf of an ri list) has room for: the ones in the
+    // cell are walked, the slack of the cell at most adds an invalid one.
+    //
+    GetExpectedCells(REGF_CELL_NIL, FALSE, Expected);
+
+    for (ULONG Case = 0; Case < 2; Case += 1)
+    {
+        ULONG List = g_Tree[Victim].List;
+
+        if (Case)
+        {
+            for (ULONG i = 0; i < g_Tree.size(); i += 1)
+            {
+                if (g_Tree[i].ListSignature == REGF_INDEX_ROOT_SIGNATURE)
+                {
+                    List = *GetUlong(Good, g_Tree[i].List, FIELD_OFFSET(REGF_KEY_INDEX, List));
+                    break;
+                }
+            }
+
+            CHECK(List != g_Tree[Victim].List);
+        }
+
+        File = Good;
+        *(PUSHORT)GetUlong(File, List, FIELD_OFFSET(REGF_KEY_INDEX, Count)) = 0xFFFF;
+
+        CHECK(WalkHive(Hive, File, Cells));
+        CHECK(Cells == Expected);
+        CHECK(Hive.m_InvalidCells <= 1);
+    }
+}
+
+static
+VOID
+TestCorruptedValues(
+)
+{
+    vector<UCHAR> Good, File;
+    vector<UCHAR> Buffer;
+    RegFile Hive;
+    RegFile::REGF_KEY Root, Key;
+    RegFile::REGF_VALUE Value;
+    const UCHAR *Data;
+    ULONG DataLength;
+    ULONG Victim;
+    string Path;
+
+    GetHive(0x22, 5, TRUE, Good);
+
+    Victim = GetVictim();
+    CHECK(Victim != 0);
+    if (Victim == 0) return;
+
+    GetPath(Victim, Path);
+
+    //
+    // Value list out of range, or shorter than the count of values.
+    //
+    File = Good;
+    *GetUlong(File, g_Tree[Victim].Cell, FIELD_OFFSET(REGF_KEY_NODE, ValueList)) = TEST_OUT_OF_RANGE;
+
+    CHECK(OpenHive(Hive, File));
+    CHECK(Hive.GetRootKey(&Root));
+    CHECK(Hive.OpenKey(&Root, Path.c_str(), &Key));
+    CHECK(!Hive.GetValue(&Key, 0, &Value));
+
+    File = Good;
+    *GetUlong(File, g_Tree[Victim].Cell, FIELD_OFFSET(REGF_KEY_NODE, ValueCount)) = 0x10000;
+
+    CHECK(OpenHive(Hive, File));
+    CHECK(Hive.GetRootKey(&Root));
+    CHECK(Hive.OpenKey(&Root, Path.c_str(), &Key));
+    CHECK(Hive.GetValue(&Key, 0, &Value));
+    CHECK(!Hive.GetValue(&Key, (ULONG)g_Tree[Victim].Values.size() + 2, &Value));
+    CHECK(!Hive.GetValue(&Key, 0xFFFF, &Value));
+
+    File = Good;
+    *GetUlong(File, *GetUlong(File, g_Tree[Victim].Cell, FIELD_OFFSET(REGF_KEY_NODE, ValueList)), 0) = TEST_OUT_OF_RANGE;
+
+    CHECK(OpenHive(Hive, File));
+    CHECK(Hive.GetRootKey(&Root));
+    CHECK(Hive.OpenKey(&Root, Path.c_str(), &Key));
+    CHECK(!Hive.GetValue(&Key, 0, &Value));
+
+    File = Good;
+    *(PUSHORT)GetUlong(File, g_Tree[Victim].Values[0].Cell, FIELD_OFFSET(REGF_KEY_VALUE, NameLength)) = 0xFFFF;
+
+    CHECK(OpenHive(Hive, File));
+    CHECK(Hive.GetRootKey(&Root));
+    CHECK(Hive.OpenKey(&Root, Path.c_str(), &Key));
+    CHECK(!Hive.GetValue(&Key, 0, &Value));
+
+    //
+    // Data cell, db cell, segment list and segment out of range.
+    //
+    for (ULONG Case = 0; Case < 4; Case += 1)
+    {
+        ULONG Owner = 0, Index = 0;
+        PTEST_VALUE Found = NULL;
+        ULONG DataCell;
+
+        for (ULONG i = 0; (i < g_Tree.size()) && !Found; i += 1)
+        {
+            if (!GetPath(i, Path)) continue;
+
+            for (Index = 0; Index < g_Tree[i].Values.size(); Index += 1)
+            {
+                ULONG Length = (ULONG)g_Tree[i].Values[Index].Data.size();
+
+                if (((Case == 0) && (Length > sizeof(ULONG)) && (Length <= REGF_BIG_DATA_SEGMENT)) ||
+                    ((Case != 0) && (Length > REGF_BIG_DATA_SEGMENT)))
+                {
+                    Found = &g_Tree[i].Values[Index];
+                    Owner = i;
+                    break;
+                }
+            }
+        }
+
+        CHECK(Found != NULL);
+        if (Found == NULL) continue;
+
+        File = Good;
+        DataCell = *GetUlong(File, Found->Cell, FIELD_OFFSET(REGF_KEY_VALUE, Data));
+
+        switch (Case)
+        {
+            case 0: *GetUlong(File, Found->Cell, FIELD_OFFSET(REGF_KEY_VALUE, Data)) = TEST_OUT_OF_RANGE; break;
+            case 1: *(PUSHORT)GetUlong(File, DataCell, 0) = REGF_KEY_VALUE_SIGNATURE; break;
+            case 2: *GetUlong(File, DataCell, FIELD_OFFSET(REGF_BIG_DATA, List)) = TEST_OUT_OF_RANGE; break;
+            case 3: *GetUlong(File, *GetUlong(File, DataCell, FIELD_OFFSET(REGF_BIG_DATA, List)), sizeof(ULONG)) = TEST_OUT_OF_RANGE; break;
+        }
+
+        GetPath(Owner, Path);
+
+        CHECK(OpenHive(Hive, File));
+        CHECK(Hive.GetRootKey(&Root));
+        CHECK(Owner == 0 || Hive.OpenKey(&Root, Path.c_str(), &Key));
+        if (Owner == 0) Key = Root;
+
+        CHECK(Hive.GetValue(&Key, Index, &Value));
+        CHECK(!Hive.GetValueData(&Value, Buffer, &Data, &DataLength));
+        CHECK(Data == NULL);
+        CHECK(DataLength == 0);
+    }
+
+    //
+    // Inline data longer than the Data field.
+    //
+    GetPath(Victim, Path);
+    CHECK(OpenHive(Hive, Good));
+    CHECK(Hive.GetRootKey(&Root));
+    CHECK(Hive.OpenKey(&Root, Path.c_str(), &Key));
+    CHECK(Hive.GetValue(&Key, 0, &Value));
+
+    Value.Inline = TRUE;
+    Value.DataLength = sizeof(ULONG) + 1;
+    CHECK(!Hive.GetValueData(&Value, Buffer, &Data, &DataLength));
+
+    //
+    // Security cell shorter than its descriptor.
+    //
+    File = Good;
+    *GetUlong(File, g_Security, FIELD_OFFSET(REGF_KEY_SECURITY, DescriptorLength)) = 0x1000;
+
+    CHECK(OpenHive(Hive, File));
+    CHECK(Hive.GetRootKey(&Root));
+    CHECK(!Hive.GetSecurityDescriptor(&Root, &Data, &DataLength));
+}
+
+//
+// Files cut short (e.g. carved): cells past the end are skipped, nothing is read past it.
+//
+static
+VOID
+TestTruncatedFile(
+)
+{
+    static const ULONG Quarters[] = { 3, 2, 1 };
+    vector<UCHAR> Good, File;
+    vector<ULONG> Cells;
+    RegFile Hive;
+
+    GetHive(0x33, 5, TRUE, Good);
+
+    for (ULONG i = 0; i < _countof(Quarters); i += 1)
+    {
+        ULONG Size = REGF_BASE_BLOCK_SIZE + (ULONG)(((Good.size() - REGF_BASE_BLOCK_SIZE) * Quarters[i]) / 4) + 0x123;
+
+        File.assign(Good.begin(), Good.begin() + Size);
+
+        CHECK(WalkHive(Hive, File, Cells));
+        CHECK(Hive.m_FileSize == Size);
+        CHECK(Cells.size() < TEST_KEYS);
+        CHECK(Hive.m_InvalidCells != 0);
+
+        for (ULONG Cell : Cells)
+        {
+            LONG CellSize = *(PLONG)&File[REGF_BASE_BLOCK_SIZE + Cell];
+
+            CHECK((REGF_BASE_BLOCK_SIZE + Cell + (ULONG)-CellSize) <= Size);
+        }
+    }
+
+    //
+    // Cut in the root key node.
+    //
+    File.assign(Good.begin(), Good.begin() + REGF_BASE_BLOCK_SIZE + g_Tree[0].Cell + 0x10);
+    CHECK(!OpenHive(Hive, File));
+}
+
+int
+main(
+)
+{
+    int Fd = mkstemp(g_FileName);
+
+    CHECK(Fd >= 0);
+    if (Fd >= 0) close(Fd);
+
+    //
+    // Big values in db cells (1.5), and in one cell bigger than a page (1.3).
+    //
+    TestKeysAndValues(5, TRUE);
+    TestKeysAndValues(3, FALSE);
+    TestBaseBlock();
+    TestCorruptedKeys();
+    TestCorruptedValues();
+    TestTruncatedFile();
+
+    remove(g_FileName);
+
+    return TestResult("RegFile");
+}
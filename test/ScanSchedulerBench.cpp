@@ -0,0 +1,174 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - ScanSchedulerBench.cpp
+
+Abstract:
+
+    - Scaling of ScanScheduler with the number of workers on a synthetic image
+      of 8 processes, the driver of the !ms_malscore /bench scheduler lines
+      outside of the debugger. Reads either cost nothing or wait as the engine
+      does on a remote target, the workers must overlap them with scoring.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdarg.h>
+#include <string.h>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <string>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "Entropy.h"
+#include "Spray.h"
+#include "PatternMatcher.h"
+#include "MalRules.h"
+#include "Security.h"
+#include "Arena.h"
+#include "ScanScheduler.h"
+#include "Test.h"
+
+#define BENCH_IMAGE_SIZE (16 * 1024 * 1024)
+#define BENCH_PROCESSES 8
+#define BENCH_REGIONS 16 // Per process, 64 KB to 2 MB each.
+#define BENCH_MAX_WORKERS 8
+#define BENCH_PAGE_SIZE 0x1000
+
+//
+// Engine read cost per 64 KB, in microseconds.
+//
+static const ULONG g_ReadCosts[] = { 0, 100 };
+
+//
+// CPU bound runs: fraction of the ideal speedup (number of cores), in percents.
+//
+#define BENCH_TARGET_SCALING 75
+
+int
+main(
+)
+{
+    vector<UCHAR> Image(BENCH_IMAGE_SIZE);
+    vector<SCAN_REGION> Regions;
+    unsigned long long Seed = 0x44;
+    ULONG Cores = thread::hardware_concurrency();
+    ULONG64 Bytes = 0;
+
+    if (!Cores) Cores = 1;
+
+    for (ULONG i = 0; i < Image.size(); i += 1) Image[i] = (UCHAR)TestRandom(&Seed);
+
+    for (ULONG Process = 0; Process < BENCH_PROCESSES; Process += 1)
+    {
+        for (ULONG j = 0; j < BENCH_REGIONS; j += 1)
+        {
+            SCAN_REGION Region = { 0 };
+
+            Region.Size = (64 * 1024) << (TestRandom(&Seed) % 6);
+            Region.BaseAddress = ((ULONG64)(Process + 1) << 32) + ((TestRandom(&Seed) % (BENCH_IMAGE_SIZE - Region.Size)) & ~(BENCH_PAGE_SIZE - 1));
+            Region.ProcessObject = Process + 1;
+            Region.Process = Process;
+            Region.Flags = MALSCORE_REGION_WRITABLE;
+            Regions.push_back(Region);
+
+            Bytes += Region.Size;
+        }
+    }
+
+    printf("Scan scheduler scaling (%d processes, %d regions, %llu MB, %u core(s)):\n",
+           BENCH_PROCESSES, (ULONG)Regions.size(), (unsigned long long)(Bytes / (1024 * 1024)), Cores);
+
+    for (ULONG c = 0; c < _countof(g_ReadCosts); c += 1)
+    {
+        ULONG Cost = g_ReadCosts[c];
+        ULONG64 ReferenceSum = 0;
+        double ReferenceSeconds = 0.0;
+
+        printf("    read cost %u us per 64 KB\n", Cost);
+
+        for (ULONG Workers = 1; Workers <= BENCH_MAX_WORKERS; Workers *= 2)
+        {
+            ULONG64 Sum = 0;
+
+            ScanScheduler Scheduler([&Image, Cost](ULONG64 ProcessObject, ULONG64 Address, LPBYTE Buffer, ULONG Length) -> BOOLEAN
+            {
+                UNREFERENCED_PARAMETER(ProcessObject);
+
+                memcpy(Buffer, &Image[(ULONG)Address], Length);
+                if (Cost) this_thread::sleep_for(chrono::microseconds(((ULONG64)Cost * Length) / (64 * 1024)));
+
+                return TRUE;
+            }, Workers, SCAN_MEMORY_BUDGET);
+
+            double Start = TestSeconds();
+
+            Scheduler.Run(Regions, [](const SCAN_PROGRESS& Progress) { UNREFERENCED_PARAMETER(Progress); });
+
+            double Seconds = TestSeconds() - Start;
+
+            for (SCAN_REGION& Region : Regions) Sum += Region.Score;
+
+            if (Workers == 1)
+            {
+                ReferenceSum = Sum;
+                ReferenceSeconds = Seconds;
+            }
+
+            double Speedup = Seconds ? ReferenceSeconds / Seconds : 0.0;
+            ULONG Ideal = min(Workers, Cores);
+            BOOLEAN Below = FALSE;
+
+            //
+            // Reads that wait must overlap with scoring even on one core, CPU bound runs
+            // can only scale with the cores.
+            //
+            if (Cost) Below = (Workers > 1) && (Speedup <= 1.0);
+            else Below = (Ideal > 1) && ((Speedup * 100) < (Ideal * BENCH_TARGET_SCALING));
+
+            printf("    %2u workers %6.0f ms  %6.0f MB/s  x%.2f  %6llu reads  scores %s%s\n",
+                   Scheduler.m_Progress.Workers, Seconds * 1000,
+                   Seconds ? (Bytes / Seconds) / (1024 * 1024) : 0.0,
+                   Speedup, (unsigned long long)Scheduler.m_Progress.Reads,
+                   (Sum == ReferenceSum) ? "identical" : "DIFFERENT",
+                   Below ? "  below target" : "");
+
+            CHECK(Sum == ReferenceSum);
+            CHECK(Sum != 0);
+        }
+    }
+
+    return TestResult("ScanSchedulerBench");
+}
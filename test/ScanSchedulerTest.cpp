@@ -0,0 +1,297 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - ScanSchedulerTest.cpp
+
+Abstract:
+
+    - ScanScheduler: every region gets the score, rules and entropy map of a
+      serial GetMalScoreStream() whatever the number of workers and the
+      memory budget, reads only happen on the calling thread, progress
+      totals add up.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdarg.h>
+#include <string.h>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <string>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "Entropy.h"
+#include "Spray.h"
+#include "PatternMatcher.h"
+#include "MalRules.h"
+#include "Security.h"
+#include "Arena.h"
+#include "ScanScheduler.h"
+#include "Test.h"
+
+#define TEST_CORPUS_SIZE (256 * 1024)
+#define TEST_PROCESSES 6
+#define TEST_REGIONS 8 // Per process.
+#define TEST_UNREADABLE_PROCESS 4
+#define TEST_PAGE_SIZE 0x1000
+
+#define TEST_PROCESS_OBJECT(Process) (0xFFFFFA8000000000ULL + ((ULONG64)(Process) * 0x1000))
+
+//
+// Every corpus one after the other, regions of process N map parts of it at (N + 1) << 32.
+//
+static vector<UCHAR> g_Image;
+
+static
+BOOLEAN
+ReadImage(
+    ULONG64 ProcessObject,
+    ULONG64 Address,
+    LPBYTE Buffer,
+    ULONG Length
+)
+{
+    ULONG Process = (ULONG)((ProcessObject - TEST_PROCESS_OBJECT(0)) / 0x1000);
+    ULONG64 Offset = Address - ((ULONG64)(Process + 1) << 32);
+    ULONG Size = Length;
+
+    if ((Process == TEST_UNREADABLE_PROCESS) || (Offset >= g_Image.size())) return FALSE;
+
+    //
+    // Past the end of the image is not mapped, left as zeroes.
+    //
+    if ((Offset + Size) > g_Image.size()) Size = (ULONG)(g_Image.size() - Offset);
+
+    memcpy(Buffer, &g_Image[(SIZE_T)Offset], Size);
+    RtlZeroMemory(Buffer + Size, Length - Size);
+
+    return TRUE;
+}
+
+static
+BOOLEAN
+ReadRegion(
+    PVOID Context,
+    ULONG64 Offset,
+    LPBYTE Buffer,
+    ULONG Length
+)
+{
+    PSCAN_REGION Region = (PSCAN_REGION)Context;
+
+    return ReadImage(Region->ProcessObject, Region->BaseAddress + Offset, Buffer, Length);
+}
+
+static
+VOID
+GetRegions(
+    vector<SCAN_REGION>& Regions
+)
+{
+    unsigned long long Seed = 0x43;
+
+    Regions.clear();
+
+    for (ULONG Process = 0; Process < TEST_PROCESSES; Process += 1)
+    {
+        for (ULONG i = 0; i < TEST_REGIONS; i += 1)
+        {
+            SCAN_REGION Region = { 0 };
+            ULONG Pages = 1 + (TestRandom(&Seed) % ((MALSCORE_CHUNK_SIZE + (256 * 1024)) / TEST_PAGE_SIZE));
+            ULONG64 Offset = (TestRandom(&Seed) % (g_Image.size() / TEST_PAGE_SIZE)) * TEST_PAGE_SIZE;
+
+            Region.ProcessObject = TEST_PROCESS_OBJECT(Process);
+            Region.BaseAddress = ((ULONG64)(Process + 1) << 32) + Offset;
+            Region.Size = (ULONG64)Pages * TEST_PAGE_SIZE;
+            Region.Process = Process;
+            Region.Flags = (i & 1) ? MALSCORE_REGION_WRITABLE : 0;
+            Regions.push_back(Region);
+        }
+    }
+}
+
+static
+VOID
+TestScores(
+)
+{
+    static const ULONG Workers[] = { 1, 2, 3, 8 };
+    static const ULONG64 Budgets[] = {
+        SCAN_MEMORY_BUDGET,
+        2 * (SCAN_MIN_CHUNK_SIZE + SCAN_WINDOW_OVERHEAD), // Two workers at most, with the smallest chunk.
+        SCAN_MIN_CHUNK_SIZE // Below the minimum, one worker.
+    };
+    vector<SCAN_REGION> Expected;
+    thread::id Caller = this_thread::get_id();
+
+    GetRegions(Expected);
+
+    for (SCAN_REGION& Region : Expected)
+    {
+        MALSCORE_DETAILS Details;
+
+        Region.Readable = GetMalScoreStream(FALSE, Region.BaseAddress, Region.Size, ReadRegion, &Region, 0, Region.Flags, &Region.Score, &Details);
+        Region.NumberOfRules = (ULONG)Details.Rules.size();
+        Region.Entropy = Details.Entropy;
+    }
+
+    for (ULONG b = 0; b < _countof(Budgets); b += 1)
+    {
+        for (ULONG w = 0; w < _countof(Workers); w += 1)
+        {
+            vector<SCAN_REGION> Regions;
+            SCAN_PROGRESS Last = { 0 };
+            ULONG ProgressCalls = 0;
+            ULONG ForeignReads = 0;
+
+            GetRegions(Regions);
+
+            ScanScheduler Scheduler([Caller, &ForeignReads](ULONG64 ProcessObject, ULONG64 Address, LPBYTE Buffer, ULONG Length) -> BOOLEAN
+            {
+                if (this_thread::get_id() != Caller) ForeignReads += 1;
+
+                return ReadImage(ProcessObject, Address, Buffer, Length);
+            }, Workers[w], Budgets[b]);
+
+            Scheduler.Run(Regions, [Caller, &Last, &ProgressCalls](const SCAN_PROGRESS& Progress)
+            {
+                CHECK(this_thread::get_id() == Caller);
+                CHECK(Progress.ProcessesDone >= Last.ProcessesDone);
+                CHECK(Progress.RegionsDone >= Last.RegionsDone);
+
+                Last = Progress;
+                ProgressCalls += 1;
+            });
+
+            CHECK(ForeignReads == 0);
+            CHECK(ProgressCalls >= 1);
+
+            //
+            // The windows of the workers fit in the budget, unless one minimum chunk does not.
+            //
+            CHECK(Last.Workers >= 1);
+            CHECK(Last.Workers <= Workers[w]);
+            CHECK(Last.ChunkSize >= SCAN_MIN_CHUNK_SIZE);
+            CHECK(Last.ChunkSize <= MALSCORE_CHUNK_SIZE);
+            if (Last.Workers > 1) CHECK(((ULONG64)Last.Workers * (Last.ChunkSize + SCAN_WINDOW_OVERHEAD)) <= Budgets[b]);
+            if (Budgets[b] == SCAN_MEMORY_BUDGET) CHECK(Last.Workers == Workers[w]);
+
+            CHECK(Last.Processes == TEST_PROCESSES);
+            CHECK(Last.ProcessesDone == TEST_PROCESSES);
+            CHECK(Last.Regions == Regions.size());
+            CHECK(Last.RegionsDone == Regions.size());
+            CHECK(Last.BytesDone == Last.Bytes);
+            CHECK(Last.Reads >= Regions.size());
+            CHECK(Last.Reads == Scheduler.m_Progress.Reads);
+
+            for (ULONG i = 0; i < Regions.size(); i += 1)
+            {
+                if ((Regions[i].Score != Expected[i].Score) || (Regions[i].Readable != Expected[i].Readable))
+                {
+                    printf("       %u workers, budget 0x%llX, region %u: %u (%u), %u expected (%u)\n",
+                           Workers[w], (unsigned long long)Budgets[b], i,
+                           Regions[i].Score, Regions[i].Readable, Expected[i].Score, Expected[i].Readable);
+                }
+
+                CHECK(Regions[i].Score == Expected[i].Score);
+                CHECK(Regions[i].Readable == Expected[i].Readable);
+                CHECK(Regions[i].NumberOfRules == Expected[i].NumberOfRules);
+                CHECK(memcmp(&Regions[i].Entropy, &Expected[i].Entropy, sizeof(ENTROPY_SUMMARY)) == 0);
+            }
+        }
+    }
+
+    //
+    // The image has something to score, and the unreadable process nothing.
+    //
+    ULONG64 Sum = 0;
+
+    for (SCAN_REGION& Region : Expected)
+    {
+        if (Region.Process == TEST_UNREADABLE_PROCESS) CHECK(!Region.Readable && !Region.Score);
+        else Sum += Region.Score;
+    }
+
+    CHECK(Sum != 0);
+}
+
+//
+// Nothing to scan, the progress routine still gets the (empty) totals.
+//
+static
+VOID
+TestEmpty(
+)
+{
+    for (ULONG Workers = 1; Workers <= 4; Workers *= 2)
+    {
+        vector<SCAN_REGION> Regions;
+        ULONG ProgressCalls = 0;
+        ULONG Reads = 0;
+
+        ScanScheduler Scheduler([&Reads](ULONG64 ProcessObject, ULONG64 Address, LPBYTE Buffer, ULONG Length) -> BOOLEAN
+        {
+            Reads += 1;
+            return ReadImage(ProcessObject, Address, Buffer, Length);
+        }, Workers, SCAN_MEMORY_BUDGET);
+
+        Scheduler.Run(Regions, [&ProgressCalls](const SCAN_PROGRESS& Progress)
+        {
+            CHECK(Progress.Regions == 0);
+            CHECK(Progress.Processes == 0);
+            ProgressCalls += 1;
+        });
+
+        CHECK(ProgressCalls == 1);
+        CHECK(Reads == 0);
+    }
+}
+
+int
+main(
+)
+{
+    vector<UCHAR> Corpus(TEST_CORPUS_SIZE);
+    LPCSTR Name;
+
+    for (ULONG i = 0; GetMalScoreCorpus(i, &Corpus[0], TEST_CORPUS_SIZE, &Name); i += 1)
+    {
+        g_Image.insert(g_Image.end(), Corpus.begin(), Corpus.end());
+    }
+
+    TestScores();
+    TestEmpty();
+
+    return TestResult("ScanScheduler");
+}
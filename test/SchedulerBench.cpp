@@ -0,0 +1,270 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - SchedulerBench.cpp
+
+Abstract:
+
+    - Enrichment of the images of 500 processes on the worker pool, as
+      GetProcesses() does once they have been captured: PE parse, section
+      hashes, exports and imports. The images are synthetic (TestImage.h).
+      Results of every run must be the ones of the single worker run.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <string>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "FuzzyHash.h"
+#include "Entropy.h"
+#include "HashStream.h"
+#include "Arena.h"
+#include "ImageIdentity.h"
+#include "Scheduler.h"
+#include "DbgHelpEx.h"
+#include "TestImage.h"
+#include "Test.h"
+
+#define BENCH_PROCESSES 500
+#define BENCH_IMAGES 16 // Distinct images, every process has its own copy of one of them.
+#define BENCH_CODE_SIZE (96 * 1024)
+#define BENCH_DATA_SIZE (32 * 1024)
+#define BENCH_EXPORTS 256
+#define BENCH_IMPORT_MODULES 4
+#define BENCH_IMPORTS 16 // Per module.
+
+//
+// Fraction of the ideal speedup (number of cores), in percents.
+//
+#define BENCH_TARGET_SCALING 75
+
+typedef struct _BENCH_TASK {
+    PEFile *Image;
+    BOOLEAN Exports;
+    BOOLEAN Imports;
+} BENCH_TASK, *PBENCH_TASK;
+
+static
+VOID
+GetImage(
+    ULONG Index,
+    vector<UCHAR>& Buffer
+)
+{
+    static const LPCSTR Modules[BENCH_IMPORT_MODULES] = { "ntdll.dll", "KERNEL32.dll", "ADVAPI32.dll", "WS2_32.dll" };
+    unsigned long long Seed = 0x27 + Index;
+    TestImage Image((Index & 1) != 0, 0x10000000ULL + ((ULONG64)Index << 24));
+    vector<TEST_EXPORT> Exports;
+    vector<TEST_IMPORT> Imports;
+    vector<UCHAR> Data(BENCH_CODE_SIZE);
+    GUID Guid = { 0 };
+    CHAR Name[64];
+    ULONG Text;
+
+    //
+    // Code is random bytes with a ret at every entry point, data is mostly zeroes.
+    //
+    Text = Image.AddSection(".text", IMAGE_SCN_CNT_CODE | IMAGE_SCN_MEM_EXECUTE | IMAGE_SCN_MEM_READ);
+    for (ULONG i = 0; i < Data.size(); i += 1) Data[i] = (UCHAR)TestRandom(&Seed);
+    for (ULONG i = 0; i < BENCH_EXPORTS; i += 1) Data[i * (BENCH_CODE_SIZE / BENCH_EXPORTS)] = 0xC3;
+    Image.Put(Data.data(), (ULONG)Data.size());
+
+    Image.AddSection(".rdata", IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ);
+
+    for (ULONG i = 0; i < BENCH_EXPORTS; i += 1)
+    {
+        TEST_EXPORT Export;
+
+        sprintf_s(Name, sizeof(Name), "Function%u_%u", Index, i);
+        Export.Name = (i % 16) ? Name : "";
+        Export.Index = i;
+        Export.Rva = Text + (i * (BENCH_CODE_SIZE / BENCH_EXPORTS));
+        Exports.push_back(Export);
+    }
+
+    sprintf_s(Name, sizeof(Name), "module%u.dll", Index);
+    Image.AddExports(Name, 1, BENCH_EXPORTS, Exports);
+
+    for (ULONG m = 0; m < BENCH_IMPORT_MODULES; m += 1)
+    {
+        for (ULONG i = 0; i < BENCH_IMPORTS; i += 1)
+        {
+            TEST_IMPORT Import;
+
+            sprintf_s(Name, sizeof(Name), "Import%u", (ULONG)(TestRandom(&Seed) % 1024));
+            Import.ModuleName = Modules[m];
+            Import.Name = (m == 3) ? "" : Name;
+            Import.Ordinal = 1 + i;
+            Imports.push_back(Import);
+        }
+    }
+
+    Image.AddImports(Imports);
+
+    Guid.Data1 = Index;
+    sprintf_s(Name, sizeof(Name), "module%u.pdb", Index);
+    Image.AddDebug(Name, &Guid, 1);
+
+    Image.AddSection(".data", IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ | IMAGE_SCN_MEM_WRITE);
+    Data.assign(BENCH_DATA_SIZE, 0);
+    for (ULONG i = 0; i < Data.size(); i += 64) Data[i] = (UCHAR)TestRandom(&Seed);
+    Image.Put(Data.data(), (ULONG)Data.size());
+
+    Image.GetImage(Buffer);
+}
+
+//
+// Section digests, exports and imphash of an image, folded into one value.
+//
+static
+ULONG64
+GetResult(
+    PEFile *Image
+)
+{
+    ULONG64 Result = 14695981039346656037ULL;
+    vector<UCHAR> Bytes;
+
+    for (ULONG i = 0; i < Image->m_CcSections.size(); i += 1)
+    {
+        Bytes.insert(Bytes.end(), Image->m_CcSections[i].VaMd5Hash, Image->m_CcSections[i].VaMd5Hash + sizeof(Image->m_CcSections[i].VaMd5Hash));
+        Bytes.insert(Bytes.end(), Image->m_CcSections[i].VaSha256Hash, Image->m_CcSections[i].VaSha256Hash + SHA256_DIGEST_SIZE);
+        Bytes.insert(Bytes.end(), Image->m_CcSections[i].VaFuzzy.Ctph, Image->m_CcSections[i].VaFuzzy.Ctph + strlen(Image->m_CcSections[i].VaFuzzy.Ctph));
+    }
+
+    for (ULONG i = 0; i < Image->m_Exports.size(); i += 1)
+    {
+        Bytes.insert(Bytes.end(), Image->m_Exports[i].Name, Image->m_Exports[i].Name + strlen(Image->m_Exports[i].Name));
+        Bytes.push_back((UCHAR)Image->m_Exports[i].Address);
+    }
+
+    for (ULONG i = 0; i < Image->m_Imports.size(); i += 1) Bytes.push_back((UCHAR)Image->m_Imports[i].IatRva);
+
+    Bytes.insert(Bytes.end(), Image->m_ImpHash, Image->m_ImpHash + sizeof(Image->m_ImpHash));
+    Bytes.insert(Bytes.end(), Image->m_PdbInfo.PdbName, Image->m_PdbInfo.PdbName + strlen(Image->m_PdbInfo.PdbName));
+
+    for (ULONG i = 0; i < Bytes.size(); i += 1) Result = (Result ^ Bytes[i]) * 1099511628211ULL;
+
+    return Result;
+}
+
+int
+main(
+)
+{
+    vector<vector<UCHAR>> Images(BENCH_IMAGES);
+    vector<ULONG64> Reference;
+    ULONG Cores = thread::hardware_concurrency();
+    ULONG64 Bytes = 0;
+    double ReferenceSeconds = 0.0;
+
+    if (!Cores) Cores = 1;
+
+    for (ULONG i = 0; i < BENCH_IMAGES; i += 1) GetImage(i, Images[i]);
+    for (ULONG Process = 0; Process < BENCH_PROCESSES; Process += 1) Bytes += Images[Process % BENCH_IMAGES].size();
+
+    printf("Image enrichment scaling (%d processes, %llu MB of images, %u core(s)):\n",
+           BENCH_PROCESSES, (unsigned long long)(Bytes / (1024 * 1024)), Cores);
+
+    for (ULONG Workers = 1; Workers <= SCHEDULER_MAX_WORKERS; Workers *= 2)
+    {
+        ArenaScope Scope;
+        vector<vector<UCHAR>> Captured(BENCH_PROCESSES);
+        vector<PEFile> Files(BENCH_PROCESSES);
+        vector<BENCH_TASK> Tasks;
+        vector<BOOLEAN> Failed;
+        vector<ULONG64> Results;
+        ULONG Failures;
+
+        //
+        // Captured by the engine thread before the tasks run.
+        //
+        for (ULONG Process = 0; Process < BENCH_PROCESSES; Process += 1)
+        {
+            BENCH_TASK Task = { &Files[Process], TRUE, TRUE };
+
+            Captured[Process] = Images[Process % BENCH_IMAGES];
+            Files[Process].m_ImageBase = 0x10000000ULL + ((ULONG64)(Process % BENCH_IMAGES) << 24);
+            CHECK(Files[Process].SetImage(Captured[Process].data(), (ULONG)Captured[Process].size()));
+            Tasks.push_back(Task);
+        }
+
+        g_Scheduler.SetWorkerCount(Workers);
+
+        double Start = TestSeconds();
+
+        Failures = g_Scheduler.Run((ULONG)Tasks.size(), [&Tasks](ULONG Index)
+        {
+            Tasks[Index].Image->ParseImage();
+            if (Tasks[Index].Exports) Tasks[Index].Image->RtlGetExports();
+            if (Tasks[Index].Imports) Tasks[Index].Image->RtlGetImports();
+        }, &Failed);
+
+        double Seconds = TestSeconds() - Start;
+
+        for (ULONG Process = 0; Process < BENCH_PROCESSES; Process += 1) Results.push_back(GetResult(&Files[Process]));
+
+        if (Workers == 1)
+        {
+            Reference = Results;
+            ReferenceSeconds = Seconds;
+        }
+
+        double Speedup = Seconds ? ReferenceSeconds / Seconds : 0.0;
+        ULONG Ideal = min(Workers, Cores);
+        BOOLEAN Below = (Ideal > 1) && ((Speedup * 100) < (Ideal * BENCH_TARGET_SCALING));
+
+        printf("    %2u workers %6.0f ms  %6.0f MB/s  %7.0f images/s  x%.2f  results %s%s\n",
+               g_Scheduler.m_Stats.LastWorkers, Seconds * 1000,
+               Seconds ? (Bytes / Seconds) / (1024 * 1024) : 0.0,
+               Seconds ? BENCH_PROCESSES / Seconds : 0.0,
+               Speedup, (Results == Reference) ? "identical" : "DIFFERENT",
+               Below ? "  below target" : "");
+
+        CHECK(Failures == 0);
+        CHECK(Results == Reference);
+        CHECK(Files[0].m_CcSections.size() == 3);
+        CHECK(Files[0].m_Exports.size() == BENCH_EXPORTS);
+        CHECK(Files[0].m_Imports.size() == (BENCH_IMPORT_MODULES * BENCH_IMPORTS));
+        CHECK(Files[0].m_HasImpHash);
+        CHECK(strcmp(Files[0].m_PdbInfo.PdbName, "module0.pdb") == 0);
+    }
+
+    return TestResult("SchedulerBench");
+}
@@ -0,0 +1,140 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - SchedulerTest.cpp
+
+Abstract:
+
+    - TaskScheduler: every index runs once whatever the number of workers,
+      tasks that throw are reported to the caller and counted.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "Scheduler.h"
+#include "Test.h"
+
+#define TEST_TASKS 1000
+
+static
+VOID
+TestIndexes(
+)
+{
+    TaskScheduler Scheduler;
+
+    for (ULONG Workers = 1; Workers <= 8; Workers *= 2)
+    {
+        vector<atomic<ULONG>> Runs(TEST_TASKS);
+
+        Scheduler.SetWorkerCount(Workers);
+        CHECK(Scheduler.GetWorkerCount() == Workers);
+
+        for (ULONG i = 0; i < TEST_TASKS; i += 1) Runs[i] = 0;
+
+        CHECK(Scheduler.Run(TEST_TASKS, [&Runs](ULONG Index) { Runs[Index] += 1; }) == 0);
+
+        for (ULONG i = 0; i < TEST_TASKS; i += 1) CHECK(Runs[i] == 1);
+        CHECK(Scheduler.m_Stats.LastTasks == TEST_TASKS);
+        CHECK(Scheduler.m_Stats.LastFailures == 0);
+    }
+
+    CHECK(Scheduler.m_Stats.Runs == 4);
+    CHECK(Scheduler.m_Stats.Tasks == 4 * TEST_TASKS);
+    CHECK(Scheduler.Run(0, [](ULONG Index) { UNREFERENCED_PARAMETER(Index); }) == 0);
+}
+
+//
+// Tasks throw on some indexes, the others still run.
+//
+static
+BOOLEAN
+IsThrowingTask(
+    ULONG Index
+)
+{
+    return ((Index % 7) == 3) || ((Index % 11) == 5);
+}
+
+static
+VOID
+TestFailures(
+)
+{
+    TaskScheduler Scheduler;
+    ULONG Expected = 0;
+
+    for (ULONG i = 0; i < TEST_TASKS; i += 1) Expected += IsThrowingTask(i);
+
+    for (ULONG Workers = 1; Workers <= 4; Workers *= 2)
+    {
+        vector<atomic<ULONG>> Runs(TEST_TASKS);
+        vector<BOOLEAN> Failed;
+
+        Scheduler.SetWorkerCount(Workers);
+        for (ULONG i = 0; i < TEST_TASKS; i += 1) Runs[i] = 0;
+
+        CHECK(Scheduler.Run(TEST_TASKS, [&Runs](ULONG Index)
+        {
+            if ((Index % 7) == 3) throw runtime_error("task");
+            if ((Index % 11) == 5) throw 5;
+            Runs[Index] += 1;
+        }, &Failed) == Expected);
+
+        CHECK(Failed.size() == TEST_TASKS);
+
+        for (ULONG i = 0; i < TEST_TASKS; i += 1)
+        {
+            CHECK(Failed[i] == IsThrowingTask(i));
+            CHECK(Runs[i] == (IsThrowingTask(i) ? 0U : 1U));
+        }
+
+        CHECK(Scheduler.m_Stats.LastFailures == Expected);
+    }
+
+    CHECK(Scheduler.m_Stats.Failures == 3 * Expected);
+}
+
+int
+main(
+)
+{
+    TestIndexes();
+    TestFailures();
+
+    return TestResult("Scheduler");
+}
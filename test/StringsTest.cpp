@@ -0,0 +1,763 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - StringsTest.cpp
+
+Abstract:
+
+    - The string extractor against a byte at a time scan on random buffers
+      fed in chunks of every size: ASCII and UTF-16LE runs across chunk and
+      block boundaries, at both parities, around the minimum length and
+      longer than STRINGS_MAX_LENGTH.
+    - GetStrings() with runs across its chunks and unreadable chunks.
+    - StringIndex round trip: the strings of a few processes written, merged
+      and opened again, every query compared with a scan of all the strings.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+using namespace std;
+
+#include "Strings.h"
+#include "Test.h"
+
+#if STRING_INDEX_RUN_ENTRIES < 65536
+#define TEST_NAME "Strings (small index runs)"
+#else
+#define TEST_NAME "Strings"
+#endif
+
+#define TEST_BUFFER_SIZE (64 * 1024)
+#define TEST_SEEDS 3
+
+static const ULONG g_MinLengths[] = { 0, 1, 2, 3, 5, 31, 32, 33, 63, 64, 65, 200 };
+
+//
+// 0 stands for a random size for every chunk.
+//
+static const ULONG g_ChunkSizes[] = { 1, 2, 63, 64, 65, 127, 4096, 0 };
+
+static
+BOOLEAN
+IsPrintable(
+    UCHAR Byte
+)
+{
+    return ((Byte >= 0x20) && (Byte < 0x7F)) || (Byte == '\t');
+}
+
+//
+// Printable byte followed by a zero, the last byte is never one.
+//
+static
+BOOLEAN
+IsCharacter(
+    const vector<UCHAR>& Data,
+    SIZE_T Offset
+)
+{
+    return ((Offset + 1) < Data.size()) && IsPrintable(Data[Offset]) && (Data[Offset + 1] == 0);
+}
+
+static
+VOID
+AddHit(
+    vector<STRING_HIT>& Hits,
+    SIZE_T Offset,
+    SIZE_T Length,
+    BOOLEAN Wide,
+    const string& Text
+)
+{
+    STRING_HIT Hit;
+
+    Hit.Offset = Offset;
+    Hit.Length = (ULONG)Length;
+    Hit.Wide = Wide;
+    Hit.Text = Text;
+
+    Hits.push_back(Hit);
+}
+
+//
+// Reference: one byte at a time, the ASCII runs then the runs of characters of each parity.
+//
+static
+VOID
+NaiveStrings(
+    const vector<UCHAR>& Data,
+    ULONG MinLength,
+    vector<STRING_HIT>& Hits
+)
+{
+    SIZE_T Size = Data.size();
+
+    if (MinLength == 0) MinLength = 1;
+
+    for (SIZE_T i = 0; i < Size; )
+    {
+        SIZE_T j = i;
+        string Text;
+
+        for (; (j < Size) && IsPrintable(Data[j]); j += 1)
+        {
+            if (Text.size() < STRINGS_MAX_LENGTH) Text.push_back((CHAR)Data[j]);
+        }
+
+        if ((j - i) >= MinLength) AddHit(Hits, i, j - i, FALSE, Text);
+
+        i = (j == i) ? (i + 1) : j;
+    }
+
+    for (SIZE_T Parity = 0; Parity < 2; Parity += 1)
+    {
+        for (SIZE_T i = Parity; i < Size; )
+        {
+            SIZE_T j = i;
+            string Text;
+
+            for (; IsCharacter(Data, j); j += 2)
+            {
+                if (Text.size() < STRINGS_MAX_LENGTH) Text.push_back((CHAR)Data[j]);
+            }
+
+            if (((j - i) / 2) >= MinLength) AddHit(Hits, i, (j - i) / 2, TRUE, Text);
+
+            i = (j == i) ? (i + 2) : j;
+        }
+    }
+}
+
+//
+// The extractor reports the runs as they end, the order differs from the reference.
+//
+static
+VOID
+SortHits(
+    vector<STRING_HIT>& Hits
+)
+{
+    sort(Hits.begin(), Hits.end(), [](const STRING_HIT& a, const STRING_HIT& b)
+    {
+        return (a.Offset != b.Offset) ? (a.Offset < b.Offset) : (a.Wide < b.Wide);
+    });
+}
+
+static
+BOOLEAN
+SameHits(
+    vector<STRING_HIT>& Expected,
+    vector<STRING_HIT>& Hits
+)
+{
+    SortHits(Expected);
+    SortHits(Hits);
+
+    if (Expected.size() != Hits.size()) return FALSE;
+
+    for (SIZE_T i = 0; i < Hits.size(); i += 1)
+    {
+        if ((Expected[i].Offset != Hits[i].Offset) ||
+            (Expected[i].Length != Hits[i].Length) ||
+            (Expected[i].Wide != Hits[i].Wide) ||
+            (Expected[i].Text != Hits[i].Text)) return FALSE;
+    }
+
+    return TRUE;
+}
+
+static
+VOID
+PutRun(
+    vector<UCHAR>& Data,
+    ULONG Length,
+    BOOLEAN Wide,
+    const CHAR *Alphabet,
+    unsigned long long *Seed
+)
+{
+    ULONG AlphabetSize = (ULONG)strlen(Alphabet);
+
+    //
+    // Neither printable nor zero on both sides, the run is exactly Length long.
+    //
+    Data.push_back(0xFF);
+
+    for (ULONG i = 0; i < Length; i += 1)
+    {
+        Data.push_back((UCHAR)Alphabet[TestRandom(Seed) % AlphabetSize]);
+        if (Wide) Data.push_back(0);
+    }
+
+    Data.push_back(0xFF);
+}
+
+//
+// Binary data with runs of lengths around MinLength, the block size and STRINGS_MAX_LENGTH.
+//
+static
+VOID
+GetBuffer(
+    vector<UCHAR>& Data,
+    SIZE_T Size,
+    ULONG MinLength,
+    const CHAR *Alphabet,
+    unsigned long long *Seed
+)
+{
+    Data.clear();
+
+    while (Data.size() < Size)
+    {
+        ULONG Kind = TestRandom(Seed) % 8;
+        ULONG Length;
+
+        switch (TestRandom(Seed) % 8)
+        {
+            case 0: Length = MinLength ? (MinLength - 1) : 0; break;
+            case 1: Length = MinLength; break;
+            case 2: Length = MinLength + 1; break;
+            case 3: Length = (STRINGS_MAX_LENGTH - 1) + (TestRandom(Seed) % 3); break;
+            case 4: Length = 600 + (TestRandom(Seed) % 200); break;
+            default: Length = 1 + (TestRandom(Seed) % 80); break;
+        }
+
+        if (Kind < 3)
+        {
+            PutRun(Data, Length, FALSE, Alphabet, Seed);
+        }
+        else if (Kind < 6)
+        {
+            //
+            // Both parities.
+            //
+            if (TestRandom(Seed) & 1) Data.push_back(0x80);
+
+            PutRun(Data, Length, TRUE, Alphabet, Seed);
+        }
+        else
+        {
+            //
+            // Binary, zeroes and printable bytes make short runs of both kinds.
+            //
+            Length = TestRandom(Seed) % 256;
+
+            for (ULONG i = 0; i < Length; i += 1)
+            {
+                ULONG Byte = TestRandom(Seed);
+
+                switch (Byte % 4)
+                {
+                    case 0: Data.push_back(0); break;
+                    case 1: Data.push_back((UCHAR)(0x20 + ((Byte >> 8) % 0x5F))); break;
+                    default: Data.push_back((UCHAR)(Byte >> 8)); break;
+                }
+            }
+        }
+    }
+
+    Data.resize(Size);
+}
+
+static
+VOID
+Extract(
+    const vector<UCHAR>& Data,
+    ULONG MinLength,
+    ULONG ChunkSize,
+    unsigned long long *Seed,
+    vector<STRING_HIT>& Hits
+)
+{
+    STRINGS_CONTEXT Context;
+
+    StringsInit(&Context, MinLength);
+
+    for (SIZE_T Offset = 0; Offset < Data.size(); )
+    {
+        ULONG Size = ChunkSize ? ChunkSize : (1 + (TestRandom(Seed) % 300));
+
+        if (Size > (Data.size() - Offset)) Size = (ULONG)(Data.size() - Offset);
+
+        StringsUpdate(&Context, &Data[Offset], Size, Hits);
+        Offset += Size;
+    }
+
+    StringsFinal(&Context, Hits);
+}
+
+static
+VOID
+TestBuffer(
+    LPCSTR Name,
+    const vector<UCHAR>& Data,
+    ULONG MinLength,
+    unsigned long long *Seed
+)
+{
+    vector<STRING_HIT> Expected;
+
+    NaiveStrings(Data, MinLength, Expected);
+
+    for (ULONG i = 0; i < _countof(g_ChunkSizes); i += 1)
+    {
+        vector<STRING_HIT> Hits;
+        vector<STRING_HIT> Reference(Expected);
+
+        Extract(Data, MinLength, g_ChunkSizes[i], Seed, Hits);
+
+        if (!SameHits(Reference, Hits))
+        {
+            printf("       %s: minimum %u, chunks of %u: %u strings, %u expected\n",
+                   Name, MinLength, g_ChunkSizes[i], (ULONG)Hits.size(), (ULONG)Reference.size());
+        }
+
+        CHECK(SameHits(Reference, Hits));
+    }
+}
+
+static
+VOID
+TestRandomBuffers(
+)
+{
+    unsigned long long Seed = 0x47;
+    vector<UCHAR> Data;
+
+    for (ULONG i = 0; i < _countof(g_MinLengths); i += 1)
+    {
+        for (ULONG Run = 0; Run < TEST_SEEDS; Run += 1)
+        {
+            GetBuffer(Data, TEST_BUFFER_SIZE, g_MinLengths[i], " Aa0~\t", &Seed);
+            TestBuffer("Random", Data, g_MinLengths[i], &Seed);
+        }
+    }
+}
+
+static
+VOID
+TestEdges(
+)
+{
+    unsigned long long Seed = 0x74;
+    vector<UCHAR> Data;
+
+    //
+    // A single run over the whole buffer, the masks never have a clear bit.
+    //
+    Data.assign(3000, 'A');
+    TestBuffer("ASCII only", Data, STRINGS_MIN_LENGTH, &Seed);
+    TestBuffer("ASCII only", Data, 3001, &Seed);
+
+    Data.clear();
+    for (ULONG i = 0; i < 1500; i += 1)
+    {
+        Data.push_back('W');
+        Data.push_back(0);
+    }
+
+    TestBuffer("Wide only", Data, STRINGS_MIN_LENGTH, &Seed);
+    TestBuffer("Wide only", Data, 1500, &Seed);
+    TestBuffer("Wide only", Data, 1501, &Seed);
+
+    //
+    // Without the high byte of its last character.
+    //
+    Data.pop_back();
+    TestBuffer("Wide truncated", Data, 1500, &Seed);
+    TestBuffer("Wide truncated", Data, 1499, &Seed);
+
+    Data.assign(1, 'A');
+    TestBuffer("One byte", Data, 1, &Seed);
+
+    Data.assign(2, 0);
+    Data[0] = 'A';
+    TestBuffer("One character", Data, 1, &Seed);
+
+    Data.assign(4096, 0);
+    TestBuffer("Zeroes", Data, 1, &Seed);
+
+    //
+    // Runs of exactly MinLength ending on every offset of two blocks, the wide ones at both
+    // parities.
+    //
+    for (ULONG MinLength = 1; MinLength <= 70; MinLength += 23)
+    {
+        for (ULONG End = 0; End < 128; End += 1)
+        {
+            ULONG WideEnd = 256 + End;
+
+            Data.assign(512, 0xFF);
+
+            if (End >= MinLength) memset(&Data[End - MinLength], 'x', MinLength);
+
+            for (ULONG i = WideEnd - (2 * MinLength); i < WideEnd; i += 2)
+            {
+                Data[i] = 'y';
+                Data[i + 1] = 0;
+            }
+
+            TestBuffer("Block edges", Data, MinLength, &Seed);
+        }
+    }
+}
+
+typedef struct _TEST_READER {
+    const vector<UCHAR> *Data;
+    ULONG64 Unreadable; // Offset of the chunk that cannot be read, ~0 if none.
+    ULONG Reads;
+} TEST_READER, *PTEST_READER;
+
+static
+BOOLEAN
+ReadBuffer(
+    PVOID Context,
+    ULONG64 Offset,
+    LPBYTE Buffer,
+    ULONG Length
+)
+{
+    PTEST_READER Reader = (PTEST_READER)Context;
+
+    Reader->Reads += 1;
+
+    if (Offset == Reader->Unreadable) return FALSE;
+
+    memcpy(Buffer, &(*Reader->Data)[(SIZE_T)Offset], Length);
+
+    return TRUE;
+}
+
+//
+// Runs across the chunks of GetStrings(), and a chunk read as zeroes.
+//
+static
+VOID
+TestGetStrings(
+)
+{
+    unsigned long long Seed = 0x5A;
+    vector<UCHAR> Data, Zeroed;
+    vector<STRING_HIT> Expected, Hits;
+    TEST_READER Reader;
+    ULONG64 Size = (2 * STRINGS_CHUNK_SIZE) + (STRINGS_CHUNK_SIZE / 2) + 3;
+
+    GetBuffer(Data, (SIZE_T)Size, STRINGS_MIN_LENGTH, " Aa0~\t", &Seed);
+
+    memset(&Data[STRINGS_CHUNK_SIZE - 700], 'C', 1400);
+    memset(&Data[STRINGS_CHUNK_SIZE + 700], 0xFF, 1);
+
+    //
+    // Odd parity, a character split by the boundary and one ending on it.
+    //
+    for (ULONG i = (2 * STRINGS_CHUNK_SIZE) - 9; i < ((2 * STRINGS_CHUNK_SIZE) + 9); i += 2)
+    {
+        Data[i] = 'D';
+        Data[i + 1] = 0;
+    }
+
+    Data[(2 * STRINGS_CHUNK_SIZE) + 9] = 0xFF;
+
+    Reader.Data = &Data;
+    Reader.Unreadable = ~0ULL;
+    Reader.Reads = 0;
+
+    NaiveStrings(Data, STRINGS_MIN_LENGTH, Expected);
+    CHECK(GetStrings(Size, ReadBuffer, &Reader, STRINGS_MIN_LENGTH, Hits));
+    CHECK(Reader.Reads == 3);
+    CHECK(SameHits(Expected, Hits));
+
+    //
+    // The unreadable chunk is scanned as zeroes, the runs around it are cut.
+    //
+    Zeroed = Data;
+    memset(&Zeroed[STRINGS_CHUNK_SIZE], 0, STRINGS_CHUNK_SIZE);
+
+    Expected.clear();
+    Hits.clear();
+    Reader.Unreadable = STRINGS_CHUNK_SIZE;
+
+    NaiveStrings(Zeroed, STRINGS_MIN_LENGTH, Expected);
+    CHECK(GetStrings(Size, ReadBuffer, &Reader, STRINGS_MIN_LENGTH, Hits));
+    CHECK(SameHits(Expected, Hits));
+
+    Data.resize(STRINGS_CHUNK_SIZE / 2);
+    Hits.clear();
+    Reader.Unreadable = 0;
+
+    CHECK(!GetStrings(Data.size(), ReadBuffer, &Reader, STRINGS_MIN_LENGTH, Hits));
+    CHECK(!GetStrings(0, ReadBuffer, &Reader, STRINGS_MIN_LENGTH, Hits));
+}
+
+#define TEST_INDEX_PROCESSES 3
+#define TEST_INDEX_VADS 4
+#define TEST_INDEX_VAD_SIZE (256 * 1024)
+
+//
+// Few letters in both cases, the trigrams are shared by many strings.
+//
+#define TEST_INDEX_ALPHABET "abcdeABCDE .-"
+
+static
+BOOLEAN
+SameResults(
+    const vector<StringIndex::INDEX_RESULT>& Expected,
+    const vector<StringIndex::INDEX_RESULT>& Results
+)
+{
+    if (Expected.size() != Results.size()) return FALSE;
+
+    for (SIZE_T i = 0; i < Results.size(); i += 1)
+    {
+        if ((Expected[i].Process != Results[i].Process) ||
+            (Expected[i].VadBase != Results[i].VadBase) ||
+            (Expected[i].Offset != Results[i].Offset) ||
+            (Expected[i].Length != Results[i].Length) ||
+            (Expected[i].Wide != Results[i].Wide) ||
+            (Expected[i].Text != Results[i].Text)) return FALSE;
+    }
+
+    return TRUE;
+}
+
+static
+VOID
+NaiveFind(
+    const vector<StringIndex::INDEX_RESULT>& Strings,
+    const string& Query,
+    ULONG MaxResults,
+    vector<StringIndex::INDEX_RESULT>& Results
+)
+{
+    string Lower(Query);
+
+    transform(Lower.begin(), Lower.end(), Lower.begin(), [](CHAR c) { return (CHAR)tolower((UCHAR)c); });
+
+    Results.clear();
+
+    for (SIZE_T i = 0; (i < Strings.size()) && (Results.size() < MaxResults); i += 1)
+    {
+        string Text(Strings[i].Text);
+
+        transform(Text.begin(), Text.end(), Text.begin(), [](CHAR c) { return (CHAR)tolower((UCHAR)c); });
+
+        if (Text.find(Lower) != string::npos) Results.push_back(Strings[i]);
+    }
+}
+
+static
+BOOLEAN
+CopyFile(
+    LPCSTR From,
+    LPCSTR To,
+    LONG Truncate
+)
+{
+    vector<UCHAR> Data;
+    FILE *File;
+    BOOLEAN Result;
+
+    File = fopen(From, "rb");
+    if (File == NULL) return FALSE;
+
+    fseek(File, 0, SEEK_END);
+    Data.resize(ftell(File));
+    fseek(File, 0, SEEK_SET);
+    Result = (fread(Data.data(), 1, Data.size(), File) == Data.size()) ? TRUE : FALSE;
+    fclose(File);
+
+    if (!Result) return FALSE;
+
+    File = fopen(To, "wb");
+    if (File == NULL) return FALSE;
+
+    Result = (fwrite(Data.data(), 1, Data.size() - Truncate, File) == (Data.size() - Truncate)) ? TRUE : FALSE;
+    fclose(File);
+
+    return Result;
+}
+
+static
+VOID
+TestIndex(
+)
+{
+    static LPCSTR Names[TEST_INDEX_PROCESSES] = { "explorer.exe", "svchost.exe", "AVeryLongImageName.exe" };
+    char FileName[] = "/tmp/StringsTest.XXXXXX";
+    CHAR RunName[MAX_PATH];
+    string Copy;
+    unsigned long long Seed = 0x1D;
+    vector<StringIndex::INDEX_RESULT> Strings, Expected, Results;
+    vector<UCHAR> Data;
+    StringIndex Index;
+    ULONG Queries = 0, Matches = 0;
+    int Fd;
+
+    Fd = mkstemp(FileName);
+    CHECK(Fd >= 0);
+    if (Fd >= 0) close(Fd);
+
+    snprintf(RunName, sizeof(RunName), "%s.0.tmp", FileName);
+    Copy = string(FileName) + ".copy";
+
+    CHECK(Index.Create(FileName));
+
+    for (ULONG Process = 0; Process < TEST_INDEX_PROCESSES; Process += 1)
+    {
+        CHECK(Index.AddProcess(0x100 + (Process * 4), 0xFFFFFA8000000000ULL + (Process * 0x1000), Names[Process]) == Process);
+
+        for (ULONG Vad = 0; Vad < TEST_INDEX_VADS; Vad += 1)
+        {
+            ULONG64 VadBase = 0x7FF600000000ULL + ((ULONG64)Vad << 24) + ((ULONG64)Process << 36);
+            vector<STRING_HIT> Hits;
+            STRINGS_CONTEXT Context;
+
+            GetBuffer(Data, TEST_INDEX_VAD_SIZE, STRINGS_MIN_LENGTH, TEST_INDEX_ALPHABET, &Seed);
+
+            StringsInit(&Context, STRINGS_MIN_LENGTH);
+            StringsUpdate(&Context, Data.data(), (ULONG)Data.size(), Hits);
+            StringsFinal(&Context, Hits);
+
+            CHECK(Index.Add(Process, VadBase, Hits));
+
+            for (const STRING_HIT& Hit : Hits)
+            {
+                StringIndex::INDEX_RESULT String;
+
+                String.Process = Process;
+                String.VadBase = VadBase;
+                String.Offset = (ULONG)Hit.Offset;
+                String.Length = Hit.Length;
+                String.Wide = Hit.Wide;
+                String.Text = Hit.Text;
+
+                Strings.push_back(String);
+            }
+        }
+    }
+
+    CHECK(Index.m_NumberOfStrings == Strings.size());
+    CHECK(!Index.Find("abc", STRINGS_MAX_RESULTS, Results));
+    CHECK(Index.Close());
+
+    //
+    // The runs are gone, the index cannot be written to anymore.
+    //
+    CHECK(access(RunName, F_OK) != 0);
+    CHECK(!Index.Add(0, 0, vector<STRING_HIT>(1)));
+    CHECK(!Index.Close());
+
+    CHECK(Index.Open(FileName));
+    CHECK(Index.m_NumberOfStrings == Strings.size());
+    CHECK(Index.m_Processes.size() == TEST_INDEX_PROCESSES);
+
+    for (ULONG Process = 0; Process < Index.m_Processes.size(); Process += 1)
+    {
+        CHECK(Index.m_Processes[Process].ProcessId == (0x100 + (Process * 4)));
+        CHECK(Index.m_Processes[Process].ProcessObject == (0xFFFFFA8000000000ULL + (Process * 0x1000)));
+        CHECK(strncmp(Index.m_Processes[Process].ImageFileName, Names[Process], sizeof(Index.m_Processes[Process].ImageFileName) - 1) == 0);
+    }
+
+    //
+    // Substrings of the strings with their case changed, shorter than a trigram too.
+    //
+    for (ULONG Run = 0; Run < 200; Run += 1)
+    {
+        const string& Text = Strings[TestRandom(&Seed) % Strings.size()].Text;
+        ULONG Length = 1 + (TestRandom(&Seed) % 10);
+        ULONG MaxResults = (Run & 1) ? STRINGS_MAX_RESULTS : (ULONG)Strings.size();
+        string Query;
+
+        if (Length > Text.size()) Length = (ULONG)Text.size();
+
+        Query = Text.substr(TestRandom(&Seed) % (Text.size() - Length + 1), Length);
+
+        for (SIZE_T i = 0; i < Query.size(); i += 1)
+        {
+            if (TestRandom(&Seed) & 1) Query[i] = (CHAR)toupper((UCHAR)Query[i]);
+        }
+
+        NaiveFind(Strings, Query, MaxResults, Expected);
+
+        CHECK(Index.Find(Query.c_str(), MaxResults, Results));
+
+        if (!SameResults(Expected, Results))
+        {
+            printf("       \"%s\": %u results, %u expected\n", Query.c_str(), (ULONG)Results.size(), (ULONG)Expected.size());
+        }
+
+        CHECK(SameResults(Expected, Results));
+
+        Queries += 1;
+        if (Results.size()) Matches += 1;
+    }
+
+    CHECK(Matches == Queries);
+
+    //
+    // 0x7F is not printable, it is in no string.
+    //
+    CHECK(Index.Find("abcd\x7F", STRINGS_MAX_RESULTS, Results));
+    CHECK(Results.empty());
+    CHECK(Index.Find("\x7F", STRINGS_MAX_RESULTS, Results));
+    CHECK(Results.empty());
+    CHECK(!Index.Find("", STRINGS_MAX_RESULTS, Results));
+
+    //
+    // Sections that do not add up to the size of the file.
+    //
+    CHECK(CopyFile(FileName, Copy.c_str(), 1));
+    CHECK(!Index.Open(Copy.c_str()));
+    CHECK(!Index.Find("abc", STRINGS_MAX_RESULTS, Results));
+
+    CHECK(CopyFile(FileName, Copy.c_str(), 0));
+    CHECK(Index.Open(Copy.c_str()));
+
+    remove(Copy.c_str());
+    remove(FileName);
+}
+
+int
+main(
+)
+{
+    TestRandomBuffers();
+    TestEdges();
+    TestGetStrings();
+    TestIndex();
+
+    return TestResult(TEST_NAME);
+}
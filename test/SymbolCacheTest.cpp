@@ -0,0 +1,254 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - SymbolCacheTest.cpp
+
+Abstract:
+
+    - SymbolCache against a fake resolver: positive and negative caching,
+      address spaces, eviction, truncated names and the batch API.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <string.h>
+#include <string>
+#include <map>
+
+#include "SymbolCache.h"
+#include "Test.h"
+
+typedef struct _FAKE_RESOLVER {
+    unsigned long Calls;
+    std::map<uint64_t, unsigned long> CallsPerOffset;
+} FAKE_RESOLVER, *PFAKE_RESOLVER;
+
+//
+// Even offsets resolve to "fake!f_<offset>", odd ones are unknown, 0x7000 has a long name.
+//
+static
+bool
+FakeResolver(
+    void *Context,
+    uint64_t Offset,
+    char *Name,
+    uint32_t NameSize
+)
+{
+    PFAKE_RESOLVER Resolver = (PFAKE_RESOLVER)Context;
+
+    Resolver->Calls += 1;
+    Resolver->CallsPerOffset[Offset] += 1;
+
+    if (Offset & 1) return false;
+
+    if (Offset == 0x7000)
+    {
+        std::string Long(400, 'x');
+
+        snprintf(Name, NameSize, "fake!%s", Long.c_str());
+        return true;
+    }
+
+    snprintf(Name, NameSize, "fake!f_%llx", (unsigned long long)Offset);
+    return true;
+}
+
+static
+void
+TestPositiveAndNegative(
+)
+{
+    FAKE_RESOLVER Resolver;
+    SymbolCache Cache(FakeResolver, &Resolver);
+    char Name[64];
+
+    Resolver.Calls = 0;
+
+    CHECK(Cache.Lookup(0x1000, 0, Name, sizeof(Name)));
+    CHECK(strcmp(Name, "fake!f_1000") == 0);
+    memset(Name, 0, sizeof(Name));
+    CHECK(Cache.Lookup(0x1000, 0, Name, sizeof(Name)));
+    CHECK(strcmp(Name, "fake!f_1000") == 0);
+    CHECK(Resolver.Calls == 1);
+
+    //
+    // Misses are cached too, the resolver is not asked again.
+    //
+    CHECK(!Cache.Lookup(0x1001, 0, Name, sizeof(Name)));
+    CHECK(!Cache.Lookup(0x1001, 0, Name, sizeof(Name)));
+    CHECK(!Cache.Lookup(0x1001, 0, Name, sizeof(Name)));
+    CHECK(Resolver.CallsPerOffset[0x1001] == 1);
+
+    CHECK(Cache.m_Stats.Lookups == 5);
+    CHECK(Cache.m_Stats.Hits == 1);
+    CHECK(Cache.m_Stats.NegativeHits == 2);
+    CHECK(Cache.m_Stats.Misses == 2);
+
+    //
+    // Same offset in another address space is another entry.
+    //
+    CHECK(Cache.Lookup(0x1000, 0xFFFFFA8000001000ULL, Name, sizeof(Name)));
+    CHECK(Resolver.CallsPerOffset[0x1000] == 2);
+
+    //
+    // Smaller buffers get a truncated copy of the cached name.
+    //
+    char Small[8];
+    CHECK(Cache.Lookup(0x1000, 0, Small, sizeof(Small)));
+    CHECK(strcmp(Small, "fake!f_") == 0);
+    CHECK(Resolver.CallsPerOffset[0x1000] == 2);
+
+    Cache.Flush();
+    CHECK(Cache.Lookup(0x1000, 0, Name, sizeof(Name)));
+    CHECK(Resolver.CallsPerOffset[0x1000] == 3);
+}
+
+static
+void
+TestUncacheable(
+)
+{
+    FAKE_RESOLVER Resolver;
+    SymbolCache Cache(FakeResolver, &Resolver);
+    char Name[512];
+    char Small[32];
+
+    //
+    // Names truncated by the caller buffer or too long for an entry are not stored.
+    //
+    CHECK(Cache.Lookup(0x7000, 0, Small, sizeof(Small)));
+    CHECK(strlen(Small) == sizeof(Small) - 1);
+    CHECK(Cache.Lookup(0x7000, 0, Name, sizeof(Name)));
+    CHECK(strlen(Name) == 405);
+    CHECK(Resolver.CallsPerOffset[0x7000] == 2);
+    CHECK(Cache.m_Stats.Uncacheable == 2);
+}
+
+static
+void
+TestEviction(
+)
+{
+    FAKE_RESOLVER Resolver;
+    SymbolCache Cache(FakeResolver, &Resolver);
+    char Name[64];
+    uint64_t Colliding = 0;
+
+    //
+    // Find an offset sharing the slot of 0x1000.
+    //
+    for (uint64_t Offset = 0x2000; Offset < 0x2000 + (SYMBOL_CACHE_SIZE * 64 * 2); Offset += 2)
+    {
+        Cache.Flush();
+        Cache.ResetStats();
+        Cache.Lookup(0x1000, 0, Name, sizeof(Name));
+        Cache.Lookup(Offset, 0, Name, sizeof(Name));
+
+        if (Cache.m_Stats.Evictions)
+        {
+            Colliding = Offset;
+            break;
+        }
+    }
+
+    CHECK(Colliding != 0);
+
+    Resolver.CallsPerOffset.clear();
+    Cache.ResetStats();
+
+    CHECK(Cache.Lookup(Colliding, 0, Name, sizeof(Name)));
+    CHECK(Resolver.CallsPerOffset[Colliding] == 0);
+    CHECK(Cache.Lookup(0x1000, 0, Name, sizeof(Name)));
+    CHECK(strcmp(Name, "fake!f_1000") == 0);
+    CHECK(Resolver.CallsPerOffset[0x1000] == 1);
+    CHECK(Cache.m_Stats.Evictions == 1);
+
+    //
+    // The cache stays bounded: every lookup past its size evicts an entry.
+    //
+    Cache.Flush();
+    Cache.ResetStats();
+
+    for (uint64_t i = 0; i < SYMBOL_CACHE_SIZE * 8; i += 1) Cache.Lookup(0x100000 + (i * 0x10), 0, Name, sizeof(Name));
+
+    CHECK(Cache.m_Stats.Misses == SYMBOL_CACHE_SIZE * 8);
+    CHECK((Cache.m_Stats.Misses - Cache.m_Stats.Evictions) <= SYMBOL_CACHE_SIZE);
+}
+
+static
+void
+TestBatch(
+)
+{
+    FAKE_RESOLVER Resolver;
+    SymbolCache Cache(FakeResolver, &Resolver);
+    const uint64_t Offsets[] = { 0x3000, 0x4000, 0x3000, 0, 0x4001, 0x3000, 0x4001, 0x5000 };
+    const uint32_t Count = sizeof(Offsets) / sizeof(Offsets[0]);
+    char Names[Count][64];
+
+    Resolver.Calls = 0;
+    memset(Names, 'z', sizeof(Names));
+
+    CHECK(Cache.LookupBatch(Count, Offsets, 0, &Names[0][0], sizeof(Names[0])) == 5);
+
+    //
+    // Each distinct non-zero offset is resolved once, 0 never.
+    //
+    CHECK(Resolver.Calls == 4);
+    CHECK(Resolver.CallsPerOffset.count(0) == 0);
+
+    CHECK(strcmp(Names[0], "fake!f_3000") == 0);
+    CHECK(strcmp(Names[1], "fake!f_4000") == 0);
+    CHECK(strcmp(Names[2], "fake!f_3000") == 0);
+    CHECK(Names[3][0] == '\0');
+    CHECK(Names[4][0] == '\0');
+    CHECK(strcmp(Names[5], "fake!f_3000") == 0);
+    CHECK(Names[6][0] == '\0');
+    CHECK(strcmp(Names[7], "fake!f_5000") == 0);
+
+    //
+    // A second batch is served from the cache, misses included.
+    //
+    CHECK(Cache.LookupBatch(Count, Offsets, 0, &Names[0][0], sizeof(Names[0])) == 5);
+    CHECK(Resolver.Calls == 4);
+    CHECK(Cache.m_Stats.NegativeHits >= 2);
+}
+
+int
+main(
+)
+{
+    TestPositiveAndNegative();
+    TestUncacheable();
+    TestEviction();
+    TestBatch();
+
+    return TestResult("SymbolCache");
+}
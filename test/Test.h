@@ -0,0 +1,93 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - Test.h
+
+Abstract:
+
+    - Checks and timing shared by the tests and benchmarks of the portable
+      modules, built on Linux with the Makefile of this directory.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __TEST_H__
+#define __TEST_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+static unsigned long g_TestFailures = 0;
+
+#define CHECK(Condition)                                                        \
+    do {                                                                        \
+        if (!(Condition)) {                                                     \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #Condition); \
+            g_TestFailures += 1;                                                \
+        }                                                                       \
+    } while (0)
+
+//
+// Returns the exit code of the test.
+//
+static inline
+int
+TestResult(
+    const char *Name
+)
+{
+    if (g_TestFailures) printf("[FAIL] %s: %lu check(s) failed\n", Name, g_TestFailures);
+    else printf("[ OK ] %s\n", Name);
+
+    return g_TestFailures ? 1 : 0;
+}
+
+static inline
+double
+TestSeconds(
+)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//
+// Deterministic generator, same corpus on every run and compiler.
+//
+static inline
+unsigned int
+TestRandom(
+    unsigned long long *Seed
+)
+{
+    *Seed = (*Seed * 6364136223846793005ULL) + 1442695040888963407ULL;
+    return (unsigned int)(*Seed >> 33);
+}
+
+#endif
@@ -0,0 +1,395 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - TestHive.h
+
+Abstract:
+
+    - Writer of synthetic regf hives for the RegFile test and benchmark: hbins
+      of 4 KB (bigger for bigger cells), nk/vk/sk cells, lf/lh/li/ri subkey
+      lists and db big data values, and the base block with its checksum.
+      Cells are returned as offsets from the first hbin, as in the file.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __TESTHIVE_H__
+#define __TESTHIVE_H__
+
+#define TEST_HBIN_SIZE 0x1000
+#define TEST_HBIN_HEADER_SIZE 0x20
+
+class TestHive {
+public:
+    TestHive(
+    )
+    {
+        m_BinStart = 0;
+        m_BinEnd = 0;
+        m_Used = 0;
+    }
+
+    ULONG
+    Allocate(
+        ULONG Size
+    )
+    {
+        ULONG CellSize = (sizeof(LONG) + Size + 7) & ~7;
+        ULONG Cell;
+
+        if ((m_BinEnd - m_Used) < CellSize)
+        {
+            ULONG BinSize = (TEST_HBIN_HEADER_SIZE + CellSize + TEST_HBIN_SIZE - 1) & ~(TEST_HBIN_SIZE - 1);
+
+            CloseBin();
+
+            m_BinStart = m_BinEnd;
+            m_BinEnd += BinSize;
+            m_Bins.resize(m_BinEnd, 0);
+
+            memcpy(&m_Bins[m_BinStart], "hbin", 4);
+            SetUlong(m_BinStart + 4, m_BinStart);
+            SetUlong(m_BinStart + 8, BinSize);
+
+            m_Used = m_BinStart + TEST_HBIN_HEADER_SIZE;
+        }
+
+        Cell = m_Used;
+        SetUlong(Cell, (ULONG)-(LONG)CellSize);
+        m_Used += CellSize;
+
+        return Cell;
+    }
+
+    PUCHAR
+    GetCell(
+        ULONG Cell
+    )
+    {
+        return &m_Bins[Cell + sizeof(LONG)];
+    }
+
+    ULONG
+    AddKey(
+        ULONG Parent,
+        LPCWSTR Name,
+        BOOLEAN Compressed,
+        ULONG Security
+    )
+    {
+        ULONG Length = (ULONG)wcslen(Name);
+        ULONG NameLength = Compressed ? Length : Length * sizeof(USHORT);
+        ULONG Cell = Allocate(FIELD_OFFSET(REGF_KEY_NODE, Name) + NameLength);
+        PREGF_KEY_NODE KeyNode = (PREGF_KEY_NODE)GetCell(Cell);
+
+        KeyNode->Signature = REGF_KEY_NODE_SIGNATURE;
+        KeyNode->Flags = Compressed ? REGF_KEY_COMP_NAME : 0;
+        KeyNode->LastWriteTime = 0x01D0000000000000ULL + Cell;
+        KeyNode->Parent = Parent;
+        KeyNode->SubKeyLists[0] = REGF_CELL_NIL;
+        KeyNode->SubKeyLists[1] = REGF_CELL_NIL;
+        KeyNode->ValueList = REGF_CELL_NIL;
+        KeyNode->Security = Security;
+        KeyNode->Class = REGF_CELL_NIL;
+        KeyNode->NameLength = (USHORT)NameLength;
+
+        SetName(KeyNode->Name, Name, Compressed);
+
+        return Cell;
+    }
+
+    //
+    // li and ri lists only hold cells, lf and lh lists a hint after each cell.
+    //
+    ULONG
+    AddList(
+        USHORT Signature,
+        const vector<ULONG>& Cells
+    )
+    {
+        ULONG Stride = ((Signature == REGF_FAST_LEAF_SIGNATURE) || (Signature == REGF_HASH_LEAF_SIGNATURE)) ? 2 : 1;
+        ULONG Cell = Allocate(FIELD_OFFSET(REGF_KEY_INDEX, List) + ((ULONG)Cells.size() * Stride * sizeof(ULONG)));
+        PREGF_KEY_INDEX Index = (PREGF_KEY_INDEX)GetCell(Cell);
+
+        Index->Signature = Signature;
+        Index->Count = (USHORT)Cells.size();
+
+        for (ULONG i = 0; i < Cells.size(); i += 1)
+        {
+            Index->List[i * Stride] = Cells[i];
+            if (Stride == 2) Index->List[(i * Stride) + 1] = GetHint(Signature, Cells[i]);
+        }
+
+        return Cell;
+    }
+
+    VOID
+    SetSubKeys(
+        ULONG Key,
+        ULONG List,
+        ULONG NumberOfSubKeys
+    )
+    {
+        PREGF_KEY_NODE KeyNode = (PREGF_KEY_NODE)GetCell(Key);
+
+        KeyNode->SubKeyLists[0] = List;
+        KeyNode->SubKeyCounts[0] = NumberOfSubKeys;
+    }
+
+    //
+    // Up to 4 bytes are stored inline, more than REGF_BIG_DATA_SEGMENT in db cells when BigData is set.
+    //
+    ULONG
+    AddValue(
+        LPCWSTR Name,
+        BOOLEAN Compressed,
+        ULONG Type,
+        const UCHAR *Data,
+        ULONG DataLength,
+        BOOLEAN BigData
+    )
+    {
+        ULONG Length = (ULONG)wcslen(Name);
+        ULONG NameLength = Compressed ? Length : Length * sizeof(USHORT);
+        ULONG DataCell = 0;
+        ULONG Cell;
+        PREGF_KEY_VALUE KeyValue;
+
+        if (DataLength <= sizeof(ULONG))
+        {
+            if (DataLength) memcpy(&DataCell, Data, DataLength);
+        }
+        else if (BigData && (DataLength > REGF_BIG_DATA_SEGMENT))
+        {
+            vector<ULONG> Segments;
+            PREGF_BIG_DATA Big;
+            ULONG List;
+
+            for (ULONG Offset = 0; Offset < DataLength; Offset += REGF_BIG_DATA_SEGMENT)
+            {
+                ULONG SegmentLength = min(DataLength - Offset, (ULONG)REGF_BIG_DATA_SEGMENT);
+                ULONG Segment = Allocate(SegmentLength);
+
+                memcpy(GetCell(Segment), Data + Offset, SegmentLength);
+                Segments.push_back(Segment);
+            }
+
+            List = Allocate((ULONG)Segments.size() * sizeof(ULONG));
+            memcpy(GetCell(List), &Segments[0], Segments.size() * sizeof(ULONG));
+
+            DataCell = Allocate(sizeof(REGF_BIG_DATA));
+            Big = (PREGF_BIG_DATA)GetCell(DataCell);
+            Big->Signature = REGF_BIG_DATA_SIGNATURE;
+            Big->Count = (USHORT)Segments.size();
+            Big->List = List;
+        }
+        else
+        {
+            DataCell = Allocate(DataLength);
+            memcpy(GetCell(DataCell), Data, DataLength);
+        }
+
+        Cell = Allocate(FIELD_OFFSET(REGF_KEY_VALUE, Name) + NameLength);
+        KeyValue = (PREGF_KEY_VALUE)GetCell(Cell);
+
+        KeyValue->Signature = REGF_KEY_VALUE_SIGNATURE;
+        KeyValue->NameLength = (USHORT)NameLength;
+        KeyValue->DataLength = DataLength | ((DataLength <= sizeof(ULONG)) ? REGF_VALUE_SPECIAL_SIZE : 0);
+        KeyValue->Data = DataCell;
+        KeyValue->Type = Type;
+        KeyValue->Flags = Compressed ? REGF_VALUE_COMP_NAME : 0;
+
+        SetName(KeyValue->Name, Name, Compressed);
+
+        return Cell;
+    }
+
+    VOID
+    SetValues(
+        ULONG Key,
+        const vector<ULONG>& Values
+    )
+    {
+        ULONG List = Allocate((ULONG)Values.size() * sizeof(ULONG));
+        PREGF_KEY_NODE KeyNode;
+
+        memcpy(GetCell(List), &Values[0], Values.size() * sizeof(ULONG));
+
+        KeyNode = (PREGF_KEY_NODE)GetCell(Key);
+        KeyNode->ValueList = List;
+        KeyNode->ValueCount = (ULONG)Values.size();
+    }
+
+    ULONG
+    AddSecurity(
+        const UCHAR *Descriptor,
+        ULONG DescriptorLength
+    )
+    {
+        ULONG Cell = Allocate(FIELD_OFFSET(REGF_KEY_SECURITY, Descriptor) + DescriptorLength);
+        PREGF_KEY_SECURITY Security = (PREGF_KEY_SECURITY)GetCell(Cell);
+
+        Security->Signature = REGF_SECURITY_SIGNATURE;
+        Security->Flink = Cell;
+        Security->Blink = Cell;
+        Security->ReferenceCount = 1;
+        Security->DescriptorLength = DescriptorLength;
+        memcpy(Security->Descriptor, Descriptor, DescriptorLength);
+
+        return Cell;
+    }
+
+    //
+    // Base block followed by the bins.
+    //
+    VOID
+    GetFile(
+        ULONG RootCell,
+        ULONG Minor,
+        vector<UCHAR>& File
+    )
+    {
+        REGF_BASE_BLOCK BaseBlock = { 0 };
+        PULONG Ulongs = (PULONG)&BaseBlock;
+        ULONG CheckSum = 0;
+
+        CloseBin();
+
+        BaseBlock.Signature = REGF_SIGNATURE;
+        BaseBlock.Sequence1 = 7;
+        BaseBlock.Sequence2 = 7;
+        BaseBlock.Major = 1;
+        BaseBlock.Minor = Minor;
+        BaseBlock.Format = 1;
+        BaseBlock.RootCell = RootCell;
+        BaseBlock.Length = (ULONG)m_Bins.size();
+        BaseBlock.Cluster = 1;
+
+        for (ULONG i = 0; i < FIELD_OFFSET(REGF_BASE_BLOCK, CheckSum) / sizeof(ULONG); i += 1) CheckSum ^= Ulongs[i];
+        if (CheckSum == 0) CheckSum = 1;
+        else if (CheckSum == 0xFFFFFFFF) CheckSum = 0xFFFFFFFE;
+        BaseBlock.CheckSum = CheckSum;
+
+        File.assign(REGF_BASE_BLOCK_SIZE, 0);
+        memcpy(&File[0], &BaseBlock, sizeof(BaseBlock));
+        File.insert(File.end(), m_Bins.begin(), m_Bins.end());
+    }
+
+    static
+    BOOLEAN
+    WriteFile(
+        LPCSTR FileName,
+        const vector<UCHAR>& File
+    )
+    {
+        FILE *Handle = fopen(FileName, "wb");
+        BOOLEAN Result;
+
+        if (Handle == NULL) return FALSE;
+
+        Result = File.empty() || (fwrite(&File[0], File.size(), 1, Handle) == 1);
+        if (fclose(Handle)) Result = FALSE;
+
+        return Result;
+    }
+
+    vector<UCHAR> m_Bins;
+
+private:
+    VOID
+    SetUlong(
+        ULONG Offset,
+        ULONG Value
+    )
+    {
+        memcpy(&m_Bins[Offset], &Value, sizeof(Value));
+    }
+
+    static
+    VOID
+    SetName(
+        PUCHAR Destination,
+        LPCWSTR Name,
+        BOOLEAN Compressed
+    )
+    {
+        for (ULONG i = 0; Name[i]; i += 1)
+        {
+            if (Compressed)
+            {
+                Destination[i] = (UCHAR)Name[i];
+            }
+            else
+            {
+                Destination[i * 2] = (UCHAR)Name[i];
+                Destination[(i * 2) + 1] = (UCHAR)(Name[i] >> 8);
+            }
+        }
+    }
+
+    //
+    // lf: the first 4 characters of the name, lh: its hash. Not used by RegFile.
+    //
+    ULONG
+    GetHint(
+        USHORT Signature,
+        ULONG Key
+    )
+    {
+        PREGF_KEY_NODE KeyNode = (PREGF_KEY_NODE)GetCell(Key);
+        ULONG Hint = 0;
+
+        for (ULONG i = 0; i < KeyNode->NameLength; i += 1)
+        {
+            UCHAR Character = (UCHAR)toupper(KeyNode->Name[i]);
+
+            if (Signature == REGF_HASH_LEAF_SIGNATURE) Hint = (Hint * 37) + Character;
+            else if (i < sizeof(ULONG)) Hint |= (ULONG)KeyNode->Name[i] << (i * 8);
+        }
+
+        return Hint;
+    }
+
+    //
+    // The rest of the bin is one free cell.
+    //
+    VOID
+    CloseBin(
+    )
+    {
+        if ((m_BinEnd - m_Used) >= sizeof(LONG)) SetUlong(m_Used, m_BinEnd - m_Used);
+        m_Used = m_BinEnd;
+    }
+
+    ULONG m_BinStart;
+    ULONG m_BinEnd;
+    ULONG m_Used;
+};
+
+#endif
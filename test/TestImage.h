@@ -0,0 +1,548 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - TestImage.h
+
+Abstract:
+
+    - Writer of synthetic PE images for the PEFile tests and benchmark: DOS
+      and NT headers (32 or 64-bit), sections on page boundaries, export,
+      import, resource, debug and relocation directories. Data is appended to the last
+      section and returned as an RVA. The image is produced in its mapped
+      layout, as captured from a process, or in its file layout.
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __TESTIMAGE_H__
+#define __TESTIMAGE_H__
+
+#define TEST_IMAGE_SECTION_ALIGNMENT 0x1000
+#define TEST_IMAGE_FILE_ALIGNMENT 0x200
+#define TEST_IMAGE_NT_HEADERS_OFFSET 0x80
+#define TEST_IMAGE_HEADERS_SIZE 0x400 // In the file, the first section is mapped at 0x1000.
+#define TEST_IMAGE_MAX_SECTIONS 8 // Section table has to fit in the headers.
+
+typedef struct _TEST_EXPORT {
+    string Name; // Empty if only exported by ordinal.
+    ULONG Index; // In the function table, the ordinal is Base + Index.
+    ULONG Rva;
+    string Forwarder; // "DLL.Function", Rva is then ignored.
+} TEST_EXPORT, *PTEST_EXPORT;
+
+typedef struct _TEST_IMPORT {
+    string ModuleName; // Consecutive imports of the same module share a descriptor.
+    string Name; // Empty for an import by ordinal.
+    ULONG Ordinal;
+    ULONG IatRva; // Set by AddImports().
+} TEST_IMPORT, *PTEST_IMPORT;
+
+class TestImage {
+public:
+    TestImage(
+        BOOLEAN Is64Bit,
+        ULONG64 ImageBase
+    )
+    {
+        m_Is64Bit = Is64Bit;
+        m_ImageBase = ImageBase;
+        m_TimeDateStamp = 0x53000000;
+        m_Image.assign(TEST_IMAGE_SECTION_ALIGNMENT, 0);
+        RtlZeroMemory(m_Directories, sizeof(m_Directories));
+    }
+
+    //
+    // Following data goes to this section, until the next call.
+    //
+    ULONG
+    AddSection(
+        LPCSTR Name,
+        ULONG Characteristics
+    )
+    {
+        IMAGE_SECTION_HEADER Section = { 0 };
+
+        CloseSection();
+
+        memcpy(Section.Name, Name, min(strlen(Name), sizeof(Section.Name)));
+        Section.VirtualAddress = (ULONG)m_Image.size();
+        Section.Characteristics = Characteristics;
+        m_Sections.push_back(Section);
+
+        return Section.VirtualAddress;
+    }
+
+    ULONG
+    Put(
+        const VOID *Data,
+        ULONG Length,
+        ULONG Alignment = sizeof(ULONG)
+    )
+    {
+        ULONG Rva = ((ULONG)m_Image.size() + Alignment - 1) & ~(Alignment - 1);
+
+        m_Image.resize(Rva + Length, 0);
+        if (Data) memcpy(&m_Image[Rva], Data, Length);
+
+        return Rva;
+    }
+
+    ULONG
+    PutString(
+        LPCSTR String
+    )
+    {
+        return Put(String, (ULONG)strlen(String) + 1, 1);
+    }
+
+    PUCHAR
+    Get(
+        ULONG Rva
+    )
+    {
+        return &m_Image[Rva];
+    }
+
+    VOID
+    SetDirectory(
+        ULONG Entry,
+        ULONG Rva,
+        ULONG Size
+    )
+    {
+        m_Directories[Entry].VirtualAddress = Rva;
+        m_Directories[Entry].Size = Size;
+    }
+
+    //
+    // Names are sorted as the loader expects them, forwarder strings are inside of the directory.
+    //
+    ULONG
+    AddExports(
+        LPCSTR DllName,
+        ULONG Base,
+        ULONG NumberOfFunctions,
+        const vector<TEST_EXPORT>& Exports
+    )
+    {
+        IMAGE_EXPORT_DIRECTORY Directory = { 0 };
+        vector<const TEST_EXPORT *> Named;
+        vector<ULONG> Functions(NumberOfFunctions, 0);
+        vector<ULONG> Names;
+        vector<USHORT> NameOrdinals;
+        ULONG Rva;
+
+        for (ULONG i = 0; i < Exports.size(); i += 1)
+        {
+            if (!Exports[i].Name.empty()) Named.push_back(&Exports[i]);
+        }
+
+        sort(Named.begin(), Named.end(), [](const TEST_EXPORT *Left, const TEST_EXPORT *Right) { return Left->Name < Right->Name; });
+
+        Rva = Put(NULL, sizeof(Directory));
+
+        Directory.Name = PutString(DllName);
+        Directory.Base = Base;
+        Directory.NumberOfFunctions = NumberOfFunctions;
+        Directory.NumberOfNames = (ULONG)Named.size();
+
+        for (ULONG i = 0; i < Exports.size(); i += 1)
+        {
+            Functions[Exports[i].Index] = Exports[i].Forwarder.empty() ? Exports[i].Rva : PutString(Exports[i].Forwarder.c_str());
+        }
+
+        for (ULONG i = 0; i < Named.size(); i += 1)
+        {
+            Names.push_back(PutString(Named[i]->Name.c_str()));
+            NameOrdinals.push_back((USHORT)Named[i]->Index);
+        }
+
+        Directory.AddressOfFunctions = Put(Functions.data(), NumberOfFunctions * sizeof(ULONG));
+        Directory.AddressOfNames = Put(Names.data(), (ULONG)Names.size() * sizeof(ULONG));
+        Directory.AddressOfNameOrdinals = Put(NameOrdinals.data(), (ULONG)NameOrdinals.size() * sizeof(USHORT));
+
+        memcpy(&m_Image[Rva], &Directory, sizeof(Directory));
+        SetDirectory(IMAGE_DIRECTORY_ENTRY_EXPORT, Rva, (ULONG)m_Image.size() - Rva);
+
+        return Rva;
+    }
+
+    //
+    // Descriptors, lookup tables and hint/name entries, then the IAT, filled as on disk (the
+    // lookup table is copied). IatRva of every import is set.
+    //
+    ULONG
+    AddImports(
+        vector<TEST_IMPORT>& Imports
+    )
+    {
+        ULONG ThunkSize = m_Is64Bit ? sizeof(ULONG64) : sizeof(ULONG);
+        ULONG64 OrdinalFlag = m_Is64Bit ? IMAGE_ORDINAL_FLAG64 : IMAGE_ORDINAL_FLAG32;
+        vector<IMAGE_IMPORT_DESCRIPTOR> Descriptors;
+        vector<ULONG> First; // Index of the first import of every descriptor.
+        vector<ULONG64> Thunks;
+        ULONG Rva, LookupRva, IatRva;
+
+        for (ULONG i = 0; i < Imports.size(); i += 1)
+        {
+            if (!i || (Imports[i].ModuleName != Imports[i - 1].ModuleName)) First.push_back(i);
+        }
+
+        First.push_back((ULONG)Imports.size());
+        Descriptors.resize(First.size()); // Ends with an empty descriptor.
+
+        Rva = Put(NULL, (ULONG)(Descriptors.size() * sizeof(IMAGE_IMPORT_DESCRIPTOR)));
+
+        for (ULONG i = 0; i < Imports.size(); i += 1)
+        {
+            ULONG64 Thunk;
+
+            if (!Imports[i].Name.empty())
+            {
+                USHORT Hint = (USHORT)Imports[i].Ordinal;
+
+                Thunk = Put(&Hint, sizeof(Hint), sizeof(USHORT));
+                PutString(Imports[i].Name.c_str());
+            }
+            else
+            {
+                Thunk = OrdinalFlag | Imports[i].Ordinal;
+            }
+
+            Thunks.push_back(Thunk);
+            if (((i + 1) == Imports.size()) || (Imports[i + 1].ModuleName != Imports[i].ModuleName)) Thunks.push_back(0);
+        }
+
+        for (ULONG d = 0; (d + 1) < First.size(); d += 1)
+        {
+            Descriptors[d].Name = PutString(Imports[First[d]].ModuleName.c_str());
+        }
+
+        LookupRva = PutThunks(Thunks, ThunkSize);
+        IatRva = PutThunks(Thunks, ThunkSize);
+
+        for (ULONG d = 0, Slot = 0; (d + 1) < First.size(); d += 1)
+        {
+            Descriptors[d].OriginalFirstThunk = LookupRva + (Slot * ThunkSize);
+            Descriptors[d].FirstThunk = IatRva + (Slot * ThunkSize);
+
+            for (ULONG i = First[d]; i < First[d + 1]; i += 1, Slot += 1) Imports[i].IatRva = IatRva + (Slot * ThunkSize);
+
+            Slot += 1; // Terminating thunk.
+        }
+
+        memcpy(&m_Image[Rva], Descriptors.data(), Descriptors.size() * sizeof(IMAGE_IMPORT_DESCRIPTOR));
+        SetDirectory(IMAGE_DIRECTORY_ENTRY_IMPORT, Rva, (ULONG)(Descriptors.size() * sizeof(IMAGE_IMPORT_DESCRIPTOR)));
+        SetDirectory(IMAGE_DIRECTORY_ENTRY_IAT, IatRva, (ULONG)Thunks.size() * ThunkSize);
+
+        return Rva;
+    }
+
+    //
+    // One resource: type, name and language directories, then its data entry and data.
+    //
+    ULONG
+    AddResource(
+        ULONG Type,
+        ULONG Name,
+        const VOID *Data,
+        ULONG Length
+    )
+    {
+        ULONG DirectorySize = sizeof(IMAGE_RESOURCE_DIRECTORY) + sizeof(IMAGE_RESOURCE_DIRECTORY_ENTRY);
+        ULONG Ids[] = { Type, Name, 0x409 };
+        IMAGE_RESOURCE_DATA_ENTRY DataEntry = { 0 };
+        ULONG Rva;
+
+        Rva = Put(NULL, (3 * DirectorySize) + sizeof(DataEntry));
+
+        for (ULONG Level = 0; Level < _countof(Ids); Level += 1)
+        {
+            PIMAGE_RESOURCE_DIRECTORY Directory = (PIMAGE_RESOURCE_DIRECTORY)&m_Image[Rva + (Level * DirectorySize)];
+            PIMAGE_RESOURCE_DIRECTORY_ENTRY Entry = (PIMAGE_RESOURCE_DIRECTORY_ENTRY)(Directory + 1);
+
+            Directory->NumberOfIdEntries = 1;
+            Entry->Id = (USHORT)Ids[Level];
+
+            if (Level < 2)
+            {
+                Entry->OffsetToDirectory = (Level + 1) * DirectorySize;
+                Entry->DataIsDirectory = 1;
+            }
+            else
+            {
+                Entry->OffsetToData = 3 * DirectorySize;
+            }
+        }
+
+        DataEntry.OffsetToData = Put(Data, Length);
+        DataEntry.Size = Length;
+        memcpy(&m_Image[Rva + (3 * DirectorySize)], &DataEntry, sizeof(DataEntry));
+
+        SetDirectory(IMAGE_DIRECTORY_ENTRY_RESOURCE, Rva, (ULONG)m_Image.size() - Rva);
+
+        return Rva;
+    }
+
+    //
+    // CodeView RSDS record, as written by the linker.
+    //
+    ULONG
+    AddDebug(
+        LPCSTR PdbName,
+        const GUID *Guid,
+        ULONG Age
+    )
+    {
+        IMAGE_DEBUG_DIRECTORY Directory = { 0 };
+        ULONG Signature = CV_SIGNATURE_RSDS;
+        ULONG Rva, RecordRva;
+
+        Rva = Put(NULL, sizeof(Directory));
+
+        RecordRva = Put(&Signature, sizeof(Signature));
+        Put(Guid, sizeof(GUID), 1);
+        Put(&Age, sizeof(Age), 1);
+        PutString(PdbName);
+
+        Directory.Type = IMAGE_DEBUG_TYPE_CODEVIEW;
+        Directory.SizeOfData = (ULONG)m_Image.size() - RecordRva;
+        Directory.AddressOfRawData = RecordRva;
+        memcpy(&m_Image[Rva], &Directory, sizeof(Directory));
+
+        SetDirectory(IMAGE_DIRECTORY_ENTRY_DEBUG, Rva, sizeof(Directory));
+
+        return Rva;
+    }
+
+    //
+    // Pointers at these RVAs are relocated (HIGHLOW or DIR64), a block per page, padded with an
+    // ABSOLUTE entry to keep the blocks aligned.
+    //
+    ULONG
+    AddRelocations(
+        vector<ULONG> Rvas
+    )
+    {
+        USHORT Type = m_Is64Bit ? IMAGE_REL_BASED_DIR64 : IMAGE_REL_BASED_HIGHLOW;
+        ULONG Rva = Put(NULL, 0);
+
+        sort(Rvas.begin(), Rvas.end());
+
+        for (ULONG i = 0; i < Rvas.size(); )
+        {
+            IMAGE_BASE_RELOCATION Block;
+            vector<USHORT> Entries;
+
+            Block.VirtualAddress = Rvas[i] & ~(TEST_IMAGE_SECTION_ALIGNMENT - 1);
+
+            for (; (i < Rvas.size()) && ((Rvas[i] & ~(TEST_IMAGE_SECTION_ALIGNMENT - 1)) == Block.VirtualAddress); i += 1)
+            {
+                Entries.push_back((USHORT)((Type << 12) | (Rvas[i] & (TEST_IMAGE_SECTION_ALIGNMENT - 1))));
+            }
+
+            if (Entries.size() & 1) Entries.push_back(IMAGE_REL_BASED_ABSOLUTE << 12);
+
+            Block.SizeOfBlock = sizeof(Block) + ((ULONG)Entries.size() * sizeof(USHORT));
+            Put(&Block, sizeof(Block));
+            Put(Entries.data(), (ULONG)Entries.size() * sizeof(USHORT));
+        }
+
+        SetDirectory(IMAGE_DIRECTORY_ENTRY_BASERELOC, Rva, (ULONG)m_Image.size() - Rva);
+
+        return Rva;
+    }
+
+    //
+    // Mapped layout, SizeOfImage bytes.
+    //
+    VOID
+    GetImage(
+        vector<UCHAR>& Image
+    )
+    {
+        CloseSection();
+        WriteHeaders();
+
+        Image = m_Image;
+    }
+
+    //
+    // File layout: headers, then the raw data of every section.
+    //
+    VOID
+    GetFile(
+        vector<UCHAR>& File
+    )
+    {
+        CloseSection();
+        WriteHeaders();
+
+        File.assign(m_Image.begin(), m_Image.begin() + TEST_IMAGE_HEADERS_SIZE);
+
+        for (ULONG i = 0; i < m_Sections.size(); i += 1)
+        {
+            File.resize(m_Sections[i].PointerToRawData, 0);
+            File.insert(File.end(),
+                        m_Image.begin() + m_Sections[i].VirtualAddress,
+                        m_Image.begin() + m_Sections[i].VirtualAddress + m_Sections[i].SizeOfRawData);
+        }
+    }
+
+    //
+    // Set by GetImage() and GetFile().
+    //
+    PIMAGE_SECTION_HEADER
+    GetSection(
+        ULONG Index
+    )
+    {
+        return &m_Sections[Index];
+    }
+
+    static
+    BOOLEAN
+    WriteFile(
+        LPCSTR FileName,
+        const vector<UCHAR>& File
+    )
+    {
+        FILE *Handle = fopen(FileName, "wb");
+        BOOLEAN Result;
+
+        if (Handle == NULL) return FALSE;
+
+        Result = File.empty() || (fwrite(&File[0], File.size(), 1, Handle) == 1);
+        if (fclose(Handle)) Result = FALSE;
+
+        return Result;
+    }
+
+    BOOLEAN m_Is64Bit;
+    ULONG64 m_ImageBase;
+    ULONG m_TimeDateStamp;
+
+private:
+    vector<UCHAR> m_Image; // Mapped layout, the headers are written by GetImage() and GetFile().
+    vector<IMAGE_SECTION_HEADER> m_Sections;
+    IMAGE_DATA_DIRECTORY m_Directories[IMAGE_NUMBEROF_DIRECTORY_ENTRIES];
+
+    ULONG
+    PutThunks(
+        const vector<ULONG64>& Thunks,
+        ULONG ThunkSize
+    )
+    {
+        ULONG Rva = Put(NULL, (ULONG)Thunks.size() * ThunkSize, ThunkSize);
+
+        for (ULONG i = 0; i < Thunks.size(); i += 1) memcpy(&m_Image[Rva + (i * ThunkSize)], &Thunks[i], ThunkSize);
+
+        return Rva;
+    }
+
+    //
+    // Sizes of the last section, the image ends on a page boundary.
+    //
+    VOID
+    CloseSection(
+    )
+    {
+        if (!m_Sections.empty())
+        {
+            IMAGE_SECTION_HEADER& Section = m_Sections.back();
+            ULONG End = (ULONG)m_Image.size();
+
+            Section.Misc.VirtualSize = End - Section.VirtualAddress;
+            Section.SizeOfRawData = (Section.Misc.VirtualSize + TEST_IMAGE_FILE_ALIGNMENT - 1) & ~(TEST_IMAGE_FILE_ALIGNMENT - 1);
+        }
+
+        m_Image.resize((m_Image.size() + TEST_IMAGE_SECTION_ALIGNMENT - 1) & ~(TEST_IMAGE_SECTION_ALIGNMENT - 1), 0);
+    }
+
+    VOID
+    WriteHeaders(
+    )
+    {
+        PIMAGE_DOS_HEADER DosHeader = (PIMAGE_DOS_HEADER)&m_Image[0];
+        PIMAGE_NT_HEADERS32 NtHeader32 = (PIMAGE_NT_HEADERS32)&m_Image[TEST_IMAGE_NT_HEADERS_OFFSET];
+        PIMAGE_NT_HEADERS64 NtHeader64 = (PIMAGE_NT_HEADERS64)NtHeader32;
+        PIMAGE_SECTION_HEADER Sections;
+        ULONG RawData = TEST_IMAGE_HEADERS_SIZE;
+
+        RtlZeroMemory(&m_Image[0], TEST_IMAGE_HEADERS_SIZE);
+
+        DosHeader->e_magic = IMAGE_DOS_SIGNATURE;
+        DosHeader->e_lfanew = TEST_IMAGE_NT_HEADERS_OFFSET;
+
+        NtHeader32->Signature = IMAGE_NT_SIGNATURE;
+        NtHeader32->FileHeader.NumberOfSections = (USHORT)m_Sections.size();
+        NtHeader32->FileHeader.TimeDateStamp = m_TimeDateStamp;
+
+        if (m_Is64Bit)
+        {
+            NtHeader64->FileHeader.Machine = 0x8664;
+            NtHeader64->FileHeader.SizeOfOptionalHeader = sizeof(IMAGE_OPTIONAL_HEADER64);
+            NtHeader64->FileHeader.Characteristics = 0x2022; // DLL, large address aware, executable.
+            NtHeader64->OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR64_MAGIC;
+            NtHeader64->OptionalHeader.ImageBase = m_ImageBase;
+            NtHeader64->OptionalHeader.SectionAlignment = TEST_IMAGE_SECTION_ALIGNMENT;
+            NtHeader64->OptionalHeader.FileAlignment = TEST_IMAGE_FILE_ALIGNMENT;
+            NtHeader64->OptionalHeader.SizeOfImage = (ULONG)m_Image.size();
+            NtHeader64->OptionalHeader.SizeOfHeaders = TEST_IMAGE_HEADERS_SIZE;
+            NtHeader64->OptionalHeader.NumberOfRvaAndSizes = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+            memcpy(NtHeader64->OptionalHeader.DataDirectory, m_Directories, sizeof(m_Directories));
+            Sections = (PIMAGE_SECTION_HEADER)(NtHeader64 + 1);
+        }
+        else
+        {
+            NtHeader32->FileHeader.Machine = 0x14C;
+            NtHeader32->FileHeader.SizeOfOptionalHeader = sizeof(IMAGE_OPTIONAL_HEADER32);
+            NtHeader32->FileHeader.Characteristics = 0x2102; // DLL, 32-bit, executable.
+            NtHeader32->OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR32_MAGIC;
+            NtHeader32->OptionalHeader.ImageBase = (ULONG)m_ImageBase;
+            NtHeader32->OptionalHeader.SectionAlignment = TEST_IMAGE_SECTION_ALIGNMENT;
+            NtHeader32->OptionalHeader.FileAlignment = TEST_IMAGE_FILE_ALIGNMENT;
+            NtHeader32->OptionalHeader.SizeOfImage = (ULONG)m_Image.size();
+            NtHeader32->OptionalHeader.SizeOfHeaders = TEST_IMAGE_HEADERS_SIZE;
+            NtHeader32->OptionalHeader.NumberOfRvaAndSizes = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+            memcpy(NtHeader32->OptionalHeader.DataDirectory, m_Directories, sizeof(m_Directories));
+            Sections = (PIMAGE_SECTION_HEADER)(NtHeader32 + 1);
+        }
+
+        for (ULONG i = 0; i < m_Sections.size(); i += 1)
+        {
+            m_Sections[i].PointerToRawData = RawData;
+            RawData += m_Sections[i].SizeOfRawData;
+        }
+
+        memcpy(Sections, m_Sections.data(), m_Sections.size() * sizeof(IMAGE_SECTION_HEADER));
+    }
+};
+
+#endif
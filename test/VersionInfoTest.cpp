@@ -0,0 +1,883 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - VersionInfoTest.cpp
+
+Abstract:
+
+    - VerParseVersionInfo() on hand-built VS_VERSIONINFO resources: padding of
+      the keys and values, choice of the string table, truncated and wrong
+      wLength / wValueLength. Every prefix of a resource and every corrupted
+      length is parsed from a buffer of its exact size. RtlGetFileVersion() on
+      the same resources in a synthetic image (TestImage.h).
+
+Environment:
+
+    - User mode
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <string>
+using namespace std;
+
+#include "Md5.h"
+#include "Hash.h"
+#include "FuzzyHash.h"
+#include "Entropy.h"
+#include "HashStream.h"
+#include "Arena.h"
+#include "ImageIdentity.h"
+#include "VersionInfo.h"
+#include "DbgHelpEx.h"
+#include "TestImage.h"
+#include "Test.h"
+
+#define TEST_TEXT 1
+#define TEST_BINARY 0
+
+#define TEST_DEFAULT_LENGTH MAXULONG // wLength and wValueLength computed from the content.
+
+typedef struct _TEST_BLOCK {
+    string Key;
+    USHORT Type;
+    vector<UCHAR> Value;
+    ULONG ValueLength; // In characters for text, the null included.
+    ULONG Length;
+    vector<_TEST_BLOCK> Children;
+} TEST_BLOCK, *PTEST_BLOCK;
+
+static
+TEST_BLOCK
+Block(
+    LPCSTR Key,
+    USHORT Type,
+    const vector<UCHAR>& Value,
+    ULONG ValueLength
+)
+{
+    TEST_BLOCK Result;
+
+    Result.Key = Key;
+    Result.Type = Type;
+    Result.Value = Value;
+    Result.ValueLength = ValueLength;
+    Result.Length = TEST_DEFAULT_LENGTH;
+
+    return Result;
+}
+
+static
+vector<UCHAR>
+Text(
+    LPCSTR String,
+    BOOLEAN Terminated = TRUE
+)
+{
+    vector<UCHAR> Value;
+
+    for (ULONG i = 0; String[i]; i += 1)
+    {
+        Value.push_back((UCHAR)String[i]);
+        Value.push_back(0);
+    }
+
+    if (Terminated) Value.insert(Value.end(), 2, 0);
+
+    return Value;
+}
+
+static
+TEST_BLOCK
+String(
+    LPCSTR Key,
+    LPCSTR Value
+)
+{
+    return Block(Key, TEST_TEXT, Text(Value), (ULONG)strlen(Value) + 1);
+}
+
+//
+// StringFileInfo with one string table per name, and its strings.
+//
+static
+TEST_BLOCK
+StringTable(
+    LPCSTR LangCodePage,
+    const vector<TEST_BLOCK>& Strings
+)
+{
+    TEST_BLOCK Table = Block(LangCodePage, TEST_TEXT, vector<UCHAR>(), 0);
+
+    Table.Children = Strings;
+
+    return Table;
+}
+
+static
+TEST_BLOCK
+StringFileInfo(
+    const vector<TEST_BLOCK>& Tables
+)
+{
+    TEST_BLOCK Info = Block("StringFileInfo", TEST_TEXT, vector<UCHAR>(), 0);
+
+    Info.Children = Tables;
+
+    return Info;
+}
+
+//
+// { wLanguage, wCodePage } pairs.
+//
+static
+TEST_BLOCK
+VarFileInfo(
+    const vector<ULONG>& Translations
+)
+{
+    TEST_BLOCK Info = Block("VarFileInfo", TEST_TEXT, vector<UCHAR>(), 0);
+    vector<UCHAR> Value;
+
+    for (ULONG i = 0; i < Translations.size(); i += 1)
+    {
+        USHORT Pair[2] = { (USHORT)(Translations[i] >> 16), (USHORT)Translations[i] };
+
+        Value.insert(Value.end(), (PUCHAR)Pair, (PUCHAR)Pair + sizeof(Pair));
+    }
+
+    Info.Children.push_back(Block("Translation", TEST_BINARY, Value, (ULONG)Value.size()));
+
+    return Info;
+}
+
+static
+TEST_BLOCK
+VersionInfo(
+    BOOLEAN FixedInfo,
+    const vector<TEST_BLOCK>& Children
+)
+{
+    ULONG Fixed[13] = { VERSION_FIXED_SIGNATURE, 0x10000, 0x00010002, 0x00030004, 0x00050006, 0x00070008 };
+    TEST_BLOCK Root = Block("VS_VERSION_INFO", TEST_BINARY, vector<UCHAR>(), 0);
+
+    if (FixedInfo) Root.Value.assign((PUCHAR)Fixed, (PUCHAR)Fixed + sizeof(Fixed));
+    Root.ValueLength = (ULONG)Root.Value.size();
+    Root.Children = Children;
+
+    return Root;
+}
+
+static
+VOID
+PutUshort(
+    vector<UCHAR>& Blob,
+    ULONG Value
+)
+{
+    Blob.push_back((UCHAR)Value);
+    Blob.push_back((UCHAR)(Value >> 8));
+}
+
+static
+VOID
+Align(
+    vector<UCHAR>& Blob
+)
+{
+    while (Blob.size() % 4) Blob.push_back(0);
+}
+
+//
+// As the resource compiler writes them: the key, its null and the value start on 32-bit
+// boundaries, every child too. wLength does not include the padding after the block.
+//
+static
+VOID
+PutBlock(
+    vector<UCHAR>& Blob,
+    const TEST_BLOCK& Block
+)
+{
+    ULONG Start = (ULONG)Blob.size();
+    ULONG Length;
+
+    PutUshort(Blob, 0);
+    PutUshort(Blob, Block.ValueLength);
+    PutUshort(Blob, Block.Type);
+
+    for (ULONG i = 0; i <= Block.Key.size(); i += 1) PutUshort(Blob, (UCHAR)Block.Key.c_str()[i]);
+
+    if (!Block.Value.empty())
+    {
+        Align(Blob);
+        Blob.insert(Blob.end(), Block.Value.begin(), Block.Value.end());
+    }
+
+    for (ULONG i = 0; i < Block.Children.size(); i += 1)
+    {
+        Align(Blob);
+        PutBlock(Blob, Block.Children[i]);
+    }
+
+    Length = (Block.Length == TEST_DEFAULT_LENGTH) ? ((ULONG)Blob.size() - Start) : Block.Length;
+    Blob[Start] = (UCHAR)Length;
+    Blob[Start + 1] = (UCHAR)(Length >> 8);
+}
+
+static
+vector<UCHAR>
+GetBlob(
+    const TEST_BLOCK& Root
+)
+{
+    vector<UCHAR> Blob;
+
+    PutBlock(Blob, Root);
+
+    return Blob;
+}
+
+static
+vector<TEST_BLOCK>
+GetStrings(
+    LPCSTR Suffix
+)
+{
+    vector<TEST_BLOCK> Strings;
+    string Value;
+
+    Value = string("MoonSols Ltd.") + Suffix;
+    Strings.push_back(String("CompanyName", Value.c_str()));
+    Value = string("Memory toolkit") + Suffix;
+    Strings.push_back(String("FileDescription", Value.c_str()));
+    Value = string("2.5.0.1") + Suffix;
+    Strings.push_back(String("FileVersion", Value.c_str()));
+    Strings.push_back(String("InternalName", "dumpit"));
+    Strings.push_back(String("ProductVersion", "2.5"));
+
+    return Strings;
+}
+
+static
+vector<UCHAR>
+GetStandardBlob(
+)
+{
+    vector<TEST_BLOCK> Tables(1, StringTable("040904b0", GetStrings("")));
+    vector<TEST_BLOCK> Children;
+
+    Children.push_back(StringFileInfo(Tables));
+    Children.push_back(VarFileInfo(vector<ULONG>(1, 0x040904B0)));
+
+    return GetBlob(VersionInfo(TRUE, Children));
+}
+
+//
+// Resource of the last Parse(), the strings point into it.
+//
+static vector<UCHAR> g_Exact;
+
+//
+// Parsed from a buffer of the exact size, the strings must be inside of it.
+//
+static
+BOOLEAN
+Parse(
+    const vector<UCHAR>& Blob,
+    ULONG Size,
+    PVERSION_INFO Info
+)
+{
+    PUCHAR Data;
+    BOOLEAN Result;
+
+    vector<UCHAR>(Blob.begin(), Blob.begin() + min(Size, (ULONG)Blob.size())).swap(g_Exact);
+    Data = g_Exact.empty() ? NULL : g_Exact.data();
+
+    Result = VerParseVersionInfo(Data, (ULONG)g_Exact.size(), Info);
+
+    for (ULONG Id = 0; Id < VersionMaxString; Id += 1)
+    {
+        const UCHAR *Buffer = (const UCHAR *)Info->Strings[Id].Buffer;
+
+        if (Buffer == NULL)
+        {
+            CHECK(Info->Strings[Id].Length == 0);
+            continue;
+        }
+
+        CHECK(Result);
+        CHECK((Buffer >= Data) && ((Buffer + (Info->Strings[Id].Length * sizeof(USHORT))) <= (Data + g_Exact.size())));
+    }
+
+    return Result;
+}
+
+//
+// Offset of the first block with this key.
+//
+static
+ULONG
+FindKey(
+    const vector<UCHAR>& Blob,
+    LPCSTR Key
+)
+{
+    vector<UCHAR> Name = Text(Key);
+
+    return (ULONG)(search(Blob.begin(), Blob.end(), Name.begin(), Name.end()) - Blob.begin()) - 6;
+}
+
+static
+string
+GetString(
+    PVERSION_INFO Info,
+    VERSION_STRING_ID Id
+)
+{
+    USHORT Buffer[64];
+    string Result;
+
+    VerCopyString(&Info->Strings[Id], Buffer, _countof(Buffer));
+
+    for (ULONG i = 0; Buffer[i]; i += 1) Result += (CHAR)Buffer[i];
+
+    return Result;
+}
+
+//
+// RtlGetFileVersion() writes UTF-16 code units (VerCopyString()).
+//
+static
+string
+GetFileString(
+    const WCHAR *Field
+)
+{
+    const USHORT *Units = (const USHORT *)Field;
+    string Result;
+
+    for (ULONG i = 0; Units[i]; i += 1) Result += (CHAR)Units[i];
+
+    return Result;
+}
+
+static
+VOID
+TestStandard(
+)
+{
+    vector<UCHAR> Blob = GetStandardBlob();
+    VERSION_INFO Info;
+
+    CHECK(Parse(Blob, (ULONG)Blob.size(), &Info));
+
+    CHECK(Info.HasFixedInfo);
+    CHECK(Info.FileVersionMS == 0x00010002);
+    CHECK(Info.FileVersionLS == 0x00030004);
+    CHECK(Info.ProductVersionMS == 0x00050006);
+    CHECK(Info.ProductVersionLS == 0x00070008);
+    CHECK(Info.LangCodePage == 0x040904B0);
+
+    CHECK(GetString(&Info, VersionCompanyName) == "MoonSols Ltd.");
+    CHECK(GetString(&Info, VersionFileDescription) == "Memory toolkit");
+    CHECK(GetString(&Info, VersionFileVersion) == "2.5.0.1");
+    CHECK(GetString(&Info, VersionInternalName) == "dumpit");
+    CHECK(GetString(&Info, VersionProductVersion) == "2.5");
+    CHECK(GetString(&Info, VersionLegalCopyright) == "");
+    CHECK(Info.Strings[VersionLegalCopyright].Buffer == NULL);
+
+    //
+    // Not a version resource.
+    //
+    TEST_BLOCK Root = VersionInfo(TRUE, vector<TEST_BLOCK>());
+
+    Root.Key = "VS_VERSION_INF0";
+    CHECK(!Parse(GetBlob(Root), MAXULONG, &Info));
+    CHECK(!Parse(Blob, 0, &Info));
+    CHECK(!VerParseVersionInfo(NULL, 64, &Info));
+
+    //
+    // No fixed info, or a wrong signature.
+    //
+    Root = VersionInfo(FALSE, vector<TEST_BLOCK>());
+    CHECK(Parse(GetBlob(Root), MAXULONG, &Info));
+    CHECK(!Info.HasFixedInfo);
+
+    Root = VersionInfo(TRUE, vector<TEST_BLOCK>());
+    Root.Value[0] ^= 1;
+    CHECK(Parse(GetBlob(Root), MAXULONG, &Info));
+    CHECK(!Info.HasFixedInfo);
+}
+
+//
+// Keys and values of every length modulo 4, the padding in front of the values and
+// of the next blocks differ.
+//
+static
+VOID
+TestPadding(
+)
+{
+    static const LPCSTR Values[] = { "", "A", "AB", "ABC", "ABCD", "ABCDE" };
+    VERSION_INFO Info;
+
+    for (ULONG i = 0; i < _countof(Values); i += 1)
+    {
+        for (ULONG j = 0; j < _countof(Values); j += 1)
+        {
+            vector<TEST_BLOCK> Strings;
+            string Padding = string(Values[j]);
+
+            Strings.push_back(String(("X" + Padding).c_str(), Values[i])); // Unknown keys of 1 to 6 characters.
+            Strings.push_back(String("CompanyName", Values[j]));
+            Strings.push_back(String("FileDescription", Values[i]));
+            Strings.push_back(String("FileVersion", (Padding + "1").c_str()));
+
+            //
+            // Some tools give the tables a value, their strings follow it.
+            //
+            TEST_BLOCK Table = StringTable("040904b0", Strings);
+
+            if (j % 2) Table.Value = Text(Values[i]);
+            Table.ValueLength = (ULONG)Table.Value.size() / sizeof(USHORT);
+
+            vector<TEST_BLOCK> Children(1, StringFileInfo(vector<TEST_BLOCK>(1, Table)));
+            vector<UCHAR> Blob = GetBlob(VersionInfo((i % 2) != 0, Children));
+
+            CHECK(Parse(Blob, (ULONG)Blob.size(), &Info));
+            CHECK(GetString(&Info, VersionCompanyName) == Values[j]);
+            CHECK(GetString(&Info, VersionFileDescription) == Values[i]);
+            CHECK(GetString(&Info, VersionFileVersion) == (Padding + "1"));
+        }
+    }
+
+    //
+    // Values without their null, an empty value without any character, and keys that
+    // only start or end like a known one.
+    //
+    vector<TEST_BLOCK> Strings;
+
+    Strings.push_back(String("Company", "Prefix"));
+    Strings.push_back(String("CompanyNames", "Longer"));
+    Strings.push_back(Block("CompanyName", TEST_TEXT, Text("MoonSols", FALSE), 8));
+    Strings.push_back(Block("FileDescription", TEST_TEXT, vector<UCHAR>(), 0));
+    Strings.push_back(Block("FileVersion", TEST_TEXT, Text("1.0.0.0", FALSE), 7));
+    Strings.push_back(String("CompanyName", "Second")); // The first one is used.
+
+    vector<TEST_BLOCK> Children(1, StringFileInfo(vector<TEST_BLOCK>(1, StringTable("040904b0", Strings))));
+    vector<UCHAR> Blob = GetBlob(VersionInfo(TRUE, Children));
+
+    CHECK(Parse(Blob, (ULONG)Blob.size(), &Info));
+    CHECK(GetString(&Info, VersionCompanyName) == "MoonSols");
+    CHECK(GetString(&Info, VersionFileDescription) == "");
+    CHECK((Info.Strings[VersionFileDescription].Buffer != NULL) && (Info.Strings[VersionFileDescription].Length == 0));
+    CHECK(GetString(&Info, VersionFileVersion) == "1.0.0.0");
+}
+
+//
+// The translation listed first in VarFileInfo, the same language with another code
+// page, U.S. English, language neutral, then the first table.
+//
+static
+VOID
+TestTranslation(
+)
+{
+    typedef struct _TEST_CASE {
+        vector<ULONG> Translations;
+        vector<LPCSTR> Tables;
+        BOOLEAN VarFileInfoFirst;
+        ULONG Expected;
+    } TEST_CASE;
+
+    const TEST_CASE Cases[] = {
+        { { 0x040704B0 }, { "040904b0", "040704B0", "000004b0" }, FALSE, 0x040704B0 },
+        { { 0x040704B0 }, { "040904b0", "040704B0", "000004b0" }, TRUE, 0x040704B0 },
+        { { 0x040704E4, 0x040904B0 }, { "040904b0", "040704b0" }, FALSE, 0x040704B0 },
+        { { }, { "040704b0", "040904e4", "000004b0" }, FALSE, 0x040904E4 },
+        { { 0x040C04B0 }, { "040704b0", "000004b0" }, FALSE, 0x000004B0 },
+        { { 0x040C04B0 }, { "040704b0", "041104b0" }, FALSE, 0x040704B0 },
+        { { 0x040C04B0 }, { "0407x4b0", "040704b", "041104b0" }, FALSE, 0x041104B0 },
+    };
+
+    for (ULONG i = 0; i < _countof(Cases); i += 1)
+    {
+        vector<TEST_BLOCK> Tables, Children;
+        VERSION_INFO Info;
+        CHAR Suffix[16];
+
+        for (ULONG j = 0; j < Cases[i].Tables.size(); j += 1)
+        {
+            sprintf_s(Suffix, sizeof(Suffix), " (%s)", Cases[i].Tables[j]);
+            Tables.push_back(StringTable(Cases[i].Tables[j], GetStrings(Suffix)));
+        }
+
+        if (Cases[i].VarFileInfoFirst) Children.push_back(VarFileInfo(Cases[i].Translations));
+        Children.push_back(StringFileInfo(Tables));
+        if (!Cases[i].VarFileInfoFirst && !Cases[i].Translations.empty()) Children.push_back(VarFileInfo(Cases[i].Translations));
+
+        vector<UCHAR> Blob = GetBlob(VersionInfo(TRUE, Children));
+
+        CHECK(Parse(Blob, (ULONG)Blob.size(), &Info));
+        CHECK(Info.LangCodePage == Cases[i].Expected);
+
+        sprintf_s(Suffix, sizeof(Suffix), " (%08x)", Cases[i].Expected);
+        CHECK(_stricmp(GetString(&Info, VersionCompanyName).c_str(), (string("MoonSols Ltd.") + Suffix).c_str()) == 0);
+    }
+
+    //
+    // A translation too short is ignored.
+    //
+    vector<TEST_BLOCK> Tables, Children;
+    VERSION_INFO Info;
+
+    Tables.push_back(StringTable("040704b0", GetStrings("")));
+    Tables.push_back(StringTable("040904b0", GetStrings("")));
+    Children.push_back(StringFileInfo(Tables));
+    Children.push_back(VarFileInfo(vector<ULONG>(1, 0x040704B0)));
+    Children.back().Children[0].Value.resize(2);
+    Children.back().Children[0].ValueLength = 2;
+
+    vector<UCHAR> Blob = GetBlob(VersionInfo(TRUE, Children));
+
+    CHECK(Parse(Blob, (ULONG)Blob.size(), &Info));
+    CHECK(Info.LangCodePage == 0x040904B0);
+
+    //
+    // Only the first Translation is used.
+    //
+    Children.back().Children[0] = VarFileInfo(vector<ULONG>(1, 0x040704B0)).Children[0];
+    Children.back().Children.push_back(VarFileInfo(vector<ULONG>(1, 0x040904B0)).Children[0]);
+    Blob = GetBlob(VersionInfo(TRUE, Children));
+
+    CHECK(Parse(Blob, (ULONG)Blob.size(), &Info));
+    CHECK(Info.LangCodePage == 0x040704B0);
+
+    //
+    // Tables without any string and no table at all.
+    //
+    Children.clear();
+    Children.push_back(StringFileInfo(vector<TEST_BLOCK>(1, StringTable("040904b0", vector<TEST_BLOCK>()))));
+    Blob = GetBlob(VersionInfo(TRUE, Children));
+
+    CHECK(Parse(Blob, (ULONG)Blob.size(), &Info));
+    CHECK(Info.LangCodePage == 0x040904B0);
+    CHECK(GetString(&Info, VersionCompanyName) == "");
+
+    Children[0].Children.clear();
+    Blob = GetBlob(VersionInfo(TRUE, Children));
+
+    CHECK(Parse(Blob, (ULONG)Blob.size(), &Info));
+    CHECK(Info.LangCodePage == 0);
+}
+
+//
+// Lengths written wrong by some linkers, or by hand.
+//
+static
+VOID
+TestLengths(
+)
+{
+    VERSION_INFO Info;
+
+    for (ULONG Case = 0; Case < 8; Case += 1)
+    {
+        vector<TEST_BLOCK> Strings = GetStrings("");
+        PTEST_BLOCK Company = &Strings[0];
+        PTEST_BLOCK Version = &Strings[2];
+        PTEST_BLOCK Last = &Strings.back();
+        vector<TEST_BLOCK> Children;
+        string ExpectedCompany = "MoonSols Ltd.";
+        string ExpectedVersion = "2.5.0.1";
+        string ExpectedProduct = "2.5";
+        BOOLEAN TableLength = FALSE;
+
+        switch (Case)
+        {
+            case 0:
+                //
+                // wValueLength in bytes for a text value.
+                //
+                Company->ValueLength *= 2;
+            break;
+            case 1:
+                //
+                // wValueLength past the end of the block and of the resource.
+                //
+                Version->ValueLength = 0xFFFF;
+                Last->ValueLength = 0xFFFF;
+            break;
+            case 2:
+                //
+                // No value.
+                //
+                Company->ValueLength = 0;
+                ExpectedCompany = "";
+            break;
+            case 3:
+                //
+                // The last block longer than its parent.
+                //
+                Last->Length = 0x1000;
+            break;
+            case 4:
+                //
+                // The value cut by wLength after its first character, the string stops
+                // at the end of its block.
+                //
+                Last->Length = 6 + (15 * 2) + 2;
+                ExpectedProduct = "2";
+            break;
+            case 5:
+                //
+                // Shorter than a header: the following blocks are not read.
+                //
+                Version->Length = 4;
+                ExpectedVersion = "";
+                ExpectedProduct = "";
+            break;
+            case 6:
+                //
+                // The key is not terminated within the block.
+                //
+                Version->Length = 6 + 4;
+                ExpectedVersion = "";
+                ExpectedProduct = "";
+            break;
+            default:
+                //
+                // The table ends in its last string.
+                //
+                TableLength = TRUE;
+                ExpectedProduct = "";
+            break;
+        }
+
+        vector<TEST_BLOCK> Tables(1, StringTable("040904b0", Strings));
+
+        if (TableLength)
+        {
+            vector<UCHAR> Table = GetBlob(Tables[0]);
+
+            //
+            // In the key of the last string.
+            //
+            Tables[0].Length = FindKey(Table, "ProductVersion") + 6 + 4;
+        }
+
+        Children.push_back(StringFileInfo(Tables));
+        Children.push_back(VarFileInfo(vector<ULONG>(1, 0x040904B0)));
+
+        vector<UCHAR> Blob = GetBlob(VersionInfo(TRUE, Children));
+
+        CHECK(Parse(Blob, (ULONG)Blob.size(), &Info));
+        CHECK(Info.LangCodePage == 0x040904B0);
+        CHECK(GetString(&Info, VersionCompanyName) == ExpectedCompany);
+        CHECK(GetString(&Info, VersionFileDescription) == "Memory toolkit");
+        CHECK(GetString(&Info, VersionFileVersion) == ExpectedVersion);
+        CHECK(GetString(&Info, VersionProductVersion) == ExpectedProduct);
+
+        if ((Case == 5) || (Case == 6)) CHECK(Info.Strings[VersionFileVersion].Buffer == NULL);
+    }
+
+    //
+    // Root shorter than its header, or longer than the resource.
+    //
+    vector<UCHAR> Blob = GetStandardBlob();
+
+    Blob[0] = 5;
+    Blob[1] = 0;
+    CHECK(!Parse(Blob, (ULONG)Blob.size(), &Info));
+
+    Blob = GetStandardBlob();
+    Blob[0] = 0xFF;
+    Blob[1] = 0xFF;
+    CHECK(Parse(Blob, (ULONG)Blob.size(), &Info));
+    CHECK(GetString(&Info, VersionCompanyName) == "MoonSols Ltd.");
+    CHECK(GetString(&Info, VersionProductVersion) == "2.5");
+}
+
+//
+// Every prefix of the resource and every 16-bit field changed, from buffers of their
+// exact size: the checks are in Parse(), ASan builds also catch the reads.
+//
+static
+VOID
+TestBounds(
+)
+{
+    static const ULONG Values[] = { 0, 1, 2, 5, 6, 7, 0x7F, 0x8000, 0xFFFF };
+    vector<UCHAR> Blob = GetStandardBlob();
+    VERSION_INFO Info;
+    ULONG Strings = 0;
+
+    for (ULONG Size = 0; Size <= Blob.size(); Size += 1)
+    {
+        BOOLEAN Result = Parse(Blob, Size, &Info);
+
+        CHECK(Result == (Size >= 6 + (16 * 2)));
+
+        if (Size == Blob.size()) CHECK(GetString(&Info, VersionCompanyName) == "MoonSols Ltd.");
+
+        //
+        // Strings are found in order as the resource grows, prefixes of their values.
+        //
+        string Company = GetString(&Info, VersionCompanyName);
+
+        CHECK(string("MoonSols Ltd.").compare(0, Company.size(), Company) == 0);
+        if (Info.Strings[VersionCompanyName].Buffer) Strings += 1;
+    }
+
+    CHECK(Strings > 0);
+
+    for (ULONG Offset = 0; Offset < Blob.size(); Offset += 2)
+    {
+        for (ULONG i = 0; i < _countof(Values); i += 1)
+        {
+            vector<UCHAR> Corrupted = Blob;
+
+            Corrupted[Offset] = (UCHAR)Values[i];
+            Corrupted[Offset + 1] = (UCHAR)(Values[i] >> 8);
+
+            Parse(Corrupted, (ULONG)Corrupted.size(), &Info);
+        }
+    }
+
+    //
+    // Copies are truncated and always terminated.
+    //
+    USHORT Buffer[4] = { 0xAAAA, 0xAAAA, 0xAAAA, 0xAAAA };
+
+    CHECK(Parse(Blob, (ULONG)Blob.size(), &Info));
+    CHECK(VerCopyString(&Info.Strings[VersionCompanyName], Buffer, 3) == 2);
+    CHECK((Buffer[0] == 'M') && (Buffer[1] == 'o') && (Buffer[2] == 0) && (Buffer[3] == 0xAAAA));
+    CHECK(VerCopyString(&Info.Strings[VersionCompanyName], Buffer, 0) == 0);
+    CHECK(VerCopyString(&Info.Strings[VersionLegalCopyright], Buffer, 4) == 0);
+    CHECK(Buffer[0] == 0);
+}
+
+//
+// The resource in an image, the size of the resource data entry bounds the parse.
+//
+static
+VOID
+TestFileVersion(
+    BOOLEAN Is64Bit
+)
+{
+    static const UCHAR Code[] = { 0xC3 };
+
+    for (ULONG Case = 0; Case < 4; Case += 1)
+    {
+        TestImage Image(Is64Bit, Is64Bit ? 0x180000000ULL : 0x10000000ULL);
+        vector<TEST_BLOCK> Children;
+        vector<UCHAR> Blob, Mapped;
+        PEFile File;
+
+        if (Case != 1)
+        {
+            vector<TEST_BLOCK> Tables;
+
+            Tables.push_back(StringTable("040704b0", GetStrings(" (de)")));
+            Tables.push_back(StringTable("040904b0", GetStrings("")));
+            Children.push_back(StringFileInfo(Tables));
+
+            //
+            // Without a translation, U.S. English is used.
+            //
+            if (Case != 2) Children.push_back(VarFileInfo(vector<ULONG>(1, 0x040704B0)));
+        }
+
+        Blob = GetBlob(VersionInfo(TRUE, Children));
+
+        Image.AddSection(".text", IMAGE_SCN_CNT_CODE | IMAGE_SCN_MEM_EXECUTE | IMAGE_SCN_MEM_READ);
+        Image.Put(Code, sizeof(Code));
+        Image.AddSection(".rsrc", IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ);
+
+        //
+        // Cut in the first string table, after FileVersion.
+        //
+        Image.AddResource(RT_VERSION, VS_VERSION_INFO, Blob.data(), (Case == 3) ? FindKey(Blob, "InternalName") : (ULONG)Blob.size());
+        Image.GetImage(Mapped);
+
+        File.m_ImageBase = Image.m_ImageBase;
+        CHECK(File.SetImage(Mapped.data(), (ULONG)Mapped.size()));
+        CHECK(File.RtlGetFileVersion());
+
+        switch (Case)
+        {
+            case 0:
+                CHECK(GetFileString(File.m_FileVersion.CompanyName) == "MoonSols Ltd. (de)");
+                CHECK(GetFileString(File.m_FileVersion.FileVersion) == "2.5.0.1 (de)");
+                CHECK(GetFileString(File.m_FileVersion.FileDescription) == "Memory toolkit (de)");
+                CHECK(GetFileString(File.m_FileVersion.ProductVersion) == "2.5");
+            break;
+            case 1:
+                //
+                // VS_FIXEDFILEINFO only, formatted by swprintf_s().
+                //
+                CHECK(GetFileString(File.m_FileVersion.CompanyName) == "");
+                CHECK(wcscmp(File.m_FileVersion.FileVersion, L"1.2.3.4") == 0);
+                CHECK(wcscmp(File.m_FileVersion.ProductVersion, L"5.6.7.8") == 0);
+            break;
+            case 2:
+                CHECK(GetFileString(File.m_FileVersion.CompanyName) == "MoonSols Ltd.");
+                CHECK(GetFileString(File.m_FileVersion.FileVersion) == "2.5.0.1");
+                CHECK(GetFileString(File.m_FileVersion.FileDescription) == "Memory toolkit");
+            break;
+            default:
+                CHECK(GetFileString(File.m_FileVersion.CompanyName) == "MoonSols Ltd. (de)");
+                CHECK(GetFileString(File.m_FileVersion.FileDescription) == "Memory toolkit (de)");
+                CHECK(GetFileString(File.m_FileVersion.FileVersion) == "2.5.0.1 (de)");
+                CHECK(wcscmp(File.m_FileVersion.ProductVersion, L"5.6.7.8") == 0);
+            break;
+        }
+    }
+}
+
+int
+main(
+)
+{
+    TestStandard();
+    TestPadding();
+    TestTranslation();
+    TestLengths();
+    TestBounds();
+    TestFileVersion(FALSE);
+    TestFileVersion(TRUE);
+
+    return TestResult("VersionInfo");
+}
@@ -0,0 +1,89 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - intrin.h
+
+Abstract:
+
+    - The MSVC intrinsics used by the portable modules, on top of the gcc/clang builtins.
+      The bit scans take the 32-bit ULONG of the modules as well as an unsigned long,
+      and write the whole index as the MSVC ones do.
+
+Environment:
+
+    - User mode (Linux, tests only)
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __COMPAT_INTRIN_H__
+#define __COMPAT_INTRIN_H__
+
+#include <immintrin.h>
+#include <cpuid.h>
+
+#include "windows.h"
+
+#define COMPAT_BIT_SCAN(Name, Type, Expression)                                 \
+    static inline unsigned char Name(ULONG *Index, Type Mask)                   \
+    {                                                                           \
+        if (!Mask) return 0;                                                    \
+        *Index = (ULONG)(Expression);                                           \
+        return 1;                                                               \
+    }                                                                           \
+    static inline unsigned char Name(unsigned long *Index, Type Mask)           \
+    {                                                                           \
+        if (!Mask) return 0;                                                    \
+        *Index = (unsigned long)(Expression);                                   \
+        return 1;                                                               \
+    }
+
+COMPAT_BIT_SCAN(_BitScanForward, unsigned int, __builtin_ctz(Mask))
+COMPAT_BIT_SCAN(_BitScanReverse, unsigned int, 31 - __builtin_clz(Mask))
+COMPAT_BIT_SCAN(_BitScanForward64, unsigned long long, __builtin_ctzll(Mask))
+COMPAT_BIT_SCAN(_BitScanReverse64, unsigned long long, 63 - __builtin_clzll(Mask))
+
+#ifdef __cpuid
+#undef __cpuid
+#endif
+
+//
+// Recent cpuid.h declare their own __cpuidex(), renamed away.
+//
+#define __cpuidex CompatCpuidEx
+#define __cpuid(Info, Function) CompatCpuidEx((Info), (Function), 0)
+
+static inline
+void
+CompatCpuidEx(
+    int Info[4],
+    int Function,
+    int SubFunction
+)
+{
+    __cpuid_count(Function, SubFunction, Info[0], Info[1], Info[2], Info[3]);
+}
+
+#endif
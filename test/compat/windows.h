@@ -0,0 +1,826 @@
+/*++
+    MoonSols Incident Response & Digital Forensics Debugging Extension
+
+    Copyright (C) 2014 MoonSols Ltd.
+    Copyright (C) 2014 Matthieu Suiche (@msuiche)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Module Name:
+
+    - windows.h
+
+Abstract:
+
+    - The subset of the Windows SDK used by the portable modules, so that they build with
+      gcc or clang for the tests. Only what the modules use is declared here.
+
+Environment:
+
+    - User mode (Linux, tests only)
+
+Revision History:
+
+    - Matthieu Suiche
+
+--*/
+
+#ifndef __COMPAT_WINDOWS_H__
+#define __COMPAT_WINDOWS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <wchar.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//
+// The C++ library does not survive the min() and max() macros below, it is included first.
+//
+#ifdef __cplusplus
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <queue>
+#include <functional>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#endif
+
+//
+// LLP64 types: LONG and ULONG are 32-bit as on Windows.
+//
+typedef void VOID, *PVOID, *LPVOID;
+typedef const void *LPCVOID;
+typedef char CHAR, *PCHAR, *PSTR, *LPSTR;
+typedef const char *PCSTR, *LPCSTR;
+typedef wchar_t WCHAR, *PWCHAR, *PWSTR, *LPWSTR;
+typedef const wchar_t *PCWSTR, *LPCWSTR;
+typedef unsigned char UCHAR, *PUCHAR, BYTE, *PBYTE, *LPBYTE, BOOLEAN, *PBOOLEAN;
+typedef short SHORT;
+typedef unsigned short USHORT, *PUSHORT, WORD, *PWORD;
+typedef int INT, BOOL;
+typedef unsigned int UINT, UINT32;
+typedef int32_t LONG, *PLONG, INT32;
+typedef uint32_t ULONG, *PULONG, DWORD, *PDWORD, *LPDWORD, ULONG32;
+typedef int64_t LONGLONG, LONG64, *PLONG64, INT64;
+typedef uint64_t ULONGLONG, ULONG64, *PULONG64, DWORD64, UINT64;
+typedef uintptr_t ULONG_PTR, SIZE_T, *PSIZE_T;
+typedef intptr_t LONG_PTR;
+typedef void *HANDLE;
+typedef LONG HRESULT;
+
+typedef union _LARGE_INTEGER {
+    struct {
+        DWORD LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef struct _GUID {
+    ULONG Data1;
+    USHORT Data2;
+    USHORT Data3;
+    UCHAR Data4[8];
+} GUID;
+
+#define TRUE 1
+#define FALSE 0
+#define CONST const
+#define IN
+#define OUT
+#define OPTIONAL
+#define CALLBACK
+#define __forceinline inline __attribute__((always_inline))
+
+#define S_OK ((HRESULT)0)
+#define E_FAIL ((HRESULT)0x80004005)
+#define SUCCEEDED(Status) ((HRESULT)(Status) >= 0)
+#define FAILED(Status) ((HRESULT)(Status) < 0)
+
+//
+// limits.h has them for a 64-bit long.
+//
+#undef LONG_MIN
+#undef LONG_MAX
+#undef ULONG_MAX
+#define LONG_MIN (-2147483647 - 1)
+#define LONG_MAX 2147483647
+#define ULONG_MAX 0xffffffffU
+
+#define MAXUSHORT 0xffff
+#define MAXULONG 0xffffffffU
+#define MAXULONG64 0xffffffffffffffffULL
+#define MAX_PATH 260
+
+#define FIELD_OFFSET(Type, Field) ((LONG)offsetof(Type, Field))
+#define UNREFERENCED_PARAMETER(Parameter) ((void)(Parameter))
+#define RtlZeroMemory(Destination, Length) memset((Destination), 0, (Length))
+#define RtlCopyMemory(Destination, Source, Length) memcpy((Destination), (Source), (Length))
+#define _countof(Array) (sizeof(Array) / sizeof((Array)[0]))
+#define LOWORD(Value) ((WORD)((ULONG_PTR)(Value) & 0xffff))
+#define HIWORD(Value) ((WORD)(((ULONG_PTR)(Value) >> 16) & 0xffff))
+
+//
+// As with the SDK, both arguments may be evaluated twice.
+//
+#ifndef NOMINMAX
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+#endif
+
+//
+// Secure CRT, with the truncation and error semantics the modules rely on.
+//
+#define _TRUNCATE ((size_t)-1)
+#define STRUNCATE 80
+
+static inline
+int
+strcpy_s(
+    char *Destination,
+    size_t Size,
+    const char *Source
+)
+{
+    size_t Length = strlen(Source);
+
+    if (Length >= Size)
+    {
+        if (Size) Destination[0] = '\0';
+        return ERANGE;
+    }
+
+    memcpy(Destination, Source, Length + 1);
+    return 0;
+}
+
+static inline
+int
+wcscpy_s(
+    wchar_t *Destination,
+    size_t Size,
+    const wchar_t *Source
+)
+{
+    size_t Length = wcslen(Source);
+
+    if (Length >= Size)
+    {
+        if (Size) Destination[0] = L'\0';
+        return ERANGE;
+    }
+
+    memcpy(Destination, Source, (Length + 1) * sizeof(wchar_t));
+    return 0;
+}
+
+static inline
+int
+strncpy_s(
+    char *Destination,
+    size_t Size,
+    const char *Source,
+    size_t Count
+)
+{
+    size_t Length;
+
+    if (!Size) return EINVAL;
+
+    Length = strnlen(Source, (Count == _TRUNCATE) ? Size : Count);
+    if (Length >= Size)
+    {
+        if (Count != _TRUNCATE)
+        {
+            Destination[0] = '\0';
+            return ERANGE;
+        }
+
+        memcpy(Destination, Source, Size - 1);
+        Destination[Size - 1] = '\0';
+        return STRUNCATE;
+    }
+
+    memcpy(Destination, Source, Length);
+    Destination[Length] = '\0';
+    return 0;
+}
+
+static inline
+int
+strcat_s(
+    char *Destination,
+    size_t Size,
+    const char *Source
+)
+{
+    size_t Length = strnlen(Destination, Size);
+
+    if (Length == Size) return EINVAL;
+    return strcpy_s(Destination + Length, Size - Length, Source);
+}
+
+static inline
+size_t
+strnlen_s(
+    const char *String,
+    size_t Size
+)
+{
+    return String ? strnlen(String, Size) : 0;
+}
+
+static inline
+int
+memcpy_s(
+    void *Destination,
+    size_t Size,
+    const void *Source,
+    size_t Count
+)
+{
+    if (Count > Size)
+    {
+        memset(Destination, 0, Size);
+        return ERANGE;
+    }
+
+    memcpy(Destination, Source, Count);
+    return 0;
+}
+
+static inline
+int
+memmove_s(
+    void *Destination,
+    size_t Size,
+    const void *Source,
+    size_t Count
+)
+{
+    if (Count > Size) return ERANGE;
+
+    memmove(Destination, Source, Count);
+    return 0;
+}
+
+static inline
+int
+fopen_s(
+    FILE **File,
+    const char *Name,
+    const char *Mode
+)
+{
+    *File = fopen(Name, Mode);
+    return *File ? 0 : errno;
+}
+
+static inline
+int
+_strlwr_s(
+    char *String,
+    size_t Size
+)
+{
+    for (size_t i = 0; (i < Size) && String[i]; i += 1) String[i] = (char)tolower((unsigned char)String[i]);
+    return 0;
+}
+
+#define sprintf_s snprintf
+#define swprintf_s swprintf
+#define _snprintf_s(Buffer, Size, Count, ...) snprintf((Buffer), (Size), __VA_ARGS__)
+#define sscanf_s sscanf // Numeric conversions only, %s and %c take a size with MSVC.
+#define _fseeki64 fseeko
+#define _ftelli64 ftello
+#define _stricmp strcasecmp
+#define _strnicmp strncasecmp
+
+//
+// Synchronization and time.
+//
+typedef pthread_mutex_t CRITICAL_SECTION, *PCRITICAL_SECTION, *LPCRITICAL_SECTION;
+
+static inline
+VOID
+InitializeCriticalSection(
+    PCRITICAL_SECTION CriticalSection
+)
+{
+    pthread_mutexattr_t Attributes;
+
+    pthread_mutexattr_init(&Attributes);
+    pthread_mutexattr_settype(&Attributes, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(CriticalSection, &Attributes);
+    pthread_mutexattr_destroy(&Attributes);
+}
+
+#define DeleteCriticalSection(CriticalSection) pthread_mutex_destroy(CriticalSection)
+#define EnterCriticalSection(CriticalSection) pthread_mutex_lock(CriticalSection)
+#define LeaveCriticalSection(CriticalSection) pthread_mutex_unlock(CriticalSection)
+
+//
+// Waits with a critical section entered once, as the recursive mutex is then released.
+//
+#define INFINITE 0xFFFFFFFF
+
+typedef pthread_cond_t CONDITION_VARIABLE, *PCONDITION_VARIABLE;
+
+#define InitializeConditionVariable(ConditionVariable) pthread_cond_init((ConditionVariable), NULL)
+#define WakeConditionVariable(ConditionVariable) pthread_cond_signal(ConditionVariable)
+#define WakeAllConditionVariable(ConditionVariable) pthread_cond_broadcast(ConditionVariable)
+
+static inline
+BOOL
+SleepConditionVariableCS(
+    PCONDITION_VARIABLE ConditionVariable,
+    PCRITICAL_SECTION CriticalSection,
+    DWORD Milliseconds
+)
+{
+    struct timespec Deadline;
+
+    if (Milliseconds == INFINITE) return pthread_cond_wait(ConditionVariable, CriticalSection) == 0;
+
+    clock_gettime(CLOCK_REALTIME, &Deadline);
+    Deadline.tv_sec += Milliseconds / 1000;
+    Deadline.tv_nsec += (long)(Milliseconds % 1000) * 1000000;
+    if (Deadline.tv_nsec >= 1000000000)
+    {
+        Deadline.tv_sec += 1;
+        Deadline.tv_nsec -= 1000000000;
+    }
+
+    return pthread_cond_timedwait(ConditionVariable, CriticalSection, &Deadline) == 0;
+}
+
+static inline
+ULONGLONG
+GetTickCount64(
+)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return ((ULONGLONG)Now.tv_sec * 1000) + ((ULONGLONG)Now.tv_nsec / 1000000);
+}
+
+//
+// Files and read-only views of them. Handles of files and mappings are the file
+// descriptor plus one, views remember their size for UnmapViewOfFile().
+//
+#define INVALID_HANDLE_VALUE ((HANDLE)(LONG_PTR)-1)
+#define GENERIC_READ 0x80000000
+#define FILE_SHARE_READ 0x1
+#define FILE_SHARE_WRITE 0x2
+#define OPEN_EXISTING 3
+#define FILE_ATTRIBUTE_NORMAL 0x80
+#define PAGE_READONLY 0x2
+#define FILE_MAP_READ 0x4
+
+typedef struct _SECURITY_ATTRIBUTES *LPSECURITY_ATTRIBUTES;
+
+static inline
+HANDLE
+CreateFileA(
+    LPCSTR FileName,
+    DWORD DesiredAccess,
+    DWORD ShareMode,
+    LPSECURITY_ATTRIBUTES SecurityAttributes,
+    DWORD CreationDisposition,
+    DWORD FlagsAndAttributes,
+    HANDLE TemplateFile
+)
+{
+    int Fd;
+
+    UNREFERENCED_PARAMETER(DesiredAccess);
+    UNREFERENCED_PARAMETER(ShareMode);
+    UNREFERENCED_PARAMETER(SecurityAttributes);
+    UNREFERENCED_PARAMETER(CreationDisposition);
+    UNREFERENCED_PARAMETER(FlagsAndAttributes);
+    UNREFERENCED_PARAMETER(TemplateFile);
+
+    Fd = open(FileName, O_RDONLY);
+    return (Fd < 0) ? INVALID_HANDLE_VALUE : (HANDLE)(ULONG_PTR)(Fd + 1);
+}
+
+//
+// Paths are converted with the current locale.
+//
+static inline
+HANDLE
+CreateFileW(
+    LPCWSTR FileName,
+    DWORD DesiredAccess,
+    DWORD ShareMode,
+    LPSECURITY_ATTRIBUTES SecurityAttributes,
+    DWORD CreationDisposition,
+    DWORD FlagsAndAttributes,
+    HANDLE TemplateFile
+)
+{
+    char Path[4096];
+
+    if (wcstombs(Path, FileName, sizeof(Path)) >= sizeof(Path)) return INVALID_HANDLE_VALUE;
+
+    return CreateFileA(Path, DesiredAccess, ShareMode, SecurityAttributes, CreationDisposition, FlagsAndAttributes, TemplateFile);
+}
+
+static inline
+BOOL
+GetFileSizeEx(
+    HANDLE File,
+    PLARGE_INTEGER FileSize
+)
+{
+    struct stat Stat;
+
+    if (fstat((int)(ULONG_PTR)File - 1, &Stat)) return FALSE;
+
+    FileSize->QuadPart = Stat.st_size;
+    return TRUE;
+}
+
+static inline
+HANDLE
+CreateFileMappingA(
+    HANDLE File,
+    LPSECURITY_ATTRIBUTES SecurityAttributes,
+    DWORD Protect,
+    DWORD MaximumSizeHigh,
+    DWORD MaximumSizeLow,
+    LPCSTR Name
+)
+{
+    UNREFERENCED_PARAMETER(SecurityAttributes);
+    UNREFERENCED_PARAMETER(Protect);
+    UNREFERENCED_PARAMETER(MaximumSizeHigh);
+    UNREFERENCED_PARAMETER(MaximumSizeLow);
+    UNREFERENCED_PARAMETER(Name);
+
+    return (HANDLE)(ULONG_PTR)(dup((int)(ULONG_PTR)File - 1) + 1);
+}
+
+#define CreateFileMappingW(File, SecurityAttributes, Protect, MaximumSizeHigh, MaximumSizeLow, Name) \
+    CreateFileMappingA((File), (SecurityAttributes), (Protect), (MaximumSizeHigh), (MaximumSizeLow), NULL)
+
+static inline
+LPVOID
+MapViewOfFile(
+    HANDLE Mapping,
+    DWORD DesiredAccess,
+    DWORD FileOffsetHigh,
+    DWORD FileOffsetLow,
+    SIZE_T NumberOfBytesToMap
+)
+{
+    LARGE_INTEGER FileSize;
+    PUCHAR View;
+
+    UNREFERENCED_PARAMETER(DesiredAccess);
+    UNREFERENCED_PARAMETER(FileOffsetHigh);
+    UNREFERENCED_PARAMETER(FileOffsetLow);
+    UNREFERENCED_PARAMETER(NumberOfBytesToMap);
+
+    if (!GetFileSizeEx(Mapping, &FileSize) || (FileSize.QuadPart == 0)) return NULL;
+
+    //
+    // The size goes in the page before the view.
+    //
+    View = (PUCHAR)mmap(NULL, sysconf(_SC_PAGESIZE) + FileSize.QuadPart, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (View == MAP_FAILED) return NULL;
+
+    *(SIZE_T *)View = (SIZE_T)FileSize.QuadPart;
+    View += sysconf(_SC_PAGESIZE);
+
+    if (mmap(View, (SIZE_T)FileSize.QuadPart, PROT_READ, MAP_PRIVATE | MAP_FIXED, (int)(ULONG_PTR)Mapping - 1, 0) == MAP_FAILED)
+    {
+        munmap(View - sysconf(_SC_PAGESIZE), sysconf(_SC_PAGESIZE) + FileSize.QuadPart);
+        return NULL;
+    }
+
+    return View;
+}
+
+static inline
+BOOL
+UnmapViewOfFile(
+    LPCVOID View
+)
+{
+    PUCHAR Base = (PUCHAR)View - sysconf(_SC_PAGESIZE);
+
+    return munmap(Base, sysconf(_SC_PAGESIZE) + *(SIZE_T *)Base) == 0;
+}
+
+static inline
+BOOL
+CloseHandle(
+    HANDLE Handle
+)
+{
+    return close((int)(ULONG_PTR)Handle - 1) == 0;
+}
+
+//
+// PE image format.
+//
+#define IMAGE_DOS_SIGNATURE 0x5A4D
+#define IMAGE_NT_SIGNATURE 0x00004550
+#define IMAGE_NT_OPTIONAL_HDR32_MAGIC 0x10b
+#define IMAGE_NT_OPTIONAL_HDR64_MAGIC 0x20b
+#define IMAGE_NUMBEROF_DIRECTORY_ENTRIES 16
+#define IMAGE_SIZEOF_SHORT_NAME 8
+
+#define IMAGE_DIRECTORY_ENTRY_EXPORT 0
+#define IMAGE_DIRECTORY_ENTRY_IMPORT 1
+#define IMAGE_DIRECTORY_ENTRY_RESOURCE 2
+#define IMAGE_DIRECTORY_ENTRY_EXCEPTION 3
+#define IMAGE_DIRECTORY_ENTRY_SECURITY 4
+#define IMAGE_DIRECTORY_ENTRY_BASERELOC 5
+#define IMAGE_DIRECTORY_ENTRY_DEBUG 6
+#define IMAGE_DIRECTORY_ENTRY_TLS 9
+#define IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG 10
+#define IMAGE_DIRECTORY_ENTRY_IAT 12
+
+#define IMAGE_SCN_CNT_CODE 0x00000020
+#define IMAGE_SCN_CNT_INITIALIZED_DATA 0x00000040
+#define IMAGE_SCN_MEM_DISCARDABLE 0x02000000
+#define IMAGE_SCN_MEM_EXECUTE 0x20000000
+#define IMAGE_SCN_MEM_READ 0x40000000
+#define IMAGE_SCN_MEM_WRITE 0x80000000
+
+#define IMAGE_DEBUG_TYPE_CODEVIEW 2
+
+#pragma pack(push, 2)
+typedef struct _IMAGE_DOS_HEADER {
+    WORD e_magic;
+    WORD e_cblp;
+    WORD e_cp;
+    WORD e_crlc;
+    WORD e_cparhdr;
+    WORD e_minalloc;
+    WORD e_maxalloc;
+    WORD e_ss;
+    WORD e_sp;
+    WORD e_csum;
+    WORD e_ip;
+    WORD e_cs;
+    WORD e_lfarlc;
+    WORD e_ovno;
+    WORD e_res[4];
+    WORD e_oemid;
+    WORD e_oeminfo;
+    WORD e_res2[10];
+    LONG e_lfanew;
+} IMAGE_DOS_HEADER, *PIMAGE_DOS_HEADER;
+#pragma pack(pop)
+
+typedef struct _IMAGE_FILE_HEADER {
+    WORD Machine;
+    WORD NumberOfSections;
+    DWORD TimeDateStamp;
+    DWORD PointerToSymbolTable;
+    DWORD NumberOfSymbols;
+    WORD SizeOfOptionalHeader;
+    WORD Characteristics;
+} IMAGE_FILE_HEADER, *PIMAGE_FILE_HEADER;
+
+typedef struct _IMAGE_DATA_DIRECTORY {
+    DWORD VirtualAddress;
+    DWORD Size;
+} IMAGE_DATA_DIRECTORY, *PIMAGE_DATA_DIRECTORY;
+
+typedef struct _IMAGE_OPTIONAL_HEADER {
+    WORD Magic;
+    BYTE MajorLinkerVersion;
+    BYTE MinorLinkerVersion;
+    DWORD SizeOfCode;
+    DWORD SizeOfInitializedData;
+    DWORD SizeOfUninitializedData;
+    DWORD AddressOfEntryPoint;
+    DWORD BaseOfCode;
+    DWORD BaseOfData;
+    DWORD ImageBase;
+    DWORD SectionAlignment;
+    DWORD FileAlignment;
+    WORD MajorOperatingSystemVersion;
+    WORD MinorOperatingSystemVersion;
+    WORD MajorImageVersion;
+    WORD MinorImageVersion;
+    WORD MajorSubsystemVersion;
+    WORD MinorSubsystemVersion;
+    DWORD Win32VersionValue;
+    DWORD SizeOfImage;
+    DWORD SizeOfHeaders;
+    DWORD CheckSum;
+    WORD Subsystem;
+    WORD DllCharacteristics;
+    DWORD SizeOfStackReserve;
+    DWORD SizeOfStackCommit;
+    DWORD SizeOfHeapReserve;
+    DWORD SizeOfHeapCommit;
+    DWORD LoaderFlags;
+    DWORD NumberOfRvaAndSizes;
+    IMAGE_DATA_DIRECTORY DataDirectory[IMAGE_NUMBEROF_DIRECTORY_ENTRIES];
+} IMAGE_OPTIONAL_HEADER32, *PIMAGE_OPTIONAL_HEADER32;
+
+typedef struct _IMAGE_OPTIONAL_HEADER64 {
+    WORD Magic;
+    BYTE MajorLinkerVersion;
+    BYTE MinorLinkerVersion;
+    DWORD SizeOfCode;
+    DWORD SizeOfInitializedData;
+    DWORD SizeOfUninitializedData;
+    DWORD AddressOfEntryPoint;
+    DWORD BaseOfCode;
+    ULONGLONG ImageBase;
+    DWORD SectionAlignment;
+    DWORD FileAlignment;
+    WORD MajorOperatingSystemVersion;
+    WORD MinorOperatingSystemVersion;
+    WORD MajorImageVersion;
+    WORD MinorImageVersion;
+    WORD MajorSubsystemVersion;
+    WORD MinorSubsystemVersion;
+    DWORD Win32VersionValue;
+    DWORD SizeOfImage;
+    DWORD SizeOfHeaders;
+    DWORD CheckSum;
+    WORD Subsystem;
+    WORD DllCharacteristics;
+    ULONGLONG SizeOfStackReserve;
+    ULONGLONG SizeOfStackCommit;
+    ULONGLONG SizeOfHeapReserve;
+    ULONGLONG SizeOfHeapCommit;
+    DWORD LoaderFlags;
+    DWORD NumberOfRvaAndSizes;
+    IMAGE_DATA_DIRECTORY DataDirectory[IMAGE_NUMBEROF_DIRECTORY_ENTRIES];
+} IMAGE_OPTIONAL_HEADER64, *PIMAGE_OPTIONAL_HEADER64;
+
+typedef struct _IMAGE_NT_HEADERS {
+    DWORD Signature;
+    IMAGE_FILE_HEADER FileHeader;
+    IMAGE_OPTIONAL_HEADER32 OptionalHeader;
+} IMAGE_NT_HEADERS32, *PIMAGE_NT_HEADERS32;
+
+typedef struct _IMAGE_NT_HEADERS64 {
+    DWORD Signature;
+    IMAGE_FILE_HEADER FileHeader;
+    IMAGE_OPTIONAL_HEADER64 OptionalHeader;
+} IMAGE_NT_HEADERS64, *PIMAGE_NT_HEADERS64;
+
+typedef struct _IMAGE_SECTION_HEADER {
+    BYTE Name[IMAGE_SIZEOF_SHORT_NAME];
+    union {
+        DWORD PhysicalAddress;
+        DWORD VirtualSize;
+    } Misc;
+    DWORD VirtualAddress;
+    DWORD SizeOfRawData;
+    DWORD PointerToRawData;
+    DWORD PointerToRelocations;
+    DWORD PointerToLinenumbers;
+    WORD NumberOfRelocations;
+    WORD NumberOfLinenumbers;
+    DWORD Characteristics;
+} IMAGE_SECTION_HEADER, *PIMAGE_SECTION_HEADER;
+
+typedef struct _IMAGE_DEBUG_DIRECTORY {
+    DWORD Characteristics;
+    DWORD TimeDateStamp;
+    WORD MajorVersion;
+    WORD MinorVersion;
+    DWORD Type;
+    DWORD SizeOfData;
+    DWORD AddressOfRawData;
+    DWORD PointerToRawData;
+} IMAGE_DEBUG_DIRECTORY, *PIMAGE_DEBUG_DIRECTORY;
+
+#define IMAGE_FIRST_SECTION(NtHeader) ((PIMAGE_SECTION_HEADER)((ULONG_PTR)(NtHeader) + \
+    FIELD_OFFSET(IMAGE_NT_HEADERS32, OptionalHeader) + ((NtHeader))->FileHeader.SizeOfOptionalHeader))
+
+typedef struct _IMAGE_EXPORT_DIRECTORY {
+    DWORD Characteristics;
+    DWORD TimeDateStamp;
+    WORD MajorVersion;
+    WORD MinorVersion;
+    DWORD Name;
+    DWORD Base;
+    DWORD NumberOfFunctions;
+    DWORD NumberOfNames;
+    DWORD AddressOfFunctions;
+    DWORD AddressOfNames;
+    DWORD AddressOfNameOrdinals;
+} IMAGE_EXPORT_DIRECTORY, *PIMAGE_EXPORT_DIRECTORY;
+
+typedef struct _IMAGE_IMPORT_DESCRIPTOR {
+    union {
+        DWORD Characteristics;
+        DWORD OriginalFirstThunk;
+    };
+    DWORD TimeDateStamp;
+    DWORD ForwarderChain;
+    DWORD Name;
+    DWORD FirstThunk;
+} IMAGE_IMPORT_DESCRIPTOR, *PIMAGE_IMPORT_DESCRIPTOR;
+
+typedef struct _IMAGE_IMPORT_BY_NAME {
+    WORD Hint;
+    CHAR Name[1];
+} IMAGE_IMPORT_BY_NAME, *PIMAGE_IMPORT_BY_NAME;
+
+#define IMAGE_ORDINAL_FLAG32 0x80000000
+#define IMAGE_ORDINAL_FLAG64 0x8000000000000000ULL
+#define IMAGE_ORDINAL64(Ordinal) ((Ordinal) & 0xffff)
+#define IMAGE_ORDINAL32(Ordinal) ((Ordinal) & 0xffff)
+
+typedef struct _IMAGE_BASE_RELOCATION {
+    DWORD VirtualAddress;
+    DWORD SizeOfBlock;
+} IMAGE_BASE_RELOCATION, *PIMAGE_BASE_RELOCATION;
+
+#define IMAGE_REL_BASED_ABSOLUTE 0
+#define IMAGE_REL_BASED_HIGH 1
+#define IMAGE_REL_BASED_LOW 2
+#define IMAGE_REL_BASED_HIGHLOW 3
+#define IMAGE_REL_BASED_DIR64 10
+
+typedef struct _IMAGE_RESOURCE_DIRECTORY {
+    DWORD Characteristics;
+    DWORD TimeDateStamp;
+    WORD MajorVersion;
+    WORD MinorVersion;
+    WORD NumberOfNamedEntries;
+    WORD NumberOfIdEntries;
+} IMAGE_RESOURCE_DIRECTORY, *PIMAGE_RESOURCE_DIRECTORY;
+
+typedef struct _IMAGE_RESOURCE_DIRECTORY_ENTRY {
+    union {
+        struct {
+            DWORD NameOffset : 31;
+            DWORD NameIsString : 1;
+        };
+        DWORD Name;
+        WORD Id;
+    };
+    union {
+        DWORD OffsetToData;
+        struct {
+            DWORD OffsetToDirectory : 31;
+            DWORD DataIsDirectory : 1;
+        };
+    };
+} IMAGE_RESOURCE_DIRECTORY_ENTRY, *PIMAGE_RESOURCE_DIRECTORY_ENTRY;
+
+typedef struct _IMAGE_RESOURCE_DATA_ENTRY {
+    DWORD OffsetToData;
+    DWORD Size;
+    DWORD CodePage;
+    DWORD Reserved;
+} IMAGE_RESOURCE_DATA_ENTRY, *PIMAGE_RESOURCE_DATA_ENTRY;
+
+//
+// MAKEINTRESOURCE() values, the modules only use them as integers.
+//
+#define RT_VERSION 16
+#define VS_VERSION_INFO 1
+
+#endif